@@ -0,0 +1,106 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// third party
+#include <gtsam/config.h>
+#include <gtsam/nonlinear/LevenbergMarquardtOptimizer.h>
+#include <gtsam/nonlinear/Marginals.h>
+#ifdef _USE_TBB_
+#include <tbb/task_arena.h>
+#endif
+// local
+#include "back_end/batch_optimization.h"
+#include "common/macro_defines.h"
+#include "common/metrics.h"
+
+namespace static_map {
+namespace back_end {
+
+namespace {
+
+// run func with the parallel parts in it limited to the threads
+template <typename Func>
+void RunWithThreads(const int threads, Func &&func) {
+#ifdef _USE_TBB_
+  if (threads > 0) {
+    tbb::task_arena arena(threads);
+    arena.execute(func);
+    return;
+  }
+#endif
+  func();
+}
+
+}  // namespace
+
+gtsam::Values BatchOptimize(const gtsam::NonlinearFactorGraph &graph,
+                            const gtsam::Values &initial,
+                            const FinalOptimizationOptions &options) {
+  static common::Histogram *const latency =
+      common::MetricsRegistry::Get()->GetHistogram("back_end.final_batch");
+  common::ScopedLatency scoped_latency(latency);
+
+  gtsam::LevenbergMarquardtParams params;
+  if (options.metis_ordering) {
+#ifdef GTSAM_SUPPORT_NESTED_DISSECTION
+    params.orderingType = gtsam::Ordering::METIS;
+#else
+    PRINT_WARNING("gtsam is built without METIS, use COLAMD instead.");
+#endif
+  }
+  gtsam::Values result;
+  RunWithThreads(options.threads, [&]() {
+    gtsam::LevenbergMarquardtOptimizer optimizer(graph, initial, params);
+    result = optimizer.optimize();
+  });
+  PRINT_INFO_FMT("Final batch optimization: error %lf -> %lf",
+                 graph.error(initial), graph.error(result));
+  return result;
+}
+
+std::map<gtsam::Key, gtsam::Matrix> MarginalCovariances(
+    const gtsam::NonlinearFactorGraph &graph, const gtsam::Values &values,
+    const std::vector<gtsam::Key> &keys,
+    const FinalOptimizationOptions &options) {
+  std::map<gtsam::Key, gtsam::Matrix> covariances;
+  std::vector<gtsam::Key> existing_keys;
+  for (const auto key : keys) {
+    if (values.exists(key)) {
+      existing_keys.push_back(key);
+    }
+  }
+  if (existing_keys.empty()) {
+    return covariances;
+  }
+  RunWithThreads(options.threads, [&]() {
+    // one elimination, then the marginal of each key is recovered from the
+    // bayes tree, without the covariances of the other variables
+    gtsam::Marginals marginals(graph, values, gtsam::Marginals::CHOLESKY);
+    for (const auto key : existing_keys) {
+      covariances[key] = marginals.marginalCovariance(key);
+    }
+  });
+  return covariances;
+}
+
+}  // namespace back_end
+}  // namespace static_map
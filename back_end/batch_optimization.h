@@ -0,0 +1,70 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef BACK_END_BATCH_OPTIMIZATION_H_
+#define BACK_END_BATCH_OPTIMIZATION_H_
+
+// third party
+#include <gtsam/inference/Key.h>
+#include <gtsam/nonlinear/NonlinearFactorGraph.h>
+#include <gtsam/nonlinear/Values.h>
+// stl
+#include <map>
+#include <vector>
+
+namespace static_map {
+namespace back_end {
+
+struct FinalOptimizationOptions {
+  // a batch Levenberg-Marquardt on the whole graph after the incremental
+  // one, from its estimate
+  bool enable_batch = false;
+  // threads of the parallel elimination, <= 0 for all
+  int threads = 0;
+  // nested dissection ordering if gtsam is built with METIS, else COLAMD
+  bool metis_ordering = true;
+  // the marginal covariances of the calibration variables (odom to lidar,
+  // gps coordinate) only, instead of all the poses
+  bool calibration_covariance = false;
+  // of the multi-trajectory graph only, > 0 for the hierarchical solve in
+  // clusters of this size (m, on xy) instead of the whole graph at once,
+  // see HierarchicalOptimizer, it replaces the batch one
+  double cluster_size = 0.;
+};
+
+/// @brief the final batch solve of the graph, with the elimination limited
+/// to options.threads
+gtsam::Values BatchOptimize(const gtsam::NonlinearFactorGraph &graph,
+                            const gtsam::Values &initial,
+                            const FinalOptimizationOptions &options);
+
+/// @brief the marginal covariances of the keys only, the keys not in the
+/// values are skipped
+std::map<gtsam::Key, gtsam::Matrix> MarginalCovariances(
+    const gtsam::NonlinearFactorGraph &graph, const gtsam::Values &values,
+    const std::vector<gtsam::Key> &keys,
+    const FinalOptimizationOptions &options);
+
+}  // namespace back_end
+}  // namespace static_map
+
+#endif  // BACK_END_BATCH_OPTIMIZATION_H_
@@ -0,0 +1,120 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+// third party
+#include <gtsam/base/Matrix.h>
+#include <gtsam/base/Vector.h>
+#include <gtsam/geometry/Point3.h>
+#include <gtsam/geometry/Pose3.h>
+#include <gtsam/nonlinear/NonlinearFactor.h>
+// stl
+#include <string>
+
+namespace static_map {
+namespace back_end {
+
+/*
+ * @class GpsLeverArmFactor
+ * @brief the utm of the gps antenna on a pose, through the map origin in
+ * gps coord and the lever arm from the tracking frame to the antenna
+ * error = coord * pose * lever_arm - utm, with the analytic jacobians, it
+ * equals the expression factor of transform_from(compose(coord, pose),
+ * lever_arm) without its allocations in each linearization
+ */
+class GpsLeverArmFactor
+    : public gtsam::NoiseModelFactor2<gtsam::Pose3 /* gps coord */,
+                                      gtsam::Pose3 /* tracking pose */> {
+ protected:
+  gtsam::Point3 measured_;
+  gtsam::Point3 lever_arm_;
+
+ public:
+  typedef GpsLeverArmFactor This;
+  typedef gtsam::NoiseModelFactor2<gtsam::Pose3, gtsam::Pose3> Base;
+  typedef boost::shared_ptr<This> shared_ptr;
+
+  GpsLeverArmFactor(const gtsam::Point3& utm, const gtsam::Point3& lever_arm,
+                    const gtsam::SharedNoiseModel& model,
+                    gtsam::Key coordKey, gtsam::Key poseKey)
+      : Base(model, coordKey, poseKey),
+        measured_(utm),
+        lever_arm_(lever_arm) {}
+  GpsLeverArmFactor() {}
+
+  virtual ~GpsLeverArmFactor() {}
+
+  /// @return a deep copy of this factor
+  virtual gtsam::NonlinearFactor::shared_ptr clone() const {
+    return boost::static_pointer_cast<gtsam::NonlinearFactor>(
+        gtsam::NonlinearFactor::shared_ptr(new This(*this)));
+  }
+
+  void print(const std::string& s = "GpsLeverArmFactor",
+             const gtsam::KeyFormatter& keyFormatter =
+                 gtsam::DefaultKeyFormatter) const {
+    Base::print(s, keyFormatter);
+    gtsam::traits<gtsam::Point3>::Print(measured_, s + ".z");
+    gtsam::traits<gtsam::Point3>::Print(lever_arm_, s + ".lever_arm");
+  }
+
+  bool equals(const gtsam::NonlinearFactor& p, double tol = 1e-9) const {
+    const This* e = dynamic_cast<const This*>(&p);
+    return e && Base::equals(p, tol) &&
+           gtsam::traits<gtsam::Point3>::Equals(measured_, e->measured_,
+                                                tol) &&
+           gtsam::traits<gtsam::Point3>::Equals(lever_arm_, e->lever_arm_,
+                                                tol);
+  }
+
+  /** h(x)-z */
+  gtsam::Vector evaluateError(
+      const gtsam::Pose3& coord, const gtsam::Pose3& pose,
+      boost::optional<gtsam::Matrix&> H1 = boost::none,
+      boost::optional<gtsam::Matrix&> H2 = boost::none) const {
+    const gtsam::Matrix3 pose_rotation = pose.rotation().matrix();
+    const gtsam::Matrix3 coord_rotation = coord.rotation().matrix();
+    // the antenna in the map frame
+    const gtsam::Vector3 antenna =
+        pose_rotation * gtsam::Vector3(lever_arm_) +
+        gtsam::Vector3(pose.translation());
+    // the poses are perturbed on the right, T * Exp([omega, v])
+    if (H1) {
+      H1->resize(3, 6);
+      H1->leftCols<3>() = -coord_rotation * gtsam::skewSymmetric(antenna);
+      H1->rightCols<3>() = coord_rotation;
+    }
+    if (H2) {
+      const gtsam::Matrix3 rotation = coord_rotation * pose_rotation;
+      H2->resize(3, 6);
+      H2->leftCols<3>() =
+          -rotation * gtsam::skewSymmetric(gtsam::Vector3(lever_arm_));
+      H2->rightCols<3>() = rotation;
+    }
+    return coord_rotation * antenna + gtsam::Vector3(coord.translation()) -
+           gtsam::Vector3(measured_);
+  }
+};
+
+}  // namespace back_end
+}  // namespace static_map
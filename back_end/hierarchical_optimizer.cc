@@ -0,0 +1,233 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// third party
+#include <gtsam/nonlinear/ExpressionFactorGraph.h>
+#include <gtsam/nonlinear/LevenbergMarquardtOptimizer.h>
+#include <gtsam/slam/expressions.h>
+// stl
+#include <cmath>
+// local
+#include "back_end/hierarchical_optimizer.h"
+#include "common/macro_defines.h"
+#include "common/metrics.h"
+#include "common/shared_executor.h"
+
+namespace static_map {
+namespace back_end {
+
+namespace {
+
+namespace NM = gtsam::noiseModel;
+using gtsam::Pose3;
+using gtsam::Pose3_;
+
+// fixes a cluster at its anchor, the relative poses do not depend on it
+constexpr double kAnchorSigma = 1.e-6;
+
+int FindRoot(const int i, std::vector<int> *const parents) {
+  int root = i;
+  while ((*parents)[root] != root) {
+    root = (*parents)[root];
+  }
+  for (int j = i; (*parents)[j] != root;) {
+    const int next = (*parents)[j];
+    (*parents)[j] = root;
+    j = next;
+  }
+  return root;
+}
+
+}  // namespace
+
+HierarchicalOptimizer::HierarchicalOptimizer(
+    const FinalOptimizationOptions &options)
+    : options_(options) {
+  CHECK_GT(options_.cluster_size, 0.);
+}
+
+gtsam::Values HierarchicalOptimizer::Optimize(
+    const std::vector<PoseGraphEdge> &edges,
+    const std::vector<PosePrior> &priors, const gtsam::Values &initial) {
+  static common::Histogram *const latency =
+      common::MetricsRegistry::Get()->GetHistogram(
+          "back_end.final_hierarchical");
+  static common::Gauge *const cluster_gauge =
+      common::MetricsRegistry::Get()->GetGauge(
+          "back_end.hierarchical.clusters");
+  static common::Gauge *const solved_gauge =
+      common::MetricsRegistry::Get()->GetGauge(
+          "back_end.hierarchical.solved_clusters");
+  common::ScopedLatency scoped_latency(latency);
+
+  // step1 the cells of the poses, then the parts of each cell connected by
+  // the edges inside it
+  const gtsam::KeyVector keys = initial.keys();
+  std::map<gtsam::Key, int> key_indices;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    key_indices[keys[i]] = i;
+    if (!key_cells_.count(keys[i])) {
+      const Pose3 &pose = initial.at<Pose3>(keys[i]);
+      key_cells_[keys[i]] = std::make_pair(
+          static_cast<int>(std::floor(pose.x() / options_.cluster_size)),
+          static_cast<int>(std::floor(pose.y() / options_.cluster_size)));
+    }
+  }
+  std::vector<int> parents(keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    parents[i] = i;
+  }
+  for (const auto &edge : edges) {
+    if (key_cells_.at(edge.target) == key_cells_.at(edge.source)) {
+      parents[FindRoot(key_indices.at(edge.target), &parents)] =
+          FindRoot(key_indices.at(edge.source), &parents);
+    }
+  }
+  // the keys are sorted, so the anchor of a cluster is its smallest key
+  std::map<int /*root*/, Cluster> clusters_by_root;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    clusters_by_root[FindRoot(i, &parents)].keys.push_back(keys[i]);
+  }
+  std::vector<size_t> outer_edges;
+  for (size_t i = 0; i < edges.size(); ++i) {
+    const int target_root = FindRoot(key_indices.at(edges[i].target), &parents);
+    if (target_root == FindRoot(key_indices.at(edges[i].source), &parents)) {
+      clusters_by_root[target_root].edges.push_back(i);
+    } else {
+      outer_edges.push_back(i);
+    }
+  }
+
+  // step2 the clusters which changed are solved again, in parallel
+  std::map<gtsam::Key, Cluster> clusters;
+  std::vector<Cluster *> changed_clusters;
+  std::map<gtsam::Key, gtsam::Key> anchors;
+  for (auto &root_cluster : clusters_by_root) {
+    Cluster &cluster = root_cluster.second;
+    const gtsam::Key anchor = cluster.keys.front();
+    for (const gtsam::Key key : cluster.keys) {
+      anchors[key] = anchor;
+    }
+    const auto solved = solved_clusters_.find(anchor);
+    if (solved != solved_clusters_.end() &&
+        solved->second.keys == cluster.keys &&
+        solved->second.edges == cluster.edges) {
+      cluster.relative_poses.swap(solved->second.relative_poses);
+    }
+    Cluster &new_cluster = clusters[anchor];
+    new_cluster = std::move(cluster);
+    if (new_cluster.relative_poses.empty()) {
+      changed_clusters.push_back(&new_cluster);
+    }
+  }
+  const int threads = options_.threads > 0
+                          ? options_.threads
+                          : common::SharedExecutor::ThreadNum();
+  common::ParallelFor(0, changed_clusters.size(), threads, [&](const int i) {
+    SolveCluster(edges, initial, changed_clusters[i]);
+  });
+  cluster_gauge->Set(clusters.size());
+  solved_gauge->Set(changed_clusters.size());
+  PRINT_INFO_FMT("Hierarchical optimization: %lu of %lu clusters solved.",
+                 changed_clusters.size(), clusters.size());
+
+  // step3 the graph of the anchors, the factors on the poses are on their
+  // anchors composed with the relative poses
+  gtsam::ExpressionFactorGraph anchor_graph;
+  gtsam::Values anchor_initial;
+  for (const auto &anchor_cluster : clusters) {
+    anchor_initial.insert(anchor_cluster.first,
+                          initial.at<Pose3>(anchor_cluster.first));
+  }
+  const auto pose_expression = [&](const gtsam::Key key) {
+    const gtsam::Key anchor = anchors.at(key);
+    return gtsam::compose(
+        Pose3_(anchor),
+        Pose3_(clusters.at(anchor).relative_poses.at<Pose3>(key)));
+  };
+  for (const size_t i : outer_edges) {
+    const auto &edge = edges[i];
+    anchor_graph.addExpressionFactor(
+        gtsam::between(pose_expression(edge.target),
+                       pose_expression(edge.source)),
+        edge.measured, edge.noise);
+  }
+  for (const auto &prior : priors) {
+    anchor_graph.addExpressionFactor(pose_expression(prior.key), prior.pose,
+                                     prior.noise);
+  }
+  gtsam::Values anchor_result = anchor_initial;
+  if (!anchor_graph.empty()) {
+    gtsam::LevenbergMarquardtOptimizer optimizer(anchor_graph, anchor_initial);
+    anchor_result = optimizer.optimize();
+    PRINT_INFO_FMT("Graph of %lu anchors: error %lf -> %lf",
+                   anchor_initial.size(), anchor_graph.error(anchor_initial),
+                   anchor_graph.error(anchor_result));
+  }
+
+  // step4 the anchors to the poses
+  gtsam::Values result;
+  for (const auto &anchor_cluster : clusters) {
+    const Pose3 &anchor_pose = anchor_result.at<Pose3>(anchor_cluster.first);
+    const Cluster &cluster = anchor_cluster.second;
+    for (const gtsam::Key key : cluster.keys) {
+      result.insert(key, anchor_pose.compose(
+                             cluster.relative_poses.at<Pose3>(key)));
+    }
+  }
+  solved_clusters_.swap(clusters);
+  return result;
+}
+
+void HierarchicalOptimizer::SolveCluster(
+    const std::vector<PoseGraphEdge> &edges, const gtsam::Values &initial,
+    Cluster *const cluster) const {
+  CHECK(cluster && !cluster->keys.empty());
+  const gtsam::Key anchor = cluster->keys.front();
+  cluster->relative_poses.clear();
+  if (cluster->keys.size() == 1) {
+    cluster->relative_poses.insert(anchor, Pose3());
+    return;
+  }
+  gtsam::ExpressionFactorGraph graph;
+  gtsam::Values values;
+  for (const gtsam::Key key : cluster->keys) {
+    values.insert(key, initial.at<Pose3>(key));
+  }
+  for (const size_t i : cluster->edges) {
+    graph.addExpressionFactor(
+        gtsam::between(Pose3_(edges[i].target), Pose3_(edges[i].source)),
+        edges[i].measured, edges[i].noise);
+  }
+  graph.addExpressionFactor(Pose3_(anchor), initial.at<Pose3>(anchor),
+                            NM::Isotropic::Sigma(6, kAnchorSigma));
+  gtsam::LevenbergMarquardtOptimizer optimizer(graph, values);
+  const gtsam::Values result = optimizer.optimize();
+  const Pose3 &anchor_pose = result.at<Pose3>(anchor);
+  for (const gtsam::Key key : cluster->keys) {
+    cluster->relative_poses.insert(key,
+                                   anchor_pose.between(result.at<Pose3>(key)));
+  }
+}
+
+}  // namespace back_end
+}  // namespace static_map
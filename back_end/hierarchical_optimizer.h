@@ -0,0 +1,100 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef BACK_END_HIERARCHICAL_OPTIMIZER_H_
+#define BACK_END_HIERARCHICAL_OPTIMIZER_H_
+
+// third party
+#include <gtsam/geometry/Pose3.h>
+#include <gtsam/inference/Key.h>
+#include <gtsam/linear/NoiseModel.h>
+#include <gtsam/nonlinear/Values.h>
+// stl
+#include <map>
+#include <utility>
+#include <vector>
+// local
+#include "back_end/batch_optimization.h"
+
+namespace static_map {
+namespace back_end {
+
+/// @brief the pose of source in target
+struct PoseGraphEdge {
+  gtsam::Key target;
+  gtsam::Key source;
+  gtsam::Pose3 measured;
+  gtsam::noiseModel::Base::shared_ptr noise;
+};
+
+struct PosePrior {
+  gtsam::Key key;
+  gtsam::Pose3 pose;
+  gtsam::noiseModel::Base::shared_ptr noise;
+};
+
+/*
+ * @class HierarchicalOptimizer
+ * @brief the two-level solve of a pose graph of Pose3 only. the poses are
+ * clustered by their xy in the grid of options.cluster_size (a cluster is
+ * also split into the parts connected by its inner edges), every cluster is
+ * solved on its own in parallel, relative to its anchor (the smallest key),
+ * then the graph of the anchors, with the edges between the clusters and
+ * the priors through the relative poses, and the anchors are propagated to
+ * the poses. the relative poses are kept, a cluster is solved again only if
+ * its poses or inner edges changed since the last call
+ */
+class HierarchicalOptimizer {
+ public:
+  explicit HierarchicalOptimizer(const FinalOptimizationOptions &options);
+
+  /// @param initial the estimate of all the poses, the keys of the edges
+  /// and priors should be in it
+  gtsam::Values Optimize(const std::vector<PoseGraphEdge> &edges,
+                         const std::vector<PosePrior> &priors,
+                         const gtsam::Values &initial);
+
+ private:
+  struct Cluster {
+    std::vector<gtsam::Key> keys;
+    // the inner edges (indices in the edges)
+    std::vector<size_t> edges;
+    // the pose of each key in the anchor (keys.front())
+    gtsam::Values relative_poses;
+  };
+
+  // the poses of the cluster in its anchor, by its inner edges
+  void SolveCluster(const std::vector<PoseGraphEdge> &edges,
+                    const gtsam::Values &initial, Cluster *cluster) const;
+
+  FinalOptimizationOptions options_;
+  // the grid cell of each key, by its pose when it is first seen, so the
+  // clusters do not change as the poses are corrected
+  std::map<gtsam::Key, std::pair<int, int>> key_cells_;
+  // the solved clusters, by their anchors
+  std::map<gtsam::Key, Cluster> solved_clusters_;
+};
+
+}  // namespace back_end
+}  // namespace static_map
+
+#endif  // BACK_END_HIERARCHICAL_OPTIMIZER_H_
@@ -23,42 +23,46 @@
 // third party
 #include <gtsam/navigation/GPSFactor.h>
 #include <gtsam/nonlinear/DoglegOptimizer.h>
+// stl
+#include <algorithm>
+#include <numeric>
+#include <sstream>
 // local
 #include "back_end/isam_optimizer.h"
 #include "back_end/odom_to_pose_factor.h"
 #include "common/make_unique.h"
 #include "common/math.h"
+#include "common/metrics.h"
+#include "common/point_types.h"
+#include "common/shared_executor.h"
+#include "common/trace.h"
 
 namespace static_map {
 namespace back_end {
 
-using gtsam::between;
-using gtsam::compose;
 using gtsam::Point3;
 using gtsam::Pose3;
-using gtsam::Pose3_;
 using gtsam::Rot3;
 namespace NM = gtsam::noiseModel;
 
-#define POSE_SYMBOL ('p')
-#define GPS_COORD_SYMBOL ('g')
-#define CALIB_SYMBOL ('c')
+#define POSE_KEY(index) (PoseKey(index))
+#define ODOM_CALIB_KEY (OdomCalibKey())
+#define GPS_COORD_KEY (GpsCoordKey())
 
-#define POSE_KEY(index) (gtsam::Symbol(POSE_SYMBOL, (index)))
-#define ODOM_CALIB_KEY (gtsam::Symbol(CALIB_SYMBOL, 0))
-#define GPS_COORD_KEY (gtsam::Symbol(GPS_COORD_SYMBOL, 0))
-
-constexpr int kGpsSkipNum = 1;
+// frames further apart are not connected by the imu factors
+constexpr double kMaxImuFactorDuration = 10.;
 
 template <typename PointT>
 IsamOptimizer<PointT>::IsamOptimizer(const IsamOptimizerOptions &options,
                                      const LoopDetectorSettings &l_d_setting)
     : isam_factor_graph_(new gtsam::NonlinearFactorGraph),
       loop_detector_(l_d_setting),
-      options_(options) {
+      options_(options),
+      loop_edge_pruner_(options.loop_edge_region_gap,
+                        options.replace_loop_edges) {
   gtsam::ISAM2Params parameters;
-  parameters.relinearizeThreshold = 0.01;
-  parameters.relinearizeSkip = 1;
+  parameters.relinearizeThreshold = options_.relinearize_threshold;
+  parameters.relinearizeSkip = options_.relinearize_skip;
   gtsam::ISAM2DoglegParams dogleg_param;
   dogleg_param.setVerbose(false);
   parameters.setOptimizationParams(dogleg_param);
@@ -82,13 +86,96 @@ IsamOptimizer<PointT>::IsamOptimizer(const IsamOptimizerOptions &options,
 
 template <typename PointT>
 void IsamOptimizer<PointT>::IsamUpdate(const int update_time) {
+  static common::Histogram *const latency =
+      common::MetricsRegistry::Get()->GetHistogram("back_end.isam_update");
+  common::ScopedLatency scoped_latency(latency);
+  common::ScopedTrace scoped_trace("back_end.isam_update");
   CHECK_GE(update_time, 1);
-  isam_->update(*isam_factor_graph_, initial_estimate_);
+  const gtsam::ISAM2Result result = isam_->update(
+      *isam_factor_graph_, initial_estimate_, removed_factor_indices_);
+  for (const auto &pending : pending_loop_factors_) {
+    loop_factor_indices_[pending.first] =
+        result.newFactorsIndices.at(pending.second);
+  }
+  pending_loop_factors_.clear();
+  removed_factor_indices_.clear();
   for (int i = 0; i < update_time; ++i) {
     isam_->update();
   }
   isam_factor_graph_->resize(0);
   initial_estimate_.clear();
+  updated_vertex_num_ = vertex_num_;
+  static common::Gauge *const factor_num =
+      common::MetricsRegistry::Get()->GetGauge("back_end.isam.factors");
+  factor_num->Set(isam_->getFactorsUnsafe().nrFactors());
+  static common::Gauge *const loop_edge_num =
+      common::MetricsRegistry::Get()->GetGauge("back_end.isam.loop_edges");
+  loop_edge_num->Set(loop_close_edges_.size());
+  if (common::MemoryAccountingEnabled()) {
+    graph_bytes_.Set(GraphBytes());
+  }
+}
+
+template <typename PointT>
+size_t IsamOptimizer<PointT>::GraphBytes() const {
+  // the factors and their cached linearization (assuming the variables have
+  // the dimension of the factors), the linearization point and the dense
+  // blocks of the bayes tree
+  size_t bytes = isam_->getLinearizationPoint().dim() * sizeof(double);
+  for (const auto &factor : isam_->getFactorsUnsafe()) {
+    if (factor) {
+      bytes += factor->dim() * (factor->dim() * factor->size() + 1) *
+               sizeof(double);
+    }
+  }
+  std::vector<gtsam::ISAM2::sharedClique> cliques(isam_->roots().begin(),
+                                                  isam_->roots().end());
+  while (!cliques.empty()) {
+    const gtsam::ISAM2::sharedClique clique = cliques.back();
+    cliques.pop_back();
+    const auto &matrix = clique->conditional()->matrixObject();
+    bytes += matrix.rows() * matrix.cols() * sizeof(double);
+    cliques.insert(cliques.end(), clique->children.begin(),
+                   clique->children.end());
+  }
+  return bytes;
+}
+
+template <typename PointT>
+void IsamOptimizer<PointT>::ScheduleIsamUpdate() {
+  if (updated_vertex_num_ == vertex_num_) {
+    return;
+  }
+  const bool batch_full =
+      vertex_num_ - updated_vertex_num_ >= options_.update_batch_size;
+  const bool batch_timeout =
+      options_.update_interval_ms > 0 &&
+      std::chrono::duration<double, std::milli>(
+          std::chrono::steady_clock::now() - batch_start_time_)
+              .count() >= options_.update_interval_ms;
+  if (!batch_full && !batch_timeout) {
+    return;
+  }
+
+  const int first_index = updated_vertex_num_;
+  IsamUpdate();
+  // the poses of the frames in the batch, the former ones are left as they
+  // were until a loop closure edge comes
+  auto &frames = loop_detector_.GetFrames();
+  gtsam::Values estimate_poses = isam_->calculateBestEstimate();
+  for (int i = first_index; i < vertex_num_; ++i) {
+    Eigen::Matrix4f pose =
+        estimate_poses.at<gtsam::Pose3>(POSE_KEY(i)).matrix().cast<float>();
+    frames[i]->SetGlobalPose(pose);
+    view_graph_.AddVertex(i, pose);
+    loop_detector_.UpdatePosition(i);
+  }
+}
+
+template <typename PointT>
+void IsamOptimizer<PointT>::AddFactor(const PoseGraphFactor &factor) {
+  AddToGraph(factor, isam_factor_graph_.get());
+  pose_graph_factors_.push_back(factor);
 }
 
 template <typename PointT>
@@ -96,16 +183,100 @@ void IsamOptimizer<PointT>::AddLoopCloseEdge(
     const int target_index, const int source_index,
     const Eigen::Matrix4f &transform_tgt_to_src,
     const NM::Base::shared_ptr &loop_close_noise) {
-  isam_factor_graph_->addExpressionFactor(
-      loop_close_noise, Pose3(transform_tgt_to_src.cast<double>()),
-      between(Pose3_(POSE_KEY(target_index)), Pose3_(POSE_KEY(source_index))));
+  LoopCloseEdge edge;
+  edge.target_index = target_index;
+  edge.source_index = source_index;
+  edge.transform = transform_tgt_to_src;
+  loop_close_edges_.push_back(edge);
+  AddFactor(MakePoseGraphFactor(PoseGraphFactor::kLoopClosure, target_index,
+                                source_index,
+                                transform_tgt_to_src.cast<double>(),
+                                loop_close_noise));
 
   auto &frames = loop_detector_.GetFrames();
   frames[target_index]->AddConnectedSubmap(frames[source_index]->GetId());
 
   view_graph_.AddEdge(target_index, source_index, transform_tgt_to_src);
+}
+
+template <typename PointT>
+int IsamOptimizer<PointT>::AddDetectedLoopCloseEdges(
+    const typename LoopDetector<PointT>::DetectResult &result) {
+  static common::Counter *const pruned_counter =
+      common::MetricsRegistry::Get()->GetCounter("back_end.loop_edges.pruned");
+  static common::Counter *const replaced_counter =
+      common::MetricsRegistry::Get()->GetCounter(
+          "back_end.loop_edges.replaced");
+  const int size = result.close_pair.size();
+  // the best ones first, so that the others of their regions are pruned
+  std::vector<int> order(size);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](const int a, const int b) {
+    return result.constraint_score[a] < result.constraint_score[b];
+  });
+  std::vector<LoopEdgePruner::Edge> replaced;
+  int added_size = 0;
+  for (const int i : order) {
+    LoopEdgePruner::Edge edge;
+    edge.target = result.close_pair[i].first;
+    edge.source = result.close_pair[i].second;
+    edge.cost = result.constraint_score[i];
+    const LoopEdgePruner::Decision decision =
+        loop_edge_pruner_.Check(edge.target, edge.source, edge.cost, &replaced);
+    if (decision == LoopEdgePruner::kPruned) {
+      pruned_counter->Add();
+      continue;
+    }
+    for (const auto &old : replaced) {
+      RemoveLoopCloseEdge(old.target, old.source);
+      replaced_counter->Add();
+    }
+    loop_edge_pruner_.Keep(edge, replaced);
+    if (options_.replace_loop_edges) {
+      pending_loop_factors_.emplace_back(
+          std::make_pair(edge.target, edge.source), isam_factor_graph_->size());
+    }
+    AddLoopCloseEdge(edge.target, edge.source, result.transform[i],
+                     loop_closure_noise_model_);
+    added_size++;
+  }
+  return added_size;
+}
+
+template <typename PointT>
+void IsamOptimizer<PointT>::RemoveLoopCloseEdge(const int target_index,
+                                                const int source_index) {
+  const auto pair = std::make_pair(target_index, source_index);
+  if (!loop_factor_indices_.count(pair)) {
+    // added in this batch, in the graph once updated
+    IsamUpdate();
+  }
+  const auto found = loop_factor_indices_.find(pair);
+  CHECK(found != loop_factor_indices_.end());
+  removed_factor_indices_.push_back(found->second);
+  loop_factor_indices_.erase(found);
+
+  loop_close_edges_.erase(
+      std::find_if(loop_close_edges_.begin(), loop_close_edges_.end(),
+                   [&](const LoopCloseEdge &edge) {
+                     return edge.target_index == target_index &&
+                            edge.source_index == source_index;
+                   }));
+  pose_graph_factors_.erase(std::find_if(
+      pose_graph_factors_.begin(), pose_graph_factors_.end(),
+      [&](const PoseGraphFactor &factor) {
+        return factor.type == PoseGraphFactor::kLoopClosure &&
+               factor.first == target_index && factor.second == source_index;
+      }));
+  // the view graph and the connections of the submaps keep it, they are
+  // for the visualization only
+}
+
+template <typename PointT>
+void IsamOptimizer<PointT>::UpdateAllPoses() {
   IsamUpdate(2);
 
+  auto &frames = loop_detector_.GetFrames();
   gtsam::Values estimate_poses = isam_->calculateEstimate();
   const int frames_size = frames.size();
   for (int i = 0; i < frames_size; ++i) {
@@ -114,6 +285,37 @@ void IsamOptimizer<PointT>::AddLoopCloseEdge(
     frames[i]->SetGlobalPose(pose);
     view_graph_.AddVertex(i, pose);
   }
+  loop_detector_.UpdatePositions();
+}
+
+template <typename PointT>
+void IsamOptimizer<PointT>::AddFinishedLoopClosings(const bool wait_all) {
+  int edge_size = 0;
+  while (!pending_loop_closings_.empty()) {
+    auto &pending = pending_loop_closings_.front();
+    const bool must_wait =
+        wait_all || static_cast<int>(pending_loop_closings_.size()) >
+                        options_.max_pending_loop_closings;
+    if (!must_wait && pending.done.wait_for(std::chrono::seconds(0)) !=
+                          std::future_status::ready) {
+      break;
+    }
+    pending.done.get();
+    typename LoopDetector<PointT>::DetectResult result;
+    loop_detector_.CollectLoopClosing(*pending.task, &result);
+    edge_size += AddDetectedLoopCloseEdges(result);
+    pending_loop_closings_.pop_front();
+  }
+  // all in one update
+  if (edge_size > 0) {
+    UpdateAllPoses();
+    PRINT_INFO_FMT(BOLD "Add %d loop closure edges." NONE_FORMAT, edge_size);
+  }
+}
+
+template <typename PointT>
+void IsamOptimizer<PointT>::FlushLoopClosings() {
+  AddFinishedLoopClosings(true);
 }
 
 template <typename PointT>
@@ -126,54 +328,130 @@ void IsamOptimizer<PointT>::AddVertex(
   gtsam::Pose3 pose_from_gtsam =
       gtsam::Pose3(transform_from_last_pose.cast<double>());
   initial_estimate_.insert(POSE_KEY(index), pose_gtsam);
+  if (updated_vertex_num_ == vertex_num_) {
+    batch_start_time_ = std::chrono::steady_clock::now();
+  }
+  CHECK_EQ(index, vertex_num_);
+  vertex_num_ = index + 1;
   view_graph_.AddVertex(index, pose);
   if (index == 0) {
-    isam_factor_graph_->addExpressionFactor(prior_noise_model_, pose_gtsam,
-                                            Pose3_(POSE_KEY(index)));
+    AddFactor(MakePoseGraphFactor(PoseGraphFactor::kPosePrior, index, -1,
+                                  pose_gtsam.matrix(), prior_noise_model_));
     if (options_.use_odom) {
       Eigen::Vector6<float> tf_6d =
           common::TransformToVector6(tf_odom_lidar_.inverse().eval());
       Pose3 odom_tf = Pose3(Rot3::RzRyRx(tf_6d[3], tf_6d[4], tf_6d[5]),
                             Point3(tf_6d[0], tf_6d[1], tf_6d[2]));
       initial_estimate_.insert(ODOM_CALIB_KEY, odom_tf);
-      isam_factor_graph_->addExpressionFactor(odom_tf_noise_model_, odom_tf,
-                                              Pose3_(ODOM_CALIB_KEY));
+      AddFactor(MakePoseGraphFactor(PoseGraphFactor::kOdomCalibPrior, -1, -1,
+                                    odom_tf.matrix(), odom_tf_noise_model_));
       calib_factor_inserted_ = true;
     }
     if (options_.use_gps) {
       initial_estimate_.insert(GPS_COORD_KEY, gps_coord_transform_);
-      isam_factor_graph_->addExpressionFactor(
+      AddFactor(MakePoseGraphFactor(
+          PoseGraphFactor::kGpsCoordPrior, -1, -1,
+          gps_coord_transform_.matrix(),
           NM::Diagonal::Sigmas(
-              (gtsam::Vector(6) << 0.2, 0.2, 1.57, 2, 2, 2.).finished()),
-          gps_coord_transform_, Pose3_(GPS_COORD_KEY));
+              (gtsam::Vector(6) << 0.2, 0.2, 1.57, 2, 2, 2.).finished())));
     }
 
   } else {
-    isam_factor_graph_->addExpressionFactor(
-        odom_noise, pose_from_gtsam,
-        between(Pose3_(POSE_KEY(index - 1)), Pose3_(POSE_KEY(index))));
+    AddFactor(MakePoseGraphFactor(PoseGraphFactor::kBetween, index - 1, index,
+                                  pose_from_gtsam.matrix(), odom_noise));
 
     frames[index - 1]->AddConnectedSubmap(frames[index]->GetId());
     view_graph_.AddEdge(index - 1, index, transform_from_last_pose);
   }
-
-  IsamUpdate();
 }
 
 template <typename PointT>
 void IsamOptimizer<PointT>::AddFrame(
     const std::shared_ptr<Submap<PointT>> &frame, const double match_score) {
+  static common::Histogram *const latency =
+      common::MetricsRegistry::Get()->GetHistogram("back_end.isam_add_frame");
+  common::ScopedLatency scoped_latency(latency);
   CHECK(frame);
-  auto result = loop_detector_.AddFrame(frame, true);
-  int frame_index = static_cast<int>(loop_detector_.GetFrames().size()) - 1;
-  CHECK_GE(frame_index, 0);
+  common::TraceArgs trace_args;
+  trace_args.trajectory = frame->GetId().trajectory_index;
+  trace_args.submap = frame->GetId().submap_index;
+  common::ScopedTrace scoped_trace("back_end.isam_add_frame", trace_args);
+  // the edges found in background, before the detection of the new frame
+  // so that it sees the corrected poses
+  AddFinishedLoopClosings(false);
+  std::shared_ptr<LoopClosingTask> task;
+  if (options_.async_loop_closing) {
+    task = std::make_shared<LoopClosingTask>();
+  }
+  auto result = loop_detector_.AddFrame(frame, true, task.get());
 
   // auto odom_noise_score = -std::log(match_score);
   PRINT_DEBUG_FMT("optimizer inserting a new frame, match score: %lf",
                   match_score);
 
-  AddVertex(result.current_frame_index, frame->GlobalPose(),
-            frame->TransformFromLast(), frame_match_noise_model_);
+  AddFrameFactors(frame, result.current_frame_index);
+  // the matches to the submaps before the previous one are as certain as
+  // the one to the previous, kept with the loop edges for the checkpoints
+  for (const auto &match : frame->earlier_submap_matches_) {
+    const int target_index = result.current_frame_index -
+                             (frame->GetId().submap_index - match.submap_index);
+    if (target_index >= 0) {
+      AddLoopCloseEdge(target_index, result.current_frame_index,
+                       match.transform, frame_match_noise_model_);
+    }
+  }
+
+  // try to close loop and add constraint
+  if (result.close_succeed) {
+    const int edge_size = AddDetectedLoopCloseEdges(result);
+    if (edge_size > 0) {
+      UpdateAllPoses();
+      PRINT_INFO_FMT(BOLD "Add %d loop closure edges." NONE_FORMAT, edge_size);
+    }
+  }
+
+  ScheduleIsamUpdate();
+
+  if (task && !task->pairs.empty()) {
+    PendingLoopClosing pending;
+    pending.task = task;
+    const LoopDetector<PointT> *const detector = &loop_detector_;
+    pending.done = common::SharedExecutor::Submit(
+        common::TaskPriority::kLoopClosure,
+        [detector, task]() { detector->CloseLoop(task.get()); });
+    pending_loop_closings_.push_back(std::move(pending));
+  }
+}
+
+template <typename PointT>
+void IsamOptimizer<PointT>::RestoreFrame(
+    const std::shared_ptr<Submap<PointT>> &frame,
+    const LoopCloseEdges &loop_close_edges) {
+  CHECK(frame);
+  auto result = loop_detector_.AddFrame(frame, false);
+  AddFrameFactors(frame, result.current_frame_index);
+  for (const auto &edge : loop_close_edges) {
+    CHECK_EQ(edge.source_index, result.current_frame_index);
+    CHECK_LT(edge.target_index, edge.source_index);
+    // kept by the pruning before, they are not scored any more so that
+    // they are never replaced
+    const LoopEdgePruner::Edge kept = {edge.target_index, edge.source_index,
+                                       0.};
+    loop_edge_pruner_.Keep(kept, {});
+    AddLoopCloseEdge(edge.target_index, edge.source_index, edge.transform,
+                     loop_closure_noise_model_);
+  }
+  if (!loop_close_edges.empty()) {
+    UpdateAllPoses();
+  }
+  ScheduleIsamUpdate();
+}
+
+template <typename PointT>
+void IsamOptimizer<PointT>::AddFrameFactors(
+    const std::shared_ptr<Submap<PointT>> &frame, const int frame_index) {
+  AddVertex(frame_index, frame->GlobalPose(), frame->TransformFromLast(),
+            frame_match_noise_model_);
 
   if (options_.use_odom && frame->HasOdom()) {
     // the factor is connected to one vertex
@@ -181,56 +459,189 @@ void IsamOptimizer<PointT>::AddFrame(
     // T.inverse * lidar_pose * T = odom_pose
     // so the cost function (factor)
     // minimise || T.inverse * lidar_pose * T - odom_pose || (l2.norm)
-    auto calib_tf = Pose3_(ODOM_CALIB_KEY);
-    auto pose = Pose3_(POSE_KEY(result.current_frame_index));
-    // compose(a, b) = a * b
-    // between(a, b) = a.inverse * b
-    // so, the following expression equals to this :
-    // calib_tf.inverse * pose * calib_tf
-    auto uncalibrated = compose(between(calib_tf, pose), calib_tf);
-    isam_factor_graph_->addExpressionFactor(
-        odom_noise_model_, Pose3(frame->GetRelatedOdom()), uncalibrated);
+    AddFactor(MakePoseGraphFactor(PoseGraphFactor::kOdom, frame_index, -1,
+                                  frame->GetRelatedOdom(), odom_noise_model_));
+  }
+
+  if (options_.use_imu && frame_index > 0) {
+    AddImuFactor(frame, frame_index);
   }
 
+  const Eigen::Vector3f frame_position = frame->GlobalPose().block(0, 3, 3, 1);
+  if (frame_index > 0) {
+    gps_travelled_distance_ += (frame_position - last_frame_position_).norm();
+  }
+  last_frame_position_ = frame_position;
+
   if (options_.use_gps) {
-    if (frame->HasUtm()) {
-      isam_factor_graph_->addExpressionFactor(
-          gps_noise_model_, gtsam::Point3(frame->GetRelatedUtm()),
-          gtsam::transform_from(
-              gtsam::compose(Pose3_(GPS_COORD_KEY),  // map origin in GPS coord
-                             Pose3_(POSE_KEY(result.current_frame_index))),
-              gtsam::Point3_(gtsam::Point3(
-                  tf_tracking_gps_.block(0, 3, 3, 1).cast<double>()))));
-      accumulated_gps_count_++;
-      IsamUpdate();
-    } else {
+    static common::Counter *const decimated_gps =
+        common::MetricsRegistry::Get()->GetCounter("back_end.gps.decimated");
+    static common::Counter *const rejected_gps =
+        common::MetricsRegistry::Get()->GetCounter("back_end.gps.rejected");
+    if (!frame->HasUtm()) {
       PRINT_WARNING("No Gps related.");
+    } else if (accumulated_gps_count_ > 0 &&
+               gps_travelled_distance_ < options_.gps_min_distance) {
+      // spatial decimation, the factors of a long drive stay bounded
+      decimated_gps->Add();
+    } else if (options_.gps_max_sigma > 0. &&
+               frame->GetRelatedUtmSigma() > options_.gps_max_sigma) {
+      rejected_gps->Add();
+    } else {
+      // the utm of the gps antenna, from the map origin in GPS coord
+      Eigen::Matrix4d utm = Eigen::Matrix4d::Identity();
+      utm.block(0, 3, 3, 1) = frame->GetRelatedUtm();
+      PoseGraphFactor factor =
+          MakePoseGraphFactor(PoseGraphFactor::kGps, frame_index, -1, utm,
+                              gps_noise_model_);
+      Eigen::Map<Eigen::Vector3d>(factor.lever_arm) =
+          tf_tracking_gps_.block(0, 3, 3, 1).cast<double>();
+      AddFactor(factor);
+      accumulated_gps_count_++;
+      gps_travelled_distance_ = 0.;
     }
   }
+}
 
-  // try to close loop and add constraint
-  if (result.close_succeed) {
-    const int edge_size = result.close_pair.size();
-    for (int i = 0; i < edge_size; ++i) {
-      AddLoopCloseEdge(result.close_pair[i].first, result.close_pair[i].second,
-                       result.transform[i], loop_closure_noise_model_);
+template <typename PointT>
+void IsamOptimizer<PointT>::AddImuData(const sensors::ImuMsg &imu_data) {
+  common::MutexLocker locker(&imu_mutex_);
+  if (!imu_data_.empty() &&
+      imu_data.header.stamp <= imu_data_.back().header.stamp) {
+    return;
+  }
+  imu_data_.push_back(imu_data);
+}
+
+template <typename PointT>
+void IsamOptimizer<PointT>::AddImuFactor(
+    const std::shared_ptr<Submap<PointT>> &frame, const int frame_index) {
+  auto &frames = loop_detector_.GetFrames();
+  const auto &last_frame = frames[frame_index - 1];
+  const SimpleTime start_time = last_frame->GetTimeStamp();
+  const SimpleTime end_time = frame->GetTimeStamp();
+  const double duration = (end_time - start_time).toSec();
+  // the samples from the one before start_time to the one after end_time
+  std::vector<sensors::ImuMsg> samples;
+  {
+    common::MutexLocker locker(&imu_mutex_);
+    while (imu_data_.size() > 1 && imu_data_[1].header.stamp <= start_time) {
+      imu_data_.pop_front();
     }
-    PRINT_INFO_FMT(BOLD "Add %d loop closure edges." NONE_FORMAT, edge_size);
+    if (imu_data_.empty() || imu_data_.front().header.stamp > start_time ||
+        imu_data_.back().header.stamp < end_time) {
+      // no imu data for the restored frames, or the imu dropped out
+      return;
+    }
+    for (const auto &imu_data : imu_data_) {
+      samples.push_back(imu_data);
+      if (imu_data.header.stamp >= end_time) {
+        break;
+      }
+    }
+  }
+  if (duration <= 0. || duration > kMaxImuFactorDuration) {
+    return;
   }
 
-  gtsam::Values estimate_poses = isam_->calculateBestEstimate();
-  Eigen::Matrix4f current_pose =
-      estimate_poses.at<gtsam::Pose3>(POSE_KEY(result.current_frame_index))
-          .matrix()
-          .cast<float>();
-  frame->SetGlobalPose(current_pose);
-  view_graph_.AddVertex(frame_index, current_pose);
+  const Eigen::Matrix4d last_pose = last_frame->GlobalPose().cast<double>();
+  const Eigen::Matrix4d pose = frame->GlobalPose().cast<double>();
+  if (imu_params_ == nullptr) {
+    // gravity in the map frame, by the mean of the accelerations which is
+    // mostly the gravity, in the map frame of the last pose
+    Eigen::Vector3d mean_acc = Eigen::Vector3d::Zero();
+    for (const auto &sample : samples) {
+      mean_acc += sample.linear_acceleration.ToEigenVector();
+    }
+    mean_acc /= static_cast<double>(samples.size());
+    imu_params_ = gtsam::PreintegratedCombinedMeasurements::Params::MakeSharedU(
+        mean_acc.norm());
+    imu_params_->n_gravity = -(last_pose.block<3, 3>(0, 0) * mean_acc);
+    const gtsam::Matrix3 identity = gtsam::Matrix3::Identity();
+    imu_params_->accelerometerCovariance =
+        identity * options_.imu_acc_noise * options_.imu_acc_noise;
+    imu_params_->gyroscopeCovariance =
+        identity * options_.imu_gyro_noise * options_.imu_gyro_noise;
+    imu_params_->integrationCovariance = identity * 1.e-8;
+    imu_params_->biasAccCovariance =
+        identity * options_.imu_acc_bias_noise * options_.imu_acc_bias_noise;
+    imu_params_->biasOmegaCovariance =
+        identity * options_.imu_gyro_bias_noise * options_.imu_gyro_bias_noise;
+    std::ostringstream stream;
+    stream << imu_params_->n_gravity.transpose();
+    PRINT_INFO_FMT("gravity in map frame for imu factors: %s",
+                   stream.str().c_str());
+  }
+
+  // the measurement of a sample is held till the next one
+  gtsam::PreintegratedCombinedMeasurements preintegrated(
+      imu_params_, gtsam::imuBias::ConstantBias());
+  for (size_t i = 0; i + 1 < samples.size(); ++i) {
+    const SimpleTime begin = std::max(samples[i].header.stamp, start_time);
+    const SimpleTime end = std::min(samples[i + 1].header.stamp, end_time);
+    const double dt = (end - begin).toSec();
+    if (dt <= 0.) {
+      continue;
+    }
+    preintegrated.integrateMeasurement(
+        samples[i].linear_acceleration.ToEigenVector(),
+        samples[i].angular_velocity.ToEigenVector(), dt);
+  }
+
+  const Eigen::Vector3d velocity =
+      (pose.block<3, 1>(0, 3) - last_pose.block<3, 1>(0, 3)) / duration;
+  has_imu_state_.resize(frame_index + 1, false);
+  const auto add_imu_state = [&](const int index) {
+    initial_estimate_.insert(VelocityKey(index), gtsam::Vector3(velocity));
+    initial_estimate_.insert(ImuBiasKey(index),
+                             gtsam::imuBias::ConstantBias());
+    has_imu_state_[index] = true;
+  };
+  if (!has_imu_state_[frame_index - 1]) {
+    // the start of the imu factors, weak priors for the gauge
+    add_imu_state(frame_index - 1);
+    isam_factor_graph_->add(gtsam::PriorFactor<gtsam::Vector3>(
+        VelocityKey(frame_index - 1), gtsam::Vector3(velocity),
+        NM::Isotropic::Sigma(3, 10.)));
+    isam_factor_graph_->add(gtsam::PriorFactor<gtsam::imuBias::ConstantBias>(
+        ImuBiasKey(frame_index - 1), gtsam::imuBias::ConstantBias(),
+        NM::Diagonal::Sigmas(
+            (gtsam::Vector(6) << 0.1, 0.1, 0.1, 0.01, 0.01, 0.01).finished())));
+  }
+  add_imu_state(frame_index);
+  // not in pose_graph_factors_, the saved graph has no imu factors
+  isam_factor_graph_->add(gtsam::CombinedImuFactor(
+      PoseKey(frame_index - 1), VelocityKey(frame_index - 1),
+      PoseKey(frame_index), VelocityKey(frame_index),
+      ImuBiasKey(frame_index - 1), ImuBiasKey(frame_index), preintegrated));
 }
 
 template <typename PointT>
 int IsamOptimizer<PointT>::RunFinalOptimazation() {
+  FlushLoopClosings();
   IsamUpdate();
-  gtsam::Values estimate_poses = isam_->calculateBestEstimate();
+  const auto &final_options = options_.final_optimization_options;
+  final_estimate_ = isam_->calculateBestEstimate();
+  // the factors removed from isam (the replaced loop edges) are null in it
+  gtsam::NonlinearFactorGraph factors;
+  for (const auto &factor : isam_->getFactorsUnsafe()) {
+    if (factor) {
+      factors.push_back(factor);
+    }
+  }
+  PRINT_INFO_FMT(
+      "pose graph: %d vertices, %d factors, %d loop edges (%ld pruned, %ld "
+      "replaced)",
+      vertex_num_, static_cast<int>(factors.size()),
+      static_cast<int>(loop_close_edges_.size()),
+      static_cast<long>(
+          loop_edge_pruner_.DecisionCount(LoopEdgePruner::kPruned)),
+      static_cast<long>(
+          loop_edge_pruner_.DecisionCount(LoopEdgePruner::kReplace)));
+  if (final_options.enable_batch) {
+    final_estimate_ = BatchOptimize(factors, final_estimate_, final_options);
+  }
+  const gtsam::Values &estimate_poses = final_estimate_;
   const auto &frames = loop_detector_.GetFrames();
   const int frames_size = frames.size();
   for (int i = 0; i < frames_size; ++i) {
@@ -241,6 +652,7 @@ int IsamOptimizer<PointT>::RunFinalOptimazation() {
 
   view_graph_.SaveTextFile("pcd/graph.txt");
   view_graph_.SaveImage("pcd/graph.jpg");
+  SavePoseGraph("pcd/pose_graph.bin");
 
   if (options_.use_odom && calib_factor_inserted_) {
     // update the calibration result
@@ -252,13 +664,40 @@ int IsamOptimizer<PointT>::RunFinalOptimazation() {
     common::PrintTransform(tf_odom_lidar_);
   }
 
+  if (final_options.calibration_covariance) {
+    const auto covariances =
+        MarginalCovariances(factors, final_estimate_,
+                            {ODOM_CALIB_KEY, GPS_COORD_KEY}, final_options);
+    for (const auto &covariance : covariances) {
+      std::ostringstream stream;
+      stream << covariance.second.diagonal().cwiseSqrt().transpose();
+      PRINT_INFO_FMT("marginal sigmas of %s (rotation, translation): %s",
+                     gtsam::DefaultKeyFormatter(covariance.first).c_str(),
+                     stream.str().c_str());
+    }
+  }
+
   return frames_size;
 }
 
+template <typename PointT>
+bool IsamOptimizer<PointT>::SavePoseGraph(const std::string &filename) {
+  FlushLoopClosings();
+  if (!isam_factor_graph_->empty() || !initial_estimate_.empty()) {
+    IsamUpdate();
+  }
+  const gtsam::Values estimate = final_estimate_.empty()
+                                     ? isam_->calculateEstimate()
+                                     : final_estimate_;
+  return back_end::SavePoseGraph(filename, pose_graph_factors_, estimate);
+}
+
 template <typename PointT>
 Eigen::Matrix4d IsamOptimizer<PointT>::GetGpsCoordTransfrom() {
   if (options_.use_gps) {
-    gtsam::Values estimate_poses = isam_->calculateEstimate();
+    const gtsam::Values estimate_poses = final_estimate_.empty()
+                                             ? isam_->calculateEstimate()
+                                             : final_estimate_;
     if (estimate_poses.exists<gtsam::Pose3>(GPS_COORD_KEY)) {
       gps_coord_transform_ = estimate_poses.at<gtsam::Pose3>(GPS_COORD_KEY);
       return gps_coord_transform_.matrix();
@@ -289,6 +728,9 @@ Eigen::Matrix4f IsamOptimizer<PointT>::GetTransformTrackingToGps() {
 }
 
 template class IsamOptimizer<pcl::PointXYZI>;
+#ifdef _USE_COMPACT_POINT_
+template class IsamOptimizer<PointXYZIc>;
+#endif
 
 }  // namespace back_end
 }  // namespace static_map
@@ -26,6 +26,7 @@
 // third party
 #include <gtsam/geometry/Pose3.h>
 #include <gtsam/geometry/Rot3.h>
+#include <gtsam/navigation/CombinedImuFactor.h>
 #include <gtsam/nonlinear/ExpressionFactorGraph.h>
 #include <gtsam/nonlinear/ISAM2.h>
 #include <gtsam/nonlinear/LevenbergMarquardtOptimizer.h>
@@ -37,13 +38,25 @@
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
 // stl
+#include <chrono>
+#include <deque>
+#include <future>
+#include <map>
 #include <memory>
+#include <string>
 #include <utility>
+#include <vector>
 // local
 #include <boost/optional.hpp>
+#include "back_end/batch_optimization.h"
 #include "back_end/loop_detector.h"
+#include "back_end/loop_edge_pruner.h"
+#include "back_end/pose_graph_file.h"
 #include "back_end/view_graph.h"
+#include "builder/sensors.h"
 #include "builder/submap.h"
+#include "common/metrics.h"
+#include "common/mutex.h"
 
 namespace static_map {
 namespace back_end {
@@ -51,30 +64,96 @@ namespace back_end {
 struct IsamOptimizerOptions {
   bool use_odom = false;
   bool use_gps = false;  // not used temperorilly
+  // preintegrated imu factors between the frames, with the velocity and the
+  // bias of each frame, the imu data should be in the tracking frame
+  bool use_imu = false;
+  // continuous-time noise densities of the measurements and the random
+  // walks of the biases
+  double imu_acc_noise = 0.05;
+  double imu_gyro_noise = 0.005;
+  double imu_acc_bias_noise = 0.001;
+  double imu_gyro_bias_noise = 0.0001;
+  // the loop closing registrations run in the shared executor, and the
+  // edges are added when done, instead of blocking AddFrame()
+  bool async_loop_closing = true;
+  // AddFrame() waits for the oldest ones if more are running
+  int max_pending_loop_closings = 2;
+  // iSAM2 is updated once this many frames are added, or the first of them
+  // is added update_interval_ms ago (<= 0 for disabled), and at once
+  // for the loop closure edges
+  int update_batch_size = 5;
+  double update_interval_ms = 2000.;
+  double relinearize_threshold = 0.01;
+  int relinearize_skip = 1;
+  // of the loop edges within this gap of each other in both the target and
+  // the source indices only the best scoring one is added, < 0 for disabled
+  int loop_edge_region_gap = -1;
+  // a better loop edge replaces the added ones of its region, their factors
+  // are removed from the graph, otherwise it is pruned
+  bool replace_loop_edges = false;
+  // a gps factor once the frames travelled this far (in meters) since the
+  // last one, 0 for all the frames with utm
+  double gps_min_distance = 0.;
+  // the fixes with a larger horizontal sigma (in meters, from their
+  // covariance) get no factor, <= 0 for disabled
+  double gps_max_sigma = -1.;
+  FinalOptimizationOptions final_optimization_options;
 };
 
+struct LoopCloseEdge {
+  int target_index;
+  int source_index;
+  // from target to source
+  Eigen::Matrix4f transform;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+using LoopCloseEdges =
+    std::vector<LoopCloseEdge, Eigen::aligned_allocator<LoopCloseEdge>>;
+
 template <typename PointT>
 class IsamOptimizer {
  public:
   IsamOptimizer(const IsamOptimizerOptions &options,
                 const LoopDetectorSettings &l_d_setting);
-  ~IsamOptimizer() {}
+  ~IsamOptimizer() {
+    // the running ones use the loop detector
+    for (auto &pending : pending_loop_closings_) {
+      pending.done.wait();
+    }
+  }
 
   IsamOptimizer(const IsamOptimizer &) = delete;
   IsamOptimizer &operator=(const IsamOptimizer &) = delete;
 
   void AddFrame(const std::shared_ptr<Submap<PointT>> &frame,
                 const double match_score);
+  /// @brief insert a frame saved in a checkpoint again without the loop
+  /// detection, the loop closure edges from it found before are added back
+  void RestoreFrame(const std::shared_ptr<Submap<PointT>> &frame,
+                    const LoopCloseEdges &loop_close_edges);
+  /// @brief wait for the running loop closings and add their edges
+  void FlushLoopClosings();
+  /// @brief all the loop closure edges added so far, in order
+  inline const LoopCloseEdges &GetLoopCloseEdges() const {
+    return loop_close_edges_;
+  }
   /// @brief set static tf link from odom to lidar(cloud frame)
   void SetTransformOdomToLidar(const Eigen::Matrix4f &t);
   /// @brief get the odom->lidar tf after calibration
   Eigen::Matrix4f GetTransformOdomToLidar();
 
   void SetTrackingToGps(const Eigen::Matrix4f &t);
+  /// @brief imu data (in tracking frame) for the imu factors, thread safe
+  void AddImuData(const sensors::ImuMsg &imu_data);
 
   Eigen::Matrix4f GetTransformTrackingToGps();
 
   int RunFinalOptimazation();
+  /// @brief save all the factors and the current estimate, which rebuild
+  /// the graph by LoadPoseGraph() without the registrations
+  bool SavePoseGraph(const std::string &filename);
 
   Eigen::Matrix4d GetGpsCoordTransfrom();
 
@@ -85,15 +164,41 @@ class IsamOptimizer {
       const int target_index, const int source_index,
       const Eigen::Matrix4f &transform_from_last_pose,
       const gtsam::noiseModel::Base::shared_ptr &constraint_noise);
+  // the edges of the loop detection through the pruning, the best first
+  // @return the added edge number
+  int AddDetectedLoopCloseEdges(
+      const typename LoopDetector<PointT>::DetectResult &result);
+  // remove a loop edge added before from the graph (on the next update)
+  void RemoveLoopCloseEdge(const int target_index, const int source_index);
   void AddVertex(const int &index, const Eigen::Matrix4f &pose,
                  const Eigen::Matrix4f &transform_from_last_pose,
                  const gtsam::noiseModel::Base::shared_ptr &odom_noise);
   void IsamUpdate(const int update_time = 1);
+  // to the graph of the next update, and to the saved ones
+  void AddFactor(const PoseGraphFactor &factor);
+  // the vertex, the odom and gps factors of a new frame
+  void AddFrameFactors(const std::shared_ptr<Submap<PointT>> &frame,
+                       const int frame_index);
+  // the preintegrated imu factor from the last frame to the new one, if the
+  // imu data covers the time between them
+  void AddImuFactor(const std::shared_ptr<Submap<PointT>> &frame,
+                    const int frame_index);
+  // update iSAM2 if the batch of the new frames is ready, and their poses
+  void ScheduleIsamUpdate();
+  // the poses of all frames after the loop closure edges added
+  void UpdateAllPoses();
+  // add the edges of the finished loop closings, or all of them with
+  // wait_all, the oldest ones are waited for if too many are pending
+  void AddFinishedLoopClosings(const bool wait_all);
+  // the memory of the graph in iSAM2, roughly
+  size_t GraphBytes() const;
 
  private:
   std::unique_ptr<gtsam::ISAM2> isam_;
   std::shared_ptr<gtsam::NonlinearFactorGraph> isam_factor_graph_;
   gtsam::Values initial_estimate_;
+  // by RunFinalOptimazation()
+  gtsam::Values final_estimate_;
   gtsam::Pose3 gps_coord_transform_;  // map origin in GPS coord
   gtsam::noiseModel::Base::shared_ptr prior_noise_model_;
   gtsam::noiseModel::Base::shared_ptr gps_noise_model_;
@@ -109,9 +214,43 @@ class IsamOptimizer {
   LoopDetector<PointT> loop_detector_;
   IsamOptimizerOptions options_;
 
+  using LoopClosingTask = typename LoopDetector<PointT>::LoopClosingTask;
+  struct PendingLoopClosing {
+    std::shared_ptr<LoopClosingTask> task;
+    std::future<void> done;
+  };
+  // in the order of the source frames
+  std::deque<PendingLoopClosing> pending_loop_closings_;
+
   ViewGraph view_graph_;
+  LoopCloseEdges loop_close_edges_;
+  PoseGraphFactors pose_graph_factors_;
+  LoopEdgePruner loop_edge_pruner_;
+  // for the replacement of loop edges, the indices of their factors in
+  // the isam graph by (target, source), the ones not updated yet by their
+  // positions in isam_factor_graph_
+  std::map<std::pair<int, int>, size_t> loop_factor_indices_;
+  std::vector<std::pair<std::pair<int, int>, size_t>> pending_loop_factors_;
+  gtsam::FactorIndices removed_factor_indices_;
   bool calib_factor_inserted_ = false;
+  // the vertices added, and the ones in iSAM2 already
+  int vertex_num_ = 0;
+  int updated_vertex_num_ = 0;
+  // with the memory accounting, updated after each iSAM2 update
+  common::TrackedBytes graph_bytes_{common::MemoryGauge("isam")};
+  std::chrono::steady_clock::time_point batch_start_time_;
   int accumulated_gps_count_ = 0;
+  // the distance travelled since the last gps factor, from the positions
+  // of the frames when they are added
+  double gps_travelled_distance_ = 0.;
+  Eigen::Vector3f last_frame_position_ = Eigen::Vector3f::Zero();
+
+  common::Mutex imu_mutex_;
+  std::deque<sensors::ImuMsg> imu_data_ GUARDED_BY(imu_mutex_);
+  boost::shared_ptr<gtsam::PreintegratedCombinedMeasurements::Params>
+      imu_params_;
+  // the frames with velocity and bias, the imu factors may start anywhere
+  std::vector<bool> has_imu_state_;
 };
 
 }  // namespace back_end
@@ -0,0 +1,167 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef BACK_END_LOOP_CLOSURE_CACHE_H_
+#define BACK_END_LOOP_CLOSURE_CACHE_H_
+// stl
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace static_map {
+namespace back_end {
+
+/*
+ * @class LoopClosureCache
+ * @brief the loop closing pairs (target, source) tried so far with the
+ * results, so that a pair is never registered twice, and the pairs which
+ * would not add much are skipped: the ones close to an accepted pair in
+ * both the target and the source indices, and the targets failed too many
+ * times already
+ */
+class LoopClosureCache {
+ public:
+  enum Result {
+    kAccepted,
+    // the registration did not converge
+    kRegistrationFailed,
+    // converged with a score under the threshold
+    kLowScore,
+    kResultCount
+  };
+
+  enum Skip {
+    kNotSkipped,
+    // the same pair was tried before
+    kTriedBefore,
+    kRedundant,
+    kTooManyFailures,
+    kSkipCount
+  };
+
+  struct Attempt {
+    Result result;
+    double score;
+  };
+
+  /// @param redundant_gap a pair with both indices within it of an accepted
+  /// pair is redundant, < 0 for disabled
+  /// @param max_failures a target failed this many times is not tried any
+  /// more, <= 0 for no limit
+  LoopClosureCache(const int redundant_gap, const int max_failures)
+      : redundant_gap_(redundant_gap), max_failures_(max_failures) {}
+  ~LoopClosureCache() {}
+
+  LoopClosureCache(const LoopClosureCache &) = delete;
+  LoopClosureCache &operator=(const LoopClosureCache &) = delete;
+
+  /// @brief whether the pair should be registered, and counts the lookup
+  Skip Check(const int target, const int source) {
+    lookup_count_++;
+    Skip skip = kNotSkipped;
+    if (attempts_.count(std::make_pair(target, source))) {
+      skip = kTriedBefore;
+    } else if (IsRedundant(target, source)) {
+      skip = kRedundant;
+    } else if (max_failures_ > 0) {
+      const auto failures = failure_counts_.find(target);
+      if (failures != failure_counts_.end() &&
+          failures->second >= max_failures_) {
+        skip = kTooManyFailures;
+      }
+    }
+    skip_counts_[skip]++;
+    return skip;
+  }
+
+  void Insert(const int target, const int source, const Attempt &attempt) {
+    const auto pair = std::make_pair(target, source);
+    if (!attempts_.emplace(pair, attempt).second) {
+      return;
+    }
+    if (attempt.result == kAccepted) {
+      accepted_by_source_[source].push_back(target);
+    } else {
+      failure_counts_[target]++;
+    }
+    result_counts_[attempt.result]++;
+  }
+
+  /// @brief the tried pair, nullptr if not tried
+  const Attempt *Find(const int target, const int source) const {
+    const auto found = attempts_.find(std::make_pair(target, source));
+    return found == attempts_.end() ? nullptr : &found->second;
+  }
+
+  /// @brief the ratio of the lookups skipped by the cache
+  double HitRate() const {
+    return lookup_count_ == 0
+               ? 0.
+               : 1. - static_cast<double>(skip_counts_[kNotSkipped]) /
+                          lookup_count_;
+  }
+  inline int64_t LookupCount() const { return lookup_count_; }
+  inline int64_t SkipCount(const Skip skip) const {
+    return skip_counts_[skip];
+  }
+  inline int64_t ResultCount(const Result result) const {
+    return result_counts_[result];
+  }
+
+ private:
+  bool IsRedundant(const int target, const int source) const {
+    if (redundant_gap_ < 0) {
+      return false;
+    }
+    for (auto it = accepted_by_source_.lower_bound(source - redundant_gap_);
+         it != accepted_by_source_.end() &&
+         it->first <= source + redundant_gap_;
+         ++it) {
+      for (const int accepted_target : it->second) {
+        if (std::abs(accepted_target - target) <= redundant_gap_) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  const int redundant_gap_;
+  const int max_failures_;
+
+  std::map<std::pair<int, int>, Attempt> attempts_;
+  // the targets of the accepted pairs by their sources
+  std::map<int, std::vector<int>> accepted_by_source_;
+  std::unordered_map<int, int> failure_counts_;
+
+  int64_t lookup_count_ = 0;
+  int64_t skip_counts_[kSkipCount] = {0};
+  int64_t result_counts_[kResultCount] = {0};
+};
+
+}  // namespace back_end
+}  // namespace static_map
+
+#endif  // BACK_END_LOOP_CLOSURE_CACHE_H_
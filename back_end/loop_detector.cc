@@ -24,33 +24,33 @@
 #include <limits>
 
 #include "back_end/loop_detector.h"
+#include "common/metrics.h"
+#include "common/point_types.h"
 #include "common/simple_thread_pool.h"
-
-#ifdef _USE_TBB_
-#include <tbb/task_group.h>
-#endif
+#include "common/trace.h"
 
 namespace static_map {
 namespace back_end {
 
 template <typename PointT>
 typename LoopDetector<PointT>::DetectResult LoopDetector<PointT>::AddFrame(
-    const std::shared_ptr<Submap<PointT>>& frame, bool do_loop_detect) {
+    const std::shared_ptr<Submap<PointT>>& frame, bool do_loop_detect,
+    LoopClosingTask* const task) {
+  static common::Histogram* const latency =
+      common::MetricsRegistry::Get()->GetHistogram("back_end.loop_detect");
+  static common::Counter* const skipped_counter =
+      common::MetricsRegistry::Get()->GetCounter("back_end.loop_cache_skips");
+  static common::Counter* const tried_counter =
+      common::MetricsRegistry::Get()->GetCounter("back_end.loop_cache_tries");
+  common::ScopedLatency scoped_latency(latency);
   all_frames_.push_back(frame);
-  if (settings_.use_gps) {
-    if (frame->HasOdom()) {
-      Eigen::Vector3d translation = frame->GetRelatedOdom().block(0, 3, 3, 1);
-      all_frames_odom_.push_back(translation.cast<double>());
-    } else {
-      all_frames_odom_.push_back(
-          Eigen::Vector3d::Constant(std::numeric_limits<double>::max()));
-    }
-  } else {
-    Eigen::Vector3f translation = frame->GlobalTranslation();
-    all_frames_odom_.push_back(translation.cast<double>());
+  int32_t current_index = all_frames_.size() - 1;
+  const Eigen::Vector2d current_position = FramePosition(current_index);
+  position_grid_.Update(current_index, current_position);
+  if (place_recognizer_) {
+    place_recognizer_->Add(frame->Cloud());
   }
 
-  int32_t current_index = all_frames_.size() - 1;
   const char* mode_name[kLoopStatusCount] = {"No Loop", "Trying To Close Loop",
                                              "Entering Loop", "Continous Loop",
                                              "Leaving Loop"};
@@ -65,12 +65,7 @@ typename LoopDetector<PointT>::DetectResult LoopDetector<PointT>::AddFrame(
 
   const int max_index = static_cast<int>(all_frames_.size()) - 1;
   std::vector<int> indices_in_distance;
-  indices_in_distance.reserve(10);
-
-  Eigen::Vector2f cur_trans_2d =
-      all_frames_odom_[current_index].topRows(2).cast<float>();
-  double min_distance = std::numeric_limits<double>::max();
-  int closest_index = -1;
+  std::vector<double> distances;
 
   int start_index = 0;
   int end_index = max_index - settings_.loop_ignore_threshold;
@@ -78,16 +73,15 @@ typename LoopDetector<PointT>::DetectResult LoopDetector<PointT>::AddFrame(
     start_index = common::Clamp(search_window_start_, 0, max_index);
     end_index = common::Clamp(search_window_end_, 0, max_index);
   }
-  for (int i = start_index; i < end_index; ++i) {
-    Eigen::Vector2f frame_trans_2d =
-        all_frames_odom_[i].topRows(2).cast<float>();
-    double distance = (cur_trans_2d - frame_trans_2d).norm();
-    if (distance <= settings_.max_close_loop_distance) {
-      indices_in_distance.push_back(i);
-      if (distance < min_distance) {
-        closest_index = i;
-        min_distance = distance;
-      }
+  position_grid_.RadiusSearch(current_position,
+                              settings_.max_close_loop_distance, start_index,
+                              end_index, &indices_in_distance, &distances);
+  double min_distance = std::numeric_limits<double>::max();
+  int closest_index = -1;
+  for (size_t i = 0; i < indices_in_distance.size(); ++i) {
+    if (distances[i] < min_distance) {
+      closest_index = indices_in_distance[i];
+      min_distance = distances[i];
     }
   }
   if (min_distance >= settings_.max_close_loop_distance * 0.4) {
@@ -103,18 +97,55 @@ typename LoopDetector<PointT>::DetectResult LoopDetector<PointT>::AddFrame(
       std::copy(indices_in_distance.begin(), indices_in_distance.end(),
                 std::back_inserter(indices_well_matched));
     } else {
-      for (auto& i : indices_in_distance) {
-        CHECK_NE(i, current_index);
-        auto& target_frame = all_frames_.at(i);
-        if (descriptor::matchTwoM2dpDescriptors<PointT>(
-                frame->GetDescriptor(), target_frame->GetDescriptor()) >
-            settings_.m2dp_match_score) {
-          indices_well_matched.push_back(i);
+      // scored all at once against the index
+      SyncDescriptorIndex(end_index);
+      std::vector<double> scores;
+      descriptor_index_.Scores(frame->GetDescriptor(), indices_in_distance,
+                               &scores);
+      for (size_t i = 0; i < indices_in_distance.size(); ++i) {
+        CHECK_NE(indices_in_distance[i], current_index);
+        if (scores[i] > settings_.m2dp_match_score) {
+          indices_well_matched.push_back(indices_in_distance[i]);
         }
       }
     }
   }
 
+  // the frames look the same but out of distance, e.g. the gps drifted
+  std::vector<int> indices_by_descriptor;
+  if (settings_.use_descriptor && settings_.descriptor_candidate_num > 0) {
+    SyncDescriptorIndex(end_index);
+    std::vector<std::pair<int, double>> matches;
+    descriptor_index_.BestMatches(
+        frame->GetDescriptor(), start_index, end_index,
+        settings_.descriptor_candidate_num, settings_.m2dp_match_score,
+        &matches);
+    for (const auto& match : matches) {
+      if (!std::binary_search(indices_in_distance.begin(),
+                              indices_in_distance.end(), match.first)) {
+        indices_by_descriptor.push_back(match.first);
+      }
+    }
+  }
+
+  // the places look the same by the clouds, with the yaw between them
+  std::vector<typename descriptor::PlaceRecognizer<PointT>::Candidate>
+      place_candidates;
+  if (place_recognizer_) {
+    std::vector<typename descriptor::PlaceRecognizer<PointT>::Candidate>
+        candidates;
+    place_recognizer_->Query(current_index, start_index, end_index,
+                             settings_.place_candidate_num, &candidates);
+    for (const auto& candidate : candidates) {
+      if (!std::binary_search(indices_in_distance.begin(),
+                              indices_in_distance.end(), candidate.index) &&
+          std::find(indices_by_descriptor.begin(), indices_by_descriptor.end(),
+                    candidate.index) == indices_by_descriptor.end()) {
+        place_candidates.push_back(candidate);
+      }
+    }
+  }
+
   loop_detection_ = 0;
   std::vector<std::pair<int, int>> maybe_close_pair;
   maybe_close_pair.reserve(settings_.nearest_history_pos_num + 1);
@@ -146,6 +177,27 @@ typename LoopDetector<PointT>::DetectResult LoopDetector<PointT>::AddFrame(
       }
     }
   }
+  const int pairs_in_distance = maybe_close_pair.size();
+  if (!indices_by_descriptor.empty()) {
+    loop_detection_ = 1;
+    for (const int index : indices_by_descriptor) {
+      maybe_close_pair.push_back(std::make_pair(index, current_index));
+    }
+  }
+  const int pairs_by_descriptor = maybe_close_pair.size();
+  if (!place_candidates.empty()) {
+    loop_detection_ = 1;
+    for (const auto& candidate : place_candidates) {
+      maybe_close_pair.push_back(
+          std::make_pair(candidate.index, current_index));
+    }
+  }
+
+  // the candidates are likely to be matched in the next frames,
+  // load the evicted ones from disk in background ahead of use
+  for (const auto& pair : maybe_close_pair) {
+    all_frames_.at(pair.first)->Prefetch();
+  }
 
   switch (current_status_) {
     case kNoLoop:
@@ -206,46 +258,154 @@ typename LoopDetector<PointT>::DetectResult LoopDetector<PointT>::AddFrame(
 
   if (current_status_ == kContinousLoop) {
     CHECK(!maybe_close_pair.empty());
-#ifdef _USE_TBB_
-    auto pair_close_loop = [&](const std::pair<int, int>& p) {
-      double constraint_score = 0.;
-      Eigen::Matrix4f transform;
-      if (CloseLoop(p.first, p.second, &transform, &constraint_score)) {
-        result.close_pair.push_back(p);
-        result.transform.push_back(transform);
-        result.constraint_score.push_back(constraint_score);
+    // all the candidates share the current frame as the source, so it is
+    // prepared once and the targets are aligned in parallel
+    LoopClosingTask local_task;
+    LoopClosingTask* const closing = task ? task : &local_task;
+    closing->source_index = maybe_close_pair.front().second;
+    closing->source_cloud = all_frames_.at(closing->source_index)->Cloud();
+    closing->pairs.clear();
+    closing->targets.clear();
+    closing->matches.clear();
+    const int pairs_size = maybe_close_pair.size();
+    for (int i = 0; i < pairs_size; ++i) {
+      const auto& pair = maybe_close_pair[i];
+      CHECK_EQ(pair.second, closing->source_index);
+      if (loop_cache_.Check(pair.first, pair.second) !=
+          LoopClosureCache::kNotSkipped) {
+        continue;
       }
-    };
-    // using threadpool
-    // common::ThreadPool pool(pair_size);
-    // const int pair_size = maybe_close_pair.size();
-    // for (auto& pair : maybe_close_pair) {
-    //   pool.enqueue(pair_close_loop, pair);
-    // }
-    tbb::task_group tasks;
-    for (auto& pair : maybe_close_pair) {
-      tasks.run([&] { pair_close_loop(pair); });
-    }
-    tasks.wait();
-#else
-    for (auto& pair : maybe_close_pair) {
-      double constraint_score = 0.;
-      Eigen::Matrix4f transform;
-      if (CloseLoop(pair.first, pair.second, &transform, &constraint_score)) {
-        result.close_pair.push_back(pair);
-        result.transform.push_back(transform);
-        result.constraint_score.push_back(constraint_score);
+      typename registrator::Interface<PointT>::BatchTarget target;
+      target.cloud = all_frames_.at(pair.first)->Cloud();
+      target.guess = InitGuess(pair.first, pair.second);
+      if (i >= pairs_by_descriptor) {
+        // the poses are not reliable for them, the yaw of the place
+        // recognizer is used instead
+        target.guess = Eigen::Matrix4f::Identity();
+        target.guess.block(0, 0, 3, 3) =
+            Eigen::AngleAxisf(place_candidates[i - pairs_by_descriptor].yaw,
+                              Eigen::Vector3f::UnitZ())
+                .toRotationMatrix();
+      } else if (i >= pairs_in_distance) {
+        // the translation of the poses is not reliable for them, but the
+        // rotation is
+        target.guess.block(0, 3, 3, 1).setZero();
       }
+      closing->targets.push_back(target);
+      closing->pairs.push_back(pair);
     }
-#endif
-    if (!result.close_pair.empty()) {
-      result.close_succeed = true;
+    const int tried_size = closing->pairs.size();
+    skipped_counter->Add(pairs_size - tried_size);
+    tried_counter->Add(tried_size);
+    PRINT_INFO_FMT("Loop cache skipped %d of %d pairs, hit rate %.1f%%",
+                   pairs_size - tried_size, pairs_size,
+                   loop_cache_.HitRate() * 100.);
+
+    if (!task) {
+      CloseLoop(&local_task);
+      CollectLoopClosing(local_task, &result);
     }
   }
 
   return result;
 }
 
+template <typename PointT>
+void LoopDetector<PointT>::CloseLoop(LoopClosingTask* const task) const {
+  CHECK(task);
+  common::TraceArgs trace_args;
+  trace_args.submap = task->source_index;
+  common::ScopedTrace scoped_trace("back_end.loop_closure", trace_args);
+  task->matches.clear();
+  if (task->targets.empty()) {
+    return;
+  }
+  std::shared_ptr<Matcher> scan_matcher =
+      std::make_shared<registrator::IcpUsingPointMatcher<PointT>>();
+  if (settings_.pyramid_levels > 1) {
+    using Pyramid = registrator::MultiResolution<PointT>;
+    scan_matcher = std::make_shared<Pyramid>(
+        scan_matcher,
+        Pyramid::MakeLevels(settings_.pyramid_levels,
+                            settings_.pyramid_resolution,
+                            settings_.pyramid_coarse_max_iterations));
+  }
+  task->matches = scan_matcher->alignBatch(task->source_cloud, task->targets);
+}
+
+template <typename PointT>
+void LoopDetector<PointT>::CollectLoopClosing(const LoopClosingTask& task,
+                                              DetectResult* const result) {
+  CHECK(result);
+  for (const auto& match : task.matches) {
+    const auto& pair = task.pairs.at(match.index);
+    LoopClosureCache::Attempt attempt;
+    attempt.score = match.score;
+    // @todo add a parameter for this threshold
+    if (match.score <= 0.75) {
+      attempt.result = match.succeed ? LoopClosureCache::kLowScore
+                                     : LoopClosureCache::kRegistrationFailed;
+      loop_cache_.Insert(pair.first, pair.second, attempt);
+      continue;
+    }
+    attempt.result = LoopClosureCache::kAccepted;
+    loop_cache_.Insert(pair.first, pair.second, attempt);
+    result->close_pair.push_back(pair);
+    result->transform.push_back(match.transform);
+    // match score = exp(-score)
+    // so, score = -log_e(match_score)
+    result->constraint_score.push_back(-std::log(match.score));
+    PRINT_INFO_FMT("++++ Got good match from source %d to target %d ++++",
+                   pair.second, pair.first);
+  }
+  if (!result->close_pair.empty()) {
+    result->close_succeed = true;
+  }
+}
+
+template <typename PointT>
+void LoopDetector<PointT>::SyncDescriptorIndex(const int size) {
+  // the descriptors of the former frames are ready long ago
+  while (descriptor_index_.Size() < size) {
+    descriptor_index_.Add(
+        all_frames_[descriptor_index_.Size()]->GetDescriptor());
+  }
+}
+
+template <typename PointT>
+void LoopDetector<PointT>::UpdatePositions() {
+  // the odoms do not change
+  if (settings_.use_gps) {
+    return;
+  }
+  const int frames_size = all_frames_.size();
+  for (int i = 0; i < frames_size; ++i) {
+    position_grid_.Update(i, FramePosition(i));
+  }
+}
+
+template <typename PointT>
+void LoopDetector<PointT>::UpdatePosition(const int index) {
+  if (!settings_.use_gps) {
+    position_grid_.Update(index, FramePosition(index));
+  }
+}
+
+template <typename PointT>
+Eigen::Vector2d LoopDetector<PointT>::FramePosition(const int index) const {
+  const auto& frame = all_frames_[index];
+  if (!settings_.use_gps) {
+    const Eigen::Vector3f translation = frame->GlobalTranslation();
+    return translation.topRows(2).cast<double>();
+  }
+  // left out of the search without odom
+  if (!frame->HasOdom()) {
+    return Eigen::Vector2d::Constant(std::numeric_limits<double>::quiet_NaN());
+  }
+  const Eigen::Matrix4d odom = frame->GetRelatedOdom();
+  return odom.block(0, 3, 2, 1);
+}
+
 template <typename PointT>
 void LoopDetector<PointT>::SetSearchWindow(const int start_index,
                                            const int end_index) {
@@ -258,9 +418,8 @@ void LoopDetector<PointT>::SetSearchWindow(const int start_index,
 }
 
 template <typename PointT>
-bool LoopDetector<PointT>::CloseLoop(const int target_id, const int source_id,
-                                     Eigen::Matrix4f* result, double* score) {
-  // PRINT_INFO("Trying to close loop ...");
+Eigen::Matrix4f LoopDetector<PointT>::InitGuess(const int target_id,
+                                                const int source_id) const {
   CHECK(all_frames_.size() > target_id && all_frames_.size() > source_id);
   Eigen::Matrix4f init_guess = all_frames_[target_id]->GlobalPose().inverse() *
                                all_frames_[source_id]->GlobalPose();
@@ -273,41 +432,7 @@ bool LoopDetector<PointT>::CloseLoop(const int target_id, const int source_id,
     init_guess =
         tf_odom_lidar_.inverse() * odom_guess.cast<float>() * tf_odom_lidar_;
   }
-
-  registrator::IcpUsingPointMatcher<PointT> scan_matcher;
-
-  scan_matcher.setInputSource(all_frames_.at(source_id)->Cloud());
-  scan_matcher.setInputTarget(all_frames_.at(target_id)->Cloud());
-
-  scan_matcher.align(init_guess, *result);
-  const double match_score = scan_matcher.getFitnessScore();
-  // @todo add a parameter for this threshold
-  if (match_score > 0.75) {
-    // match score = exp(-score)
-    // so, score = -log_e(match_score)
-    *score = -std::log(match_score);
-    PRINT_INFO_FMT("++++ Got good match from source %d to target %d ++++",
-                   source_id, target_id);
-    // for debug ****
-    // std::cout << "\nlast: " << source_id << std::endl
-    //           << all_frames_.at(source_id)->GlobalPose()
-    //           << "\nfirst: " << target_id << std::endl
-    //           << all_frames_.at(target_id)->GlobalPose() << std::endl;
-    // PRINT_DEBUG_FMT("match score: %lf, score: %lf", match_score, *score);
-    // typename pcl::PointCloud<PointT>::Ptr matched_cloud(
-    //     new typename pcl::PointCloud<PointT>);
-    // pcl::transformPointCloud(*all_frames_.at(source_id)->Cloud(),
-    //                          *matched_cloud, *result);
-    // *matched_cloud += *all_frames_.at(target_id)->Cloud();
-    // pcl::io::savePCDFile("pcd/matched_" + std::to_string(target_id) + "_" +
-    //                          std::to_string(source_id) + ".pcd",
-    //                      *matched_cloud);
-    // ****************
-    return true;
-  }
-
-  // PRINT_INFO("drop the match.");
-  return false;
+  return init_guess;
 }
 
 template <typename PointT>
@@ -316,6 +441,9 @@ void LoopDetector<PointT>::SetTransformOdomToLidar(const Eigen::Matrix4f& t) {
 }
 
 template class LoopDetector<pcl::PointXYZI>;
+#ifdef _USE_COMPACT_POINT_
+template class LoopDetector<PointXYZIc>;
+#endif
 
 }  // namespace back_end
 }  // namespace static_map
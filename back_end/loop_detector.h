@@ -24,12 +24,19 @@
 #define BACK_END_LOOP_DETECTOR_H_
 
 // stl
+#include <algorithm>
 #include <memory>
+#include <string>
 #include <utility>
 #include <vector>
 // local
+#include "back_end/loop_closure_cache.h"
+#include "back_end/position_grid.h"
 #include "builder/submap.h"
+#include "descriptor/m2dp_index.h"
+#include "descriptor/scan_context.h"
 #include "registrators/icp_pointmatcher.h"
+#include "registrators/multi_resolution.h"
 
 #ifdef _USE_TBB_
 #include <tbb/atomic.h>
@@ -47,13 +54,44 @@ struct LoopDetectorSettings {
   int nearest_history_pos_num = 4;
   float max_close_loop_distance = 25.;
   float m2dp_match_score = 0.99;
+  // with use_descriptor, the best matched frames by the descriptors out of
+  // max_close_loop_distance are also tried, 0 for disabled
+  int descriptor_candidate_num = 0;
+  // "scan_context" for the candidates out of max_close_loop_distance by the
+  // clouds only, with the yaw estimated for the guess, "" for disabled
+  std::string place_recognizer = "";
+  int place_candidate_num = 3;
+  descriptor::ScanContextSettings scan_context_settings;
+  // the pairs within this gap of an accepted pair in both the target and
+  // the source indices are skipped, < 0 for disabled
+  int redundant_loop_gap = 1;
+  // a target failed this many times is not tried again by any source,
+  // <= 0 for no limit (default). mind that a target failed while the drift
+  // is large is then never closed, even after the poses are corrected
+  int max_loop_failures = 0;
+  // > 1 for coarse to fine loop closing, the finest coarse level is down
+  // sampled with pyramid_resolution and the coarser ones doubled
+  int pyramid_levels = 1;
+  float pyramid_resolution = 0.4;
+  int pyramid_coarse_max_iterations = 10;
 };
 
 template <typename PointT>
 class LoopDetector {
  public:
   explicit LoopDetector(const LoopDetectorSettings &l_d_settings)
-      : settings_(l_d_settings), tf_odom_lidar_(Eigen::Matrix4f::Identity()) {}
+      : settings_(l_d_settings),
+        tf_odom_lidar_(Eigen::Matrix4f::Identity()),
+        position_grid_(
+            std::max(static_cast<double>(l_d_settings.max_close_loop_distance),
+                     1.e-3)),
+        loop_cache_(l_d_settings.redundant_loop_gap,
+                    l_d_settings.max_loop_failures) {
+    if (settings_.place_recognizer == "scan_context") {
+      place_recognizer_.reset(new descriptor::ScanContext<PointT>(
+          settings_.scan_context_settings));
+    }
+  }
   ~LoopDetector() {}
 
   LoopDetector(const LoopDetector &) = delete;
@@ -88,9 +126,35 @@ class LoopDetector {
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
   };
 
+  using Matcher = registrator::Interface<PointT>;
+  // the registrations of a frame against its loop closing candidates
+  struct LoopClosingTask {
+    int source_index = -1;
+    typename Matcher::PointCloudSourcePtr source_cloud;
+    std::vector<std::pair<int, int>> pairs;
+    typename Matcher::BatchTargets targets;
+    // filled by CloseLoop()
+    typename Matcher::BatchResults matches;
+  };
+
+  /// @brief detect the loop for the new frame and close it
+  /// @param task if given, the registrations are not run but put into it in
+  /// continous loop, then CloseLoop() and CollectLoopClosing() do the rest
   DetectResult AddFrame(const std::shared_ptr<Submap<PointT>> &submap,
-                        bool do_loop_detect = true);
+                        bool do_loop_detect = true,
+                        LoopClosingTask *const task = nullptr);
+  /// @brief run the registrations of the task, it only reads the settings
+  /// so it can run in another thread than AddFrame()
+  void CloseLoop(LoopClosingTask *const task) const;
+  /// @brief the good matches of a closed task into result, and all the
+  /// attempts into the cache
+  void CollectLoopClosing(const LoopClosingTask &task,
+                          DetectResult *const result);
   void SetSearchWindow(const int start_index, const int end_index);
+  /// @brief refresh the positions for the candidate search after the
+  /// optimizer updated the poses of all frames, or a single one
+  void UpdatePositions();
+  void UpdatePosition(const int index);
   inline std::vector<std::shared_ptr<Submap<PointT>>> &GetFrames() {
     return all_frames_;
   }
@@ -100,12 +164,15 @@ class LoopDetector {
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
  protected:
-  bool CloseLoop(const int first_id, const int last_id, Eigen::Matrix4f *result,
-                 double *score);
+  // initial guess from source to target by the poses or odoms
+  Eigen::Matrix4f InitGuess(const int target_id, const int source_id) const;
+  // the global position, or the odom if use_gps
+  Eigen::Vector2d FramePosition(const int index) const;
+  // add the descriptors of the first "size" frames into the index
+  void SyncDescriptorIndex(const int size);
 
  private:
   std::vector<std::shared_ptr<Submap<PointT>>> all_frames_;
-  std::vector<Eigen::Vector3d> all_frames_odom_;
 
   int loop_detection_;
   int accumulate_loop_detected_count_;
@@ -118,6 +185,11 @@ class LoopDetector {
 
   int search_window_start_ = -1;
   int search_window_end_ = -1;
+
+  PositionGrid position_grid_;
+  descriptor::M2dpIndex descriptor_index_;
+  std::unique_ptr<descriptor::PlaceRecognizer<PointT>> place_recognizer_;
+  LoopClosureCache loop_cache_;
 };
 
 }  // namespace back_end
@@ -0,0 +1,134 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef BACK_END_LOOP_EDGE_PRUNER_H_
+#define BACK_END_LOOP_EDGE_PRUNER_H_
+// stl
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+namespace static_map {
+namespace back_end {
+
+/*
+ * @class LoopEdgePruner
+ * @brief keeps the loop edges of the pose graph sparse on repeated laps:
+ * the edges within the region gap of a kept edge in both the target and
+ * the source indices connect submaps which are strongly connected already,
+ * so of the edges of a region only the best scoring one is kept, a better
+ * one either is pruned as well or replaces the kept ones
+ */
+class LoopEdgePruner {
+ public:
+  enum Decision {
+    kAdd,
+    // redundant to a kept edge
+    kPruned,
+    // better than all of the kept edges of its region
+    kReplace,
+    kDecisionCount
+  };
+
+  struct Edge {
+    int target;
+    int source;
+    // -log(score), the lower the better
+    double cost;
+  };
+
+  /// @param region_gap the edges with both indices within it of each other
+  /// are in the same region, < 0 for disabled
+  /// @param replace a better edge replaces the kept ones of its region
+  LoopEdgePruner(const int region_gap, const bool replace)
+      : region_gap_(region_gap), replace_(replace) {}
+  ~LoopEdgePruner() {}
+
+  LoopEdgePruner(const LoopEdgePruner &) = delete;
+  LoopEdgePruner &operator=(const LoopEdgePruner &) = delete;
+
+  /// @brief whether the edge should be added, call Keep() if it is
+  /// @param replaced the kept edges it replaces with kReplace
+  Decision Check(const int target, const int source, const double cost,
+                 std::vector<Edge> *const replaced) {
+    replaced->clear();
+    Decision decision = kAdd;
+    if (region_gap_ >= 0) {
+      for (auto it = kept_by_source_.lower_bound(source - region_gap_);
+           it != kept_by_source_.end() && it->first <= source + region_gap_;
+           ++it) {
+        for (const Edge &kept : it->second) {
+          if (std::abs(kept.target - target) <= region_gap_) {
+            replaced->push_back(kept);
+          }
+        }
+      }
+      if (!replaced->empty()) {
+        decision = kReplace;
+        for (const Edge &kept : *replaced) {
+          if (!replace_ || kept.cost <= cost) {
+            decision = kPruned;
+            break;
+          }
+        }
+        if (decision == kPruned) {
+          replaced->clear();
+        }
+      }
+    }
+    decision_counts_[decision]++;
+    return decision;
+  }
+
+  /// @brief an added edge, the ones it replaces are forgotten
+  void Keep(const Edge &edge, const std::vector<Edge> &replaced) {
+    for (const Edge &old : replaced) {
+      auto &edges = kept_by_source_[old.source];
+      for (auto it = edges.begin(); it != edges.end(); ++it) {
+        if (it->target == old.target) {
+          edges.erase(it);
+          break;
+        }
+      }
+    }
+    kept_by_source_[edge.source].push_back(edge);
+  }
+
+  inline int64_t DecisionCount(const Decision decision) const {
+    return decision_counts_[decision];
+  }
+
+ private:
+  const int region_gap_;
+  const bool replace_;
+
+  // the kept edges by their sources
+  std::map<int, std::vector<Edge>> kept_by_source_;
+
+  int64_t decision_counts_[kDecisionCount] = {0};
+};
+
+}  // namespace back_end
+}  // namespace static_map
+
+#endif  // BACK_END_LOOP_EDGE_PRUNER_H_
@@ -25,6 +25,8 @@
 // local
 #include "back_end/multi_trajectory_optimizer.h"
 #include "common/make_unique.h"
+#include "common/point_types.h"
+#include "common/shared_executor.h"
 
 namespace static_map {
 namespace back_end {
@@ -43,6 +45,12 @@ inline uint32_t SubmapIndexFromUint64(uint64_t index) {
   return *submap_id;
 }
 
+// the loop closings registered in parallel at once, their clouds are kept
+// until all of them are done
+constexpr int kLoopClosingBatchSize = 16;
+// the sources read ahead of the one being detected
+constexpr int kSubmapPrefetchNum = 2;
+
 namespace NM = gtsam::noiseModel;
 using gtsam::between;
 using gtsam::compose;
@@ -51,13 +59,19 @@ using gtsam::Pose3_;
 
 template <typename PointT>
 MultiTrajectoryOptimizer<PointT>::MultiTrajectoryOptimizer(
-    const LoopDetectorSettings& l_d_setting)
+    const LoopDetectorSettings& l_d_setting,
+    const FinalOptimizationOptions& final_options)
     : loop_detector_(l_d_setting),
+      final_options_(final_options),
       isam_factor_graph_(new gtsam::ExpressionFactorGraph) {
   gtsam::ISAM2Params parameters;
   parameters.relinearizeThreshold = 0.01;
   parameters.relinearizeSkip = 1;
   isam_ = common::make_unique<gtsam::ISAM2>(parameters);
+  if (final_options_.cluster_size > 0.) {
+    hierarchical_optimizer_ =
+        common::make_unique<HierarchicalOptimizer>(final_options_);
+  }
 
   // init several noise models
   prior_noise_model_ = NM::Diagonal::Sigmas(
@@ -84,24 +98,74 @@ MultiTrajectoryOptimizer<PointT>::~MultiTrajectoryOptimizer() {}
 template <typename PointT>
 void MultiTrajectoryOptimizer<PointT>::AddSubmap(
     const std::shared_ptr<Submap<PointT>>& submap, bool do_loop_detect) {
-  const SubmapId id = submap->GetId();
-  PRINT_INFO_FMT("Add submap: %s", id.DebugString().c_str());
-  const int t_index = id.trajectory_index;
-  trajectories_[t_index].push_back(submap);
-
-  auto result = loop_detector_.AddFrame(submap, do_loop_detect);
-  AddVertex(SubmapIdToUint64(id), submap->GlobalPose());
-
-  if (result.close_succeed) {
-    const int edge_size = result.close_pair.size();
-    auto& frames = loop_detector_.GetFrames();
-    for (int i = 0; i < edge_size; ++i) {
+  AddSubmaps({submap}, do_loop_detect);
+}
+
+template <typename PointT>
+void MultiTrajectoryOptimizer<PointT>::AddSubmaps(
+    const std::vector<std::shared_ptr<Submap<PointT>>>& submaps,
+    bool do_loop_detect) {
+  std::vector<std::shared_ptr<LoopClosingTask>> tasks;
+  const int submaps_size = submaps.size();
+  for (int i = 0; i < submaps_size; ++i) {
+    const auto& submap = submaps[i];
+    for (int j = i + 1; j <= i + kSubmapPrefetchNum && j < submaps_size;
+         ++j) {
+      submaps[j]->Prefetch();
+    }
+    const SubmapId id = submap->GetId();
+    PRINT_INFO_FMT("Add submap: %s", id.DebugString().c_str());
+    const int t_index = id.trajectory_index;
+    trajectories_[t_index].push_back(submap);
+
+    // the candidates are found now, but registered later with the others
+    auto task = std::make_shared<LoopClosingTask>();
+    loop_detector_.AddFrame(submap, do_loop_detect, task.get());
+    AddVertex(SubmapIdToUint64(id), submap->GlobalPose());
+    if (!task->pairs.empty()) {
+      tasks.push_back(task);
+    } else {
+      submap->ReleaseCloud();
+    }
+    if (static_cast<int>(tasks.size()) >= kLoopClosingBatchSize) {
+      CloseLoops(&tasks);
+    }
+  }
+  CloseLoops(&tasks);
+  IsamUpdate();
+}
+
+template <typename PointT>
+void MultiTrajectoryOptimizer<PointT>::CloseLoops(
+    std::vector<std::shared_ptr<LoopClosingTask>>* const tasks) {
+  CHECK(tasks);
+  if (tasks->empty()) {
+    return;
+  }
+  // each batch of the registrations is parallel on its own, so are the
+  // batches of the sources
+  const LoopDetector<PointT>* const detector = &loop_detector_;
+  common::ParallelFor(0, tasks->size(), tasks->size(), [&](const int i) {
+    detector->CloseLoop((*tasks)[i].get());
+  });
+
+  int edge_size = 0;
+  auto& frames = loop_detector_.GetFrames();
+  for (const auto& task : *tasks) {
+    typename LoopDetector<PointT>::DetectResult result;
+    loop_detector_.CollectLoopClosing(*task, &result);
+    const int size = result.close_pair.size();
+    for (int i = 0; i < size; ++i) {
       const SubmapId target_id = frames[result.close_pair[i].first]->GetId();
       const SubmapId source_id = frames[result.close_pair[i].second]->GetId();
       CHECK_NE(target_id.trajectory_index, source_id.trajectory_index);
-      const Eigen::Matrix4f transform = result.transform[i];
-      AddSubmapConnection(target_id, source_id, transform, true);
+      AddConnectionFactor(target_id, source_id, result.transform[i], true);
     }
+    edge_size += size;
+    frames[task->source_index]->ReleaseCloud();
+  }
+  tasks->clear();
+  if (edge_size > 0) {
     PRINT_INFO_FMT(BOLD "Add %d loop closure edges." NONE_FORMAT, edge_size);
   }
 }
@@ -110,6 +174,22 @@ template <typename PointT>
 void MultiTrajectoryOptimizer<PointT>::AddSubmapConnection(
     const SubmapId& target, const SubmapId& source,
     const Eigen::Matrix4f& transform, bool is_loop_constraint) {
+  AddConnectionFactor(target, source, transform, is_loop_constraint);
+  IsamUpdate();
+}
+
+template <typename PointT>
+void MultiTrajectoryOptimizer<PointT>::IsamUpdate() {
+  isam_->update(*isam_factor_graph_, initial_estimate_);
+  isam_->update();
+  isam_factor_graph_->resize(0);
+  initial_estimate_.clear();
+}
+
+template <typename PointT>
+void MultiTrajectoryOptimizer<PointT>::AddConnectionFactor(
+    const SubmapId& target, const SubmapId& source,
+    const Eigen::Matrix4f& transform, bool is_loop_constraint) {
   PRINT_DEBUG_FMT("target_id : %s, source_id: %s", target.DebugString().c_str(),
                   source.DebugString().c_str());
   if (is_loop_constraint) {
@@ -131,14 +211,12 @@ void MultiTrajectoryOptimizer<PointT>::AddSubmapConnection(
       between(Pose3_(SUBMAP_KEY(target_index)),
               Pose3_(SUBMAP_KEY(source_index))),
       transform_gtsam, noise_model);
+  edges_.push_back(
+      {SUBMAP_KEY(target_index), SUBMAP_KEY(source_index), transform_gtsam,
+       noise_model});
 
   view_graph_.AddEdge(static_cast<int64_t>(target_index),
                       static_cast<int64_t>(source_index), transform);
-
-  isam_->update(*isam_factor_graph_);
-  isam_->update();
-  isam_factor_graph_->resize(0);
-  isam_->calculateEstimate();
 }
 
 template <typename PointT>
@@ -152,12 +230,10 @@ void MultiTrajectoryOptimizer<PointT>::AddVertex(const uint64_t index,
     PRINT_INFO("It is the first submap of its trajectory, add a prior factor.");
     isam_factor_graph_->addExpressionFactor(Pose3_(SUBMAP_KEY(index)),
                                             pose_gtsam, prior_noise_model_);
+    priors_.push_back({SUBMAP_KEY(index), pose_gtsam, prior_noise_model_});
   }
 
   view_graph_.AddVertex(index, pose);
-  isam_->update(*isam_factor_graph_, initial_estimate_);
-  isam_->update();
-  initial_estimate_.clear();
 }
 
 template <typename PointT>
@@ -175,6 +251,12 @@ template <typename PointT>
 void MultiTrajectoryOptimizer<PointT>::RunFinalOptimizing() {
   PRINT_INFO("Final optimizing ... ");
   gtsam::Values result = isam_->calculateBestEstimate();
+  if (hierarchical_optimizer_) {
+    // only the clusters whose submaps or edges changed are solved again
+    result = hierarchical_optimizer_->Optimize(edges_, priors_, result);
+  } else if (final_options_.enable_batch) {
+    result = BatchOptimize(isam_->getFactorsUnsafe(), result, final_options_);
+  }
   for (auto& pair : trajectories_) {
     for (auto& submap : pair.second) {
       const uint64_t index = SubmapIdToUint64(submap->GetId());
@@ -189,6 +271,9 @@ void MultiTrajectoryOptimizer<PointT>::RunFinalOptimizing() {
 }
 
 template class MultiTrajectoryOptimizer<pcl::PointXYZI>;
+#ifdef _USE_COMPACT_POINT_
+template class MultiTrajectoryOptimizer<PointXYZIc>;
+#endif
 
 }  // namespace back_end
 }  // namespace static_map
@@ -39,6 +39,8 @@
 #include <memory>
 #include <vector>
 // local
+#include "back_end/batch_optimization.h"
+#include "back_end/hierarchical_optimizer.h"
 #include "back_end/loop_detector.h"
 #include "back_end/view_graph.h"
 #include "builder/submap.h"
@@ -49,11 +51,18 @@ namespace back_end {
 template <typename PointT>
 class MultiTrajectoryOptimizer {
  public:
-  explicit MultiTrajectoryOptimizer(const LoopDetectorSettings &l_d_setting);
+  explicit MultiTrajectoryOptimizer(
+      const LoopDetectorSettings &l_d_setting,
+      const FinalOptimizationOptions &final_options =
+          FinalOptimizationOptions());
   ~MultiTrajectoryOptimizer();
 
   void AddSubmap(const std::shared_ptr<Submap<PointT>> &submap,
                  bool do_loop_detect);
+  /// @brief add the submaps in order, the loop closure candidates of them
+  /// are registered in parallel batches and the graph is updated once
+  void AddSubmaps(const std::vector<std::shared_ptr<Submap<PointT>>> &submaps,
+                  bool do_loop_detect);
   void AddSubmapConnection(const SubmapId &target, const SubmapId &source,
                            const Eigen::Matrix4f &transform,
                            bool is_loop_constraint = false);
@@ -63,13 +72,24 @@ class MultiTrajectoryOptimizer {
   void RunFinalOptimizing();
 
  protected:
+  using LoopClosingTask = typename LoopDetector<PointT>::LoopClosingTask;
+
   void AddVertex(const uint64_t index, const Eigen::Matrix4f &pose);
+  // the factor is added in the next IsamUpdate()
+  void AddConnectionFactor(const SubmapId &target, const SubmapId &source,
+                           const Eigen::Matrix4f &transform,
+                           bool is_loop_constraint);
+  void IsamUpdate();
+  // register the tasks in parallel and add the good ones as loop closure
+  // edges, the tasks are cleared
+  void CloseLoops(std::vector<std::shared_ptr<LoopClosingTask>> *const tasks);
 
  private:
   std::map<int /*trajectory id*/, std::vector<std::shared_ptr<Submap<PointT>>>>
       trajectories_;
 
   LoopDetector<PointT> loop_detector_;
+  FinalOptimizationOptions final_options_;
 
   std::unique_ptr<gtsam::ISAM2> isam_;
   std::shared_ptr<gtsam::ExpressionFactorGraph> isam_factor_graph_;
@@ -81,6 +101,11 @@ class MultiTrajectoryOptimizer {
   gtsam::noiseModel::Base::shared_ptr loop_closure_model_;
 
   ViewGraph view_graph_;
+
+  // the factors of the graph as they are, for the hierarchical solve
+  std::vector<PoseGraphEdge> edges_;
+  std::vector<PosePrior> priors_;
+  std::unique_ptr<HierarchicalOptimizer> hierarchical_optimizer_;
 };
 
 }  // namespace back_end
@@ -57,11 +57,25 @@ class OdomToPoseFactor : public gtsam::NoiseModelFactor1<gtsam::Pose3> {
   gtsam::Vector evaluateError(
       const gtsam::Pose3& pose,
       boost::optional<gtsam::Matrix&> H = boost::none) const {
-    if (H) (*H) = (gtsam::Matrix16() << 0., 0., 1., 0., 0., 0.).finished();
+    // the pose is perturbed on the right, T * Exp([omega, v]), so the
+    // translation moves by R * v
+    if (H) {
+      gtsam::Matrix16 jacobian = gtsam::Matrix16::Zero();
+      jacobian.rightCols<3>() = -pose.rotation().matrix().row(2);
+      (*H) = jacobian;
+    }
     return (gtsam::Vector1() << z_ - pose.translation().z()).finished();
   }
 };
 
+/*
+ * @class OdomCalibrationFactor
+ * @brief the odom pose of a lidar pose through the calibration tf
+ * error = Logmap(measured^-1 * calib^-1 * pose * calib), with the analytic
+ * fixed-size jacobians, it equals the expression factor of
+ * compose(between(calib, pose), calib) without its allocations in each
+ * linearization
+ */
 class OdomCalibrationFactor
     : public gtsam::NoiseModelFactor2<gtsam::Pose3 /* lidar pose */,
                                       gtsam::Pose3 /* calibration tf */> {
@@ -106,7 +120,8 @@ class OdomCalibrationFactor
    */
   bool equals(const gtsam::NonlinearFactor& p, double tol = 1e-9) const {
     const This* e = dynamic_cast<const This*>(&p);
-    return e && Base::equals(p, tol);
+    return e && Base::equals(p, tol) &&
+           gtsam::traits<gtsam::Pose3>::Equals(measured_, e->measured_, tol);
   }
 
   /** h(x)-z */
@@ -114,9 +129,30 @@ class OdomCalibrationFactor
       const gtsam::Pose3& pose, const gtsam::Pose3& calib,
       boost::optional<gtsam::Matrix&> H1 = boost::none,
       boost::optional<gtsam::Matrix&> H2 = boost::none) const {
-    auto transformed =
-        gtsam::traits<gtsam::Pose3>::Between(calib, pose, H2, H1) * calib;
-    return gtsam::traits<gtsam::Pose3>::Local(measured_, transformed);
+    const gtsam::Pose3 calib_inverse = calib.inverse();
+    // the odom pose predicted from the lidar pose
+    const gtsam::Pose3 transformed = calib_inverse * pose * calib;
+    gtsam::Matrix6 log_jacobian;
+    const gtsam::Vector6 error = gtsam::Pose3::Logmap(
+        measured_.inverse() * transformed,
+        (H1 || H2) ? &log_jacobian : nullptr);
+    // the poses are perturbed on the right, T * Exp(xi), so
+    //   pose  : calib^-1 * pose * Exp(xi) * calib
+    //           = transformed * Exp(Ad(calib^-1) * xi)
+    //   calib : Exp(-xi) * transformed * Exp(xi)
+    //           = transformed * Exp((I - Ad(transformed^-1)) * xi)
+    if (H1) {
+      const gtsam::Matrix6 jacobian =
+          log_jacobian * calib_inverse.AdjointMap();
+      (*H1) = jacobian;
+    }
+    if (H2) {
+      const gtsam::Matrix6 jacobian =
+          log_jacobian * (gtsam::Matrix6::Identity() -
+                          transformed.inverse().AdjointMap());
+      (*H2) = jacobian;
+    }
+    return error;
   }
 };
 
@@ -38,6 +38,16 @@ struct Options {
     bool enable_ndt = false;
     float voxel_filter_resolution = 0.1;
     float accepted_min_score = 0.8;
+    // memory budget of the cached ndt voxel grids of submaps
+    float ndt_cache_memory_mb = 512.;
+    // > 1 for coarse to fine matching, the coarse levels are down sampled
+    // from 2 * voxel_filter_resolution with doubled resolution
+    int pyramid_levels = 1;
+    int pyramid_coarse_max_iterations = 10;
+    // a new submap is matched to this many previous submaps in parallel,
+    // the accepted matches beyond the previous one are extra edges in the
+    // pose graph
+    int previous_submap_num = 1;
   } submap_matcher_options;
 
   SubmapOptions submap_options;
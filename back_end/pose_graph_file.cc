@@ -0,0 +1,216 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// third party
+#include <gtsam/geometry/Pose3.h>
+#include <gtsam/slam/expressions.h>
+// stl
+#include <cstring>
+#include <fstream>
+// local
+#include "back_end/gps_lever_arm_factor.h"
+#include "back_end/odom_to_pose_factor.h"
+#include "back_end/pose_graph_file.h"
+#include "common/macro_defines.h"
+
+namespace static_map {
+namespace back_end {
+
+namespace {
+
+namespace NM = gtsam::noiseModel;
+using gtsam::Pose3;
+using gtsam::Pose3_;
+
+constexpr uint32_t kPoseGraphMagic = 0x46524750;  // "PGRF"
+constexpr uint32_t kPoseGraphVersion = 1;
+
+// the file is the header followed by factor_count factors and
+// value_count value records
+struct PoseGraphHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t factor_count;
+  uint64_t value_count;
+};
+
+struct PoseGraphValueRecord {
+  uint64_t key;
+  // column major
+  double pose[16];
+};
+
+}  // namespace
+
+PoseGraphFactor MakePoseGraphFactor(
+    const PoseGraphFactor::Type type, const int first, const int second,
+    const Eigen::Matrix4d &measurement,
+    const gtsam::noiseModel::Base::shared_ptr &noise) {
+  PoseGraphFactor factor;
+  std::memset(&factor, 0, sizeof(factor));
+  factor.type = type;
+  factor.first = first;
+  factor.second = second;
+  Eigen::Map<Eigen::Matrix4d>(factor.measurement) = measurement;
+
+  NM::Diagonal::shared_ptr diagonal;
+  const auto robust = boost::dynamic_pointer_cast<NM::Robust>(noise);
+  if (robust) {
+    const auto huber =
+        boost::dynamic_pointer_cast<NM::mEstimator::Huber>(robust->robust());
+    CHECK(huber) << "only the huber robust noise is supported.";
+    factor.huber = huber->modelParameter();
+    diagonal = boost::dynamic_pointer_cast<NM::Diagonal>(robust->noise());
+  } else {
+    diagonal = boost::dynamic_pointer_cast<NM::Diagonal>(noise);
+  }
+  CHECK(diagonal) << "only the diagonal noise is supported.";
+  const gtsam::Vector sigmas = diagonal->sigmas();
+  CHECK_LE(sigmas.size(), 6);
+  factor.sigma_num = sigmas.size();
+  Eigen::Map<Eigen::VectorXd>(factor.sigmas, sigmas.size()) = sigmas;
+  return factor;
+}
+
+gtsam::noiseModel::Base::shared_ptr NoiseModel(const PoseGraphFactor &factor) {
+  const auto diagonal = NM::Diagonal::Sigmas(
+      Eigen::Map<const Eigen::VectorXd>(factor.sigmas, factor.sigma_num));
+  if (factor.huber > 0.) {
+    return NM::Robust::Create(NM::mEstimator::Huber::Create(factor.huber),
+                              diagonal);
+  }
+  return diagonal;
+}
+
+void AddToGraph(const PoseGraphFactor &factor,
+                gtsam::NonlinearFactorGraph *graph) {
+  CHECK(graph);
+  const auto noise = NoiseModel(factor);
+  const Pose3 measurement(
+      Eigen::Map<const Eigen::Matrix4d>(factor.measurement));
+  switch (factor.type) {
+    case PoseGraphFactor::kPosePrior:
+      graph->addExpressionFactor(noise, measurement,
+                                 Pose3_(PoseKey(factor.first)));
+      break;
+    case PoseGraphFactor::kBetween:
+    case PoseGraphFactor::kLoopClosure:
+      graph->addExpressionFactor(
+          noise, measurement,
+          gtsam::between(Pose3_(PoseKey(factor.first)),
+                         Pose3_(PoseKey(factor.second))));
+      break;
+    case PoseGraphFactor::kOdomCalibPrior:
+      graph->addExpressionFactor(noise, measurement, Pose3_(OdomCalibKey()));
+      break;
+    case PoseGraphFactor::kGpsCoordPrior:
+      graph->addExpressionFactor(noise, measurement, Pose3_(GpsCoordKey()));
+      break;
+    case PoseGraphFactor::kOdom:
+      // calib_tf.inverse * pose * calib_tf, with the analytic jacobians
+      graph->emplace_shared<OdomCalibrationFactor>(
+          measurement, noise, PoseKey(factor.first), OdomCalibKey());
+      break;
+    case PoseGraphFactor::kGps:
+      // map origin in GPS coord
+      graph->emplace_shared<GpsLeverArmFactor>(
+          measurement.translation(),
+          gtsam::Point3(Eigen::Map<const Eigen::Vector3d>(factor.lever_arm)),
+          noise, GpsCoordKey(), PoseKey(factor.first));
+      break;
+    default:
+      PRINT_ERROR_FMT("Unknown pose graph factor type: %d", factor.type);
+      break;
+  }
+}
+
+bool SavePoseGraph(const std::string &filename,
+                   const PoseGraphFactors &factors,
+                   const gtsam::Values &values) {
+  std::vector<PoseGraphValueRecord> records;
+  for (const auto &key_value : values) {
+    const auto *pose =
+        dynamic_cast<const gtsam::GenericValue<Pose3> *>(&key_value.value);
+    if (!pose) {
+      continue;
+    }
+    PoseGraphValueRecord record;
+    record.key = key_value.key;
+    Eigen::Map<Eigen::Matrix4d>(record.pose) = pose->value().matrix();
+    records.push_back(record);
+  }
+
+  std::ofstream file(filename,
+                     std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    PRINT_ERROR_FMT("Cannot open file: %s", filename.c_str());
+    return false;
+  }
+  PoseGraphHeader header;
+  std::memset(&header, 0, sizeof(header));
+  header.magic = kPoseGraphMagic;
+  header.version = kPoseGraphVersion;
+  header.factor_count = factors.size();
+  header.value_count = records.size();
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char *>(factors.data()),
+             factors.size() * sizeof(PoseGraphFactor));
+  file.write(reinterpret_cast<const char *>(records.data()),
+             records.size() * sizeof(PoseGraphValueRecord));
+  if (!file.good()) {
+    PRINT_ERROR_FMT("Failed to write file: %s", filename.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool LoadPoseGraph(const std::string &filename, PoseGraphFactors *factors,
+                   gtsam::Values *values) {
+  CHECK(factors && values);
+  std::ifstream file(filename, std::ios::in | std::ios::binary);
+  PoseGraphHeader header;
+  if (!file.is_open() ||
+      !file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+      header.magic != kPoseGraphMagic || header.version != kPoseGraphVersion) {
+    PRINT_ERROR_FMT("Invalid pose graph file: %s", filename.c_str());
+    return false;
+  }
+  factors->resize(header.factor_count);
+  std::vector<PoseGraphValueRecord> records(header.value_count);
+  if (!file.read(reinterpret_cast<char *>(factors->data()),
+                 factors->size() * sizeof(PoseGraphFactor)) ||
+      !file.read(reinterpret_cast<char *>(records.data()),
+                 records.size() * sizeof(PoseGraphValueRecord))) {
+    PRINT_ERROR_FMT("Truncated pose graph file: %s", filename.c_str());
+    factors->clear();
+    return false;
+  }
+  values->clear();
+  for (const auto &record : records) {
+    values->insert(record.key,
+                   Pose3(Eigen::Map<const Eigen::Matrix4d>(record.pose)));
+  }
+  return true;
+}
+
+}  // namespace back_end
+}  // namespace static_map
@@ -0,0 +1,113 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef BACK_END_POSE_GRAPH_FILE_H_
+#define BACK_END_POSE_GRAPH_FILE_H_
+
+// third party
+#include <Eigen/Core>
+#include <gtsam/inference/Symbol.h>
+#include <gtsam/linear/NoiseModel.h>
+#include <gtsam/nonlinear/NonlinearFactorGraph.h>
+#include <gtsam/nonlinear/Values.h>
+// stl
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace static_map {
+namespace back_end {
+
+// the keys of the pose graph of IsamOptimizer
+inline gtsam::Key PoseKey(const int index) {
+  return gtsam::Symbol('p', index);
+}
+inline gtsam::Key OdomCalibKey() { return gtsam::Symbol('c', 0); }
+inline gtsam::Key GpsCoordKey() { return gtsam::Symbol('g', 0); }
+// velocity and imu bias of a pose, with the imu factors only
+inline gtsam::Key VelocityKey(const int index) {
+  return gtsam::Symbol('v', index);
+}
+inline gtsam::Key ImuBiasKey(const int index) {
+  return gtsam::Symbol('b', index);
+}
+
+/*
+ * @struct PoseGraphFactor
+ * @brief a factor of the pose graph as it is saved, with the measurement
+ * and the noise instead of the gtsam expression, so the graph is rebuilt
+ * by AddToGraph() without the registrations
+ */
+struct PoseGraphFactor {
+  enum Type : int32_t {
+    kPosePrior = 0,      // on pose first
+    kBetween = 1,        // from pose first to pose second
+    kLoopClosure = 2,    // from pose first (target) to second (source)
+    kOdomCalibPrior = 3,
+    kGpsCoordPrior = 4,
+    kOdom = 5,  // odom pose of pose first, through the calibration
+    kGps = 6,   // utm of pose first, through the gps coord and lever arm
+  };
+
+  int32_t type;
+  int32_t first;
+  int32_t second;
+  // 3 for kGps, else 6
+  int32_t sigma_num;
+  // the huber threshold of the robust noise, <= 0 for the plain diagonal
+  double huber;
+  // column major, the utm is in the translation for kGps
+  double measurement[16];
+  // from tracking frame to gps, kGps only
+  double lever_arm[3];
+  double sigmas[6];
+};
+
+using PoseGraphFactors = std::vector<PoseGraphFactor>;
+
+/// @brief the factor of type with the measurement and the noise, which is
+/// a diagonal or a huber robust one over a diagonal
+PoseGraphFactor MakePoseGraphFactor(
+    const PoseGraphFactor::Type type, const int first, const int second,
+    const Eigen::Matrix4d &measurement,
+    const gtsam::noiseModel::Base::shared_ptr &noise);
+
+gtsam::noiseModel::Base::shared_ptr NoiseModel(const PoseGraphFactor &factor);
+
+/// @brief add the gtsam factor of the saved one to the graph
+void AddToGraph(const PoseGraphFactor &factor,
+                gtsam::NonlinearFactorGraph *graph);
+
+/// @brief the factors followed by the values (the Pose3 ones only), return
+/// false if the file can not be written
+bool SavePoseGraph(const std::string &filename,
+                   const PoseGraphFactors &factors,
+                   const gtsam::Values &values);
+
+/// @brief return false if the file is invalid
+bool LoadPoseGraph(const std::string &filename, PoseGraphFactors *factors,
+                   gtsam::Values *values);
+
+}  // namespace back_end
+}  // namespace static_map
+
+#endif  // BACK_END_POSE_GRAPH_FILE_H_
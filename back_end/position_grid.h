@@ -0,0 +1,136 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef BACK_END_POSITION_GRID_H_
+#define BACK_END_POSITION_GRID_H_
+// third party
+#include <Eigen/Eigen>
+// stl
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace static_map {
+namespace back_end {
+
+/*
+ * @class PositionGrid
+ * @brief 2d hash grid of the frame positions (x, y) for the radius search
+ * of the loop closure candidates, the cell width is the search radius so a
+ * query only visits the 3x3 cells around, the positions can be moved after
+ * the optimizer updates the poses
+ */
+class PositionGrid {
+ public:
+  explicit PositionGrid(const double cell_width)
+      : inverse_cell_width_(1. / cell_width) {}
+  ~PositionGrid() {}
+
+  PositionGrid(const PositionGrid &) = delete;
+  PositionGrid &operator=(const PositionGrid &) = delete;
+
+  /// @brief add the index at the position, or move it there if it is added
+  /// already, the non-finite positions are left out
+  void Update(const int index, const Eigen::Vector2d &position) {
+    if (index >= static_cast<int>(positions_.size())) {
+      positions_.resize(index + 1, Eigen::Vector2d::Constant(NAN));
+    }
+    Eigen::Vector2d &current = positions_[index];
+    const bool was_in = current.allFinite();
+    const bool is_in = position.allFinite();
+    if (was_in && is_in && CellKey(current) == CellKey(position)) {
+      current = position;
+      return;
+    }
+    if (was_in) {
+      std::vector<int> &cell = cells_[CellKey(current)];
+      cell.erase(std::find(cell.begin(), cell.end(), index));
+    }
+    if (is_in) {
+      cells_[CellKey(position)].push_back(index);
+    }
+    current = position;
+  }
+
+  /// @brief the indices in [start_index, end_index) within the radius
+  /// (not larger than the cell width) of position, in ascending order
+  void RadiusSearch(const Eigen::Vector2d &position, const double radius,
+                    const int start_index, const int end_index,
+                    std::vector<int> *const indices,
+                    std::vector<double> *const distances) const {
+    indices->clear();
+    distances->clear();
+    if (!position.allFinite()) {
+      return;
+    }
+    const int64_t x = CellCoord(position[0]);
+    const int64_t y = CellCoord(position[1]);
+    for (int64_t i = x - 1; i <= x + 1; ++i) {
+      for (int64_t j = y - 1; j <= y + 1; ++j) {
+        const auto cell = cells_.find(Key(i, j));
+        if (cell == cells_.end()) {
+          continue;
+        }
+        for (const int index : cell->second) {
+          if (index >= start_index && index < end_index &&
+              Distance(positions_[index], position) <= radius) {
+            indices->push_back(index);
+          }
+        }
+      }
+    }
+    std::sort(indices->begin(), indices->end());
+    distances->reserve(indices->size());
+    for (const int index : *indices) {
+      distances->push_back(Distance(positions_[index], position));
+    }
+  }
+
+ private:
+  inline int64_t CellCoord(const double value) const {
+    return static_cast<int64_t>(std::floor(value * inverse_cell_width_));
+  }
+  // in float as the former linear search
+  static inline double Distance(const Eigen::Vector2d &a,
+                                const Eigen::Vector2d &b) {
+    return (a.cast<float>() - b.cast<float>()).norm();
+  }
+  static inline uint64_t Key(const int64_t x, const int64_t y) {
+    return (static_cast<uint64_t>(x) << 32) ^
+           (static_cast<uint64_t>(y) & 0xffffffffu);
+  }
+  inline uint64_t CellKey(const Eigen::Vector2d &position) const {
+    return Key(CellCoord(position[0]), CellCoord(position[1]));
+  }
+
+  const double inverse_cell_width_;
+  std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d>>
+      positions_;
+  std::unordered_map<uint64_t, std::vector<int>> cells_;
+};
+
+}  // namespace back_end
+}  // namespace static_map
+
+#endif  // BACK_END_POSITION_GRID_H_
@@ -21,8 +21,13 @@
 // SOFTWARE.
 
 // stl
+#include <algorithm>
+#include <cmath>
 #include <fstream>
+#include <map>
+#include <numeric>
 #include <ostream>
+#include <utility>
 // local
 #include "back_end/view_graph.h"
 #include "common/macro_defines.h"
@@ -34,62 +39,69 @@
 namespace static_map {
 namespace back_end {
 
+constexpr int ViewGraph::kMaxImageSide;
+constexpr int ViewGraph::kTileSide;
+
 void ViewGraph::AddEdge(const int64_t a, const int64_t b,
                         const Eigen::Matrix4f &t) {
-  if (graph_map_.find(a) == graph_map_.end() ||
-      graph_map_.find(b) == graph_map_.end()) {
+  const auto from = slots_.find(a);
+  const auto to = slots_.find(b);
+  if (from == slots_.end() || to == slots_.end()) {
     PRINT_ERROR("Cannot find the index a or b in the map.");
     return;
   }
-  graph_map_[a].connections.push_back(std::make_pair(b, t));
+  edges_.push_back(Edge{from->second, to->second});
 }
 
 void ViewGraph::AddVertex(const int64_t index, const Eigen::Matrix4f &pose) {
-  if (graph_map_.find(index) == graph_map_.end()) {
-    graph_map_.emplace(index, GraphItem());
+  const auto inserted =
+      slots_.emplace(index, static_cast<uint32_t>(indices_.size()));
+  if (inserted.second) {
+    indices_.push_back(index);
+    positions_.emplace_back();
   }
-  graph_map_[index].self_pose = pose;
+  positions_[inserted.first->second] << pose(0, 3), pose(1, 3);
+}
 
-  // update bbox
-  if (pose(0, 3) < min_bounding_[0]) {
-    min_bounding_[0] = pose(0, 3);
-  }
-  if (pose(1, 3) < min_bounding_[1]) {
-    min_bounding_[1] = pose(1, 3);
+void ViewGraph::SaveTextFile(const std::string &filename) {
+  std::ofstream file(filename);
+  if (!file.is_open()) {
+    PRINT_ERROR("Failed to open file.");
+    return;
   }
-  if (pose(0, 3) > max_bounding_[0]) {
-    max_bounding_[0] = pose(0, 3);
+  // the edges grouped by their from vertices, in the order of insertion
+  const size_t vertex_num = indices_.size();
+  std::vector<uint32_t> offsets(vertex_num + 1, 0u);
+  for (const auto &edge : edges_) {
+    offsets[edge.from + 1]++;
   }
-  if (pose(1, 3) > max_bounding_[1]) {
-    max_bounding_[1] = pose(1, 3);
+  std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+  std::vector<uint32_t> targets(edges_.size());
+  std::vector<uint32_t> cursors(offsets.begin(), offsets.end() - 1);
+  for (const auto &edge : edges_) {
+    targets[cursors[edge.from]++] = edge.to;
   }
-}
 
-void ViewGraph::SaveTextFile(const std::string &filename) {
-  std::ofstream file(filename);
-  if (file.is_open()) {
-    std::string content;
-
-    for (auto &item : graph_map_) {
-      content += std::to_string(item.first);
-      content += " > ";
-      for (auto &connect : item.second.connections) {
-        content += (std::to_string(connect.first) + ", ");
-      }
-      content += "\n";
+  // the vertices in the order of their indices
+  std::vector<uint32_t> order(vertex_num);
+  std::iota(order.begin(), order.end(), 0u);
+  std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+    return indices_[a] < indices_[b];
+  });
+  for (const uint32_t slot : order) {
+    file << indices_[slot] << " > ";
+    for (uint32_t i = offsets[slot]; i < offsets[slot + 1]; ++i) {
+      file << indices_[targets[i]] << ", ";
     }
-
-    file << content;
-    file.close();
-  } else {
-    PRINT_ERROR("Failed to open file.");
+    file << "\n";
   }
+  file.close();
 }
 
 /// @brief save the graph into a png image file
 void ViewGraph::SaveImage(const std::string &filename,
                           const double resolution) {
-  if (graph_map_.empty()) {
+  if (positions_.empty()) {
     PRINT_WARNING("Graph is empty, output nothing.");
     return;
   }
@@ -97,55 +109,124 @@ void ViewGraph::SaveImage(const std::string &filename,
   PRINT_WARNING("Option: Do not use OpenCV, so not able to save to image.");
   return;
 #else
-  const double edge_width = 1.;
-  max_bounding_[0] += edge_width;
-  max_bounding_[1] += edge_width;
-  min_bounding_[0] -= edge_width;
-  min_bounding_[1] -= edge_width;
-  Eigen::Vector2d image_bbox = max_bounding_ - min_bounding_;
-  image_bbox /= resolution;
-  // std::cout << image_bbox << std::endl;
-
-  auto pose_to_image = [&](const Eigen::Matrix4f &pose) -> std::pair<int, int> {
-    Eigen::Vector2d image_position(pose(0, 3), pose(1, 3));
-    image_position[0] -= min_bounding_[0];
-    image_position[1] = max_bounding_[1] - image_position[1];
-    image_position /= resolution;
-    return std::make_pair(static_cast<int>(image_position[0]),
-                          static_cast<int>(image_position[1]));
+  const float edge_width = 1.f;
+  Eigen::Vector2f min_bounding = positions_.front();
+  Eigen::Vector2f max_bounding = positions_.front();
+  for (const auto &position : positions_) {
+    min_bounding = min_bounding.cwiseMin(position);
+    max_bounding = max_bounding.cwiseMax(position);
+  }
+  min_bounding -= Eigen::Vector2f::Constant(edge_width);
+  max_bounding += Eigen::Vector2f::Constant(edge_width);
+  const Eigen::Vector2d image_bbox =
+      (max_bounding - min_bounding).cast<double>() / resolution;
+  const int64_t width = static_cast<int64_t>(image_bbox[0]);
+  const int64_t height = static_cast<int64_t>(image_bbox[1]);
+
+  // the vertices in the full resolution image, y points down
+  std::vector<Eigen::Vector2d> pixels(positions_.size());
+  for (size_t i = 0; i < positions_.size(); ++i) {
+    pixels[i] << positions_[i][0] - min_bounding[0],
+        max_bounding[1] - positions_[i][1];
+    pixels[i] /= resolution;
+  }
+  const int line_width = 2;
+  // the sequential edges in red, the others (loop closures) in blue
+  auto draw_edge = [&](const Edge &edge, const double scale,
+                       const Eigen::Vector2d &origin, cv::Mat *image) {
+    const Eigen::Vector2d from = pixels[edge.from] * scale - origin;
+    const Eigen::Vector2d to = pixels[edge.to] * scale - origin;
+    const cv::Scalar color = indices_[edge.to] - indices_[edge.from] == 1
+                                 ? cv::Scalar(0, 0, 255)
+                                 : cv::Scalar(255, 0, 0);
+    cv::line(*image,
+             cv::Point(static_cast<int>(from[0]), static_cast<int>(from[1])),
+             cv::Point(static_cast<int>(to[0]), static_cast<int>(to[1])),
+             color, line_width, CV_AA);
   };
 
-  cv::Mat image(static_cast<int>(image_bbox[1]),
-                static_cast<int>(image_bbox[0]), CV_8UC3,
-                cv::Scalar(255, 255, 255));
-  if (image.empty()) {
-    PRINT_ERROR("image is empty.");
+  if (width <= kMaxImageSide && height <= kMaxImageSide) {
+    cv::Mat image(static_cast<int>(height), static_cast<int>(width), CV_8UC3,
+                  cv::Scalar(255, 255, 255));
+    if (image.empty()) {
+      PRINT_ERROR("image is empty.");
+      return;
+    }
+    for (const auto &edge : edges_) {
+      draw_edge(edge, 1., Eigen::Vector2d::Zero(), &image);
+    }
+    cv::imwrite(filename, image);
     return;
   }
 
-  for (auto &item : graph_map_) {
-    auto from_index = item.first;
-    auto from_coord_in_image = pose_to_image(item.second.self_pose);
-    for (auto &connect : item.second.connections) {
-      auto to_index = connect.first;
-      auto to_coord_in_image = pose_to_image(graph_map_[to_index].self_pose);
-      if (to_index - from_index == 1) {
-        cv::line(
-            image,
-            cv::Point(from_coord_in_image.first, from_coord_in_image.second),
-            cv::Point(to_coord_in_image.first, to_coord_in_image.second),
-            cv::Scalar(0, 0, 255), 2, CV_AA);
-      } else {
-        cv::line(
-            image,
-            cv::Point(from_coord_in_image.first, from_coord_in_image.second),
-            cv::Point(to_coord_in_image.first, to_coord_in_image.second),
-            cv::Scalar(255, 0, 0), 2, CV_AA);
+  // too large for one image, the overview is downscaled into
+  // kMaxImageSide pixels
+  const double scale =
+      static_cast<double>(kMaxImageSide) / std::max(width, height);
+  cv::Mat overview(std::max(1, static_cast<int>(height * scale)),
+                   std::max(1, static_cast<int>(width * scale)), CV_8UC3,
+                   cv::Scalar(255, 255, 255));
+  for (const auto &edge : edges_) {
+    draw_edge(edge, scale, Eigen::Vector2d::Zero(), &overview);
+  }
+  cv::imwrite(filename, overview);
+  overview.release();
+
+  // the edges by the tiles their bounding boxes cross, the tiles without
+  // any edge are not written
+  std::map<std::pair<int, int> /* row, col */, std::vector<uint32_t>>
+      tile_edges;
+  for (uint32_t i = 0; i < edges_.size(); ++i) {
+    const Eigen::Vector2d &from = pixels[edges_[i].from];
+    const Eigen::Vector2d &to = pixels[edges_[i].to];
+    const Eigen::Vector2d min_pixel =
+        from.cwiseMin(to) - Eigen::Vector2d::Constant(line_width);
+    const Eigen::Vector2d max_pixel =
+        from.cwiseMax(to) + Eigen::Vector2d::Constant(line_width);
+    const int min_col = std::max(0, static_cast<int>(min_pixel[0]) / kTileSide);
+    const int min_row = std::max(0, static_cast<int>(min_pixel[1]) / kTileSide);
+    const int max_col = static_cast<int>(max_pixel[0]) / kTileSide;
+    const int max_row = static_cast<int>(max_pixel[1]) / kTileSide;
+    for (int row = min_row; row <= max_row; ++row) {
+      for (int col = min_col; col <= max_col; ++col) {
+        tile_edges[std::make_pair(row, col)].push_back(i);
       }
     }
   }
 
-  cv::imwrite(filename, image);
+  std::string name = filename;
+  std::string extension = "";
+  const size_t dot = filename.find_last_of('.');
+  const size_t slash = filename.find_last_of('/');
+  if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+    name = filename.substr(0, dot);
+    extension = filename.substr(dot);
+  }
+  // one tile in RAM at a time, row by row
+  cv::Mat tile(kTileSide, kTileSide, CV_8UC3);
+  for (const auto &pair : tile_edges) {
+    const int row = pair.first.first;
+    const int col = pair.first.second;
+    if (static_cast<int64_t>(row) * kTileSide >= height ||
+        static_cast<int64_t>(col) * kTileSide >= width) {
+      continue;
+    }
+    // the last tiles of a row or a column are cropped by the image
+    cv::Mat cropped = tile(cv::Rect(
+        0, 0, std::min<int64_t>(kTileSide, width - col * kTileSide),
+        std::min<int64_t>(kTileSide, height - row * kTileSide)));
+    cropped.setTo(cv::Scalar(255, 255, 255));
+    const Eigen::Vector2d origin(col * kTileSide, row * kTileSide);
+    for (const uint32_t i : pair.second) {
+      draw_edge(edges_[i], 1., origin, &cropped);
+    }
+    cv::imwrite(name + "_" + std::to_string(row) + "_" +
+                    std::to_string(col) + extension,
+                cropped);
+  }
+  PRINT_INFO_FMT("Graph image of %ldx%ld pixels, saved as an overview and "
+                 "%lu tiles.",
+                 width, height, tile_edges.size());
 #endif
 }
 
@@ -25,57 +25,55 @@
 // third party
 #include <Eigen/Eigen>
 // stl
-#include <limits>
-#include <map>
+#include <cstdint>
 #include <string>
-#include <utility>
+#include <unordered_map>
 #include <vector>
 
 namespace static_map {
 namespace back_end {
 
+/*
+ * @class ViewGraph
+ * @brief the vertices and edges of a pose graph for diagnostics, only the
+ * xy positions are kept, in contiguous arrays
+ */
 class ViewGraph {
  public:
-  ViewGraph() {
-    min_bounding_ << std::numeric_limits<double>::max(),
-        std::numeric_limits<double>::max();
-    max_bounding_ << std::numeric_limits<double>::min(),
-        std::numeric_limits<double>::min();
-  }
+  ViewGraph() {}
   ~ViewGraph() {}
 
   ViewGraph(const ViewGraph &) = delete;
   ViewGraph &operator=(const ViewGraph &) = delete;
 
-  // @todo matrix4f pitfalls
-  using Connect =
-      std::pair<int64_t /* index */, Eigen::Matrix4f /* Transform */>;
-  struct GraphItem {
-    Eigen::Matrix4f self_pose;
-    std::vector<Connect> connections;
-
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
-  };
-
   /// @breif add a new vertex if not exist, or update the pose
   void AddVertex(const int64_t index, const Eigen::Matrix4f &pose);
-  /// @brief connect a -> b with t(transform in matrix)
+  /// @brief connect a -> b with t(transform in matrix), only the
+  /// connection is kept
   void AddEdge(const int64_t a, const int64_t b, const Eigen::Matrix4f &t);
   /// @brief save the grapg into a text file
   void SaveTextFile(const std::string &filename);
-  /// @brief save the graph into a png image file (using OpenCV)
+  /// @brief save the graph into a png image file (using OpenCV), a graph
+  /// larger than kMaxImageSide pixels is saved as a downscaled overview in
+  /// the file and the tiles of the full resolution beside it, named
+  /// <name>_<row>_<col>.<ext>
   void SaveImage(const std::string &filename, const double resolution = 0.05);
 
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
-
- protected:
-  void CalcualtePixels();
+  static constexpr int kMaxImageSide = 8192;
+  static constexpr int kTileSide = 4096;
 
  private:
-  std::map<int64_t, GraphItem> graph_map_;
+  // the slots of the vertices in the arrays
+  struct Edge {
+    uint32_t from;
+    uint32_t to;
+  };
 
-  Eigen::Vector2d min_bounding_;
-  Eigen::Vector2d max_bounding_;
+  // the vertices in the order of insertion
+  std::vector<int64_t> indices_;
+  std::vector<Eigen::Vector2f> positions_;
+  std::unordered_map<int64_t, uint32_t> slots_;
+  std::vector<Edge> edges_;
 };
 
 }  // namespace back_end
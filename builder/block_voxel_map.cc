@@ -0,0 +1,270 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// stl
+#include <algorithm>
+#include <cstring>
+// local
+#include "builder/block_voxel_map.h"
+#include "builder/multi_resolution_voxel_map.h"
+#include "common/point_types.h"
+#include "common/point_utils.h"
+
+namespace static_map {
+
+template <typename PointT>
+BlockVoxelMap<PointT>::LeafBlock::LeafBlock() : touched_in_scan(false) {
+  std::memset(observed, 0, sizeof(observed));
+  std::memset(hit_in_scan, 0, sizeof(hit_in_scan));
+  std::memset(missed_in_scan, 0, sizeof(missed_in_scan));
+  std::memset(probability, kUnknown, sizeof(probability));
+  std::memset(point_num, 0, sizeof(point_num));
+  std::memset(max_intensity, 0, sizeof(max_intensity));
+}
+
+template <typename PointT>
+BlockVoxelMap<PointT>::BlockVoxelMap() : odds_table_(kTableSize) {
+  for (size_t i = 0; i < kTableSize; ++i) {
+    const float prob = static_cast<float>(i) / kTableSize;
+    odds_table_[i] = std::log(prob / (1. - prob));
+  }
+}
+
+template <typename PointT>
+void BlockVoxelMap<PointT>::InsertPointCloud(
+    const PointCloudPtr& cloud, const Eigen::Vector3f& origin,
+    const MrvmSettings& settings, const Eigen::AlignedBox3i* bounds) {
+  Eigen::Vector3f offseted_origin = origin;
+  offseted_origin[2] += settings.z_offset;
+  const float resolution = settings.high_resolution;
+  KeyInt3 origin_index;
+  if (!common::PointToVoxel(offseted_origin, resolution, &origin_index)) {
+    PRINT_ERROR("origin is nan.");
+    return;
+  }
+  // the same as MultiResolutionVoxelMap
+  auto to_odd = [](float prob) { return std::log(prob / (1. - prob)); };
+  const float hit_log_odd = to_odd(settings.hit_prob);
+  const float miss_log_odd = to_odd(settings.miss_prob);
+  auto update_prob = [&](Probability former_prob, bool hit) -> Probability {
+    float odd = odds_table_[former_prob];
+    odd += hit ? hit_log_odd : miss_log_odd;
+    const float prob =
+        Clamp<float>(1. - 1. / (1. + std::exp(odd)), kMinProb, kMaxProb);
+    return (Probability)(prob * kTableSize);
+  };
+
+  std::vector<LeafBlock*> touched_blocks;
+  std::vector<KeyInt3> end_indices;
+  // the end voxels out of the bounds, only their rays are cast
+  std::vector<KeyInt3> outside_end_indices;
+  auto update_end_voxel = [&](const PointT& point, const KeyInt3& end_index) {
+    if (bounds && !bounds->contains(end_index)) {
+      if (settings.discretized_insertion) {
+        outside_end_indices.push_back(end_index);
+      }
+      return;
+    }
+    LeafBlock& block = blocks_[BlockIndex(end_index)];
+    if (!block.touched_in_scan) {
+      block.touched_in_scan = true;
+      touched_blocks.push_back(&block);
+    }
+    const int offset = VoxelOffset(end_index);
+    SetBit(block.observed, offset);
+    if (!TestBit(block.hit_in_scan, offset)) {
+      SetBit(block.hit_in_scan, offset);
+      end_indices.push_back(end_index);
+    }
+    const int intensity = Clamp(static_cast<int>(point.intensity), 0,
+                                static_cast<int>(UINT16_MAX));
+    if (intensity > block.max_intensity[offset]) {
+      block.max_intensity[offset] = intensity;
+    }
+    block.probability[offset] = update_prob(block.probability[offset], true);
+    if (block.point_num[offset] < settings.max_point_num_in_cell) {
+      FATAL_CHECK_POINT(point);
+      ++block.point_num[offset];
+      block.points.push_back(point);
+      block.point_offsets.push_back(offset);
+    }
+  };
+  // the block of the last voxel is cached, it is looked up only
+  // when the ray enters a new block
+  auto update_ray = [&](const Eigen::Vector3f& ray_end,
+                        const KeyInt3& end_index) {
+    KeyInt3 cached_index = BlockIndex(end_index);
+    auto cached_it = blocks_.find(cached_index);
+    LeafBlock* cached_block =
+        cached_it == blocks_.end() ? nullptr : &cached_it->second;
+    common::VisitVoxelsBresenham(
+        offseted_origin, ray_end, resolution, [&](const KeyInt3& index) {
+          if (index == end_index) {
+            return false;
+          }
+          const KeyInt3 block_index = BlockIndex(index);
+          if (block_index != cached_index) {
+            cached_index = block_index;
+            auto it = blocks_.find(block_index);
+            cached_block = it == blocks_.end() ? nullptr : &it->second;
+          }
+          if (cached_block == nullptr) {
+            return true;
+          }
+          LeafBlock& block = *cached_block;
+          const int offset = VoxelOffset(index);
+          if (!TestBit(block.observed, offset) ||
+              TestBit(block.missed_in_scan, offset)) {
+            return true;
+          }
+          if (TestBit(block.hit_in_scan, offset)) {
+            // hit by another ray of this scan, the voxels behind it
+            // are treated as occluded if stop_ray_at_hit_voxel
+            return !settings.stop_ray_at_hit_voxel;
+          }
+          if (settings.discretized_insertion) {
+            if (!block.touched_in_scan) {
+              block.touched_in_scan = true;
+              touched_blocks.push_back(&block);
+            }
+            SetBit(block.missed_in_scan, offset);
+          }
+          block.probability[offset] =
+              update_prob(block.probability[offset], false);
+          return true;
+        });
+  };
+
+  const size_t cloud_size = cloud->size();
+  if (settings.discretized_insertion) {
+    for (size_t i = 0; i < cloud_size; ++i) {
+      const auto& point = cloud->points[i];
+      const Eigen::Vector3f point_vec(point.x, point.y, point.z);
+      KeyInt3 end_index;
+      if (common::PointToVoxel(point_vec, resolution, &end_index)) {
+        update_end_voxel(point, end_index);
+      }
+    }
+    // the rays out of the bounds are cast once for each end voxel too
+    std::sort(outside_end_indices.begin(), outside_end_indices.end(),
+              [](const KeyInt3& a, const KeyInt3& b) {
+                return std::lexicographical_compare(a.data(), a.data() + 3,
+                                                    b.data(), b.data() + 3);
+              });
+    outside_end_indices.erase(
+        std::unique(outside_end_indices.begin(), outside_end_indices.end()),
+        outside_end_indices.end());
+    end_indices.insert(end_indices.end(), outside_end_indices.begin(),
+                       outside_end_indices.end());
+    for (const KeyInt3& end_index : end_indices) {
+      const Eigen::Vector3f center =
+          (end_index.cast<float>() + Eigen::Vector3f::Constant(0.5f)) *
+          resolution;
+      update_ray(center, end_index);
+    }
+  } else {
+    for (size_t i = 0; i < cloud_size; ++i) {
+      const auto& point = cloud->points[i];
+      const Eigen::Vector3f point_vec(point.x, point.y, point.z);
+      KeyInt3 end_index;
+      if (!common::PointToVoxel(point_vec, resolution, &end_index)) {
+        continue;
+      }
+      update_end_voxel(point, end_index);
+      update_ray(point_vec, end_index);
+    }
+  }
+
+  for (LeafBlock* block : touched_blocks) {
+    std::memset(block->hit_in_scan, 0, sizeof(block->hit_in_scan));
+    std::memset(block->missed_in_scan, 0, sizeof(block->missed_in_scan));
+    block->touched_in_scan = false;
+  }
+}
+
+template <typename PointT>
+size_t BlockVoxelMap<PointT>::OutputBlocks(float threshold,
+                                           const MrvmSettings& settings,
+                                           size_t first_block,
+                                           size_t last_block,
+                                           PointT* points) const {
+  const Probability prob_threshold = threshold * kTableSize;
+  std::vector<float> sums;
+  size_t output_num = 0;
+  for (auto it = blocks_.begin() + first_block;
+       it != blocks_.begin() + last_block; ++it) {
+    const LeafBlock& block = it->second;
+    auto output = [&](const int offset) {
+      return TestBit(block.observed, offset) &&
+             block.probability[offset] >= prob_threshold;
+    };
+    const size_t point_num = block.points.size();
+    if (points == nullptr) {
+      for (int offset = 0; offset < kLeafVoxelNum; ++offset) {
+        if (output(offset)) {
+          output_num += settings.output_average ? 1 : block.point_num[offset];
+        }
+      }
+    } else if (settings.output_average) {
+      sums.assign(kLeafVoxelNum * 4, 0.f);
+      for (size_t i = 0; i < point_num; ++i) {
+        const int offset = block.point_offsets[i];
+        const auto& point = block.points[i];
+        float* sum = &sums[offset * 4];
+        sum[0] += point.x;
+        sum[1] += point.y;
+        sum[2] += point.z;
+        sum[3] += point.intensity;
+      }
+      for (int offset = 0; offset < kLeafVoxelNum; ++offset) {
+        if (!output(offset)) {
+          continue;
+        }
+        CHECK_GT(block.point_num[offset], 0);
+        const float size = block.point_num[offset];
+        const float* sum = &sums[offset * 4];
+        PointT& average_point = points[output_num++];
+        average_point.x = sum[0] / size;
+        average_point.y = sum[1] / size;
+        average_point.z = sum[2] / size;
+        average_point.intensity = sum[3] / size;
+      }
+    } else {
+      for (size_t i = 0; i < point_num; ++i) {
+        const int offset = block.point_offsets[i];
+        if (output(offset)) {
+          PointT& point = points[output_num++];
+          point = block.points[i];
+          point.intensity = block.max_intensity[offset];
+        }
+      }
+    }
+  }
+  return output_num;
+}
+
+template class BlockVoxelMap<pcl::PointXYZI>;
+#ifdef _USE_COMPACT_POINT_
+template class BlockVoxelMap<PointXYZIc>;
+#endif
+
+}  // namespace static_map
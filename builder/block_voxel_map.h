@@ -0,0 +1,121 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef BUILDER_BLOCK_VOXEL_MAP_H_
+#define BUILDER_BLOCK_VOXEL_MAP_H_
+
+// stl
+#include <cstdint>
+#include <vector>
+// third party
+#include "Eigen/Core"
+#include "Eigen/Geometry"
+#include "pcl/point_cloud.h"
+#include "pcl/point_types.h"
+// local
+#include "common/voxel_hash_map.h"
+
+namespace static_map {
+
+struct MrvmSettings;
+
+/// @class BlockVoxelMap
+/// @brief the block storage of MultiResolutionVoxelMap (like the leaf nodes
+/// of VDB), the voxels are grouped into 8^3 blocks with dense arrays of
+/// probabilities and bitmasks for the states, the points of a block are
+/// kept in one vector. a ray only looks the block up when it enters it
+/// @note it is used through MultiResolutionVoxelMap with the settings
+/// "block_storage", the result is the same as the one of the flat storage
+/// except the order of the output points
+template <typename PointT>
+class BlockVoxelMap {
+ public:
+  using PointCloudType = pcl::PointCloud<PointT>;
+  using PointCloudPtr = typename PointCloudType::Ptr;
+  using KeyInt3 = Eigen::Vector3i;
+
+  static constexpr int kLeafBits = 3;
+  static constexpr int kLeafSize = 1 << kLeafBits;
+  static constexpr int kLeafVoxelNum = kLeafSize * kLeafSize * kLeafSize;
+  static constexpr int kMaskWordNum = kLeafVoxelNum / 64;
+
+  BlockVoxelMap();
+  ~BlockVoxelMap() = default;
+
+  BlockVoxelMap(const BlockVoxelMap&) = delete;
+  BlockVoxelMap& operator=(const BlockVoxelMap&) = delete;
+
+  /// @param bounds the voxels out of it are not kept, nullptr for no bounds
+  void InsertPointCloud(const PointCloudPtr& cloud,
+                        const Eigen::Vector3f& origin,
+                        const MrvmSettings& settings,
+                        const Eigen::AlignedBox3i* bounds);
+
+  /// @brief output the blocks [first_block, last_block) in the order of the
+  /// iteration into 'points', they are only counted if it is nullptr
+  /// @return the number of the output points
+  size_t OutputBlocks(float threshold, const MrvmSettings& settings,
+                      size_t first_block, size_t last_block,
+                      PointT* points) const;
+
+  inline size_t BlockNum() const { return blocks_.size(); }
+
+ private:
+  struct LeafBlock {
+    LeafBlock();
+    // the voxels hit at least once
+    uint64_t observed[kMaskWordNum];
+    // the states in the current scan
+    uint64_t hit_in_scan[kMaskWordNum];
+    uint64_t missed_in_scan[kMaskWordNum];
+    uint8_t probability[kLeafVoxelNum];
+    uint8_t point_num[kLeafVoxelNum];
+    uint16_t max_intensity[kLeafVoxelNum];
+    bool touched_in_scan;
+    // the points and the offsets of their voxels in the block
+    std::vector<PointT, Eigen::aligned_allocator<PointT>> points;
+    std::vector<uint16_t> point_offsets;
+  };
+
+  static inline KeyInt3 BlockIndex(const KeyInt3& index) {
+    return KeyInt3(index[0] >> kLeafBits, index[1] >> kLeafBits,
+                   index[2] >> kLeafBits);
+  }
+  static inline int VoxelOffset(const KeyInt3& index) {
+    constexpr int kMask = kLeafSize - 1;
+    return ((index[0] & kMask) << (2 * kLeafBits)) |
+           ((index[1] & kMask) << kLeafBits) | (index[2] & kMask);
+  }
+  static inline bool TestBit(const uint64_t* mask, const int offset) {
+    return (mask[offset >> 6] >> (offset & 63)) & 1u;
+  }
+  static inline void SetBit(uint64_t* mask, const int offset) {
+    mask[offset >> 6] |= (uint64_t(1) << (offset & 63));
+  }
+
+  common::VoxelHashMap<LeafBlock> blocks_;
+  std::vector<float> odds_table_;
+};
+
+}  // namespace static_map
+
+#endif  // BUILDER_BLOCK_VOXEL_MAP_H_
@@ -81,6 +81,87 @@ class OdomToMapPath {
   Eigen::Vector3d direction_;
 };
 
+/// @class OdomToMapPathAnalytic
+/// @brief the same residual as OdomToMapPath with the analytic jacobians,
+/// for the calibrations over thousands of submaps
+/// @note the odom position in map is R^T * ((Ro - I) * t + to), the
+/// residual is the norm of its offset to the path line
+class OdomToMapPathAnalytic : public ceres::SizedCostFunction<1, 3, 3> {
+ public:
+  OdomToMapPathAnalytic(const Eigen::Vector3d& map_position,
+                        const Eigen::Matrix4d& odom_pose,
+                        const Eigen::Vector3d& map_direction)
+      : map_(map_position),
+        odom_rotation_minus_identity_(odom_pose.block<3, 3>(0, 0) -
+                                      Eigen::Matrix3d::Identity()),
+        odom_translation_(odom_pose.block<3, 1>(0, 3)) {
+    const Eigen::Vector3d direction = map_direction.normalized();
+    projection_ =
+        Eigen::Matrix3d::Identity() - direction * direction.transpose();
+  }
+
+  bool Evaluate(double const* const* parameters, double* residuals,
+                double** jacobians) const override {
+    const Eigen::Map<const Eigen::Vector3d> t(parameters[0]);
+    const double* const r = parameters[1];
+    // R = Rz * Ry * Rx as common::EulerAnglesToRotationMatrix
+    const Eigen::Matrix3d rx_t =
+        Eigen::AngleAxisd(-r[0], Eigen::Vector3d::UnitX()).toRotationMatrix();
+    const Eigen::Matrix3d ry_t =
+        Eigen::AngleAxisd(-r[1], Eigen::Vector3d::UnitY()).toRotationMatrix();
+    const Eigen::Matrix3d rz_t =
+        Eigen::AngleAxisd(-r[2], Eigen::Vector3d::UnitZ()).toRotationMatrix();
+    const Eigen::Matrix3d rotation_t = rx_t * ry_t * rz_t;
+
+    const Eigen::Vector3d v =
+        odom_rotation_minus_identity_ * t + odom_translation_;
+    const Eigen::Vector3d offset = projection_ * (rotation_t * v - map_);
+    const double distance = offset.norm();
+    residuals[0] = distance;
+    if (jacobians == nullptr) {
+      return true;
+    }
+
+    // d(distance) = offset^T / distance * d(position), the projection is
+    // already in the offset. no gradient on the path line
+    const Eigen::RowVector3d gradient =
+        distance > 1.e-12 ? Eigen::RowVector3d(offset.transpose() / distance)
+                          : Eigen::RowVector3d::Zero();
+    if (jacobians[0] != nullptr) {
+      Eigen::Map<Eigen::RowVector3d> jacobian_t(jacobians[0]);
+      jacobian_t = gradient * rotation_t * odom_rotation_minus_identity_;
+    }
+    if (jacobians[1] != nullptr) {
+      // d(Ra(a)^T)/da = -[e]x * Ra(a)^T
+      const Eigen::Vector3d rz_v = rz_t * v;
+      const Eigen::Vector3d ry_rz_v = ry_t * rz_v;
+      Eigen::Map<Eigen::RowVector3d> jacobian_r(jacobians[1]);
+      jacobian_r[0] = -gradient.dot(Eigen::Vector3d::UnitX().cross(
+          rx_t * ry_rz_v));
+      jacobian_r[1] = -gradient.dot(
+          rx_t * Eigen::Vector3d::UnitY().cross(ry_rz_v));
+      jacobian_r[2] = -gradient.dot(
+          rx_t * ry_t * Eigen::Vector3d::UnitZ().cross(rz_v));
+    }
+    return true;
+  }
+
+  static ceres::CostFunction* Create(const Eigen::Vector3d& map_position,
+                                     const Eigen::Matrix4d& odom_pose,
+                                     const Eigen::Vector3d& map_direction) {
+    return new OdomToMapPathAnalytic(map_position, odom_pose, map_direction);
+  }
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+ private:
+  Eigen::Vector3d map_;
+  Eigen::Matrix3d odom_rotation_minus_identity_;
+  Eigen::Vector3d odom_translation_;
+  // removes the part along the path direction
+  Eigen::Matrix3d projection_;
+};
+
 }  // namespace cost_functions
 }  // namespace static_map
 
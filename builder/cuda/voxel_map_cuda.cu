@@ -0,0 +1,592 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "voxel_map_cuda.h"
+
+#include <thrust/copy.h>
+#include <thrust/device_ptr.h>
+#include <thrust/device_vector.h>
+#include <thrust/execution_policy.h>
+#include <thrust/functional.h>
+#include <thrust/iterator/constant_iterator.h>
+#include <thrust/iterator/counting_iterator.h>
+#include <thrust/scan.h>
+#include <thrust/sequence.h>
+#include <thrust/sort.h>
+#include <thrust/transform_reduce.h>
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+
+namespace static_map {
+namespace cuda {
+
+namespace {
+
+constexpr int kBlockSize = 256;
+constexpr uint64_t kEmptyKey = ~0ull;
+constexpr int kMinTableSize = 1024;
+// the states of the end voxels
+constexpr int kInvalid = 0;
+constexpr int kHit = 1;
+
+inline int BlockNum(const int num) {
+  return (num + kBlockSize - 1) / kBlockSize;
+}
+
+inline bool CheckCudaError(const cudaError_t error, const char* what) {
+  if (error != cudaSuccess) {
+    fprintf(stderr, "%s: %s\n", what, cudaGetErrorString(error));
+    return false;
+  }
+  return true;
+}
+
+// the same as PackVoxelKey and HashVoxelKey in common/voxel_hash_map.h
+__host__ __device__ inline uint64_t SpreadBits(uint64_t v) {
+  v &= (1ull << 21) - 1u;
+  v = (v | v << 32) & 0x1f00000000ffffull;
+  v = (v | v << 16) & 0x1f0000ff0000ffull;
+  v = (v | v << 8) & 0x100f00f00f00f00full;
+  v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+  v = (v | v << 2) & 0x1249249249249249ull;
+  return v;
+}
+
+__host__ __device__ inline uint64_t PackVoxelKey(const int x, const int y,
+                                                 const int z) {
+  const int64_t kOffset = 1 << 20;
+  return SpreadBits(static_cast<uint64_t>(x + kOffset)) |
+         SpreadBits(static_cast<uint64_t>(y + kOffset)) << 1 |
+         SpreadBits(static_cast<uint64_t>(z + kOffset)) << 2;
+}
+
+__host__ __device__ inline int HashSlot(uint64_t key, const int mask) {
+  key ^= key >> 30;
+  key *= 0xbf58476d1ce4e5b9ull;
+  key ^= key >> 27;
+  key *= 0x94d049bb133111ebull;
+  key ^= key >> 31;
+  return static_cast<int>(key & static_cast<uint64_t>(mask));
+}
+
+__device__ inline int FindVoxel(const uint64_t* keys, const int* indices,
+                                const int mask, const uint64_t key) {
+  // the load factor is less than 0.5, so there is always an empty slot
+  for (int slot = HashSlot(key, mask);; slot = (slot + 1) & mask) {
+    const uint64_t k = keys[slot];
+    if (k == key) {
+      return indices[slot];
+    }
+    if (k == kEmptyKey) {
+      return -1;
+    }
+  }
+}
+
+// the slot of the key, 'inserted' is true if the key is new
+__device__ inline int InsertKey(uint64_t* keys, const int mask,
+                                const uint64_t key, bool* inserted) {
+  for (int slot = HashSlot(key, mask);; slot = (slot + 1) & mask) {
+    const uint64_t previous = atomicCAS(
+        reinterpret_cast<unsigned long long*>(&keys[slot]),
+        static_cast<unsigned long long>(kEmptyKey),
+        static_cast<unsigned long long>(key));
+    if (previous == kEmptyKey || previous == key) {
+      *inserted = (previous == kEmptyKey);
+      return slot;
+    }
+  }
+}
+
+__global__ void RehashKernel(const uint64_t* old_keys, const int* old_indices,
+                             const int old_size, uint64_t* keys, int* indices,
+                             const int mask) {
+  const int slot = blockIdx.x * blockDim.x + threadIdx.x;
+  if (slot >= old_size || old_keys[slot] == kEmptyKey) {
+    return;
+  }
+  bool inserted;
+  indices[InsertKey(keys, mask, old_keys[slot], &inserted)] =
+      old_indices[slot];
+}
+
+// insert the end voxels, the index of a new voxel is taken by the thread
+// inserting its key, and only read by the later kernels
+__global__ void InsertEndVoxelsKernel(const int* end_indices, const int num,
+                                      uint64_t* keys, int* indices,
+                                      const int mask, int* voxel_num) {
+  const int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= num || end_indices[4 * i + 3] != kHit) {
+    return;
+  }
+  const int* end = end_indices + 4 * i;
+  bool inserted;
+  const int slot =
+      InsertKey(keys, mask, PackVoxelKey(end[0], end[1], end[2]), &inserted);
+  if (inserted) {
+    indices[slot] = atomicAdd(voxel_num, 1);
+  }
+}
+
+__global__ void InitVoxelsKernel(const int begin, const int end,
+                                 uint8_t* probabilities, int* max_intensities,
+                                 int* point_nums, int* first_hits,
+                                 int* hit_counts, int* miss_counts,
+                                 uint8_t* created) {
+  const int index = begin + blockIdx.x * blockDim.x + threadIdx.x;
+  if (index >= end) {
+    return;
+  }
+  // kUnknown
+  probabilities[index] = kProbabilityNum >> 1;
+  max_intensities[index] = 0;
+  point_nums[index] = 0;
+  first_hits[index] = INT_MAX;
+  hit_counts[index] = 0;
+  miss_counts[index] = 0;
+  created[index] = 1;
+}
+
+__global__ void HitKernel(const float* points, const int* end_indices,
+                          const int num, const uint64_t* keys,
+                          const int* indices, const int mask,
+                          int* end_voxels, int* first_hits, int* hit_counts,
+                          int* max_intensities) {
+  const int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= num) {
+    return;
+  }
+  const int* end = end_indices + 4 * i;
+  if (end[3] != kHit) {
+    end_voxels[i] = -1;
+    return;
+  }
+  const int voxel =
+      FindVoxel(keys, indices, mask, PackVoxelKey(end[0], end[1], end[2]));
+  end_voxels[i] = voxel;
+  atomicMin(&first_hits[voxel], i);
+  atomicAdd(&hit_counts[voxel], 1);
+  atomicMax(&max_intensities[voxel], static_cast<int>(points[4 * i + 3]));
+}
+
+// the serial insertion misses a voxel on the ray of point i only if it
+// existed before the scan and is not hit by the points before i, and a
+// voxel once hit is never missed in the scan, so only the misses are
+// counted here and applied before the hits
+__global__ void RayKernel(const int* end_indices, const int num,
+                          const int3 origin, const uint64_t* keys,
+                          const int* indices, const int mask,
+                          const int* first_hits,
+                          const uint8_t* created, int* miss_counts,
+                          const bool stop_ray_at_hit_voxel) {
+  const int i = blockIdx.x * blockDim.x + threadIdx.x;
+  const int* end = end_indices + 4 * i;
+  if (i >= num || end[3] == kInvalid) {
+    return;
+  }
+  // the same as VisitVoxelsBresenham in common/math.h
+  int current[3] = {origin.x, origin.y, origin.z};
+  int d[3], s[3], e[3];
+  int dm = 0;
+  for (int k = 0; k < 3; ++k) {
+    d[k] = abs(end[k] - current[k]);
+    s[k] = current[k] < end[k] ? 1 : -1;
+    dm = max(dm, d[k]);
+  }
+  e[0] = e[1] = e[2] = (dm >> 1);
+  for (int step = dm;; --step) {
+    if (current[0] == end[0] && current[1] == end[1] &&
+        current[2] == end[2]) {
+      return;
+    }
+    const int voxel = FindVoxel(
+        keys, indices, mask, PackVoxelKey(current[0], current[1], current[2]));
+    if (voxel >= 0) {
+      if (i < first_hits[voxel]) {
+        if (!created[voxel]) {
+          atomicAdd(&miss_counts[voxel], 1);
+        }
+      } else if (stop_ray_at_hit_voxel) {
+        return;
+      }
+    }
+    if (step == 0) {
+      return;
+    }
+    for (int k = 0; k < 3; ++k) {
+      e[k] -= d[k];
+      if (e[k] < 0) {
+        e[k] += dm;
+        current[k] += s[k];
+      }
+    }
+  }
+}
+
+// the points are kept in the order of the cloud until the voxel is full
+__global__ void StorePointsKernel(const float* cloud_points,
+                                  const int* sorted_voxels,
+                                  const int* sorted_points, const int* ranks,
+                                  const int num, const int* point_nums,
+                                  const int max_point_num, float* points) {
+  const int k = blockIdx.x * blockDim.x + threadIdx.x;
+  if (k >= num || sorted_voxels[k] < 0) {
+    return;
+  }
+  const int voxel = sorted_voxels[k];
+  const int position = point_nums[voxel] + ranks[k];
+  if (position >= max_point_num) {
+    return;
+  }
+  const float* point = cloud_points + 4 * sorted_points[k];
+  float* target =
+      points + 4 * (static_cast<size_t>(voxel) * max_point_num + position);
+  for (int j = 0; j < 4; ++j) {
+    target[j] = point[j];
+  }
+}
+
+__global__ void UpdateVoxelsKernel(const int voxel_num,
+                                   const ProbabilityTables tables,
+                                   const int max_point_num,
+                                   uint8_t* probabilities, int* point_nums,
+                                   int* first_hits, int* hit_counts,
+                                   int* miss_counts, uint8_t* created) {
+  const int index = blockIdx.x * blockDim.x + threadIdx.x;
+  if (index >= voxel_num) {
+    return;
+  }
+  const int miss_count = miss_counts[index];
+  const int hit_count = hit_counts[index];
+  if (miss_count == 0 && hit_count == 0) {
+    return;
+  }
+  uint8_t probability = probabilities[index];
+  for (int k = 0; k < miss_count; ++k) {
+    probability = tables.miss[probability];
+  }
+  for (int k = 0; k < hit_count; ++k) {
+    probability = tables.hit[probability];
+  }
+  probabilities[index] = probability;
+  point_nums[index] = min(point_nums[index] + hit_count, max_point_num);
+  first_hits[index] = INT_MAX;
+  hit_counts[index] = 0;
+  miss_counts[index] = 0;
+  created[index] = 0;
+}
+
+struct IsOccupied {
+  const uint8_t* probabilities;
+  uint8_t threshold;
+  __device__ bool operator()(const int index) const {
+    return probabilities[index] >= threshold;
+  }
+};
+
+struct OccupiedPointNum {
+  const uint8_t* probabilities;
+  const int* point_nums;
+  uint8_t threshold;
+  bool average;
+  __device__ int64_t operator()(const int index) const {
+    if (probabilities[index] < threshold) {
+      return 0;
+    }
+    return average ? 1 : point_nums[index];
+  }
+};
+
+__global__ void GatherVoxelsKernel(const int* voxels, const int num,
+                                   const int* point_nums,
+                                   const int* max_intensities,
+                                   const float* points,
+                                   const int max_point_num,
+                                   int* output_point_nums,
+                                   int* output_max_intensities,
+                                   float* output_points) {
+  const int k = blockIdx.x * blockDim.x + threadIdx.x;
+  if (k >= num) {
+    return;
+  }
+  const int voxel = voxels[k];
+  output_point_nums[k] = point_nums[voxel];
+  output_max_intensities[k] = max_intensities[voxel];
+  const float* source = points + 4 * static_cast<size_t>(voxel) * max_point_num;
+  float* target = output_points + 4 * static_cast<size_t>(k) * max_point_num;
+  for (int j = 0; j < 4 * point_nums[voxel]; ++j) {
+    target[j] = source[j];
+  }
+}
+
+// copy the first 'num' elements into a new buffer of 'capacity'
+template <typename T>
+bool Grow(T** buffer, const size_t num, const size_t capacity) {
+  T* new_buffer = nullptr;
+  if (!CheckCudaError(cudaMalloc(&new_buffer, capacity * sizeof(T)),
+                      "allocate voxels")) {
+    return false;
+  }
+  if (*buffer) {
+    cudaMemcpy(new_buffer, *buffer, num * sizeof(T), cudaMemcpyDeviceToDevice);
+    cudaFree(*buffer);
+  }
+  *buffer = new_buffer;
+  return true;
+}
+
+}  // namespace
+
+DeviceVoxelMap::DeviceVoxelMap(const int max_point_num_in_cell,
+                               const bool stop_ray_at_hit_voxel,
+                               const ProbabilityTables& tables)
+    : max_point_num_(max_point_num_in_cell),
+      stop_ray_at_hit_voxel_(stop_ray_at_hit_voxel),
+      tables_(tables) {
+  cudaMalloc(&voxel_num_device_, sizeof(int));
+  cudaMemset(voxel_num_device_, 0, sizeof(int));
+  Rehash(kMinTableSize);
+}
+
+DeviceVoxelMap::~DeviceVoxelMap() {
+  cudaFree(table_keys_);
+  cudaFree(table_indices_);
+  cudaFree(voxel_num_device_);
+  cudaFree(probabilities_);
+  cudaFree(max_intensities_);
+  cudaFree(point_nums_);
+  cudaFree(first_hits_);
+  cudaFree(hit_counts_);
+  cudaFree(miss_counts_);
+  cudaFree(created_);
+  cudaFree(points_);
+  cudaFree(cloud_points_);
+  cudaFree(cloud_end_indices_);
+  cudaFree(cloud_end_voxels_);
+  cudaFree(sorted_voxels_);
+  cudaFree(sorted_points_);
+  cudaFree(ranks_);
+}
+
+bool DeviceVoxelMap::InsertPointCloud(const float* points,
+                                      const int* end_indices, const int num,
+                                      const int* origin_index) {
+  if (num <= 0) {
+    return true;
+  }
+  if (!Reserve(num)) {
+    return false;
+  }
+  cudaMemcpy(cloud_points_, points, 4 * num * sizeof(float),
+             cudaMemcpyHostToDevice);
+  cudaMemcpy(cloud_end_indices_, end_indices, 4 * num * sizeof(int),
+             cudaMemcpyHostToDevice);
+  const int mask = table_size_ - 1;
+
+  // 1. the new end voxels
+  InsertEndVoxelsKernel<<<BlockNum(num), kBlockSize>>>(
+      cloud_end_indices_, num, table_keys_, table_indices_, mask,
+      voxel_num_device_);
+  int voxel_num = 0;
+  if (!CheckCudaError(cudaMemcpy(&voxel_num, voxel_num_device_, sizeof(int),
+                                 cudaMemcpyDeviceToHost),
+                      "insert end voxels")) {
+    return false;
+  }
+  if (voxel_num > voxel_num_) {
+    InitVoxelsKernel<<<BlockNum(voxel_num - voxel_num_), kBlockSize>>>(
+        voxel_num_, voxel_num, probabilities_, max_intensities_, point_nums_,
+        first_hits_, hit_counts_, miss_counts_, created_);
+  }
+  voxel_num_ = voxel_num;
+
+  // 2. the hits, then the misses on the rays
+  HitKernel<<<BlockNum(num), kBlockSize>>>(
+      cloud_points_, cloud_end_indices_, num, table_keys_, table_indices_,
+      mask, cloud_end_voxels_, first_hits_, hit_counts_, max_intensities_);
+  const int3 origin = make_int3(origin_index[0], origin_index[1],
+                                origin_index[2]);
+  RayKernel<<<BlockNum(num), kBlockSize>>>(
+      cloud_end_indices_, num, origin, table_keys_, table_indices_, mask,
+      first_hits_, created_, miss_counts_, stop_ray_at_hit_voxel_);
+
+  // 3. the points of each voxel in the order of the cloud
+  thrust::device_ptr<int> sorted_voxels(sorted_voxels_);
+  thrust::device_ptr<int> sorted_points(sorted_points_);
+  thrust::copy(thrust::device_ptr<int>(cloud_end_voxels_),
+               thrust::device_ptr<int>(cloud_end_voxels_) + num,
+               sorted_voxels);
+  thrust::sequence(sorted_points, sorted_points + num);
+  thrust::stable_sort_by_key(sorted_voxels, sorted_voxels + num,
+                             sorted_points);
+  thrust::exclusive_scan_by_key(sorted_voxels, sorted_voxels + num,
+                                thrust::make_constant_iterator(1),
+                                thrust::device_ptr<int>(ranks_));
+  StorePointsKernel<<<BlockNum(num), kBlockSize>>>(
+      cloud_points_, sorted_voxels_, sorted_points_, ranks_, num, point_nums_,
+      max_point_num_, points_);
+
+  // 4. apply the misses and the hits, reset the counters
+  UpdateVoxelsKernel<<<BlockNum(voxel_num_), kBlockSize>>>(
+      voxel_num_, tables_, max_point_num_, probabilities_, point_nums_,
+      first_hits_, hit_counts_, miss_counts_, created_);
+  return CheckCudaError(cudaDeviceSynchronize(), "insert point cloud");
+}
+
+int64_t DeviceVoxelMap::CountOccupiedPoints(const uint8_t threshold,
+                                            const int begin, const int end,
+                                            const bool average) const {
+  if (begin >= end) {
+    return 0;
+  }
+  OccupiedPointNum point_num;
+  point_num.probabilities = probabilities_;
+  point_num.point_nums = point_nums_;
+  point_num.threshold = threshold;
+  point_num.average = average;
+  return thrust::transform_reduce(
+      thrust::device, thrust::make_counting_iterator(begin),
+      thrust::make_counting_iterator(end), point_num, int64_t(0),
+      thrust::plus<int64_t>());
+}
+
+bool DeviceVoxelMap::DownloadOccupied(const uint8_t threshold,
+                                      const int begin, const int end,
+                                      OccupiedVoxels* voxels) const {
+  voxels->max_point_num = max_point_num_;
+  voxels->point_nums.clear();
+  voxels->max_intensities.clear();
+  voxels->points.clear();
+  if (begin >= end) {
+    return true;
+  }
+  IsOccupied is_occupied;
+  is_occupied.probabilities = probabilities_;
+  is_occupied.threshold = threshold;
+  thrust::device_vector<int> occupied(end - begin);
+  const int num =
+      thrust::copy_if(thrust::device, thrust::make_counting_iterator(begin),
+                      thrust::make_counting_iterator(end), occupied.begin(),
+                      is_occupied) -
+      occupied.begin();
+  if (num == 0) {
+    return true;
+  }
+  thrust::device_vector<int> point_nums(num);
+  thrust::device_vector<int> max_intensities(num);
+  thrust::device_vector<float> points(4 * static_cast<size_t>(num) *
+                                      max_point_num_);
+  GatherVoxelsKernel<<<BlockNum(num), kBlockSize>>>(
+      thrust::raw_pointer_cast(occupied.data()), num, point_nums_,
+      max_intensities_, points_, max_point_num_,
+      thrust::raw_pointer_cast(point_nums.data()),
+      thrust::raw_pointer_cast(max_intensities.data()),
+      thrust::raw_pointer_cast(points.data()));
+  if (!CheckCudaError(cudaGetLastError(), "gather voxels")) {
+    return false;
+  }
+  voxels->point_nums.resize(num);
+  voxels->max_intensities.resize(num);
+  voxels->points.resize(points.size());
+  thrust::copy(point_nums.begin(), point_nums.end(),
+               voxels->point_nums.begin());
+  thrust::copy(max_intensities.begin(), max_intensities.end(),
+               voxels->max_intensities.begin());
+  thrust::copy(points.begin(), points.end(), voxels->points.begin());
+  return true;
+}
+
+size_t DeviceVoxelMap::MemoryBytes() const {
+  const size_t voxel_bytes = 2 * sizeof(uint8_t) + 6 * sizeof(int) +
+                             4 * max_point_num_ * sizeof(float);
+  return table_size_ * (sizeof(uint64_t) + sizeof(int)) +
+         voxel_capacity_ * voxel_bytes +
+         cloud_capacity_ * (8 * sizeof(float) + 5 * sizeof(int));
+}
+
+bool DeviceVoxelMap::Reserve(const int num) {
+  if (num > cloud_capacity_) {
+    cudaFree(cloud_points_);
+    cudaFree(cloud_end_indices_);
+    cudaFree(cloud_end_voxels_);
+    cudaFree(sorted_voxels_);
+    cudaFree(sorted_points_);
+    cudaFree(ranks_);
+    cudaMalloc(&cloud_points_, 4 * num * sizeof(float));
+    cudaMalloc(&cloud_end_indices_, 4 * num * sizeof(int));
+    cudaMalloc(&cloud_end_voxels_, num * sizeof(int));
+    cudaMalloc(&sorted_voxels_, num * sizeof(int));
+    cudaMalloc(&sorted_points_, num * sizeof(int));
+    cudaMalloc(&ranks_, num * sizeof(int));
+    cloud_capacity_ = num;
+  }
+  // every point may end in a new voxel
+  const int needed = voxel_num_ + num;
+  if (needed > voxel_capacity_) {
+    const int capacity = std::max(needed, 2 * voxel_capacity_);
+    const size_t point_stride = 4 * static_cast<size_t>(max_point_num_);
+    if (!Grow(&probabilities_, voxel_num_, capacity) ||
+        !Grow(&max_intensities_, voxel_num_, capacity) ||
+        !Grow(&point_nums_, voxel_num_, capacity) ||
+        !Grow(&first_hits_, voxel_num_, capacity) ||
+        !Grow(&hit_counts_, voxel_num_, capacity) ||
+        !Grow(&miss_counts_, voxel_num_, capacity) ||
+        !Grow(&created_, voxel_num_, capacity) ||
+        !Grow(&points_, voxel_num_ * point_stride, capacity * point_stride)) {
+      return false;
+    }
+    voxel_capacity_ = capacity;
+  }
+  if (2 * static_cast<int64_t>(needed) > table_size_) {
+    int table_size = table_size_;
+    while (table_size < 2 * static_cast<int64_t>(needed)) {
+      table_size <<= 1;
+    }
+    return Rehash(table_size);
+  }
+  return CheckCudaError(cudaGetLastError(), "reserve voxels");
+}
+
+bool DeviceVoxelMap::Rehash(const int table_size) {
+  uint64_t* keys = nullptr;
+  int* indices = nullptr;
+  cudaMalloc(&keys, table_size * sizeof(uint64_t));
+  cudaMalloc(&indices, table_size * sizeof(int));
+  cudaMemset(keys, 0xff, table_size * sizeof(uint64_t));
+  cudaMemset(indices, 0xff, table_size * sizeof(int));
+  if (table_keys_) {
+    RehashKernel<<<BlockNum(table_size_), kBlockSize>>>(
+        table_keys_, table_indices_, table_size_, keys, indices,
+        table_size - 1);
+    cudaFree(table_keys_);
+    cudaFree(table_indices_);
+  }
+  table_keys_ = keys;
+  table_indices_ = indices;
+  table_size_ = table_size;
+  return CheckCudaError(cudaGetLastError(), "rehash voxels");
+}
+
+}  // namespace cuda
+}  // namespace static_map
@@ -0,0 +1,136 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef BUILDER_CUDA_VOXEL_MAP_CUDA_H_
+#define BUILDER_CUDA_VOXEL_MAP_CUDA_H_
+
+#include <cstdint>
+#include <vector>
+
+namespace static_map {
+namespace cuda {
+
+// the probabilities are quantized into 8 bits (see MultiResolutionVoxelMap)
+constexpr int kProbabilityNum = 256;
+
+/*
+ * @struct ProbabilityTables
+ * @brief the quantized probability after a hit/miss for each quantized
+ * probability, computed on host so the device updates are bit-exact
+ */
+struct ProbabilityTables {
+  uint8_t hit[kProbabilityNum];
+  uint8_t miss[kProbabilityNum];
+};
+
+/*
+ * @struct OccupiedVoxels
+ * @brief the voxels over the threshold downloaded from device, the points
+ * of voxel i are points[4 * (i * max_point_num), ...) (x, y, z, intensity)
+ */
+struct OccupiedVoxels {
+  int max_point_num = 0;
+  std::vector<int> point_nums;
+  std::vector<int> max_intensities;
+  std::vector<float> points;
+};
+
+/*
+ * @class DeviceVoxelMap
+ * @brief the high resolution voxels of MultiResolutionVoxelMap resident in
+ * device memory: a hash table of the voxel keys with the probabilities, the
+ * counters of the current scan and the points of the voxels. a whole cloud
+ * is inserted by a few kernels (hits, ray traversal, points, updates) with
+ * the same result as the serial insertion on host
+ */
+class DeviceVoxelMap {
+ public:
+  DeviceVoxelMap(int max_point_num_in_cell, bool stop_ray_at_hit_voxel,
+                 const ProbabilityTables& tables);
+  ~DeviceVoxelMap();
+
+  DeviceVoxelMap(const DeviceVoxelMap&) = delete;
+  DeviceVoxelMap& operator=(const DeviceVoxelMap&) = delete;
+
+  /// @param points x,y,z,intensity (AoS, num for each)
+  /// @param end_indices the voxel index of every point and its state (AoS,
+  /// num for each): 0 for invalid, 1 for hit and 2 for ray only (out of the
+  /// bounds), computed on host so that the voxels are the same
+  /// @param origin_index the voxel of the origin
+  bool InsertPointCloud(const float* points, const int* end_indices, int num,
+                        const int* origin_index);
+
+  /// @brief the number of the points to output in the voxels [begin, end)
+  /// @param average one point for each voxel if it is true
+  int64_t CountOccupiedPoints(uint8_t threshold, int begin, int end,
+                              bool average) const;
+  /// @brief download the voxels in [begin, end) over the threshold,
+  /// in the order of their indices
+  bool DownloadOccupied(uint8_t threshold, int begin, int end,
+                        OccupiedVoxels* voxels) const;
+
+  inline int VoxelNum() const { return voxel_num_; }
+  size_t MemoryBytes() const;
+
+ private:
+  // make room for the new voxels of a cloud of num points
+  bool Reserve(int num);
+  bool Rehash(int table_size);
+
+  const int max_point_num_;
+  const bool stop_ray_at_hit_voxel_;
+  const ProbabilityTables tables_;
+
+  // open addressing, the size is power of 2, the load factor is under 0.5
+  int table_size_ = 0;
+  uint64_t* table_keys_ = nullptr;
+  int* table_indices_ = nullptr;
+
+  // the voxels (SoA)
+  int voxel_num_ = 0;
+  int voxel_capacity_ = 0;
+  int* voxel_num_device_ = nullptr;
+  uint8_t* probabilities_ = nullptr;
+  int* max_intensities_ = nullptr;
+  int* point_nums_ = nullptr;
+  // the counters in the current scan
+  int* first_hits_ = nullptr;
+  int* hit_counts_ = nullptr;
+  int* miss_counts_ = nullptr;
+  uint8_t* created_ = nullptr;
+  // max_point_num_ points for each voxel
+  float* points_ = nullptr;
+
+  // the buffers of the current cloud
+  int cloud_capacity_ = 0;
+  float* cloud_points_ = nullptr;
+  int* cloud_end_indices_ = nullptr;
+  int* cloud_end_voxels_ = nullptr;
+  int* sorted_voxels_ = nullptr;
+  int* sorted_points_ = nullptr;
+  int* ranks_ = nullptr;
+};
+
+}  // namespace cuda
+}  // namespace static_map
+
+#endif  // BUILDER_CUDA_VOXEL_MAP_CUDA_H_
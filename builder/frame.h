@@ -24,9 +24,12 @@
 #define BUILDER_FRAME_H_
 
 // stl
+#include <atomic>
+#include <mutex>
 #include <string>
 // local
 #include "builder/simple_frame.h"
+#include "common/metrics.h"
 
 namespace static_map {
 
@@ -64,8 +67,12 @@ class Frame : public SimpleFrame<PointType> {
   using PointCloudPtr = typename PointCloudType::Ptr;
   using PointCloudConstPtr = typename PointCloudType::ConstPtr;
 
-  Frame() : SimpleFrame<PointType>() {}
-  ~Frame() {}
+  Frame()
+      : SimpleFrame<PointType>(),
+        submap_(nullptr),
+        cached_version_(0u),
+        tracked_bytes_(0) {}
+  ~Frame() { UntrackCloudBytes(); }
 
   Frame(const Frame&) = delete;
   Frame& operator=(const Frame&) = delete;
@@ -81,6 +88,79 @@ class Frame : public SimpleFrame<PointType> {
   }
 
   PointCloudPtr Cloud() override { return this->cloud_; }
+
+  /// @brief count the cloud into the "memory.frames.bytes" gauge until it
+  /// is released or the frame is destroyed, even without memory accounting
+  inline void TrackCloudBytes() {
+    UntrackCloudBytes();
+    if (this->cloud_) {
+      const int64_t bytes =
+          this->cloud_->points.capacity() * sizeof(PointType);
+      tracked_bytes_ = bytes;
+      LiveCloudBytes()->Add(bytes);
+    }
+  }
+  /// @brief release the cloud (in place, it may be shared) once the submap
+  /// does not need it any more, the frame keeps its pose and id
+  inline void ReleaseCloud() {
+    this->ClearCloud();
+    UntrackCloudBytes();
+  }
+
+  /// @brief the global pose is the submap pose * the local pose from now on,
+  /// it is computed when asked and only again after the submap pose changed
+  /// @note the submap should keep the frame not longer than itself
+  inline void AttachToSubmap(const SimpleFrame<PointType>* submap) {
+    std::lock_guard<std::mutex> locker(pose_mutex_);
+    submap_ = submap;
+    cached_version_ = submap->PoseVersion() - 1u;
+  }
+  /// @brief keep the current global pose and stop following the submap
+  inline void DetachFromSubmap() {
+    const Eigen::Matrix4f pose = GlobalPose();
+    std::lock_guard<std::mutex> locker(pose_mutex_);
+    submap_ = nullptr;
+    this->global_pose_ = pose;
+  }
+
+  Eigen::Matrix4f GlobalPose() const override {
+    const SimpleFrame<PointType>* const submap = submap_.load();
+    if (submap == nullptr) {
+      return this->global_pose_;
+    }
+    std::lock_guard<std::mutex> locker(pose_mutex_);
+    const uint64_t version = submap->PoseVersion();
+    if (version != cached_version_) {
+      cached_pose_ = submap->GlobalPose() * this->local_pose_;
+      common::NormalizeRotation(cached_pose_);
+      cached_version_ = version;
+    }
+    return cached_pose_;
+  }
+  void SetGlobalPose(const Eigen::Matrix4f& t) override {
+    submap_ = nullptr;
+    SimpleFrame<PointType>::SetGlobalPose(t);
+  }
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+ private:
+  static common::Gauge* LiveCloudBytes() {
+    static common::Gauge* const gauge = common::MemoryGauge("frames");
+    return gauge;
+  }
+  inline void UntrackCloudBytes() {
+    const int64_t bytes = tracked_bytes_.exchange(0);
+    if (bytes != 0) {
+      LiveCloudBytes()->Add(-bytes);
+    }
+  }
+
+  std::atomic<const SimpleFrame<PointType>*> submap_;
+  mutable std::mutex pose_mutex_;
+  mutable Eigen::Matrix4f cached_pose_;
+  mutable uint64_t cached_version_;
+  std::atomic<int64_t> tracked_bytes_;
 };
 
 }  // namespace static_map
@@ -60,7 +60,8 @@ class ImuTracker {
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
  private:
-  const double imu_gravity_time_constant_;
+  // not const, so that the trackers can be assigned in place
+  double imu_gravity_time_constant_;
   SimpleTime time_;
   SimpleTime last_linear_acceleration_time_;
   Eigen::Quaterniond orientation_;
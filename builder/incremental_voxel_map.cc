@@ -0,0 +1,201 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// stl
+#include <cmath>
+// local
+#include "builder/incremental_voxel_map.h"
+#include "common/macro_defines.h"
+#include "common/point_types.h"
+
+namespace static_map {
+
+template <typename PointT>
+IncrementalVoxelMap<PointT>::IncrementalVoxelMap(
+    const IncrementalVoxelMapOptions& options, const MrvmSettings& settings,
+    const CloudLoader& loader)
+    : options_(options),
+      settings_(settings),
+      loader_(loader),
+      grid_(options.tile_width, options.ray_range, settings.high_resolution) {
+  CHECK_GT(options_.tile_width, 0.);
+  CHECK_GT(options_.ray_range, 0.);
+  CHECK(loader_);
+}
+
+template <typename PointT>
+void IncrementalVoxelMap<PointT>::InsertPointCloud(
+    int id, const PointCloudPtr& cloud, const Eigen::Matrix4f& pose) {
+  CHECK(!Contains(id)) << "the cloud " << id << " is inserted already";
+  cloud_indices_[id] = clouds_.size();
+  CloudRecord record;
+  record.id = id;
+  record.pose = pose;
+  clouds_.push_back(record);
+
+  // appended to the order, so the tiles do not need to be rebuilt
+  PointCloudType cloud_in_range;
+  TransformAndCrop(*cloud, pose, &cloud_in_range);
+  const Eigen::Vector3f origin = pose.block<3, 1>(0, 3);
+  InsertIntoTiles(cloud_in_range, origin, grid_.TilesInRange(origin));
+}
+
+template <typename PointT>
+int IncrementalVoxelMap<PointT>::UpdatePoses(
+    const std::map<int, Eigen::Matrix4f>& poses) {
+  // 1. the tiles reached by the old or the new rays of the moved clouds
+  std::set<TileIndex> dirty_tiles;
+  int moved_num = 0;
+  for (const auto& id_pose : poses) {
+    auto it = cloud_indices_.find(id_pose.first);
+    if (it == cloud_indices_.end()) {
+      PRINT_WARNING_FMT("cloud %d is not inserted, ignored.", id_pose.first);
+      continue;
+    }
+    CloudRecord& record = clouds_[it->second];
+    if (!PoseMoved(record.pose, id_pose.second)) {
+      continue;
+    }
+    for (const auto& index :
+         grid_.TilesInRange(record.pose.template block<3, 1>(0, 3))) {
+      dirty_tiles.insert(index);
+    }
+    for (const auto& index :
+         grid_.TilesInRange(id_pose.second.block<3, 1>(0, 3))) {
+      dirty_tiles.insert(index);
+    }
+    record.pose = id_pose.second;
+    ++moved_num;
+  }
+  if (dirty_tiles.empty()) {
+    return 0;
+  }
+
+  // 2. rebuild the dirty tiles with the clouds reaching them in the order
+  // of the insertion, a cloud is loaded once for all of its tiles
+  for (const auto& index : dirty_tiles) {
+    tiles_.erase(index);
+  }
+  PointCloudPtr cloud(new PointCloudType);
+  PointCloudType cloud_in_range;
+  std::vector<TileIndex> tile_indices;
+  for (const auto& record : clouds_) {
+    const Eigen::Vector3f origin = record.pose.template block<3, 1>(0, 3);
+    tile_indices.clear();
+    for (const auto& index : grid_.TilesInRange(origin)) {
+      if (dirty_tiles.count(index)) {
+        tile_indices.push_back(index);
+      }
+    }
+    if (tile_indices.empty()) {
+      continue;
+    }
+    cloud->clear();
+    if (!loader_(record.id, cloud.get())) {
+      PRINT_ERROR_FMT("failed to load cloud %d, skipped.", record.id);
+      continue;
+    }
+    TransformAndCrop(*cloud, record.pose, &cloud_in_range);
+    InsertIntoTiles(cloud_in_range, origin, tile_indices);
+  }
+  PRINT_INFO_FMT("%d clouds moved, %zu / %zu tiles rebuilt.", moved_num,
+                 dirty_tiles.size(), tiles_.size());
+  return dirty_tiles.size();
+}
+
+template <typename PointT>
+bool IncrementalVoxelMap<PointT>::OutputToPointCloud(
+    float threshold, common::PcdStreamWriter<PointT>* writer) {
+  for (auto& tile : tiles_) {
+    if (!tile.second->OutputToPointCloud(threshold, writer)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename PointT>
+bool IncrementalVoxelMap<PointT>::OutputTileToPointCloud(
+    const TileIndex& index, float threshold,
+    common::PcdStreamWriter<PointT>* writer) {
+  auto it = tiles_.find(index);
+  if (it == tiles_.end()) {
+    return false;
+  }
+  return it->second->OutputToPointCloud(threshold, writer);
+}
+
+template <typename PointT>
+void IncrementalVoxelMap<PointT>::TransformAndCrop(
+    const PointCloudType& cloud, const Eigen::Matrix4f& pose,
+    PointCloudType* cloud_in_range) const {
+  PointCloudType transformed_cloud;
+  common::TransformPointCloud(cloud, &transformed_cloud, pose);
+  const size_t dropped_num = grid_.CropToRange(
+      transformed_cloud, pose.block<3, 1>(0, 3), cloud_in_range);
+  if (dropped_num > 0) {
+    PRINT_WARNING_FMT("%zu points out of the ray range are dropped.",
+                      dropped_num);
+  }
+}
+
+template <typename PointT>
+void IncrementalVoxelMap<PointT>::InsertIntoTiles(
+    const PointCloudType& cloud_in_range, const Eigen::Vector3f& origin,
+    const std::vector<TileIndex>& tile_indices) {
+  PointCloudPtr tile_cloud(new PointCloudType);
+  for (const auto& index : tile_indices) {
+    if (!active_tiles_.empty() && !active_tiles_.count(index)) {
+      continue;
+    }
+    grid_.CropToTile(cloud_in_range, origin, index, tile_cloud.get());
+    if (tile_cloud->empty()) {
+      continue;
+    }
+    auto& tile = tiles_[index];
+    if (!tile) {
+      tile.reset(new MultiResolutionVoxelMap<PointT>);
+      tile->Initialise(settings_);
+      tile->SetBounds(grid_.TileBounds(index));
+    }
+    tile->InsertPointCloud(tile_cloud, origin);
+  }
+}
+
+template <typename PointT>
+bool IncrementalVoxelMap<PointT>::PoseMoved(
+    const Eigen::Matrix4f& old_pose, const Eigen::Matrix4f& new_pose) const {
+  const Eigen::Matrix4f delta = old_pose.inverse() * new_pose;
+  const double translation = delta.block<3, 1>(0, 3).norm();
+  // the angle of the rotation from its trace
+  const double cos_angle =
+      Clamp((delta.block<3, 3>(0, 0).trace() - 1.) * 0.5, -1., 1.);
+  return translation > options_.translation_threshold ||
+         std::acos(cos_angle) > options_.rotation_threshold;
+}
+
+template class IncrementalVoxelMap<pcl::PointXYZI>;
+#ifdef _USE_COMPACT_POINT_
+template class IncrementalVoxelMap<PointXYZIc>;
+#endif
+
+}  // namespace static_map
@@ -0,0 +1,147 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef BUILDER_INCREMENTAL_VOXEL_MAP_H_
+#define BUILDER_INCREMENTAL_VOXEL_MAP_H_
+
+// stl
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+// local
+#include "builder/multi_resolution_voxel_map.h"
+#include "builder/tiled_voxel_map.h"
+
+namespace static_map {
+
+struct IncrementalVoxelMapOptions {
+  // the width of the square tiles in meters
+  double tile_width = 100.;
+  // the points farther than it (in x-y) from their origins are dropped
+  double ray_range = 100.;
+  // the tiles of a cloud are rebuilt only if its pose moves more than
+  // them (meters / radians)
+  double translation_threshold = 0.05;
+  double rotation_threshold = 0.005;
+};
+
+/// @class IncrementalVoxelMap
+/// @brief a MultiResolutionVoxelMap split into square tiles (in x-y) which
+/// tracks the clouds reaching each tile, so that when the poses of some
+/// clouds change (loop closures, new trajectories), only the tiles reached
+/// by their old or new rays are rebuilt from the clouds reaching them
+/// @note the probabilities are clamped and quantized at every update, so
+/// the rays of a cloud can not be subtracted from the voxels, the affected
+/// tiles are rebuilt instead. the result is the same as a map rebuilt from
+/// scratch with the clouds in the insertion order and the kept poses
+/// (except stop_ray_at_hit_voxel). the tiles are kept in memory
+template <typename PointT>
+class IncrementalVoxelMap {
+ public:
+  using PointCloudType = pcl::PointCloud<PointT>;
+  using PointCloudPtr = typename PointCloudType::Ptr;
+  using TileIndex = TileGrid::TileIndex;
+  /// @brief fill the cloud (in its local frame) of the id, return false if
+  /// it is lost, it is called when the tiles are rebuilt
+  using CloudLoader = std::function<bool(int id, PointCloudType* cloud)>;
+
+  IncrementalVoxelMap(const IncrementalVoxelMapOptions& options,
+                      const MrvmSettings& settings, const CloudLoader& loader);
+  ~IncrementalVoxelMap() = default;
+
+  IncrementalVoxelMap(const IncrementalVoxelMap&) = delete;
+  IncrementalVoxelMap& operator=(const IncrementalVoxelMap&) = delete;
+
+  /// @brief insert a new cloud (in its local frame) with its global pose
+  void InsertPointCloud(int id, const PointCloudPtr& cloud,
+                        const Eigen::Matrix4f& pose);
+  inline bool Contains(int id) const { return cloud_indices_.count(id) > 0; }
+
+  /// @brief update the poses of the inserted clouds, the ones moving more
+  /// than the thresholds are reinserted into the affected tiles
+  /// @return the number of the rebuilt tiles
+  int UpdatePoses(const std::map<int, Eigen::Matrix4f>& poses);
+
+  /// @brief stream the voxels over the threshold of all the tiles
+  /// @return false if the writer fails
+  bool OutputToPointCloud(float threshold,
+                          common::PcdStreamWriter<PointT>* writer);
+
+  inline size_t TileNum() const { return tiles_.size(); }
+
+  /// @brief only these tiles are built if it is not empty, the other parts
+  /// of the clouds are skipped, e.g. to rebuild some pieces of a saved map
+  inline void SetActiveTiles(const std::set<TileIndex>& tiles) {
+    active_tiles_ = tiles;
+  }
+  /// @brief the tiles reached by the rays of a cloud at the pose
+  inline std::vector<TileIndex> TilesInRange(
+      const Eigen::Matrix4f& pose) const {
+    return grid_.TilesInRange(pose.block<3, 1>(0, 3));
+  }
+  inline bool HasTile(const TileIndex& index) const {
+    return tiles_.count(index) > 0;
+  }
+  /// @brief whether the pose moves more than the thresholds
+  bool PoseMoved(const Eigen::Matrix4f& old_pose,
+                 const Eigen::Matrix4f& new_pose) const;
+  /// @brief stream the voxels over the threshold of one tile
+  /// @return false if the writer fails or the tile is empty
+  bool OutputTileToPointCloud(const TileIndex& index, float threshold,
+                              common::PcdStreamWriter<PointT>* writer);
+
+ private:
+  struct CloudRecord {
+    int id;
+    Eigen::Matrix4f pose;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+
+  // the cloud in the range of its pose, in the global frame
+  void TransformAndCrop(const PointCloudType& cloud,
+                        const Eigen::Matrix4f& pose,
+                        PointCloudType* cloud_in_range) const;
+  // insert the parts of the cloud reaching the tiles
+  void InsertIntoTiles(const PointCloudType& cloud_in_range,
+                       const Eigen::Vector3f& origin,
+                       const std::vector<TileIndex>& tile_indices);
+
+  const IncrementalVoxelMapOptions options_;
+  const MrvmSettings settings_;
+  const CloudLoader loader_;
+  const TileGrid grid_;
+  // in the order of the insertion
+  std::vector<CloudRecord, Eigen::aligned_allocator<CloudRecord>> clouds_;
+  std::map<int, size_t> cloud_indices_;
+  std::map<TileIndex, std::unique_ptr<MultiResolutionVoxelMap<PointT>>>
+      tiles_;
+  std::set<TileIndex> active_tiles_;
+};
+
+}  // namespace static_map
+
+#endif  // BUILDER_INCREMENTAL_VOXEL_MAP_H_
@@ -0,0 +1,186 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef BUILDER_LIDAR_SYNCHRONIZER_H_
+#define BUILDER_LIDAR_SYNCHRONIZER_H_
+
+// stl
+#include <cstdint>
+#include <memory>
+#include <vector>
+// pcl
+#include <pcl/point_cloud.h>
+
+#include "glog/logging.h"
+
+namespace static_map {
+
+/*
+ * @class LidarSynchronizer
+ * @brief merges the scans of several lidars (already in the tracking frame)
+ * taken at about the same time into one scan
+ * the points are appended into the earliest scan, and the per-point times
+ * are shifted by the stamps of the scans, so the motion compensation
+ * deskews every lidar by its own times
+ * a window is merged once all lidars got their scans in it, or without the
+ * missing lidars when a scan out of it arrives
+ * not thread safe
+ */
+template <typename PointT>
+class LidarSynchronizer {
+ public:
+  using PointCloudPtr = typename pcl::PointCloud<PointT>::Ptr;
+  /// per-point times in seconds relative to the stamp of the scan
+  using PointTimesPtr = std::shared_ptr<std::vector<float>>;
+
+  struct Scan {
+    PointCloudPtr cloud;
+    PointTimesPtr point_times;
+  };
+
+  enum Result { kPending, kMerged, kDropped };
+
+  /// @param max_time_difference in seconds, between the scans in a window
+  LidarSynchronizer(int lidar_num, double max_time_difference)
+      : pending_(lidar_num),
+        max_time_difference_(
+            static_cast<uint64_t>(max_time_difference * 1.e6)) {
+    CHECK_GT(lidar_num, 1);
+    CHECK_GT(max_time_difference, 0.);
+  }
+
+  LidarSynchronizer(const LidarSynchronizer&) = delete;
+  LidarSynchronizer& operator=(const LidarSynchronizer&) = delete;
+
+  int LidarNum() const { return static_cast<int>(pending_.size()); }
+
+  /// @return kMerged if a window is merged into *merged, kDropped if the
+  /// scan is older than the window (it can not be merged in order)
+  Result AddScan(const int lidar_index, const Scan& scan, Scan* const merged) {
+    CHECK(merged);
+    CHECK(scan.cloud);
+    CHECK(lidar_index >= 0 && lidar_index < LidarNum());
+    // pcl stamps are in microseconds
+    const uint64_t stamp = scan.cloud->header.stamp;
+    Result result = kPending;
+    if (pending_num_ > 0) {
+      if (stamp + max_time_difference_ < window_stamp_) {
+        return kDropped;
+      }
+      if (pending_[lidar_index].cloud ||
+          stamp > window_stamp_ + max_time_difference_) {
+        // some lidar missed this window
+        Merge(merged);
+        result = kMerged;
+      }
+    }
+    if (pending_num_ == 0 || stamp < window_stamp_) {
+      window_stamp_ = stamp;
+    }
+    pending_[lidar_index] = scan;
+    ++pending_num_;
+    if (pending_num_ == LidarNum()) {
+      CHECK_EQ(result, kPending);
+      Merge(merged);
+      result = kMerged;
+    }
+    return result;
+  }
+
+ private:
+  void Merge(Scan* const merged) {
+    // the earliest scan takes all points
+    size_t base_index = 0;
+    size_t point_num = 0;
+    bool has_times = false;
+    for (size_t i = 0; i < pending_.size(); ++i) {
+      const Scan& scan = pending_[i];
+      if (!scan.cloud) {
+        continue;
+      }
+      point_num += scan.cloud->size();
+      has_times = has_times || HasTimes(scan);
+      if (!pending_[base_index].cloud ||
+          scan.cloud->header.stamp <
+              pending_[base_index].cloud->header.stamp) {
+        base_index = i;
+      }
+    }
+    Scan base = pending_[base_index];
+    const uint64_t base_stamp = base.cloud->header.stamp;
+    if (has_times && !HasTimes(base)) {
+      base.point_times = std::make_shared<std::vector<float>>(
+          base.cloud->size(), 0.f);
+    } else if (!has_times) {
+      base.point_times.reset();
+    }
+    base.cloud->points.reserve(point_num);
+    if (base.point_times) {
+      base.point_times->reserve(point_num);
+    }
+    for (size_t i = 0; i < pending_.size(); ++i) {
+      Scan& scan = pending_[i];
+      if (!scan.cloud || i == base_index) {
+        scan = Scan();
+        continue;
+      }
+      if (base.point_times) {
+        // lidars without times are at least shifted by their stamps
+        const float offset =
+            static_cast<float>(scan.cloud->header.stamp - base_stamp) * 1.e-6f;
+        if (HasTimes(scan)) {
+          for (const float time : *scan.point_times) {
+            base.point_times->push_back(offset + time);
+          }
+        } else {
+          base.point_times->insert(base.point_times->end(),
+                                   scan.cloud->size(), offset);
+        }
+      }
+      base.cloud->points.insert(base.cloud->points.end(),
+                                scan.cloud->points.begin(),
+                                scan.cloud->points.end());
+      scan = Scan();
+    }
+    base.cloud->width = static_cast<uint32_t>(base.cloud->points.size());
+    base.cloud->height = 1;
+    pending_[base_index] = Scan();
+    pending_num_ = 0;
+    *merged = base;
+  }
+
+  static bool HasTimes(const Scan& scan) {
+    return scan.point_times &&
+           scan.point_times->size() == scan.cloud->size();
+  }
+
+  std::vector<Scan> pending_;
+  int pending_num_ = 0;
+  // the earliest stamp in the window
+  uint64_t window_stamp_ = 0u;
+  // in microseconds
+  const uint64_t max_time_difference_;
+};
+
+}  // namespace static_map
+
+#endif  // BUILDER_LIDAR_SYNCHRONIZER_H_
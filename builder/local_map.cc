@@ -0,0 +1,144 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#include "builder/local_map.h"
+#include "common/point_types.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+#include "glog/logging.h"
+
+namespace static_map {
+
+template <typename PointT>
+LocalMap<PointT>::LocalMap(const LocalMapOptions& options)
+    : options_(options),
+      cloud_(new PointCloudType),
+      cloud_outdated_(false),
+      added_points_(new PointCloudType),
+      removed_points_(new PointCloudType) {
+  CHECK_GT(options_.voxel_size, 1.e-3);
+  CHECK_GE(options_.max_point_num_in_voxel, 1);
+}
+
+template <typename PointT>
+void LocalMap<PointT>::InsertPointCloud(const PointCloudType& cloud,
+                                        const Eigen::Matrix4f& pose) {
+  const Eigen::Matrix3f rotation = pose.block(0, 0, 3, 3);
+  const Eigen::Vector3f translation = pose.block(0, 3, 3, 1);
+  const size_t max_point_num =
+      static_cast<size_t>(options_.max_point_num_in_voxel);
+  for (const auto& point : cloud.points) {
+    const Eigen::Vector3f point_in_map =
+        rotation * Eigen::Vector3f(point.x, point.y, point.z) + translation;
+    const KeyInt3 key = PointToKey(point_in_map);
+    auto& voxel = voxels_[key];
+    // the first points are kept, the voxel is already well described
+    if (voxel.size() >= max_point_num) {
+      continue;
+    }
+    PointT new_point = point;
+    new_point.x = point_in_map[0];
+    new_point.y = point_in_map[1];
+    new_point.z = point_in_map[2];
+    voxel.push_back(static_cast<int>(cloud_->size()));
+    cloud_->push_back(new_point);
+    point_keys_.push_back(key);
+    added_points_->push_back(new_point);
+  }
+  cloud_outdated_ = true;
+}
+
+template <typename PointT>
+void LocalMap<PointT>::RemoveOutsideBox(const Eigen::Vector3f& center,
+                                        const float radius) {
+  const Eigen::Vector3f offset = Eigen::Vector3f::Constant(radius);
+  const KeyInt3 min_key = PointToKey(center - offset);
+  const KeyInt3 max_key = PointToKey(center + offset);
+  for (auto it = voxels_.begin(); it != voxels_.end();) {
+    const KeyInt3& key = it->first;
+    if ((key.array() < min_key.array()).any() ||
+        (key.array() > max_key.array()).any()) {
+      // from the largest index, the last point moved into a removed one is
+      // never of this voxel
+      std::vector<int>& indices = it->second;
+      std::sort(indices.begin(), indices.end(), std::greater<int>());
+      for (const int index : indices) {
+        removed_points_->push_back(cloud_->points[index]);
+        RemovePoint(index);
+      }
+      it = voxels_.erase(it);
+      cloud_outdated_ = true;
+    } else {
+      ++it;
+    }
+  }
+}
+
+template <typename PointT>
+void LocalMap<PointT>::RemovePoint(const int index) {
+  const int last_index = static_cast<int>(cloud_->size()) - 1;
+  if (index != last_index) {
+    cloud_->points[index] = cloud_->points[last_index];
+    point_keys_[index] = point_keys_[last_index];
+    auto& owner = voxels_.at(point_keys_[index]);
+    *std::find(owner.begin(), owner.end(), last_index) = index;
+  }
+  cloud_->points.pop_back();
+  point_keys_.pop_back();
+}
+
+template <typename PointT>
+typename LocalMap<PointT>::PointCloudPtr LocalMap<PointT>::GetCloud() {
+  if (!cloud_outdated_) {
+    return cloud_;
+  }
+  // a new cloud object takes over the points without copying them, the old
+  // one is left empty
+  PointCloudPtr cloud(new PointCloudType);
+  cloud->points.swap(cloud_->points);
+  cloud_ = cloud;
+  cloud_->width = cloud_->points.size();
+  cloud_->height = 1;
+  cloud_->is_dense = true;
+
+  added_points_cloud_ = added_points_;
+  removed_points_cloud_ = removed_points_;
+  for (const auto& changed : {added_points_cloud_, removed_points_cloud_}) {
+    changed->width = changed->points.size();
+    changed->height = 1;
+    changed->is_dense = true;
+  }
+  added_points_.reset(new PointCloudType);
+  removed_points_.reset(new PointCloudType);
+  cloud_outdated_ = false;
+  return cloud_;
+}
+
+template class LocalMap<pcl::PointXYZI>;
+template class LocalMap<pcl::PointXYZ>;
+#ifdef _USE_COMPACT_POINT_
+template class LocalMap<PointXYZIc>;
+#endif
+
+}  // namespace static_map
@@ -0,0 +1,116 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#ifndef BUILDER_LOCAL_MAP_H_
+#define BUILDER_LOCAL_MAP_H_
+
+// stl
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+// third party
+#include "pcl/point_cloud.h"
+#include "pcl/point_types.h"
+// local
+#include "common/eigen_hash.h"
+
+namespace static_map {
+
+struct LocalMapOptions {
+  // false for scan to scan matching
+  bool enable = false;
+  float voxel_size = 0.3f;
+  // the voxels out of the box (center, radius) will be removed
+  float radius = 80.f;
+  int max_point_num_in_voxel = 5;
+};
+
+/*
+ * @class LocalMap
+ * @brief sliding local map for the scan to map matching in front end
+ * points are kept in a voxel hash, which supports incremental inserting and
+ * deleting by box without any rebalancing
+ */
+template <typename PointT>
+class LocalMap {
+ public:
+  using PointCloudType = pcl::PointCloud<PointT>;
+  using PointCloudPtr = typename PointCloudType::Ptr;
+  using KeyInt3 = Eigen::Vector3i;
+
+  explicit LocalMap(const LocalMapOptions& options);
+  ~LocalMap() {}
+
+  LocalMap(const LocalMap&) = delete;
+  LocalMap& operator=(const LocalMap&) = delete;
+
+  /// @brief insert the cloud (in its own frame) with its pose in map
+  void InsertPointCloud(const PointCloudType& cloud,
+                        const Eigen::Matrix4f& pose);
+  /// @brief remove all voxels out of the box
+  void RemoveOutsideBox(const Eigen::Vector3f& center, const float radius);
+  /// @brief insert the cloud and slide the map to its pose
+  void Update(const PointCloudType& cloud, const Eigen::Matrix4f& pose) {
+    InsertPointCloud(cloud, pose);
+    RemoveOutsideBox(pose.block(0, 3, 3, 1), options_.radius);
+  }
+  /// @brief all points in the map as a cloud
+  /// the points are updated in place when the map changes (the points of the
+  /// removed voxels are swapped out), so the cloud got is only valid until the
+  /// next update. after it, a new cloud object takes over the points, so that
+  /// the registrator could tell the changed target from the one prepared
+  PointCloudPtr GetCloud();
+  /// @brief the points inserted and removed between the last two clouds got
+  /// by GetCloud(), a point may be in both if it is removed soon
+  inline PointCloudPtr AddedPoints() const { return added_points_cloud_; }
+  inline PointCloudPtr RemovedPoints() const { return removed_points_cloud_; }
+
+  inline bool Empty() const { return voxels_.empty(); }
+  inline size_t VoxelSize() const { return voxels_.size(); }
+  inline size_t PointSize() const { return cloud_->size(); }
+
+ private:
+  inline KeyInt3 PointToKey(const Eigen::Vector3f& point) const {
+    const Eigen::Vector3f scaled = point / options_.voxel_size;
+    return KeyInt3(static_cast<int>(std::floor(scaled[0])),
+                   static_cast<int>(std::floor(scaled[1])),
+                   static_cast<int>(std::floor(scaled[2])));
+  }
+  /// @brief remove the point by moving the last point of the cloud into it
+  void RemovePoint(const int index);
+
+  LocalMapOptions options_;
+  // the indices of the points of every voxel in cloud_
+  std::unordered_map<KeyInt3, std::vector<int>, std::hash<KeyInt3>> voxels_;
+  PointCloudPtr cloud_;
+  // the voxel of every point in cloud_
+  std::vector<KeyInt3> point_keys_;
+  bool cloud_outdated_;
+  // changed since the last GetCloud()
+  PointCloudPtr added_points_;
+  PointCloudPtr removed_points_;
+  PointCloudPtr added_points_cloud_;
+  PointCloudPtr removed_points_cloud_;
+};
+
+}  // namespace static_map
+
+#endif  // BUILDER_LOCAL_MAP_H_
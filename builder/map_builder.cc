@@ -20,9 +20,17 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <cstdio>
+#include <future>
+#include <limits>
+#include <sstream>
+#include <thread>
+#include <unordered_set>
 #include <utility>
+#include <vector>
 
 // pcl
 #include "pcl/filters/statistical_outlier_removal.h"
@@ -30,47 +38,167 @@
 
 // local headers
 #include "builder/map_builder.h"
+#include "builder/map_piece.h"
+#include "builder/motion_compensation.h"
+#include "builder/submap_cache.h"
+#include "builder/submap_file.h"
 #include "builder/utm.h"
+#include "common/eigen_hash.h"
+#include "common/execution.h"
+#include "common/file_utils.h"
 #include "common/macro_defines.h"
 #include "common/make_unique.h"
+#include "common/metrics.h"
+#include "common/pcd_writer.h"
+#include "common/shared_executor.h"
 #include "common/pugixml.hpp"
+#include "common/trace.h"
 #include "cost_functions/odom_map_match.h"
 #include "descriptor/m2dp.h"
+#include "registrators/adaptive.h"
+#include "registrators/cloud_attachments.h"
 #include "registrators/icp_fast.h"
+#include "registrators/icp_gpu.h"
 #include "registrators/icp_libicp.h"
 #include "registrators/lego_loam.h"
+#include "registrators/multi_resolution.h"
 #include "registrators/ndt.h"
 #include "registrators/ndt_gicp.h"
 
 namespace static_map {
 
+using registrator::IcpFast;
+#ifdef _ICP_USE_CUDA_
+using registrator::IcpGpu;
+#endif
 using registrator::IcpUsingLibicp;
 using registrator::IcpUsingPointMatcher;
 using registrator::LegoLoam;
 using registrator::Ndt;
 using registrator::NdtWithGicp;
 
+// history of odom and utm msgs, ~100s of 100Hz odom
 constexpr int kOdomMsgMaxSize = 10000;
+constexpr int kUtmMsgMaxSize = 10000;
 constexpr int kSubmapResSize = 100;
+// submaps loaded from disk ahead of the one being exported
+constexpr int kSubmapPrefetchNum = 2;
 // usually, our longtitude is about 121E, in UTM "51R" zone
 constexpr int kUtmZone = 51;
+// committed by renaming, so a crash never leaves a partial one
+constexpr char kCheckpointManifest[] = "checkpoint.xml";
+// frame id of the clouds converted into the tracking frame on acquiring
+constexpr char kTrackingFrameId[] = "static_map_tracking";
+
+std::string CheckpointFileName(const std::string& path, const SubmapId& id,
+                               const std::string& extension) {
+  return path + "submap_" + std::to_string(id.trajectory_index) + "_" +
+         std::to_string(id.submap_index) + extension;
+}
+
+// the bytes of a queued cloud for the memory accounting, 0 without it
+int64_t QueuedCloudBytes(const MapBuilder::PointCloudPtr& cloud,
+                         const MapBuilder::PointTimesPtr& times) {
+  if (!common::MemoryAccountingEnabled()) {
+    return 0;
+  }
+  int64_t bytes = 0;
+  if (cloud) {
+    bytes += cloud->points.capacity() * sizeof(MapBuilder::PointType);
+  }
+  if (times) {
+    bytes += times->capacity() * sizeof(float);
+  }
+  return bytes;
+}
+
+common::Gauge* RawCloudBytes() {
+  static common::Gauge* const gauge = common::MemoryGauge("raw_clouds");
+  return gauge;
+}
+
+common::Gauge* InnerCloudBytes() {
+  static common::Gauge* const gauge = common::MemoryGauge("clouds");
+  return gauge;
+}
 
 MapBuilder::MapBuilder()
     : accumulated_point_cloud_(new PointCloudType),
       accumulated_cloud_count_(0),
+      odom_msgs_(kOdomMsgMaxSize),
+      utm_msgs_(kUtmMsgMaxSize),
+      tracking_to_lidars_(1, Eigen::Matrix4f::Identity()),
       use_imu_(false),
       use_gps_(false),
       end_all_thread_(false),
       end_managing_memory_(false),
-      submap_processing_done_(false) {
-  point_clouds_.reserve(200);
-}
+      pre_processing_done_(false),
+      scan_match_thread_running_(false),
+      submap_processing_done_(false) {}
 MapBuilder::~MapBuilder() {}
 
 int MapBuilder::InitialiseInside() {
   if (scan_matcher_ != nullptr || submap_marcher_ != nullptr) {
     return -1;
   }
+  if (!output_prefix_.empty()) {
+    auto& whole_options = options_.whole_options;
+    whole_options.export_file_path =
+        output_prefix_ + whole_options.export_file_path;
+    whole_options.map_package_path =
+        output_prefix_ + whole_options.map_package_path;
+    // the jobs (or the segments of a bag) must not share their checkpoints
+    auto& checkpoint_options = options_.checkpoint_options;
+    checkpoint_options.path = output_prefix_ + checkpoint_options.path;
+    if (!common::MakeDirectories(whole_options.export_file_path) ||
+        !common::MakeDirectories(whole_options.map_package_path) ||
+        (checkpoint_options.enable &&
+         !common::MakeDirectories(checkpoint_options.path))) {
+      PRINT_ERROR_FMT("failed to create the outputs in %s",
+                      output_prefix_.c_str());
+    }
+  }
+  if (options_.metrics_options.enable_memory_accounting) {
+    // before any cloud is queued
+    common::EnableMemoryAccounting();
+  }
+  if (options_.metrics_options.enable_trace) {
+    // before the threads start, so that they are named
+    common::Tracer::Get()->Start(options_.whole_options.export_file_path +
+                                 options_.metrics_options.trace_filename);
+  }
+
+  if (options_.whole_options.deterministic) {
+    PRINT_INFO("Deterministic mode, the replay waits for each cloud.");
+    // the random samplers are seeded by the cloud stamps
+    common::SetDeterministicSeeds(true);
+    auto& isam_options = options_.back_end_options.isam_optimizer_options;
+    isam_options.async_loop_closing = false;
+    isam_options.update_interval_ms = 0.;
+  }
+
+  if (options_.whole_options.shared_thread_num > 0) {
+    common::SharedExecutor::SetThreadNum(
+        options_.whole_options.shared_thread_num);
+  }
+  common::SetPcdCompression(options_.whole_options.compress_pcd);
+  const auto& execution_options = options_.execution_options;
+  std::vector<int> numa_node_cpus;
+  if (execution_options.numa_node >= 0) {
+    numa_node_cpus = common::NumaNodeCpus(execution_options.numa_node);
+    // the threads created from now on (also in the libraries) inherit them
+    common::SetCurrentThreadCpus(numa_node_cpus);
+  }
+  const auto cpus_of = [&numa_node_cpus](const std::string& cpu_list) {
+    return cpu_list.empty() ? numa_node_cpus : common::ParseCpuList(cpu_list);
+  };
+  // the threads set them as they start
+  front_end_cpus_ = cpus_of(execution_options.front_end_cpus);
+  back_end_cpus_ = cpus_of(execution_options.back_end_cpus);
+  const std::vector<int> worker_cpus = cpus_of(execution_options.worker_cpus);
+  common::SetOmpThreadNum(execution_options.omp_thread_num);
+  common::SharedExecutor::SetCpus(worker_cpus);
+  common::SetTbbExecution(execution_options.tbb_thread_num, worker_cpus);
 
   PRINT_INFO("Init scan matchers.");
   // init front end (scan to scan matcher)
@@ -98,15 +226,62 @@ int MapBuilder::InitialiseInside() {
     case registrator::kNdt:
       scan_matcher_ = common::make_unique<Ndt<PointType>>();
       break;
+    case registrator::kFastIcp:
+      scan_matcher_ = common::make_unique<IcpFast<PointType>>();
+      break;
+#ifdef _ICP_USE_CUDA_
+    case registrator::kGpuIcp:
+      scan_matcher_ = common::make_unique<IcpGpu<PointType>>();
+      break;
+#endif
     default:
       PRINT_ERROR("Wrong type");
       return -1;
   }
+  if (scan_matcher_options.enable_adaptive) {
+    PRINT_INFO("Adaptive scan matcher, icp fast first.");
+    std::shared_ptr<registrator::Interface<PointType>> fallback_matcher =
+        std::move(scan_matcher_);
+    auto adaptive_matcher =
+        common::make_unique<registrator::Adaptive<PointType>>(
+            std::make_shared<IcpFast<PointType>>(), fallback_matcher,
+            "front_end.adaptive");
+    adaptive_matcher->setAcceptedMinScore(
+        scan_matcher_options.adaptive_accepted_min_score);
+    adaptive_matcher->setCheapMaxIterations(
+        scan_matcher_options.adaptive_max_iterations);
+    scan_matcher_ = std::move(adaptive_matcher);
+  }
+
+  const int lidar_num = LidarNum();
+  if (lidar_num > 1) {
+    PRINT_INFO_FMT("Merging the scans of %d lidars.", lidar_num);
+    common::MutexLocker locker(&lidar_sync_mutex_);
+    lidar_synchronizer_ = common::make_unique<LidarSynchronizer<PointType>>(
+        lidar_num,
+        options_.front_end_options.lidar_sync_options.max_time_difference);
+  }
+  if (options_.front_end_options.input_reorder_options.latency > 0.) {
+    input_reorder_buffer_ =
+        common::make_unique<common::ReorderBuffer<std::function<void()>>>(
+            options_.front_end_options.input_reorder_options.latency);
+  }
+
+  ndt_target_cache_ = std::make_shared<registrator::NdtTargetCache<PointType>>(
+      static_cast<size_t>(
+          options_.back_end_options.submap_matcher_options.ndt_cache_memory_mb *
+          1024 * 1024));
 
   use_imu_ = options_.front_end_options.imu_options.enabled;
   if (use_imu_) {
     CHECK_GT(options_.front_end_options.imu_options.frequency, 1.e-6);
   }
+  if (use_imu_ && options_.front_end_options.imu_options.use_gps_ekf) {
+    PRINT_INFO("Init imu-gps ekf for the guesses of scan matching.");
+    imu_gps_fusion_ = common::make_unique<sensor_fusions::ImuGpsEkf>(
+        options_.front_end_options.imu_options.gravity_constant,
+        options_.front_end_options.imu_options.frequency, SimpleTime());
+  }
 
   PRINT_INFO("Init isam optimizer.");
   isam_optimizer_ = common::make_unique<back_end::IsamOptimizer<PointType>>(
@@ -123,23 +298,52 @@ int MapBuilder::InitialiseInside() {
   PRINT_INFO("Enable TBB.");
 #endif
 
+  // once per process, the next map builders of a service skip them
+  static std::once_flag process_init_flag;
+  std::call_once(process_init_flag, []() {
 #ifdef _USE_OPENVDB_
-  PRINT_INFO("Init openvdb.");
-  openvdb::initialize();
+    PRINT_INFO("Init openvdb.");
+    openvdb::initialize();
 #endif
 
 #ifdef _ICP_USE_CUDA_
-  PRINT_INFO("Init cuda device.");
-  registrator::cuda::init_cuda_device();
+    PRINT_INFO("Init cuda device.");
+    registrator::cuda::init_cuda_device();
 #endif
+  });
 
   AddNewTrajectory();
+  if (options_.checkpoint_options.resume) {
+    LoadCheckpoint();
+  }
+
+  const auto& cloud_pool_options =
+      options_.front_end_options.cloud_pool_options;
+  cloud_pool_.Reset(static_cast<size_t>(cloud_pool_options.max_size),
+                    static_cast<size_t>(cloud_pool_options.reserved_point_num));
+  raw_point_clouds_.Reset(static_cast<size_t>(
+      options_.front_end_options.cloud_queue_options.capacity));
+  point_clouds_.Reset(static_cast<size_t>(
+      options_.front_end_options.cloud_queue_options.capacity));
 
   PRINT_INFO("Init threads.");
+  // set before starting the threads, submap thread quits once it is false
+  scan_match_thread_running_ = true;
+  pre_processing_thread_ = common::make_unique<std::thread>(
+      std::bind(&MapBuilder::PreProcessing, this));
   scan_match_thread_ = common::make_unique<std::thread>(
       std::bind(&MapBuilder::ScanMatchProcessing, this));
   submap_thread_ = common::make_unique<std::thread>(
       std::bind(&MapBuilder::SubmapProcessing, this));
+  if (options_.metrics_options.enable) {
+    metrics_thread_ = common::make_unique<std::thread>(
+        std::bind(&MapBuilder::MetricsDumping, this));
+  }
+  if (options_.metrics_options.http_port > 0) {
+    // the mapping goes on without it
+    metrics_server_.Start(options_.metrics_options.http_port);
+  }
+  visualization_sink_.Start(options_.visualization_options);
 
   PRINT_INFO("Init finished.");
   return 0;
@@ -158,7 +362,10 @@ void MapBuilder::SetTransformImuToLidar(const Eigen::Matrix4f& t) {
 }
 
 void MapBuilder::SetTrackingToImu(const Eigen::Matrix4f& t) {
-  tracking_to_imu_ = t;
+  {
+    common::MutexLocker locker(&sensor_mutex_);
+    tracking_to_imu_ = t;
+  }
   // CHECK the transform
   PRINT_INFO("Got tf : tracking -> imu ");
   common::PrintTransform(t);
@@ -174,30 +381,331 @@ void MapBuilder::SetTrackingToGps(const Eigen::Matrix4f& t) {
   common::PrintTransform(t);
 }
 
+void MapBuilder::SetOutputPrefix(const std::string& prefix) {
+  output_prefix_ = prefix;
+  if (!output_prefix_.empty() && output_prefix_.back() != '/') {
+    output_prefix_ += '/';
+  }
+}
+
+void MapBuilder::SetJobName(const std::string& name) { job_name_ = name; }
+
 void MapBuilder::SetTrackingToOdom(const Eigen::Matrix4f& t) {
   tracking_to_odom_ = t;
   PRINT_INFO("Got tf : tracking -> imu ");
   common::PrintTransform(t);
 }
 
-void MapBuilder::SetTrackingToLidar(const Eigen::Matrix4f& t) {
-  tracking_to_lidar_ = t;
-  PRINT_INFO("Got tf : tracking -> lidar ");
+void MapBuilder::SetTrackingToLidar(const Eigen::Matrix4f& t,
+                                    const int lidar_index) {
+  CHECK_GE(lidar_index, 0);
+  {
+    common::MutexLocker locker(&sensor_mutex_);
+    if (lidar_index >= static_cast<int>(tracking_to_lidars_.size())) {
+      tracking_to_lidars_.resize(lidar_index + 1,
+                                 Eigen::Matrix4f::Identity());
+    }
+    tracking_to_lidars_[lidar_index] = t;
+  }
+  PRINT_INFO_FMT("Got tf : tracking -> lidar %d", lidar_index);
   common::PrintTransform(t);
 }
 
-void MapBuilder::InsertPointcloudMsg(const PointCloudPtr& point_cloud) {
-  if (end_all_thread_.load() || extrapolator_ == nullptr ||
+int MapBuilder::LidarNum() {
+  common::MutexLocker locker(&sensor_mutex_);
+  return static_cast<int>(tracking_to_lidars_.size());
+}
+
+Eigen::Matrix4f MapBuilder::TrackingToLidar(const int lidar_index) {
+  common::MutexLocker locker(&sensor_mutex_);
+  CHECK(lidar_index >= 0 &&
+        lidar_index < static_cast<int>(tracking_to_lidars_.size()))
+      << "Unknown lidar " << lidar_index;
+  return tracking_to_lidars_[lidar_index];
+}
+
+MapBuilder::PointCloudPtr MapBuilder::AcquirePointCloud() {
+  return cloud_pool_.Acquire();
+}
+
+MapBuilder::PointCloudPtr MapBuilder::AcquirePointCloud(
+    const sensor_msgs::PointCloud2& msg, PointTimesPtr* const point_times,
+    const int lidar_index) {
+  const Eigen::Matrix4f tracking_to_lidar = TrackingToLidar(lidar_index);
+  PointCloudPtr cloud = cloud_pool_.Acquire();
+  PointTimesPtr times;
+  if (point_times) {
+    times = std::make_shared<std::vector<float>>();
+  }
+  if (!sensors::FromPointCloud2Msg(msg, tracking_to_lidar,
+                                   cloud.get(), times.get())) {
+    PRINT_ERROR("The point cloud msg has no float x/y/z fields.");
+    return nullptr;
+  }
+  if (point_times) {
+    *point_times = times->empty() ? nullptr : times;
+  }
+  // so that the pre-processing will not transform it again
+  cloud->header.frame_id = kTrackingFrameId;
+  return cloud;
+}
+
+MapBuilder::CloudQueueStatus MapBuilder::GetCloudQueueStatus() const {
+  CloudQueueStatus status;
+  status.raw_cloud_depth = raw_point_clouds_.Size();
+  status.raw_cloud_capacity = raw_point_clouds_.Capacity();
+  status.cloud_depth = point_clouds_.Size();
+  status.cloud_capacity = point_clouds_.Capacity();
+  status.dropped_cloud_count = dropped_clouds_count_.load();
+  status.decimated_cloud_count = decimated_clouds_count_.load();
+  return status;
+}
+
+bool MapBuilder::InsertPointcloudMsg(const PointCloudPtr& point_cloud,
+                                     const PointTimesPtr& point_times,
+                                     const int lidar_index) {
+  return EnqueuePointcloud(
+      point_cloud, point_times, lidar_index,
+      options_.front_end_options.cloud_queue_options.full_policy ==
+          front_end::kBlockWhenFull);
+}
+
+bool MapBuilder::TryInsertPointcloudMsg(const PointCloudPtr& point_cloud,
+                                        const PointTimesPtr& point_times,
+                                        const int lidar_index) {
+  return EnqueuePointcloud(point_cloud, point_times, lidar_index, false);
+}
+
+bool MapBuilder::InsertPointcloudMsgBlocking(const PointCloudPtr& point_cloud,
+                                             const PointTimesPtr& point_times,
+                                             const int lidar_index) {
+  return EnqueuePointcloud(point_cloud, point_times, lidar_index, true);
+}
+
+bool MapBuilder::EnqueuePointcloud(const PointCloudPtr& point_cloud,
+                                   const PointTimesPtr& point_times,
+                                   const int lidar_index,
+                                   const bool block_when_full) {
+  if (!input_reorder_buffer_) {
+    return MergePointcloud(point_cloud, point_times, lidar_index,
+                           block_when_full);
+  }
+  return InsertInOrder(
+      sensors::ToLocalTime(point_cloud->header.stamp),
+      [this, point_cloud, point_times, lidar_index, block_when_full]() {
+        MergePointcloud(point_cloud, point_times, lidar_index,
+                        block_when_full);
+      });
+}
+
+bool MapBuilder::MergePointcloud(const PointCloudPtr& point_cloud,
+                                 const PointTimesPtr& point_times,
+                                 const int lidar_index,
+                                 const bool block_when_full) {
+  if (LidarNum() == 1) {
+    CHECK_EQ(lidar_index, 0);
+    return EnqueueRawCloud(point_cloud, point_times, block_when_full);
+  }
+  // the pre-processing only knows the transform of the first lidar, so the
+  // scans are merged in the tracking frame
+  if (point_cloud->header.frame_id != kTrackingFrameId) {
+    common::TransformPointCloud(*point_cloud, point_cloud.get(),
+                                TrackingToLidar(lidar_index));
+    point_cloud->header.frame_id = kTrackingFrameId;
+  }
+  // the merged scans are also pushed one by one, single producer still
+  common::MutexLocker locker(&lidar_sync_mutex_);
+  CHECK(lidar_synchronizer_) << "Not initialised yet.";
+  LidarSynchronizer<PointType>::Scan merged;
+  switch (lidar_synchronizer_->AddScan(lidar_index, {point_cloud, point_times},
+                                       &merged)) {
+    case LidarSynchronizer<PointType>::kPending:
+      return true;
+    case LidarSynchronizer<PointType>::kDropped:
+      dropped_clouds_count_++;
+      PRINT_WARNING_FMT("Scan of lidar %d is too late to merge.", lidar_index);
+      return false;
+    case LidarSynchronizer<PointType>::kMerged:
+    default:
+      break;
+  }
+  return EnqueueRawCloud(merged.cloud, merged.point_times, block_when_full);
+}
+
+bool MapBuilder::EnqueueRawCloud(const PointCloudPtr& point_cloud,
+                                 const PointTimesPtr& point_times,
+                                 const bool block_when_full) {
+  static common::Histogram* const latency =
+      common::MetricsRegistry::Get()->GetHistogram("front_end.insert_cloud");
+  common::ScopedLatency scoped_latency(latency);
+  common::TraceArgs trace_args;
+  trace_args.queue_depth = raw_point_clouds_.Size();
+  common::ScopedTrace scoped_trace("front_end.insert_cloud", trace_args);
+  PoseExtrapolator* extrapolator = nullptr;
+  {
+    // may be created by the imu callback in another thread
+    common::MutexLocker locker(&sensor_mutex_);
+    extrapolator = extrapolator_.get();
+  }
+  if (end_all_thread_.load() || extrapolator == nullptr ||
       sensors::ToLocalTime(point_cloud->header.stamp) <
-          extrapolator_->GetLastPoseTime()) {
+          extrapolator->GetLastPoseTime()) {
+    return false;
+  }
+
+  // adaptive decimation, drop every Nth cloud if there is a big backlog
+  const auto& cloud_queue_options =
+      options_.front_end_options.cloud_queue_options;
+  if (cloud_queue_options.decimation_threshold > 0 &&
+      cloud_queue_options.decimation_step > 0) {
+    const size_t backlog = raw_point_clouds_.Size() + point_clouds_.Size();
+    if (backlog >=
+        static_cast<size_t>(cloud_queue_options.decimation_threshold)) {
+      decimation_counter_++;
+      if (decimation_counter_ % cloud_queue_options.decimation_step == 0) {
+        decimated_clouds_count_++;
+        return false;
+      }
+    } else {
+      decimation_counter_ = 0;
+    }
+  }
+
+  // only enqueue the raw cloud here, all the heavy work is done in
+  // the pre-processing thread
+  const RawCloud raw_cloud{point_cloud, point_times};
+  // counted before it can be popped
+  const int64_t raw_cloud_bytes = QueuedCloudBytes(point_cloud, point_times);
+  RawCloudBytes()->Add(raw_cloud_bytes);
+  if (!raw_point_clouds_.TryPush(raw_cloud)) {
+    if (!block_when_full) {
+      RawCloudBytes()->Add(-raw_cloud_bytes);
+      dropped_clouds_count_++;
+      PRINT_WARNING_FMT("Raw cloud queue is full, dropped %u clouds already.",
+                        dropped_clouds_count_.load());
+      return false;
+    }
+    common::MutexLocker locker(&raw_cloud_queue_mutex_);
+    while (!raw_point_clouds_.TryPush(raw_cloud)) {
+      if (end_all_thread_.load()) {
+        RawCloudBytes()->Add(-raw_cloud_bytes);
+        return false;
+      }
+      locker.AwaitWithTimeout(
+          [&]() {
+            return !raw_point_clouds_.Full() || end_all_thread_.load();
+          },
+          common::FromSeconds(1.));
+    }
+  }
+  // wake up the pre-processing thread
+  common::MutexLocker locker(&raw_cloud_queue_mutex_);
+  if (options_.whole_options.deterministic) {
+    // the sensor data after this cloud come only after it is done, so the
+    // front end and the submap thread see the same data in every run
+    unsettled_raw_clouds_++;
+    locker.Await([&]() {
+      return unsettled_raw_clouds_ <= 0 || end_all_thread_.load();
+    });
+  }
+  return true;
+}
+
+void MapBuilder::SettleRawClouds(const int cloud_num) {
+  if (!options_.whole_options.deterministic || cloud_num <= 0) {
     return;
   }
+  // wake up the producer
+  common::MutexLocker locker(&raw_cloud_queue_mutex_);
+  unsettled_raw_clouds_ -= cloud_num;
+}
 
-  // transform to tracking frame
-  pcl::transformPointCloud(*point_cloud, *point_cloud, tracking_to_lidar_);
+void MapBuilder::PreProcessing() {
+  common::SetCurrentThreadCpus(front_end_cpus_);
+  auto* const metrics = common::MetricsRegistry::Get();
+  common::Histogram* const latency =
+      metrics->GetHistogram("front_end.pre_processing");
+  common::Counter* const busy_us =
+      metrics->GetCounter("thread.pre_processing.busy_us");
+  common::Tracer::Get()->SetThreadName("pre_processing");
+  RawCloud raw_cloud;
+  while (true) {
+    if (!raw_point_clouds_.TryPop(&raw_cloud)) {
+      if (end_all_thread_.load()) {
+        break;
+      }
+      common::MutexLocker locker(&raw_cloud_queue_mutex_);
+      locker.AwaitWithTimeout(
+          [&]() {
+            return !raw_point_clouds_.Empty() || end_all_thread_.load();
+          },
+          common::FromSeconds(1.));
+      continue;
+    }
+    {
+      // wake up the producer if it is waiting for room
+      common::MutexLocker locker(&raw_cloud_queue_mutex_);
+    }
+    RawCloudBytes()->Add(
+        -QueuedCloudBytes(raw_cloud.cloud, raw_cloud.point_times));
+    {
+      common::ScopedLatency scoped_latency(latency, busy_us);
+      common::TraceArgs trace_args;
+      trace_args.queue_depth = raw_point_clouds_.Size();
+      common::ScopedTrace scoped_trace("front_end.pre_processing", trace_args);
+      if (!PreProcessPointcloud(raw_cloud.cloud, raw_cloud.point_times)) {
+        SettleRawClouds(1);
+      }
+    }
+    raw_cloud = RawCloud();
+  }
+
+  {
+    // wake up the scan matching thread
+    common::MutexLocker locker(&cloud_queue_mutex_);
+    pre_processing_done_ = true;
+  }
+  PRINT_INFO("pre-processing thread exit.");
+}
+
+// factors in [0, 1] of the filtered points over the cloud duration,
+// the inliers are the indices of the filtered points in the unfiltered cloud
+// @return nullptr if the times can not follow the filters
+MapBuilder::PointTimesPtr FilteredPointFactors(
+    const std::vector<float>& times, const std::vector<int>& inliers,
+    const size_t filtered_size) {
+  const bool no_filter = inliers.empty() && filtered_size == times.size();
+  if (filtered_size == 0 || (!no_filter && inliers.size() != filtered_size)) {
+    return nullptr;
+  }
+  MapBuilder::PointTimesPtr factors =
+      std::make_shared<std::vector<float>>(filtered_size);
+  for (size_t i = 0; i < filtered_size; ++i) {
+    (*factors)[i] = times[no_filter ? i : inliers[i]];
+  }
+  const auto min_max = std::minmax_element(factors->begin(), factors->end());
+  const float min_time = *min_max.first;
+  const float duration = *min_max.second - min_time;
+  if (duration < 1.e-6) {
+    return nullptr;
+  }
+  for (float& factor : *factors) {
+    factor = (factor - min_time) / duration;
+  }
+  return factors;
+}
+
+bool MapBuilder::PreProcessPointcloud(const PointCloudPtr& point_cloud,
+                                      const PointTimesPtr& point_times) {
+  // transform to tracking frame if it is not converted there already
+  if (point_cloud->header.frame_id != kTrackingFrameId) {
+    common::TransformPointCloud(*point_cloud, point_cloud.get(),
+                                TrackingToLidar(0));
+  }
+  const bool has_times =
+      point_times && point_times->size() == point_cloud->size();
   // accumulating clouds into one
   if (options_.front_end_options.accumulate_cloud_num > 1) {
-    common::MutexLocker locker(&mutex_);
     // "+=" will update the time stamp of accumulated_point_cloud_
     // so, no need to manually copy the time stamp from pointcloud to
     // accumulated_point_cloud_
@@ -205,25 +713,50 @@ void MapBuilder::InsertPointcloudMsg(const PointCloudPtr& point_cloud) {
     if (accumulated_cloud_count_ == 0) {
       first_time_in_accmulated_cloud_ =
           sensors::ToLocalTime(point_cloud->header.stamp);
+      accumulated_point_times_.clear();
+      accumulated_times_valid_ = true;
+    }
+    // the times are shifted by the stamp of each cloud
+    if (has_times && accumulated_times_valid_) {
+      const float offset = (sensors::ToLocalTime(point_cloud->header.stamp) -
+                            first_time_in_accmulated_cloud_)
+                               .toSec();
+      for (const float time : *point_times) {
+        accumulated_point_times_.push_back(offset + time);
+      }
+    } else {
+      accumulated_times_valid_ = false;
     }
     accumulated_cloud_count_++;
     if (accumulated_cloud_count_ <
         options_.front_end_options.accumulate_cloud_num) {
-      return;
+      return false;
     }
   } else {
     accumulated_point_cloud_.reset();
     accumulated_point_cloud_ = point_cloud;
+    accumulated_times_valid_ = has_times;
+    if (has_times) {
+      accumulated_point_times_.assign(point_times->begin(),
+                                      point_times->end());
+    }
   }
   // filtering cloud
-  PointCloudPtr filtered_cloud(new PointCloudType);
+  PointCloudPtr filtered_cloud = cloud_pool_.Acquire();
   DownSamplePointcloud(accumulated_point_cloud_, filtered_cloud);
+  // the times follow the filtered points by the inliers of the filters
+  PointTimesPtr point_factors;
+  if (accumulated_times_valid_) {
+    point_factors = FilteredPointFactors(accumulated_point_times_,
+                                         filter_factory_.Inliers(),
+                                         filtered_cloud->size());
+  }
 
   // registrator::IcpFast<PointType> matcher;
   // matcher.setInputTarget(point_cloud);
 
+  // keep the capacity, the cloud may be recycled by the pool
   point_cloud->points.clear();
-  point_cloud->points.shrink_to_fit();
   accumulated_cloud_count_ = 0;
   accumulated_point_cloud_->clear();
 
@@ -231,12 +764,73 @@ void MapBuilder::InsertPointcloudMsg(const PointCloudPtr& point_cloud) {
   const float delta_time = (sensors::ToLocalTime(point_cloud->header.stamp) -
                             first_time_in_accmulated_cloud_)
                                .toSec();
-  common::MutexLocker locker(&mutex_);
-  point_clouds_.emplace_back(InnerCloud{delta_time, filtered_cloud});
+  InnerCloud inner_cloud{delta_time, filtered_cloud, point_factors};
+  // e.g. from the range image, the registrators skip the normal estimation
+  if (!filter_factory_.Normals().empty()) {
+    inner_cloud.normals = std::make_shared<const std::vector<float>>(
+        filter_factory_.Normals());
+  }
+  // counted before it can be popped
+  const int64_t inner_cloud_bytes =
+      QueuedCloudBytes(filtered_cloud, point_factors);
+  InnerCloudBytes()->Add(inner_cloud_bytes);
+  if (!point_clouds_.TryPush(inner_cloud)) {
+    if (options_.front_end_options.cloud_queue_options.full_policy ==
+        front_end::kDropWhenFull) {
+      InnerCloudBytes()->Add(-inner_cloud_bytes);
+      dropped_clouds_count_++;
+      PRINT_WARNING_FMT("Cloud queue is full, dropped %u clouds already.",
+                        dropped_clouds_count_.load());
+      return false;
+    }
+    // the scan matching thread keeps consuming until this thread quits
+    common::MutexLocker locker(&cloud_queue_mutex_);
+    while (!point_clouds_.TryPush(inner_cloud)) {
+      locker.AwaitWithTimeout([&]() { return !point_clouds_.Full(); },
+                              common::FromSeconds(1.));
+    }
+  }
+  {
+    // wake up the scan matching thread
+    common::MutexLocker locker(&cloud_queue_mutex_);
+  }
   // just for debug
   got_clouds_count_++;
   if (got_clouds_count_ % 100 == 0) {
-    PRINT_INFO_FMT("Got %u clouds already.", got_clouds_count_);
+    PRINT_INFO_FMT("Got %u clouds already. (cloud pool hit: %lu, miss: %lu)",
+                   got_clouds_count_, cloud_pool_.HitCount(),
+                   cloud_pool_.MissCount());
+  }
+  return true;
+}
+
+bool MapBuilder::InsertInOrder(const SimpleTime& stamp,
+                               const std::function<void()>& insertion) {
+  static common::Counter* const late_count =
+      common::MetricsRegistry::Get()->GetCounter("front_end.reorder.late");
+  std::vector<std::function<void()>> released;
+  common::MutexLocker locker(&reorder_mutex_);
+  if (!input_reorder_buffer_->Push(stamp, insertion, &released)) {
+    late_count->Add();
+    PRINT_WARNING_FMT("A msg is later than %lf s, dropped.",
+                      options_.front_end_options.input_reorder_options.latency);
+    return false;
+  }
+  for (const auto& released_insertion : released) {
+    released_insertion();
+  }
+  return true;
+}
+
+void MapBuilder::FlushReorderBuffer() {
+  if (!input_reorder_buffer_) {
+    return;
+  }
+  std::vector<std::function<void()>> released;
+  common::MutexLocker locker(&reorder_mutex_);
+  input_reorder_buffer_->Flush(&released);
+  for (const auto& released_insertion : released) {
+    released_insertion();
   }
 }
 
@@ -244,9 +838,26 @@ void MapBuilder::InsertImuMsg(const sensors::ImuMsg::Ptr& imu_msg) {
   if (!use_imu_ || end_all_thread_.load()) {
     return;
   }
+  if (!input_reorder_buffer_) {
+    ProcessImuMsg(imu_msg);
+    return;
+  }
+  InsertInOrder(imu_msg->header.stamp,
+                [this, imu_msg]() { ProcessImuMsg(imu_msg); });
+}
+
+void MapBuilder::ProcessImuMsg(const sensors::ImuMsg::Ptr& imu_msg) {
+  if (end_all_thread_.load()) {
+    return;
+  }
 
+  Eigen::Matrix4f tracking_to_imu;
+  {
+    common::MutexLocker locker(&sensor_mutex_);
+    tracking_to_imu = tracking_to_imu_;
+  }
   const Eigen::Matrix3d rotation =
-      common::Rotation(tracking_to_imu_).cast<double>();
+      common::Rotation(tracking_to_imu).cast<double>();
   Eigen::Vector3d new_acc =
       rotation * Eigen::Vector3d(imu_msg->linear_acceleration.x,
                                  imu_msg->linear_acceleration.y,
@@ -262,28 +873,59 @@ void MapBuilder::InsertImuMsg(const sensors::ImuMsg::Ptr& imu_msg) {
   imu_msg->angular_velocity.x = new_angular_velocity[0];
   imu_msg->angular_velocity.y = new_angular_velocity[1];
   imu_msg->angular_velocity.z = new_angular_velocity[2];
+  if (isam_optimizer_ &&
+      options_.back_end_options.isam_optimizer_options.use_imu) {
+    isam_optimizer_->AddImuData(*imu_msg);
+  }
 
-  if (!extrapolator_) {
-    extrapolator_ = PoseExtrapolator::InitializeWithImu(
-        SimpleTime::from_sec(0.001),
-        options_.front_end_options.imu_options.gravity_constant, *imu_msg);
-  } else {
-    extrapolator_->AddImuData(*imu_msg);
+  {
+    // the lidar callbacks read the pointer in other threads
+    common::MutexLocker locker(&sensor_mutex_);
+    if (!extrapolator_ && restored_submap_num_ > 0) {
+      // resumed, the extrapolator continues from the last restored frames
+      if (imu_msg->header.stamp < resume_time_) {
+        return;
+      }
+      extrapolator_ = common::make_unique<PoseExtrapolator>(
+          SimpleTime::from_sec(0.001),
+          options_.front_end_options.imu_options.gravity_constant);
+      const auto& frames = current_trajectory_->back()->GetFrames();
+      for (size_t i = frames.size() >= 2 ? frames.size() - 2 : 0;
+           i < frames.size(); ++i) {
+        extrapolator_->AddPose(frames[i]->GetTimeStamp(),
+                               frames[i]->GlobalPose().cast<double>());
+      }
+      extrapolator_->AddImuData(*imu_msg);
+    } else if (!extrapolator_) {
+      extrapolator_ = PoseExtrapolator::InitializeWithImu(
+          SimpleTime::from_sec(0.001),
+          options_.front_end_options.imu_options.gravity_constant, *imu_msg);
+    } else {
+      extrapolator_->AddImuData(*imu_msg);
+    }
   }
 
-  // if (!imu_gps_fusion_) {
-  //   imu_gps_fusion_ = common::make_unique<sensor_fusions::ImuGpsTracker>(
-  //       options_.front_end_options.imu_options.gravity_constant,
-  //       options_.front_end_options.imu_options.frequency,
-  //       imu_msg->header.stamp);
-  // }
-  // imu_gps_fusion_->AddImuData(*imu_msg);
+  if (imu_gps_fusion_) {
+    imu_gps_fusion_->AddImuData(*imu_msg);
+  }
 }
 
 void MapBuilder::InsertOdomMsg(const sensors::OdomMsg::Ptr& odom_msg) {
   if (!use_odom_ || end_all_thread_.load()) {
     return;
   }
+  if (!input_reorder_buffer_) {
+    ProcessOdomMsg(odom_msg);
+    return;
+  }
+  InsertInOrder(odom_msg->header.stamp,
+                [this, odom_msg]() { ProcessOdomMsg(odom_msg); });
+}
+
+void MapBuilder::ProcessOdomMsg(const sensors::OdomMsg::Ptr& odom_msg) {
+  if (end_all_thread_.load()) {
+    return;
+  }
 
   // transform to tracking frame
   const Eigen::Matrix4d tracking_frame_odom =
@@ -299,18 +941,21 @@ void MapBuilder::InsertOdomMsg(const sensors::OdomMsg::Ptr& odom_msg) {
     }
     return;
   }
+  if (odom_msg->header.stamp < resume_time_) {
+    return;
+  }
   extrapolator_->AddOdometryData(*odom_msg);
 
   common::MutexLocker locker(&mutex_);
   // odom_msgs_ are just for generating path file now
-  if (odom_msgs_.empty()) {
+  if (odom_msgs_.Empty()) {
     init_odom_msg_ = *odom_msg;
   }
   Eigen::Matrix4d init_pose = init_odom_msg_.PoseInMatrix();
   Eigen::Matrix4d relative_pose =
       init_pose.inverse() * odom_msg->PoseInMatrix();
   odom_msg->SetPose(relative_pose);
-  odom_msgs_.push_back(odom_msg);
+  odom_msgs_.Push(*odom_msg);
 
   // for output pcd
   Eigen::Vector3d odom_path_point;
@@ -323,10 +968,27 @@ void MapBuilder::InsertGpsMsg(const sensors::NavSatFixMsg::Ptr& gps_msg) {
   if (!use_gps_ || end_all_thread_.load()) {
     return;
   }
+  if (!input_reorder_buffer_) {
+    ProcessGpsMsg(gps_msg);
+    return;
+  }
+  InsertInOrder(gps_msg->header.stamp,
+                [this, gps_msg]() { ProcessGpsMsg(gps_msg); });
+}
+
+void MapBuilder::ProcessGpsMsg(const sensors::NavSatFixMsg::Ptr& gps_msg) {
+  if (end_all_thread_.load()) {
+    return;
+  }
   sensors::UtmMsg::Ptr utm(new sensors::UtmMsg);
-  utm::LatLonToUTMXY(gps_msg->latitude, gps_msg->longtitude, kUtmZone, utm->x,
-                     utm->y);
+  // the batch conversion shares the precomputed constants of the zone
+  utm::LatLonToUTMXY(&gps_msg->latitude, &gps_msg->longtitude, 1, kUtmZone,
+                     &utm->x, &utm->y);
   utm->z = gps_msg->altitude;
+  if (gps_msg->position_covariance_type != sensors::COVARIANCE_TYPE_UNKNOWN) {
+    utm->sigma = std::sqrt(std::max(gps_msg->position_covariance[0],
+                                    gps_msg->position_covariance[4]));
+  }
 
   if (!utm_init_offset_) {
     if (gps_msg->status.status != sensors::STATUS_FIX) {
@@ -338,10 +1000,6 @@ void MapBuilder::InsertGpsMsg(const sensors::NavSatFixMsg::Ptr& gps_msg) {
   utm->y -= utm_init_offset_.value()[1];
   utm->z -= utm_init_offset_.value()[2];
 
-  // if (imu_gps_fusion_) {
-  //   imu_gps_fusion_->AddUtmData(*utm);
-  // }
-
   Eigen::Vector4d utm_point;
   utm_point[0] = utm->x;
   utm_point[1] = utm->y;
@@ -354,7 +1012,10 @@ void MapBuilder::InsertGpsMsg(const sensors::NavSatFixMsg::Ptr& gps_msg) {
   }
 
   utm->header = gps_msg->header;
-  utm_msgs_.push_back(utm);
+  utm_msgs_.Push(*utm);
+  if (imu_gps_fusion_) {
+    imu_gps_fusion_->AddUtmData(*utm);
+  }
 }
 
 void MapBuilder::AddNewTrajectory() {
@@ -371,59 +1032,37 @@ void MapBuilder::InsertFrameForSubmap(const PointCloudPtr& cloud_ptr,
                                       const double match_score) {
   auto frame = std::make_shared<Frame<PointType>>();
   frame->SetCloud(cloud_ptr);
-  frame->CalculateDescriptor();
+  // usually made by the scan matcher already
+  frame->AttachSoaCloud();
+  frame->CalculateDescriptorAsync();
   frame->SetTimeStamp(sensors::ToLocalTime(cloud_ptr->header.stamp));
   frame->SetGlobalPose(global_pose);
+  frame->TrackCloudBytes();
+  visualization_sink_.UpdatePose(global_pose);
 
   common::MutexLocker locker(&mutex_);
   frames_.push_back(frame);
 }
 
-template <typename T>
-Eigen::Matrix<T, 4, 4> InterpolateTransform(const Eigen::Matrix<T, 4, 4>& t1,
-                                            const Eigen::Matrix<T, 4, 4>& t2,
-                                            const float factor) {
-  CHECK(factor >= 0. && factor <= 1.);
-  Eigen::Matrix<T, 4, 4> new_transform = Eigen::Matrix<T, 4, 4>::Identity();
-  const Eigen::Quaternion<T> q_a(Eigen::Matrix<T, 3, 3>(t1.block(0, 0, 3, 3)));
-  const Eigen::Quaternion<T> q_b(Eigen::Matrix<T, 3, 3>(t2.block(0, 0, 3, 3)));
-  new_transform.block(0, 0, 3, 3) = q_a.slerp(factor, q_b).toRotationMatrix();
-  new_transform.block(0, 3, 3, 1) =
-      t1.block(0, 3, 3, 1) +
-      (t2.block(0, 3, 3, 1) - t1.block(0, 3, 3, 1)) * factor;
-  return new_transform;
-}
-
 void MotionCompensation(const MapBuilder::PointCloudPtr& raw_cloud,
+                        const MapBuilder::PointTimesPtr& point_factors,
                         const float delta_time,
                         const Eigen::Matrix4f& delta_transform,
                         MapBuilder::PointCloudType* const output_cloud) {
   CHECK(raw_cloud);
-  CHECK(output_cloud);
   CHECK_GT(delta_time, 1.e-6);
-  output_cloud->clear();
-  const size_t cloud_size = raw_cloud->size();
-  output_cloud->header = raw_cloud->header;
-  output_cloud->reserve(cloud_size);
-  for (size_t i = 0; i < cloud_size; ++i) {
-    const auto& point = raw_cloud->points[i];
-    float delta_factor = static_cast<float>(i) / static_cast<float>(cloud_size);
-    const Eigen::Matrix4f transform = InterpolateTransform(
-        Eigen::Matrix4f::Identity().eval(), delta_transform, delta_factor);
-    const Eigen::Vector3f new_point_start =
-        transform.block(0, 0, 3, 3) *
-            Eigen::Vector3f(point.x, point.y, point.z) +
-        transform.block(0, 3, 3, 1);
-
-    const Eigen::Vector3f new_point_current =
-        delta_transform.block(0, 0, 3, 3).inverse() *
-        (new_point_start - delta_transform.block(0, 3, 3, 1));
-    MapBuilder::PointType new_point;
-    new_point.x = new_point_current[0];
-    new_point.y = new_point_current[1];
-    new_point.z = new_point_current[2];
-    new_point.intensity = point.intensity;
-    output_cloud->points.push_back(new_point);
+  MotionCompensation(*raw_cloud, point_factors.get(), delta_transform,
+                     output_cloud);
+}
+
+// the compensated points are only moved slightly, the normals given for
+// the raw cloud (e.g. by the range image) are good enough for the copy
+void ShareGivenNormals(const MapBuilder::PointCloudPtr& raw_cloud,
+                       const MapBuilder::PointCloudPtr& compensated_cloud) {
+  using Attachments = registrator::CloudAttachments<MapBuilder::PointType>;
+  const auto normals = Attachments::Get(raw_cloud)->GivenNormals();
+  if (normals) {
+    Attachments::Get(compensated_cloud)->SetNormals(normals);
   }
 }
 
@@ -448,8 +1087,8 @@ Eigen::Matrix4f AverageTransforms(
 
 void MapBuilder::ScanMatchProcessing() {
   using Pose3d = PoseExtrapolator::RigidPose3d;
-
-  scan_match_thread_running_ = true;
+  common::Tracer::Get()->SetThreadName("scan_match");
+  common::SetCurrentThreadCpus(front_end_cpus_);
 
   PointCloudPtr target_cloud;
   PointCloudPtr source_cloud;
@@ -458,40 +1097,141 @@ void MapBuilder::ScanMatchProcessing() {
   Pose3d accumulative_transform = Pose3d::Identity();
   SimpleTime last_source_time;
   float source_cloud_delta_time = 0.;
+  PointTimesPtr source_point_factors;
+
+  // the next cloud matched against the current source in parallel, with
+  // the guessed pose of the current source (see speculative_options)
+  struct Speculation {
+    PointCloudPtr source_cloud;
+    float delta_time = 0.;
+    PointTimesPtr point_factors;
+    PointCloudPtr target_cloud;
+    // the guessed pose of the target it assumed
+    Pose3d target_pose = Pose3d::Identity();
+    Pose3d guess = Pose3d::Identity();
+    // the source compensated with the guess, if it is not in place
+    PointCloudPtr compensated_source_cloud;
+    Eigen::Matrix4f align_result = Eigen::Matrix4f::Identity();
+    double score = 0.;
+    std::future<void> done;
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+  const auto& speculative_options =
+      options_.front_end_options.speculative_options;
+  std::unique_ptr<registrator::Interface<PointType>> speculative_matcher;
+  if (speculative_options.enable) {
+    speculative_matcher = scan_matcher_->cloneWithSource();
+    if (!speculative_matcher) {
+      PRINT_WARNING("the scan matcher can not be cloned, no speculation.");
+    }
+  }
+  std::unique_ptr<Speculation> speculation;
+  // the speculation of the cloud of this iteration, finished
+  std::unique_ptr<Speculation> finished_speculation;
 
   // get a new cloud from the cloud buffer
   // it is usually not the newest one but hasn't been calculated
-  const auto get_new_cloud = [&](PointCloudPtr& cloud,
-                                 float* const delta_time) -> bool {
-    common::MutexLocker locker(&mutex_);
-    if (point_clouds_.empty()) {
+  const auto get_new_cloud = [&](PointCloudPtr& cloud, float* const delta_time,
+                                 PointTimesPtr* const point_factors) -> bool {
+    if (speculation) {
+      // popped already
+      speculation->done.wait();
+      cloud = speculation->source_cloud;
+      *delta_time = speculation->delta_time;
+      *point_factors = speculation->point_factors;
+      finished_speculation = std::move(speculation);
+      return true;
+    }
+    // a speculation skipped by the filters is stale
+    finished_speculation.reset();
+    InnerCloud inner_cloud;
+    if (!point_clouds_.TryPop(&inner_cloud)) {
       return false;
     }
-    cloud = point_clouds_[0].cloud;
-    *delta_time = point_clouds_[0].delta_time_in_cloud;
-    point_clouds_.erase(point_clouds_.begin());
+    {
+      // wake up the pre-processing thread if it is waiting for room
+      common::MutexLocker locker(&cloud_queue_mutex_);
+    }
+    InnerCloudBytes()->Add(
+        -QueuedCloudBytes(inner_cloud.cloud, inner_cloud.point_factors));
+    cloud = inner_cloud.cloud;
+    *delta_time = inner_cloud.delta_time_in_cloud;
+    *point_factors = inner_cloud.point_factors;
+    if (inner_cloud.normals) {
+      // attached just before matching, the attachments only keep the
+      // recent clouds
+      registrator::CloudAttachments<PointType>::Get(cloud)->SetNormals(
+          inner_cloud.normals);
+    }
     return true;
   };
 
+  auto* const metrics = common::MetricsRegistry::Get();
+  common::Histogram* const latency =
+      metrics->GetHistogram("front_end.scan_match");
+  common::Counter* const busy_us =
+      metrics->GetCounter("thread.scan_match.busy_us");
+
   bool first_in_accumulate = true;
   PointCloudPtr history_cloud = nullptr;
+  // scan to local map matching if enabled
+  const bool use_local_map =
+      options_.front_end_options.local_map_options.enable;
+  std::unique_ptr<LocalMap<PointType>> local_map;
+  if (use_local_map) {
+    local_map = common::make_unique<LocalMap<PointType>>(
+        options_.front_end_options.local_map_options);
+  }
+  PointCloudPtr local_map_target;
+  // the cloud of the last iteration is done, unless it is a new frame,
+  // which is done in the submap thread
+  bool cloud_unsettled = false;
   while (true) {
-    if (get_new_cloud(source_cloud, &source_cloud_delta_time)) {
+    if (cloud_unsettled) {
+      SettleRawClouds(1);
+      cloud_unsettled = false;
+    }
+    if (get_new_cloud(source_cloud, &source_cloud_delta_time,
+                      &source_point_factors)) {
+      cloud_unsettled = true;
       auto source_time = sensors::ToLocalTime(source_cloud->header.stamp);
       if (!got_first_point_cloud_) {
         got_first_point_cloud_ = true;
         target_cloud = source_cloud;
         history_cloud = target_cloud;
-        InsertFrameForSubmap(source_cloud, Eigen::Matrix4f::Identity(), 1.);
+        scan_matcher_->setPinnedTarget(history_cloud);
+        Eigen::Matrix4f first_pose = Eigen::Matrix4f::Identity();
+        if (restored_submap_num_ > 0) {
+          // resumed, following the path restored from the checkpoint
+          pose_target = extrapolator_->ExtrapolatePose(source_time);
+          final_transform = pose_target;
+          first_pose = final_transform.cast<float>();
+        }
+        InsertFrameForSubmap(source_cloud, first_pose, 1.);
+        cloud_unsettled = false;
+        if (use_local_map) {
+          local_map->Update(*source_cloud, first_pose);
+        }
         continue;
       }
     } else {
-      if (end_all_thread_.load()) {
+      if (pre_processing_done_.load()) {
         break;
       }
-      SimpleTime::from_sec(0.01).sleep();
+      common::MutexLocker locker(&cloud_queue_mutex_);
+      locker.AwaitWithTimeout(
+          [&]() {
+            return !point_clouds_.Empty() || pre_processing_done_.load();
+          },
+          common::FromSeconds(1.));
       continue;
     }
+    // measures the rest of this iteration
+    common::ScopedLatency scoped_latency(latency, busy_us);
+    common::TraceArgs trace_args;
+    trace_args.trajectory = current_trajectory_->GetId();
+    trace_args.queue_depth = point_clouds_.Size();
+    common::ScopedTrace scoped_trace("front_end.scan_match", trace_args);
 
     const auto source_time = sensors::ToLocalTime(source_cloud->header.stamp);
     if (source_time < extrapolator_->GetLastPoseTime()) {
@@ -500,6 +1240,16 @@ void MapBuilder::ScanMatchProcessing() {
       continue;
     }
     Pose3d pose_source = extrapolator_->ExtrapolatePose(source_time);
+    if (imu_gps_fusion_ && imu_gps_fusion_->IsReady()) {
+      // the motion fused with gps is closer than the extrapolation from
+      // the velocities of the poses
+      Pose3d fused_motion = Pose3d::Identity();
+      if (imu_gps_fusion_->RelativePose(
+              sensors::ToLocalTime(target_cloud->header.stamp), source_time,
+              &fused_motion)) {
+        pose_source = pose_target * fused_motion;
+      }
+    }
     Pose3d guess = pose_target.inverse() * pose_source;
     common::NormalizeRotation(guess);
 
@@ -519,18 +1269,145 @@ void MapBuilder::ScanMatchProcessing() {
       continue;
     }
 
-    // motion compensation using guess
-    scan_matcher_->setInputTarget(target_cloud);
-    if (options_.front_end_options.motion_compensation_options.enable) {
-      PointCloudType compensated_source_cloud;
-      MotionCompensation(source_cloud, source_cloud_delta_time,
-                         guess.cast<float>(), &compensated_source_cloud);
-      scan_matcher_->setInputSource(compensated_source_cloud.makeShared());
+    const bool compensation_enabled =
+        options_.front_end_options.motion_compensation_options.enable;
+    PointCloudPtr compensated_source_cloud;
+    Eigen::Matrix4f align_result = Eigen::Matrix4f::Identity();
+    double fitness_score = 0.;
+    // the speculative result is taken if the target is refined close to the
+    // pose it assumed
+    bool speculated = false;
+    if (finished_speculation) {
+      const Pose3d deviation =
+          finished_speculation->target_pose.inverse() * pose_target;
+      const double deviation_angle =
+          common::RotationMatrixToEulerAngles(common::Rotation(deviation))
+              .norm() *
+          180. / M_PI;
+      speculated = finished_speculation->target_cloud == target_cloud &&
+                   common::Translation(deviation).norm() <
+                       speculative_options.translation_threshold &&
+                   deviation_angle < speculative_options.angle_threshold;
+      if (speculated) {
+        guess = finished_speculation->guess;
+        compensated_source_cloud =
+            finished_speculation->compensated_source_cloud;
+        align_result = finished_speculation->align_result;
+        fitness_score = finished_speculation->score;
+      }
+      metrics
+          ->GetCounter(speculated ? "front_end.speculation.hit"
+                                  : "front_end.speculation.miss")
+          ->Add();
+      finished_speculation.reset();
+    }
+    if (!speculated) {
+      // motion compensation using guess
+      // target_cloud is usually the source of last matching
+      // its prepared structures (e.g. kd-tree) are reused if possible
+      // the local map cloud only changes when a new frame inserted
+      if (!use_local_map) {
+        scan_matcher_->setInputTarget(target_cloud);
+      } else {
+        const PointCloudPtr local_map_cloud = local_map->GetCloud();
+        // the local map changed from the current target by the added and
+        // removed points, e.g. ndt only updates the voxels touched by them
+        if (local_map_target && local_map_cloud != local_map_target) {
+          scan_matcher_->updateInputTarget(local_map_cloud,
+                                           local_map->AddedPoints(),
+                                           local_map->RemovedPoints());
+        } else {
+          scan_matcher_->setInputTarget(local_map_cloud);
+        }
+        local_map_target = local_map_cloud;
+      }
+      if (compensation_enabled) {
+        compensated_source_cloud = cloud_pool_.Acquire();
+        MotionCompensation(source_cloud, source_point_factors,
+                           source_cloud_delta_time, guess.cast<float>(),
+                           compensated_source_cloud.get());
+        ShareGivenNormals(source_cloud, compensated_source_cloud);
+        if (source_point_factors) {
+          // compensated by the real times of points, accurate enough
+          // already, same size and header, swapping the points is enough
+          source_cloud->points.swap(compensated_source_cloud->points);
+          registrator::CloudAttachments<PointType>::Invalidate(source_cloud);
+          compensated_source_cloud.reset();
+        }
+      }
+      scan_matcher_->setInputSource(compensated_source_cloud
+                                        ? compensated_source_cloud
+                                        : source_cloud);
+    }
+
+    // the next cloud is matched in parallel against this one, if this one
+    // does not change after its matching
+    PointCloudPtr next_cloud;
+    float next_delta_time = 0.;
+    PointTimesPtr next_point_factors;
+    if (!speculated && speculative_matcher && !use_local_map &&
+        !compensated_source_cloud &&
+        get_new_cloud(next_cloud, &next_delta_time, &next_point_factors)) {
+      speculation.reset(new Speculation);
+      Speculation* const next = speculation.get();
+      next->source_cloud = next_cloud;
+      next->delta_time = next_delta_time;
+      next->point_factors = next_point_factors;
+      next->target_cloud = source_cloud;
+      next->target_pose = pose_source;
+      const auto next_time = sensors::ToLocalTime(next_cloud->header.stamp);
+      Pose3d next_pose = extrapolator_->ExtrapolatePose(next_time);
+      Pose3d fused_motion = Pose3d::Identity();
+      if (imu_gps_fusion_ && imu_gps_fusion_->IsReady() &&
+          imu_gps_fusion_->RelativePose(source_time, next_time,
+                                        &fused_motion)) {
+        next_pose = pose_source * fused_motion;
+      }
+      next->guess = pose_source.inverse() * next_pose;
+      common::NormalizeRotation(next->guess);
+      if (compensation_enabled) {
+        next->compensated_source_cloud = cloud_pool_.Acquire();
+      }
+      registrator::Interface<PointType>* const matcher =
+          speculative_matcher.get();
+      next->done = common::SharedExecutor::Submit(
+          common::TaskPriority::kFrontEnd, [next, matcher]() {
+            // never in place, the raw cloud is matched again if missed
+            if (next->compensated_source_cloud) {
+              MotionCompensation(next->source_cloud, next->point_factors,
+                                 next->delta_time, next->guess.cast<float>(),
+                                 next->compensated_source_cloud.get());
+              ShareGivenNormals(next->source_cloud,
+                                next->compensated_source_cloud);
+            }
+            matcher->setInputTarget(next->target_cloud);
+            matcher->setInputSource(next->compensated_source_cloud
+                                        ? next->compensated_source_cloud
+                                        : next->source_cloud);
+            matcher->align(next->guess.cast<float>(), next->align_result);
+            next->score = matcher->getFitnessScore();
+          });
+    }
+
+    if (speculated) {
+      // matched already
+    } else if (use_local_map) {
+      // the pose of target in local map (also the global frame of front end)
+      const Pose3d target_pose_in_map =
+          final_transform * accumulative_transform;
+      Eigen::Matrix4f source_pose_in_map = Eigen::Matrix4f::Identity();
+      scan_matcher_->align((target_pose_in_map * guess).cast<float>(),
+                           source_pose_in_map);
+      align_result = (target_pose_in_map.inverse() *
+                      source_pose_in_map.cast<double>())
+                         .cast<float>();
+      common::NormalizeRotation(align_result);
     } else {
-      scan_matcher_->setInputSource(source_cloud);
+      scan_matcher_->align(guess.cast<float>(), align_result);
+    }
+    if (!speculated) {
+      fitness_score = scan_matcher_->getFitnessScore();
     }
-    Eigen::Matrix4f align_result = Eigen::Matrix4f::Identity();
-    scan_matcher_->align(guess.cast<float>(), align_result);
     // PRINT_DEBUG("guess vs result");
     // std::cout << common::Translation(guess).transpose() << std::endl;
     // std::cout << common::Translation(align_result).transpose() << std::endl;
@@ -539,7 +1416,13 @@ void MapBuilder::ScanMatchProcessing() {
     //                  .transpose()
     //           << std::endl;
 
-    if (options_.front_end_options.motion_compensation_options.enable) {
+    if (compensated_source_cloud && source_point_factors) {
+      // compensated by the real times of points, accurate enough already
+      source_cloud->points.swap(compensated_source_cloud->points);
+      // the kd-tree etc. built while matching it as the source are of the
+      // uncompensated points, they must not be reused for the next target
+      registrator::CloudAttachments<PointType>::Invalidate(source_cloud);
+    } else if (compensated_source_cloud) {
       Eigen::Matrix4f average_transform = align_result;
       if (options_.front_end_options.motion_compensation_options.use_average) {
         std::vector<Eigen::Matrix4f> transforms;
@@ -548,10 +1431,12 @@ void MapBuilder::ScanMatchProcessing() {
         average_transform = AverageTransforms(transforms);
       }
       // motion compensation using align result
-      PointCloudType compensated_source_cloud;
-      MotionCompensation(source_cloud, source_cloud_delta_time,
-                         average_transform, &compensated_source_cloud);
-      *source_cloud = compensated_source_cloud;
+      PointCloudPtr average_compensated_cloud = cloud_pool_.Acquire();
+      MotionCompensation(source_cloud, nullptr, source_cloud_delta_time,
+                         average_transform, average_compensated_cloud.get());
+      // same size and header, swapping the points is enough
+      source_cloud->points.swap(average_compensated_cloud->points);
+      registrator::CloudAttachments<PointType>::Invalidate(source_cloud);
     }
 
     pose_source = pose_target * align_result.cast<double>();
@@ -572,20 +1457,29 @@ void MapBuilder::ScanMatchProcessing() {
         (options_.front_end_options.motion_filter.angle_range > 1e-3 &&
          accu_angles >= options_.front_end_options.motion_filter.angle_range)) {
       // re-align if nessary
-      if (!first_in_accumulate) {
+      // no need for local map, the source is already matched to the map
+      if (!first_in_accumulate && !use_local_map) {
         scan_matcher_->setInputSource(source_cloud);
         scan_matcher_->setInputTarget(history_cloud);
         Eigen::Matrix4f tmp_result;
         scan_matcher_->align(accumulative_transform.cast<float>(), tmp_result);
         accumulative_transform = tmp_result.cast<double>();
+        fitness_score = scan_matcher_->getFitnessScore();
       }
 
       final_transform *= accumulative_transform;
+      common::NormalizeRotation(final_transform);
       InsertFrameForSubmap(source_cloud, final_transform.cast<float>(),
-                           scan_matcher_->getFitnessScore());
+                           fitness_score);
+      cloud_unsettled = false;
+      if (use_local_map) {
+        local_map->Update(*source_cloud, final_transform.cast<float>());
+      }
 
       accumulative_transform = Pose3d::Identity();
       history_cloud = source_cloud;
+      // keep the prepared target for re-aligning to the history cloud
+      scan_matcher_->setPinnedTarget(history_cloud);
       first_in_accumulate = true;
     } else {
       first_in_accumulate = false;
@@ -595,7 +1489,11 @@ void MapBuilder::ScanMatchProcessing() {
     pose_target = pose_source;
   }
 
-  scan_match_thread_running_ = false;
+  {
+    // wake up the submap thread and FinishAllComputations
+    common::MutexLocker locker(&mutex_);
+    scan_match_thread_running_ = false;
+  }
   PRINT_INFO("point cloud thread exit.");
 }
 
@@ -627,64 +1525,37 @@ sensors::OdomMsg InterpolateOdom(
   return data;
 }
 
-template <typename MsgTypePtr>
-std::pair<int, int> TimeStampBinarySearch(const std::vector<MsgTypePtr>& msgs,
-                                          const SimpleTime& time) {
-  int mid;
-  int start = 0;
-  int end = msgs.size() - 1;
-  while (end - start > 1) {
-    mid = start + (end - start) / 2;
-    if (time < msgs.at(mid)->header.stamp) {
-      end = mid;
-    } else {
-      start = mid;
-    }
-  }
-  return std::make_pair(start, end);
-}
-
 bool MapBuilder::GetOdomAtTime(const SimpleTime& time, sensors::OdomMsg* odom,
                                double threshold_in_sec) {
   CHECK(odom);
   if (threshold_in_sec < 1.e-6) {
     threshold_in_sec = 1.e-6;
   }
-  sensors::OdomMsg::Ptr former_data;
-  sensors::OdomMsg::Ptr latter_data;
-  {
-    common::MutexLocker locker(&mutex_);
-    // size == 0
-    if (odom_msgs_.empty()) {
-      PRINT_WARNING("no odom data.");
-      return false;
-    }
-    // size == 1
-    if (odom_msgs_.size() == 1) {
-      if (std::fabs(time.toSec() - odom_msgs_[0]->header.stamp.toSec()) <=
-          threshold_in_sec) {
-        *odom = *odom_msgs_[0];
-        return true;
-      } else {
-        return false;
-      }
-    }
-    // size >= 2
-    if (time < odom_msgs_.front()->header.stamp ||
-        time > odom_msgs_.back()->header.stamp) {
-      PRINT_WARNING("too old or too new.");
+  // no need to lock mutex_, the buffer has its own lock
+  sensors::OdomMsg former_data;
+  sensors::OdomMsg latter_data;
+  if (odom_msgs_.Empty()) {
+    PRINT_WARNING("no odom data.");
+    return false;
+  }
+  if (!odom_msgs_.Bracket(time, &former_data, &latter_data)) {
+    PRINT_WARNING("too old or too new.");
+    return false;
+  }
+  // only one msg
+  if (former_data.header.stamp == latter_data.header.stamp) {
+    if (std::fabs(time.toSec() - former_data.header.stamp.toSec()) <=
+        threshold_in_sec) {
+      *odom = former_data;
+      return true;
+    } else {
       return false;
     }
-
-    // binary search for the time period for the target time
-    auto indices = TimeStampBinarySearch(odom_msgs_, time);
-    former_data = odom_msgs_[indices.first];
-    latter_data = odom_msgs_[indices.second];
   }
 
-  CHECK(time >= former_data->header.stamp && time <= latter_data->header.stamp);
+  CHECK(time >= former_data.header.stamp && time <= latter_data.header.stamp);
   // interpolate the data for more accurate odom data
-  *odom = InterpolateOdom(*former_data, *latter_data, time);
+  *odom = InterpolateOdom(former_data, latter_data, time);
   return true;
 }
 
@@ -693,62 +1564,55 @@ bool MapBuilder::GetUtmAtTime(const SimpleTime& time, sensors::UtmMsg* utm,
   CHECK(utm);
   if (threshold_in_sec < 1.e-6) {
     threshold_in_sec = 1.e-6;
-  }
-  sensors::UtmMsg::Ptr former_data;
-  sensors::UtmMsg::Ptr latter_data;
-  {
-    common::MutexLocker locker(&mutex_);
-    // size == 0
-    if (utm_msgs_.empty()) {
-      PRINT_WARNING("no utm data.");
-      return false;
-    }
-    // size == 1
-    if (utm_msgs_.size() == 1) {
-      if (std::fabs(time.toSec() - utm_msgs_[0]->header.stamp.toSec()) <=
-          threshold_in_sec) {
-        *utm = *utm_msgs_[0];
-        return true;
-      } else {
-        return false;
-      }
-    }
-    // size >= 2
-    if (time < utm_msgs_.front()->header.stamp ||
-        time > utm_msgs_.back()->header.stamp) {
-      PRINT_WARNING("too old or too new.");
+  }
+  // no need to lock mutex_, the buffer has its own lock
+  sensors::UtmMsg former_data;
+  sensors::UtmMsg latter_data;
+  if (utm_msgs_.Empty()) {
+    PRINT_WARNING("no utm data.");
+    return false;
+  }
+  if (!utm_msgs_.Bracket(time, &former_data, &latter_data)) {
+    PRINT_WARNING("too old or too new.");
+    return false;
+  }
+  // only one msg
+  if (former_data.header.stamp == latter_data.header.stamp) {
+    if (std::fabs(time.toSec() - former_data.header.stamp.toSec()) <=
+        threshold_in_sec) {
+      *utm = former_data;
+      return true;
+    } else {
       return false;
     }
-
-    // binary search for the time period for the target time
-    auto indices = TimeStampBinarySearch(utm_msgs_, time);
-    former_data = utm_msgs_.at(indices.first);
-    latter_data = utm_msgs_.at(indices.second);
   }
 
-  CHECK(time >= former_data->header.stamp && time <= latter_data->header.stamp);
-  if (latter_data->header.stamp.toSec() - former_data->header.stamp.toSec() >
+  CHECK(time >= former_data.header.stamp && time <= latter_data.header.stamp);
+  if (latter_data.header.stamp.toSec() - former_data.header.stamp.toSec() >
       1.) {
     return false;
   }
 
-  float factor =
-      (time - former_data->header.stamp).toSec() /
-      (latter_data->header.stamp - former_data->header.stamp).toSec();
+  float factor = (time - former_data.header.stamp).toSec() /
+                 (latter_data.header.stamp - former_data.header.stamp).toSec();
   CHECK(factor >= 0. && factor <= 1.);
 
-  utm->x = former_data->x + factor * (latter_data->x - former_data->x);
-  utm->y = former_data->y + factor * (latter_data->y - former_data->y);
-  utm->z = former_data->z + factor * (latter_data->z - former_data->z);
+  utm->x = former_data.x + factor * (latter_data.x - former_data.x);
+  utm->y = former_data.y + factor * (latter_data.y - former_data.y);
+  utm->z = former_data.z + factor * (latter_data.z - former_data.z);
+  utm->sigma = former_data.sigma < 0. || latter_data.sigma < 0.
+                   ? -1.
+                   : std::max(former_data.sigma, latter_data.sigma);
   return true;
 }
 
-void MapBuilder::SubmapPairMatch(const int source_index,
-                                 const int target_index) {
-  std::shared_ptr<Submap<PointType>> target_submap, source_submap;
-  target_submap = current_trajectory_->at(target_index);
-  source_submap = current_trajectory_->at(source_index);
-  target_submap->ClearCloudInFrames();
+double MapBuilder::MatchSubmaps(
+    const std::shared_ptr<Submap<PointType>>& source_submap,
+    const int target_index, Eigen::Matrix4f* const guess,
+    Eigen::Matrix4f* const result) {
+  CHECK(guess && result);
+  std::shared_ptr<Submap<PointType>> target_submap =
+      current_trajectory_->at(target_index);
 
   // init back end(submap to submap matcher)
   std::shared_ptr<registrator::Interface<PointType>> matcher;
@@ -769,71 +1633,190 @@ void MapBuilder::SubmapPairMatch(const int source_index,
       dynamic_cast<NdtWithGicp<PointType>*>(matcher.get())
           ->enableNdt(submap_matcher_options.enable_ndt);
       break;
+    case registrator::kNdt:
+      matcher = std::make_shared<Ndt<PointType>>();
+      dynamic_cast<Ndt<PointType>*>(matcher.get())
+          ->setSharedTargetCache(ndt_target_cache_);
+      break;
+#ifdef _ICP_USE_CUDA_
+    case registrator::kGpuIcp:
+      matcher = std::make_shared<IcpGpu<PointType>>();
+      break;
+#endif
 
     default:
       PRINT_ERROR("Wrong type");
-      return;
+      return 0.;
+  }
+  // ndt keeps its voxel grids of submaps, so coarse levels do not help
+  if (submap_matcher_options.pyramid_levels > 1 &&
+      submap_matcher_options.type != registrator::kNdt) {
+    using Pyramid = registrator::MultiResolution<PointType>;
+    matcher = std::make_shared<Pyramid>(
+        matcher,
+        Pyramid::MakeLevels(
+            submap_matcher_options.pyramid_levels,
+            2.f * submap_matcher_options.voxel_filter_resolution,
+            submap_matcher_options.pyramid_coarse_max_iterations));
   }
 
   matcher->setInputSource(source_submap->Cloud());
-  matcher->setInputTarget(target_submap->Cloud());
-  Eigen::Matrix4f result = Eigen::Matrix4f::Identity();
-  Eigen::Matrix4f guess =
-      target_submap->GetFrames()[0]->GlobalPose().inverse() *
-      source_submap->GetFrames()[0]->GlobalPose();
-  matcher->align(guess, result);
-  common::NormalizeRotation(result);
-  double submap_match_score = matcher->getFitnessScore();
+  auto ndt_matcher = dynamic_cast<Ndt<PointType>*>(matcher.get());
+  if (ndt_matcher) {
+    // the voxel grid of a submap is re-used while it is in cache, the pair
+    // tasks of the next submaps align to it concurrently (with more than
+    // one previous submap), so only the read-only grid and kd-tree are
+    // shared, every task aligns with its own matcher
+    ndt_matcher->setInputTarget(target_submap->Cloud(), target_index);
+  } else {
+    matcher->setInputTarget(target_submap->Cloud());
+  }
+  *result = Eigen::Matrix4f::Identity();
+  // the global poses may be moved by the optimizer meanwhile
+  *guess = target_submap->FrontEndPose().inverse() *
+           source_submap->FrontEndPose();
+  matcher->align(*guess, *result);
+  common::NormalizeRotation(*result);
+  return matcher->getFitnessScore();
+}
+
+void MapBuilder::SubmapPairMatch(const int source_index,
+                                 const int target_index) {
+  static common::Histogram* const latency =
+      common::MetricsRegistry::Get()->GetHistogram(
+          "back_end.submap_pair_match");
+  common::ScopedLatency scoped_latency(latency);
+  common::TraceArgs trace_args;
+  trace_args.trajectory = current_trajectory_->GetId();
+  trace_args.submap = source_index;
+  common::ScopedTrace scoped_trace("back_end.submap_pair_match", trace_args);
+  std::shared_ptr<Submap<PointType>> target_submap, source_submap;
+  target_submap = current_trajectory_->at(target_index);
+  source_submap = current_trajectory_->at(source_index);
+  target_submap->ClearCloudInFrames();
+
+  const auto& submap_matcher_options =
+      options_.back_end_options.submap_matcher_options;
+  // the previous one and the earlier ones, all finished before this task
+  // was submitted, or finishing in the tasks submitted earlier
+  const int match_num =
+      std::min(submap_matcher_options.previous_submap_num, target_index + 1);
+  std::vector<Eigen::Matrix4f, Eigen::aligned_allocator<Eigen::Matrix4f>>
+      guesses(match_num), results(match_num);
+  std::vector<double> scores(match_num, 0.);
+  common::ParallelFor(0, match_num, match_num, [&](const int i) {
+    scores[i] = MatchSubmaps(source_submap, target_index - i, &guesses[i],
+                             &results[i]);
+  });
+  for (int i = 1; i < match_num; ++i) {
+    if (scores[i] < submap_matcher_options.accepted_min_score) {
+      continue;
+    }
+    EarlierSubmapMatch match;
+    match.submap_index = target_index - i;
+    match.transform = results[i];
+    match.score = scores[i];
+    source_submap->earlier_submap_matches_.push_back(match);
+  }
+  if (match_num > 1) {
+    static common::Counter* const extra_edges =
+        common::MetricsRegistry::Get()->GetCounter(
+            "back_end.earlier_submap_edges");
+    extra_edges->Add(source_submap->earlier_submap_matches_.size());
+  }
+
+  double submap_match_score = scores[0];
   // PRINT_DEBUG_FMT("submap match score: %lf", submap_match_score);
   source_submap->match_score_to_previous_submap_ = submap_match_score;
-  if (submap_match_score >=
-      options_.back_end_options.submap_matcher_options.accepted_min_score) {
-    target_submap->SetMatchedTransformedToNext(result);
+  if (submap_match_score >= submap_matcher_options.accepted_min_score) {
+    target_submap->SetMatchedTransformedToNext(results[0]);
   } else {
     // do nothing
     // keep the former transform
-    target_submap->SetMatchedTransformedToNext(guess);
+    target_submap->SetMatchedTransformedToNext(guesses[0]);
     PRINT_WARNING("keep the transform got from scan matching.");
   }
-  matcher.reset();
+  {
+    // wake up ConnectAllSubmap
+    common::MutexLocker locker(&submap_connection_mutex_);
+  }
 }
 
 void MapBuilder::ConnectAllSubmap() {
+  common::Tracer::Get()->SetThreadName("submap_connection");
   // finish mens that its global pose is ready
   int current_finished_index = 0;
   std::vector<std::shared_ptr<Submap<PointType>>> submaps_to_connect;
   submaps_to_connect.reserve(20);
   bool first_inserted = false;
+  // the submaps restored from the checkpoint are connected already
+  if (restored_submap_num_ > 0) {
+    current_finished_index = restored_submap_num_ - 1;
+    first_inserted = true;
+  }
+  const auto& checkpoint_options = options_.checkpoint_options;
+  int checkpointed_submap_num = restored_submap_num_;
+  std::vector<std::future<void>> checkpoint_writes;
+  const auto save_checkpoint = [&](const int submap_num) {
+    for (auto& write : checkpoint_writes) {
+      write.wait();
+    }
+    checkpoint_writes.clear();
+    // the edges found in background belong to the checkpoint too
+    isam_optimizer_->FlushLoopClosings();
+    SaveCheckpointManifest(submap_num);
+    checkpointed_submap_num = submap_num;
+  };
+  // the loop detection in the optimizer runs after the submap matching
+  common::ScopedTaskPriority loop_closure_priority(
+      common::TaskPriority::kLoopClosure);
   while (true) {
-    int submap_size = current_trajectory_->size();
-    if (submap_size == 0 || submap_size - 1 == current_finished_index) {
+    const auto got_new_submap = [&]() -> bool {
+      const int submap_size = current_trajectory_->size();
+      return submap_size != 0 && submap_size - 1 != current_finished_index;
+    };
+    const auto got_new_connection = [&]() -> bool {
+      return (*current_trajectory_)[current_finished_index]
+          ->GotMatchedToNext();
+    };
+    if (!got_new_submap()) {
       if (submap_processing_done_.load()) {
         break;
       }
-      SimpleTime::from_sec(0.1).sleep();
+      common::MutexLocker locker(&submap_connection_mutex_);
+      locker.AwaitWithTimeout(
+          [&]() { return got_new_submap() || submap_processing_done_.load(); },
+          common::FromSeconds(1.));
       continue;
     }
-
-    if (!first_inserted) {
-      first_inserted = true;
-      // it is the first frame (first submap)
-      isam_optimizer_->AddFrame(
-          current_trajectory_->front(),
-          current_trajectory_->front()->match_score_to_previous_submap_);
-    }
+    // one snapshot for the whole pass
+    const auto snapshot = current_trajectory_->GetSnapshot();
+    const int submap_size = snapshot->size();
 
     submaps_to_connect.clear();
     for (int i = current_finished_index; i < submap_size; ++i) {
-      submaps_to_connect.push_back((*current_trajectory_)[i]);
-      if (!(*current_trajectory_)[i]->GotMatchedToNext()) {
+      submaps_to_connect.push_back((*snapshot)[i]);
+      if (!(*snapshot)[i]->GotMatchedToNext()) {
         break;
       }
     }
 
     if (submaps_to_connect.size() <= 1) {
-      SimpleTime::from_sec(0.1).sleep();
+      common::MutexLocker locker(&submap_connection_mutex_);
+      locker.AwaitWithTimeout(got_new_connection, common::FromSeconds(1.));
       continue;
     }
+    if (!first_inserted) {
+      first_inserted = true;
+      // it is the first frame (first submap), inserted after it is matched
+      // to the next one, then its cloud is ready (e.g. refined)
+      const auto& first_submap = snapshot->front();
+      if (checkpoint_options.enable) {
+        checkpoint_writes.push_back(SaveSubmapCheckpoint(first_submap));
+      }
+      isam_optimizer_->AddFrame(first_submap,
+                                first_submap->match_score_to_previous_submap_);
+    }
     for (size_t i = 1; i < submaps_to_connect.size(); ++i) {
       submaps_to_connect[i]->SetGlobalPose(
           submaps_to_connect[i - 1]->GlobalPose() *
@@ -842,10 +1825,23 @@ void MapBuilder::ConnectAllSubmap() {
           submaps_to_connect[i - 1]->TransformToNext());
       current_finished_index++;
 
+      if (checkpoint_options.enable) {
+        checkpoint_writes.push_back(
+            SaveSubmapCheckpoint(submaps_to_connect[i]));
+      }
       isam_optimizer_->AddFrame(
           submaps_to_connect[i],
           submaps_to_connect[i]->match_score_to_previous_submap_);
     }
+    if (checkpoint_options.enable &&
+        current_finished_index + 1 - checkpointed_submap_num >=
+            checkpoint_options.submap_interval) {
+      save_checkpoint(current_finished_index + 1);
+    }
+  }
+  if (checkpoint_options.enable && first_inserted &&
+      current_finished_index + 1 > checkpointed_submap_num) {
+    save_checkpoint(current_finished_index + 1);
   }
 
   // for last submap
@@ -855,9 +1851,19 @@ void MapBuilder::ConnectAllSubmap() {
         Eigen::Matrix4f::Identity());
   }
   PRINT_INFO("All submaps have been connected.");
+  // the rest is for the outputs, the lowest priority
+  common::ScopedTaskPriority output_priority(common::TaskPriority::kOutput);
 
+  const auto optimization_start = std::chrono::steady_clock::now();
   const int frames_count_optimized = isam_optimizer_->RunFinalOptimazation();
   CHECK_EQ(frames_count_optimized, current_trajectory_->size());
+  const auto map_generation_start = std::chrono::steady_clock::now();
+  run_statistics_.final_optimization_time =
+      std::chrono::duration<double>(map_generation_start - optimization_start)
+          .count();
+  run_statistics_.submap_num = current_trajectory_->size();
+  run_statistics_.loop_closure_num =
+      isam_optimizer_->GetLoopCloseEdges().size();
   if (use_odom_) {
     switch (options_.whole_options.odom_calib_mode) {
       case kNoCalib:
@@ -880,16 +1886,15 @@ void MapBuilder::ConnectAllSubmap() {
   // all frame connected
   // generate results (clouds to pcd files)
   // output the path into pointcloud as a pcd file
-  for (auto& submap : *current_trajectory_) {
-    submap->UpdateInnerFramePose();
-  }
+  // the frame poses follow the optimized submap poses on demand
+  const auto submaps = current_trajectory_->GetSnapshot();
   // clear all source clouds
-  for (auto& frame : point_clouds_) {
-    frame.cloud->points.clear();
-    frame.cloud->points.shrink_to_fit();
+  // the scan matching thread (consumer) has already quit here
+  InnerCloud inner_cloud;
+  while (point_clouds_.TryPop(&inner_cloud)) {
+    InnerCloudBytes()->Add(
+        -QueuedCloudBytes(inner_cloud.cloud, inner_cloud.point_factors));
   }
-  point_clouds_.clear();
-  point_clouds_.shrink_to_fit();
 
   // calculate the coord transform from the map th utm
   CalculateCoordTransformToUtm();
@@ -900,43 +1905,116 @@ void MapBuilder::ConnectAllSubmap() {
 
   if (options_.map_package_options.enable) {
     SaveMapPackage();
+  } else if (options_.tiled_map_options.enable) {
+    SaveTiledMap();
   } else {
     // output the whole map instead of seperated
     MultiResolutionVoxelMap<PointType> map;
     map.Initialise(options_.output_mrvm_settings);
     PointCloudPtr output_cloud(new PointCloudType);
-    const int submaps_size = current_trajectory_->size();
-    for (auto& submap : *current_trajectory_) {
+    const int submaps_size = submaps->size();
+    // the range images of all the submaps first, the clouds are kept
+    std::unique_ptr<VisibilityRemover<PointType>> remover;
+    if (options_.visibility_removal_options.enable) {
+      SCOPED_TIMER("output_map.range_images");
+      remover.reset(new VisibilityRemover<PointType>(
+          options_.visibility_removal_options));
+      for (int i = 0; i < submaps_size; ++i) {
+        for (int j = i + 1; j <= i + kSubmapPrefetchNum && j < submaps_size;
+             ++j) {
+          (*submaps)[j]->Prefetch();
+        }
+        remover->AddSubmap(*(*submaps)[i]->Cloud(),
+                           (*submaps)[i]->GlobalPose());
+      }
+    }
+    size_t removed_num = 0;
+    for (int i = 0; i < submaps_size; ++i) {
+      const auto& submap = (*submaps)[i];
+      for (int j = i + 1; j <= i + kSubmapPrefetchNum && j < submaps_size;
+           ++j) {
+        (*submaps)[j]->Prefetch();
+      }
       output_cloud->clear();
-      pcl::transformPointCloud(*(submap->Cloud()), *output_cloud,
-                               submap->GlobalPose());
+      common::TransformPointCloud(*(submap->Cloud()), output_cloud.get(),
+                                  submap->GlobalPose());
 
       PRINT_DEBUG_FMT("submap index: %d / %d", submap->GetId().submap_index,
                       submaps_size - 1);
       Eigen::Vector3d translation = submap->GlobalTranslation().cast<double>();
 
-      start_clock();
-      map.InsertPointCloud(output_cloud, translation.cast<float>());
-      end_clock(__FILE__, __FUNCTION__, __LINE__);
+      if (remover) {
+        SCOPED_TIMER("output_map.remove_dynamic_points");
+        removed_num += remover->RemoveDynamicPoints(i, output_cloud.get());
+      }
+      {
+        SCOPED_TIMER("output_map.insert_submap");
+        if (remover) {
+          map.AggregatePointCloud(output_cloud, translation.cast<float>());
+        } else {
+          map.InsertPointCloud(output_cloud, translation.cast<float>());
+        }
+      }
       submap->ClearCloud();
     }
+    if (remover) {
+      PRINT_INFO_FMT("%zu dynamic points are removed by the visibility.",
+                     removed_num);
+    }
     PRINT_INFO("creating the whole static map ...");
+    // streamed into a binary pcd, the whole map is never in memory
     map.OutputToPointCloud(
         options_.output_mrvm_settings.prob_threshold,
-        options_.whole_options.export_file_path + "static_map.pcd");
+        options_.whole_options.export_file_path + "static_map.pcd", false);
+    if (options_.octree_lod_options.enable) {
+      SCOPED_TIMER("output_map.octree_lod");
+      PRINT_INFO("creating the octree of the levels of detail ...");
+      common::OctreeLodWriter<PointType> octree_writer(
+          options_.octree_lod_options);
+      const bool written =
+          octree_writer.Open(options_.whole_options.export_file_path +
+                             options_.octree_lod_options.directory) &&
+          map.OutputToPointCloud(
+              options_.output_mrvm_settings.prob_threshold,
+              [&octree_writer](const PointCloudType& cloud) {
+                return octree_writer.Write(cloud);
+              }) &&
+          octree_writer.Close();
+      if (!written) {
+        PRINT_ERROR("failed to write the octree of the levels of detail.");
+      }
+    }
+  }
+  run_statistics_.map_generation_time =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                    map_generation_start)
+          .count();
+  {
+    common::MutexLocker locker(&memory_managing_mutex_);
+    end_managing_memory_ = true;
   }
-  end_managing_memory_ = true;
 }
 
 void MapBuilder::OutputPath() {
   int path_point_index = 0;
-  std::ofstream path_text_file(options_.whole_options.export_file_path +
-                               "path.csv");
-  std::string path_content;
-  bool write_to_text = path_text_file.is_open();
+  common::TextTrajectoryWriter path_text_file;
+  path_text_file.Open(options_.whole_options.export_file_path + "path.csv");
+  common::BinaryTrajectoryWriter path_binary_file;
+  if (options_.whole_options.binary_path) {
+    path_binary_file.Open(options_.whole_options.export_file_path +
+                          "path.traj");
+  }
+  const bool write_to_text = path_text_file.IsOpen();
+  const bool write_to_binary = path_binary_file.IsOpen();
   pcl::PointCloud<pcl::_PointXYZI>::Ptr path_cloud(
       new pcl::PointCloud<pcl::_PointXYZI>);
-  for (auto& submap : *current_trajectory_) {
+  const auto submaps = current_trajectory_->GetSnapshot();
+  size_t frame_num = 0u;
+  for (auto& submap : *submaps) {
+    frame_num += submap->GetFrames().size();
+  }
+  path_cloud->reserve(frame_num);
+  for (auto& submap : *submaps) {
     for (auto& frame : submap->GetFrames()) {
       pcl::_PointXYZI path_point;
       Eigen::Matrix4d pose = frame->GlobalPose().cast<double>();
@@ -948,109 +2026,284 @@ void MapBuilder::OutputPath() {
 
       path_cloud->push_back(path_point);
       if (write_to_text) {
-        path_content += (std::to_string(path_point_index) + ", ");
-        path_content += (std::to_string(utm_pose_6d[0]) + ", ");
-        path_content += (std::to_string(utm_pose_6d[1]) + ", ");
-        path_content += (std::to_string(utm_pose_6d[2]) + ", ");
-        path_content += (std::to_string(utm_pose_6d[3]) + ", ");
-        path_content += (std::to_string(utm_pose_6d[4]) + ", ");
-        path_content += (std::to_string(utm_pose_6d[5]) + " \n");
+        path_text_file.Write(path_point_index, utm_pose_6d.data());
+      }
+      if (write_to_binary) {
+        common::TrajectoryRecord record;
+        record.index = path_point_index;
+        const SimpleTime stamp = frame->GetTimeStamp();
+        record.secs = stamp.secs;
+        record.nsecs = stamp.nsecs;
+        std::copy(utm_pose_6d.data(), utm_pose_6d.data() + 6, record.pose);
+        path_binary_file.Write(record);
       }
       path_point_index++;
     }
   }
   if (!path_cloud->empty()) {
-    pcl::io::savePCDFileBinaryCompressed(
+    common::SavePcdFile(
         options_.whole_options.export_file_path + "path.pcd", *path_cloud);
   }
-  if (write_to_text) {
-    path_text_file << path_content;
-    path_text_file.close();
+  if (!path_text_file.Close() || !path_binary_file.Close()) {
+    PRINT_ERROR("failed to write the path.");
+  }
+}
+
+std::future<void> MapBuilder::SaveSubmapCheckpoint(
+    const std::shared_ptr<Submap<PointType>>& submap) {
+  const std::string& path = options_.checkpoint_options.path;
+  const SubmapId id = submap->GetId();
+  // the pose now is the initial estimate of the optimizer
+  submap->ToInfoFile(CheckpointFileName(path, id, ".info"));
+  return common::SharedExecutor::Submit(
+      common::TaskPriority::kLoopClosure, [=]() {
+        const std::string filename = CheckpointFileName(path, id, ".smap");
+        if (!SubmapFile<PointType>::Write(
+                filename, id.trajectory_index, id.submap_index,
+                submap->GlobalPose(), submap->GetDescriptor(),
+                *submap->Cloud())) {
+          PRINT_ERROR_FMT("Failed to save the checkpoint: %s",
+                          filename.c_str());
+        }
+      });
+}
+
+void MapBuilder::SaveCheckpointManifest(const int submap_num) {
+  pugi::xml_document doc;
+  pugi::xml_node checkpoint_node = doc.append_child("Checkpoint");
+  checkpoint_node.append_attribute("job") = job_name_.c_str();
+  checkpoint_node.append_attribute("trajectory") = current_trajectory_->GetId();
+  checkpoint_node.append_attribute("submap_num") = submap_num;
+  // the edges found so far, all of them are between the submaps above
+  for (const auto& edge : isam_optimizer_->GetLoopCloseEdges()) {
+    pugi::xml_node edge_node = checkpoint_node.append_child("LoopCloseEdge");
+    edge_node.append_attribute("target") = edge.target_index;
+    edge_node.append_attribute("source") = edge.source_index;
+    std::ostringstream transform;
+    transform.precision(9);
+    for (int i = 0; i < 16; ++i) {
+      transform << (i ? " " : "") << edge.transform(i);
+    }
+    edge_node.text() = transform.str().c_str();
+  }
+  const std::string filename =
+      options_.checkpoint_options.path + kCheckpointManifest;
+  const std::string tmp_filename = filename + ".tmp";
+  if (!doc.save_file(tmp_filename.c_str()) ||
+      std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+    PRINT_ERROR_FMT("Failed to save the checkpoint: %s", filename.c_str());
+    return;
+  }
+  PRINT_INFO_FMT("Checkpoint saved with %d submaps.", submap_num);
+}
+
+void MapBuilder::LoadCheckpoint() {
+  const std::string& path = options_.checkpoint_options.path;
+  pugi::xml_document doc;
+  if (!doc.load_file((path + kCheckpointManifest).c_str())) {
+    PRINT_WARNING_FMT("No checkpoint in %s, start from the beginning.",
+                      path.c_str());
+    return;
+  }
+  pugi::xml_node checkpoint_node = doc.child("Checkpoint");
+  const std::string job_name = checkpoint_node.attribute("job").as_string();
+  if (job_name != job_name_) {
+    PRINT_ERROR_FMT(
+        "The checkpoint in %s is of job \"%s\", not \"%s\", start from the "
+        "beginning.",
+        path.c_str(), job_name.c_str(), job_name_.c_str());
+    return;
+  }
+  const int trajectory_index =
+      checkpoint_node.attribute("trajectory").as_int();
+  const int submap_num = checkpoint_node.attribute("submap_num").as_int();
+  CHECK_EQ(trajectory_index, current_trajectory_->GetId());
+  CHECK_GT(submap_num, 0);
+
+  // the edges are added back along with their source submaps
+  std::vector<back_end::LoopCloseEdges> loop_close_edges(submap_num);
+  for (pugi::xml_node edge_node : checkpoint_node.children("LoopCloseEdge")) {
+    back_end::LoopCloseEdge edge;
+    edge.target_index = edge_node.attribute("target").as_int();
+    edge.source_index = edge_node.attribute("source").as_int();
+    std::istringstream transform(edge_node.text().as_string());
+    for (int i = 0; i < 16; ++i) {
+      transform >> edge.transform(i);
+    }
+    CHECK(transform) << "Invalid loop closure edge in the checkpoint.";
+    CHECK_GE(edge.source_index, 0);
+    CHECK_LT(edge.source_index, submap_num);
+    loop_close_edges[edge.source_index].push_back(edge);
+  }
+
+  for (int i = 0; i < submap_num; ++i) {
+    auto submap = std::make_shared<Submap<PointType>>(
+        options_.back_end_options.submap_options);
+    SubmapId id;
+    id.trajectory_index = trajectory_index;
+    id.submap_index = i;
+    submap->SetSavePath(options_.whole_options.map_package_path);
+    // the last one is matched to the next submap again
+    CHECK(submap->LoadInfoFile(CheckpointFileName(path, id, ".info"),
+                               CheckpointFileName(path, id, ".smap"),
+                               i + 1 < submap_num))
+        << "Failed to resume from the checkpoint in " << path;
+    CHECK(submap->GetId() == id);
+    current_trajectory_->push_back(submap);
+    isam_optimizer_->RestoreFrame(submap, loop_close_edges[i]);
   }
+  restored_submap_num_ = submap_num;
+  resume_time_ =
+      current_trajectory_->back()->GetFrames().back()->GetTimeStamp();
+  PRINT_INFO_FMT("Resumed from the checkpoint with %d submaps, at %lf s.",
+                 submap_num, resume_time_.toSec());
 }
 
 void MapBuilder::SubmapMemoryManaging() {
-  if (!options_.back_end_options.submap_options.enable_disk_saving) {
+  if (!options_.back_end_options.submap_options.enable_disk_saving &&
+      !options_.back_end_options.submap_options.enable_memory_quantization) {
     PRINT_INFO("No need to manage submap memory, exit the thread.");
     return;
   }
 
   const int time = 1;
+  SubmapCache<PointType> cache(
+      static_cast<size_t>(
+          options_.back_end_options.submap_options.disk_saving_budget_mb)
+      << 20);
+  std::vector<std::shared_ptr<Submap<PointType>>> submaps;
   while (true) {
     if (end_managing_memory_) {
       break;
     }
 
-    // int submap_size = current_trajectory_->size();
-    int active_submap_count = 0;
-    for (auto& submap : *current_trajectory_) {
-      if (submap->UpdateInactiveTime(time)) {
-        active_submap_count++;
-      }
+    // one budget for the submaps of all trajectories
+    submaps.clear();
+    for (auto& trajectory : trajectories_) {
+      const auto snapshot = trajectory->GetSnapshot();
+      submaps.insert(submaps.end(), snapshot->begin(), snapshot->end());
     }
-    SimpleTime::from_sec(static_cast<double>(time)).sleep();
-    // PRINT_INFO_FMT("Active submaps %d in all %d submaps",
-    // active_submap_count,
-    //                submap_size);
+    cache.Update(submaps);
+    // tick once per "time" seconds, but quit immediately when finished
+    common::MutexLocker locker(&memory_managing_mutex_);
+    locker.AwaitWithTimeout([&]() { return end_managing_memory_.load(); },
+                            common::FromSeconds(static_cast<double>(time)));
   }
-  PRINT_INFO("End managing memory.");
+  PRINT_INFO_FMT("End managing memory, %lu MB of submaps in RAM.",
+                 cache.ResidentBytes() >> 20);
 }
 
 void MapBuilder::SubmapProcessing() {
+  common::Tracer::Get()->SetThreadName("submap");
+  // before starting the connection and memory managing threads, they
+  // inherit the cpus
+  common::SetCurrentThreadCpus(back_end_cpus_);
   current_trajectory_->reserve(kSubmapResSize);
   auto& submap_options = options_.back_end_options.submap_options;
   const int submap_frame_count = submap_options.frame_count;
 
   size_t current_index = 0;
   std::vector<std::shared_ptr<Frame<PointType>>> local_frames;
-  common::ThreadPool submap_match_thread_pool(6);
-  // there is a deamon thread in this thread pool
-  // it is to connect all submap into a global map
-  // others are for submap matching
-  submap_match_thread_pool.enqueue([&]() { ConnectAllSubmap(); });
-  submap_match_thread_pool.enqueue([&]() { SubmapMemoryManaging(); });
-  size_t frames_size = 0;
+  // the submap being filled, it is added into the trajectory once full
+  std::shared_ptr<Submap<PointType>> submap;
+  // the last frames of the last submap, merged into the next one as well
+  std::shared_ptr<Submap<PointType>> last_submap;
+  std::vector<std::shared_ptr<Frame<PointType>>> overlap_frames;
+  // the daemons have own threads, connecting all submaps into a global map
+  // and managing the memory of the submaps, the submap matching tasks are
+  // in the shared executor
+  std::thread connection_thread([&]() { ConnectAllSubmap(); });
+  std::thread memory_managing_thread([&]() { SubmapMemoryManaging(); });
+  // a full submap is finished in the executor while the next one is being
+  // assembled, the match of two neighbours runs in the finishing task of
+  // the later finished one, counted down by a latch, so no worker waits
+  using PairMatchLatch = std::shared_ptr<std::atomic<int>>;
+  PairMatchLatch last_latch;
+  std::vector<std::future<void>> finish_futures;
+  auto* const metrics = common::MetricsRegistry::Get();
+  common::Histogram* const latency =
+      metrics->GetHistogram("back_end.submap_processing");
+  common::Counter* const busy_us =
+      metrics->GetCounter("thread.submap.busy_us");
   while (true) {
     {
       common::MutexLocker locker(&mutex_);
-      frames_size = frames_.size();
+      locker.AwaitWithTimeout(
+          [&]() {
+            return frames_.size() > current_index ||
+                   !scan_match_thread_running_.load();
+          },
+          common::FromSeconds(1.));
+      // the frames are inserted as they arrive, not only when there are
+      // enough for a whole submap
+      const int submap_frame_num = submap ? submap->GetFrames().size() : 0;
+      while (current_index < frames_.size() &&
+             submap_frame_num + static_cast<int>(local_frames.size()) <
+                 submap_frame_count) {
+        local_frames.push_back(frames_[current_index]);
+        current_index++;
+      }
+      // the submaps keep the frames from now on, so that the queue does not
+      // grow with the run length
+      frames_.erase(frames_.begin(), frames_.begin() + current_index);
+      current_index = 0;
     }
-    if (frames_size - current_index < submap_frame_count) {
+    if (local_frames.empty()) {
       if (!scan_match_thread_running_) {
         PRINT_INFO("no enough frames for new submap, quit");
         break;
       }
-      SimpleTime::from_sec(0.5).sleep();
       continue;
     }
 
-    for (int i = 0; i < submap_frame_count; ++i) {
-      local_frames.push_back(frames_[current_index]);
-      current_index++;
+    common::ScopedLatency scoped_latency(latency, busy_us);
+    common::ScopedTrace scoped_trace("back_end.submap_insertion");
+    if (submap == nullptr) {
+      // create a submap and init with the configs
+      submap = std::make_shared<Submap<PointType>>(submap_options);
+      SubmapId id;
+      id.trajectory_index = current_trajectory_->GetId();
+      id.submap_index = current_trajectory_->size();
+      submap->SetId(id);
+      submap->SetSavePath(options_.whole_options.map_package_path);
+      if (last_submap) {
+        submap->SetSharedFrames(overlap_frames, *last_submap);
+      }
     }
-
-    // Adding new submap
-    auto submap = std::make_shared<Submap<PointType>>(submap_options);
-    SubmapId current_id;
-    current_id.trajectory_index = current_trajectory_->GetId();
-    auto& current_submap_index = current_id.submap_index;
-    current_submap_index = current_trajectory_->size();
-    submap->SetId(current_id);
-    submap->SetSavePath(options_.whole_options.map_package_path);
-    current_trajectory_->push_back(submap);
-    // create a submap and init with the configs
-    PRINT_DEBUG_FMT("Add a new submap : %d", current_submap_index);
-
+    // the clouds of the frames are done once they are in the submap, also
+    // with its utm and odom if it is full
+    const int taken_frame_num = local_frames.size();
     for (auto& frame : local_frames) {
       submap->InsertFrame(frame);
     }
-    CHECK(submap->Full());
-    submap->CalculateDescriptor();
+    local_frames.clear();
+    common::TraceArgs* const trace_args = scoped_trace.MutableArgs();
+    trace_args->trajectory = submap->GetId().trajectory_index;
+    trace_args->submap = submap->GetId().submap_index;
+    // the last frame inserted
+    trace_args->frame = submap->GetFrames().back()->id_.frame_index;
+    if (!submap->Full()) {
+      SettleRawClouds(taken_frame_num);
+      continue;
+    }
+
+    // the descriptor is only waited for by the loop detection, when there
+    // is a candidate in distance, Cloud() waits for it as well
+    const auto descriptor_ready = std::make_shared<std::promise<void>>();
+    submap->SetDescriptorReady(descriptor_ready->get_future().share());
+
+    // Adding new submap
+    const int current_submap_index = submap->GetId().submap_index;
+    {
+      common::MutexLocker locker(&submap_connection_mutex_);
+      current_trajectory_->push_back(submap);
+    }
+    PRINT_DEBUG_FMT("Add a new submap : %d", current_submap_index);
 
     if (use_gps_) {
       sensors::UtmMsg utm;
       if (GetUtmAtTime(submap->GetTimeStamp(), &utm)) {
-        submap->SetRelatedUtm(UtmPosition(utm.x, utm.y, utm.z));
+        submap->SetRelatedUtm(UtmPosition(utm.x, utm.y, utm.z), utm.sigma);
       }
     }
     if (use_odom_) {
@@ -1059,24 +2312,67 @@ void MapBuilder::SubmapProcessing() {
         submap->SetRelatedOdom(odom.PoseInMatrix().cast<double>());
       }
     }
-
-    local_frames.clear();
-    if (show_submap_function_) {
-      show_submap_function_(submap->GetFrames()[0]->Cloud());
-    }
-    if (current_submap_index > 0) {
-      submap_match_thread_pool.enqueue([=]() {
-        SubmapPairMatch(current_submap_index, current_submap_index - 1);
-      });
-    }
+    SettleRawClouds(taken_frame_num);
+
+    visualization_sink_.AddSubmap(submap);
+    finish_futures.erase(
+        std::remove_if(finish_futures.begin(), finish_futures.end(),
+                       [](const std::future<void>& future) {
+                         return future.wait_for(std::chrono::seconds(0)) ==
+                                std::future_status::ready;
+                       }),
+        finish_futures.end());
+    const PairMatchLatch latch_to_last = last_latch;
+    const PairMatchLatch latch_to_next = std::make_shared<std::atomic<int>>(2);
+    finish_futures.push_back(common::SharedExecutor::Submit(
+        common::TaskPriority::kSubmapMatch, [=]() {
+          {
+            common::TraceArgs trace_args;
+            trace_args.trajectory = submap->GetId().trajectory_index;
+            trace_args.submap = current_submap_index;
+            common::ScopedTrace scoped_trace("back_end.submap_finish",
+                                             trace_args);
+            submap->FinishCloud();
+            submap->CalculateDescriptor();
+          }
+          descriptor_ready->set_value();
+          if (latch_to_last && --(*latch_to_last) == 0) {
+            SubmapPairMatch(current_submap_index, current_submap_index - 1);
+          }
+          if (--(*latch_to_next) == 0) {
+            SubmapPairMatch(current_submap_index + 1, current_submap_index);
+          }
+        }));
+    last_latch = latch_to_next;
+    const auto& frames = submap->GetFrames();
+    overlap_frames.assign(
+        frames.end() - submap_options.overlap_frame_count, frames.end());
+    last_submap = std::move(submap);
+  }
+  for (auto& future : finish_futures) {
+    future.wait();
+  }
+  // the last submap is not the target of any match, which releases them
+  if (!current_trajectory_->empty()) {
+    current_trajectory_->back()->ClearCloudInFrames();
+  }
+  {
+    common::MutexLocker locker(&submap_connection_mutex_);
+    submap_processing_done_ = true;
   }
-  submap_processing_done_ = true;
+  connection_thread.join();
+  memory_managing_thread.join();
   PRINT_INFO("submap processing done.");
 }
 
 void MapBuilder::FinishAllComputations() {
   PRINT_INFO("Finishing Remaining Computations...");
-  end_all_thread_ = true;
+  // the msgs still waiting for the later ones
+  FlushReorderBuffer();
+  {
+    common::MutexLocker locker(&raw_cloud_queue_mutex_);
+    end_all_thread_ = true;
+  }
   // output some file
   if (!odom_path_.empty()) {
     pcl::PointCloud<pcl::PointXYZ> odom_path_cloud;
@@ -1085,7 +2381,7 @@ void MapBuilder::FinishAllComputations() {
           odom_path_point[0], odom_path_point[1], odom_path_point[2]));
     }
     PRINT_INFO("Generated ODOM path file.");
-    pcl::io::savePCDFileBinaryCompressed(
+    common::SavePcdFile(
         options_.whole_options.export_file_path + "odom_path.pcd",
         odom_path_cloud);
   }
@@ -1100,37 +2396,132 @@ void MapBuilder::FinishAllComputations() {
       point.intensity = path_point[3];
       utm_path_cloud.push_back(point);
     }
-    pcl::io::savePCDFileBinaryCompressed(
+    common::SavePcdFile(
         options_.whole_options.export_file_path + "utm_path.pcd",
         utm_path_cloud);
   }
 
-  size_t remaining_pointcloud_count = point_clouds_.size();
-  int delay = 0;
-  SimpleTime delay_time = SimpleTime::from_sec(0.1);
+  size_t remaining_pointcloud_count =
+      raw_point_clouds_.Size() + point_clouds_.Size();
   if (scan_match_thread_) {
-    do {
-      delay_time.sleep();
-      delay++;
-      if (delay >= 20) {
-        std::ostringstream progress_info;
-        progress_info << "Remaining Point Cloud : "
-                      << (1. - static_cast<double>(point_clouds_.size()) /
-                                   remaining_pointcloud_count) *
-                             100.
-                      << "% ...";
-        PRINT_COLOR_FMT(BOLD, "%s", progress_info.str().c_str());
-        delay = 0;
+    while (true) {
+      {
+        common::MutexLocker locker(&mutex_);
+        if (locker.AwaitWithTimeout(
+                [&]() { return !scan_match_thread_running_.load(); },
+                common::FromSeconds(2.))) {
+          break;
+        }
       }
-    } while (scan_match_thread_running_);
+      std::ostringstream progress_info;
+      progress_info << "Remaining Point Cloud : "
+                    << (1. - static_cast<double>(raw_point_clouds_.Size() +
+                                                 point_clouds_.Size()) /
+                                 remaining_pointcloud_count) *
+                           100.
+                    << "% ...";
+      PRINT_COLOR_FMT(BOLD, "%s", progress_info.str().c_str());
+    }
 
     scan_match_thread_->join();
   }
 
+  if (pre_processing_thread_ && pre_processing_thread_->joinable()) {
+    pre_processing_thread_->join();
+    pre_processing_thread_.reset();
+  }
+  PRINT_INFO("Statistics of the filters:");
+  filter_factory_.DisplayFilterStatistics();
+
   if (submap_thread_ && submap_thread_->joinable()) {
     submap_thread_->join();
     submap_thread_.reset();
   }
+  // the last submaps and poses
+  visualization_sink_.Stop();
+
+  if (metrics_thread_ && metrics_thread_->joinable()) {
+    {
+      common::MutexLocker locker(&metrics_mutex_);
+      metrics_dumping_done_ = true;
+    }
+    metrics_thread_->join();
+    metrics_thread_.reset();
+  }
+  metrics_server_.Stop();
+  if (options_.metrics_options.enable_trace) {
+    common::Tracer::Get()->Stop();
+  }
+}
+
+MapBuilder::RunStatistics MapBuilder::GetRunStatistics() const {
+  return run_statistics_;
+}
+
+void MapBuilder::MetricsDumping() {
+  const std::string filename = options_.whole_options.export_file_path +
+                               options_.metrics_options.filename;
+  auto* const metrics = common::MetricsRegistry::Get();
+  common::Gauge* const raw_cloud_depth =
+      metrics->GetGauge("queue.raw_cloud.depth");
+  common::Gauge* const cloud_depth = metrics->GetGauge("queue.cloud.depth");
+  common::Gauge* const dropped_count = metrics->GetGauge("queue.dropped");
+  common::Gauge* const decimated_count = metrics->GetGauge("queue.decimated");
+  PRINT_INFO_FMT("dumping metrics into %s", filename.c_str());
+  bool done = false;
+  while (!done) {
+    {
+      common::MutexLocker locker(&metrics_mutex_);
+      locker.AwaitWithTimeout([&]() { return metrics_dumping_done_; },
+                              common::FromSeconds(
+                                  options_.metrics_options.dump_period));
+      done = metrics_dumping_done_;
+    }
+    const CloudQueueStatus status = GetCloudQueueStatus();
+    raw_cloud_depth->Set(status.raw_cloud_depth);
+    cloud_depth->Set(status.cloud_depth);
+    dropped_count->Set(status.dropped_cloud_count);
+    decimated_count->Set(status.decimated_cloud_count);
+    if (options_.metrics_options.enable_memory_accounting) {
+      AccountMemory();
+    }
+    if (!metrics->DumpToFile(filename)) {
+      PRINT_WARNING_FMT("failed to dump metrics into %s", filename.c_str());
+      return;
+    }
+  }
+  if (options_.metrics_options.enable_memory_accounting) {
+    PRINT_INFO("High-water marks of the memory:");
+    for (const auto& gauge : metrics->GetGauges("memory.")) {
+      PRINT_INFO_FMT("  %s : %.1f MB, %.1f MB at the end",
+                     gauge.first.c_str(), gauge.second->Max() / 1048576.,
+                     gauge.second->Value() / 1048576.);
+    }
+  }
+}
+
+void MapBuilder::AccountMemory() {
+  static common::Gauge* const resident_bytes =
+      common::MemoryGauge("submaps.resident");
+  static common::Gauge* const released_bytes =
+      common::MemoryGauge("submaps.released");
+  static common::Gauge* const registrator_bytes =
+      common::MemoryGauge("registrators");
+  int64_t resident = 0;
+  int64_t released = 0;
+  for (auto& trajectory : trajectories_) {
+    const auto snapshot = trajectory->GetSnapshot();
+    for (const auto& submap : *snapshot) {
+      resident += submap->ResidentBytes();
+      released += submap->ReleasedBytes();
+    }
+  }
+  resident_bytes->Set(resident);
+  released_bytes->Set(released);
+  // the voxel grids of the ndt targets, the other registrators only cache
+  // a few kd-trees
+  registrator_bytes->Set(ndt_target_cache_ ? ndt_target_cache_->MemoryUsed()
+                                           : 0);
 }
 
 void MapBuilder::OfflineCalibrationOdomToLidar() {
@@ -1142,49 +2533,96 @@ void MapBuilder::OfflineCalibrationOdomToLidar() {
     PRINT_WARNING("too few submaps to calculate the transfrom");
     return;
   }
+  auto* const metrics = common::MetricsRegistry::Get();
+  static common::Histogram* const latency =
+      metrics->GetHistogram("back_end.odom_calibration");
+  static common::Histogram* const solving_latency =
+      metrics->GetHistogram("back_end.odom_calibration.solve");
+  static common::Gauge* const residual_num =
+      metrics->GetGauge("back_end.odom_calibration.residuals");
+  common::ScopedLatency scoped_latency(latency);
+  common::ScopedTrace scoped_trace("back_end.odom_calibration");
+
+  // the path positions, directions and odoms of the submaps, in parallel
+  struct PathSample {
+    bool valid = false;
+    Eigen::Vector3d position;
+    Eigen::Vector3d direction;
+    OdomPose odom_pose;
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+  const auto submaps = current_trajectory_->GetSnapshot();
+  std::vector<PathSample, Eigen::aligned_allocator<PathSample>> samples(
+      submaps->size());
+  common::ParallelFor(
+      0, static_cast<int>(submaps->size()),
+      static_cast<int>(common::SharedExecutor::ThreadNum()),
+      [&](const int i) {
+        const auto& submap = (*submaps)[i];
+        if (!submap->HasOdom()) {
+          return;
+        }
+        PathSample& sample = samples[i];
+        sample.position = submap->GlobalTranslation().cast<double>();
+        // refer to
+        // https://stackoverflow.com/questions/1568568/how-to-convert-euler-angles-to-directional-vector
+        // get the directional vector of a rotation matrix
+        const Eigen::Matrix3d path_roation =
+            submap->GlobalRotation().cast<double>();
+        const Eigen::Vector3d eulers =
+            common::RotationMatrixToEulerAngles(path_roation);
+        sample.direction << std::cos(eulers[2]) * std::cos(eulers[1]),
+            std::sin(eulers[2]) * std::cos(eulers[1]), std::sin(eulers[1]);
+        sample.odom_pose = submap->GetRelatedOdom();
+        sample.valid = true;
+      });
 
+  // keep the first submap in each cube of the path, so that the stops and
+  // the revisits do not weigh more than the rest
+  const double sample_resolution =
+      options_.whole_options.odom_calib_sample_resolution;
+  std::unordered_set<Eigen::Vector3i> sampled_cubes;
   std::vector<Eigen::Vector3d> map_path_positions;
   std::vector<Eigen::Vector3d> map_path_directions;
   std::vector<OdomPose> odom_poses;
-
-  Eigen::Matrix4f init_estimate = transform_odom_lidar_;
+  map_path_positions.reserve(samples.size());
+  map_path_directions.reserve(samples.size());
+  odom_poses.reserve(samples.size());
   PointCloudType path_and_odom_cloud;
-  for (auto& submap : *current_trajectory_) {
-    if (!submap->HasOdom()) {
+  for (const PathSample& sample : samples) {
+    if (!sample.valid) {
       continue;
     }
+    if (sample_resolution > 0.) {
+      const Eigen::Vector3i cube =
+          (sample.position / sample_resolution)
+              .array()
+              .floor()
+              .cast<int>()
+              .matrix();
+      if (!sampled_cubes.insert(cube).second) {
+        continue;
+      }
+    }
+    map_path_positions.push_back(sample.position);
+    map_path_directions.push_back(sample.direction);
+    odom_poses.push_back(sample.odom_pose);
 
     PointType path_point;
-    Eigen::Vector3d path_position = submap->GlobalTranslation().cast<double>();
-    path_point.x = path_position[0];
-    path_point.y = path_position[1];
-    path_point.z = path_position[2];
+    path_point.x = sample.position[0];
+    path_point.y = sample.position[1];
+    path_point.z = sample.position[2];
     path_point.intensity = 1;
-    map_path_positions.push_back(path_position);
-
-    // refer to
-    // https://stackoverflow.com/questions/1568568/how-to-convert-euler-angles-to-directional-vector
-    // get the directional vector of a rotation matrix
-    Eigen::Matrix3d path_roation = submap->GlobalRotation().cast<double>();
-    Eigen::Vector3d eulers = common::RotationMatrixToEulerAngles(path_roation);
-    Eigen::Vector3d direction(std::cos(eulers[2]) * std::cos(eulers[1]),
-                              std::sin(eulers[2]) * std::cos(eulers[1]),
-                              std::sin(eulers[1]));
-    map_path_directions.push_back(direction);
-
-    OdomPose odom_pose = submap->GetRelatedOdom();
-    odom_poses.push_back(odom_pose);
     PointType odom_point;
-    odom_point.x = odom_pose(0, 3);
-    odom_point.y = odom_pose(1, 3);
-    odom_point.z = odom_pose(2, 3);
+    odom_point.x = sample.odom_pose(0, 3);
+    odom_point.y = sample.odom_pose(1, 3);
+    odom_point.z = sample.odom_pose(2, 3);
     odom_point.intensity = 2;
-
     path_and_odom_cloud.points.push_back(path_point);
     path_and_odom_cloud.points.push_back(odom_point);
   }
   if (!path_and_odom_cloud.empty()) {
-    pcl::io::savePCDFileBinaryCompressed(
+    common::SavePcdFile(
         options_.whole_options.export_file_path + "path_and_odom_before.pcd",
         path_and_odom_cloud);
   }
@@ -1194,28 +2632,42 @@ void MapBuilder::OfflineCalibrationOdomToLidar() {
   }
 
   const int size = map_path_positions.size();
+  residual_num->Set(size);
+  PRINT_INFO_FMT("odom calibration with %d of %d submaps.", size,
+                 submap_size);
   // @todo add a init estimate based-on tf_odom_lidar
+  Eigen::Matrix4f init_estimate = transform_odom_lidar_;
   Eigen::Vector6<float> init_estimate_6d =
       common::TransformToVector6(init_estimate);
   double t[] = {init_estimate_6d[0], init_estimate_6d[1], init_estimate_6d[2]};
   double r[] = {init_estimate_6d[3], init_estimate_6d[4], init_estimate_6d[5]};
   ceres::Problem problem;
   for (int i = 0; i < size; ++i) {
-    auto cost_function = cost_functions::OdomToMapPath::Create(
+    auto cost_function = cost_functions::OdomToMapPathAnalytic::Create(
         map_path_positions[i], odom_poses[i], map_path_directions[i]);
     problem.AddResidualBlock(cost_function, new ceres::HuberLoss(1.0), t, r);
   }
   ceres::Solver::Options options;
   options.minimizer_progress_to_stdout = false;
   options.max_num_iterations = 100;
-  options.num_threads = 8;
+  options.num_threads = common::SharedExecutor::ThreadNum();
   ceres::Solver::Summary summary;
-  ceres::Solve(options, &problem, &summary);
+  {
+    common::ScopedLatency scoped_solving_latency(solving_latency);
+    ceres::Solve(options, &problem, &summary);
+  }
 
   Eigen::Vector3d translation(t[0], t[1], t[2]);
   Eigen::Matrix3d rotation =
       common::EulerAnglesToRotationMatrix(Eigen::Vector3d(r[0], r[1], r[2]));
+  PRINT_INFO_FMT("odom calibration solved in %d iterations.",
+                 static_cast<int>(summary.iterations.size()));
+  Eigen::Matrix4d transform = Eigen::Matrix4d::Identity();
+  transform.block(0, 0, 3, 3) = rotation;
+  transform.block(0, 3, 3, 1) = translation;
+  const Eigen::Matrix4d transform_inverse = transform.inverse();
   PointCloudType path_and_odom_cloud_after;
+  path_and_odom_cloud_after.points.reserve(2 * size);
   for (int i = 0; i < size; ++i) {
     PointType path_point;
     Eigen::Vector3d path_position = map_path_positions[i];
@@ -1224,11 +2676,8 @@ void MapBuilder::OfflineCalibrationOdomToLidar() {
     path_point.z = path_position[2];
     path_point.intensity = 1;
 
-    Eigen::Matrix4d transform = Eigen::Matrix4d::Identity();
-    transform.block(0, 0, 3, 3) = rotation;
-    transform.block(0, 3, 3, 1) = translation;
     Eigen::Matrix4d odom_pose_in_map =
-        transform.inverse() * odom_poses[i] * transform;
+        transform_inverse * odom_poses[i] * transform;
     PointType odom_point;
     odom_point.x = odom_pose_in_map(0, 3);
     odom_point.y = odom_pose_in_map(1, 3);
@@ -1239,7 +2688,7 @@ void MapBuilder::OfflineCalibrationOdomToLidar() {
     path_and_odom_cloud_after.points.push_back(odom_point);
   }
   if (!path_and_odom_cloud_after.empty()) {
-    pcl::io::savePCDFileBinaryCompressed(
+    common::SavePcdFile(
         options_.whole_options.export_file_path + "path_and_odom_after.pcd",
         path_and_odom_cloud_after);
   }
@@ -1269,11 +2718,11 @@ void MapBuilder::CalculateCoordTransformToUtm() {
   // update the submap pose and frame pose
   Eigen::Matrix4d map_utm_transform = Eigen::Matrix4d::Identity();
   map_utm_transform.block<3, 3>(0, 0) = map_utm_rotation_;
-  for (auto& submap : *current_trajectory_) {
+  const auto submaps = current_trajectory_->GetSnapshot();
+  for (auto& submap : *submaps) {
     Eigen::Matrix4d new_submap_pose =
         map_utm_transform * submap->GlobalPose().cast<double>();
     submap->SetGlobalPose(new_submap_pose.cast<float>());
-    submap->UpdateInnerFramePose();
   }
   current_trajectory_->SetUtmOffset(map_utm_translation_[0],
                                     map_utm_translation_[1]);
@@ -1290,21 +2739,23 @@ void MapBuilder::SetShowMapFunction(const MapBuilder::ShowMapFunction& func) {
 }
 
 void MapBuilder::SetShowPoseFunction(const MapBuilder::ShowPoseFunction& func) {
-  show_pose_function_ = std::move(func);
+  visualization_sink_.SetShowPoseFunction(func);
 }
 
 void MapBuilder::SetShowSubmapFunction(
     const MapBuilder::ShowMapFunction& func) {
-  show_submap_function_ = std::move(func);
+  visualization_sink_.SetShowSubmapFunction(func);
+}
+
+void MapBuilder::SetShowSubmapPosesFunction(
+    const MapBuilder::ShowSubmapPosesFunction& func) {
+  visualization_sink_.SetShowSubmapPosesFunction(func);
 }
 
 void MapBuilder::EnableUsingOdom(bool flag) {
   use_odom_ = flag;
   std::string str = flag ? "enable" : "disable";
   PRINT_INFO_FMT("%s odom.", str.c_str());
-  if (flag) {
-    odom_msgs_.reserve(kOdomMsgMaxSize);
-  }
 }
 
 void MapBuilder::EnableUsingGps(bool flag) {
@@ -1314,36 +2765,86 @@ void MapBuilder::EnableUsingGps(bool flag) {
 }
 
 void MapBuilder::GenerateMapPackage(const std::string& filename) {
-  pugi::xml_document doc;
-  pugi::xml_node map_node = doc.append_child("Map");
+  MapPackageWriter writer;
+  if (!writer.Open(filename)) {
+    return;
+  }
   for (auto& single_trajectory : trajectories_) {
-    single_trajectory->ToXmlNode(&map_node);
+    single_trajectory->ToPackage(&writer);
   }
-  doc.save_file(filename.c_str());
+  writer.Close();
+}
+
+void MapBuilder::SaveTiledMap() {
+  const auto submaps = current_trajectory_->GetSnapshot();
+  std::vector<Eigen::Vector3f> positions;
+  positions.reserve(submaps->size());
+  for (const auto& submap : *submaps) {
+    positions.push_back(submap->GlobalTranslation());
+  }
+  // insert the submaps tile by tile so that the finished tiles leave memory
+  const std::vector<int> order =
+      TiledVoxelMap<PointType>::SpatiallyCoherentOrder(
+          positions, options_.tiled_map_options.tile_width);
+  std::vector<Eigen::Vector3f> origins;
+  origins.reserve(order.size());
+  for (const int index : order) {
+    origins.push_back(positions[index]);
+  }
+
+  TiledVoxelMap<PointType> map(options_.tiled_map_options,
+                               options_.output_mrvm_settings);
+  if (!map.Plan(origins, options_.whole_options.export_file_path +
+                             "static_map.pcd")) {
+    PRINT_ERROR("failed to plan the tiled static map.");
+    return;
+  }
+  PointCloudPtr output_cloud(new PointCloudType);
+  const int submaps_size = order.size();
+  for (int i = 0; i < submaps_size; ++i) {
+    const auto& submap = (*submaps)[order[i]];
+    for (int j = i + 1; j <= i + kSubmapPrefetchNum && j < submaps_size;
+         ++j) {
+      (*submaps)[order[j]]->Prefetch();
+    }
+    output_cloud->clear();
+    common::TransformPointCloud(*(submap->Cloud()), output_cloud.get(),
+                                submap->GlobalPose());
+    PRINT_DEBUG_FMT("submap index: %d (%d / %d)",
+                    submap->GetId().submap_index, i, submaps_size - 1);
+    map.InsertPointCloud(output_cloud, origins[i]);
+    submap->ClearCloud();
+  }
+  const size_t point_num = map.Finish();
+  PRINT_INFO_FMT("the tiled static map has %zu points.", point_num);
 }
 
 void MapBuilder::SaveMapPackage() {
   // step1. calculate the bbox
+  std::vector<std::shared_ptr<Submap<PointType>>> submaps;
+  for (auto& single_trajectory : trajectories_) {
+    const auto trajectory_submaps = single_trajectory->GetSnapshot();
+    submaps.insert(submaps.end(), trajectory_submaps->begin(),
+                   trajectory_submaps->end());
+  }
   double min_x = 1.e50;
   double max_x = -1.e50;
   double min_y = 1.e50;
   double max_y = -1.e50;
-  for (auto& single_trajectory : trajectories_) {
-    for (auto& submap : *single_trajectory) {
-      Eigen::Vector3f position = submap->GlobalTranslation();
-      if (position[0] > max_x) {
-        max_x = position[0];
-      }
-      if (position[0] < min_x) {
-        min_x = position[0];
-      }
+  for (auto& submap : submaps) {
+    Eigen::Vector3f position = submap->GlobalTranslation();
+    if (position[0] > max_x) {
+      max_x = position[0];
+    }
+    if (position[0] < min_x) {
+      min_x = position[0];
+    }
 
-      if (position[1] > max_y) {
-        max_y = position[1];
-      }
-      if (position[1] < min_y) {
-        min_y = position[1];
-      }
+    if (position[1] > max_y) {
+      max_y = position[1];
+    }
+    if (position[1] < min_y) {
+      min_y = position[1];
     }
   }
 
@@ -1381,11 +2882,37 @@ void MapBuilder::SaveMapPackage() {
     return (point[0] >= bbox_min[0] && point[0] <= bbox_max[0] &&
             point[1] >= bbox_min[1] && point[1] <= bbox_max[1]);
   };
+
+  // bucket the submaps into cells of the half width once, a piece only
+  // tests the submaps in the cells its offseted bbox overlaps
+  const int cell_x_num = static_cast<int>((max_x - min_x) / half_width) + 1;
+  const int cell_y_num = static_cast<int>((max_y - min_y) / half_width) + 1;
+  auto cell_index = [&](const double value, const double min_value,
+                        const int cell_num) -> int {
+    return common::Clamp(static_cast<int>((value - min_value) / half_width),
+                         0, cell_num - 1);
+  };
+  std::vector<std::vector<int>> cells(cell_x_num * cell_y_num);
+  const int submaps_num = submaps.size();
+  for (int i = 0; i < submaps_num; ++i) {
+    const Eigen::Vector3f position = submaps[i]->GlobalTranslation();
+    cells[cell_index(position[0], min_x, cell_x_num) * cell_y_num +
+          cell_index(position[1], min_y, cell_y_num)]
+        .push_back(i);
+  }
+
   const Eigen::Vector2d part_offset(offset, offset);
-  SeperatedPart parts[x_steps][y_steps];
+  std::vector<SeperatedPart, Eigen::aligned_allocator<SeperatedPart>> parts(
+      x_steps * y_steps);
+  auto part_at = [&](const int x, const int y) -> SeperatedPart& {
+    return parts[x * y_steps + y];
+  };
+  // the pieces using each submap, its transformed cloud is released after
+  // the last of them
+  std::vector<int> submap_users(submaps_num, 0);
   for (int x = 0; x < x_steps; ++x) {
     for (int y = 0; y < y_steps; ++y) {
-      auto& part = parts[x][y];
+      auto& part = part_at(x, y);
       part.center << min_x + (x + 1) * half_width, min_y + (y + 1) * half_width;
       part.bb_min = part.center - Eigen::Vector2d(half_width, half_width);
       part.bb_max = part.center + Eigen::Vector2d(half_width, half_width);
@@ -1396,92 +2923,234 @@ void MapBuilder::SaveMapPackage() {
 
       Eigen::Vector2d offseted_bb_min = part.bb_min - part_offset;
       Eigen::Vector2d offseted_bb_max = part.bb_max + part_offset;
-      for (auto& trajectory : trajectories_) {
-        for (auto& submap : *trajectory) {
-          Eigen::Vector3d position = submap->GlobalTranslation().cast<double>();
-          if (inside_bbox(position, offseted_bb_min, offseted_bb_max)) {
-            part.inside_submaps.push_back(submap);
+      const int cell_x_min = cell_index(offseted_bb_min[0], min_x, cell_x_num);
+      const int cell_x_max = cell_index(offseted_bb_max[0], min_x, cell_x_num);
+      const int cell_y_min = cell_index(offseted_bb_min[1], min_y, cell_y_num);
+      const int cell_y_max = cell_index(offseted_bb_max[1], min_y, cell_y_num);
+      for (int cell_x = cell_x_min; cell_x <= cell_x_max; ++cell_x) {
+        for (int cell_y = cell_y_min; cell_y <= cell_y_max; ++cell_y) {
+          for (const int i : cells[cell_x * cell_y_num + cell_y]) {
+            Eigen::Vector3d position =
+                submaps[i]->GlobalTranslation().cast<double>();
+            if (inside_bbox(position, offseted_bb_min, offseted_bb_max)) {
+              part.inside_submaps.push_back(i);
+              ++submap_users[i];
+            }
           }
         }
       }
+      // keep the order of the trajectories and submaps
+      std::sort(part.inside_submaps.begin(), part.inside_submaps.end());
+    }
+  }
+
+  // the pieces are built by map_piece_worker (in other processes) instead
+  if (!options_.map_package_options.work_manifest_filename.empty()) {
+    SaveMapWorkManifest(submaps, parts, y_steps);
+    SaveMapPackageDescription(parts, x_steps, y_steps);
+    return;
+  }
+
+  // the submaps are transformed once and shared by the pieces around them
+  struct TransformedSubmap {
+    common::Mutex mutex;
+    PointCloudPtr cloud;
+    int user_num = 0;
+  };
+  std::vector<TransformedSubmap> transformed_submaps(submaps_num);
+  for (int i = 0; i < submaps_num; ++i) {
+    transformed_submaps[i].user_num = submap_users[i];
+  }
+  auto acquire_transformed = [&](const int index) -> PointCloudPtr {
+    auto& transformed = transformed_submaps[index];
+    common::MutexLocker locker(&transformed.mutex);
+    if (!transformed.cloud) {
+      transformed.cloud.reset(new PointCloudType);
+      common::TransformPointCloud(*(submaps[index]->Cloud()),
+                                  transformed.cloud.get(),
+                                  submaps[index]->GlobalPose());
+    }
+    return transformed.cloud;
+  };
+  auto release_transformed = [&](const int index) {
+    auto& transformed = transformed_submaps[index];
+    common::MutexLocker locker(&transformed.mutex);
+    if (--transformed.user_num == 0) {
+      transformed.cloud.reset();
+    }
+  };
+
+  // the tiles are written in the order the pieces are finished
+  const auto& package_options = options_.map_package_options;
+  common::TiledMapWriter<PointType> tiled_writer;
+  common::Mutex tiled_writer_mutex;
+  if (!package_options.tiled_filename.empty()) {
+    std::vector<float> resolutions;
+    for (int i = 1; i < package_options.lod_num; ++i) {
+      resolutions.push_back(package_options.lod_resolution * (1 << (i - 1)));
+    }
+    if (!tiled_writer.Open(options_.whole_options.export_file_path +
+                               package_options.tiled_filename,
+                           resolutions)) {
+      PRINT_ERROR_FMT("failed to open the tiled map file %s.",
+                      package_options.tiled_filename.c_str());
+    }
+  }
+
+  // the pieces overlap by half, a piece gives the octree only the points in
+  // its own cell of the half width, the cells on the border are unbounded
+  std::unique_ptr<common::OctreeLodWriter<PointType>> octree_writer;
+  if (options_.octree_lod_options.enable) {
+    octree_writer.reset(
+        new common::OctreeLodWriter<PointType>(options_.octree_lod_options));
+    if (!octree_writer->Open(options_.whole_options.export_file_path +
+                             options_.octree_lod_options.directory)) {
+      PRINT_ERROR("failed to open the octree of the levels of detail.");
     }
   }
+  auto write_octree = [&](const int x, const int y,
+                          const SeperatedPart& part) {
+    const double inf = std::numeric_limits<double>::infinity();
+    const double quarter_width = half_width * 0.5;
+    const Eigen::Vector2d cell_min(x == 0 ? -inf : -quarter_width,
+                                   y == 0 ? -inf : -quarter_width);
+    const Eigen::Vector2d cell_max(x == x_steps - 1 ? inf : quarter_width,
+                                   y == y_steps - 1 ? inf : quarter_width);
+    PointCloudType cloud;
+    cloud.reserve(part.cloud->size());
+    for (const auto& point : part.cloud->points) {
+      if (point.x >= cell_min[0] && point.x < cell_max[0] &&
+          point.y >= cell_min[1] && point.y < cell_max[1]) {
+        cloud.push_back(point);
+        cloud.points.back().x += part.center[0];
+        cloud.points.back().y += part.center[1];
+      }
+    }
+    if (!octree_writer->Write(cloud)) {
+      PRINT_ERROR_FMT("failed to write piece[%d][%d] into the octree.", x, y);
+    }
+  };
 
   // step3. join the submaps in single part together
-  for (int x = 0; x < x_steps; ++x) {
-    for (int y = 0; y < y_steps; ++y) {
-      auto& part = parts[x][y];
-      const int submaps_size = part.inside_submaps.size();
-      int i = 0;
-      MultiResolutionVoxelMap<PointType> voxel_map;
-      voxel_map.Initialise(options_.output_mrvm_settings);
-      for (auto& submap : part.inside_submaps) {
-        PointCloudPtr transformed_cloud(new PointCloudType);
-        Eigen::Matrix4f pose = submap->GlobalPose();
-        Eigen::Vector3f translation = submap->GlobalTranslation();
-        pcl::transformPointCloud(*(submap->Cloud()), *transformed_cloud, pose);
-        PRINT_DEBUG_FMT("submap in piece[%d][%d] : %d / %d", x, y, i,
-                        submaps_size - 1);
-        if (inside_bbox(translation.cast<double>(), part.bb_min, part.bb_max)) {
-          start_clock();
-          voxel_map.InsertPointCloud(transformed_cloud, translation);
-          end_clock(__FILE__, __FUNCTION__, __LINE__);
-        } else {
-          start_clock();
-          PointCloudPtr transformed_cloud_in_bbox(new PointCloudType);
-          for (auto& point : transformed_cloud->points) {
-            if (inside_bbox(Eigen::Vector3d(point.x, point.y, point.z),
-                            part.bb_min, part.bb_max)) {
-              transformed_cloud_in_bbox->points.push_back(point);
-            }
-          }
-          if (!transformed_cloud_in_bbox->empty()) {
-            voxel_map.InsertPointCloud(transformed_cloud_in_bbox, translation);
-          }
-          end_clock(__FILE__, __FUNCTION__, __LINE__);
-        }
-        ++i;
+  common::Mutex piece_bytes_mutex;
+  size_t piece_bytes = 0u;
+  auto build_piece = [&](const int piece_index) {
+    const int x = piece_index / y_steps;
+    const int y = piece_index % y_steps;
+    auto& part = part_at(x, y);
+    const int submaps_size = part.inside_submaps.size();
+    size_t transformed_bytes = 0u;
+    auto acquire = [&](const int i, Eigen::Vector3f* origin) {
+      for (int j = i + 1; j <= i + kSubmapPrefetchNum && j < submaps_size;
+           ++j) {
+        submaps[part.inside_submaps[j]]->Prefetch();
       }
+      const int index = part.inside_submaps[i];
+      PointCloudPtr transformed_cloud = acquire_transformed(index);
+      transformed_bytes +=
+          transformed_cloud->points.capacity() * sizeof(PointType);
+      *origin = submaps[index]->GlobalTranslation();
+      PRINT_DEBUG_FMT("submap in piece[%d][%d] : %d / %d", x, y, i,
+                      submaps_size - 1);
+      return transformed_cloud;
+    };
+    auto release = [&](const int i) {
+      release_transformed(part.inside_submaps[i]);
+    };
+    // step4. the cloud is cut in right size
+    const size_t map_bytes = BuildMapPiece<PointType>(
+        part.center, part.bb_min, part.bb_max, submaps_size,
+        options_.output_mrvm_settings, acquire, release, part.cloud.get());
+    {
+      common::MutexLocker locker(&piece_bytes_mutex);
+      piece_bytes = std::max(piece_bytes, map_bytes + transformed_bytes);
+    }
 
-      PointCloudPtr whole_part_cloud(new PointCloudType);
-      voxel_map.OutputToPointCloud(options_.output_mrvm_settings.prob_threshold,
-                                   whole_part_cloud);
-
-      // step4. cut the cloud in right size
-      for (auto& point : whole_part_cloud->points) {
-        if (inside_bbox(Eigen::Vector3d(point.x, point.y, point.z), part.bb_min,
-                        part.bb_max)) {
-          point.x -= part.center[0];
-          point.y -= part.center[1];
-          part.cloud->points.push_back(point);
-        }
+    // output to pcd file and release the memory
+    const std::string filename = PieceFileName(x, y);
+    common::SavePcdFile(
+        options_.whole_options.export_file_path + filename, *part.cloud);
+    if (package_options.ndt_resolution > 0.) {
+      SCOPED_TIMER("output_map.ndt_grid");
+      if (!common::SaveNdtMap(options_.whole_options.export_file_path +
+                                  PieceFileName(x, y, ".ndt"),
+                              part.center, *part.cloud,
+                              package_options.ndt_resolution,
+                              package_options.ndt_min_points)) {
+        PRINT_ERROR_FMT("failed to write the ndt grid of piece[%d][%d].", x,
+                        y);
       }
+    }
+    {
+      common::MutexLocker locker(&tiled_writer_mutex);
+      tiled_writer.AddTile(x, y, part.center, *part.cloud);
+    }
+    if (octree_writer) {
+      write_octree(x, y, part);
+    }
+    part.cloud->points.clear();
+    part.cloud->points.shrink_to_fit();
+  };
 
-      // output to pcd file and release the memory
-      std::string filename = options_.map_package_options.cloud_file_prefix +
-                             std::to_string(x) + "_" + std::to_string(y) +
-                             ".pcd";
-      pcl::io::savePCDFileBinaryCompressed(
-          options_.whole_options.export_file_path + filename, *part.cloud);
-      part.cloud->points.clear();
-      part.cloud->points.shrink_to_fit();
+  // the neighbouring pieces (sharing most of their submaps) are built
+  // together in waves, the pieces are built one by one until the largest
+  // one is known to size the waves under the memory budget
+  const size_t memory_budget =
+      static_cast<size_t>(options_.map_package_options.memory_budget_mb)
+      << 20;
+  const int max_parallelism =
+      std::max<int>(1, common::SharedExecutor::ThreadNum());
+  const int piece_num = parts.size();
+  for (int begin = 0; begin < piece_num;) {
+    int wave_size = 1;
+    {
+      common::MutexLocker locker(&piece_bytes_mutex);
+      if (piece_bytes > 0u) {
+        wave_size = std::max<size_t>(
+            1u, std::min<size_t>(memory_budget / piece_bytes, max_parallelism));
+      }
+    }
+    const int end = std::min(begin + wave_size, piece_num);
+    common::ParallelFor(begin, end, end - begin, build_piece);
+    begin = end;
+  }
+  if (!tiled_writer.Close()) {
+    PRINT_ERROR("failed to write the tiled map file.");
+  }
+  if (octree_writer) {
+    SCOPED_TIMER("output_map.octree_lod");
+    if (!octree_writer->Close()) {
+      PRINT_ERROR("failed to write the octree of the levels of detail.");
     }
   }
 
   // step5. generate description file and save cloud
+  SaveMapPackageDescription(parts, x_steps, y_steps);
+}
+
+std::string MapBuilder::PieceFileName(const int x, const int y,
+                                      const std::string& extension) const {
+  return options_.map_package_options.cloud_file_prefix + std::to_string(x) +
+         "_" + std::to_string(y) + extension;
+}
+
+void MapBuilder::SaveMapPackageDescription(
+    const std::vector<SeperatedPart, Eigen::aligned_allocator<SeperatedPart>>&
+        parts,
+    const int x_steps, const int y_steps) {
   pugi::xml_document doc;
   pugi::xml_node map_package_node = doc.append_child("MapPackage");
   for (int x = 0; x < x_steps; ++x) {
     for (int y = 0; y < y_steps; ++y) {
       pugi::xml_node map_piece_node = map_package_node.append_child("Piece");
-      auto& part = parts[x][y];
+      const auto& part = parts[x * y_steps + y];
       map_piece_node.append_attribute("x") = part.center[0];
       map_piece_node.append_attribute("y") = part.center[1];
-
-      std::string filename = options_.map_package_options.cloud_file_prefix +
-                             std::to_string(x) + "_" + std::to_string(y) +
-                             ".pcd";
-      map_piece_node.append_attribute("file") = filename.c_str();
+      map_piece_node.append_attribute("file") = PieceFileName(x, y).c_str();
+      if (options_.map_package_options.ndt_resolution > 0.) {
+        map_piece_node.append_attribute("ndt_file") =
+            PieceFileName(x, y, ".ndt").c_str();
+      }
     }
   }
   std::string filename = options_.whole_options.export_file_path +
@@ -1489,4 +3158,49 @@ void MapBuilder::SaveMapPackage() {
   doc.save_file(filename.c_str());
 }
 
+void MapBuilder::SaveMapWorkManifest(
+    const std::vector<std::shared_ptr<Submap<PointType>>>& submaps,
+    const std::vector<SeperatedPart, Eigen::aligned_allocator<SeperatedPart>>&
+        parts,
+    const int y_steps) {
+  const std::string& path = options_.whole_options.export_file_path;
+  MapWorkManifest manifest;
+  manifest.settings = options_.output_mrvm_settings;
+  const int submaps_num = submaps.size();
+  for (int i = 0; i < submaps_num; ++i) {
+    const auto& submap = submaps[i];
+    // the pcd files of the package are used if they are saved, else the
+    // clouds are saved for the workers
+    std::string filename = submap->SavedFileName();
+    if (filename.empty() || !common::FileExist(path + filename)) {
+      filename = "work_submap_" +
+                 std::to_string(submap->GetId().trajectory_index) + "_" +
+                 std::to_string(submap->GetId().submap_index) + ".pcd";
+      common::SavePcdFile(path + filename, *submap->Cloud());
+    }
+    manifest.submap_files.push_back(filename);
+    manifest.submap_poses.push_back(submap->GlobalPose());
+  }
+  const int parts_num = parts.size();
+  for (int i = 0; i < parts_num; ++i) {
+    MapPieceWork piece;
+    piece.x = i / y_steps;
+    piece.y = i % y_steps;
+    piece.center = parts[i].center;
+    piece.bb_min = parts[i].bb_min;
+    piece.bb_max = parts[i].bb_max;
+    piece.submaps = parts[i].inside_submaps;
+    piece.filename = PieceFileName(piece.x, piece.y);
+    manifest.pieces.push_back(piece);
+  }
+  const std::string manifest_file =
+      path + options_.map_package_options.work_manifest_filename;
+  if (!static_map::SaveMapWorkManifest(manifest_file, manifest)) {
+    PRINT_ERROR_FMT("failed to write %s", manifest_file.c_str());
+    return;
+  }
+  PRINT_INFO_FMT("%d map pieces are described in %s for map_piece_worker.",
+                 parts_num, manifest_file.c_str());
+}
+
 }  // namespace static_map
@@ -34,6 +34,7 @@
 #include <pcl/point_types.h>
 
 // stl
+#include <future>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -44,24 +45,52 @@
 #include <boost/optional.hpp>
 #include "back_end/isam_optimizer.h"
 #include "back_end/options.h"
+#include "builder/lidar_synchronizer.h"
+#include "builder/local_map.h"
 #include "builder/map_utm_matcher.h"
 #include "builder/msg_conversion.h"
 #include "builder/multi_resolution_voxel_map.h"
 #include "builder/pose_extrapolator.h"
+#include "builder/sensor_fusions/imu_gps_ekf.h"
 #include "builder/sensor_fusions/imu_gps_tracker.h"
+#include "builder/tiled_voxel_map.h"
 #include "builder/trajectory.h"
+#include "builder/visibility_remover.h"
+#include "builder/visualization_sink.h"
+#include "common/metrics_server.h"
+#include "common/ndt_map_file.h"
+#include "common/octree_lod_writer.h"
+#include "common/point_cloud_pool.h"
+#include "common/point_types.h"
+#include "common/reorder_buffer.h"
+#include "common/spsc_ring_buffer.h"
+#include "common/time_indexed_buffer.h"
+#include "common/tiled_map_file.h"
+#include "common/trajectory_writer.h"
 #include "pre_processors/filter_factory.h"
 #include "registrators/registrator_interface.h"
 
 namespace static_map {
+
+namespace registrator {
+template <typename PointType>
+class NdtTargetCache;
+}  // namespace registrator
+
 namespace front_end {
 
+enum CloudQueueFullPolicy { kBlockWhenFull, kDropWhenFull };
+
 struct Options {
   struct {
     registrator::Type type = static_map::registrator::Type::kIcpPM;
     bool enable_ndt = false;
     bool use_voxel_filter = true;
     double voxel_filter_resolution = 0.1;
+    // try icp fast first and escalate to the type above only if it fails
+    bool enable_adaptive = false;
+    double adaptive_accepted_min_score = 0.9;
+    int adaptive_max_iterations = 5;
     // for inner filters
     pugi::xml_node inner_filters_node;
   } scan_matcher_options;
@@ -72,6 +101,8 @@ struct Options {
     sensors::ImuType type = sensors::ImuType::kNormalImu;
     float frequency = 0.f;
     float gravity_constant = 9.8f;
+    // ekf of imu and gps giving the guesses of scan matching
+    bool use_gps_ekf = false;
   } imu_options;
 
   struct {
@@ -82,10 +113,53 @@ struct Options {
 
   int accumulate_cloud_num = 1;
 
+  // buffer between the sensor callback and the scan matching thread
+  struct {
+    int capacity = 512;
+    CloudQueueFullPolicy full_policy = kBlockWhenFull;
+    // drop every "decimation_step"th cloud when the clouds waiting in queues
+    // reach "decimation_threshold", 0 for disabled
+    int decimation_threshold = 0;
+    int decimation_step = 2;
+  } cloud_queue_options;
+
+  // merging the scans of several lidars, in seconds
+  struct {
+    double max_time_difference = 0.05;
+  } lidar_sync_options;
+
+  // all the msgs (clouds, imu, odom and gps) are passed on in the order of
+  // their stamps once a msg "latency" (seconds) newer is inserted, the ones
+  // later than that are dropped. for the inputs slightly out of order, like
+  // the bags read in parallel, 0 for passing them on as they come
+  struct {
+    double latency = 0.;
+  } input_reorder_options;
+
+  // the next scan is matched against the current one in parallel, assuming
+  // the guessed pose of the current one, and matched again if the current
+  // one is refined more than "translation_threshold" (m) or
+  // "angle_threshold" (degree) away from it. needs a cloneable scan matcher,
+  // not for the local map
+  struct {
+    bool enable = false;
+    double translation_threshold = 0.05;
+    double angle_threshold = 0.5;
+  } speculative_options;
+
+  // recycling pool for the clouds used in front end
+  struct {
+    int max_size = 32;
+    int reserved_point_num = 150000;
+  } cloud_pool_options;
+
   struct {
     bool enable = true;
     bool use_average = true;
   } motion_compensation_options;
+
+  // match the scans to local map instead of last scan
+  LocalMapOptions local_map_options;
 };
 
 }  // namespace front_end
@@ -96,21 +170,117 @@ struct MapPackageOptions {
   double piece_width = 500.;
   std::string cloud_file_prefix = "part_";
   std::string descript_filename = "map_package.xml";
+  // the pieces are built in parallel as long as their voxel maps and the
+  // shared transformed submaps fit in the budget
+  int memory_budget_mb = 4096;
+  // the pieces are also written into this tiled map file (see
+  // common/tiled_map_file.h) if it is not empty, with lod_num levels of
+  // detail, the voxel size is lod_resolution and doubled in each level
+  std::string tiled_filename = "";
+  int lod_num = 3;
+  double lod_resolution = 0.5;
+  // the pieces are not built but described in this manifest (see
+  // builder/map_piece.h) if it is not empty, for map_piece_worker to build
+  // each of them in other processes, the tiled map file is not written
+  std::string work_manifest_filename = "";
+  // the pieces are also written as precomputed ndt grids (see
+  // common/ndt_map_file.h) beside their pcd files if ndt_resolution > 0,
+  // the voxels of less than ndt_min_points points are dropped
+  double ndt_resolution = 0.;
+  int ndt_min_points = 6;
 };
 
 enum OdomCalibrationMode { kNoCalib, kOnlineCalib, kOfflineCalib };
 
+struct MetricsOptions {
+  bool enable = false;
+  // in seconds
+  double dump_period = 1.;
+  // saved in export_file_path
+  std::string filename = "metrics.log";
+  // the tagged bytes of the clouds, voxels and graphs as "memory.*" gauges,
+  // their high-water marks are logged at the end
+  bool enable_memory_accounting = false;
+  // the timeline of the pipeline stages, viewable in Perfetto or
+  // chrome://tracing, saved in export_file_path when all finished
+  bool enable_trace = false;
+  std::string trace_filename = "trace.json";
+  // the metrics at runtime in the prometheus text format on
+  // http://<host>:<http_port>/metrics, refreshed with the dumps, 0 for off
+  int http_port = 0;
+};
+
+struct CheckpointOptions {
+  bool enable = false;
+  // all files of the checkpoint, it should exist, or it is created under
+  // the output prefix of the job (see MapBuilder::SetOutputPrefix())
+  std::string path = "checkpoint/";
+  // the connected submaps are saved as they are connected, and committed
+  // into the checkpoint once per submap_interval submaps
+  int submap_interval = 50;
+  // resume from the checkpoint in the path if there is one
+  bool resume = false;
+};
+
+// partition the cpus when several jobs share a machine, the cpu lists are
+// like "0-3,8" (as taskset), empty for no pinning
+struct ExecutionOptions {
+  // threads of each omp loop (filters, icp, cloud codec), 0 for 10
+  int omp_thread_num = 0;
+  // the limit of the tbb workers of the process, 0 for the tbb default
+  int tbb_thread_num = 0;
+  // the pre-processing and the scan matching threads
+  std::string front_end_cpus = "";
+  // the submap thread, also the connection and memory managing threads
+  // started by it
+  std::string back_end_cpus = "";
+  // the workers of the shared executor and tbb
+  std::string worker_cpus = "";
+  // keep all threads of the process on the cpus of the numa node, so that
+  // their memory is allocated in it, -1 for no numa placement. the cpu
+  // lists above are used as they are if they are not empty
+  int numa_node = -1;
+};
+
 struct MapBuilderOptions {
   struct WholeOptions {
     std::string export_file_path = "./";
     std::string map_package_path = "./";
     OdomCalibrationMode odom_calib_mode = kOnlineCalib;
+    // the offline calibration uses one submap in each cube of this size (in
+    // meters) on the path, 0 for all submaps
+    double odom_calib_sample_resolution = 0.;
+    // workers of the executor shared by the filters, submap matching, loop
+    // closure and outputs (also the threads of ndt and ceres),
+    // 0 for (cpu cores - 1)
+    int shared_thread_num = 0;
+    // also save the path with the full timestamps into path.traj (see
+    // common/trajectory_writer.h)
+    bool binary_path = false;
+    // the same inputs give the same results, for the benchmarks: the
+    // replay waits until each cloud is done by the front end and the
+    // submap thread, the loop closures and the isam updates follow the
+    // submaps only, it is much slower
+    bool deterministic = false;
+    // lzf as pcl, in chunks in parallel, false gives the uncompressed
+    // binary pcd, the fastest to write and to load
+    bool compress_pcd = true;
   } whole_options;
 
   front_end::Options front_end_options;
   back_end::Options back_end_options;
   MrvmSettings output_mrvm_settings;
   MapPackageOptions map_package_options;
+  // for the whole map if the map package is disabled
+  TiledVoxelMapOptions tiled_map_options;
+  // for the whole map if the map package and the tiled map are disabled
+  VisibilityRemovalOptions visibility_removal_options;
+  // for the whole map and the map package
+  common::OctreeLodOptions octree_lod_options;
+  MetricsOptions metrics_options;
+  CheckpointOptions checkpoint_options;
+  ExecutionOptions execution_options;
+  VisualizationOptions visualization_options;
 };
 
 /*
@@ -127,19 +297,44 @@ class MapBuilder {
 
   // type define
   // point and cloud definitions
-  using PointType = pcl::PointXYZI;
+  using PointType = MapPointType;
   using PointCloudType = pcl::PointCloud<PointType>;
   using PointCloudPtr = PointCloudType::Ptr;
+  /// per-point times in seconds relative to the first point of the cloud
+  using PointTimesPtr = std::shared_ptr<std::vector<float>>;
   using PointCloudConstPtr = PointCloudType::ConstPtr;
   // call back function for ROS
   using ShowMapFunction = std::function<void(const PointCloudPtr&)>;
   using ShowSubmapFunction = ShowMapFunction;
   using ShowPoseFunction = std::function<void(const Eigen::Matrix4f&)>;
+  using SubmapPoses = VisualizationSink<PointType>::SubmapPoses;
+  using ShowSubmapPosesFunction =
+      VisualizationSink<PointType>::ShowSubmapPosesFunction;
 
   using TransformMatrix = Eigen::Matrix4f;
   using Ptr = std::shared_ptr<MapBuilder>;
   using ConstPtr = std::shared_ptr<const MapBuilder>;
 
+  struct CloudQueueStatus {
+    // raw clouds waiting for pre-processing
+    size_t raw_cloud_depth = 0u;
+    size_t raw_cloud_capacity = 0u;
+    // filtered clouds waiting for scan matching
+    size_t cloud_depth = 0u;
+    size_t cloud_capacity = 0u;
+    uint32_t dropped_cloud_count = 0u;
+    uint32_t decimated_cloud_count = 0u;
+  };
+
+  struct RunStatistics {
+    int submap_num = 0;
+    int loop_closure_num = 0;
+    // in seconds
+    double final_optimization_time = 0.;
+    // from the optimized poses to the map package (or the whole map)
+    double map_generation_time = 0.;
+  };
+
   struct SeperatedPart {
     SeperatedPart()
         : center(Eigen::Vector2d::Zero()),
@@ -149,7 +344,8 @@ class MapBuilder {
     Eigen::Vector2d center;
     Eigen::Vector2d bb_min;
     Eigen::Vector2d bb_max;
-    std::vector<std::shared_ptr<Submap<PointType>>> inside_submaps;
+    // the indices of the submaps in the order of insertion
+    std::vector<int> inside_submaps;
     PointCloudPtr cloud;
 
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
@@ -162,12 +358,48 @@ class MapBuilder {
   void FinishAllComputations();
   /// @brief set a callback function when the map updated
   void SetShowMapFunction(const ShowMapFunction& func);
-  /// @brief set a callback function when the map updated
+  /// @brief set a callback function for the cloud of the new submaps (in the
+  /// map frame), called from the visualization thread
   void SetShowSubmapFunction(const ShowMapFunction& func);
-  /// @brief set a callback function whem the pose updated
+  /// @brief set a callback function whem the pose updated, called from the
+  /// visualization thread
   void SetShowPoseFunction(const ShowPoseFunction& func);
+  /// @brief set a callback function for the poses of the new submaps and the
+  /// ones changed by the optimization, called from the visualization thread
+  void SetShowSubmapPosesFunction(const ShowSubmapPosesFunction& func);
+  /// @brief borrow an empty cloud from the inner pool
+  /// it goes back to the pool automatically once released
+  PointCloudPtr AcquirePointCloud();
+  /// @brief borrow a cloud from the inner pool and fill it with the msg,
+  /// already without NaNs and in the tracking frame
+  /// @param point_times output of the per-point times if the msg has a time
+  /// field, they are used for the motion compensation, otherwise nullptr
+  /// @param lidar_index the lidar whose tracking to lidar transform is used
+  /// @return nullptr if the msg can not be converted
+  PointCloudPtr AcquirePointCloud(const sensor_msgs::PointCloud2& msg,
+                                  PointTimesPtr* point_times = nullptr,
+                                  int lidar_index = 0);
   /// @brief get pointcloud and insert it into the inner container
-  void InsertPointcloudMsg(const PointCloudPtr& point_cloud);
+  /// blocks or drops when the queue is full according to the config
+  /// @return false if the cloud is dropped
+  /// the points are assumed uniformly spread in time in index order if
+  /// point_times is nullptr
+  /// with several lidars, the cloud waits for the scans of the others and
+  /// is queued once merged with them
+  bool InsertPointcloudMsg(const PointCloudPtr& point_cloud,
+                           const PointTimesPtr& point_times = nullptr,
+                           int lidar_index = 0);
+  /// @brief never blocks, return false if the queue is full
+  bool TryInsertPointcloudMsg(const PointCloudPtr& point_cloud,
+                              const PointTimesPtr& point_times = nullptr,
+                              int lidar_index = 0);
+  /// @brief blocks until there is room in the queue
+  /// @return false only if the cloud is invalid or the mapping is finished
+  bool InsertPointcloudMsgBlocking(const PointCloudPtr& point_cloud,
+                                   const PointTimesPtr& point_times = nullptr,
+                                   int lidar_index = 0);
+  /// @brief depth and capacity of the inner cloud queues
+  CloudQueueStatus GetCloudQueueStatus() const;
   /// @brief get imu msg from sensor and insert it into the inner container
   void InsertImuMsg(const sensors::ImuMsg::Ptr& imu_msg);
   /// @brief get odom msg from sensor and insert it into the inner container
@@ -183,15 +415,29 @@ class MapBuilder {
   /// @brief set static tf link from tracking frame to odometry
   void SetTrackingToOdom(const Eigen::Matrix4f& t);
   /// @brief set static tf link from tracking frame to lidar
-  void SetTrackingToLidar(const Eigen::Matrix4f& t);
+  /// several lidars are indexed from 0, their scans are merged
+  /// before the pre-processing, set them all before Initialise()
+  void SetTrackingToLidar(const Eigen::Matrix4f& t, int lidar_index = 0);
   /// @brief set static tf link from tracking frame to gps
   void SetTrackingToGps(const Eigen::Matrix4f& t);
+  /// @brief prefix the export and map package paths of the config, for
+  /// the jobs of a service sharing one config, set it before Initialise()
+  void SetOutputPrefix(const std::string& prefix);
+  /// @brief the identity of the job (e.g. the bag and its segment), it is
+  /// recorded in the checkpoint and the checkpoint of another job is not
+  /// resumed, set it before Initialise()
+  void SetJobName(const std::string& name);
 
   /// @todo(edward) remove these two functions, using tracking frame instead
   /// @brief set static tf link from odom to lidar(cloud frame)
   void SetTransformOdomToLidar(const Eigen::Matrix4f& t);
   /// @brief set static tf link from imu to lidar(cloud frame)
   void SetTransformImuToLidar(const Eigen::Matrix4f& t);
+  /// @brief the time of the last frame restored from the checkpoint, the
+  /// sensor data before it are ignored, zero if not resumed
+  inline SimpleTime ResumeTime() const { return resume_time_; }
+  /// @brief the statistics of the run, valid after FinishAllComputations()
+  RunStatistics GetRunStatistics() const;
 
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
@@ -214,6 +460,43 @@ class MapBuilder {
   /// @brief add a new trajectory
   /// when build a new map or load a exsiting map
   void AddNewTrajectory();
+  /// @brief number of lidars, the transforms may be updated in another thread
+  int LidarNum();
+  /// @brief copy of the transform from the tracking frame to the lidar
+  Eigen::Matrix4f TrackingToLidar(int lidar_index);
+  /// @brief through the reorder buffer if enabled, then MergePointcloud()
+  bool EnqueuePointcloud(const PointCloudPtr& point_cloud,
+                         const PointTimesPtr& point_times,
+                         const int lidar_index, const bool block_when_full);
+  /// @brief merge the scans of several lidars, then EnqueueRawCloud()
+  bool MergePointcloud(const PointCloudPtr& point_cloud,
+                       const PointTimesPtr& point_times, const int lidar_index,
+                       const bool block_when_full);
+  /// @brief pass the insertion of a msg into the reorder buffer, and run the
+  /// released ones in the order of their stamps
+  /// @return false if the msg is too late
+  bool InsertInOrder(const SimpleTime& stamp,
+                     const std::function<void()>& insertion);
+  /// @brief run the insertions left in the reorder buffer
+  void FlushReorderBuffer();
+  // the insertions after the reorder buffer
+  void ProcessImuMsg(const sensors::ImuMsg::Ptr& imu_msg);
+  void ProcessOdomMsg(const sensors::OdomMsg::Ptr& odom_msg);
+  void ProcessGpsMsg(const sensors::NavSatFixMsg::Ptr& gps_msg);
+  /// @brief push the raw cloud into the queue for pre-processing
+  bool EnqueueRawCloud(const PointCloudPtr& point_cloud,
+                       const PointTimesPtr& point_times,
+                       const bool block_when_full);
+  /// @brief in the deterministic mode, the raw clouds are done by the
+  /// pipeline, wake up the producer waiting for them
+  void SettleRawClouds(const int cloud_num);
+  /// @brief thread for transforming, accumulating and filtering the raw clouds
+  /// keeps the order of clouds from the sensor callback
+  void PreProcessing();
+  /// @brief pre-process single raw cloud and push it to the scan matcher
+  /// @return false if nothing is pushed (accumulated or dropped)
+  bool PreProcessPointcloud(const PointCloudPtr& point_cloud,
+                            const PointTimesPtr& point_times);
   /// @brief thread for scan to scan matching
   void ScanMatchProcessing();
   /// @brief
@@ -224,10 +507,30 @@ class MapBuilder {
   void SubmapProcessing();
   /// @brief lifelong thread for connecting all submap in back-end
   void ConnectAllSubmap();
+  /// @brief save a connected submap into the checkpoint path before it is
+  /// inserted into the optimizer, the cloud is saved in the executor
+  std::future<void> SaveSubmapCheckpoint(
+      const std::shared_ptr<Submap<PointType>>& submap);
+  /// @brief commit the first submap_num submaps saved and the loop closure
+  /// edges between them into the checkpoint
+  void SaveCheckpointManifest(const int submap_num);
+  /// @brief restore the submaps and the optimizer from the checkpoint
+  void LoadCheckpoint();
   /// @brief life long thread for managing submaps between RAM and Disk
   void SubmapMemoryManaging();
-  /// @brief match 2 specified submaps
+  /// @brief thread for dumping the metrics periodically if enabled
+  void MetricsDumping();
+  /// @brief sample the tagged bytes which are not tracked by their owners
+  /// (the submaps and the registrator caches) for the memory accounting
+  void AccountMemory();
+  /// @brief match 2 specified submaps, the source is also matched to the
+  /// earlier ones by "previous_submap_num" in parallel
   void SubmapPairMatch(const int source_index, const int target_index);
+  /// @brief match a submap to an earlier one with their front end poses
+  /// @return the fitness score
+  double MatchSubmaps(const std::shared_ptr<Submap<PointType>>& source_submap,
+                      const int target_index, Eigen::Matrix4f* const guess,
+                      Eigen::Matrix4f* const result);
   /// @brief do offline calibration between odom and lidar
   /// after finishing the optimization of whole map
   void OfflineCalibrationOdomToLidar();
@@ -241,6 +544,22 @@ class MapBuilder {
   void GenerateMapPackage(const std::string& filename);
   /// @brief save the map into pieces if enabled
   void SaveMapPackage();
+  // the pcd (or other) file of the piece x, y in the map package
+  std::string PieceFileName(const int x, const int y,
+                            const std::string& extension = ".pcd") const;
+  void SaveMapPackageDescription(
+      const std::vector<SeperatedPart, Eigen::aligned_allocator<SeperatedPart>>&
+          parts,
+      const int x_steps, const int y_steps);
+  // the inputs of all the pieces for map_piece_worker instead of building
+  // them, parts are indexed by x * y_steps + y
+  void SaveMapWorkManifest(
+      const std::vector<std::shared_ptr<Submap<PointType>>>& submaps,
+      const std::vector<SeperatedPart, Eigen::aligned_allocator<SeperatedPart>>&
+          parts,
+      const int y_steps);
+  /// @brief save the whole map built in tiles under the memory budget
+  void SaveTiledMap();
 
  private:
   common::Mutex mutex_;
@@ -250,24 +569,50 @@ class MapBuilder {
   PointCloudPtr accumulated_point_cloud_;
   int accumulated_cloud_count_;
   SimpleTime first_time_in_accmulated_cloud_;
+  // times of accumulated_point_cloud_, in seconds since
+  // first_time_in_accmulated_cloud_, empty if any cloud has no times
+  std::vector<float> accumulated_point_times_;
+  bool accumulated_times_valid_ = true;
 
+  struct RawCloud {
+    PointCloudPtr cloud;
+    PointTimesPtr point_times;
+  };
   struct InnerCloud {
     float delta_time_in_cloud;
     PointCloudPtr cloud;
+    // factors of the filtered points in [0, 1] over the cloud duration,
+    // nullptr if the points are uniformly spread in index order
+    PointTimesPtr point_factors;
+    // normals of the filtered points given by the filters (3 floats per
+    // point), nullptr if they are not estimated there
+    std::shared_ptr<const std::vector<float>> normals;
   };
-  std::vector<InnerCloud> point_clouds_;
+  // single producer (sensor callback) and single consumer (pre-processing)
+  common::SpscRingBuffer<RawCloud> raw_point_clouds_;
+  // single producer (pre-processing) and single consumer (scan matching)
+  common::SpscRingBuffer<InnerCloud> point_clouds_;
+  // both cloud queues may drop clouds
+  std::atomic<uint32_t> dropped_clouds_count_{0u};
+  std::atomic<uint32_t> decimated_clouds_count_{0u};
+  uint32_t decimation_counter_ = 0u;
   // odoms
-  std::vector<sensors::OdomMsg::Ptr> odom_msgs_;
+  common::TimeIndexedBuffer<sensors::OdomMsg> odom_msgs_;
   sensors::OdomMsg init_odom_msg_;
   // gps
-  std::vector<sensors::UtmMsg::Ptr> utm_msgs_;
-  // we assume that there is only one lidar
-  // even if we have several lidars, we still use the fused cloud only
+  common::TimeIndexedBuffer<sensors::UtmMsg> utm_msgs_;
+  // the transforms to lidar (cloud frame) are of the first lidar, the scans
+  // of the others are merged into its frames
   Eigen::Matrix4f transform_odom_lidar_;
   Eigen::Matrix4f transform_imu_lidar_;
-  Eigen::Matrix4f tracking_to_imu_;
+  // the sensor callbacks run in several threads and the transforms may be
+  // updated from /tf_static in another one, this guards the transforms read
+  // by the callbacks and the creation of extrapolator_
+  common::Mutex sensor_mutex_;
+  Eigen::Matrix4f tracking_to_imu_ GUARDED_BY(sensor_mutex_);
   Eigen::Matrix4f tracking_to_odom_;
-  Eigen::Matrix4f tracking_to_lidar_;
+  std::vector<Eigen::Matrix4f, Eigen::aligned_allocator<Eigen::Matrix4f>>
+      tracking_to_lidars_ GUARDED_BY(sensor_mutex_);
   // can not use the inversion of the transform
   Eigen::Matrix4f tracking_to_gps_;
   bool use_imu_;
@@ -275,32 +620,66 @@ class MapBuilder {
   bool use_gps_;
   std::atomic<bool> end_all_thread_;
   std::atomic<bool> end_managing_memory_;
+  std::atomic<bool> pre_processing_done_;
+  // only for waking up the waiting threads as soon as their inputs are ready
+  // mutex_ is used for the frames between front end and submap processing
+  common::Mutex raw_cloud_queue_mutex_;
+  common::Mutex cloud_queue_mutex_;
+  common::Mutex submap_connection_mutex_;
+  common::Mutex memory_managing_mutex_;
+  // the raw clouds accepted but not done yet in the deterministic mode
+  int unsettled_raw_clouds_ GUARDED_BY(raw_cloud_queue_mutex_) = 0;
 
   // ********************* pre processors *********************
+  common::PointCloudPool<PointType> cloud_pool_;
+  // only for several lidars, their callbacks may be in different threads
+  common::Mutex lidar_sync_mutex_;
+  std::unique_ptr<LidarSynchronizer<PointType>> lidar_synchronizer_
+      GUARDED_BY(lidar_sync_mutex_);
+  // created in the initialisation if enabled, the mutex is held while the
+  // released msgs are inserted, so that they stay in order
+  common::Mutex reorder_mutex_;
+  std::unique_ptr<common::ReorderBuffer<std::function<void()>>>
+      input_reorder_buffer_;
   pre_processers::filter::Factory<PointType> filter_factory_;
   // frond end
+  // created once by the first imu msg (under sensor_mutex_), never reset
   std::unique_ptr<PoseExtrapolator> extrapolator_ = nullptr;
   std::unique_ptr<registrator::Interface<PointType>> scan_matcher_ = nullptr;
+  std::unique_ptr<std::thread> pre_processing_thread_;
   std::unique_ptr<std::thread> scan_match_thread_;
+  // the cpus of the threads (see ExecutionOptions), empty for no pinning
+  std::vector<int> front_end_cpus_;
+  std::vector<int> back_end_cpus_;
+  // the frames not taken by the submap thread yet
   std::vector<std::shared_ptr<Frame<PointType>>> frames_;
-  bool scan_match_thread_running_ = false;
+  std::atomic<bool> scan_match_thread_running_;
   bool got_first_point_cloud_ = false;
   uint32_t got_clouds_count_ = 0u;
 
-  // std::unique_ptr<sensor_fusions::ImuGpsTracker> imu_gps_fusion_;
+  // fused with gps, only receives the utm msgs if gps is enabled
+  std::unique_ptr<sensor_fusions::ImuGpsEkf> imu_gps_fusion_;
 
   // ************************ back end ************************
   // submaps
   std::unique_ptr<std::thread> submap_thread_;
   std::unique_ptr<registrator::Interface<PointType>> submap_marcher_ = nullptr;
+  // voxel grids of the submaps, shared by the matchers of all pairs
+  std::shared_ptr<registrator::NdtTargetCache<PointType>> ndt_target_cache_;
   // optimizer
   // finally, we decide to use isam to do the back-end optimizing
   std::unique_ptr<back_end::IsamOptimizer<PointType>> isam_optimizer_;
 
+  // periodically dumping the metrics of all stages
+  std::unique_ptr<std::thread> metrics_thread_;
+  common::Mutex metrics_mutex_;
+  bool metrics_dumping_done_ = false;
+  common::MetricsServer metrics_server_;
+
   // show the result in RVIZ(ros) or other platform
   ShowMapFunction show_map_function_;
-  ShowSubmapFunction show_submap_function_;
-  ShowPoseFunction show_pose_function_;
+  // the submaps and the poses at a limited rate, see VisualizationOptions
+  VisualizationSink<PointType> visualization_sink_;
 
   // utm
   boost::optional<Eigen::Vector3d> utm_init_offset_;
@@ -313,6 +692,16 @@ class MapBuilder {
   // trajectories
   std::vector<Trajectory<PointType>::Ptr> trajectories_;
   Trajectory<PointType>::Ptr current_trajectory_;
+
+  // resuming from a checkpoint
+  int restored_submap_num_ = 0;
+  SimpleTime resume_time_;
+
+  std::string output_prefix_;
+  std::string job_name_;
+
+  // written by the connection thread before it quits
+  RunStatistics run_statistics_;
 };
 
 }  // namespace static_map
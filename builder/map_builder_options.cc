@@ -26,16 +26,126 @@
 namespace static_map {
 
 void CheckOptions(const MapBuilderOptions& options) {
+  CHECK(!options.metrics_options.enable ||
+        options.metrics_options.dump_period > 0.)
+      << "The period of dumping metrics should be positive" << std::endl;
+  CHECK(!options.metrics_options.enable_memory_accounting ||
+        options.metrics_options.enable)
+      << "The memory accounting is dumped with the metrics" << std::endl;
+  CHECK(options.metrics_options.http_port <= 0 ||
+        options.metrics_options.enable)
+      << "The metrics served over http are refreshed with the dumps"
+      << std::endl;
+  CHECK_LE(options.metrics_options.http_port, 65535);
+  CHECK_GT(options.checkpoint_options.submap_interval, 0);
+  CHECK_GE(options.whole_options.odom_calib_sample_resolution, 0.);
+  CHECK_GE(options.execution_options.omp_thread_num, 0);
+  CHECK_GE(options.execution_options.tbb_thread_num, 0);
+  CHECK_GE(options.visualization_options.publish_rate, 0.);
+  CHECK_GE(options.visualization_options.downsample_leaf_size, 0.f);
+  CHECK_GT(options.visualization_options.max_submaps_per_publish, 0);
+  const auto& local_map = options.front_end_options.local_map_options;
+  if (local_map.enable) {
+    CHECK_GT(local_map.voxel_size, 0.f);
+    CHECK_GT(local_map.radius, local_map.voxel_size);
+    CHECK_GT(local_map.max_point_num_in_voxel, 0);
+  }
+  CHECK_GT(options.back_end_options.submap_matcher_options.ndt_cache_memory_mb,
+           0.f);
+  CHECK(!options.front_end_options.imu_options.use_gps_ekf ||
+        options.front_end_options.imu_options.enabled)
+      << "the ekf needs the imu.";
+  const auto& scan_matcher = options.front_end_options.scan_matcher_options;
+  CHECK_GT(scan_matcher.adaptive_max_iterations, 0);
+  CHECK_GE(options.back_end_options.submap_matcher_options.pyramid_levels, 1);
+  CHECK_GE(
+      options.back_end_options.submap_matcher_options.previous_submap_num, 1);
+  CHECK_GE(options.back_end_options.loop_detector_setting.pyramid_levels, 1);
+  CHECK_GE(
+      options.back_end_options.loop_detector_setting.descriptor_candidate_num,
+      0);
+  {
+    const auto& isam = options.back_end_options.isam_optimizer_options;
+    CHECK_GE(isam.max_pending_loop_closings, 0);
+    CHECK_GE(isam.update_batch_size, 1);
+    CHECK_GT(isam.relinearize_threshold, 0.);
+    CHECK_GE(isam.relinearize_skip, 1);
+    CHECK_GE(isam.gps_min_distance, 0.);
+    if (isam.use_imu) {
+      CHECK(options.front_end_options.imu_options.enabled)
+          << "the imu factors need the imu.";
+      CHECK_GT(isam.imu_acc_noise, 0.);
+      CHECK_GT(isam.imu_gyro_noise, 0.);
+      CHECK_GT(isam.imu_acc_bias_noise, 0.);
+      CHECK_GT(isam.imu_gyro_bias_noise, 0.);
+    }
+  }
+  {
+    const auto& loop_detector = options.back_end_options.loop_detector_setting;
+    CHECK(loop_detector.place_recognizer.empty() ||
+          loop_detector.place_recognizer == "scan_context")
+        << "Unknown place recognizer: " << loop_detector.place_recognizer;
+    CHECK_GT(loop_detector.place_candidate_num, 0);
+    CHECK_GT(loop_detector.scan_context_settings.max_radius, 0.f);
+    CHECK_GT(loop_detector.scan_context_settings.max_distance, 0.f);
+    CHECK_LE(loop_detector.scan_context_settings.max_distance, 1.f);
+  }
+  CHECK_GT(options.back_end_options.loop_detector_setting.pyramid_resolution,
+           0.f);
+  CHECK_GT(options.back_end_options.submap_options.disk_saving_budget_mb, 0);
+  CHECK_GT(
+      options.back_end_options.submap_options.disk_compression_resolution,
+      0.f);
+  CHECK_GT(
+      options.back_end_options.submap_options.memory_quantization_resolution,
+      0.f);
   CHECK_GE(options.back_end_options.submap_options.frame_count, 2)
       << "A submap must constain at least 2 frames" << std::endl;
+  CHECK_GE(options.back_end_options.submap_options.overlap_frame_count, 0);
+  CHECK_LE(options.back_end_options.submap_options.overlap_frame_count,
+           options.back_end_options.submap_options.frame_count);
   CHECK(!options.back_end_options.loop_detector_setting.use_gps ||
         !options.back_end_options.loop_detector_setting.use_descriptor)
       << "You should selete at least one way to do loop detect: use gps or "
          "descriptor or both.";
   CHECK_GE(options.front_end_options.accumulate_cloud_num, 1);
+  CHECK_GE(options.front_end_options.cloud_queue_options.capacity, 2);
+  CHECK_GE(options.front_end_options.cloud_queue_options.decimation_threshold,
+           0);
+  CHECK_GE(options.front_end_options.cloud_queue_options.decimation_step, 1);
+  CHECK_GE(options.front_end_options.input_reorder_options.latency, 0.);
+  CHECK_GE(
+      options.front_end_options.speculative_options.translation_threshold, 0.);
+  CHECK_GE(options.front_end_options.speculative_options.angle_threshold, 0.);
+  CHECK_GT(options.front_end_options.lidar_sync_options.max_time_difference,
+           0.);
+  CHECK_GE(options.front_end_options.cloud_pool_options.max_size, 0);
+  CHECK_GE(options.front_end_options.cloud_pool_options.reserved_point_num, 0);
   CHECK_GT(options.output_mrvm_settings.hit_prob, 0.5);
   CHECK_LT(options.output_mrvm_settings.miss_prob, 0.5);
   CHECK_GE(options.output_mrvm_settings.max_point_num_in_cell, 1);
+  CHECK_GE(options.output_mrvm_settings.refine_hit_num, 0);
+  CHECK_GT(options.map_package_options.memory_budget_mb, 0);
+  CHECK_GE(options.map_package_options.lod_num, 1);
+  CHECK_LE(options.map_package_options.lod_num, common::kTiledMapMaxLodNum);
+  CHECK_GT(options.map_package_options.lod_resolution, 0.);
+  CHECK_GE(options.map_package_options.ndt_resolution, 0.);
+  CHECK_GE(options.map_package_options.ndt_min_points, 3);
+  CHECK_GT(options.tiled_map_options.tile_width, 0.);
+  CHECK_GT(options.tiled_map_options.ray_range, 0.);
+  CHECK_GT(options.tiled_map_options.memory_budget_mb, 0);
+  CHECK_GT(options.visibility_removal_options.top_angle,
+           options.visibility_removal_options.btm_angle);
+  CHECK_GT(options.visibility_removal_options.vertical_line_num, 0);
+  CHECK_GT(options.visibility_removal_options.horizontal_line_num, 0);
+  CHECK_GT(options.visibility_removal_options.search_range, 0.);
+  CHECK_GE(options.visibility_removal_options.range_tolerance, 0.f);
+  CHECK_GE(options.visibility_removal_options.range_ratio, 0.f);
+  CHECK_GE(options.visibility_removal_options.min_see_through_num, 1);
+  CHECK_GT(options.octree_lod_options.max_node_points, 0);
+  CHECK_GT(options.octree_lod_options.hierarchy_step_size, 0);
+  CHECK_GT(options.octree_lod_options.scale, 0.);
+  CHECK_GT(options.octree_lod_options.partition_points, 0);
 }
 
 MapBuilderOptions& MapBuilder::Initialise(const char* config_file_name) {
@@ -87,6 +197,72 @@ MapBuilderOptions& MapBuilder::Initialise(const char* config_file_name) {
                     whole_options.map_package_path, string, string);
   GET_SINGLE_OPTION(static_map_node, "whole_options", "odom_calib_mode",
                     whole_options.odom_calib_mode, int, OdomCalibrationMode);
+  GET_SINGLE_OPTION(static_map_node, "whole_options",
+                    "odom_calib_sample_resolution",
+                    whole_options.odom_calib_sample_resolution, double, double);
+  GET_SINGLE_OPTION(static_map_node, "whole_options", "shared_thread_num",
+                    whole_options.shared_thread_num, int, int);
+  GET_SINGLE_OPTION(static_map_node, "whole_options", "binary_path",
+                    whole_options.binary_path, bool, bool);
+  GET_SINGLE_OPTION(static_map_node, "whole_options", "deterministic",
+                    whole_options.deterministic, bool, bool);
+  GET_SINGLE_OPTION(static_map_node, "whole_options", "compress_pcd",
+                    whole_options.compress_pcd, bool, bool);
+  std::cout << std::endl;
+
+  auto& metrics_options = options_.metrics_options;
+  GET_SINGLE_OPTION(static_map_node, "metrics_options", "enable",
+                    metrics_options.enable, bool, bool);
+  GET_SINGLE_OPTION(static_map_node, "metrics_options", "dump_period",
+                    metrics_options.dump_period, double, double);
+  GET_SINGLE_OPTION(static_map_node, "metrics_options", "filename",
+                    metrics_options.filename, string, string);
+  GET_SINGLE_OPTION(static_map_node, "metrics_options",
+                    "enable_memory_accounting",
+                    metrics_options.enable_memory_accounting, bool, bool);
+  GET_SINGLE_OPTION(static_map_node, "metrics_options", "enable_trace",
+                    metrics_options.enable_trace, bool, bool);
+  GET_SINGLE_OPTION(static_map_node, "metrics_options", "trace_filename",
+                    metrics_options.trace_filename, string, string);
+  GET_SINGLE_OPTION(static_map_node, "metrics_options", "http_port",
+                    metrics_options.http_port, int, int);
+  std::cout << std::endl;
+
+  auto& execution_options = options_.execution_options;
+  GET_SINGLE_OPTION(static_map_node, "execution_options", "omp_thread_num",
+                    execution_options.omp_thread_num, int, int);
+  GET_SINGLE_OPTION(static_map_node, "execution_options", "tbb_thread_num",
+                    execution_options.tbb_thread_num, int, int);
+  GET_SINGLE_OPTION(static_map_node, "execution_options", "front_end_cpus",
+                    execution_options.front_end_cpus, string, string);
+  GET_SINGLE_OPTION(static_map_node, "execution_options", "back_end_cpus",
+                    execution_options.back_end_cpus, string, string);
+  GET_SINGLE_OPTION(static_map_node, "execution_options", "worker_cpus",
+                    execution_options.worker_cpus, string, string);
+  GET_SINGLE_OPTION(static_map_node, "execution_options", "numa_node",
+                    execution_options.numa_node, int, int);
+  std::cout << std::endl;
+
+  auto& visualization_options = options_.visualization_options;
+  GET_SINGLE_OPTION(static_map_node, "visualization_options", "publish_rate",
+                    visualization_options.publish_rate, double, double);
+  GET_SINGLE_OPTION(static_map_node, "visualization_options",
+                    "downsample_leaf_size",
+                    visualization_options.downsample_leaf_size, float, float);
+  GET_SINGLE_OPTION(static_map_node, "visualization_options",
+                    "max_submaps_per_publish",
+                    visualization_options.max_submaps_per_publish, int, int);
+  std::cout << std::endl;
+
+  auto& checkpoint_options = options_.checkpoint_options;
+  GET_SINGLE_OPTION(static_map_node, "checkpoint_options", "enable",
+                    checkpoint_options.enable, bool, bool);
+  GET_SINGLE_OPTION(static_map_node, "checkpoint_options", "path",
+                    checkpoint_options.path, string, string);
+  GET_SINGLE_OPTION(static_map_node, "checkpoint_options", "submap_interval",
+                    checkpoint_options.submap_interval, int, int);
+  GET_SINGLE_OPTION(static_map_node, "checkpoint_options", "resume",
+                    checkpoint_options.resume, bool, bool);
   std::cout << std::endl;
 
   auto& output_mrvm_settings = options_.output_mrvm_settings;
@@ -107,6 +283,20 @@ MapBuilderOptions& MapBuilder::Initialise(const char* config_file_name) {
   GET_SINGLE_OPTION(static_map_node, "output_mrvm_settings",
                     "max_point_num_in_cell",
                     output_mrvm_settings.max_point_num_in_cell, int, int);
+  GET_SINGLE_OPTION(static_map_node, "output_mrvm_settings",
+                    "stop_ray_at_hit_voxel",
+                    output_mrvm_settings.stop_ray_at_hit_voxel, bool, bool);
+  GET_SINGLE_OPTION(static_map_node, "output_mrvm_settings",
+                    "discretized_insertion",
+                    output_mrvm_settings.discretized_insertion, bool, bool);
+  GET_SINGLE_OPTION(static_map_node, "output_mrvm_settings", "block_storage",
+                    output_mrvm_settings.block_storage, bool, bool);
+  GET_SINGLE_OPTION(static_map_node, "output_mrvm_settings", "compact_points",
+                    output_mrvm_settings.compact_points, bool, bool);
+  GET_SINGLE_OPTION(static_map_node, "output_mrvm_settings", "gpu_insertion",
+                    output_mrvm_settings.gpu_insertion, bool, bool);
+  GET_SINGLE_OPTION(static_map_node, "output_mrvm_settings", "refine_hit_num",
+                    output_mrvm_settings.refine_hit_num, int, int);
 
   std::cout << std::endl;
 
@@ -134,12 +324,58 @@ MapBuilderOptions& MapBuilder::Initialise(const char* config_file_name) {
     GET_SINGLE_OPTION(
         front_end_node, "scan_matcher_options", "voxel_filter_resolution",
         scan_matcher_options.voxel_filter_resolution, float, float);
+    GET_SINGLE_OPTION(front_end_node, "scan_matcher_options",
+                      "enable_adaptive", scan_matcher_options.enable_adaptive,
+                      bool, bool);
+    GET_SINGLE_OPTION(front_end_node, "scan_matcher_options",
+                      "adaptive_accepted_min_score",
+                      scan_matcher_options.adaptive_accepted_min_score, double,
+                      double);
+    GET_SINGLE_OPTION(front_end_node, "scan_matcher_options",
+                      "adaptive_max_iterations",
+                      scan_matcher_options.adaptive_max_iterations, int, int);
 
     auto& front_end_options = options_.front_end_options;
     GET_SINGLE_OPTION(static_map_node, "front_end_options",
                       "accumulate_cloud_num",
                       front_end_options.accumulate_cloud_num, int, int);
 
+    auto& cloud_queue_options = options_.front_end_options.cloud_queue_options;
+    GET_SINGLE_OPTION(front_end_node, "cloud_queue_options", "capacity",
+                      cloud_queue_options.capacity, int, int);
+    GET_SINGLE_OPTION(front_end_node, "cloud_queue_options", "full_policy",
+                      cloud_queue_options.full_policy, int,
+                      front_end::CloudQueueFullPolicy);
+    GET_SINGLE_OPTION(front_end_node, "cloud_queue_options",
+                      "decimation_threshold",
+                      cloud_queue_options.decimation_threshold, int, int);
+    GET_SINGLE_OPTION(front_end_node, "cloud_queue_options", "decimation_step",
+                      cloud_queue_options.decimation_step, int, int);
+
+    GET_SINGLE_OPTION(front_end_node, "lidar_sync_options",
+                      "max_time_difference",
+                      front_end_options.lidar_sync_options.max_time_difference,
+                      double, double);
+    GET_SINGLE_OPTION(front_end_node, "input_reorder_options", "latency",
+                      front_end_options.input_reorder_options.latency, double,
+                      double);
+    auto& speculative_options = options_.front_end_options.speculative_options;
+    GET_SINGLE_OPTION(front_end_node, "speculative_options", "enable",
+                      speculative_options.enable, bool, bool);
+    GET_SINGLE_OPTION(front_end_node, "speculative_options",
+                      "translation_threshold",
+                      speculative_options.translation_threshold, double,
+                      double);
+    GET_SINGLE_OPTION(front_end_node, "speculative_options", "angle_threshold",
+                      speculative_options.angle_threshold, double, double);
+
+    auto& cloud_pool_options = options_.front_end_options.cloud_pool_options;
+    GET_SINGLE_OPTION(front_end_node, "cloud_pool_options", "max_size",
+                      cloud_pool_options.max_size, int, int);
+    GET_SINGLE_OPTION(front_end_node, "cloud_pool_options",
+                      "reserved_point_num",
+                      cloud_pool_options.reserved_point_num, int, int);
+
     if (!front_end_node.child("scan_matcher_options").empty() &&
         !front_end_node.child("scan_matcher_options")
              .child("inner_filters")
@@ -164,6 +400,17 @@ MapBuilderOptions& MapBuilder::Initialise(const char* config_file_name) {
                       "use_average", motion_compensation_options.use_average,
                       bool, bool);
 
+    auto& local_map_options = options_.front_end_options.local_map_options;
+    GET_SINGLE_OPTION(front_end_node, "local_map_options", "enable",
+                      local_map_options.enable, bool, bool);
+    GET_SINGLE_OPTION(front_end_node, "local_map_options", "voxel_size",
+                      local_map_options.voxel_size, float, float);
+    GET_SINGLE_OPTION(front_end_node, "local_map_options", "radius",
+                      local_map_options.radius, float, float);
+    GET_SINGLE_OPTION(front_end_node, "local_map_options",
+                      "max_point_num_in_voxel",
+                      local_map_options.max_point_num_in_voxel, int, int);
+
     auto& imu_options = options_.front_end_options.imu_options;
     GET_SINGLE_OPTION(front_end_node, "imu_options", "use_imu",
                       imu_options.enabled, bool, bool);
@@ -173,6 +420,8 @@ MapBuilderOptions& MapBuilder::Initialise(const char* config_file_name) {
                       imu_options.frequency, float, float);
     GET_SINGLE_OPTION(front_end_node, "imu_options", "gravity_constant",
                       imu_options.gravity_constant, float, float);
+    GET_SINGLE_OPTION(front_end_node, "imu_options", "use_gps_ekf",
+                      imu_options.use_gps_ekf, bool, bool);
   } else {
     PRINT_WARNING("No config for front end");
   }
@@ -195,10 +444,25 @@ MapBuilderOptions& MapBuilder::Initialise(const char* config_file_name) {
     GET_SINGLE_OPTION(back_end_node, "submap_matcher_options",
                       "accepted_min_score",
                       submap_matcher_options.accepted_min_score, float, float);
+    GET_SINGLE_OPTION(back_end_node, "submap_matcher_options",
+                      "ndt_cache_memory_mb",
+                      submap_matcher_options.ndt_cache_memory_mb, float, float);
+    GET_SINGLE_OPTION(back_end_node, "submap_matcher_options",
+                      "pyramid_levels", submap_matcher_options.pyramid_levels,
+                      int, int);
+    GET_SINGLE_OPTION(back_end_node, "submap_matcher_options",
+                      "pyramid_coarse_max_iterations",
+                      submap_matcher_options.pyramid_coarse_max_iterations,
+                      int, int);
+    GET_SINGLE_OPTION(back_end_node, "submap_matcher_options",
+                      "previous_submap_num",
+                      submap_matcher_options.previous_submap_num, int, int);
 
     auto& submap_options = options_.back_end_options.submap_options;
     GET_SINGLE_OPTION(back_end_node, "submap_options", "frame_count",
                       submap_options.frame_count, int, int32_t);
+    GET_SINGLE_OPTION(back_end_node, "submap_options", "overlap_frame_count",
+                      submap_options.overlap_frame_count, int, int32_t);
     GET_SINGLE_OPTION(back_end_node, "submap_options",
                       "enable_inner_multiview_icp",
                       submap_options.enable_inner_multiview_icp, bool, bool);
@@ -213,8 +477,22 @@ MapBuilderOptions& MapBuilder::Initialise(const char* config_file_name) {
                       submap_options.enable_disk_saving, bool, bool);
     GET_SINGLE_OPTION(back_end_node, "submap_options", "enable_check",
                       submap_options.enable_check, bool, bool);
-    GET_SINGLE_OPTION(back_end_node, "submap_options", "disk_saving_delay",
-                      submap_options.disk_saving_delay, int, int32_t);
+    GET_SINGLE_OPTION(back_end_node, "submap_options", "disk_saving_budget_mb",
+                      submap_options.disk_saving_budget_mb, int, int32_t);
+    GET_SINGLE_OPTION(back_end_node, "submap_options",
+                      "enable_disk_compression",
+                      submap_options.enable_disk_compression, bool, bool);
+    GET_SINGLE_OPTION(back_end_node, "submap_options",
+                      "disk_compression_resolution",
+                      submap_options.disk_compression_resolution, float,
+                      float);
+    GET_SINGLE_OPTION(back_end_node, "submap_options",
+                      "enable_memory_quantization",
+                      submap_options.enable_memory_quantization, bool, bool);
+    GET_SINGLE_OPTION(back_end_node, "submap_options",
+                      "memory_quantization_resolution",
+                      submap_options.memory_quantization_resolution, float,
+                      float);
     GET_SINGLE_OPTION(back_end_node, "submap_options", "saving_name_prefix",
                       submap_options.saving_name_prefix, string, string);
 
@@ -224,6 +502,67 @@ MapBuilderOptions& MapBuilder::Initialise(const char* config_file_name) {
                       isam_optimizer_options.use_odom, bool, bool);
     GET_SINGLE_OPTION(back_end_node, "isam_optimizer_options", "use_gps",
                       isam_optimizer_options.use_gps, bool, bool);
+    GET_SINGLE_OPTION(back_end_node, "isam_optimizer_options", "use_imu",
+                      isam_optimizer_options.use_imu, bool, bool);
+    GET_SINGLE_OPTION(back_end_node, "isam_optimizer_options", "imu_acc_noise",
+                      isam_optimizer_options.imu_acc_noise, double, double);
+    GET_SINGLE_OPTION(back_end_node, "isam_optimizer_options",
+                      "imu_gyro_noise", isam_optimizer_options.imu_gyro_noise,
+                      double, double);
+    GET_SINGLE_OPTION(back_end_node, "isam_optimizer_options",
+                      "imu_acc_bias_noise",
+                      isam_optimizer_options.imu_acc_bias_noise, double,
+                      double);
+    GET_SINGLE_OPTION(back_end_node, "isam_optimizer_options",
+                      "imu_gyro_bias_noise",
+                      isam_optimizer_options.imu_gyro_bias_noise, double,
+                      double);
+    GET_SINGLE_OPTION(back_end_node, "isam_optimizer_options",
+                      "async_loop_closing",
+                      isam_optimizer_options.async_loop_closing, bool, bool);
+    GET_SINGLE_OPTION(back_end_node, "isam_optimizer_options",
+                      "max_pending_loop_closings",
+                      isam_optimizer_options.max_pending_loop_closings, int,
+                      int);
+    GET_SINGLE_OPTION(back_end_node, "isam_optimizer_options",
+                      "update_batch_size",
+                      isam_optimizer_options.update_batch_size, int, int);
+    GET_SINGLE_OPTION(back_end_node, "isam_optimizer_options",
+                      "update_interval_ms",
+                      isam_optimizer_options.update_interval_ms, double,
+                      double);
+    GET_SINGLE_OPTION(back_end_node, "isam_optimizer_options",
+                      "relinearize_threshold",
+                      isam_optimizer_options.relinearize_threshold, double,
+                      double);
+    GET_SINGLE_OPTION(back_end_node, "isam_optimizer_options",
+                      "relinearize_skip",
+                      isam_optimizer_options.relinearize_skip, int, int);
+    GET_SINGLE_OPTION(back_end_node, "isam_optimizer_options",
+                      "loop_edge_region_gap",
+                      isam_optimizer_options.loop_edge_region_gap, int, int);
+    GET_SINGLE_OPTION(back_end_node, "isam_optimizer_options",
+                      "replace_loop_edges",
+                      isam_optimizer_options.replace_loop_edges, bool, bool);
+    GET_SINGLE_OPTION(back_end_node, "isam_optimizer_options",
+                      "gps_min_distance",
+                      isam_optimizer_options.gps_min_distance, double, double);
+    GET_SINGLE_OPTION(back_end_node, "isam_optimizer_options", "gps_max_sigma",
+                      isam_optimizer_options.gps_max_sigma, double, double);
+    auto& final_optimization_options =
+        isam_optimizer_options.final_optimization_options;
+    GET_SINGLE_OPTION(back_end_node, "final_optimization_options",
+                      "enable_batch", final_optimization_options.enable_batch,
+                      bool, bool);
+    GET_SINGLE_OPTION(back_end_node, "final_optimization_options", "threads",
+                      final_optimization_options.threads, int, int);
+    GET_SINGLE_OPTION(back_end_node, "final_optimization_options",
+                      "metis_ordering",
+                      final_optimization_options.metis_ordering, bool, bool);
+    GET_SINGLE_OPTION(back_end_node, "final_optimization_options",
+                      "calibration_covariance",
+                      final_optimization_options.calibration_covariance, bool,
+                      bool);
 
     auto& loop_detector_setting =
         options_.back_end_options.loop_detector_setting;
@@ -246,6 +585,37 @@ MapBuilderOptions& MapBuilder::Initialise(const char* config_file_name) {
     GET_SINGLE_OPTION(back_end_node, "loop_detector_setting",
                       "m2dp_match_score",
                       loop_detector_setting.m2dp_match_score, float, float);
+    GET_SINGLE_OPTION(back_end_node, "loop_detector_setting",
+                      "descriptor_candidate_num",
+                      loop_detector_setting.descriptor_candidate_num, int, int);
+    GET_SINGLE_OPTION(back_end_node, "loop_detector_setting",
+                      "place_recognizer",
+                      loop_detector_setting.place_recognizer, string, string);
+    GET_SINGLE_OPTION(back_end_node, "loop_detector_setting",
+                      "place_candidate_num",
+                      loop_detector_setting.place_candidate_num, int, int);
+    GET_SINGLE_OPTION(
+        back_end_node, "loop_detector_setting", "scan_context_max_radius",
+        loop_detector_setting.scan_context_settings.max_radius, float, float);
+    GET_SINGLE_OPTION(
+        back_end_node, "loop_detector_setting", "scan_context_max_distance",
+        loop_detector_setting.scan_context_settings.max_distance, float,
+        float);
+    GET_SINGLE_OPTION(back_end_node, "loop_detector_setting",
+                      "redundant_loop_gap",
+                      loop_detector_setting.redundant_loop_gap, int, int);
+    GET_SINGLE_OPTION(back_end_node, "loop_detector_setting",
+                      "max_loop_failures",
+                      loop_detector_setting.max_loop_failures, int, int);
+    GET_SINGLE_OPTION(back_end_node, "loop_detector_setting", "pyramid_levels",
+                      loop_detector_setting.pyramid_levels, int, int);
+    GET_SINGLE_OPTION(back_end_node, "loop_detector_setting",
+                      "pyramid_resolution",
+                      loop_detector_setting.pyramid_resolution, float, float);
+    GET_SINGLE_OPTION(back_end_node, "loop_detector_setting",
+                      "pyramid_coarse_max_iterations",
+                      loop_detector_setting.pyramid_coarse_max_iterations,
+                      int, int);
   }
 
   auto& map_package_options = options_.map_package_options;
@@ -259,6 +629,76 @@ MapBuilderOptions& MapBuilder::Initialise(const char* config_file_name) {
                     map_package_options.cloud_file_prefix, string, string);
   GET_SINGLE_OPTION(static_map_node, "map_package_options", "descript_filename",
                     map_package_options.descript_filename, string, string);
+  GET_SINGLE_OPTION(static_map_node, "map_package_options", "memory_budget_mb",
+                    map_package_options.memory_budget_mb, int, int);
+  GET_SINGLE_OPTION(static_map_node, "map_package_options", "tiled_filename",
+                    map_package_options.tiled_filename, string, string);
+  GET_SINGLE_OPTION(static_map_node, "map_package_options", "lod_num",
+                    map_package_options.lod_num, int, int);
+  GET_SINGLE_OPTION(static_map_node, "map_package_options", "lod_resolution",
+                    map_package_options.lod_resolution, double, double);
+  GET_SINGLE_OPTION(static_map_node, "map_package_options",
+                    "work_manifest_filename",
+                    map_package_options.work_manifest_filename, string, string);
+  GET_SINGLE_OPTION(static_map_node, "map_package_options", "ndt_resolution",
+                    map_package_options.ndt_resolution, double, double);
+  GET_SINGLE_OPTION(static_map_node, "map_package_options", "ndt_min_points",
+                    map_package_options.ndt_min_points, int, int);
+
+  auto& tiled_map_options = options_.tiled_map_options;
+  GET_SINGLE_OPTION(static_map_node, "tiled_map_options", "enable",
+                    tiled_map_options.enable, bool, bool);
+  GET_SINGLE_OPTION(static_map_node, "tiled_map_options", "tile_width",
+                    tiled_map_options.tile_width, double, double);
+  GET_SINGLE_OPTION(static_map_node, "tiled_map_options", "ray_range",
+                    tiled_map_options.ray_range, double, double);
+  GET_SINGLE_OPTION(static_map_node, "tiled_map_options", "memory_budget_mb",
+                    tiled_map_options.memory_budget_mb, int, int);
+  GET_SINGLE_OPTION(static_map_node, "tiled_map_options", "cache_path",
+                    tiled_map_options.cache_path, string, string);
+
+  auto& visibility_removal_options = options_.visibility_removal_options;
+  GET_SINGLE_OPTION(static_map_node, "visibility_removal_options", "enable",
+                    visibility_removal_options.enable, bool, bool);
+  GET_SINGLE_OPTION(static_map_node, "visibility_removal_options",
+                    "top_angle", visibility_removal_options.top_angle, float,
+                    float);
+  GET_SINGLE_OPTION(static_map_node, "visibility_removal_options",
+                    "btm_angle", visibility_removal_options.btm_angle, float,
+                    float);
+  GET_SINGLE_OPTION(static_map_node, "visibility_removal_options",
+                    "vertical_line_num",
+                    visibility_removal_options.vertical_line_num, int, int);
+  GET_SINGLE_OPTION(static_map_node, "visibility_removal_options",
+                    "horizontal_line_num",
+                    visibility_removal_options.horizontal_line_num, int, int);
+  GET_SINGLE_OPTION(static_map_node, "visibility_removal_options",
+                    "search_range", visibility_removal_options.search_range,
+                    double, double);
+  GET_SINGLE_OPTION(static_map_node, "visibility_removal_options",
+                    "range_tolerance",
+                    visibility_removal_options.range_tolerance, float, float);
+  GET_SINGLE_OPTION(static_map_node, "visibility_removal_options",
+                    "range_ratio", visibility_removal_options.range_ratio,
+                    float, float);
+  GET_SINGLE_OPTION(static_map_node, "visibility_removal_options",
+                    "min_see_through_num",
+                    visibility_removal_options.min_see_through_num, int, int);
+
+  auto& octree_lod_options = options_.octree_lod_options;
+  GET_SINGLE_OPTION(static_map_node, "octree_lod_options", "enable",
+                    octree_lod_options.enable, bool, bool);
+  GET_SINGLE_OPTION(static_map_node, "octree_lod_options", "directory",
+                    octree_lod_options.directory, string, string);
+  GET_SINGLE_OPTION(static_map_node, "octree_lod_options", "max_node_points",
+                    octree_lod_options.max_node_points, int, int);
+  GET_SINGLE_OPTION(static_map_node, "octree_lod_options",
+                    "hierarchy_step_size",
+                    octree_lod_options.hierarchy_step_size, int, int);
+  GET_SINGLE_OPTION(static_map_node, "octree_lod_options", "scale",
+                    octree_lod_options.scale, double, double);
+  GET_SINGLE_OPTION(static_map_node, "octree_lod_options", "partition_points",
+                    octree_lod_options.partition_points, int, int);
 
   std::cout
       << BOLD
@@ -0,0 +1,353 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// third party
+#include <glog/logging.h>
+// stl
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+// local
+#include "builder/map_package_file.h"
+#include "common/macro_defines.h"
+#include "common/pugixml.hpp"
+
+namespace static_map {
+
+namespace {
+
+constexpr uint32_t kMapPackageIndexMagic = 0x494b504d;  // "MPKI"
+constexpr uint32_t kMapPackageIndexVersion = 1;
+
+// the index is the header followed by the trajectories, each one is a
+// record followed by its submaps, each submap is a record followed by
+// file_length chars of the file and connection_count pairs of int32
+struct MapPackageIndexHeader {
+  uint32_t magic;
+  uint32_t version;
+  // the size of the xml written along with it, it is stale if not matched
+  uint64_t xml_bytes;
+  uint32_t trajectory_count;
+  uint32_t reserved;
+};
+
+struct TrajectoryRecord {
+  int32_t id;
+  uint32_t submap_count;
+  double utm_x;
+  double utm_y;
+};
+
+struct SubmapRecord {
+  int32_t id;
+  uint32_t file_length;
+  uint32_t connection_count;
+  uint32_t reserved;
+  double pose_6d[6];
+};
+
+std::string IndexFileName(const std::string& filename) {
+  return filename + ".idx";
+}
+
+// the attribute value with the xml entities
+void WriteEscaped(FILE* file, const std::string& value) {
+  for (const char c : value) {
+    switch (c) {
+      case '&':
+        std::fputs("&amp;", file);
+        break;
+      case '<':
+        std::fputs("&lt;", file);
+        break;
+      case '>':
+        std::fputs("&gt;", file);
+        break;
+      case '"':
+        std::fputs("&quot;", file);
+        break;
+      default:
+        std::fputc(c, file);
+        break;
+    }
+  }
+}
+
+bool LoadIndex(const std::string& filename,
+               std::vector<MapPackageTrajectory>* trajectories) {
+  std::ifstream xml_file(filename, std::ios::in | std::ios::binary);
+  std::ifstream file(IndexFileName(filename),
+                     std::ios::in | std::ios::binary | std::ios::ate);
+  if (!xml_file.is_open() || !file.is_open()) {
+    return false;
+  }
+  xml_file.seekg(0, std::ios::end);
+  const uint64_t xml_bytes = xml_file.tellg();
+  const size_t size = file.tellg();
+  std::vector<char> buffer(size);
+  file.seekg(0);
+  if (!file.read(buffer.data(), size)) {
+    return false;
+  }
+  const char* data = buffer.data();
+  const char* const end = data + size;
+  const auto read = [&](void* output, const size_t bytes) -> bool {
+    if (static_cast<size_t>(end - data) < bytes) {
+      return false;
+    }
+    std::memcpy(output, data, bytes);
+    data += bytes;
+    return true;
+  };
+  MapPackageIndexHeader header;
+  if (!read(&header, sizeof(header)) ||
+      header.magic != kMapPackageIndexMagic ||
+      header.version != kMapPackageIndexVersion ||
+      header.xml_bytes != xml_bytes) {
+    return false;
+  }
+  trajectories->clear();
+  trajectories->resize(header.trajectory_count);
+  for (auto& trajectory : *trajectories) {
+    TrajectoryRecord trajectory_record;
+    if (!read(&trajectory_record, sizeof(trajectory_record))) {
+      return false;
+    }
+    trajectory.id = trajectory_record.id;
+    trajectory.utm_x = trajectory_record.utm_x;
+    trajectory.utm_y = trajectory_record.utm_y;
+    trajectory.submaps.resize(trajectory_record.submap_count);
+    for (auto& submap : trajectory.submaps) {
+      SubmapRecord submap_record;
+      if (!read(&submap_record, sizeof(submap_record)) ||
+          static_cast<size_t>(end - data) < submap_record.file_length) {
+        return false;
+      }
+      submap.id = submap_record.id;
+      std::memcpy(submap.pose_6d, submap_record.pose_6d,
+                  sizeof(submap.pose_6d));
+      submap.file.assign(data, submap_record.file_length);
+      data += submap_record.file_length;
+      std::vector<int32_t> ids(2 * submap_record.connection_count);
+      if (!read(ids.data(), ids.size() * sizeof(int32_t))) {
+        return false;
+      }
+      submap.connections.resize(submap_record.connection_count);
+      for (size_t i = 0; i < submap.connections.size(); ++i) {
+        submap.connections[i].trajectory_index = ids[2 * i];
+        submap.connections[i].submap_index = ids[2 * i + 1];
+      }
+    }
+  }
+  return data == end;
+}
+
+bool LoadXml(const std::string& filename,
+             std::vector<MapPackageTrajectory>* trajectories) {
+  pugi::xml_document doc;
+  if (!doc.load_file(filename.c_str())) {
+    PRINT_ERROR("Failed to load file.");
+    return false;
+  }
+  pugi::xml_node map_node = doc.child("Map");
+  if (!map_node) {
+    PRINT_ERROR("Format error.");
+    return false;
+  }
+  trajectories->clear();
+  for (auto t_node = map_node.child("Trajectory"); t_node;
+       t_node = t_node.next_sibling("Trajectory")) {
+    trajectories->emplace_back();
+    auto& trajectory = trajectories->back();
+    trajectory.id = t_node.attribute("id").as_int();
+    trajectory.utm_x = t_node.attribute("utm_x").as_double();
+    trajectory.utm_y = t_node.attribute("utm_y").as_double();
+    for (auto s_node = t_node.child("Submap"); s_node;
+         s_node = s_node.next_sibling("Submap")) {
+      trajectory.submaps.emplace_back();
+      auto& submap = trajectory.submaps.back();
+      submap.id = s_node.attribute("id").as_int();
+      submap.file = s_node.attribute("file").as_string();
+      const char* const pose_names[6] = {"tx", "ty", "tz", "rx", "ry", "rz"};
+      for (int i = 0; i < 6; ++i) {
+        submap.pose_6d[i] = s_node.attribute(pose_names[i]).as_double();
+      }
+      submap.connections =
+          ParseSubmapIds(s_node.attribute("connections").as_string());
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+bool MapPackageWriter::Open(const std::string& filename) {
+  Close();
+  filename_ = filename;
+  good_ = true;
+  trajectory_count_ = 0;
+  xml_file_ = std::fopen(filename.c_str(), "wb");
+  index_file_ = std::fopen(IndexFileName(filename).c_str(), "wb");
+  if (!xml_file_ || !index_file_) {
+    PRINT_ERROR_FMT("Cannot open file: %s", filename.c_str());
+    good_ = false;
+    Close();
+    return false;
+  }
+  std::fputs("<?xml version=\"1.0\"?>\n<Map>\n", xml_file_);
+  // the counts are filled in on Close()
+  MapPackageIndexHeader header;
+  std::memset(&header, 0, sizeof(header));
+  WriteIndex(&header, sizeof(header));
+  return good_;
+}
+
+void MapPackageWriter::BeginTrajectory(const int id, const double utm_x,
+                                       const double utm_y) {
+  CHECK(xml_file_);
+  CHECK(!in_trajectory_);
+  in_trajectory_ = true;
+  trajectory_count_++;
+  submap_count_ = 0;
+  std::fprintf(xml_file_,
+               "\t<Trajectory id=\"%d\" utm_x=\"%.17g\" utm_y=\"%.17g\">\n",
+               id, utm_x, utm_y);
+  submap_count_offset_ =
+      std::ftell(index_file_) + offsetof(TrajectoryRecord, submap_count);
+  TrajectoryRecord record;
+  std::memset(&record, 0, sizeof(record));
+  record.id = id;
+  record.utm_x = utm_x;
+  record.utm_y = utm_y;
+  WriteIndex(&record, sizeof(record));
+}
+
+void MapPackageWriter::AddSubmap(const MapPackageSubmap& submap) {
+  CHECK(in_trajectory_);
+  submap_count_++;
+  std::fprintf(xml_file_, "\t\t<Submap id=\"%d\" file=\"", submap.id);
+  WriteEscaped(xml_file_, submap.file);
+  // the poses are of floats
+  std::fprintf(xml_file_,
+               "\" tx=\"%.9g\" ty=\"%.9g\" tz=\"%.9g\" rx=\"%.9g\" "
+               "ry=\"%.9g\" rz=\"%.9g\" connections=\"",
+               submap.pose_6d[0], submap.pose_6d[1], submap.pose_6d[2],
+               submap.pose_6d[3], submap.pose_6d[4], submap.pose_6d[5]);
+  std::vector<int32_t> ids;
+  ids.reserve(2 * submap.connections.size());
+  for (const auto& connected : submap.connections) {
+    std::fprintf(xml_file_, "[%d,%d]", connected.trajectory_index,
+                 connected.submap_index);
+    ids.push_back(connected.trajectory_index);
+    ids.push_back(connected.submap_index);
+  }
+  std::fputs("\" />\n", xml_file_);
+
+  SubmapRecord record;
+  std::memset(&record, 0, sizeof(record));
+  record.id = submap.id;
+  record.file_length = submap.file.size();
+  record.connection_count = submap.connections.size();
+  std::memcpy(record.pose_6d, submap.pose_6d, sizeof(record.pose_6d));
+  WriteIndex(&record, sizeof(record));
+  WriteIndex(submap.file.data(), submap.file.size());
+  WriteIndex(ids.data(), ids.size() * sizeof(int32_t));
+}
+
+void MapPackageWriter::EndTrajectory() {
+  CHECK(in_trajectory_);
+  in_trajectory_ = false;
+  std::fputs("\t</Trajectory>\n", xml_file_);
+  const long end = std::ftell(index_file_);
+  good_ = good_ && std::fseek(index_file_, submap_count_offset_, SEEK_SET) == 0;
+  WriteIndex(&submap_count_, sizeof(submap_count_));
+  good_ = good_ && std::fseek(index_file_, end, SEEK_SET) == 0;
+}
+
+bool MapPackageWriter::Close() {
+  if (!xml_file_ && !index_file_) {
+    return good_;
+  }
+  if (xml_file_ && index_file_) {
+    if (in_trajectory_) {
+      EndTrajectory();
+    }
+    std::fputs("</Map>\n", xml_file_);
+    good_ = good_ && std::fflush(xml_file_) == 0;
+    MapPackageIndexHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = kMapPackageIndexMagic;
+    header.version = kMapPackageIndexVersion;
+    header.xml_bytes = std::ftell(xml_file_);
+    header.trajectory_count = trajectory_count_;
+    good_ = good_ && std::fseek(index_file_, 0, SEEK_SET) == 0;
+    WriteIndex(&header, sizeof(header));
+  }
+  if (xml_file_) {
+    good_ = std::fclose(xml_file_) == 0 && good_;
+    xml_file_ = nullptr;
+  }
+  if (index_file_) {
+    good_ = std::fclose(index_file_) == 0 && good_;
+    index_file_ = nullptr;
+  }
+  if (!good_) {
+    PRINT_ERROR_FMT("Failed to write file: %s", filename_.c_str());
+    // a broken index is never read instead of the xml
+    std::remove(IndexFileName(filename_).c_str());
+  }
+  return good_;
+}
+
+void MapPackageWriter::WriteIndex(const void* data, const size_t size) {
+  if (size > 0) {
+    good_ = good_ && std::fwrite(data, 1, size, index_file_) == size;
+  }
+}
+
+bool LoadMapPackage(const std::string& filename,
+                    std::vector<MapPackageTrajectory>* trajectories) {
+  CHECK(trajectories);
+  if (LoadIndex(filename, trajectories)) {
+    return true;
+  }
+  PRINT_INFO_FMT("no valid index of %s, parsing the xml.", filename.c_str());
+  return LoadXml(filename, trajectories);
+}
+
+std::vector<SubmapId> ParseSubmapIds(const char* ids) {
+  std::vector<SubmapId> result;
+  CHECK(ids);
+  while ((ids = std::strchr(ids, '['))) {
+    char* comma = nullptr;
+    SubmapId id;
+    id.trajectory_index = std::strtol(ids + 1, &comma, 10);
+    CHECK(*comma == ',');
+    id.submap_index = std::strtol(comma + 1, nullptr, 10);
+    result.push_back(id);
+    ids = comma;
+  }
+  return result;
+}
+
+}  // namespace static_map
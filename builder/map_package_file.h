@@ -0,0 +1,101 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef BUILDER_MAP_PACKAGE_FILE_H_
+#define BUILDER_MAP_PACKAGE_FILE_H_
+
+// stl
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+// local
+#include "builder/submap.h"
+
+namespace static_map {
+
+/// @brief a submap in the map package descriptor (map.xml)
+struct MapPackageSubmap {
+  int32_t id = 0;
+  // the pcd file in the package
+  std::string file;
+  // tx, ty, tz, rx, ry, rz
+  double pose_6d[6] = {0., 0., 0., 0., 0., 0.};
+  std::vector<SubmapId> connections;
+};
+
+struct MapPackageTrajectory {
+  int32_t id = 0;
+  double utm_x = 0.;
+  double utm_y = 0.;
+  std::vector<MapPackageSubmap> submaps;
+};
+
+/*
+ * @class MapPackageWriter
+ * @brief writes the map package descriptor submap by submap instead of
+ * building a document of all submaps, in the layout of pugixml, along with
+ * a binary index of the same content ("<filename>.idx") which is read much
+ * faster than the xml by LoadMapPackage()
+ */
+class MapPackageWriter {
+ public:
+  MapPackageWriter() = default;
+  ~MapPackageWriter() { Close(); }
+
+  MapPackageWriter(const MapPackageWriter&) = delete;
+  MapPackageWriter& operator=(const MapPackageWriter&) = delete;
+
+  /// @return false if either file can not be created
+  bool Open(const std::string& filename);
+  void BeginTrajectory(const int id, const double utm_x, const double utm_y);
+  void AddSubmap(const MapPackageSubmap& submap);
+  void EndTrajectory();
+  /// @return false if anything failed to be written
+  bool Close();
+
+ private:
+  void WriteIndex(const void* data, const size_t size);
+
+  std::string filename_;
+  FILE* xml_file_ = nullptr;
+  FILE* index_file_ = nullptr;
+  bool good_ = true;
+  bool in_trajectory_ = false;
+  uint32_t trajectory_count_ = 0;
+  uint32_t submap_count_ = 0;
+  // where the submap count of the current trajectory is in the index
+  long submap_count_offset_ = 0;
+};
+
+/// @brief the descriptor with its index if the index is there and matches
+/// the xml, otherwise the xml is parsed
+/// @return false if the descriptor is invalid
+bool LoadMapPackage(const std::string& filename,
+                    std::vector<MapPackageTrajectory>* trajectories);
+
+/// @brief the ids of a string like "[0,63][0,80][0,81]"
+std::vector<SubmapId> ParseSubmapIds(const char* ids);
+
+}  // namespace static_map
+
+#endif  // BUILDER_MAP_PACKAGE_FILE_H_
@@ -0,0 +1,256 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// stl
+#include <iomanip>
+#include <sstream>
+// local
+#include "builder/map_piece.h"
+#include "common/macro_defines.h"
+#include "common/point_types.h"
+#include "common/pugixml.hpp"
+
+namespace static_map {
+
+namespace {
+
+bool InsideBbox(const Eigen::Vector3d& point, const Eigen::Vector2d& bbox_min,
+                const Eigen::Vector2d& bbox_max) {
+  return (point[0] >= bbox_min[0] && point[0] <= bbox_max[0] &&
+          point[1] >= bbox_min[1] && point[1] <= bbox_max[1]);
+}
+
+}  // namespace
+
+bool SaveMapWorkManifest(const std::string& filename,
+                         const MapWorkManifest& manifest) {
+  CHECK_EQ(manifest.submap_files.size(), manifest.submap_poses.size());
+  pugi::xml_document doc;
+  pugi::xml_node work_node = doc.append_child("MapWork");
+  pugi::xml_node settings_node = work_node.append_child("MrvmSettings");
+  const MrvmSettings& settings = manifest.settings;
+  settings_node.append_attribute("output_average") = settings.output_average;
+  settings_node.append_attribute("prob_threshold") = settings.prob_threshold;
+  settings_node.append_attribute("low_resolution") = settings.low_resolution;
+  settings_node.append_attribute("high_resolution") = settings.high_resolution;
+  settings_node.append_attribute("hit_prob") = settings.hit_prob;
+  settings_node.append_attribute("miss_prob") = settings.miss_prob;
+  settings_node.append_attribute("z_offset") = settings.z_offset;
+  settings_node.append_attribute("max_point_num_in_cell") =
+      settings.max_point_num_in_cell;
+  settings_node.append_attribute("stop_ray_at_hit_voxel") =
+      settings.stop_ray_at_hit_voxel;
+  settings_node.append_attribute("discretized_insertion") =
+      settings.discretized_insertion;
+  settings_node.append_attribute("block_storage") = settings.block_storage;
+  settings_node.append_attribute("compact_points") = settings.compact_points;
+  settings_node.append_attribute("gpu_insertion") = settings.gpu_insertion;
+  settings_node.append_attribute("refine_hit_num") = settings.refine_hit_num;
+
+  const int submaps_size = manifest.submap_files.size();
+  for (int i = 0; i < submaps_size; ++i) {
+    std::ostringstream pose;
+    pose << std::setprecision(9);
+    for (int k = 0; k < 16; ++k) {
+      pose << (k ? " " : "") << manifest.submap_poses[i].data()[k];
+    }
+    pugi::xml_node submap_node = work_node.append_child("Submap");
+    submap_node.append_attribute("file") = manifest.submap_files[i].c_str();
+    submap_node.append_attribute("pose") = pose.str().c_str();
+  }
+
+  for (const auto& piece : manifest.pieces) {
+    std::ostringstream submaps;
+    for (size_t k = 0; k < piece.submaps.size(); ++k) {
+      submaps << (k ? " " : "") << piece.submaps[k];
+    }
+    pugi::xml_node piece_node = work_node.append_child("Piece");
+    piece_node.append_attribute("x") = piece.x;
+    piece_node.append_attribute("y") = piece.y;
+    piece_node.append_attribute("center_x") = piece.center[0];
+    piece_node.append_attribute("center_y") = piece.center[1];
+    piece_node.append_attribute("min_x") = piece.bb_min[0];
+    piece_node.append_attribute("min_y") = piece.bb_min[1];
+    piece_node.append_attribute("max_x") = piece.bb_max[0];
+    piece_node.append_attribute("max_y") = piece.bb_max[1];
+    piece_node.append_attribute("file") = piece.filename.c_str();
+    piece_node.append_attribute("submaps") = submaps.str().c_str();
+  }
+  return doc.save_file(filename.c_str());
+}
+
+bool LoadMapWorkManifest(const std::string& filename,
+                         MapWorkManifest* manifest) {
+  CHECK(manifest);
+  pugi::xml_document doc;
+  pugi::xml_node work_node;
+  if (doc.load_file(filename.c_str())) {
+    work_node = doc.child("MapWork");
+  }
+  if (!work_node) {
+    PRINT_ERROR_FMT("Invalid map work manifest: %s", filename.c_str());
+    return false;
+  }
+  pugi::xml_node settings_node = work_node.child("MrvmSettings");
+  MrvmSettings& settings = manifest->settings;
+  settings.output_average =
+      settings_node.attribute("output_average").as_bool();
+  settings.prob_threshold =
+      settings_node.attribute("prob_threshold").as_float();
+  settings.low_resolution =
+      settings_node.attribute("low_resolution").as_float();
+  settings.high_resolution =
+      settings_node.attribute("high_resolution").as_float();
+  settings.hit_prob = settings_node.attribute("hit_prob").as_float();
+  settings.miss_prob = settings_node.attribute("miss_prob").as_float();
+  settings.z_offset = settings_node.attribute("z_offset").as_float();
+  settings.max_point_num_in_cell =
+      settings_node.attribute("max_point_num_in_cell").as_int();
+  settings.stop_ray_at_hit_voxel =
+      settings_node.attribute("stop_ray_at_hit_voxel").as_bool();
+  settings.discretized_insertion =
+      settings_node.attribute("discretized_insertion").as_bool();
+  settings.block_storage = settings_node.attribute("block_storage").as_bool();
+  settings.compact_points =
+      settings_node.attribute("compact_points").as_bool();
+  settings.gpu_insertion = settings_node.attribute("gpu_insertion").as_bool();
+  settings.refine_hit_num = settings_node.attribute("refine_hit_num").as_int();
+
+  manifest->submap_files.clear();
+  manifest->submap_poses.clear();
+  for (auto s_node = work_node.child("Submap"); s_node;
+       s_node = s_node.next_sibling("Submap")) {
+    Eigen::Matrix4f pose;
+    std::istringstream stream(s_node.attribute("pose").as_string());
+    for (int k = 0; k < 16; ++k) {
+      stream >> pose.data()[k];
+    }
+    if (!stream) {
+      PRINT_ERROR_FMT("Invalid submap pose in %s", filename.c_str());
+      return false;
+    }
+    manifest->submap_files.push_back(s_node.attribute("file").as_string());
+    manifest->submap_poses.push_back(pose);
+  }
+
+  const int submaps_size = manifest->submap_files.size();
+  manifest->pieces.clear();
+  for (auto p_node = work_node.child("Piece"); p_node;
+       p_node = p_node.next_sibling("Piece")) {
+    MapPieceWork piece;
+    piece.x = p_node.attribute("x").as_int();
+    piece.y = p_node.attribute("y").as_int();
+    piece.center << p_node.attribute("center_x").as_double(),
+        p_node.attribute("center_y").as_double();
+    piece.bb_min << p_node.attribute("min_x").as_double(),
+        p_node.attribute("min_y").as_double();
+    piece.bb_max << p_node.attribute("max_x").as_double(),
+        p_node.attribute("max_y").as_double();
+    piece.filename = p_node.attribute("file").as_string();
+    std::istringstream stream(p_node.attribute("submaps").as_string());
+    int index;
+    while (stream >> index) {
+      if (index < 0 || index >= submaps_size) {
+        PRINT_ERROR_FMT("Invalid submap index %d in %s", index,
+                        filename.c_str());
+        return false;
+      }
+      piece.submaps.push_back(index);
+    }
+    manifest->pieces.push_back(piece);
+  }
+  return true;
+}
+
+template <typename PointT>
+size_t BuildMapPiece(
+    const Eigen::Vector2d& center, const Eigen::Vector2d& bb_min,
+    const Eigen::Vector2d& bb_max, const int submap_num,
+    const MrvmSettings& settings,
+    const std::function<typename pcl::PointCloud<PointT>::Ptr(
+        int k, Eigen::Vector3f* origin)>& acquire,
+    const std::function<void(int k)>& release,
+    pcl::PointCloud<PointT>* piece_cloud) {
+  using PointCloudPtr = typename pcl::PointCloud<PointT>::Ptr;
+  CHECK(piece_cloud);
+  MultiResolutionVoxelMap<PointT> voxel_map;
+  voxel_map.Initialise(settings);
+  for (int k = 0; k < submap_num; ++k) {
+    Eigen::Vector3f origin;
+    PointCloudPtr transformed_cloud = acquire(k, &origin);
+    if (InsideBbox(origin.cast<double>(), bb_min, bb_max)) {
+      voxel_map.InsertPointCloud(transformed_cloud, origin);
+    } else {
+      PointCloudPtr transformed_cloud_in_bbox(new pcl::PointCloud<PointT>);
+      for (auto& point : transformed_cloud->points) {
+        if (InsideBbox(Eigen::Vector3d(point.x, point.y, point.z), bb_min,
+                       bb_max)) {
+          transformed_cloud_in_bbox->points.push_back(point);
+        }
+      }
+      if (!transformed_cloud_in_bbox->empty()) {
+        voxel_map.InsertPointCloud(transformed_cloud_in_bbox, origin);
+      }
+    }
+    transformed_cloud.reset();
+    release(k);
+  }
+  const size_t memory_bytes = voxel_map.MemoryBytes();
+
+  PointCloudPtr whole_part_cloud(new pcl::PointCloud<PointT>);
+  voxel_map.OutputToPointCloud(settings.prob_threshold, whole_part_cloud);
+
+  // cut the cloud in right size
+  piece_cloud->points.clear();
+  for (auto& point : whole_part_cloud->points) {
+    if (InsideBbox(Eigen::Vector3d(point.x, point.y, point.z), bb_min,
+                   bb_max)) {
+      point.x -= center[0];
+      point.y -= center[1];
+      piece_cloud->points.push_back(point);
+    }
+  }
+  piece_cloud->width = piece_cloud->points.size();
+  piece_cloud->height = 1;
+  return memory_bytes;
+}
+
+template size_t BuildMapPiece<pcl::PointXYZI>(
+    const Eigen::Vector2d& center, const Eigen::Vector2d& bb_min,
+    const Eigen::Vector2d& bb_max, const int submap_num,
+    const MrvmSettings& settings,
+    const std::function<pcl::PointCloud<pcl::PointXYZI>::Ptr(
+        int k, Eigen::Vector3f* origin)>& acquire,
+    const std::function<void(int k)>& release,
+    pcl::PointCloud<pcl::PointXYZI>* piece_cloud);
+#ifdef _USE_COMPACT_POINT_
+template size_t BuildMapPiece<PointXYZIc>(
+    const Eigen::Vector2d& center, const Eigen::Vector2d& bb_min,
+    const Eigen::Vector2d& bb_max, const int submap_num,
+    const MrvmSettings& settings,
+    const std::function<pcl::PointCloud<PointXYZIc>::Ptr(
+        int k, Eigen::Vector3f* origin)>& acquire,
+    const std::function<void(int k)>& release,
+    pcl::PointCloud<PointXYZIc>* piece_cloud);
+#endif
+
+}  // namespace static_map
@@ -0,0 +1,97 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef BUILDER_MAP_PIECE_H_
+#define BUILDER_MAP_PIECE_H_
+
+// stl
+#include <functional>
+#include <string>
+#include <vector>
+// third party
+#include <Eigen/Eigen>
+#include <pcl/point_cloud.h>
+// local
+#include "builder/multi_resolution_voxel_map.h"
+
+namespace static_map {
+
+/*
+ * @struct MapPieceWork
+ * @brief a piece of the map package to build, from the submaps around it
+ */
+struct MapPieceWork {
+  // the index of the piece in the package
+  int x = 0;
+  int y = 0;
+  Eigen::Vector2d center = Eigen::Vector2d::Zero();
+  Eigen::Vector2d bb_min = Eigen::Vector2d::Zero();
+  Eigen::Vector2d bb_max = Eigen::Vector2d::Zero();
+  // the indices of the submaps in the manifest, in the order of insertion
+  std::vector<int> submaps;
+  // the pcd file of the piece
+  std::string filename;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+/*
+ * @struct MapWorkManifest
+ * @brief all the inputs of the pieces of a map package, so that each piece
+ * can be built by map_piece_worker in another process (or node)
+ */
+struct MapWorkManifest {
+  MrvmSettings settings;
+  // the pcd files of the submaps, relative to the manifest
+  std::vector<std::string> submap_files;
+  // the global poses of the submaps
+  std::vector<Eigen::Matrix4f, Eigen::aligned_allocator<Eigen::Matrix4f>>
+      submap_poses;
+  std::vector<MapPieceWork, Eigen::aligned_allocator<MapPieceWork>> pieces;
+};
+
+/// @brief save the manifest as xml, return false if it can not be written
+bool SaveMapWorkManifest(const std::string& filename,
+                         const MapWorkManifest& manifest);
+/// @brief return false if the file is invalid
+bool LoadMapWorkManifest(const std::string& filename,
+                         MapWorkManifest* manifest);
+
+/// @brief build the voxel map of a piece from its submaps and output the
+/// points in its bbox, relative to its center
+/// @param acquire the k-th submap of the piece in the global frame, and
+/// its origin
+/// @param release called when the k-th submap is inserted
+/// @return the bytes of the voxel map
+template <typename PointT>
+size_t BuildMapPiece(
+    const Eigen::Vector2d& center, const Eigen::Vector2d& bb_min,
+    const Eigen::Vector2d& bb_max, const int submap_num,
+    const MrvmSettings& settings,
+    const std::function<typename pcl::PointCloud<PointT>::Ptr(
+        int k, Eigen::Vector3f* origin)>& acquire,
+    const std::function<void(int k)>& release,
+    pcl::PointCloud<PointT>* piece_cloud);
+
+}  // namespace static_map
+
+#endif  // BUILDER_MAP_PIECE_H_
@@ -21,8 +21,10 @@
 // SOFTWARE.
 
 // stl
+#include <cmath>
 #include <fstream>
 #include <ostream>
+#include <vector>
 // third party
 #include "ceres/problem.h"
 #include "glog/logging.h"
@@ -32,10 +34,17 @@
 // local
 #include "builder/map_utm_matcher.h"
 #include "common/macro_defines.h"
+#include "common/pcd_writer.h"
+#include "common/shared_executor.h"
 #include "cost_functions/utm_map_match.h"
 
 namespace static_map {
 
+namespace {
+// meters, for both the 2d and 3d optimization
+constexpr double kHuberThreshold = 1.;
+}  // namespace
+
 template <int DIM>
 void MapUtmMatcher<DIM>::InsertPositionData(
     const Eigen::VectorNd<DIM>& utm_position,
@@ -138,7 +147,7 @@ Eigen::Matrix4d MapUtmMatcher<DIM>::RunMatch(bool output_files) {
       path_compare_cloud->push_back(point_pcl_utm);
     }
     if (!path_compare_cloud->empty()) {
-      pcl::io::savePCDFileBinaryCompressed(filename, *path_compare_cloud);
+      common::SavePcdFile(filename, *path_compare_cloud);
     }
   };
 
@@ -149,15 +158,29 @@ Eigen::Matrix4d MapUtmMatcher<DIM>::RunMatch(bool output_files) {
   }
 
   // step2 optimizing
+  // the dense gps samples of a long drive add little but a lot of residuals,
+  // only the ones with enough distance along the map path are used
+  std::vector<int> sample_indices;
+  sample_indices.reserve(corre_size);
+  for (int i = 0; i < corre_size; ++i) {
+    if (sample_indices.empty() ||
+        (map_positions_[i] - map_positions_[sample_indices.back()]).norm() >=
+            sample_stride_) {
+      sample_indices.push_back(i);
+    }
+  }
+  PRINT_INFO_FMT("Matching with %lu of %d utm positions.",
+                 sample_indices.size(), corre_size);
+
   const int max_iter_num = 100;
   if (kDimValue == 2) {
-    // step2, use svd to solve the problem
-    // just like point-line icp
+    // step2, point-line icp, gauss-newton with the analytic jacobians and
+    // huber weights (iteratively reweighted) in the normal equations
     // iteration loop
     for (int iter = 0; iter < max_iter_num; ++iter) {
-      Eigen::MatrixXd A(corre_size, 3);
-      Eigen::MatrixXd b(corre_size, 1);
-      for (int i = 0; i < corre_size; ++i) {
+      Eigen::Matrix3d AtA = Eigen::Matrix3d::Zero();
+      Eigen::Vector3d Atb = Eigen::Vector3d::Zero();
+      for (const int i : sample_indices) {
         Eigen::VectorNd<DIM> p_u = utm_positions_[i];
         Eigen::VectorNd<DIM> p_m = map_positions_[i];
         // Get the normal vector to normal
@@ -166,15 +189,19 @@ Eigen::Matrix4d MapUtmMatcher<DIM>::RunMatch(bool output_files) {
         n_m.normalize();
         Eigen::VectorNd<DIM> opt_p_u = rotation * p_u + translation;
 
-        A.row(i) << (opt_p_u(0, 0) * n_m(1, 0) - opt_p_u(1, 0) * n_m(0, 0)),
-            n_m(0, 0), n_m(1, 0);
-        b(i, 0) = n_m(0, 0) * (p_m(0, 0) - opt_p_u(0, 0)) +
-                  n_m(1, 0) * (p_m(1, 0) - opt_p_u(1, 0));
+        const Eigen::Vector3d a(
+            opt_p_u(0, 0) * n_m(1, 0) - opt_p_u(1, 0) * n_m(0, 0), n_m(0, 0),
+            n_m(1, 0));
+        const double b = n_m(0, 0) * (p_m(0, 0) - opt_p_u(0, 0)) +
+                         n_m(1, 0) * (p_m(1, 0) - opt_p_u(1, 0));
+        const double weight = std::fabs(b) <= kHuberThreshold
+                                  ? 1.
+                                  : kHuberThreshold / std::fabs(b);
+        AtA += weight * a * a.transpose();
+        Atb += weight * a * b;
       }
-      Eigen::MatrixXd At = A.transpose();
-      Eigen::MatrixXd matAtA = At * A;
-      Eigen::MatrixXd matAtb = At * b;
-      Eigen::VectorXd result = A.colPivHouseholderQr().solve(b);
+      // rank deficient on a straight path
+      const Eigen::Vector3d result = AtA.colPivHouseholderQr().solve(Atb);
 
       Eigen::Matrix<double, DIM, DIM> delta_r;
       delta_r << std::cos(result[0]), -std::sin(result[0]), std::sin(result[0]),
@@ -201,7 +228,7 @@ Eigen::Matrix4d MapUtmMatcher<DIM>::RunMatch(bool output_files) {
     double t[3] = {translation[0], translation[1], translation[2]};
     double r[3] = {eulers[0], eulers[1], eulers[2]};
     ceres::Problem problem;
-    for (int i = 0; i < corre_size; ++i) {
+    for (const int i : sample_indices) {
       Eigen::Vector3d map_position, utm_position, map_direction;
       map_position << map_positions_[i][0], map_positions_[i][1],
           map_positions_[i][2];
@@ -211,13 +238,14 @@ Eigen::Matrix4d MapUtmMatcher<DIM>::RunMatch(bool output_files) {
           map_directions_[i][2];
       auto cost_function = cost_functions::UtmToMap3D::Create(
           map_position, utm_position, map_direction);
-      problem.AddResidualBlock(cost_function, new ceres::HuberLoss(1.0), t, r);
+      problem.AddResidualBlock(cost_function,
+                               new ceres::HuberLoss(kHuberThreshold), t, r);
     }
     ceres::Solver::Options options;
     options.linear_solver_type = ceres::DENSE_QR;
     options.minimizer_progress_to_stdout = false;
     options.max_num_iterations = 100;
-    options.num_threads = 8;
+    options.num_threads = common::SharedExecutor::ThreadNum();
     ceres::Solver::Summary summary;
     ceres::Solve(options, &problem, &summary);
 
@@ -37,7 +37,7 @@ namespace static_map {
 template <int DIM>
 class MapUtmMatcher {
  public:
-  MapUtmMatcher() : output_file_path_("") {}
+  MapUtmMatcher() : output_file_path_(""), sample_stride_(1.) {}
   ~MapUtmMatcher() {}
 
   enum { kDimValue = DIM };
@@ -65,6 +65,9 @@ class MapUtmMatcher {
   /// @brief if we need to output files when matching, we will output them to
   /// this path
   void SetOutputPath(const std::string& path) { output_file_path_ = path; }
+  /// @brief the data are subsampled by the distance along the map path
+  /// (meters) for the optimization, 0 to use all of them
+  void SetSampleStride(const double stride) { sample_stride_ = stride; }
   /// @brief output the error for all inserted data to a text file
   void OutputError(const Eigen::Matrix4d& result, const std::string& filename);
 
@@ -77,6 +80,7 @@ class MapUtmMatcher {
   std::vector<Eigen::VectorNd<DIM>> map_directions_;
 
   std::string output_file_path_;
+  double sample_stride_;
 };
 
 }  // namespace static_map
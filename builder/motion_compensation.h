@@ -0,0 +1,162 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef BUILDER_MOTION_COMPENSATION_H_
+#define BUILDER_MOTION_COMPENSATION_H_
+
+// third party
+#include <Eigen/Geometry>
+#include <Eigen/StdVector>
+#include <pcl/point_cloud.h>
+#include "glog/logging.h"
+// stl
+#include <algorithm>
+#include <vector>
+// local
+#include "common/macro_defines.h"
+#include "common/shared_executor.h"
+
+namespace static_map {
+
+template <typename T>
+Eigen::Matrix<T, 4, 4> InterpolateTransform(const Eigen::Matrix<T, 4, 4>& t1,
+                                            const Eigen::Matrix<T, 4, 4>& t2,
+                                            const float factor) {
+  CHECK(factor >= 0. && factor <= 1.);
+  Eigen::Matrix<T, 4, 4> new_transform = Eigen::Matrix<T, 4, 4>::Identity();
+  const Eigen::Quaternion<T> q_a(Eigen::Matrix<T, 3, 3>(t1.block(0, 0, 3, 3)));
+  const Eigen::Quaternion<T> q_b(Eigen::Matrix<T, 3, 3>(t2.block(0, 0, 3, 3)));
+  new_transform.block(0, 0, 3, 3) = q_a.slerp(factor, q_b).toRotationMatrix();
+  new_transform.block(0, 3, 3, 1) =
+      t1.block(0, 3, 3, 1) +
+      (t2.block(0, 3, 3, 1) - t1.block(0, 3, 3, 1)) * factor;
+  return new_transform;
+}
+
+// the transforms are only interpolated per bucket instead of per point,
+// buckets of consecutive points if the points are ordered by time, or
+// buckets of the time factors of points if they are given
+constexpr size_t kMotionCompensationBucketNum = 512;
+
+/// @brief moves every point of raw_cloud to the end of the scan, the
+/// sensor moved by delta_transform during the scan
+/// @param point_factors the time factors ([0, 1]) of the points, if not
+/// given (nullptr or size mismatch) the points are ordered by time
+/// the points are kept as pcl stores them (AoS): the xyz of a pcl point
+/// are aligned 4-floats, so one 4x4 product per point is one SIMD
+/// multiply-add per column (SSE/AVX/NEON by eigen). a SoA x/y/z kernel
+/// needs the points transposed there and back, which costs more than it
+/// saves (about 2x slower in micro_bench, BM_MotionCompensationSoa)
+template <typename PointT>
+void MotionCompensation(const pcl::PointCloud<PointT>& raw_cloud,
+                        const std::vector<float>* const point_factors,
+                        const Eigen::Matrix4f& delta_transform,
+                        pcl::PointCloud<PointT>* const output_cloud) {
+  CHECK(output_cloud);
+  const size_t cloud_size = raw_cloud.size();
+  output_cloud->header = raw_cloud.header;
+  output_cloud->points.resize(cloud_size);
+  output_cloud->width = cloud_size;
+  output_cloud->height = 1;
+  output_cloud->is_dense = raw_cloud.is_dense;
+  if (cloud_size == 0) {
+    return;
+  }
+  const bool use_factors = point_factors && point_factors->size() == cloud_size;
+  const size_t bucket_num = std::min(cloud_size, kMotionCompensationBucketNum);
+  const Eigen::Matrix4f delta_transform_inverse = delta_transform.inverse();
+  // transform = delta^-1 * interpolated, it maps a point to the end of scan
+  std::vector<Eigen::Matrix4f, Eigen::aligned_allocator<Eigen::Matrix4f>>
+      transforms(bucket_num);
+  for (size_t b = 0; b < bucket_num; ++b) {
+    // use the factor of the center (point) of the bucket
+    const size_t center = (b * cloud_size + cloud_size / 2) / bucket_num;
+    const float delta_factor =
+        use_factors
+            ? (static_cast<float>(b) + 0.5f) / static_cast<float>(bucket_num)
+            : static_cast<float>(center) / static_cast<float>(cloud_size);
+    transforms[b] = delta_transform_inverse *
+                    InterpolateTransform(Eigen::Matrix4f::Identity().eval(),
+                                         delta_transform, delta_factor);
+  }
+  // with w set to 1 the 4x4 product is vectorized, w is the intensity of
+  // PointXYZIc, so only xyz of the copied point are written
+  const int bucket_count = static_cast<int>(bucket_num);
+  common::ParallelFor(0, bucket_count, LOCAL_OMP_THREADS_NUM, [&](const int b) {
+    const size_t begin = b * cloud_size / bucket_num;
+    const size_t end = (b + 1) * cloud_size / bucket_num;
+    for (size_t i = begin; i < end; ++i) {
+      size_t bucket = b;
+      if (use_factors) {
+        bucket = std::min(
+            static_cast<size_t>((*point_factors)[i] * bucket_num),
+            bucket_num - 1);
+      }
+      const Eigen::Matrix4f& transform = transforms[bucket];
+      const auto& point = raw_cloud.points[i];
+      auto& new_point = output_cloud->points[i];
+      Eigen::Vector4f homogeneous = point.getVector4fMap();
+      homogeneous[3] = 1.f;
+      new_point = point;
+      new_point.getVector3fMap() = (transform * homogeneous).head<3>();
+    }
+  });
+}
+
+/// @brief the reference of MotionCompensation, the transform is
+/// interpolated for every point, only for the checks and benchmarks
+template <typename PointT>
+void MotionCompensationPerPoint(const pcl::PointCloud<PointT>& raw_cloud,
+                                const std::vector<float>* const point_factors,
+                                const Eigen::Matrix4f& delta_transform,
+                                pcl::PointCloud<PointT>* const output_cloud) {
+  CHECK(output_cloud);
+  CHECK_NE(&raw_cloud, output_cloud);
+  const size_t cloud_size = raw_cloud.size();
+  const bool use_factors = point_factors && point_factors->size() == cloud_size;
+  output_cloud->clear();
+  output_cloud->header = raw_cloud.header;
+  output_cloud->reserve(cloud_size);
+  const Eigen::Matrix3f rotation_inverse =
+      delta_transform.block<3, 3>(0, 0).inverse();
+  for (size_t i = 0; i < cloud_size; ++i) {
+    const auto& point = raw_cloud.points[i];
+    const float delta_factor =
+        use_factors
+            ? std::min(std::max((*point_factors)[i], 0.f), 1.f)
+            : static_cast<float>(i) / static_cast<float>(cloud_size);
+    const Eigen::Matrix4f transform = InterpolateTransform(
+        Eigen::Matrix4f::Identity().eval(), delta_transform, delta_factor);
+    const Eigen::Vector3f new_point_start =
+        transform.block<3, 3>(0, 0) * point.getVector3fMap() +
+        transform.block<3, 1>(0, 3);
+    PointT new_point = point;
+    new_point.getVector3fMap() =
+        rotation_inverse *
+        (new_point_start - delta_transform.block<3, 1>(0, 3));
+    output_cloud->push_back(new_point);
+  }
+}
+
+}  // namespace static_map
+
+#endif  // BUILDER_MOTION_COMPENSATION_H_
@@ -22,8 +22,82 @@
 
 #include "builder/msg_conversion.h"
 
+#include <cmath>
+#include <cstring>
+#include <string>
+
+#include "pcl_conversions/pcl_conversions.h"
+
 namespace static_map {
 namespace sensors {
+
+namespace {
+
+// offset and datatype of a PointCloud2 field, offset < 0 if not found
+struct FieldReader {
+  int offset = -1;
+  uint8_t datatype = 0;
+
+  bool Valid() const { return offset >= 0; }
+
+  double Read(const uint8_t* point) const {
+    const uint8_t* data = point + offset;
+    switch (datatype) {
+      case sensor_msgs::PointField::INT8:
+        return *reinterpret_cast<const int8_t*>(data);
+      case sensor_msgs::PointField::UINT8:
+        return *data;
+      case sensor_msgs::PointField::INT16: {
+        int16_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+      }
+      case sensor_msgs::PointField::UINT16: {
+        uint16_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+      }
+      case sensor_msgs::PointField::INT32: {
+        int32_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+      }
+      case sensor_msgs::PointField::UINT32: {
+        uint32_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+      }
+      case sensor_msgs::PointField::FLOAT64: {
+        double value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+      }
+      default: {
+        float value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+      }
+    }
+  }
+};
+
+FieldReader FindField(const sensor_msgs::PointCloud2& msg,
+                      const std::vector<std::string>& names) {
+  FieldReader reader;
+  for (const auto& field : msg.fields) {
+    for (const auto& name : names) {
+      if (field.name == name) {
+        reader.offset = field.offset;
+        reader.datatype = field.datatype;
+        return reader;
+      }
+    }
+  }
+  return reader;
+}
+
+}  // namespace
+
 SimpleTime ToLocalTime(const ros::Time& time) {
   SimpleTime local_time;
   local_time.secs = time.sec;
@@ -118,5 +192,98 @@ NavSatFixMsg ToLocalNavSatMsg(const sensor_msgs::NavSatFix& msg) {
   return std::move(local_navsat);
 }
 
+template <typename PointT>
+bool FromPointCloud2Msg(const sensor_msgs::PointCloud2& msg,
+                        const Eigen::Matrix4f& transform,
+                        pcl::PointCloud<PointT>* cloud,
+                        std::vector<float>* times,
+                        std::vector<uint16_t>* rings) {
+  cloud->clear();
+  if (times) {
+    times->clear();
+  }
+  if (rings) {
+    rings->clear();
+  }
+  cloud->header = pcl_conversions::toPCL(msg.header);
+
+  const FieldReader x = FindField(msg, {"x"});
+  const FieldReader y = FindField(msg, {"y"});
+  const FieldReader z = FindField(msg, {"z"});
+  const bool xyz_float = x.datatype == sensor_msgs::PointField::FLOAT32 &&
+                         y.datatype == sensor_msgs::PointField::FLOAT32 &&
+                         z.datatype == sensor_msgs::PointField::FLOAT32;
+  if (!x.Valid() || !y.Valid() || !z.Valid() || !xyz_float) {
+    return false;
+  }
+  const FieldReader intensity = FindField(msg, {"intensity"});
+  const FieldReader time = FindField(msg, {"time", "t", "timestamp"});
+  const FieldReader ring = FindField(msg, {"ring"});
+  const bool keep_times = times && time.Valid();
+  // integer times are in nanoseconds (e.g. "t" of ouster), otherwise seconds
+  const double time_scale =
+      time.datatype == sensor_msgs::PointField::FLOAT32 ||
+              time.datatype == sensor_msgs::PointField::FLOAT64
+          ? 1.
+          : 1.e-9;
+  double first_time = 0.;
+  const bool keep_rings = rings && ring.Valid();
+
+  const size_t point_num = static_cast<size_t>(msg.width) * msg.height;
+  cloud->reserve(point_num);
+  if (keep_times) {
+    times->reserve(point_num);
+  }
+  if (keep_rings) {
+    rings->reserve(point_num);
+  }
+  const Eigen::Matrix3f rotation = transform.block<3, 3>(0, 0);
+  const Eigen::Vector3f translation = transform.block<3, 1>(0, 3);
+  for (uint32_t row = 0; row < msg.height; ++row) {
+    const uint8_t* point = msg.data.data() + row * msg.row_step;
+    for (uint32_t col = 0; col < msg.width; ++col, point += msg.point_step) {
+      Eigen::Vector3f p;
+      std::memcpy(&p[0], point + x.offset, sizeof(float));
+      std::memcpy(&p[1], point + y.offset, sizeof(float));
+      std::memcpy(&p[2], point + z.offset, sizeof(float));
+      if (!std::isfinite(p[0]) || !std::isfinite(p[1]) ||
+          !std::isfinite(p[2])) {
+        continue;
+      }
+      PointT pcl_point;
+      pcl_point.getVector3fMap() = rotation * p + translation;
+      common::SetIntensity(intensity.Valid() ? intensity.Read(point) : 0.f,
+                           &pcl_point);
+      cloud->push_back(pcl_point);
+      if (keep_times) {
+        // relative to the first point, absolute times do not fit in floats
+        const double point_time = time.Read(point) * time_scale;
+        if (times->empty()) {
+          first_time = point_time;
+        }
+        times->push_back(point_time - first_time);
+      }
+      if (keep_rings) {
+        rings->push_back(ring.Read(point));
+      }
+    }
+  }
+  cloud->width = cloud->size();
+  cloud->height = 1;
+  cloud->is_dense = true;
+  return true;
+}
+
+template bool FromPointCloud2Msg<pcl::PointXYZI>(
+    const sensor_msgs::PointCloud2& msg, const Eigen::Matrix4f& transform,
+    pcl::PointCloud<pcl::PointXYZI>* cloud, std::vector<float>* times,
+    std::vector<uint16_t>* rings);
+#ifdef _USE_COMPACT_POINT_
+template bool FromPointCloud2Msg<PointXYZIc>(
+    const sensor_msgs::PointCloud2& msg, const Eigen::Matrix4f& transform,
+    pcl::PointCloud<PointXYZIc>* cloud, std::vector<float>* times,
+    std::vector<uint16_t>* rings);
+#endif
+
 }  // namespace sensors
 }  // namespace static_map
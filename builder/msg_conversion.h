@@ -24,6 +24,7 @@
 #define BUILDER_MSG_CONVERSION_H_
 
 #include <utility>
+#include <vector>
 
 #include "nav_msgs/Odometry.h"
 #include "pcl/point_cloud.h"
@@ -31,8 +32,10 @@
 #include "pointmatcher/PointMatcher.h"
 #include "sensor_msgs/Imu.h"
 #include "sensor_msgs/NavSatFix.h"
+#include "sensor_msgs/PointCloud2.h"
 
 #include "builder/sensors.h"
+#include "common/point_types.h"
 
 namespace static_map {
 namespace sensors {
@@ -48,6 +51,19 @@ OdomMsg ToLocalOdom(const nav_msgs::Odometry& msg);
 
 NavSatFixMsg ToLocalNavSatMsg(const sensor_msgs::NavSatFix& msg);
 
+/// @brief convert a PointCloud2 msg in one pass, reading the fields from the
+/// buffer by their offsets, dropping the NaN points and applying transform;
+/// the per-point times ("time", "t" or "timestamp", in seconds since the
+/// first point) and rings ("ring") are kept if the outputs are given and
+/// the fields exist, otherwise cleared
+/// @return false if the msg has no x/y/z float fields
+template <typename PointT>
+bool FromPointCloud2Msg(const sensor_msgs::PointCloud2& msg,
+                        const Eigen::Matrix4f& transform,
+                        pcl::PointCloud<PointT>* cloud,
+                        std::vector<float>* times = nullptr,
+                        std::vector<uint16_t>* rings = nullptr);
+
 using PM = PointMatcher<float>;
 template <typename PointT>
 PM::DataPoints pclPointCloudToLibPointMatcherPoints(
@@ -63,22 +79,28 @@ PM::DataPoints pclPointCloudToLibPointMatcherPoints(
   labels.push_back(PM::DataPoints::Label("pad", 1));
 
   const size_t point_count(pcl_point_cloud->points.size());
-  PM::Matrix inner_cloud(4, point_count);
-  int index = 0;
-  for (size_t i = 0; i < point_count; ++i) {
-    if (!std::isnan(pcl_point_cloud->points[i].x) &&
-        !std::isnan(pcl_point_cloud->points[i].y) &&
-        !std::isnan(pcl_point_cloud->points[i].z)) {
-      inner_cloud(0, index) = pcl_point_cloud->points[i].x;
-      inner_cloud(1, index) = pcl_point_cloud->points[i].y;
-      inner_cloud(2, index) = pcl_point_cloud->points[i].z;
-      inner_cloud(3, index) = 1;
-      ++index;
+  // the features are allocated once and filled in place
+  PM::DataPoints d(labels, PM::DataPoints::Labels(), point_count);
+  // xyz of the pcl points as a strided view, no copy
+  static_assert(sizeof(PointT) % sizeof(float) == 0,
+                "pcl point should be made of floats");
+  const Eigen::Map<const Eigen::Matrix<float, 3, Eigen::Dynamic>,
+                   Eigen::Unaligned, Eigen::OuterStride<>>
+      xyz(&pcl_point_cloud->points[0].x, 3, point_count,
+          Eigen::OuterStride<>(sizeof(PointT) / sizeof(float)));
+  d.features.topRows<3>() = xyz;
+  d.features.row(3).setOnes();
+
+  if (xyz.hasNaN()) {
+    int index = 0;
+    for (size_t i = 0; i < point_count; ++i) {
+      if (!xyz.col(i).hasNaN()) {
+        d.features.col(index++) = d.features.col(i);
+      }
     }
+    d.features.conservativeResize(Eigen::NoChange, index);
   }
-
-  PM::DataPoints d(inner_cloud.leftCols(index), labels);
-  return std::move(d);
+  return d;
 }
 
 }  // namespace sensors
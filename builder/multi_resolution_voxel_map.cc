@@ -20,9 +20,15 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
+// stl
+#include <algorithm>
+#include <fstream>
+#include <numeric>
 // local
 #include "builder/multi_resolution_voxel_map.h"
+#include "common/point_types.h"
 #include "common/point_utils.h"
+#include "common/shared_executor.h"
 
 namespace static_map {
 
@@ -30,10 +36,61 @@ template <typename PointT>
 void MultiResolutionVoxelMap<PointT>::InsertPointCloud(
     const MultiResolutionVoxelMap<PointT>::PointCloudPtr& cloud,
     const Eigen::Vector3f& origin) {
+  InsertPointCloudInside(cloud, origin);
+  if (common::MemoryAccountingEnabled()) {
+    tracked_bytes_.Set(MemoryBytes());
+  }
+}
+
+template <typename PointT>
+void MultiResolutionVoxelMap<PointT>::AggregatePointCloud(
+    const MultiResolutionVoxelMap<PointT>::PointCloudPtr& cloud,
+    const Eigen::Vector3f& origin) {
+  if (block_voxels_ || OnDevice() || TwoLevels()) {
+    InsertPointCloud(cloud, origin);
+    return;
+  }
   if (!cloud || cloud->empty()) {
     PRINT_ERROR("cloud is empty.");
     return;
   }
+  const float hit_log_odd = ProbabilityToOdd(settings_.hit_prob);
+  const float resolution = settings_.high_resolution;
+  for (const auto& point : cloud->points) {
+    KeyInt3 index;
+    if (!common::PointToVoxel(Eigen::Vector3f(point.x, point.y, point.z),
+                              resolution, &index) ||
+        (bounded_ && !bounds_.contains(index))) {
+      continue;
+    }
+    auto& voxel = high_resolution_voxels_[index];
+    if (static_cast<int>(point.intensity) >
+        static_cast<int>(voxel.max_intensity)) {
+      voxel.max_intensity = static_cast<int>(point.intensity);
+    }
+    const float odd = odds_table_[voxel.probability] + hit_log_odd;
+    voxel.probability = (Probability)(
+        Clamp(OddToProbability(odd), kMinProb, kMaxProb) * kTableSize);
+    AddPoint(index, point, &voxel);
+  }
+  if (common::MemoryAccountingEnabled()) {
+    tracked_bytes_.Set(MemoryBytes());
+  }
+}
+
+template <typename PointT>
+void MultiResolutionVoxelMap<PointT>::InsertPointCloudInside(
+    const MultiResolutionVoxelMap<PointT>::PointCloudPtr& cloud,
+    const Eigen::Vector3f& origin) {
+  if (!cloud || cloud->empty()) {
+    PRINT_ERROR("cloud is empty.");
+    return;
+  }
+  if (block_voxels_) {
+    block_voxels_->InsertPointCloud(cloud, origin, settings_,
+                                    bounded_ ? &bounds_ : nullptr);
+    return;
+  }
 
   Eigen::Vector3f offseted_origin = origin;
   offseted_origin[2] += settings_.z_offset;
@@ -48,53 +105,455 @@ void MultiResolutionVoxelMap<PointT>::InsertPointCloud(
   size_t point_index = 0;
   const size_t cloud_size = cloud->size();
   const float resolution = settings_.high_resolution;
-  VoxelMap<bool> end_voxels;
-#if defined _OPENMP && defined _USE_TBB_
-#pragma omp parallel for private(point_index) num_threads(LOCAL_OMP_THREADS_NUM)
+  KeyInt3 origin_index;
+  if (!common::PointToVoxel(offseted_origin, resolution, &origin_index)) {
+    PRINT_ERROR("origin is nan.");
+    return;
+  }
+#ifdef _VOXEL_MAP_USE_CUDA_
+  if (device_voxels_) {
+    InsertPointCloudOnDevice(cloud, origin_index);
+    return;
+  }
 #endif
-  for (point_index = 0; point_index < cloud_size; ++point_index) {
-    auto& point = cloud->points[point_index];
-    Eigen::Vector3f point_vec;
-    point_vec << point.x, point.y, point.z;
-    std::vector<KeyInt3> high_res_indices =
-        common::VoxelCastingBresenham(offseted_origin, point_vec, resolution);
-
-    // update the end voxel
-    if (!high_res_indices.empty()) {
-      const KeyInt3 high_end_index = high_res_indices.back();
-      high_resolution_voxels_[high_end_index].need_update = kFalse;
-      end_voxels[high_end_index] = true;
-
-      auto& voxel = high_resolution_voxels_[high_end_index];
-      auto& prob = voxel.probability;
+  if (TwoLevels()) {
+    InsertPointCloudInTwoLevels(cloud, offseted_origin);
+    return;
+  }
+  if (!settings_.discretized_insertion &&
+      cloud_size >= kMinPointNumInShards &&
+      common::SharedExecutor::ThreadNum() > 1) {
+    InsertPointCloudInShards(cloud, offseted_origin);
+    return;
+  }
+  VoxelMap<bool> end_voxels;
+  // the end voxels out of the bounds, only their rays are cast
+  VoxelMap<bool> outside_end_voxels;
+  // update the end voxel, one lookup for each voxel
+  auto update_end_voxel = [&](const PointT& point, const KeyInt3& end_index) {
+    if (bounded_ && !bounds_.contains(end_index)) {
+      if (settings_.discretized_insertion) {
+        outside_end_voxels[end_index] = true;
+      }
+      return;
+    }
+    auto& voxel = high_resolution_voxels_[end_index];
+    voxel.need_update = kFalse;
+    end_voxels[end_index] = true;
+
+    auto& prob = voxel.probability;
+    if (static_cast<int>(point.intensity) >
+        static_cast<int>(voxel.max_intensity)) {
+      voxel.max_intensity = static_cast<int>(point.intensity);
+    }
+    prob = (Probability)(update_prob(prob, true) * kTableSize);
+    AddPoint(end_index, point, &voxel);
+  };
+  // update the voxels on the line, the end voxel is the last one
+  // if 'missed_voxels' is given, a voxel is missed at most once and
+  // collected there to be reset after the scan
+  auto update_ray = [&](const Eigen::Vector3f& ray_end,
+                        const KeyInt3& end_index,
+                        std::vector<HighResolutionVoxel*>* missed_voxels) {
+    common::VisitVoxelsBresenham(
+        offseted_origin, ray_end, resolution, [&](const KeyInt3& index) {
+          if (index == end_index) {
+            return false;
+          }
+          auto it = high_resolution_voxels_.find(index);
+          if (it == high_resolution_voxels_.end() ||
+              it->second.need_update == kMissed) {
+            return true;
+          }
+          if (it->second.need_update == kTrue) {
+            if (missed_voxels) {
+              it->second.need_update = kMissed;
+              missed_voxels->push_back(&it->second);
+            }
+            // update the probability
+            auto& prob = it->second.probability;
+            prob = (Probability)(update_prob(prob, false) * kTableSize);
+          } else if (settings_.stop_ray_at_hit_voxel) {
+            // hit by another ray of this scan, the voxels behind it
+            // are treated as occluded
+            return false;
+          }
+          return true;
+        });
+  };
+
+  if (settings_.discretized_insertion) {
+    // bin the points by their end voxels first, then cast one ray to the
+    // center of each end voxel and miss every voxel at most once in a scan
+    // like the discretized insertion of OctoMap
+    for (point_index = 0; point_index < cloud_size; ++point_index) {
+      auto& point = cloud->points[point_index];
+      Eigen::Vector3f point_vec;
+      point_vec << point.x, point.y, point.z;
+      KeyInt3 high_end_index;
+      if (common::PointToVoxel(point_vec, resolution, &high_end_index)) {
+        update_end_voxel(point, high_end_index);
+      }
+    }
+    std::vector<HighResolutionVoxel*> missed_voxels;
+    for (auto& voxel : end_voxels) {
+      const KeyInt3& end_index = voxel.first;
+      const Eigen::Vector3f center =
+          (end_index.cast<float>() + Eigen::Vector3f::Constant(0.5f)) *
+          resolution;
+      update_ray(center, end_index, &missed_voxels);
+    }
+    for (auto& voxel : outside_end_voxels) {
+      const KeyInt3& end_index = voxel.first;
+      const Eigen::Vector3f center =
+          (end_index.cast<float>() + Eigen::Vector3f::Constant(0.5f)) *
+          resolution;
+      update_ray(center, end_index, &missed_voxels);
+    }
+    for (auto& voxel : missed_voxels) {
+      voxel->need_update = kTrue;
+    }
+  } else {
+    // the serial version of InsertPointCloudInShards
+    for (point_index = 0; point_index < cloud_size; ++point_index) {
+      auto& point = cloud->points[point_index];
+      Eigen::Vector3f point_vec;
+      point_vec << point.x, point.y, point.z;
+      KeyInt3 high_end_index;
+      if (!common::PointToVoxel(point_vec, resolution, &high_end_index)) {
+        continue;
+      }
+      update_end_voxel(point, high_end_index);
+      update_ray(point_vec, high_end_index, nullptr);
+    }
+  }
+
+  for (auto& voxel : end_voxels) {
+    high_resolution_voxels_[voxel.first].need_update = kTrue;
+  }
+}
+
+template <typename PointT>
+void MultiResolutionVoxelMap<PointT>::InsertPointCloudInShards(
+    const MultiResolutionVoxelMap<PointT>::PointCloudPtr& cloud,
+    const Eigen::Vector3f& origin) {
+  const float hit_log_odd = ProbabilityToOdd(settings_.hit_prob);
+  const float miss_log_odd = ProbabilityToOdd(settings_.miss_prob);
+  auto update_prob = [&](Probability former_prob, bool hit) -> float {
+    float odd = odds_table_[former_prob];
+    odd += hit ? hit_log_odd : miss_log_odd;
+    return Clamp(OddToProbability(odd), kMinProb, kMaxProb);
+  };
+
+  // the serial insertion handles the points one by one, so the result
+  // only depends on the index of the first point hitting each voxel
+  // (first_hit), a voxel missed by the ray of point i
+  //   1. existed before the scan and is not hit yet (i < first_hit)
+  //   2. the misses of a voxel all come before its hits
+  // so the misses are collected in parallel and applied per shard first,
+  // then the hits in the order of the points
+  const float resolution = settings_.high_resolution;
+  const int point_num = static_cast<int>(cloud->size());
+  const int thread_num = static_cast<int>(common::SharedExecutor::ThreadNum());
+  std::vector<KeyInt3> end_indices(point_num);
+  // the rays are cast in the morton order of their end voxels, so the
+  // neighbouring rays visit the same voxels one after another
+  std::vector<uint64_t> end_keys(point_num, UINT64_MAX);
+  std::vector<HighResolutionVoxel*> end_voxels(point_num, nullptr);
+  // -1 for the invalid points, kRayOnly for the ones out of the bounds
+  constexpr int8_t kRayOnly = -2;
+  std::vector<int8_t> shards(point_num, -1);
+
+  // 1. the end voxels which already exist, read only
+  common::ParallelFor(0, point_num, thread_num, [&](const int i) {
+    const auto& point = cloud->points[i];
+    const Eigen::Vector3f point_vec(point.x, point.y, point.z);
+    if (!common::PointToVoxel(point_vec, resolution, &end_indices[i])) {
+      return;
+    }
+    end_keys[i] = common::MortonEncode(end_indices[i]);
+    if (bounded_ && !bounds_.contains(end_indices[i])) {
+      shards[i] = kRayOnly;
+      return;
+    }
+    shards[i] = ShardOf(end_indices[i]);
+    auto it = high_resolution_voxels_.find(end_indices[i]);
+    if (it != high_resolution_voxels_.end()) {
+      end_voxels[i] = &it->second;
+    }
+  });
+
+  // 2. create the new voxels and mark the first hits, serial
+  for (int i = 0; i < point_num; ++i) {
+    if (shards[i] < 0) {
+      continue;
+    }
+    HighResolutionVoxel* voxel = end_voxels[i];
+    if (voxel == nullptr) {
+      voxel = &high_resolution_voxels_[end_indices[i]];
+      end_voxels[i] = voxel;
+      if (voxel->need_update == kTrue) {
+        voxel->need_update = kCreated;
+        voxel->first_hit = i;
+      }
+    } else if (voxel->need_update == kTrue) {
+      voxel->need_update = kFalse;
+      voxel->first_hit = i;
+    }
+  }
+
+  // 3. cast the rays, the misses are collected by shard
+  // the misses of a voxel are all the same update, so the order of the rays
+  // does not change the result
+  const std::vector<int> ray_order = common::MortonOrder(end_keys);
+  const int chunk_num =
+      std::max(1, std::min(thread_num * 4, point_num / kMinPointNumInChunk));
+  std::vector<std::vector<std::vector<HighResolutionVoxel*>>> misses(
+      chunk_num, std::vector<std::vector<HighResolutionVoxel*>>(
+                     kInsertionShardNum));
+  common::ParallelFor(0, chunk_num, thread_num, [&](const int chunk) {
+    auto& chunk_misses = misses[chunk];
+    const int begin = static_cast<int64_t>(point_num) * chunk / chunk_num;
+    const int end = static_cast<int64_t>(point_num) * (chunk + 1) / chunk_num;
+    for (int k = begin; k < end; ++k) {
+      const int i = ray_order[k];
+      if (shards[i] == -1) {
+        continue;
+      }
+      const auto& point = cloud->points[i];
+      const Eigen::Vector3f point_vec(point.x, point.y, point.z);
+      const KeyInt3& end_index = end_indices[i];
+      common::VisitVoxelsBresenham(
+          origin, point_vec, resolution, [&](const KeyInt3& index) {
+            if (index == end_index) {
+              return false;
+            }
+            auto it = high_resolution_voxels_.find(index);
+            if (it == high_resolution_voxels_.end()) {
+              return true;
+            }
+            HighResolutionVoxel& voxel = it->second;
+            const int need_update = voxel.need_update;
+            if (need_update == kTrue ||
+                (need_update == kFalse && i < voxel.first_hit)) {
+              chunk_misses[ShardOf(index)].push_back(&voxel);
+            } else if (i > voxel.first_hit && settings_.stop_ray_at_hit_voxel) {
+              // hit by an earlier point of this scan
+              return false;
+            }
+            // a voxel created by a later point does not exist for this ray
+            return true;
+          });
+    }
+  });
+
+  // 4. apply the misses and then the hits, each shard by its own
+  common::ParallelFor(0, kInsertionShardNum, thread_num, [&](const int shard) {
+    for (auto& chunk_misses : misses) {
+      for (HighResolutionVoxel* voxel : chunk_misses[shard]) {
+        voxel->probability =
+            (Probability)(update_prob(voxel->probability, false) * kTableSize);
+      }
+    }
+    for (int i = 0; i < point_num; ++i) {
+      if (shards[i] != shard) {
+        continue;
+      }
+      const auto& point = cloud->points[i];
+      HighResolutionVoxel& voxel = *end_voxels[i];
+      voxel.need_update = kTrue;
       if (static_cast<int>(point.intensity) >
           static_cast<int>(voxel.max_intensity)) {
         voxel.max_intensity = static_cast<int>(point.intensity);
       }
-      prob = (Probability)(update_prob(prob, true) * kTableSize);
-      if (voxel.points.size() < settings_.max_point_num_in_cell) {
-        FATAL_CHECK_POINT(point);
-        voxel.points.push_back(point);
-      }
+      voxel.probability =
+          (Probability)(update_prob(voxel.probability, true) * kTableSize);
+      AddPoint(end_indices[i], point, &voxel);
+    }
+  });
+}
 
-      // update the voxels on the line
-      const size_t indices_size = high_res_indices.size();
-      for (size_t i = 0; i < indices_size - 1; ++i) {
-        auto& high_index = high_res_indices[i];
-        if (high_resolution_voxels_.find(high_index) !=
-                high_resolution_voxels_.end() &&
-            high_resolution_voxels_[high_index].need_update == kTrue) {
-          // update the probability
-          auto& prob = high_resolution_voxels_[high_index].probability;
-          prob = (Probability)(update_prob(prob, false) * kTableSize);
-        }
-      }
+template <typename PointT>
+void MultiResolutionVoxelMap<PointT>::InsertPointCloudInTwoLevels(
+    const PointCloudPtr& cloud, const Eigen::Vector3f& origin) {
+  const float hit_log_odd = ProbabilityToOdd(settings_.hit_prob);
+  const float miss_log_odd = ProbabilityToOdd(settings_.miss_prob);
+  auto update_prob = [&](Probability former_prob, bool hit) -> Probability {
+    float odd = odds_table_[former_prob];
+    odd += hit ? hit_log_odd : miss_log_odd;
+    return (Probability)(Clamp(OddToProbability(odd), kMinProb, kMaxProb) *
+                         kTableSize);
+  };
+  const float resolution = settings_.high_resolution;
+
+  // the voxels hit in this scan, they are not missed by the other rays
+  VoxelMap<bool> end_voxels;
+  IndexVector low_end_voxels;
+  auto hit_voxel = [&](const PointT& point, const KeyInt3& index) {
+    auto& voxel = high_resolution_voxels_[index];
+    if (voxel.need_update == kTrue) {
+      voxel.need_update = kFalse;
+      end_voxels[index] = true;
+    }
+    if (static_cast<int>(point.intensity) >
+        static_cast<int>(voxel.max_intensity)) {
+      voxel.max_intensity = static_cast<int>(point.intensity);
+    }
+    voxel.probability = update_prob(voxel.probability, true);
+    AddPoint(index, point, &voxel);
+  };
+  // the coarse voxel keeps the hit until it is refined, then all of its
+  // hits go to the voxels of high resolution
+  auto update_end_voxel = [&](const PointT& point, const KeyInt3& end_index) {
+    const KeyInt3 low_end_index = LowResolutionIndex(end_index);
+    LowResolutionVoxel& low_voxel = low_resolution_voxels_[low_end_index];
+    if (low_voxel.refined) {
+      hit_voxel(point, end_index);
+      return;
+    }
+    if (low_voxel.need_update == kTrue) {
+      low_voxel.need_update = kFalse;
+      low_end_voxels.push_back(low_end_index);
+    }
+    low_voxel.max_intensity =
+        std::max(low_voxel.max_intensity, static_cast<int>(point.intensity));
+    low_voxel.probability = update_prob(low_voxel.probability, true);
+    low_voxel.points.push_back(point);
+    if (++low_voxel.hit_num < settings_.refine_hit_num) {
+      return;
+    }
+    low_voxel.refined = true;
+    for (const auto& kept_point : low_voxel.points) {
+      KeyInt3 index;
+      common::PointToVoxel(
+          Eigen::Vector3f(kept_point.x, kept_point.y, kept_point.z),
+          resolution, &index);
+      hit_voxel(kept_point, index);
+    }
+    PointVector().swap(low_voxel.points);
+  };
+  // the missed voxel, false if the ray stops at it
+  auto miss_voxel = [&](Probability* probability, const int need_update) {
+    if (need_update == kTrue) {
+      *probability = update_prob(*probability, false);
+      return true;
+    }
+    // hit by another ray of this scan, the voxels behind it are treated as
+    // occluded
+    return !settings_.stop_ray_at_hit_voxel;
+  };
+  // the coarse voxel on the ray, which is looked up only when the ray goes
+  // into it. the ones not refined are missed once for a ray as a whole, the
+  // voxels of high resolution are only looked up in the refined ones
+  struct RayCell {
+    KeyInt3 index;
+    // the first voxel of high resolution in it
+    KeyInt3 origin;
+    bool refined = false;
+  };
+  // false if the ray stops at the coarse voxel
+  auto enter_low_voxel = [&](const KeyInt3& low_end_index, RayCell* cell) {
+    cell->origin = cell->index * refine_ratio_;
+    cell->refined = false;
+    auto low_it = low_resolution_voxels_.find(cell->index);
+    if (low_it == low_resolution_voxels_.end()) {
+      return true;
+    }
+    LowResolutionVoxel& low_voxel = low_it->second;
+    cell->refined = low_voxel.refined;
+    if (low_voxel.refined || cell->index == low_end_index) {
+      return true;
+    }
+    return miss_voxel(&low_voxel.probability, low_voxel.need_update);
+  };
+  const int ratio = refine_ratio_;
+  auto update_ray = [&](const Eigen::Vector3f& ray_end,
+                        const KeyInt3& end_index) {
+    const KeyInt3 low_end_index = LowResolutionIndex(end_index);
+    KeyInt3 start_index;
+    if (!common::PointToVoxel(origin, resolution, &start_index)) {
+      return;
+    }
+    RayCell cell;
+    cell.index = LowResolutionIndex(start_index);
+    if (!enter_low_voxel(low_end_index, &cell)) {
+      return;
     }
+    common::VisitVoxelsBresenham(
+        origin, ray_end, resolution, [&](const KeyInt3& index) {
+          if (index == end_index) {
+            return false;
+          }
+          // the ray moves at most one voxel on each axis in a step, so the
+          // coarse voxel is followed without the divisions
+          const KeyInt3 offset = index - cell.origin;
+          bool moved = false;
+          for (int i = 0; i < 3; ++i) {
+            if (offset[i] < 0) {
+              --cell.index[i];
+              moved = true;
+            } else if (offset[i] >= ratio) {
+              ++cell.index[i];
+              moved = true;
+            }
+          }
+          if (moved && !enter_low_voxel(low_end_index, &cell)) {
+            return false;
+          }
+          if (!cell.refined) {
+            return true;
+          }
+          auto it = high_resolution_voxels_.find(index);
+          if (it == high_resolution_voxels_.end()) {
+            return true;
+          }
+          return miss_voxel(&it->second.probability, it->second.need_update);
+        });
+  };
+
+  for (const auto& point : cloud->points) {
+    const Eigen::Vector3f point_vec(point.x, point.y, point.z);
+    KeyInt3 end_index;
+    if (!common::PointToVoxel(point_vec, resolution, &end_index)) {
+      continue;
+    }
+    // the points out of the bounds are only used for the misses
+    if (!bounded_ || bounds_.contains(end_index)) {
+      update_end_voxel(point, end_index);
+    }
+    update_ray(point_vec, end_index);
   }
 
   for (auto& voxel : end_voxels) {
     high_resolution_voxels_[voxel.first].need_update = kTrue;
   }
+  for (const KeyInt3& index : low_end_voxels) {
+    low_resolution_voxels_[index].need_update = kTrue;
+  }
+}
+
+template <typename PointT>
+void MultiResolutionVoxelMap<PointT>::InitialiseLowResolution() {
+  low_resolution_voxels_.clear();
+  refine_ratio_ = 1;
+  if (!TwoLevels()) {
+    return;
+  }
+  if (settings_.block_storage || settings_.compact_points ||
+      settings_.gpu_insertion || settings_.discretized_insertion) {
+    PRINT_WARNING(
+        "the voxels of low resolution are only for the flat storage with the "
+        "full points and the insertion of every point, ignored.");
+    settings_.refine_hit_num = 0;
+    return;
+  }
+  refine_ratio_ = static_cast<int>(
+      std::lround(settings_.low_resolution / settings_.high_resolution));
+  CHECK_GE(refine_ratio_, 2) << "low resolution should be coarser";
+  CHECK_LT(std::fabs(refine_ratio_ * settings_.high_resolution -
+                     settings_.low_resolution),
+           1.e-3f * settings_.low_resolution)
+      << "low resolution should be a multiple of high resolution";
 }
 
 template <typename PointT>
@@ -102,42 +561,576 @@ void MultiResolutionVoxelMap<PointT>::OutputToPointCloud(
     float threshold, const PointCloudPtr& cloud) {
   if (!cloud) {
     PRINT_WARNING("cloud is nullptr. do nothing!");
+    return;
   }
   cloud->clear();
-  cloud->points.reserve(high_resolution_voxels_.size());
-  const Probability prob_threshold = threshold * kTableSize;
-  for (auto& high_res_voxel : high_resolution_voxels_) {
-    if (high_res_voxel.second.probability >= prob_threshold) {
-      CHECK(!high_res_voxel.second.points.empty());
+  // count the points of the chunks first, then fill them in place
+  const std::vector<OutputChunk> chunks = OutputChunks();
+  const int chunk_num = static_cast<int>(chunks.size());
+  const int thread_num = static_cast<int>(common::SharedExecutor::ThreadNum());
+  std::vector<size_t> offsets(chunk_num + 1, 0);
+  common::ParallelFor(0, chunk_num, thread_num, [&](const int i) {
+    offsets[i + 1] = OutputChunkPoints(chunks[i], threshold, nullptr);
+  });
+  std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+  cloud->points.resize(offsets.back());
+  cloud->width = cloud->points.size();
+  cloud->height = 1;
+  common::ParallelFor(0, chunk_num, thread_num, [&](const int i) {
+    OutputChunkPoints(chunks[i], threshold, cloud->points.data() + offsets[i]);
+  });
+}
+
+template <typename PointT>
+bool MultiResolutionVoxelMap<PointT>::OutputToPointCloud(
+    float threshold, common::PcdStreamWriter<PointT>* writer) {
+  CHECK(writer != nullptr);
+  return OutputToPointCloud(threshold, [writer](const PointCloudType& cloud) {
+    return writer->Write(cloud);
+  });
+}
+
+template <typename PointT>
+bool MultiResolutionVoxelMap<PointT>::OutputToPointCloud(
+    float threshold,
+    const std::function<bool(const PointCloudType&)>& write_function) {
+  const std::vector<OutputChunk> chunks = OutputChunks();
+  const int chunk_num = static_cast<int>(chunks.size());
+  const int thread_num = static_cast<int>(common::SharedExecutor::ThreadNum());
+  // the chunks are output in batches, and written in order
+  const int batch_size = thread_num * kOutputChunkNumPerThread;
+  std::vector<PointCloudType> clouds(std::min(batch_size, chunk_num));
+  for (int first = 0; first < chunk_num; first += batch_size) {
+    const int last = std::min(first + batch_size, chunk_num);
+    common::ParallelFor(first, last, thread_num, [&](const int i) {
+      PointCloudType& cloud = clouds[i - first];
+      cloud.points.resize(OutputChunkPoints(chunks[i], threshold, nullptr));
+      OutputChunkPoints(chunks[i], threshold, cloud.points.data());
+    });
+    for (int i = first; i < last; ++i) {
+      if (!write_function(clouds[i - first])) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
 
+template <typename PointT>
+std::vector<typename MultiResolutionVoxelMap<PointT>::OutputChunk>
+MultiResolutionVoxelMap<PointT>::OutputChunks() const {
+  std::vector<OutputChunk> chunks;
+  if (block_voxels_ || OnDevice()) {
+    size_t num = 0;
+    size_t chunk_size = kOutputChunkVoxelNum;
+    if (block_voxels_) {
+      num = block_voxels_->BlockNum();
+      chunk_size /= BlockVoxelMap<PointT>::kLeafVoxelNum;
+    }
+#ifdef _VOXEL_MAP_USE_CUDA_
+    if (device_voxels_) {
+      num = device_voxels_->VoxelNum();
+    }
+#endif
+    for (size_t first = 0; first < num; first += chunk_size) {
+      OutputChunk chunk;
+      chunk.first = first;
+      chunk.last = std::min(first + chunk_size, num);
+      chunks.push_back(chunk);
+    }
+    return chunks;
+  }
+  // the iterators of the tbb map are not random access, so the chunks are
+  // split in one pass
+  const auto voxels_end = high_resolution_voxels_.end();
+  auto it = high_resolution_voxels_.begin();
+  while (it != voxels_end) {
+    OutputChunk chunk;
+    chunk.begin = it;
+    for (size_t i = 0; i < kOutputChunkVoxelNum && it != voxels_end; ++i) {
+      ++it;
+    }
+    chunk.end = it;
+    chunks.push_back(chunk);
+  }
+  // then the coarse voxels not refined
+  const auto low_voxels_end = low_resolution_voxels_.end();
+  auto low_it = low_resolution_voxels_.begin();
+  while (low_it != low_voxels_end) {
+    OutputChunk chunk;
+    chunk.low_resolution = true;
+    chunk.low_begin = low_it;
+    for (size_t i = 0; i < kOutputChunkVoxelNum && low_it != low_voxels_end;
+         ++i) {
+      ++low_it;
+    }
+    chunk.low_end = low_it;
+    chunks.push_back(chunk);
+  }
+  return chunks;
+}
+
+template <typename PointT>
+size_t MultiResolutionVoxelMap<PointT>::OutputChunkPoints(
+    const OutputChunk& chunk, float threshold, PointT* points) const {
+  if (block_voxels_) {
+    return block_voxels_->OutputBlocks(threshold, settings_, chunk.first,
+                                       chunk.last, points);
+  }
+  const Probability prob_threshold = threshold * kTableSize;
+#ifdef _VOXEL_MAP_USE_CUDA_
+  if (device_voxels_) {
+    if (points == nullptr) {
+      return device_voxels_->CountOccupiedPoints(
+          prob_threshold, chunk.first, chunk.last, settings_.output_average);
+    }
+    cuda::OccupiedVoxels voxels;
+    CHECK(device_voxels_->DownloadOccupied(prob_threshold, chunk.first,
+                                           chunk.last, &voxels));
+    size_t output_num = 0;
+    for (size_t i = 0; i < voxels.point_nums.size(); ++i) {
+      const int point_num = voxels.point_nums[i];
+      CHECK_GT(point_num, 0);
+      const float* values = &voxels.points[4 * i * voxels.max_point_num];
       if (settings_.output_average) {
         PointT average_point;
-        for (auto& point : high_res_voxel.second.points) {
-          average_point.x += point.x;
-          average_point.y += point.y;
-          average_point.z += point.z;
-          average_point.intensity += point.intensity;
+        // summed apart, the intensity of PointXYZIc is an integer
+        float intensity_sum = 0.f;
+        for (int j = 0; j < point_num; ++j) {
+          average_point.x += values[4 * j];
+          average_point.y += values[4 * j + 1];
+          average_point.z += values[4 * j + 2];
+          intensity_sum += values[4 * j + 3];
         }
-        float size = high_res_voxel.second.points.size();
+        float size = point_num;
         average_point.x /= size;
         average_point.y /= size;
         average_point.z /= size;
-        average_point.intensity /= size;
+        average_point.intensity = intensity_sum / size;
 
-        cloud->push_back(average_point);
+        points[output_num++] = average_point;
       } else {
-        for (auto& point : high_res_voxel.second.points) {
-          // FATAL_CHECK_POINT(point);
-          point.intensity =
-              static_cast<int>(high_res_voxel.second.max_intensity);
-          cloud->points.push_back(point);
+        for (int j = 0; j < point_num; ++j) {
+          PointT& output_point = points[output_num++];
+          output_point.x = values[4 * j];
+          output_point.y = values[4 * j + 1];
+          output_point.z = values[4 * j + 2];
+          output_point.intensity = voxels.max_intensities[i];
         }
       }
     }
+    return output_num;
+  }
+#endif
+  size_t output_num = 0;
+  if (chunk.low_resolution) {
+    for (auto it = chunk.low_begin; it != chunk.low_end; ++it) {
+      const LowResolutionVoxel& voxel = it->second;
+      if (voxel.refined || voxel.probability < prob_threshold ||
+          voxel.points.empty()) {
+        continue;
+      }
+      if (points == nullptr) {
+        output_num += settings_.output_average ? 1 : voxel.points.size();
+        continue;
+      }
+      output_num += OutputVoxelPoints(voxel.points, voxel.max_intensity,
+                                      points + output_num);
+    }
+    return output_num;
+  }
+  PointVector buffer;
+  for (auto it = chunk.begin; it != chunk.end; ++it) {
+    const HighResolutionVoxel& voxel = it->second;
+    if (voxel.probability < prob_threshold) {
+      continue;
+    }
+    if (points == nullptr) {
+      output_num += settings_.output_average
+                        ? 1
+                        : (settings_.compact_points ? voxel.point_num
+                                                    : voxel.points.size());
+      continue;
+    }
+    const PointVector& voxel_points = GetPoints(it->first, voxel, &buffer);
+    CHECK(!voxel_points.empty());
+    output_num += OutputVoxelPoints(voxel_points, voxel.max_intensity,
+                                    points + output_num);
+  }
+  return output_num;
+}
+
+template <typename PointT>
+size_t MultiResolutionVoxelMap<PointT>::OutputVoxelPoints(
+    const PointVector& voxel_points, const int max_intensity,
+    PointT* points) const {
+  if (settings_.output_average) {
+    PointT average_point;
+    float intensity_sum = 0.f;
+    for (auto& point : voxel_points) {
+      average_point.x += point.x;
+      average_point.y += point.y;
+      average_point.z += point.z;
+      intensity_sum += point.intensity;
+    }
+    float size = voxel_points.size();
+    average_point.x /= size;
+    average_point.y /= size;
+    average_point.z /= size;
+    average_point.intensity = intensity_sum / size;
+
+    points[0] = average_point;
+    return 1;
+  }
+  size_t output_num = 0;
+  for (auto& point : voxel_points) {
+    // FATAL_CHECK_POINT(point);
+    PointT& output_point = points[output_num++];
+    output_point = point;
+    output_point.intensity = max_intensity;
+  }
+  return output_num;
+}
+
+template <typename PointT>
+void MultiResolutionVoxelMap<PointT>::AddPoint(const KeyInt3& index,
+                                               const PointT& point,
+                                               HighResolutionVoxel* voxel) {
+  if (!settings_.compact_points) {
+    if (voxel->points.size() < settings_.max_point_num_in_cell) {
+      FATAL_CHECK_POINT(point);
+      voxel->points.push_back(point);
+    }
+    return;
+  }
+  if (voxel->point_num >= settings_.max_point_num_in_cell) {
+    return;
+  }
+  FATAL_CHECK_POINT(point);
+  const float resolution = settings_.high_resolution;
+  auto quantize = [resolution](float value, int index) -> uint16_t {
+    // the offset in the voxel is in [0, 1)
+    const float offset = value / resolution - index;
+    return Clamp(static_cast<int>(offset * 65536.f), 0, 65535);
+  };
+  CompactPoint compact_point;
+  compact_point.x = quantize(point.x, index[0]);
+  compact_point.y = quantize(point.y, index[1]);
+  compact_point.z = quantize(point.z, index[2]);
+  compact_point.intensity =
+      Clamp(static_cast<int>(std::lround(point.intensity)), 0, 255);
+
+  // find the last chunk, a new one is needed if it is full
+  PointArena& arena = point_arenas_[ShardOf(index)];
+  const int offset_in_chunk = voxel->point_num % kCompactChunkSize;
+  uint32_t chunk = voxel->first_chunk;
+  for (int i = 1; i < (voxel->point_num + kCompactChunkSize - 1) /
+                          kCompactChunkSize;
+       ++i) {
+    chunk = arena.next_chunks[chunk];
+  }
+  if (offset_in_chunk == 0) {
+    const uint32_t new_chunk = arena.next_chunks.size();
+    arena.next_chunks.push_back(kNoChunk);
+    arena.points.resize(arena.points.size() + kCompactChunkSize);
+    if (chunk == kNoChunk) {
+      voxel->first_chunk = new_chunk;
+    } else {
+      arena.next_chunks[chunk] = new_chunk;
+    }
+    chunk = new_chunk;
   }
-  cloud->points.shrink_to_fit();
+  arena.points[chunk * kCompactChunkSize + offset_in_chunk] = compact_point;
+  ++voxel->point_num;
+}
+
+template <typename PointT>
+const typename MultiResolutionVoxelMap<PointT>::PointVector&
+MultiResolutionVoxelMap<PointT>::GetPoints(const KeyInt3& index,
+                                           const HighResolutionVoxel& voxel,
+                                           PointVector* buffer) const {
+  if (!settings_.compact_points) {
+    return voxel.points;
+  }
+  const float resolution = settings_.high_resolution;
+  auto dequantize = [resolution](uint16_t value, int index) -> float {
+    return (index + (value + 0.5f) / 65536.f) * resolution;
+  };
+  const PointArena& arena = point_arenas_[ShardOf(index)];
+  buffer->clear();
+  uint32_t chunk = voxel.first_chunk;
+  for (int i = 0; i < voxel.point_num; ++i) {
+    if (i > 0 && i % kCompactChunkSize == 0) {
+      chunk = arena.next_chunks[chunk];
+    }
+    const CompactPoint& compact_point =
+        arena.points[chunk * kCompactChunkSize + i % kCompactChunkSize];
+    PointT point;
+    point.x = dequantize(compact_point.x, index[0]);
+    point.y = dequantize(compact_point.y, index[1]);
+    point.z = dequantize(compact_point.z, index[2]);
+    point.intensity = compact_point.intensity;
+    buffer->push_back(point);
+  }
+  return *buffer;
+}
+
+namespace {
+constexpr uint32_t kVoxelFileMagic = 0x4c584f56;  // "VOXL"
+}  // namespace
+
+template <typename PointT>
+bool MultiResolutionVoxelMap<PointT>::SaveVoxels(const std::string& filename) {
+  CHECK(block_voxels_ == nullptr && !OnDevice()) << "only for the flat storage";
+  std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+  if (!file.good()) {
+    PRINT_ERROR_FMT("failed to open %s", filename.c_str());
+    return false;
+  }
+  auto write = [&file](const void* data, const size_t size) {
+    file.write(reinterpret_cast<const char*>(data), size);
+  };
+  const uint64_t voxel_num = high_resolution_voxels_.size();
+  write(&kVoxelFileMagic, sizeof(kVoxelFileMagic));
+  write(&voxel_num, sizeof(voxel_num));
+  PointVector buffer;
+  std::vector<float> values;
+  for (auto& high_res_voxel : high_resolution_voxels_) {
+    const KeyInt3& index = high_res_voxel.first;
+    const HighResolutionVoxel& voxel = high_res_voxel.second;
+    const PointVector& points = GetPoints(index, voxel, &buffer);
+    const int32_t key[3] = {index[0], index[1], index[2]};
+    const int32_t max_intensity = voxel.max_intensity;
+    const uint32_t point_num = points.size();
+    write(key, sizeof(key));
+    write(&voxel.probability, sizeof(voxel.probability));
+    write(&max_intensity, sizeof(max_intensity));
+    write(&point_num, sizeof(point_num));
+    values.clear();
+    for (const auto& point : points) {
+      values.insert(values.end(), {point.x, point.y, point.z,
+                                   static_cast<float>(point.intensity)});
+    }
+    write(values.data(), values.size() * sizeof(float));
+  }
+  // the coarse voxels in an optional section after the high resolution ones
+  const uint64_t low_voxel_num = low_resolution_voxels_.size();
+  if (low_voxel_num > 0) {
+    write(&low_voxel_num, sizeof(low_voxel_num));
+  }
+  for (auto& low_res_voxel : low_resolution_voxels_) {
+    const KeyInt3& index = low_res_voxel.first;
+    const LowResolutionVoxel& voxel = low_res_voxel.second;
+    const int32_t key[3] = {index[0], index[1], index[2]};
+    const int32_t state[3] = {voxel.refined ? 1 : 0, voxel.hit_num,
+                              voxel.max_intensity};
+    const uint32_t point_num = voxel.points.size();
+    write(key, sizeof(key));
+    write(&voxel.probability, sizeof(voxel.probability));
+    write(state, sizeof(state));
+    write(&point_num, sizeof(point_num));
+    values.clear();
+    for (const auto& point : voxel.points) {
+      values.insert(values.end(), {point.x, point.y, point.z,
+                                   static_cast<float>(point.intensity)});
+    }
+    write(values.data(), values.size() * sizeof(float));
+  }
+  return file.good();
+}
+
+template <typename PointT>
+bool MultiResolutionVoxelMap<PointT>::LoadVoxels(const std::string& filename) {
+  CHECK(block_voxels_ == nullptr && !OnDevice()) << "only for the flat storage";
+  CHECK(high_resolution_voxels_.empty());
+  std::ifstream file(filename, std::ios::binary);
+  auto read = [&file](void* data, const size_t size) {
+    file.read(reinterpret_cast<char*>(data), size);
+    return file.good();
+  };
+  uint32_t magic = 0;
+  uint64_t voxel_num = 0;
+  if (!read(&magic, sizeof(magic)) || magic != kVoxelFileMagic ||
+      !read(&voxel_num, sizeof(voxel_num))) {
+    PRINT_ERROR_FMT("%s is not a voxel file", filename.c_str());
+    return false;
+  }
+  std::vector<float> values;
+  for (uint64_t i = 0; i < voxel_num; ++i) {
+    int32_t key[3];
+    Probability probability;
+    int32_t max_intensity;
+    uint32_t point_num;
+    if (!read(key, sizeof(key)) ||
+        !read(&probability, sizeof(probability)) ||
+        !read(&max_intensity, sizeof(max_intensity)) ||
+        !read(&point_num, sizeof(point_num))) {
+      PRINT_ERROR_FMT("%s is truncated", filename.c_str());
+      return false;
+    }
+    values.resize(point_num * 4);
+    if (!read(values.data(), values.size() * sizeof(float))) {
+      PRINT_ERROR_FMT("%s is truncated", filename.c_str());
+      return false;
+    }
+    const KeyInt3 index(key[0], key[1], key[2]);
+    HighResolutionVoxel& voxel = high_resolution_voxels_[index];
+    voxel.probability = probability;
+    voxel.max_intensity = max_intensity;
+    for (uint32_t j = 0; j < point_num; ++j) {
+      PointT point;
+      point.x = values[j * 4];
+      point.y = values[j * 4 + 1];
+      point.z = values[j * 4 + 2];
+      point.intensity = values[j * 4 + 3];
+      AddPoint(index, point, &voxel);
+    }
+  }
+  // the files without the coarse voxels end here
+  uint64_t low_voxel_num = 0;
+  if (!read(&low_voxel_num, sizeof(low_voxel_num))) {
+    low_voxel_num = 0;
+  }
+  for (uint64_t i = 0; i < low_voxel_num; ++i) {
+    int32_t key[3];
+    Probability probability;
+    int32_t state[3];
+    uint32_t point_num;
+    if (!read(key, sizeof(key)) ||
+        !read(&probability, sizeof(probability)) ||
+        !read(state, sizeof(state)) || !read(&point_num, sizeof(point_num))) {
+      PRINT_ERROR_FMT("%s is truncated", filename.c_str());
+      return false;
+    }
+    values.resize(point_num * 4);
+    if (!read(values.data(), values.size() * sizeof(float))) {
+      PRINT_ERROR_FMT("%s is truncated", filename.c_str());
+      return false;
+    }
+    LowResolutionVoxel& voxel =
+        low_resolution_voxels_[KeyInt3(key[0], key[1], key[2])];
+    voxel.probability = probability;
+    voxel.refined = state[0] != 0;
+    voxel.hit_num = state[1];
+    voxel.max_intensity = state[2];
+    for (uint32_t j = 0; j < point_num; ++j) {
+      PointT point;
+      point.x = values[j * 4];
+      point.y = values[j * 4 + 1];
+      point.z = values[j * 4 + 2];
+      point.intensity = values[j * 4 + 3];
+      voxel.points.push_back(point);
+    }
+  }
+  if (common::MemoryAccountingEnabled()) {
+    tracked_bytes_.Set(MemoryBytes());
+  }
+  return true;
+}
+
+template <typename PointT>
+void MultiResolutionVoxelMap<PointT>::InitialiseDevice() {
+#ifdef _VOXEL_MAP_USE_CUDA_
+  device_voxels_.reset();
+  if (!settings_.gpu_insertion) {
+    return;
+  }
+  if (settings_.block_storage || settings_.compact_points ||
+      settings_.discretized_insertion) {
+    PRINT_WARNING(
+        "gpu insertion is only for the flat storage with the full points and "
+        "the insertion of every point, ignored.");
+    return;
+  }
+  // the same as update_prob in InsertPointCloud, so the probabilities are
+  // the same as the ones on host
+  const float hit_log_odd = ProbabilityToOdd(settings_.hit_prob);
+  const float miss_log_odd = ProbabilityToOdd(settings_.miss_prob);
+  static_assert(kTableSize == cuda::kProbabilityNum,
+                "the probabilities on device are 8 bits");
+  cuda::ProbabilityTables tables;
+  for (size_t i = 0; i < kTableSize; ++i) {
+    float hit_odd = odds_table_[i];
+    hit_odd += hit_log_odd;
+    float miss_odd = odds_table_[i];
+    miss_odd += miss_log_odd;
+    tables.hit[i] = (Probability)(
+        Clamp(OddToProbability(hit_odd), kMinProb, kMaxProb) * kTableSize);
+    tables.miss[i] = (Probability)(
+        Clamp(OddToProbability(miss_odd), kMinProb, kMaxProb) * kTableSize);
+  }
+  device_voxels_.reset(new cuda::DeviceVoxelMap(
+      settings_.max_point_num_in_cell, settings_.stop_ray_at_hit_voxel,
+      tables));
+#else
+  if (settings_.gpu_insertion) {
+    PRINT_WARNING("built without cuda, gpu insertion is ignored.");
+  }
+#endif
+}
+
+#ifdef _VOXEL_MAP_USE_CUDA_
+template <typename PointT>
+void MultiResolutionVoxelMap<PointT>::InsertPointCloudOnDevice(
+    const PointCloudPtr& cloud, const KeyInt3& origin_index) {
+  // the end voxels are found on host, so they are the same as the ones of
+  // the host storage, 0 for the invalid points, 1 for the hits and 2 for
+  // the ones out of the bounds (only their rays are cast)
+  const int point_num = static_cast<int>(cloud->size());
+  std::vector<float> points(4 * point_num);
+  std::vector<int> end_indices(4 * point_num);
+  const int thread_num = static_cast<int>(common::SharedExecutor::ThreadNum());
+  common::ParallelFor(0, point_num, thread_num, [&](const int i) {
+        const auto& point = cloud->points[i];
+        points[4 * i] = point.x;
+        points[4 * i + 1] = point.y;
+        points[4 * i + 2] = point.z;
+        points[4 * i + 3] = point.intensity;
+        KeyInt3 end_index;
+        int* end = &end_indices[4 * i];
+        if (!common::PointToVoxel(Eigen::Vector3f(point.x, point.y, point.z),
+                                  settings_.high_resolution, &end_index)) {
+          end[0] = end[1] = end[2] = end[3] = 0;
+          return;
+        }
+        end[0] = end_index[0];
+        end[1] = end_index[1];
+        end[2] = end_index[2];
+        end[3] = (bounded_ && !bounds_.contains(end_index)) ? 2 : 1;
+      });
+  CHECK(device_voxels_->InsertPointCloud(points.data(), end_indices.data(),
+                                         point_num, origin_index.data()))
+      << "failed to insert the cloud on device";
+}
+#endif
+
+template <typename PointT>
+size_t MultiResolutionVoxelMap<PointT>::MemoryBytes() const {
+  // the value and about 2 slots (12 bytes each) in the hash table
+  constexpr size_t kVoxelBytes =
+      sizeof(std::pair<const KeyInt3, HighResolutionVoxel>) + 24;
+  size_t bytes = high_resolution_voxels_.size() * kVoxelBytes;
+  if (settings_.compact_points) {
+    for (const auto& arena : point_arenas_) {
+      bytes += arena.points.capacity() * sizeof(CompactPoint) +
+               arena.next_chunks.capacity() * sizeof(uint32_t);
+    }
+  } else {
+    for (const auto& high_res_voxel : high_resolution_voxels_) {
+      bytes += high_res_voxel.second.points.capacity() * sizeof(PointT);
+    }
+  }
+  bytes += low_resolution_voxels_.size() *
+           (sizeof(std::pair<const KeyInt3, LowResolutionVoxel>) + 24);
+  for (const auto& low_res_voxel : low_resolution_voxels_) {
+    bytes += low_res_voxel.second.points.capacity() * sizeof(PointT);
+  }
+  return bytes;
 }
 
 template class MultiResolutionVoxelMap<pcl::PointXYZI>;
+#ifdef _USE_COMPACT_POINT_
+template class MultiResolutionVoxelMap<PointXYZIc>;
+#endif
 
 }  // namespace static_map
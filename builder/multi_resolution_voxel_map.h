@@ -24,7 +24,8 @@
 #define BUILDER_MULTI_RESOLUTION_VOXEL_MAP_H_
 
 // stl
-#include <map>
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 // third party
@@ -33,9 +34,18 @@
 #include "pcl/point_cloud.h"
 #include "pcl/point_types.h"
 // local
+#include "builder/block_voxel_map.h"
 #include "common/eigen_hash.h"
 #include "common/macro_defines.h"
 #include "common/math.h"
+#include "common/metrics.h"
+#include "common/morton.h"
+#include "common/pcd_stream_writer.h"
+#include "common/pcd_writer.h"
+#include "common/voxel_hash_map.h"
+#ifdef _VOXEL_MAP_USE_CUDA_
+#include "builder/cuda/voxel_map_cuda.h"
+#endif
 
 #if defined _OPENMP && defined _USE_TBB_
 #include <tbb/atomic.h>
@@ -60,16 +70,59 @@ constexpr float kMinProb = 0.1f;
 
 constexpr int kTrue = 1;
 constexpr int kFalse = 0;
+// need_update of a voxel already missed in the current scan
+// only used by the discretized insertion
+constexpr int kMissed = 2;
+// need_update of a voxel created in the current scan
+// only used by the insertion in shards
+constexpr int kCreated = 3;
+
+// the insertion in shards is used for the clouds with at least
+// kMinPointNumInShards points if the shared executor has more than one thread
+constexpr int kMinPointNumInShards = 4096;
+constexpr int kMinPointNumInChunk = 256;
+constexpr int kInsertionShardBits = 6;
+constexpr int kInsertionShardNum = 1 << kInsertionShardBits;
+
+// the compact points are kept in chunks of kCompactChunkSize points
+constexpr int kCompactChunkSize = 4;
+constexpr uint32_t kNoChunk = UINT32_MAX;
+
+// the voxels are output in parallel in chunks of kOutputChunkVoxelNum
+// voxels, the streaming output keeps kOutputChunkNumPerThread chunks for
+// each thread in memory
+constexpr size_t kOutputChunkVoxelNum = 1 << 16;
+constexpr int kOutputChunkNumPerThread = 2;
 
 struct MrvmSettings {
   bool output_average = false;
   float prob_threshold = 0.6f;
-  float low_resolution = 1.f;  // not in use any more
+  // a voxel of low_resolution keeps its hits itself until it gets
+  // "refine_hit_num" of them, then it is refined into the voxels of
+  // high_resolution. the far and sparse areas stay coarse, a ray misses a
+  // coarse voxel not refined once and looks up no voxel of high resolution
+  // in it. 0 for the voxels of high_resolution everywhere, low_resolution
+  // should be a multiple of high_resolution then
+  float low_resolution = 1.f;
+  int refine_hit_num = 0;
   float high_resolution = 0.1f;
   float hit_prob = 0.55f;
   float miss_prob = 0.48f;
   float z_offset = 0.f;
   int max_point_num_in_cell = 10;
+  // stop a ray at the first voxel hit by another point of the same scan
+  bool stop_ray_at_hit_voxel = false;
+  // cast one ray for each end voxel and miss a voxel at most once in a scan
+  bool discretized_insertion = false;
+  // use BlockVoxelMap as the storage of the voxels
+  bool block_storage = false;
+  // keep the points of the voxels quantized (8 bytes for each point)
+  // only for the flat storage
+  bool compact_points = false;
+  // insert the clouds on device (in the builds with USE_CUDA), the voxels
+  // are only downloaded for the output, only for the flat storage with the
+  // full points and the insertion of every point
+  bool gpu_insertion = false;
 };
 
 using common::Clamp;
@@ -100,15 +153,8 @@ class MultiResolutionVoxelMap {
   using IndexVector = std::vector<KeyInt3>;
   using AtomicBool = std::atomic<int>;
   using AtomicInt = std::atomic<int>;
-
-  struct VectorCompare {
-    bool operator()(const KeyInt3 a, const KeyInt3 b) const {
-      return std::forward_as_tuple(a[0], a[1], a[2]) <
-             std::forward_as_tuple(b[0], b[1], b[2]);
-    }
-  };
   template <typename T>
-  using VoxelMap = std::map<KeyInt3, T, VectorCompare>;
+  using VoxelMap = common::VoxelHashMap<T>;
 #endif
 
   MultiResolutionVoxelMap() {
@@ -121,19 +167,58 @@ class MultiResolutionVoxelMap {
   MultiResolutionVoxelMap(const MultiResolutionVoxelMap&) = delete;
   MultiResolutionVoxelMap& operator=(const MultiResolutionVoxelMap&) = delete;
 
+  /// @note with the memory accounting, the "memory.voxel_maps.bytes" gauge
+  /// is updated from MemoryBytes() after each insertion
   void InsertPointCloud(const PointCloudPtr& cloud,
                         const Eigen::Vector3f& origin);
-
+  /// @brief only the hits of the points, no ray is cast, for the clouds
+  /// whose dynamic points are removed already (see VisibilityRemover)
+  /// @notice only for the flat storage with the voxels of high resolution,
+  /// the others insert the cloud with the rays from the origin
+  void AggregatePointCloud(const PointCloudPtr& cloud,
+                           const Eigen::Vector3f& origin);
+
+  /// @brief output the voxels over the threshold in parallel, the cloud is
+  /// allocated once with the number of the output points
   void OutputToPointCloud(float threshold, const PointCloudPtr& cloud);
-
+  /// @brief output the voxels over the threshold chunk by chunk into the
+  /// writer, the whole cloud is never in memory
+  /// @return false if the writer fails
+  bool OutputToPointCloud(float threshold,
+                          common::PcdStreamWriter<PointT>* writer);
+  /// @brief the chunks are given to the function in order, it returns
+  /// false to stop
+  bool OutputToPointCloud(
+      float threshold,
+      const std::function<bool(const PointCloudType&)>& write_function);
+
+  // save/load the voxels of the flat storage, the voxels are loaded into
+  // an empty map, return false if the file can not be written/read
+  bool SaveVoxels(const std::string& filename);
+  bool LoadVoxels(const std::string& filename);
+  // the memory of the voxels and points, roughly
+  size_t MemoryBytes() const;
+
+  /// @param compress the compressed pcd needs the whole cloud in memory,
+  /// the binary one is streamed
   void OutputToPointCloud(float threshold, const std::string& filename,
                           bool compress = true) {
+    if (!compress) {
+      common::PcdStreamWriter<PointT> writer;
+      if (!writer.Open(filename) || !OutputToPointCloud(threshold, &writer) ||
+          !writer.Close()) {
+        PRINT_ERROR_FMT("failed to write %s", filename.c_str());
+      } else if (writer.PointNum() == 0) {
+        PRINT_WARNING("Cloud is empty.");
+      }
+      return;
+    }
     PointCloudPtr output_cloud(new PointCloudType);
     OutputToPointCloud(threshold, output_cloud);
     PRINT_INFO("Finished filtering output cloud, generating pcd file.");
     if (!output_cloud->empty()) {
       if (compress) {
-        pcl::io::savePCDFileBinaryCompressed(filename, *output_cloud);
+        common::SavePcdFile(filename, *output_cloud);
       } else {
         pcl::io::savePCDFileBinary(filename, *output_cloud);
       }
@@ -156,6 +241,13 @@ class MultiResolutionVoxelMap {
     settings_.high_resolution = res;
   }
   inline void SetOffsetZ(const float& offset) { settings_.z_offset = offset; }
+  // only the voxels in the bounds are kept, the points out of them are
+  // only used for the misses of their rays (for the tiles of TiledVoxelMap)
+  // @notice stop_ray_at_hit_voxel ignores the hits out of the bounds
+  inline void SetBounds(const Eigen::AlignedBox3i& bounds) {
+    bounded_ = true;
+    bounds_ = bounds;
+  }
 
   // Getter for the inner parameters
   inline float GetHitProbability() const { return settings_.hit_prob; }
@@ -174,24 +266,161 @@ class MultiResolutionVoxelMap {
 
     settings_.hit_prob = Clamp(settings_.hit_prob, kMinHitProb, kMaxProb);
     settings_.miss_prob = Clamp(settings_.miss_prob, kMinProb, kMaxMissProb);
+    if (settings_.compact_points) {
+      CHECK_LE(settings_.max_point_num_in_cell, UINT8_MAX);
+      point_arenas_.resize(kInsertionShardNum);
+    }
+    if (settings_.block_storage) {
+      CHECK_LE(settings_.max_point_num_in_cell, UINT8_MAX);
+      block_voxels_.reset(new BlockVoxelMap<PointT>);
+    } else {
+      block_voxels_.reset();
+    }
+    InitialiseLowResolution();
+    InitialiseDevice();
   }
 
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
  private:
+  void InsertPointCloudInside(const PointCloudPtr& cloud,
+                              const Eigen::Vector3f& origin);
+  // deterministic parallel insertion, the result is identical to the serial
+  // one, the voxels are partitioned into shards by their spatial hash and
+  // each shard is updated by one thread only
+  void InsertPointCloudInShards(const PointCloudPtr& cloud,
+                                const Eigen::Vector3f& origin);
+  // the two-level insertion if the settings "refine_hit_num" is on, serial
+  void InsertPointCloudInTwoLevels(const PointCloudPtr& cloud,
+                                   const Eigen::Vector3f& origin);
+  void InitialiseLowResolution();
+  inline bool TwoLevels() const { return settings_.refine_hit_num > 0; }
+  inline KeyInt3 LowResolutionIndex(const KeyInt3& index) const {
+    // rounded down for the negative indices as well
+    return KeyInt3(common::FloorDiv(index[0], refine_ratio_),
+                   common::FloorDiv(index[1], refine_ratio_),
+                   common::FloorDiv(index[2], refine_ratio_));
+  }
+  // the voxels are on device if the settings "gpu_insertion" is on
+  void InitialiseDevice();
+  inline bool OnDevice() const {
+#ifdef _VOXEL_MAP_USE_CUDA_
+    return device_voxels_ != nullptr;
+#else
+    return false;
+#endif
+  }
+#ifdef _VOXEL_MAP_USE_CUDA_
+  void InsertPointCloudOnDevice(const PointCloudPtr& cloud,
+                                const KeyInt3& origin_index);
+#endif
+
   struct HighResolutionVoxel {
     HighResolutionVoxel()
-        : probability(kUnknown), need_update(kTrue), max_intensity(0) {}
+        : probability(kUnknown),
+          point_num(0),
+          need_update(kTrue),
+          max_intensity(0),
+          first_hit(0),
+          first_chunk(kNoChunk) {}
     Probability probability;
+    // the number of the compact points
+    uint8_t point_num;
     AtomicBool need_update;
     AtomicInt max_intensity;
+    // the index of the first point hitting it in the current scan
+    // only used by the insertion in shards
+    int first_hit;
+    // the first chunk of the compact points in the arena of its shard
+    uint32_t first_chunk;
+    PointVector points;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+
+  // a voxel of low resolution, with the hits until it is refined
+  // only used by the two-level insertion, which is serial
+  struct LowResolutionVoxel {
+    Probability probability = kUnknown;
+    bool refined = false;
+    int need_update = kTrue;
+    int hit_num = 0;
+    int max_intensity = 0;
     PointVector points;
 
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
   };
 
+  // a point quantized in its voxel, 16 bits for each axis
+  struct CompactPoint {
+    uint16_t x, y, z;
+    uint8_t intensity;
+  };
+  // the compact points of the voxels in a shard, chunk i is made of
+  // points[i * kCompactChunkSize, (i + 1) * kCompactChunkSize)
+  struct PointArena {
+    std::vector<CompactPoint> points;
+    std::vector<uint32_t> next_chunks;
+  };
+
+  static inline int ShardOf(const KeyInt3& index) {
+    return static_cast<int>(
+        common::HashVoxelKey(common::PackVoxelKey(index)) >>
+        (64 - kInsertionShardBits));
+  }
+
+  using HighResolutionVoxelIterator =
+      typename VoxelMap<HighResolutionVoxel>::const_iterator;
+  using LowResolutionVoxelIterator =
+      typename VoxelMap<LowResolutionVoxel>::const_iterator;
+  // the voxels of the flat storage (of high or low resolution), or
+  // [first, last) of the leaf blocks of the block storage or the voxels on
+  // device, which are output together
+  struct OutputChunk {
+    HighResolutionVoxelIterator begin;
+    HighResolutionVoxelIterator end;
+    bool low_resolution = false;
+    LowResolutionVoxelIterator low_begin;
+    LowResolutionVoxelIterator low_end;
+    size_t first = 0;
+    size_t last = 0;
+  };
+  std::vector<OutputChunk> OutputChunks() const;
+  // output the points of the chunk into 'points', they are only counted if
+  // it is nullptr, return the number of the points
+  size_t OutputChunkPoints(const OutputChunk& chunk, float threshold,
+                           PointT* points) const;
+  // the points of a voxel, or their average
+  size_t OutputVoxelPoints(const PointVector& voxel_points, int max_intensity,
+                           PointT* points) const;
+
+  // keep the point in the voxel if it is not full
+  // @notice the voxels of different shards can be updated in parallel
+  void AddPoint(const KeyInt3& index, const PointT& point,
+                HighResolutionVoxel* voxel);
+  // the points of the voxel, decoded into 'buffer' if they are compact
+  const PointVector& GetPoints(const KeyInt3& index,
+                               const HighResolutionVoxel& voxel,
+                               PointVector* buffer) const;
+
   VoxelMap<HighResolutionVoxel> high_resolution_voxels_;
+  // the coarse voxels if the settings "refine_hit_num" is on
+  VoxelMap<LowResolutionVoxel> low_resolution_voxels_;
+  // low_resolution / high_resolution
+  int refine_ratio_ = 1;
+  // not nullptr if the settings "block_storage" is on
+  std::unique_ptr<BlockVoxelMap<PointT>> block_voxels_;
+  // one for each shard if the settings "compact_points" is on
+  std::vector<PointArena> point_arenas_;
+  // the share in the gauge of the memory accounting
+  common::TrackedBytes tracked_bytes_{common::MemoryGauge("voxel_maps")};
+#ifdef _VOXEL_MAP_USE_CUDA_
+  // not nullptr if the settings "gpu_insertion" is on
+  std::unique_ptr<cuda::DeviceVoxelMap> device_voxels_;
+#endif
   MrvmSettings settings_;
+  bool bounded_ = false;
+  Eigen::AlignedBox3i bounds_;
 
   float odds_table_[kTableSize];
 };
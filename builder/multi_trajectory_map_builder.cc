@@ -20,28 +20,110 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
+// stl
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iomanip>
+#include <set>
+#include <sstream>
+#include <utility>
 // local
 #include "builder/multi_trajectory_map_builder.h"
 #include "common/file_utils.h"
 #include "common/math.h"
+#include "common/metrics.h"
+#include "common/pcd_writer.h"
 #include "common/pugixml.hpp"
+#include "common/shared_executor.h"
+#include "common/trajectory_writer.h"
 
 namespace static_map {
 
-// refer to
-// http://www.martinbroadhurst.com/how-to-split-a-string-in-c.html
-template <class Container>
-void split(const std::string& str, Container* cont, char delim = ' ') {
-  std::stringstream ss(str);
-  std::string token;
-  while (std::getline(ss, token, delim)) {
-    cont->push_back(token);
+namespace {
+
+// the clouds read ahead of the one being used
+constexpr int kSubmapPrefetchNum = 2;
+constexpr float kStaticMapThreshold = 0.57f;
+// in the directory of the static map pieces
+constexpr char kPiecesManifestName[] = "static_map_pieces.xml";
+
+using SubmapPtr =
+    std::shared_ptr<Submap<MultiTrajectoryMapBuilder::PointType>>;
+
+std::vector<SubmapPtr> AllSubmaps(
+    const std::vector<
+        std::shared_ptr<Trajectory<MultiTrajectoryMapBuilder::PointType>>>&
+        trajectories) {
+  std::vector<SubmapPtr> all_submaps;
+  for (auto& trajectory : trajectories) {
+    const auto submaps = trajectory->GetSnapshot();
+    all_submaps.insert(all_submaps.end(), submaps->begin(), submaps->end());
+  }
+  return all_submaps;
+}
+
+void PrefetchAfter(const std::vector<SubmapPtr>& submaps, const int index) {
+  const int submaps_size = submaps.size();
+  for (int j = index + 1; j <= index + kSubmapPrefetchNum && j < submaps_size;
+       ++j) {
+    submaps[j]->Prefetch();
+  }
+}
+
+MrvmSettings StaticMapSettings() {
+  MrvmSettings settings;
+  settings.z_offset = 1.2;
+  settings.max_point_num_in_cell = 4;
+  return settings;
+}
+
+std::string PieceFileName(const std::pair<int, int>& index) {
+  return "static_piece_" + std::to_string(index.first) + "_" +
+         std::to_string(index.second) + ".pcd";
+}
+
+// the overlapping segments are aligned by at least these many frames
+constexpr size_t kMinAlignedFrameNum = 3u;
+
+struct TimedPose {
+  double time;
+  Eigen::Matrix4d pose;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+// the path in the order of time
+bool ReadTimedPath(const std::string& filename,
+                   std::vector<TimedPose>* const path) {
+  common::BinaryTrajectoryReader reader;
+  if (!reader.Open(filename)) {
+    PRINT_ERROR_FMT("failed to read the path %s", filename.c_str());
+    return false;
+  }
+  common::TrajectoryRecord record;
+  while (reader.Read(&record)) {
+    TimedPose timed_pose;
+    timed_pose.time = record.secs + record.nsecs * 1.e-9;
+    const Eigen::Vector6<double> pose_6d =
+        Eigen::Map<const Eigen::Vector6<double>>(record.pose);
+    timed_pose.pose = common::Vector6ToTransform(pose_6d);
+    path->push_back(timed_pose);
   }
+  std::sort(path->begin(), path->end(),
+            [](const TimedPose& a, const TimedPose& b) {
+              return a.time < b.time;
+            });
+  return true;
 }
 
+}  // namespace
+
 MultiTrajectoryMapBuilder::MultiTrajectoryMapBuilder(
     const MultiTrajectoryMapBuilderOptions& options)
-    : options_(options), optimizer_(options.loop_dettect_settings) {}
+    : options_(options),
+      optimizer_(options.loop_dettect_settings,
+                 options.final_optimization_options) {}
 
 MultiTrajectoryMapBuilder::~MultiTrajectoryMapBuilder() {}
 
@@ -52,16 +134,14 @@ void MultiTrajectoryMapBuilder::LoadBaseMap(const std::string& package_file) {
 
   // step2 insert submaps and connections into back-end
   PRINT_DEBUG("Add submaps ... ");
-  for (auto& trajectory : base_trajectories_) {
-    for (auto& submap : *trajectory) {
-      optimizer_.AddSubmap(submap, false);
-    }
-  }
+  CalculateDescriptors(base_trajectories_);
+  optimizer_.AddSubmaps(AllSubmaps(base_trajectories_), false);
 
   // step3 add connections built when mapping
   PRINT_DEBUG("Add connections without loop detection ... ");
   for (auto& trajectory : base_trajectories_) {
-    for (auto& submap : *trajectory) {
+    const auto submaps = trajectory->GetSnapshot();
+    for (auto& submap : *submaps) {
       auto target_id = submap->GetId();
       auto connections = submap->GetConnected();
       Eigen::Matrix4f target_pose = submap->GlobalPose();
@@ -81,12 +161,13 @@ void MultiTrajectoryMapBuilder::LoadBaseMap(const std::string& package_file) {
 }
 
 void MultiTrajectoryMapBuilder::LoadIncrementalMap(
-    const std::string& package_file) {
+    const std::string& package_file,
+    const Eigen::Matrix4d& base_from_incremental) {
   // step1 load file to trajectories
   PRINT_INFO("Loading incremental map file ... ");
-  CHECK_GE(
-      LoadTrajectoryFromFile(&incremental_trajectories_, package_file, false),
-      0);
+  CHECK_GE(LoadTrajectoryFromFile(&incremental_trajectories_, package_file,
+                                  false, base_from_incremental),
+           0);
 
   // step1.1 change the trajectory_index of incremental trajectories
   const int offset = base_trajectories_.size();
@@ -96,19 +177,21 @@ void MultiTrajectoryMapBuilder::LoadIncrementalMap(
   for (auto& trajectory : incremental_trajectories_) {
     int current_trajectory_id = trajectory->GetId();
     trajectory->SetId(current_trajectory_id + offset);
-    for (auto& submap : *trajectory) {
+    const auto submaps = trajectory->GetSnapshot();
+    for (auto& submap : *submaps) {
       auto submap_id = submap->GetId();
       submap_id.trajectory_index += offset;
       submap->SetId(submap_id);
-      optimizer_.AddSubmap(submap, true);
-      // common::PrintTransform(submap->GlobalPose());
     }
   }
+  CalculateDescriptors(incremental_trajectories_);
+  optimizer_.AddSubmaps(AllSubmaps(incremental_trajectories_), true);
 
   // step3
   PRINT_DEBUG("Add connections in incremental trajectories ... ");
   for (auto& trajectory : incremental_trajectories_) {
-    for (auto& submap : *trajectory) {
+    const auto submaps = trajectory->GetSnapshot();
+    for (auto& submap : *submaps) {
       auto target_id = submap->GetId();
       auto& connections = submap->GetConnected();
       Eigen::Matrix4f target_pose = submap->GlobalPose();
@@ -137,70 +220,60 @@ void MultiTrajectoryMapBuilder::LoadIncrementalMap(
 
 int MultiTrajectoryMapBuilder::LoadTrajectoryFromFile(
     std::vector<std::shared_ptr<Trajectory<PointType>>>* trajectories,
-    const std::string& file, bool update_base_utm) {
+    const std::string& file, bool update_base_utm,
+    const Eigen::Matrix4d& transform) {
   CHECK(trajectories);
   // step0, test for existence of the file
   if (!common::FileExist(file)) {
     PRINT_ERROR_FMT("base map file does not exist ... %s", file.c_str());
     return -1;
   }
-  // step1, load the file
-  pugi::xml_document doc;
-  if (!doc.load_file(file.c_str())) {
-    PRINT_ERROR("Failed to load file.");
-    return -1;
-  }
-  pugi::xml_node map_node = doc.child("Map");
-  if (!map_node) {
-    PRINT_ERROR("Format error.");
+  // step1, load the file, through its index if there is
+  std::vector<MapPackageTrajectory> package_trajectories;
+  if (!LoadMapPackage(file, &package_trajectories)) {
     return -1;
   }
   // step1.1 get the path of pkg.xml (for submaps)
   std::string pkg_file_path = common::FilePath(file);
-  for (auto t_node = map_node.child("Trajectory"); t_node;
-       t_node = t_node.next_sibling("Trajectory")) {
+  for (const auto& package_trajectory : package_trajectories) {
     const int current_trajectory_index = trajectories->size();
     trajectories->emplace_back(new Trajectory<PointType>);
     auto& current_trajectory = trajectories->back();
     // trajectory attr
     if (current_trajectory_index == 0 && update_base_utm) {
-      base_utm_x_ = t_node.attribute("utm_x").as_double();
-      base_utm_y_ = t_node.attribute("utm_y").as_double();
+      base_utm_x_ = package_trajectory.utm_x;
+      base_utm_y_ = package_trajectory.utm_y;
     }
-    double utm_offset_x = t_node.attribute("utm_x").as_double() - base_utm_x_;
-    double utm_offset_y = t_node.attribute("utm_y").as_double() - base_utm_y_;
+    double utm_offset_x = package_trajectory.utm_x - base_utm_x_;
+    double utm_offset_y = package_trajectory.utm_y - base_utm_y_;
     current_trajectory->SetId(current_trajectory_index);
+    current_trajectory->reserve(package_trajectory.submaps.size());
     // insert submaps
-    for (auto s_node = t_node.child("Submap"); s_node;
-         s_node = s_node.next_sibling("Submap")) {
+    for (const auto& package_submap : package_trajectory.submaps) {
       auto submap =
           std::make_shared<Submap<PointType>>(options_.submap_options);
       // id
       SubmapId submap_id;
       submap_id.trajectory_index = current_trajectory_index;
-      submap_id.submap_index = s_node.attribute("id").as_int();
+      submap_id.submap_index = package_submap.id;
       submap->SetId(submap_id);
       // pose
       Eigen::Vector6<double> pose_6d;
-      pose_6d[0] = s_node.attribute("tx").as_double() + utm_offset_x;
-      pose_6d[1] = s_node.attribute("ty").as_double() + utm_offset_y;
-      pose_6d[2] = s_node.attribute("tz").as_double();
-      pose_6d[3] = s_node.attribute("rx").as_double();
-      pose_6d[4] = s_node.attribute("ry").as_double();
-      pose_6d[5] = s_node.attribute("rz").as_double();
-      Eigen::Matrix4d pose = common::Vector6ToTransform(pose_6d);
+      for (int i = 0; i < 6; ++i) {
+        pose_6d[i] = package_submap.pose_6d[i];
+      }
+      pose_6d[0] += utm_offset_x;
+      pose_6d[1] += utm_offset_y;
+      Eigen::Matrix4d pose = transform * common::Vector6ToTransform(pose_6d);
       submap->SetGlobalPose(pose.cast<float>());
       // connections
-      std::string connections = s_node.attribute("connections").as_string();
-      auto connected_ids = ConnectionsStrToIds(connections);
-      for (auto& id : connected_ids) {
+      for (auto& id : package_submap.connections) {
         submap->AddConnectedSubmap(id);
       }
-      // file
-      std::string file = s_node.attribute("file").as_string();
+      // file, the cloud is read when it is used
+      const std::string& file = package_submap.file;
       CHECK(common::FileExist(pkg_file_path + file));
-      submap->SetSavePath(pkg_file_path);
-      submap->SetSavedFileName(file);
+      submap->SetPackageFile(pkg_file_path, file);
       // finished
       current_trajectory->push_back(submap);
     }
@@ -209,20 +282,39 @@ int MultiTrajectoryMapBuilder::LoadTrajectoryFromFile(
   return 0;
 }
 
+void MultiTrajectoryMapBuilder::CalculateDescriptors(
+    const std::vector<std::shared_ptr<Trajectory<PointType>>>& trajectories) {
+  if (!options_.loop_dettect_settings.use_descriptor) {
+    return;
+  }
+  // the clouds are read in parallel, and released until the registrations
+  // or the map generation use them
+  const auto submaps = AllSubmaps(trajectories);
+  common::ParallelFor(
+      0, submaps.size(),
+      static_cast<int>(common::SharedExecutor::ThreadNum()),
+      [&](const int i) {
+        submaps[i]->Cloud();
+        submaps[i]->CalculateDescriptor();
+        submaps[i]->ReleaseCloud();
+      });
+}
+
 void MultiTrajectoryMapBuilder::SaveWholeMap(const std::string& package_file) {
   std::string pkg_path = common::FilePath(package_file);
   PRINT_INFO("Save whole map package ... ");
   CHECK(incremental_trajectories_.empty());
 
-  pugi::xml_document doc;
-  pugi::xml_node map_node = doc.append_child("Map");
+  MapPackageWriter writer;
+  if (!writer.Open(package_file)) {
+    return;
+  }
   for (auto& trajectory : base_trajectories_) {
     // trajectory->SetSavePath(pkg_path);
     trajectory->SetUtmOffset(base_utm_x_, base_utm_y_);
-    trajectory->ToXmlNode(&map_node);
+    trajectory->ToPackage(&writer);
   }
-
-  doc.save_file(package_file.c_str());
+  writer.Close();
 }
 
 void MultiTrajectoryMapBuilder::GenerateWholeMapPcd(
@@ -230,17 +322,19 @@ void MultiTrajectoryMapBuilder::GenerateWholeMapPcd(
   PRINT_INFO("Save Whole Map to pcd...");
   CHECK(incremental_trajectories_.empty());
   pcl::PointCloud<PointType> whole_map;
-  for (auto& trajectory : base_trajectories_) {
-    for (auto& submap : *trajectory) {
-      Eigen::Matrix4f pose = submap->GlobalPose();
-      pcl::PointCloud<PointType> transformed_cloud;
-      pcl::transformPointCloud(*submap->Cloud(), transformed_cloud, pose);
-      whole_map += transformed_cloud;
-    }
+  const auto submaps = AllSubmaps(base_trajectories_);
+  const int submaps_size = submaps.size();
+  for (int i = 0; i < submaps_size; ++i) {
+    PrefetchAfter(submaps, i);
+    Eigen::Matrix4f pose = submaps[i]->GlobalPose();
+    pcl::PointCloud<PointType> transformed_cloud;
+    common::TransformPointCloud(*submaps[i]->Cloud(), &transformed_cloud, pose);
+    whole_map += transformed_cloud;
+    submaps[i]->ReleaseCloud();
   }
 
   if (!whole_map.empty()) {
-    pcl::io::savePCDFileBinaryCompressed(pcd_filename, whole_map);
+    common::SavePcdFile(pcd_filename, whole_map);
   }
 }
 
@@ -248,52 +342,302 @@ void MultiTrajectoryMapBuilder::GenerateStaticMap(
     const std::string& pcd_filename) {
   PRINT_INFO("Save Whole Map to static_map(pcd file)...");
   CHECK(incremental_trajectories_.empty());
-  MultiResolutionVoxelMap<PointType> map;
-  MrvmSettings settings;
-  settings.z_offset = 1.2;
-  settings.max_point_num_in_cell = 4;
-  map.Initialise(settings);
+  if (!static_map_) {
+    // reload the submaps whose tiles are rebuilt
+    auto loader = [this](int id, PointCloudType* cloud) {
+      const auto& submap = static_map_submaps_[id];
+      *cloud = *submap->Cloud();
+      submap->ReleaseCloud();
+      return true;
+    };
+    static_map_.reset(new IncrementalVoxelMap<PointType>(
+        options_.static_map_options, StaticMapSettings(), loader));
+  }
+
+  // step1 the submaps in the map already follow their optimized poses
+  std::map<int, Eigen::Matrix4f> poses;
   for (auto& trajectory : base_trajectories_) {
-    for (auto& submap : *trajectory) {
-      Eigen::Matrix4f pose = submap->GlobalPose();
-      pcl::PointCloud<PointType>::Ptr transformed_cloud(
-          new pcl::PointCloud<PointType>);
-      pcl::transformPointCloud(*submap->Cloud(), *transformed_cloud, pose);
-      PRINT_DEBUG_FMT("submap index in trajectory %d : %d / %d",
-                      trajectory->GetId(), submap->GetId().submap_index,
-                      static_cast<int>(trajectory->size()) - 1);
-      start_clock();
-      map.InsertPointCloud(transformed_cloud, submap->GlobalTranslation());
-      submap->ClearCloud();
-      end_clock(__FILE__, __FUNCTION__, __LINE__);
+    const auto submaps = trajectory->GetSnapshot();
+    for (auto& submap : *submaps) {
+      auto it = static_map_ids_.find(submap->GetId());
+      if (it != static_map_ids_.end()) {
+        poses[it->second] = submap->GlobalPose();
+      }
     }
   }
+  static_map_->UpdatePoses(poses);
+
+  // step2 insert the new submaps
+  std::vector<SubmapPtr> new_submaps;
+  for (auto& submap : AllSubmaps(base_trajectories_)) {
+    if (!static_map_ids_.count(submap->GetId())) {
+      new_submaps.push_back(submap);
+    }
+  }
+  const int new_submaps_size = new_submaps.size();
+  for (int i = 0; i < new_submaps_size; ++i) {
+    const auto& submap = new_submaps[i];
+    PrefetchAfter(new_submaps, i);
+    const int id = static_map_submaps_.size();
+    static_map_ids_[submap->GetId()] = id;
+    static_map_submaps_.push_back(submap);
+    PRINT_DEBUG_FMT("submap in trajectory %d : %d (%d / %d)",
+                    submap->GetId().trajectory_index,
+                    submap->GetId().submap_index, i, new_submaps_size - 1);
+    SCOPED_TIMER("static_map.insert_submap");
+    static_map_->InsertPointCloud(id, submap->Cloud(), submap->GlobalPose());
+    submap->ReleaseCloud();
+  }
   PRINT_INFO("All trajectories inserted...");
-  map.OutputToPointCloud(0.57, pcd_filename, false);
+  common::PcdStreamWriter<PointType> writer;
+  if (!writer.Open(pcd_filename) ||
+      !static_map_->OutputToPointCloud(kStaticMapThreshold, &writer) ||
+      !writer.Close()) {
+    PRINT_ERROR_FMT("failed to write %s", pcd_filename.c_str());
+  }
+}
+
+void MultiTrajectoryMapBuilder::GenerateStaticMapPieces(
+    const std::string& path) {
+  PRINT_INFO("Save Whole Map to static map pieces...");
+  CHECK(incremental_trajectories_.empty());
+  using TileIndex = IncrementalVoxelMap<PointType>::TileIndex;
+  using Poses = std::map<SubmapId, Eigen::Matrix4f, std::less<SubmapId>,
+                         Eigen::aligned_allocator<
+                             std::pair<const SubmapId, Eigen::Matrix4f>>>;
+  const auto submaps = AllSubmaps(base_trajectories_);
+  const int submaps_size = submaps.size();
+  auto loader = [&submaps](int id, PointCloudType* cloud) {
+    *cloud = *submaps[id]->Cloud();
+    submaps[id]->ReleaseCloud();
+    return true;
+  };
+  IncrementalVoxelMap<PointType> map(options_.static_map_options,
+                                     StaticMapSettings(), loader);
+
+  // step1 the submaps reaching each piece, in the order of the insertion
+  std::map<TileIndex, std::vector<int>> piece_submaps;
+  for (int i = 0; i < submaps_size; ++i) {
+    for (const auto& index : map.TilesInRange(submaps[i]->GlobalPose())) {
+      piece_submaps[index].push_back(i);
+    }
+  }
+
+  // step2 the pieces in the manifest with the same submaps which have not
+  // moved are kept as they are, the other ones are rebuilt
+  const std::string manifest_file = path + kPiecesManifestName;
+  Poses saved_poses;
+  std::map<TileIndex, std::vector<SubmapId>> saved_pieces;
+  pugi::xml_document saved_doc;
+  pugi::xml_node saved_node;
+  if (common::FileExist(manifest_file) &&
+      saved_doc.load_file(manifest_file.c_str())) {
+    saved_node = saved_doc.child("StaticMapPieces");
+  }
+  if (saved_node &&
+      saved_node.attribute("tile_width").as_double() ==
+          options_.static_map_options.tile_width &&
+      saved_node.attribute("ray_range").as_double() ==
+          options_.static_map_options.ray_range) {
+    for (auto s_node = saved_node.child("Submap"); s_node;
+         s_node = s_node.next_sibling("Submap")) {
+      SubmapId id;
+      id.trajectory_index = s_node.attribute("trajectory").as_int();
+      id.submap_index = s_node.attribute("id").as_int();
+      Eigen::Matrix4f pose;
+      std::istringstream stream(s_node.attribute("pose").as_string());
+      for (int k = 0; k < 16; ++k) {
+        stream >> pose.data()[k];
+      }
+      if (stream) {
+        saved_poses[id] = pose;
+      }
+    }
+    for (auto p_node = saved_node.child("Piece"); p_node;
+         p_node = p_node.next_sibling("Piece")) {
+      const TileIndex index(p_node.attribute("x").as_int(),
+                            p_node.attribute("y").as_int());
+      saved_pieces[index] =
+          ConnectionsStrToIds(p_node.attribute("submaps").as_string());
+    }
+  } else if (saved_node) {
+    PRINT_WARNING("the tiles of the saved pieces differ, rebuild all.");
+  }
+
+  std::set<TileIndex> dirty_pieces;
+  for (const auto& piece : piece_submaps) {
+    auto saved = saved_pieces.find(piece.first);
+    bool kept = saved != saved_pieces.end() &&
+                saved->second.size() == piece.second.size() &&
+                common::FileExist(path + PieceFileName(piece.first));
+    for (size_t k = 0; kept && k < piece.second.size(); ++k) {
+      const auto& submap = submaps[piece.second[k]];
+      auto saved_pose = saved_poses.find(submap->GetId());
+      kept = saved->second[k] == submap->GetId() &&
+             saved_pose != saved_poses.end() &&
+             !map.PoseMoved(saved_pose->second, submap->GlobalPose());
+    }
+    if (!kept) {
+      dirty_pieces.insert(piece.first);
+    }
+  }
+  // the saved pieces which no submap reaches any more
+  for (const auto& piece : saved_pieces) {
+    if (!piece_submaps.count(piece.first)) {
+      std::remove((path + PieceFileName(piece.first)).c_str());
+    }
+  }
+  PRINT_INFO_FMT("%zu / %zu static map pieces to rebuild.",
+                 dirty_pieces.size(), piece_submaps.size());
+
+  // step3 the submaps reaching the rebuilt pieces, into those pieces only
+  std::vector<bool> reaches_dirty(submaps_size, false);
+  for (const auto& index : dirty_pieces) {
+    for (const int i : piece_submaps[index]) {
+      reaches_dirty[i] = true;
+    }
+  }
+  std::vector<int> inserted;
+  for (int i = 0; i < submaps_size; ++i) {
+    if (reaches_dirty[i]) {
+      inserted.push_back(i);
+    }
+  }
+  map.SetActiveTiles(dirty_pieces);
+  const int inserted_size = inserted.size();
+  for (int k = 0; k < inserted_size; ++k) {
+    for (int j = k + 1; j <= k + kSubmapPrefetchNum && j < inserted_size;
+         ++j) {
+      submaps[inserted[j]]->Prefetch();
+    }
+    const auto& submap = submaps[inserted[k]];
+    map.InsertPointCloud(inserted[k], submap->Cloud(), submap->GlobalPose());
+    submap->ReleaseCloud();
+  }
+  for (const auto& index : dirty_pieces) {
+    const std::string filename = path + PieceFileName(index);
+    common::PcdStreamWriter<PointType> writer;
+    // an empty piece if no point of its submaps is in it
+    if (!writer.Open(filename) ||
+        (map.HasTile(index) &&
+         !map.OutputTileToPointCloud(index, kStaticMapThreshold, &writer)) ||
+        !writer.Close()) {
+      PRINT_ERROR_FMT("failed to write %s", filename.c_str());
+    }
+  }
+
+  // step4 the manifest, the submaps only in the kept pieces keep their
+  // saved poses, so that their small moves do not add up over the updates
+  pugi::xml_document doc;
+  pugi::xml_node pieces_node = doc.append_child("StaticMapPieces");
+  pieces_node.append_attribute("tile_width") =
+      options_.static_map_options.tile_width;
+  pieces_node.append_attribute("ray_range") =
+      options_.static_map_options.ray_range;
+  for (int i = 0; i < submaps_size; ++i) {
+    const SubmapId id = submaps[i]->GetId();
+    auto saved_pose = saved_poses.find(id);
+    const Eigen::Matrix4f pose =
+        reaches_dirty[i] || saved_pose == saved_poses.end()
+            ? submaps[i]->GlobalPose()
+            : saved_pose->second;
+    std::ostringstream stream;
+    stream << std::setprecision(9);
+    for (int k = 0; k < 16; ++k) {
+      stream << (k ? " " : "") << pose.data()[k];
+    }
+    pugi::xml_node submap_node = pieces_node.append_child("Submap");
+    submap_node.append_attribute("trajectory") = id.trajectory_index;
+    submap_node.append_attribute("id") = id.submap_index;
+    submap_node.append_attribute("pose") = stream.str().c_str();
+  }
+  for (const auto& piece : piece_submaps) {
+    std::string ids;
+    for (const int i : piece.second) {
+      const SubmapId id = submaps[i]->GetId();
+      ids += "[" + std::to_string(id.trajectory_index) + "," +
+             std::to_string(id.submap_index) + "]";
+    }
+    pugi::xml_node piece_node = pieces_node.append_child("Piece");
+    piece_node.append_attribute("x") = piece.first.first;
+    piece_node.append_attribute("y") = piece.first.second;
+    piece_node.append_attribute("file") = PieceFileName(piece.first).c_str();
+    piece_node.append_attribute("submaps") = ids.c_str();
+  }
+  if (!doc.save_file(manifest_file.c_str())) {
+    PRINT_ERROR_FMT("failed to write %s", manifest_file.c_str());
+  }
 }
 
 std::vector<SubmapId> MultiTrajectoryMapBuilder::ConnectionsStrToIds(
     const std::string& connections) {
   // the string must be like this
   // "[0,63][0,80][0,81][0,82]"
-  if (connections.empty()) {
-    return std::vector<SubmapId>();
-  }
-  std::vector<SubmapId> ids;
-  std::vector<std::string> splited_strs;
-  split(connections, &splited_strs, ']');
-  for (auto& str : splited_strs) {
-    auto first_int_pos = str.find('[') + 1;
-    auto comma_pos = str.find(',');
-    CHECK(first_int_pos <= comma_pos);
-
-    SubmapId id;
-    id.trajectory_index =
-        atoi(str.substr(first_int_pos, comma_pos - first_int_pos).c_str());
-    id.submap_index = atoi(str.substr(comma_pos + 1).c_str());
-    ids.push_back(id);
-  }
-  return ids;
+  return ParseSubmapIds(connections.c_str());
+}
+
+bool AlignOverlappingPaths(const std::string& earlier_path_file,
+                           const std::string& later_path_file,
+                           Eigen::Matrix4d* const earlier_from_later,
+                           const double max_time_difference) {
+  CHECK(earlier_from_later);
+  std::vector<TimedPose> earlier_path;
+  std::vector<TimedPose> later_path;
+  if (!ReadTimedPath(earlier_path_file, &earlier_path) ||
+      !ReadTimedPath(later_path_file, &later_path)) {
+    return false;
+  }
+  // each matched frame gives the transform, they are averaged, so a
+  // straight overlap is fine as well
+  Eigen::Vector4d quaternion_sum = Eigen::Vector4d::Zero();
+  Eigen::Quaterniond first_rotation;
+  std::vector<std::pair<Eigen::Vector3d, Eigen::Vector3d>> positions;
+  for (const auto& later : later_path) {
+    const auto after = std::lower_bound(
+        earlier_path.begin(), earlier_path.end(), later,
+        [](const TimedPose& a, const TimedPose& b) { return a.time < b.time; });
+    auto nearest = after;
+    if (after == earlier_path.end() ||
+        (after != earlier_path.begin() &&
+         later.time - (after - 1)->time < after->time - later.time)) {
+      if (after == earlier_path.begin()) {
+        continue;
+      }
+      nearest = after - 1;
+    }
+    if (std::fabs(nearest->time - later.time) > max_time_difference) {
+      continue;
+    }
+    Eigen::Quaterniond rotation(
+        Eigen::Matrix3d(nearest->pose.block<3, 3>(0, 0) *
+                        later.pose.block<3, 3>(0, 0).transpose()));
+    if (positions.empty()) {
+      first_rotation = rotation;
+    } else if (rotation.dot(first_rotation) < 0.) {
+      rotation.coeffs() = -rotation.coeffs();
+    }
+    quaternion_sum += rotation.coeffs();
+    positions.emplace_back(nearest->pose.block<3, 1>(0, 3),
+                           later.pose.block<3, 1>(0, 3));
+  }
+  if (positions.size() < kMinAlignedFrameNum) {
+    PRINT_ERROR_FMT("only %lu frames of %s overlap %s", positions.size(),
+                    later_path_file.c_str(), earlier_path_file.c_str());
+    return false;
+  }
+  const Eigen::Matrix3d rotation =
+      Eigen::Quaterniond(quaternion_sum.normalized()).toRotationMatrix();
+  Eigen::Vector3d translation = Eigen::Vector3d::Zero();
+  for (const auto& position : positions) {
+    translation += position.first - rotation * position.second;
+  }
+  translation /= static_cast<double>(positions.size());
+  earlier_from_later->setIdentity();
+  earlier_from_later->block<3, 3>(0, 0) = rotation;
+  earlier_from_later->block<3, 1>(0, 3) = translation;
+  PRINT_INFO_FMT("aligned %s to %s by %lu frames", later_path_file.c_str(),
+                 earlier_path_file.c_str(), positions.size());
+  return true;
 }
 
 }  // namespace static_map
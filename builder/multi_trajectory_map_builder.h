@@ -24,19 +24,24 @@
 #define BUILDER_MULTI_TRAJECTORY_MAP_BUILDER_H_
 
 // stl
+#include <map>
 #include <memory>
 #include <string>
 #include <vector>
 // local
 #include "back_end/loop_detector.h"
 #include "back_end/multi_trajectory_optimizer.h"
+#include "builder/incremental_voxel_map.h"
 #include "builder/trajectory.h"
+#include "common/point_types.h"
 
 namespace static_map {
 
 struct MultiTrajectoryMapBuilderOptions {
   back_end::LoopDetectorSettings loop_dettect_settings;
+  back_end::FinalOptimizationOptions final_optimization_options;
   SubmapOptions submap_options;
+  IncrementalVoxelMapOptions static_map_options;
 };
 
 class MultiTrajectoryMapBuilder {
@@ -51,7 +56,7 @@ class MultiTrajectoryMapBuilder {
 
   // type define
   // point and cloud definitions
-  using PointType = pcl::PointXYZI;
+  using PointType = MapPointType;
   using PointCloudType = pcl::PointCloud<PointType>;
   using PointCloudPtr = PointCloudType::Ptr;
   using PointCloudConstPtr = PointCloudType::ConstPtr;
@@ -60,17 +65,33 @@ class MultiTrajectoryMapBuilder {
   int Initialise(const char* config_file_name);
 
   void LoadBaseMap(const std::string& package_file);
-  void LoadIncrementalMap(const std::string& package_file);
+  /// @param base_from_incremental the initial guess of the incremental map
+  /// in the base map, after the utm offsets, e.g. by AlignOverlappingPaths()
+  /// for the segments of one bag without gps
+  void LoadIncrementalMap(const std::string& package_file,
+                          const Eigen::Matrix4d& base_from_incremental =
+                              Eigen::Matrix4d::Identity());
   void SaveWholeMap(const std::string& whole_map_file);
   void GenerateWholeMapPcd(const std::string& pcd_filename);
+  /// @brief the static map is kept, the next call only updates the tiles
+  /// of the moved and the new submaps
   void GenerateStaticMap(const std::string& pcd_filename);
+  /// @brief the static map in pieces (its tiles) under the path, with a
+  /// manifest of the submaps reaching each piece and their poses, the
+  /// pieces there whose submaps are the same and have not moved are kept
+  /// as they are (byte-identical), only the other ones are rebuilt
+  void GenerateStaticMapPieces(const std::string& path);
 
  protected:
   int LoadTrajectoryFromFile(
       std::vector<std::shared_ptr<Trajectory<PointType>>>* trajectories,
-      const std::string& file, bool update_base_utm);
+      const std::string& file, bool update_base_utm,
+      const Eigen::Matrix4d& transform = Eigen::Matrix4d::Identity());
 
   std::vector<SubmapId> ConnectionsStrToIds(const std::string& connections);
+  // the descriptors of the loaded submaps, for the loop detection
+  void CalculateDescriptors(
+      const std::vector<std::shared_ptr<Trajectory<PointType>>>& trajectories);
 
  private:
   MultiTrajectoryMapBuilderOptions options_;
@@ -81,8 +102,22 @@ class MultiTrajectoryMapBuilder {
 
   double base_utm_x_ = 0.;
   double base_utm_y_ = 0.;
+
+  std::unique_ptr<IncrementalVoxelMap<PointType>> static_map_;
+  // the submaps in the static map, indexed by their ids in it
+  std::vector<std::shared_ptr<Submap<PointType>>> static_map_submaps_;
+  std::map<SubmapId, int> static_map_ids_;
 };
 
+/// @brief the transform from the map frame of a segment into the one of the
+/// segment before it, by their paths (path.traj of MapBuilder) in the time
+/// they overlap, the frames within max_time_difference are matched
+/// @return false if there are not enough matched frames
+bool AlignOverlappingPaths(const std::string& earlier_path_file,
+                           const std::string& later_path_file,
+                           Eigen::Matrix4d* earlier_from_later,
+                           double max_time_difference = 0.05);
+
 }  // namespace static_map
 
 #endif  // BUILDER_MULTI_TRAJECTORY_MAP_BUILDER_H_
@@ -31,10 +31,16 @@
 #include <pcl/sample_consensus/model_types.h>
 #include <pcl/segmentation/sac_segmentation.h>
 // stl
-#include <map>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <tuple>
+#include <utility>
 #include <vector>
 // local
 #include "common/macro_defines.h"
+#include "common/math.h"
+#include "common/shared_executor.h"
 #include "glog/logging.h"
 
 namespace static_map {
@@ -48,6 +54,7 @@ class PlaneDetector {
 
   PlaneDetector()
       : min_point_num_in_voxel_(10),
+        max_point_num_for_pca_(100),
         min_z_(1.e9),
         max_z_(-1.e9),
         leaf_size_(0.5) {}
@@ -66,7 +73,15 @@ class PlaneDetector {
 
   inline void SetLeafSize(float leaf_size) { leaf_size_ = leaf_size; }
 
+  // the planes in the voxels with at most num points are fitted by pca,
+  // the larger ones by ransac
+  inline void SetMaxPointNumForPca(size_t num) { max_point_num_for_pca_ = num; }
+
   void SetInputCloud(const PointCloudPtr& cloud) {
+    voxel_points_.clear();
+    voxels_.clear();
+    min_z_ = 1.e9;
+    max_z_ = -1.e9;
     if (!cloud || cloud->empty()) {
       PRINT_ERROR("cloud is empty.");
       input_cloud_ = nullptr;
@@ -74,12 +89,15 @@ class PlaneDetector {
     }
     input_cloud_ = cloud;
 
+    // sort the points by the voxels, so that each voxel is a run of them
+    voxel_points_.reserve(input_cloud_->size());
     for (int i = 0; i < input_cloud_->size(); ++i) {
       auto& point = input_cloud_->points[i];
-      Eigen::Vector3i index(static_cast<int>(point.x / leaf_size_),
-                            static_cast<int>(point.y / leaf_size_),
-                            static_cast<int>(point.z / leaf_size_));
-      voxels_[index].push_back(i);
+      voxel_points_.push_back(
+          VoxelPoint{{static_cast<int>(point.x / leaf_size_),
+                      static_cast<int>(point.y / leaf_size_),
+                      static_cast<int>(point.z / leaf_size_)},
+                     i});
       if (point.z > max_z_) {
         max_z_ = point.z;
       }
@@ -87,6 +105,13 @@ class PlaneDetector {
         min_z_ = point.z;
       }
     }
+    std::sort(voxel_points_.begin(), voxel_points_.end());
+    for (size_t i = 0; i < voxel_points_.size(); ++i) {
+      if (i == 0 || voxel_points_[i].key != voxel_points_[i - 1].key) {
+        voxels_.push_back(std::make_pair(i, i));
+      }
+      ++voxels_.back().second;
+    }
   }
 
   void Detect(std::vector<int>& ground_indices,
@@ -100,71 +125,139 @@ class PlaneDetector {
       return;
     }
 
-    for (auto& index_vector : voxels_) {
-      Eigen::Vector3i index = index_vector.first;
-      auto& indices = index_vector.second;
-      if (indices.size() < min_point_num_in_voxel_) {
-        continue;
+    // the voxels in chunks, each with its own reused buffers and output,
+    // joined in the voxel order
+    const int chunk_num =
+        std::min(static_cast<int>(voxels_.size()),
+                 4 * static_cast<int>(common::SharedExecutor::ThreadNum()));
+    if (scratches_.size() < static_cast<size_t>(chunk_num)) {
+      scratches_.resize(chunk_num);
+    }
+    common::ParallelFor(0, chunk_num, chunk_num, [&](const int chunk) {
+      Scratch& scratch = scratches_[chunk];
+      scratch.ground_indices.clear();
+      const size_t begin = voxels_.size() * chunk / chunk_num;
+      const size_t end = voxels_.size() * (chunk + 1) / chunk_num;
+      for (size_t v = begin; v < end; ++v) {
+        DetectInVoxel(voxels_[v], distance_threshold, &scratch);
       }
-      if (index[2] /* z index */ <= 0) {
-        float max_z_in_voxel = -1.e9;
-        float min_z_in_voxel = 1.e9;
-        for (auto& i : indices) {
-          auto& point = input_cloud_->points[i];
-          if (point.z > max_z_in_voxel) {
-            max_z_in_voxel = point.z;
-          }
-          if (point.z < min_z_in_voxel) {
-            min_z_in_voxel = point.z;
-          }
-        }
-        auto delta = max_z_in_voxel - min_z_in_voxel;
-        if (delta >= 0. && delta <= distance_threshold) {
-          for (auto& i : indices) {
-            ground_indices.push_back(i);
-          }
+    });
+    for (int chunk = 0; chunk < chunk_num; ++chunk) {
+      const auto& indices = scratches_[chunk].ground_indices;
+      ground_indices.insert(ground_indices.end(), indices.begin(),
+                            indices.end());
+    }
+  }
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+ private:
+  struct VoxelPoint {
+    std::array<int, 3> key;
+    int index;
+
+    bool operator<(const VoxelPoint& other) const {
+      return std::tie(key, index) < std::tie(other.key, other.index);
+    }
+  };
+  // [begin, end) in voxel_points_
+  using Voxel = std::pair<size_t, size_t>;
+
+  // reused by the voxels of a chunk
+  struct Scratch {
+    std::vector<Eigen::Vector3f> points;
+    PointCloudPtr cloud{new PointCloudType};
+    pcl::ModelCoefficients coefficients;
+    pcl::PointIndices inliers;
+    std::vector<int> ground_indices;
+  };
+
+  void DetectInVoxel(const Voxel& voxel, const float distance_threshold,
+                     Scratch* const scratch) const {
+    const size_t point_num = voxel.second - voxel.first;
+    if (point_num < min_point_num_in_voxel_) {
+      return;
+    }
+    auto& ground_indices = scratch->ground_indices;
+    if (voxel_points_[voxel.first].key[2] /* z index */ <= 0) {
+      float max_z_in_voxel = -1.e9;
+      float min_z_in_voxel = 1.e9;
+      for (size_t i = voxel.first; i < voxel.second; ++i) {
+        auto& point = input_cloud_->points[voxel_points_[i].index];
+        if (point.z > max_z_in_voxel) {
+          max_z_in_voxel = point.z;
         }
-      } else {
-        if (indices.size() < min_point_num_in_voxel_ * 2) {
-          continue;
+        if (point.z < min_z_in_voxel) {
+          min_z_in_voxel = point.z;
         }
-        pcl::ModelCoefficients::Ptr coefficients(new pcl::ModelCoefficients);
-        pcl::PointIndices::Ptr inliers(new pcl::PointIndices);
-        pcl::SACSegmentation<PointT> seg;  // Create the segmentation object
-        seg.setOptimizeCoefficients(true);
-        seg.setModelType(pcl::SACMODEL_PLANE);
-        seg.setMethodType(pcl::SAC_RANSAC);
-        seg.setDistanceThreshold(0.1);
-        PointCloudPtr voxel_cloud(new PointCloudType);
-        for (auto& i : indices) {
-          voxel_cloud->push_back(input_cloud_->points[i]);
+      }
+      auto delta = max_z_in_voxel - min_z_in_voxel;
+      if (delta >= 0. && delta <= distance_threshold) {
+        for (size_t i = voxel.first; i < voxel.second; ++i) {
+          ground_indices.push_back(voxel_points_[i].index);
         }
-        seg.setInputCloud(voxel_cloud);
-        seg.segment(*inliers, *coefficients);
-        float inliers_rate =
-            static_cast<float>(inliers->indices.size()) / indices.size();
-        if (inliers_rate > 0.85) {
-          for (auto index : inliers->indices) {
-            ground_indices.push_back(indices[index]);
-          }
+      }
+      return;
+    }
+
+    if (point_num < min_point_num_in_voxel_ * 2) {
+      return;
+    }
+    const float kInlierDistance = 0.1;
+    const float kMinInliersRate = 0.85;
+    if (point_num <= max_point_num_for_pca_) {
+      // closed-form fit, the inliers are the points close to the plane
+      scratch->points.clear();
+      for (size_t i = voxel.first; i < voxel.second; ++i) {
+        scratch->points.push_back(
+            input_cloud_->points[voxel_points_[i].index].getVector3fMap());
+      }
+      const auto plane = common::PlaneFitting(scratch->points);
+      const size_t first_inlier = ground_indices.size();
+      for (size_t i = 0; i < point_num; ++i) {
+        if (std::fabs((scratch->points[i] - plane.first).dot(plane.second)) <=
+            kInlierDistance) {
+          ground_indices.push_back(voxel_points_[voxel.first + i].index);
         }
       }
+      const float inliers_rate =
+          static_cast<float>(ground_indices.size() - first_inlier) /
+          point_num;
+      if (inliers_rate <= kMinInliersRate) {
+        ground_indices.resize(first_inlier);
+      }
+      return;
     }
-  }
 
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    pcl::SACSegmentation<PointT> seg;  // Create the segmentation object
+    seg.setOptimizeCoefficients(true);
+    seg.setModelType(pcl::SACMODEL_PLANE);
+    seg.setMethodType(pcl::SAC_RANSAC);
+    seg.setDistanceThreshold(kInlierDistance);
+    scratch->cloud->clear();
+    for (size_t i = voxel.first; i < voxel.second; ++i) {
+      scratch->cloud->push_back(
+          input_cloud_->points[voxel_points_[i].index]);
+    }
+    seg.setInputCloud(scratch->cloud);
+    seg.segment(scratch->inliers, scratch->coefficients);
+    float inliers_rate =
+        static_cast<float>(scratch->inliers.indices.size()) / point_num;
+    if (inliers_rate > kMinInliersRate) {
+      for (auto index : scratch->inliers.indices) {
+        ground_indices.push_back(voxel_points_[voxel.first + index].index);
+      }
+    }
+  }
 
- private:
   PointCloudPtr input_cloud_;
 
-  struct VectorCompare {
-    bool operator()(const Eigen::Vector3i a, const Eigen::Vector3i b) const {
-      return std::forward_as_tuple(a[0], a[1], a[2]) <
-             std::forward_as_tuple(b[0], b[1], b[2]);
-    }
-  };
-  std::map<Eigen::Vector3i, std::vector<int>, VectorCompare> voxels_;
+  // the points sorted by their voxels, and the runs of the voxels
+  std::vector<VoxelPoint> voxel_points_;
+  std::vector<Voxel> voxels_;
+  std::vector<Scratch> scratches_;
   size_t min_point_num_in_voxel_;
+  size_t max_point_num_for_pca_;
 
   float min_z_;
   float max_z_;
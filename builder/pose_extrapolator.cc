@@ -26,6 +26,10 @@
 
 namespace static_map {
 
+// ~10s of 400Hz imu msgs and 100Hz odom msgs after the last pose
+constexpr size_t kImuDataCapacity = 4096;
+constexpr size_t kOdometryDataCapacity = 1024;
+
 inline Eigen::Quaterniond Rotation(const PoseExtrapolator::RigidPose3d& pose) {
   return Eigen::Quaterniond(Eigen::Matrix3d(pose.block(0, 0, 3, 3)));
 }
@@ -34,7 +38,9 @@ PoseExtrapolator::PoseExtrapolator(const SimpleTime pose_queue_duration,
                                    double imu_gravity_time_constant)
     : pose_queue_duration_(pose_queue_duration),
       gravity_time_constant_(imu_gravity_time_constant),
-      cached_extrapolated_pose_{SimpleTime(), RigidPose3d::Identity()} {}
+      imu_data_(kImuDataCapacity),
+      cached_extrapolated_pose_{SimpleTime(), RigidPose3d::Identity()},
+      odometry_data_(kOdometryDataCapacity) {}
 
 std::unique_ptr<PoseExtrapolator> PoseExtrapolator::InitializeWithImu(
     const SimpleTime pose_queue_duration,
@@ -89,18 +95,47 @@ void PoseExtrapolator::AddPose(const SimpleTime time, const RigidPose3d& pose) {
     timed_pose_queue_.pop_front();
   }
   UpdateVelocitiesFromPoses();
-  AdvanceImuTracker(time, imu_tracker_.get());
+  if (!ReuseExtrapolatedImuTracker(time)) {
+    AdvanceImuTracker(time, imu_tracker_.get());
+  }
   TrimImuData();
   TrimOdometryData();
-  odometry_imu_tracker_ = common::make_unique<ImuTracker>(*imu_tracker_);
-  extrapolation_imu_tracker_ = common::make_unique<ImuTracker>(*imu_tracker_);
+  if (odometry_imu_tracker_ == nullptr) {
+    odometry_imu_tracker_ = common::make_unique<ImuTracker>(*imu_tracker_);
+    extrapolation_imu_tracker_ = common::make_unique<ImuTracker>(*imu_tracker_);
+  } else {
+    *odometry_imu_tracker_ = *imu_tracker_;
+    *extrapolation_imu_tracker_ = *imu_tracker_;
+  }
+  extrapolation_imu_tracker_outdated_ = false;
+}
+
+bool PoseExtrapolator::ReuseExtrapolatedImuTracker(const SimpleTime time) {
+  // the pose is usually added right after the extrapolation at the same time,
+  // integrated from imu_tracker_ by real imu data only (no faked gravity
+  // or velocities from poses which are just updated)
+  if (extrapolation_imu_tracker_ == nullptr ||
+      extrapolation_imu_tracker_outdated_ ||
+      extrapolation_imu_tracker_->time() != time || imu_data_.empty() ||
+      imu_tracker_->time() < imu_data_.front().header.stamp) {
+    return false;
+  }
+  *imu_tracker_ = *extrapolation_imu_tracker_;
+  return true;
 }
 
 void PoseExtrapolator::AddImuData(const sensors::ImuMsg& imu_data) {
   common::MutexLocker locker(&mutex_);
   CHECK(timed_pose_queue_.empty() ||
         imu_data.header.stamp >= timed_pose_queue_.back().time);
-  imu_data_.push_back(imu_data);
+  if (extrapolation_imu_tracker_ &&
+      imu_data.header.stamp < extrapolation_imu_tracker_->time()) {
+    extrapolation_imu_tracker_outdated_ = true;
+  }
+  if (!imu_data_.push_back(imu_data)) {
+    LOG_EVERY_N(WARNING, 1000) << "imu data queue is full, no pose for "
+                               << "a long time, the oldest one is dropped.";
+  }
   TrimImuData();
 }
 
@@ -108,7 +143,10 @@ void PoseExtrapolator::AddOdometryData(const sensors::OdomMsg& odometry_data) {
   common::MutexLocker locker(&mutex_);
   CHECK(timed_pose_queue_.empty() ||
         odometry_data.header.stamp >= timed_pose_queue_.back().time);
-  odometry_data_.push_back(odometry_data);
+  if (!odometry_data_.push_back(odometry_data)) {
+    LOG_EVERY_N(WARNING, 1000) << "odometry data queue is full, no pose for "
+                               << "a long time, the oldest one is dropped.";
+  }
   TrimOdometryData();
   if (odometry_data_.size() < 2) {
     return;
@@ -236,18 +274,17 @@ void PoseExtrapolator::AdvanceImuTracker(const SimpleTime time,
     // Advance to the beginning of 'imu_data_'.
     imu_tracker->Advance(imu_data_.front().header.stamp);
   }
-  auto it = std::lower_bound(
-      imu_data_.begin(), imu_data_.end(), imu_tracker->time(),
-      [](const sensors::ImuMsg& imu_data, const SimpleTime& time) {
-        return imu_data.header.stamp < time;
-      });
-  while (it != imu_data_.end() && it->header.stamp < time) {
-    imu_tracker->Advance(it->header.stamp);
+  const SimpleTime tracker_time = imu_tracker->time();
+  size_t i = imu_data_.LowerBound([&](const sensors::ImuMsg& imu_data) {
+    return imu_data.header.stamp < tracker_time;
+  });
+  for (; i < imu_data_.size() && imu_data_[i].header.stamp < time; ++i) {
+    const sensors::ImuMsg& imu_data = imu_data_[i];
+    imu_tracker->Advance(imu_data.header.stamp);
     imu_tracker->AddImuLinearAccelerationObservation(
-        it->linear_acceleration.ToEigenVector());
+        imu_data.linear_acceleration.ToEigenVector());
     imu_tracker->AddImuAngularVelocityObservation(
-        it->angular_velocity.ToEigenVector());
-    ++it;
+        imu_data.angular_velocity.ToEigenVector());
   }
   imu_tracker->Advance(time);
 }
@@ -28,6 +28,7 @@
 #include "Eigen/Eigen"
 #include "builder/imu_tracker.h"
 #include "builder/sensors.h"
+#include "common/fixed_ring.h"
 #include "common/math.h"
 #include "common/mutex.h"
 #include "common/simple_time.h"
@@ -75,6 +76,10 @@ class PoseExtrapolator {
   void TrimImuData();
   void TrimOdometryData();
   void AdvanceImuTracker(SimpleTime time, ImuTracker* imu_tracker) const;
+  /// @brief imu_tracker_ takes the state of extrapolation_imu_tracker_ if it
+  /// is integrated with the same imu data up to the time already
+  /// @return false if imu_tracker_ has to be advanced itself
+  bool ReuseExtrapolatedImuTracker(SimpleTime time);
   Eigen::Quaterniond ExtrapolateRotation(SimpleTime time,
                                          ImuTracker* imu_tracker) const;
   Eigen::Vector3d ExtrapolateTranslation(SimpleTime time);
@@ -93,13 +98,18 @@ class PoseExtrapolator {
   Eigen::Vector3d angular_velocity_from_poses_ = Eigen::Vector3d::Zero();
 
   const double gravity_time_constant_;
-  std::deque<sensors::ImuMsg> imu_data_;
+  // bounded, the imu data after the last pose is kept until a new pose
+  common::FixedRing<sensors::ImuMsg> imu_data_;
   std::unique_ptr<ImuTracker> imu_tracker_;
+  // allocated once, assigned from imu_tracker_ in place for every pose
   std::unique_ptr<ImuTracker> odometry_imu_tracker_;
   std::unique_ptr<ImuTracker> extrapolation_imu_tracker_;
+  // an imu msg older than extrapolation_imu_tracker_ was added after it was
+  // advanced, so its state can not be reused by imu_tracker_
+  bool extrapolation_imu_tracker_outdated_ = false;
   TimedPose cached_extrapolated_pose_;
 
-  std::deque<sensors::OdomMsg> odometry_data_;
+  common::FixedRing<sensors::OdomMsg> odometry_data_;
   Eigen::Vector3d linear_velocity_from_odometry_ = Eigen::Vector3d::Zero();
   Eigen::Vector3d angular_velocity_from_odometry_ = Eigen::Vector3d::Zero();
 };
@@ -88,10 +88,12 @@ class RandomSamplerWithPlaneDetect {
 
     int other_sum = 0;
     int other_sapmled_sum = 0;
+    // the next plane point, instead of erasing the front of the indices
+    auto next_plane_index = plane_indices.begin();
     for (int i = 0; i < input_cloud_->size(); ++i) {
-      if (i == plane_indices.front()) {
+      if (next_plane_index != plane_indices.end() && i == *next_plane_index) {
         cloud->push_back(input_cloud_->points[i]);
-        plane_indices.erase(plane_indices.begin());
+        ++next_plane_index;
       } else {
         other_sum++;
         if (static_cast<float>(other_sapmled_sum) /
@@ -22,6 +22,300 @@
 
 #include "builder/sensor_fusions/imu_gps_ekf.h"
 
+#include <algorithm>
+#include <cmath>
+
+#include "common/macro_defines.h"
+#include "common/math.h"
+
 namespace static_map {
-namespace sensor_fusions {}
+namespace sensor_fusions {
+
+namespace {
+
+// continuous-time noise densities of the imu
+constexpr double kAccNoise = 0.05;         // m/s^2/sqrt(Hz)
+constexpr double kGyroNoise = 0.005;       // rad/s/sqrt(Hz)
+constexpr double kAccBiasNoise = 0.001;    // m/s^3/sqrt(Hz)
+constexpr double kGyroBiasNoise = 0.0001;  // rad/s^2/sqrt(Hz)
+// the same as the gps factor in ImuGpsTracker
+constexpr double kUtmNoise = 2.0;  // m
+// utm messages older than the newest imu by it are dropped
+constexpr double kMaxUtmDelay = 0.5;  // s
+// imu gaps longer than it are integrated as one nominal period
+constexpr double kMaxImuGap = 0.5;  // s
+constexpr double kHistoryDuration = 10.;  // s
+constexpr double kMaxExtrapolationDuration = 0.5;  // s
+// yaw is only observable under motion, not ready until it converged
+const double kMaxYawVariance = common::Pow2(common::DegToRad(5.));
+
+inline Eigen::Matrix3d SkewSymmetric(const Eigen::Vector3d& v) {
+  Eigen::Matrix3d m;
+  m << 0., -v.z(), v.y(), v.z(), 0., -v.x(), -v.y(), v.x(), 0.;
+  return m;
+}
+
+inline Eigen::Quaterniond RotationVectorToQuaternion(
+    const Eigen::Vector3d& rotation_vector) {
+  const double angle = rotation_vector.norm();
+  if (angle < 1.e-9) {
+    // first order is accurate enough for such an angle
+    return Eigen::Quaterniond(1., 0.5 * rotation_vector.x(),
+                              0.5 * rotation_vector.y(),
+                              0.5 * rotation_vector.z())
+        .normalized();
+  }
+  return Eigen::Quaterniond(
+      Eigen::AngleAxisd(angle, rotation_vector / angle));
+}
+
+}  // namespace
+
+ImuGpsEkf::ImuGpsEkf(const double gravity_constant, const double imu_frequency,
+                     SimpleTime time)
+    : Interface(),
+      imu_period_(1. / imu_frequency),
+      last_imu_time_(time.toSec()),
+      gravity_(0., 0., -gravity_constant),
+      covariance_(StateCovariance::Zero()),
+      history_(static_cast<size_t>(
+          std::max(64., std::ceil(kHistoryDuration * imu_frequency)))) {
+  CHECK_GT(imu_frequency, 0.);
+  CHECK_GT(gravity_constant, 0.);
+}
+
+ImuGpsEkf::~ImuGpsEkf() {}
+
+void ImuGpsEkf::Initialize(const Eigen::Vector3d& acc, const double time) {
+  // static at the beginning, the acc is just the opposite of the gravity
+  rotation_ = Eigen::Quaterniond::FromTwoVectors(acc, Eigen::Vector3d::UnitZ());
+  position_.setZero();
+  velocity_.setZero();
+  acc_bias_.setZero();
+  gyro_bias_.setZero();
+  angular_velocity_.setZero();
+
+  covariance_.setZero();
+  // no position until the first utm
+  covariance_.block<3, 3>(0, 0) = Eigen::Matrix3d::Identity() * 1.e4;
+  covariance_.block<3, 3>(3, 3) = Eigen::Matrix3d::Identity() * 1.;
+  covariance_.block<2, 2>(6, 6) =
+      Eigen::Matrix2d::Identity() * common::Pow2(common::DegToRad(2.));
+  covariance_(8, 8) = common::Pow2(M_PI);
+  covariance_.block<3, 3>(9, 9) = Eigen::Matrix3d::Identity() * 1.e-2;
+  covariance_.block<3, 3>(12, 12) = Eigen::Matrix3d::Identity() * 1.e-4;
+
+  correction_rotation_.setIdentity();
+  correction_translation_.setZero();
+  history_.clear();
+  last_imu_time_ = time;
+  initialized_ = true;
+  PushHistory(time);
+}
+
+void ImuGpsEkf::AddImuData(const sensors::ImuMsg& imu_msg) {
+  const double time = imu_msg.header.stamp.toSec();
+  const Eigen::Vector3d acc = imu_msg.linear_acceleration.ToEigenVector();
+  const Eigen::Vector3d gyro = imu_msg.angular_velocity.ToEigenVector();
+
+  common::MutexLocker locker(&mutex_);
+  if (!initialized_) {
+    Initialize(acc, time);
+    return;
+  }
+  double delta_time = time - last_imu_time_;
+  if (delta_time <= 0.) {
+    PRINT_WARNING_FMT("Imu message out of order, delta_time: %lf", delta_time);
+    return;
+  }
+  if (delta_time > kMaxImuGap) {
+    PRINT_WARNING_FMT(
+        "Maybe missing imu message. delta_time: %lf, imu_period: %lf",
+        delta_time, imu_period_);
+    delta_time = imu_period_;
+  }
+  Predict(acc, gyro, delta_time);
+  last_imu_time_ = time;
+  PushHistory(time);
+}
+
+void ImuGpsEkf::Predict(const Eigen::Vector3d& acc,
+                        const Eigen::Vector3d& gyro, const double delta_time) {
+  const double dt = delta_time;
+  const Eigen::Matrix3d rotation = rotation_.toRotationMatrix();
+  const Eigen::Vector3d unbiased_acc = acc - acc_bias_;
+  angular_velocity_ = gyro - gyro_bias_;
+  const Eigen::Quaterniond delta_rotation =
+      RotationVectorToQuaternion(angular_velocity_ * dt);
+
+  // nominal state
+  const Eigen::Vector3d world_acc = rotation * unbiased_acc + gravity_;
+  position_ += velocity_ * dt + 0.5 * world_acc * dt * dt;
+  velocity_ += world_acc * dt;
+  rotation_ = (rotation_ * delta_rotation).normalized();
+
+  // error state, the rotation error is in the body frame
+  StateCovariance transition = StateCovariance::Identity();
+  transition.block<3, 3>(0, 3) = Eigen::Matrix3d::Identity() * dt;
+  transition.block<3, 3>(3, 6) = -rotation * SkewSymmetric(unbiased_acc) * dt;
+  transition.block<3, 3>(3, 9) = -rotation * dt;
+  transition.block<3, 3>(6, 6) =
+      delta_rotation.toRotationMatrix().transpose();
+  transition.block<3, 3>(6, 12) = -Eigen::Matrix3d::Identity() * dt;
+  covariance_ = transition * covariance_ * transition.transpose();
+
+  const double acc_variance = common::Pow2(kAccNoise) * dt;
+  const double gyro_variance = common::Pow2(kGyroNoise) * dt;
+  const double acc_bias_variance = common::Pow2(kAccBiasNoise) * dt;
+  const double gyro_bias_variance = common::Pow2(kGyroBiasNoise) * dt;
+  for (int i = 0; i < 3; ++i) {
+    covariance_(3 + i, 3 + i) += acc_variance;
+    covariance_(6 + i, 6 + i) += gyro_variance;
+    covariance_(9 + i, 9 + i) += acc_bias_variance;
+    covariance_(12 + i, 12 + i) += gyro_bias_variance;
+  }
+}
+
+void ImuGpsEkf::AddUtmData(const sensors::UtmMsg& utm_msg) {
+  common::MutexLocker locker(&mutex_);
+  if (!initialized_) {
+    return;
+  }
+  if (last_imu_time_ - utm_msg.header.stamp.toSec() > kMaxUtmDelay) {
+    PRINT_WARNING("Utm message is too old for the ekf, dropped.");
+    return;
+  }
+  const Eigen::Vector3d utm(utm_msg.x, utm_msg.y, utm_msg.z);
+  const Eigen::Quaterniond rotation_before = rotation_;
+  const Eigen::Vector3d position_before = position_;
+
+  // position measurement, H = [I 0 0 0 0]
+  const Eigen::Matrix3d innovation_covariance =
+      covariance_.block<3, 3>(0, 0) +
+      Eigen::Matrix3d::Identity() * common::Pow2(kUtmNoise);
+  const Eigen::Matrix<double, 15, 3> gain =
+      covariance_.leftCols<3>() * innovation_covariance.inverse();
+  const StateVector error_state = gain * (utm - position_);
+  covariance_ -= gain * covariance_.topRows<3>();
+  covariance_ = 0.5 * (covariance_ + covariance_.transpose()).eval();
+
+  // inject the error into the nominal state
+  position_ += error_state.segment<3>(0);
+  velocity_ += error_state.segment<3>(3);
+  rotation_ =
+      (rotation_ * RotationVectorToQuaternion(error_state.segment<3>(6)))
+          .normalized();
+  acc_bias_ += error_state.segment<3>(9);
+  gyro_bias_ += error_state.segment<3>(12);
+
+  // keep the history continuous, the jump goes into the correction
+  const Eigen::Quaterniond jump_rotation =
+      rotation_ * rotation_before.conjugate();
+  const Eigen::Vector3d jump_translation =
+      position_ - jump_rotation * position_before;
+  correction_translation_ =
+      jump_rotation * correction_translation_ + jump_translation;
+  correction_rotation_ = (jump_rotation * correction_rotation_).normalized();
+  got_utm_ = true;
+}
+
+void ImuGpsEkf::PushHistory(const double time) {
+  TimedPose pose;
+  pose.time = time;
+  const Eigen::Quaterniond inverse_correction =
+      correction_rotation_.conjugate();
+  pose.rotation = inverse_correction * rotation_;
+  pose.translation =
+      inverse_correction * (position_ - correction_translation_);
+  history_.push_back(pose);
+}
+
+bool ImuGpsEkf::PoseInHistory(const double time, TimedPose* pose) const {
+  CHECK(pose);
+  if (history_.empty() || time < history_.front().time) {
+    return false;
+  }
+  const TimedPose& last = history_.back();
+  if (time >= last.time) {
+    const double delta_time = time - last.time;
+    if (delta_time > kMaxExtrapolationDuration) {
+      return false;
+    }
+    // constant velocity, the velocity is in the corrected frame
+    pose->time = time;
+    pose->rotation =
+        Eigen::Quaterniond(last.rotation) *
+        RotationVectorToQuaternion(angular_velocity_ * delta_time);
+    pose->translation = last.translation + correction_rotation_.conjugate() *
+                                               velocity_ * delta_time;
+    return true;
+  }
+  const size_t index = history_.LowerBound(
+      [time](const TimedPose& p) { return p.time < time; });
+  if (index == 0) {
+    *pose = history_.front();
+    return true;
+  }
+  const TimedPose& prev = history_[index - 1];
+  const TimedPose& next = history_[index];
+  const double factor = (time - prev.time) / (next.time - prev.time);
+  pose->time = time;
+  pose->rotation = Eigen::Quaterniond(prev.rotation)
+                       .slerp(factor, Eigen::Quaterniond(next.rotation));
+  pose->translation =
+      prev.translation + factor * (next.translation - prev.translation);
+  return true;
+}
+
+bool ImuGpsEkf::IsReady() {
+  common::MutexLocker locker(&mutex_);
+  if (!initialized_ || !got_utm_) {
+    return false;
+  }
+  // variance of the yaw in the utm frame
+  const Eigen::Vector3d up_in_body =
+      rotation_.conjugate() * Eigen::Vector3d::UnitZ();
+  const double yaw_variance =
+      up_in_body.transpose() * covariance_.block<3, 3>(6, 6) * up_in_body;
+  return yaw_variance < kMaxYawVariance;
+}
+
+bool ImuGpsEkf::ExtrapolatePose(SimpleTime time, Eigen::Matrix4d* pose) {
+  CHECK(pose);
+  common::MutexLocker locker(&mutex_);
+  TimedPose history_pose;
+  if (!initialized_ || !got_utm_ ||
+      !PoseInHistory(time.toSec(), &history_pose)) {
+    return false;
+  }
+  pose->setIdentity();
+  pose->block<3, 3>(0, 0) =
+      (correction_rotation_ * Eigen::Quaterniond(history_pose.rotation))
+          .toRotationMatrix();
+  pose->block<3, 1>(0, 3) =
+      correction_rotation_ * history_pose.translation + correction_translation_;
+  return true;
+}
+
+bool ImuGpsEkf::RelativePose(SimpleTime from, SimpleTime to,
+                             Eigen::Matrix4d* pose) {
+  CHECK(pose);
+  common::MutexLocker locker(&mutex_);
+  TimedPose from_pose;
+  TimedPose to_pose;
+  if (!initialized_ || !PoseInHistory(from.toSec(), &from_pose) ||
+      !PoseInHistory(to.toSec(), &to_pose)) {
+    return false;
+  }
+  const Eigen::Quaterniond from_inverse =
+      Eigen::Quaterniond(from_pose.rotation).conjugate();
+  pose->setIdentity();
+  pose->block<3, 3>(0, 0) =
+      (from_inverse * Eigen::Quaterniond(to_pose.rotation)).toRotationMatrix();
+  pose->block<3, 1>(0, 3) =
+      from_inverse * (to_pose.translation - from_pose.translation);
+  return true;
+}
+
+}  // namespace sensor_fusions
 }  // namespace static_map
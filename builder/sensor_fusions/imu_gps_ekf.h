@@ -23,18 +23,31 @@
 #ifndef BUILDER_SENSOR_FUSIONS_IMU_GPS_EKF_H_
 #define BUILDER_SENSOR_FUSIONS_IMU_GPS_EKF_H_
 
+#include "Eigen/Eigen"
 #include "builder/sensor_fusions/interface.h"
 #include "builder/sensors.h"
+#include "common/fixed_ring.h"
 #include "common/mutex.h"
 #include "common/simple_time.h"
 
 namespace static_map {
 namespace sensor_fusions {
 
+/*
+ * @class ImuGpsEkf
+ * @brief error-state ekf fusing the imu with the utm positions
+ * the nominal state is position, velocity and orientation in the utm frame
+ * (z up) with the biases of the imu, the error state is 15 dimensional
+ * all matrices are fixed-size and the history of poses is a pre-allocated
+ * ring, so neither the prediction nor the update allocates
+ */
 class ImuGpsEkf : public Interface {
  public:
-  explicit ImuGpsEkf(const double imu_gravity_time_constant,
-                     const double imu_frequency, SimpleTime time);
+  using StateVector = Eigen::Matrix<double, 15, 1>;
+  using StateCovariance = Eigen::Matrix<double, 15, 15>;
+
+  explicit ImuGpsEkf(const double gravity_constant, const double imu_frequency,
+                     SimpleTime time);
   ~ImuGpsEkf();
 
   void AddImuData(const sensors::ImuMsg& imu_msg) final;
@@ -42,6 +55,62 @@ class ImuGpsEkf : public Interface {
   void AddOdomData(const sensors::OdomMsg&) final {
     LOG(FATAL) << "Not supported in this tracker.";
   }
+
+  /// @brief got the gps fix and the heading has converged
+  bool IsReady();
+  /// @brief pose of the imu in the utm frame at the time, interpolated in the
+  /// history or predicted with the latest velocity if newer than the last imu
+  /// @return false if not ready or the time is out of the history
+  bool ExtrapolatePose(SimpleTime time, Eigen::Matrix4d* pose);
+  /// @brief motion from time "from" to "to" in the imu frame of "from"
+  /// the corrections of the gps are not in it, so it is smooth in the history
+  bool RelativePose(SimpleTime from, SimpleTime to, Eigen::Matrix4d* pose);
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+ private:
+  // unaligned to be stored in the ring (a std::vector)
+  struct TimedPose {
+    double time = 0.;
+    Eigen::Quaternion<double, Eigen::DontAlign> rotation =
+        Eigen::Quaterniond::Identity();
+    Eigen::Vector3d translation = Eigen::Vector3d::Zero();
+  };
+
+  void Initialize(const Eigen::Vector3d& acc, double time);
+  void Predict(const Eigen::Vector3d& acc, const Eigen::Vector3d& gyro,
+               double delta_time);
+  void PushHistory(double time);
+  bool PoseInHistory(double time, TimedPose* pose) const;
+
+  const double imu_period_;
+
+  common::Mutex mutex_;
+  bool initialized_ GUARDED_BY(mutex_) = false;
+  bool got_utm_ GUARDED_BY(mutex_) = false;
+  double last_imu_time_ GUARDED_BY(mutex_) = 0.;
+
+  // nominal state
+  Eigen::Vector3d position_ GUARDED_BY(mutex_) = Eigen::Vector3d::Zero();
+  Eigen::Vector3d velocity_ GUARDED_BY(mutex_) = Eigen::Vector3d::Zero();
+  Eigen::Quaterniond rotation_ GUARDED_BY(mutex_) =
+      Eigen::Quaterniond::Identity();
+  Eigen::Vector3d acc_bias_ GUARDED_BY(mutex_) = Eigen::Vector3d::Zero();
+  Eigen::Vector3d gyro_bias_ GUARDED_BY(mutex_) = Eigen::Vector3d::Zero();
+  Eigen::Vector3d gravity_ GUARDED_BY(mutex_);
+  // latest bias-corrected angular velocity for predicting beyond the history
+  Eigen::Vector3d angular_velocity_ GUARDED_BY(mutex_) =
+      Eigen::Vector3d::Zero();
+  // error state covariance, order: p, v, theta, acc bias, gyro bias
+  StateCovariance covariance_ GUARDED_BY(mutex_);
+
+  // accumulated corrections of the updates, the history keeps the poses
+  // before them (corrected_pose = correction * history_pose)
+  Eigen::Quaterniond correction_rotation_ GUARDED_BY(mutex_) =
+      Eigen::Quaterniond::Identity();
+  Eigen::Vector3d correction_translation_ GUARDED_BY(mutex_) =
+      Eigen::Vector3d::Zero();
+  common::FixedRing<TimedPose> history_ GUARDED_BY(mutex_);
 };
 
 }  // namespace sensor_fusions
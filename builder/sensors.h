@@ -249,6 +249,8 @@ struct UtmMsg {
   double x = 0.;
   double y = 0.;
   double z = 0.;
+  // the horizontal standard deviation of the fix in meters, < 0 if unknown
+  double sigma = -1.;
 
   Eigen::Vector3d ToMatrix() { return Eigen::Vector3d(x, y, z); }
 };
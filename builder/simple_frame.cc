@@ -22,6 +22,7 @@
 
 #include "builder/simple_frame.h"
 #include "builder/msg_conversion.h"
+#include "common/point_types.h"
 #include "nabo/nabo.h"
 
 namespace static_map {
@@ -40,7 +41,8 @@ InlierPointPairs GetPointPairs(
   using PointCloudType = pcl::PointCloud<PointT>;
   using PointCloudPtr = typename PointCloudType::Ptr;
   PointCloudPtr transformed_cloud(new PointCloudType);
-  pcl::transformPointCloud(*last_frame->Cloud(), *transformed_cloud, delta);
+  common::TransformPointCloud(*last_frame->Cloud(), transformed_cloud.get(),
+                              delta);
 
   // typedef PointMatcher<float> PM;
   // typedef PM::DataPoints DP;
@@ -118,5 +120,11 @@ template InlierPointPairs GetPointPairs<pcl::PointXYZI>(
     const std::shared_ptr<SimpleFrame<pcl::PointXYZI>>& first_frame,
     const std::shared_ptr<SimpleFrame<pcl::PointXYZI>>& last_frame,
     double max_distance, int sample);
+#ifdef _USE_COMPACT_POINT_
+template InlierPointPairs GetPointPairs<PointXYZIc>(
+    const std::shared_ptr<SimpleFrame<PointXYZIc>>& first_frame,
+    const std::shared_ptr<SimpleFrame<PointXYZIc>>& last_frame,
+    double max_distance, int sample);
+#endif
 
 }  // namespace static_map
@@ -25,13 +25,19 @@
 // third_party
 #include <Eigen/Eigen>
 // stl
+#include <atomic>
+#include <chrono>
+#include <future>
 #include <memory>
 #include <string>
 // local
 #include "common/math.h"
+#include "common/pcd_writer.h"
+#include "common/shared_executor.h"
 #include "common/simple_time.h"
 #include "descriptor/m2dp.h"
 #include "registrators/registrator_interface.h"
+#include "registrators/soa_cloud.h"
 
 namespace static_map {
 
@@ -51,9 +57,12 @@ class SimpleFrame {
   using PointCloudType = pcl::PointCloud<PointType>;
   using PointCloudPtr = typename PointCloudType::Ptr;
   using PointCloudConstPtr = typename PointCloudType::ConstPtr;
+  using SoaCloudConstPtr =
+      std::shared_ptr<const registrator::SoaCloud<PointType>>;
 
   SimpleFrame()
       : global_pose_(Eigen::Matrix4f::Identity()),
+        pose_version_(0u),
         local_pose_(Eigen::Matrix4f::Identity()),
         transform_from_last_frame_(Eigen::Matrix4f::Identity()),
         transform_to_next_frame_(Eigen::Matrix4f::Identity()),
@@ -62,23 +71,23 @@ class SimpleFrame {
         related_odom_(OdomPose::Zero()),
         got_related_odom_(false) {}
 
-  ~SimpleFrame() = default;
+  ~SimpleFrame() { WaitForDescriptor(); }
 
   virtual void ToPcdFile(const std::string& filename) {
     if (cloud_ == nullptr || cloud_->empty()) {
       return;
     }
     if (!filename.empty()) {
-      pcl::io::savePCDFileBinaryCompressed(filename, *cloud_);
+      common::SavePcdFile(filename, *cloud_);
     } else {
-      pcl::io::savePCDFileBinaryCompressed("simple_frame.pcd", *cloud_);
+      common::SavePcdFile("simple_frame.pcd", *cloud_);
     }
   }
   inline Eigen::Matrix3f GlobalRotation() const {
-    return Eigen::Matrix3f(global_pose_.block(0, 0, 3, 3));
+    return Eigen::Matrix3f(GlobalPose().block(0, 0, 3, 3));
   }
   inline Eigen::Vector3f GlobalTranslation() const {
-    return Eigen::Vector3f(global_pose_.block(0, 3, 3, 1));
+    return Eigen::Vector3f(GlobalPose().block(0, 3, 3, 1));
   }
   inline Eigen::Matrix3f LocalRotation() const {
     return Eigen::Matrix3f(local_pose_.block(0, 0, 3, 3));
@@ -87,14 +96,18 @@ class SimpleFrame {
     return Eigen::Vector3f(local_pose_.block(0, 3, 3, 1));
   }
 
-  inline Eigen::Matrix4f GlobalPose() const { return global_pose_; }
-  inline void SetGlobalPose(const Eigen::Matrix4f& t) {
+  // a frame in a submap derives its global pose from the submap's one
+  virtual Eigen::Matrix4f GlobalPose() const { return global_pose_; }
+  virtual void SetGlobalPose(const Eigen::Matrix4f& t) {
     global_pose_ = t;
     common::NormalizeRotation(global_pose_);
+    ++pose_version_;
   }
   inline Eigen::VectorXf GlobalPoseIn6Dof() {
-    return common::TransformToVector6(global_pose_);
+    return common::TransformToVector6(GlobalPose());
   }
+  // increased by every SetGlobalPose(), for the poses derived from it
+  inline uint64_t PoseVersion() const { return pose_version_.load(); }
 
   inline Eigen::Matrix4f LocalPose() const { return local_pose_; }
   inline void SetLocalPose(const Eigen::Matrix4f& t) {
@@ -104,18 +117,38 @@ class SimpleFrame {
 
   // cloud
   virtual PointCloudPtr Cloud() = 0;
-  inline void SetCloud(const PointCloudPtr& cloud) { cloud_ = cloud; }
-  inline void ResetCloud() { cloud_.reset(); }
+  // the cloud is not changed while its descriptor is being calculated
+  inline void SetCloud(const PointCloudPtr& cloud) {
+    WaitForDescriptor();
+    cloud_ = cloud;
+    soa_cloud_.reset();
+  }
+  inline void ResetCloud() {
+    WaitForDescriptor();
+    cloud_.reset();
+    soa_cloud_.reset();
+  }
   inline void ClearCloud() {
+    WaitForDescriptor();
+    soa_cloud_.reset();
     if (cloud_) {
       cloud_->clear();
       cloud_->points.shrink_to_fit();
     }
   }
 
+  // the SoA copy of the (filtered) cloud shared with the registrators,
+  // it is the same one the registrators get for the cloud
+  inline void AttachSoaCloud() {
+    soa_cloud_ = registrator::SoaCloud<PointType>::Get(cloud_);
+  }
+  inline SoaCloudConstPtr GetSoaCloud() const { return soa_cloud_; }
+
   // descriptor (m2dp)
+  // waits for the calculation if it is still running in background
   inline typename descriptor::M2dp<PointType>::Descriptor GetDescriptor()
       const {
+    WaitForDescriptor();
     return descriptor_;
   }
   inline void SetDescriptor(
@@ -130,6 +163,28 @@ class SimpleFrame {
       PRINT_ERROR("did not get a descriptor for the frame.");
     }
   }
+  // calculate it in the shared executor, GetDescriptor() waits for it
+  inline void CalculateDescriptorAsync() {
+    WaitForDescriptor();
+    descriptor_ready_ =
+        common::SharedExecutor::Submit(common::TaskPriority::kLoopClosure,
+                                       [this]() { CalculateDescriptor(); })
+            .share();
+  }
+  // the descriptor is calculated by another task, e.g. after a refinement
+  inline void SetDescriptorReady(const std::shared_future<void>& ready) {
+    descriptor_ready_ = ready;
+  }
+  inline bool DescriptorReady() const {
+    return !descriptor_ready_.valid() ||
+           descriptor_ready_.wait_for(std::chrono::seconds(0)) ==
+               std::future_status::ready;
+  }
+  inline void WaitForDescriptor() const {
+    if (descriptor_ready_.valid()) {
+      descriptor_ready_.wait();
+    }
+  }
 
   // transform between last&next
   virtual void SetTransformToNext(const Eigen::Matrix4f& t) {
@@ -146,11 +201,14 @@ class SimpleFrame {
   }
 
   // utm
-  inline void SetRelatedUtm(const UtmPosition& utm) {
+  // @param sigma the horizontal standard deviation, < 0 if unknown
+  inline void SetRelatedUtm(const UtmPosition& utm, const double sigma = -1.) {
     related_utm_ = utm;
+    related_utm_sigma_ = sigma;
     got_related_utm_ = true;
   }
   inline UtmPosition GetRelatedUtm() { return related_utm_; }
+  inline double GetRelatedUtmSigma() const { return related_utm_sigma_; }
   inline bool HasUtm() { return got_related_utm_; }
 
   // odom
@@ -168,14 +226,18 @@ class SimpleFrame {
 
  protected:
   Eigen::Matrix4f global_pose_;
+  std::atomic<uint64_t> pose_version_;
   Eigen::Matrix4f local_pose_;
   Eigen::Matrix4f transform_from_last_frame_;
   Eigen::Matrix4f transform_to_next_frame_;
   PointCloudPtr cloud_;
+  SoaCloudConstPtr soa_cloud_;
   SimpleTime stamp_;
   typename descriptor::M2dp<PointType>::Descriptor descriptor_;
+  std::shared_future<void> descriptor_ready_;
 
   UtmPosition related_utm_;
+  double related_utm_sigma_ = -1.;
   bool got_related_utm_;
 
   OdomPose related_odom_;
@@ -21,12 +21,67 @@
 // SOFTWARE.
 
 #include "builder/submap.h"
+#include "builder/submap_file.h"
 #include "common/make_unique.h"
+#include "common/metrics.h"
+#include "common/pcd_writer.h"
+#include "common/point_types.h"
 #include "common/point_utils.h"
+#include "common/simple_thread_pool.h"
 #include "common/simple_time.h"
+#include "common/trace.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 
 namespace static_map {
 
+namespace {
+
+// the access order of all the submaps for the LRU eviction
+std::atomic<uint64_t> access_clock{0u};
+
+// the resolution of the voxels merging the frames and of the voxel filter
+constexpr float kSubmapVoxelSize = 0.1f;
+
+constexpr uint32_t kSubmapInfoMagic = 0x464e4953;  // "SINF"
+constexpr uint32_t kSubmapInfoVersion = 1;
+
+// the info file is the header followed by frame_count frame records
+struct SubmapInfoHeader {
+  uint32_t magic;
+  uint32_t version;
+  int32_t trajectory_index;
+  int32_t submap_index;
+  uint32_t secs;
+  uint32_t nsecs;
+  uint32_t frame_count;
+  uint32_t got_related_utm;
+  uint32_t got_related_odom;
+  uint32_t reserved;
+  double match_score;
+  double related_utm[3];
+  double related_odom[16];
+  // column major
+  float global_pose[16];
+  float transform_from_last[16];
+  float transform_to_next[16];
+};
+
+struct FrameInfoRecord {
+  uint32_t secs;
+  uint32_t nsecs;
+  float local_pose[16];
+};
+
+common::ThreadPool* DiskIoQueue() {
+  static common::ThreadPool queue(1);
+  return &queue;
+}
+
+}  // namespace
+
 template <typename PointType>
 void Submap<PointType>::InsertFrame(
     const std::shared_ptr<Frame<PointType>>& frame) {
@@ -35,11 +90,20 @@ void Submap<PointType>::InsertFrame(
 
   if (frames_.empty()) {
     this->global_pose_ = frame->GlobalPose();
+    front_end_pose_ = this->global_pose_;
     frame->SetLocalPose(Eigen::Matrix4f::Identity());
     this->SetTimeStamp(frame->GetTimeStamp());
+    // the poses of the shared frames from the front end as well
+    for (auto& shared : shared_frames_) {
+      shared.local_pose = front_end_pose_.inverse() * shared.local_pose;
+      if (!options_.enable_inner_multiview_icp) {
+        MergeFrame(shared.frame->Cloud(), shared.local_pose);
+      }
+    }
   } else {
     frame->SetLocalPose(this->global_pose_.inverse() * frame->GlobalPose());
   }
+  frame->AttachToSubmap(this);
 
   frame->id_.frame_index = frames_.size();
   frame->id_.submap_index = id_.submap_index;
@@ -47,58 +111,111 @@ void Submap<PointType>::InsertFrame(
   frames_.push_back(frame);
   if (frames_.size() == options_.frame_count) {
     full_ = true;
+    // the cloud is in memory, Cloud() waits for FinishCloud() to fill it
+    is_cloud_in_memory_ = true;
   }
 
-  if (full_.load()) {
-    PointCloudPtr output_cloud(new PointCloudType);
+  if (options_.enable_inner_multiview_icp) {
+    // the refined cloud replaces the merged one, so nothing to merge
+    return;
+  }
+  MergeFrame(frame->Cloud(), frame->LocalPose());
+}
+
+template <typename PointType>
+void Submap<PointType>::SetSharedFrames(
+    const std::vector<std::shared_ptr<Frame<PointType>>>& frames,
+    const Submap<PointType>& previous) {
+  CHECK(frames_.empty());
+  shared_frames_.clear();
+  for (const auto& frame : frames) {
+    CHECK(frame != nullptr);
+    SharedFrame shared;
+    shared.frame = frame;
+    // the global pose from the front end until the first InsertFrame(),
+    // the previous submap may be moved by the optimizer meanwhile
+    shared.local_pose = previous.FrontEndPose() * frame->LocalPose();
+    shared_frames_.push_back(shared);
+  }
+}
 
-    MultiResolutionVoxelMap<PointType> map;
+template <typename PointType>
+void Submap<PointType>::MergeFrame(const PointCloudPtr& frame_cloud,
+                                   const Eigen::Matrix4f& local_pose) {
+  // the frames are merged into the voxels as they arrive, so that only the
+  // output is left when the submap gets full
+  if (voxel_map_ == nullptr) {
+    MrvmSettings settings;
+    settings.high_resolution = kSubmapVoxelSize;
+    // the voxels are the voxel filter if nothing is sampled before it
+    settings.output_average = VoxelFilteredOnInsertion();
+    voxel_map_ = common::make_unique<MultiResolutionVoxelMap<PointType>>();
+    voxel_map_->Initialise(settings);
     // todo add a parameter : z offset
-    map.SetOffsetZ(1.2);
-    for (auto& frame : frames_) {
-      pcl::transformPointCloud(*frame->Cloud(), *output_cloud,
-                               frame->LocalPose());
-      if (options_.enable_check) {
-        FATAL_CHECK_CLOUD(output_cloud);
-      }
-      map.InsertPointCloud(output_cloud, frame->LocalTranslation());
-    }
-    map.OutputToPointCloud(0.51, this->cloud_);
+    voxel_map_->SetOffsetZ(1.2);
+  }
+  PointCloudPtr transformed_cloud(new PointCloudType);
+  common::TransformPointCloud(*frame_cloud, transformed_cloud.get(),
+                              local_pose);
+  if (options_.enable_check) {
+    FATAL_CHECK_CLOUD(transformed_cloud);
+  }
+  voxel_map_->InsertPointCloud(
+      transformed_cloud, Eigen::Vector3f(local_pose.block(0, 3, 3, 1)));
+}
 
-    // check if the submap is valid
-    if (options_.enable_check) {
-      FATAL_CHECK_CLOUD(this->cloud_);
+template <typename PointType>
+void Submap<PointType>::FinishCloud() {
+  CHECK(full_.load());
+  PointCloudPtr cloud(new PointCloudType);
+  if (options_.enable_inner_multiview_icp) {
+    MultiviewRegistratorLumPcl<PointType> multi_matcher;
+    for (auto& shared : shared_frames_) {
+      multi_matcher.AddNewCloud(shared.frame->Cloud(), shared.local_pose);
     }
-
-    if (options_.enable_inner_multiview_icp) {
-      MultiviewRegistratorLumPcl<PointType> multi_matcher;
-      for (auto& frame : frames_) {
-        multi_matcher.AddNewCloud(frame->Cloud(), frame->LocalPose());
-      }
-      multi_matcher.AlignAll(this->cloud_);
+    for (auto& frame : frames_) {
+      multi_matcher.AddNewCloud(frame->Cloud(), frame->LocalPose());
     }
+    multi_matcher.AlignAll(cloud);
+  } else {
+    CHECK(voxel_map_ != nullptr);
+    voxel_map_->OutputToPointCloud(0.51, cloud);
+    voxel_map_.reset();
+  }
 
-    if (options_.enable_random_sampleing) {
-      RandomSamplerWithPlaneDetect<PointType> random_sampler;
-      random_sampler.SetSamplingRate(options_.random_sampling_rate);
-      random_sampler.SetInputCloud(this->cloud_);
-      PointCloudPtr filtered_final_cloud(new PointCloudType);
-      random_sampler.Filter(filtered_final_cloud);
-      *this->cloud_ = *filtered_final_cloud;
-      filtered_final_cloud.reset();
-    }
+  // check if the submap is valid
+  if (options_.enable_check) {
+    FATAL_CHECK_CLOUD(cloud);
+  }
+  if (!VoxelFilteredOnInsertion()) {
+    FilterCloud(cloud);
+  }
+  // the shared frames are owned by the previous submap
+  shared_frames_.clear();
+  boost::upgrade_lock<ReadWriteMutex> locker(mutex_);
+  WriteMutexLocker write_locker(locker);
+  this->cloud_->swap(*cloud);
+}
 
-    if (options_.enable_voxel_filter && !this->cloud_->empty()) {
-      pcl::ApproximateVoxelGrid<PointType> approximate_voxel_filter;
-      approximate_voxel_filter.setLeafSize(0.1, 0.1, 0.1);
-      PointCloudPtr filtered_final_cloud(new PointCloudType);
-      approximate_voxel_filter.setInputCloud(this->cloud_);
-      approximate_voxel_filter.filter(*filtered_final_cloud);
-      *this->cloud_ = *filtered_final_cloud;
-      filtered_final_cloud.reset();
-    }
+template <typename PointType>
+void Submap<PointType>::FilterCloud(const PointCloudPtr& cloud) {
+  if (options_.enable_random_sampleing) {
+    RandomSamplerWithPlaneDetect<PointType> random_sampler;
+    random_sampler.SetSamplingRate(options_.random_sampling_rate);
+    random_sampler.SetInputCloud(cloud);
+    PointCloudPtr filtered_final_cloud(new PointCloudType);
+    random_sampler.Filter(filtered_final_cloud);
+    cloud->swap(*filtered_final_cloud);
+  }
 
-    is_cloud_in_memory_ = true;
+  if (options_.enable_voxel_filter && !cloud->empty()) {
+    pcl::ApproximateVoxelGrid<PointType> approximate_voxel_filter;
+    approximate_voxel_filter.setLeafSize(kSubmapVoxelSize, kSubmapVoxelSize,
+                                         kSubmapVoxelSize);
+    PointCloudPtr filtered_final_cloud(new PointCloudType);
+    approximate_voxel_filter.setInputCloud(cloud);
+    approximate_voxel_filter.filter(*filtered_final_cloud);
+    cloud->swap(*filtered_final_cloud);
   }
 }
 
@@ -150,45 +267,204 @@ void Submap<PointType>::SetMatchedTransformedToNext(const Eigen::Matrix4f& t) {
   }
   if (options_.enable_disk_saving) {
     CHECK(!save_filename_.empty());
-    ToPcdFile(save_path_ + save_filename_);
+    // the pcd file is a part of the map package
+    EnqueueIo([this]() {
+      ReadMutexLocker read_locker(mutex_);
+      ToPcdFile(save_path_ + save_filename_);
+    });
   }
 }
 
+template <typename PointType>
+std::shared_future<void> Submap<PointType>::EnqueueIo(
+    const std::function<void()>& task) {
+  common::MutexLocker locker(&io_mutex_);
+  // the queue is FIFO, waiting for the last one is waiting for all
+  last_io_ = DiskIoQueue()->enqueue(task).share();
+  return last_io_;
+}
+
 template <typename PointType>
 typename Submap<PointType>::PointCloudPtr Submap<PointType>::Cloud() {
-  cloud_inactive_time_ = 0;
+  // a new submap is finished along with its descriptor
+  this->WaitForDescriptor();
+  Touch();
+  if (!is_cloud_in_memory_.load()) {
+    std::shared_future<void> loading;
+    {
+      common::MutexLocker locker(&io_mutex_);
+      loading = loading_;
+    }
+    if (loading.valid()) {
+      loading.wait();
+    }
+  }
   boost::upgrade_lock<ReadWriteMutex> locker(mutex_);
   if (!is_cloud_in_memory_.load()) {
     WriteMutexLocker write_locker(locker);
-    CHECK(pcl::io::loadPCDFile<PointType>(save_path_ + save_filename_,
-                                          *this->cloud_) == 0);
-    is_cloud_in_memory_ = true;
+    LoadCloud();
     // PRINT_DEBUG_FMT("get submap data %d from disk.", id_.submap_index);
   }
   return this->cloud_;
 }
 
 template <typename PointType>
-bool Submap<PointType>::UpdateInactiveTime(const int update_time_in_sec) {
-  if (!options_.enable_disk_saving) {
-    return true;
+void Submap<PointType>::Prefetch() {
+  if ((!options_.enable_disk_saving && !in_package_ && !quantized_.load()) ||
+      is_cloud_in_memory_.load()) {
+    return;
+  }
+  // also cancels a queued eviction
+  Touch();
+  {
+    common::MutexLocker locker(&io_mutex_);
+    if (loading_.valid() && loading_.wait_for(std::chrono::seconds(0)) !=
+                                std::future_status::ready) {
+      return;
+    }
+  }
+  auto loading = EnqueueIo([this]() {
+    boost::upgrade_lock<ReadWriteMutex> locker(mutex_);
+    if (!is_cloud_in_memory_.load()) {
+      WriteMutexLocker write_locker(locker);
+      LoadCloud();
+    }
+  });
+  common::MutexLocker locker(&io_mutex_);
+  loading_ = loading;
+}
+
+template <typename PointType>
+void Submap<PointType>::LoadCloud() {
+  common::TraceArgs trace_args;
+  trace_args.trajectory = id_.trajectory_index;
+  trace_args.submap = id_.submap_index;
+  common::ScopedTrace scoped_trace("submap.reload", trace_args);
+  if (quantized_.load()) {
+    // the quantized copy is kept, the cloud can be released again for free
+    quantized_cloud_.Decode(this->cloud_.get());
+    is_cloud_in_memory_ = true;
+    released_bytes_ = 0u;
+    static common::Counter* const decodes =
+        common::MetricsRegistry::Get()->GetCounter("submap_cache.decodes");
+    decodes->Add();
+    return;
   }
-  if (!got_matched_transform_to_next_.load()) {
-    return true;
+  std::unique_ptr<SubmapFile<PointType>> file;
+  if (spilled_.load()) {
+    file = SubmapFile<PointType>::Open(SpillFileName());
+  } else if (!checkpoint_filename_.empty()) {
+    file = SubmapFile<PointType>::Open(checkpoint_filename_);
   }
+  if (!file || !file->CopyTo(this->cloud_.get())) {
+    CHECK(pcl::io::loadPCDFile<PointType>(save_path_ + save_filename_,
+                                          *this->cloud_) == 0);
+  }
+  is_cloud_in_memory_ = true;
+  released_bytes_ = 0u;
+  static common::Counter* const reloads =
+      common::MetricsRegistry::Get()->GetCounter("submap_cache.reloads");
+  reloads->Add();
+}
 
+template <typename PointType>
+void Submap<PointType>::Touch() {
+  last_access_ = ++access_clock;
+}
+
+template <typename PointType>
+size_t Submap<PointType>::ResidentBytes() {
+  if (!is_cloud_in_memory_.load() && !quantized_.load()) {
+    return 0;
+  }
+  ReadMutexLocker locker(mutex_);
+  size_t bytes = quantized_.load() ? quantized_cloud_.Bytes() : 0u;
+  if (is_cloud_in_memory_.load()) {
+    bytes += this->cloud_->points.capacity() * sizeof(PointType);
+  }
+  return bytes;
+}
+
+template <typename PointType>
+bool Submap<PointType>::Evictable() const {
+  if (!got_matched_transform_to_next_.load() || evicting_.load()) {
+    return false;
+  }
+  if (is_cloud_in_memory_.load()) {
+    return options_.enable_disk_saving ||
+           options_.enable_memory_quantization;
+  }
+  // the quantized copy is the last one in RAM
+  return quantized_.load() && options_.enable_disk_saving;
+}
+
+template <typename PointType>
+void Submap<PointType>::RequestEviction() {
+  if (!Evictable() || evicting_.exchange(true)) {
+    return;
+  }
+  const uint64_t requested_access = last_access_.load();
+  EnqueueIo([this, requested_access]() { Evict(requested_access); });
+}
+
+template <typename PointType>
+void Submap<PointType>::Evict(const uint64_t requested_access) {
   boost::upgrade_lock<ReadWriteMutex> locker(mutex_);
+  static common::Counter* const evictions =
+      common::MetricsRegistry::Get()->GetCounter("submap_cache.evictions");
+  // it may be used again after the eviction was queued
+  if (last_access_.load() != requested_access) {
+    evicting_ = false;
+    return;
+  }
   if (is_cloud_in_memory_.load()) {
-    cloud_inactive_time_ += update_time_in_sec;
-    if (cloud_inactive_time_ > options_.disk_saving_delay) {
-      WriteMutexLocker write_locker(locker);
-      this->cloud_->points.clear();
-      this->cloud_->points.shrink_to_fit();
-      is_cloud_in_memory_ = false;
-      // PRINT_DEBUG_FMT("Remove submap %d from RAM.", id_.submap_index);
+    // the cloud does not change any more, so it is quantized or written
+    // only once, a restored cloud is read from its checkpoint instead
+    if (options_.enable_memory_quantization) {
+      if (!quantized_.load()) {
+        quantized_cloud_.Encode(*this->cloud_,
+                                options_.memory_quantization_resolution);
+        quantized_ = true;
+        static common::Counter* const quantizations =
+            common::MetricsRegistry::Get()->GetCounter(
+                "submap_cache.quantizations");
+        quantizations->Add();
+      }
+    } else if (!spilled_.load() && checkpoint_filename_.empty() &&
+               !this->cloud_->empty()) {
+      spilled_ = SubmapFile<PointType>::Write(
+          SpillFileName(), id_.trajectory_index, id_.submap_index,
+          this->global_pose_, this->GetDescriptor(), *this->cloud_,
+          options_.enable_disk_compression
+              ? options_.disk_compression_resolution
+              : 0.f);
     }
+    WriteMutexLocker write_locker(locker);
+    released_bytes_ = this->cloud_->points.size() * sizeof(PointType);
+    this->cloud_->points.clear();
+    this->cloud_->points.shrink_to_fit();
+    is_cloud_in_memory_ = false;
+    evictions->Add();
+    // PRINT_DEBUG_FMT("Remove submap %d from RAM.", id_.submap_index);
+  } else if (quantized_.load() && options_.enable_disk_saving) {
+    // the quantized copy goes to disk at last
+    if (!spilled_.load() && checkpoint_filename_.empty() &&
+        !quantized_cloud_.Empty()) {
+      PointCloudType cloud;
+      quantized_cloud_.Decode(&cloud);
+      spilled_ = SubmapFile<PointType>::Write(
+          SpillFileName(), id_.trajectory_index, id_.submap_index,
+          this->global_pose_, this->GetDescriptor(), cloud,
+          options_.enable_disk_compression
+              ? options_.disk_compression_resolution
+              : 0.f);
+    }
+    WriteMutexLocker write_locker(locker);
+    quantized_cloud_.Clear();
+    quantized_ = false;
+    evictions->Add();
   }
-  return is_cloud_in_memory_.load();
+  evicting_ = false;
 }
 
 template <typename PointType>
@@ -199,9 +475,9 @@ void Submap<PointType>::ToPcdFile(const std::string& filename) {
 
   // PRINT_INFO("Export submap pcd file.");
   if (!filename.empty()) {
-    pcl::io::savePCDFileBinaryCompressed(filename, *this->cloud_);
+    common::SavePcdFile(filename, *this->cloud_);
   } else {
-    pcl::io::savePCDFileBinaryCompressed(
+    common::SavePcdFile(
         "submap_" + std::to_string(id_.submap_index) + ".pcd", *this->cloud_);
   }
 }
@@ -225,19 +501,121 @@ void Submap<PointType>::ToVtkFile(const std::string& filename) {
 
 template <typename PointType>
 void Submap<PointType>::ToInfoFile(const std::string& filename) {
-  std::ofstream info_file(filename, std::ios::out | std::ios::binary);
-  if (info_file.is_open()) {
-    info_file.close();
-  } else {
+  std::ofstream info_file(filename,
+                          std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!info_file.is_open()) {
     PRINT_ERROR_FMT("Cannot open file: %s", filename.c_str());
+    return;
+  }
+  ReadMutexLocker locker(mutex_);
+  SubmapInfoHeader header;
+  std::memset(&header, 0, sizeof(header));
+  header.magic = kSubmapInfoMagic;
+  header.version = kSubmapInfoVersion;
+  header.trajectory_index = id_.trajectory_index;
+  header.submap_index = id_.submap_index;
+  header.secs = this->stamp_.secs;
+  header.nsecs = this->stamp_.nsecs;
+  header.frame_count = frames_.size();
+  header.got_related_utm = this->got_related_utm_;
+  header.got_related_odom = this->got_related_odom_;
+  header.match_score = match_score_to_previous_submap_;
+  Eigen::Map<Eigen::Vector3d>(header.related_utm) = this->related_utm_;
+  Eigen::Map<Eigen::Matrix4d>(header.related_odom) = this->related_odom_;
+  Eigen::Map<Eigen::Matrix4f>(header.global_pose) = this->GlobalPose();
+  Eigen::Map<Eigen::Matrix4f>(header.transform_from_last) =
+      this->TransformFromLast();
+  Eigen::Map<Eigen::Matrix4f>(header.transform_to_next) =
+      this->TransformToNext();
+  info_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  for (const auto& frame : frames_) {
+    FrameInfoRecord record;
+    record.secs = frame->GetTimeStamp().secs;
+    record.nsecs = frame->GetTimeStamp().nsecs;
+    Eigen::Map<Eigen::Matrix4f>(record.local_pose) = frame->LocalPose();
+    info_file.write(reinterpret_cast<const char*>(&record), sizeof(record));
+  }
+  if (!info_file.good()) {
+    PRINT_ERROR_FMT("Failed to write file: %s", filename.c_str());
   }
 }
 
+template <typename PointType>
+bool Submap<PointType>::LoadInfoFile(const std::string& info_filename,
+                                     const std::string& cloud_filename,
+                                     const bool matched_to_next) {
+  CHECK(frames_.empty());
+  std::ifstream info_file(info_filename, std::ios::in | std::ios::binary);
+  SubmapInfoHeader header;
+  if (!info_file.is_open() ||
+      !info_file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      header.magic != kSubmapInfoMagic ||
+      header.version != kSubmapInfoVersion) {
+    PRINT_ERROR_FMT("Invalid submap info file: %s", info_filename.c_str());
+    return false;
+  }
+  const auto cloud_file = SubmapFile<PointType>::Open(cloud_filename);
+  if (!cloud_file ||
+      cloud_file->Header().trajectory_index != header.trajectory_index ||
+      cloud_file->Header().submap_index != header.submap_index) {
+    PRINT_ERROR_FMT("Invalid submap file: %s", cloud_filename.c_str());
+    return false;
+  }
+
+  SubmapId id;
+  id.trajectory_index = header.trajectory_index;
+  id.submap_index = header.submap_index;
+  SetId(id);
+  this->SetTimeStamp(SimpleTime(header.secs, header.nsecs));
+  match_score_to_previous_submap_ = header.match_score;
+  if (header.got_related_utm) {
+    this->SetRelatedUtm(Eigen::Map<const Eigen::Vector3d>(header.related_utm));
+  }
+  if (header.got_related_odom) {
+    this->SetRelatedOdom(
+        Eigen::Map<const Eigen::Matrix4d>(header.related_odom));
+  }
+  this->SetGlobalPose(Eigen::Map<const Eigen::Matrix4f>(header.global_pose));
+  // the front end continues from the restored poses
+  front_end_pose_ = this->global_pose_;
+  this->SetTransformFromLast(
+      Eigen::Map<const Eigen::Matrix4f>(header.transform_from_last));
+  this->SetTransformToNext(
+      Eigen::Map<const Eigen::Matrix4f>(header.transform_to_next));
+  this->SetDescriptor(cloud_file->Descriptor());
+
+  frames_.reserve(header.frame_count);
+  for (uint32_t i = 0; i < header.frame_count; ++i) {
+    FrameInfoRecord record;
+    if (!info_file.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+      PRINT_ERROR_FMT("Truncated submap info file: %s",
+                      info_filename.c_str());
+      frames_.clear();
+      return false;
+    }
+    auto frame = std::make_shared<Frame<PointType>>();
+    frame->SetTimeStamp(SimpleTime(record.secs, record.nsecs));
+    frame->SetLocalPose(Eigen::Map<const Eigen::Matrix4f>(record.local_pose));
+    frame->AttachToSubmap(this);
+    frame->id_.frame_index = i;
+    frame->id_.submap_index = id_.submap_index;
+    frame->id_.trajectory_index = id_.trajectory_index;
+    frames_.push_back(frame);
+  }
+
+  // the cloud is loaded from the submap file when it is used
+  checkpoint_filename_ = cloud_filename;
+  full_ = true;
+  is_cloud_in_memory_ = false;
+  got_matched_transform_to_next_ = matched_to_next;
+  return true;
+}
+
 template <typename PointType>
 void Submap<PointType>::ClearCloudInFrames() {
   CHECK(full_.load());
   for (auto& frame : frames_) {
-    frame->ClearCloud();
+    frame->ReleaseCloud();
   }
 }
 
@@ -254,15 +632,6 @@ std::vector<SubmapId>& Submap<PointType>::GetConnected() {
   return connected_submaps_;
 }
 
-template <typename PointType>
-void Submap<PointType>::UpdateInnerFramePose() {
-  boost::upgrade_lock<ReadWriteMutex> locker(mutex_);
-  WriteMutexLocker write_locker(locker);
-  for (auto& frame : frames_) {
-    frame->SetGlobalPose(this->global_pose_ * frame->LocalPose());
-  }
-}
-
 template <typename PointType>
 std::string Submap<PointType>::SavedFileName() {
   if (options_.enable_disk_saving) {
@@ -277,8 +646,52 @@ void Submap<PointType>::SetSavedFileName(const std::string& filename) {
 }
 
 template <typename PointType>
-Submap<PointType>::~Submap() {}
+void Submap<PointType>::SetPackageFile(const std::string& path,
+                                       const std::string& filename) {
+  save_path_ = path;
+  save_filename_ = filename;
+  in_package_ = true;
+  is_cloud_in_memory_ = false;
+}
+
+template <typename PointType>
+void Submap<PointType>::ReleaseCloud() {
+  this->WaitForDescriptor();
+  boost::upgrade_lock<ReadWriteMutex> locker(mutex_);
+  if (!is_cloud_in_memory_.load() ||
+      (!in_package_ && !spilled_.load() && !quantized_.load() &&
+       checkpoint_filename_.empty())) {
+    return;
+  }
+  WriteMutexLocker write_locker(locker);
+  released_bytes_ = this->cloud_->points.size() * sizeof(PointType);
+  this->cloud_->points.clear();
+  this->cloud_->points.shrink_to_fit();
+  is_cloud_in_memory_ = false;
+}
+
+template <typename PointType>
+Submap<PointType>::~Submap() {
+  std::shared_future<void> last_io;
+  {
+    common::MutexLocker locker(&io_mutex_);
+    last_io = last_io_;
+  }
+  if (last_io.valid()) {
+    last_io.wait();
+  }
+  // the frames may be kept by others
+  for (auto& frame : frames_) {
+    frame->DetachFromSubmap();
+  }
+  if (spilled_.load()) {
+    std::remove(SpillFileName().c_str());
+  }
+}
 
 template class Submap<pcl::PointXYZI>;
+#ifdef _USE_COMPACT_POINT_
+template class Submap<PointXYZIc>;
+#endif
 
 }  // namespace static_map
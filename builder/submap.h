@@ -30,6 +30,8 @@
 #include <pcl/io/vtk_io.h>
 // stl
 #include <atomic>
+#include <functional>
+#include <future>
 #include <memory>
 #include <ostream>
 #include <sstream>
@@ -41,6 +43,7 @@
 #include "builder/multi_resolution_voxel_map.h"
 #include "builder/random_sample_with_plane_detect.h"
 #include "common/mutex.h"
+#include "common/quantized_cloud.h"
 #include "registrators/multiview_registrator_lum_pcl.h"
 
 #include <boost/thread/pthread/shared_mutex.hpp>
@@ -70,6 +73,20 @@ struct SubmapId {
   }
 };
 
+/// @brief the match of a submap to an earlier one than the previous submap
+struct EarlierSubmapMatch {
+  int32_t submap_index;
+  // from the earlier submap to this one
+  Eigen::Matrix4f transform;
+  double score;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+using EarlierSubmapMatches =
+    std::vector<EarlierSubmapMatch,
+                Eigen::aligned_allocator<EarlierSubmapMatch>>;
+
 using static_map::registrator::MultiviewRegistratorLumPcl;
 
 struct SubmapOptions {
@@ -79,10 +96,23 @@ struct SubmapOptions {
   bool enable_check = true;
   float random_sampling_rate = 0.5;
   int32_t frame_count = 5;
+  // the last frames of a submap are also merged into the next one, so that
+  // the neighbours overlap, they are shared by reference but not copied
+  int32_t overlap_frame_count = 0;
 
   // disk saving function
   bool enable_disk_saving = false;
-  int32_t disk_saving_delay = 10;  // seconds
+  // the clouds of all submaps kept in RAM, the least recently used ones
+  // are saved to disk when over it
+  int32_t disk_saving_budget_mb = 2048;
+  // compress the clouds saved to disk, the points are quantized in meters
+  bool enable_disk_compression = false;
+  float disk_compression_resolution = 0.001;
+  // the clouds over the budget are quantized in RAM first (16-bit
+  // coordinates and 8-bit intensities, about 1/4 of the bytes), only the
+  // quantized ones are saved to disk then if disk saving is enabled
+  bool enable_memory_quantization = false;
+  float memory_quantization_resolution = 0.001;
   std::string saving_name_prefix = "submap_";
 };
 
@@ -107,7 +137,12 @@ class Submap : public SimpleFrame<PointType> {
         full_(false),
         is_cloud_in_memory_(false),
         got_matched_transform_to_next_(false),
-        cloud_inactive_time_(0) {
+        last_access_(0u),
+        spilled_(false),
+        quantized_(false),
+        evicting_(false),
+        released_bytes_(0u) {
+    front_end_pose_.setIdentity();
     this->cloud_.reset(new PointCloudType);
   }
   ~Submap();
@@ -123,16 +158,39 @@ class Submap : public SimpleFrame<PointType> {
   void ToPcdFile(const std::string& filename) override;
   /// @brief save the inner cloud into a vtk file
   void ToVtkFile(const std::string& filename);
-  /// @brief save all information including cloud data into a give file
+  /// @brief save all information but the cloud data into a given file,
+  /// the cloud is saved in a SubmapFile along with the pose and descriptor
   void ToInfoFile(const std::string& filename);
+  /// @brief restore a full submap from its info file and submap file
+  /// the cloud is loaded from the submap file when it is used
+  /// @return false if either file is invalid
+  bool LoadInfoFile(const std::string& info_filename,
+                    const std::string& cloud_filename,
+                    const bool matched_to_next);
   /// @brief insert single cloud frame into the submap
   void InsertFrame(const std::shared_ptr<Frame<PointType>>& frame);
-  /// @brief clean the cloud data in frames (for saving RAM) only if the
-  /// submap cloud data is stable
+  /// @brief the frames of the previous submap merged into this one as well,
+  /// it keeps owning them, their poses in this submap are set on the first
+  /// InsertFrame(), so call it before that
+  /// @param previous the submap owning the frames, its front end pose keeps
+  /// their poses away from the optimizer
+  void SetSharedFrames(
+      const std::vector<std::shared_ptr<Frame<PointType>>>& frames,
+      const Submap<PointType>& previous);
+  /// @brief output the merged (or refined with enable_inner_multiview_icp)
+  /// cloud of a full submap and filter it, InsertFrame leaves it to this so
+  /// that the caller can schedule it without stalling the next submaps
+  /// @note Cloud() waits for the descriptor, which comes after this
+  void FinishCloud();
+  /// @brief release the cloud data in frames (for saving RAM) only if the
+  /// submap cloud data is stable, i.e. finished and matched, the released
+  /// bytes leave the "memory.frames.bytes" gauge
   void ClearCloudInFrames();
-  /// @brief if the submap's global pose has been changed,
-  /// you should call this func to update the inner frames's global pose
-  void UpdateInnerFramePose();
+  /// @brief the global pose from the front end (of the first frame), the
+  /// optimizer does not change it, so it is the same in every run
+  inline const Eigen::Matrix4f& FrontEndPose() const {
+    return front_end_pose_;
+  }
   /// @brief set the matrix to next and set flag to true as well
   void SetMatchedTransformedToNext(const Eigen::Matrix4f& t);
   /// @brief when the submap is full, you can insert no more frames into it
@@ -148,9 +206,22 @@ class Submap : public SimpleFrame<PointType> {
   /// @brief we do not just return the cloud
   /// @notice we update the active status and inactive time in this function
   PointCloudPtr Cloud() override;
-  /// @brief we manage all submaps' memory in a single thread
-  /// and this managing thread tells each submap how long has it been waited
-  bool UpdateInactiveTime(const int update_time_in_sec);
+  /// @brief start loading an evicted cloud on the disk io thread, Cloud()
+  /// waits for it instead of loading again
+  void Prefetch();
+  /// @brief the bytes of the cloud in RAM, including the quantized copy
+  size_t ResidentBytes();
+  /// @brief the bytes of the cloud released from RAM, it is read from the
+  /// disk when used again
+  inline size_t ReleasedBytes() const { return released_bytes_.load(); }
+  /// @brief the order of the last access among all submaps
+  inline uint64_t LastAccess() const { return last_access_.load(); }
+  /// @brief the cloud can be quantized in RAM or saved to disk and released
+  bool Evictable() const;
+  inline bool Evicting() const { return evicting_.load(); }
+  /// @brief evict the cloud on the disk io thread, it is cancelled if the
+  /// cloud is accessed before that
+  void RequestEviction();
   /// @brief connect to another submap with this id
   /// @todo one submap should be connected directly to another submap
   /// but not a SubmapId (a submap's id can be changed, but it self will stay
@@ -163,15 +234,59 @@ class Submap : public SimpleFrame<PointType> {
   /// @brief set the path without filename
   void SetSavePath(const std::string& path);
   std::string SavedFileName();
+  /// @brief the submap of a map package, its cloud is read from the pcd
+  /// file (path + filename) only when it is used
+  void SetPackageFile(const std::string& path, const std::string& filename);
+  /// @brief release the cloud if it can be read again from the disk (a map
+  /// package, a checkpoint or a spill file), Cloud() reloads it
+  void ReleaseCloud();
 
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
  public:
   double match_score_to_previous_submap_ = 0.;
+  // the accepted matches to the submaps before the previous one, set along
+  // with the match to the previous one, before it is marked as matched
+  EarlierSubmapMatches earlier_submap_matches_;
+
+ private:
+  void FilterCloud(const PointCloudPtr& cloud);
+  // merge a frame with its pose in this submap into the voxels
+  void MergeFrame(const PointCloudPtr& frame_cloud,
+                  const Eigen::Matrix4f& local_pose);
+  // the averaged voxels of the frames are the voxel filtered cloud when it
+  // is neither refined nor sampled before the voxel filter
+  inline bool VoxelFilteredOnInsertion() const {
+    return options_.enable_voxel_filter && !options_.enable_random_sampleing &&
+           !options_.enable_inner_multiview_icp;
+  }
+  // all the disk reads and writes go through a single background thread
+  std::shared_future<void> EnqueueIo(const std::function<void()>& task);
+  // quantize the cloud in RAM (if enabled), or write it into the spill
+  // file (if not yet), and release it
+  void Evict(const uint64_t requested_access);
+  void Touch();
+  // with the write lock held
+  void LoadCloud();
+  inline std::string SpillFileName() const {
+    return save_path_ + save_filename_ + ".smap";
+  }
 
  private:
   ReadWriteMutex mutex_;
   std::vector<std::shared_ptr<Frame<PointType>>> frames_;
+  Eigen::Matrix4f front_end_pose_;
+  // a frame of the previous submap and its pose in this one
+  struct SharedFrame {
+    std::shared_ptr<Frame<PointType>> frame;
+    Eigen::Matrix4f local_pose;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+  std::vector<SharedFrame, Eigen::aligned_allocator<SharedFrame>>
+      shared_frames_;
+  // the frames merged so far, released when the submap is full
+  std::unique_ptr<MultiResolutionVoxelMap<PointType>> voxel_map_;
 
   SubmapOptions options_;
   SubmapId id_;
@@ -180,7 +295,21 @@ class Submap : public SimpleFrame<PointType> {
   std::atomic<bool> full_;
   std::atomic<bool> is_cloud_in_memory_;
   std::atomic<bool> got_matched_transform_to_next_;
-  std::atomic<int> cloud_inactive_time_;
+  std::atomic<uint64_t> last_access_;
+  // the cloud has been written into the spill file
+  std::atomic<bool> spilled_;
+  // quantized_cloud_ keeps the cloud, the cloud does not change any more
+  std::atomic<bool> quantized_;
+  common::QuantizedCloud<PointType> quantized_cloud_;
+  std::atomic<bool> evicting_;
+  std::atomic<size_t> released_bytes_;
+  // the submap file of a submap restored from a checkpoint
+  std::string checkpoint_filename_;
+  // the pcd file of a submap loaded from a map package
+  bool in_package_ = false;
+  common::Mutex io_mutex_;
+  std::shared_future<void> last_io_;
+  std::shared_future<void> loading_;
 
   std::vector<SubmapId> connected_submaps_;
 };
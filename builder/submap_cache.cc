@@ -0,0 +1,81 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "builder/submap_cache.h"
+#include "common/point_types.h"
+
+#include <algorithm>
+#include <tuple>
+
+namespace static_map {
+
+template <typename PointType>
+SubmapCache<PointType>::SubmapCache(const size_t budget_bytes)
+    : budget_bytes_(budget_bytes),
+      resident_bytes_(0),
+      resident_gauge_(common::MetricsRegistry::Get()->GetGauge(
+          "submap_cache.resident_bytes")) {}
+
+template <typename PointType>
+void SubmapCache<PointType>::Update(const std::vector<SubmapPtr>& submaps) {
+  // (last access, bytes, submap)
+  std::vector<std::tuple<uint64_t, size_t, Submap<PointType>*>> candidates;
+  size_t resident_bytes = 0;
+  for (const auto& submap : submaps) {
+    if (submap->Evicting()) {
+      continue;
+    }
+    const size_t bytes = submap->ResidentBytes();
+    if (bytes == 0) {
+      continue;
+    }
+    resident_bytes += bytes;
+    if (submap->Evictable()) {
+      candidates.emplace_back(submap->LastAccess(), bytes, submap.get());
+    }
+  }
+
+  if (resident_bytes > budget_bytes_) {
+    // the least recently used first
+    std::sort(candidates.begin(), candidates.end(),
+              [](const std::tuple<uint64_t, size_t, Submap<PointType>*>& a,
+                 const std::tuple<uint64_t, size_t, Submap<PointType>*>& b) {
+                return std::get<0>(a) < std::get<0>(b);
+              });
+    for (const auto& candidate : candidates) {
+      if (resident_bytes <= budget_bytes_) {
+        break;
+      }
+      std::get<2>(candidate)->RequestEviction();
+      resident_bytes -= std::get<1>(candidate);
+    }
+  }
+  resident_bytes_ = resident_bytes;
+  resident_gauge_->Set(static_cast<int64_t>(resident_bytes));
+}
+
+template class SubmapCache<pcl::PointXYZI>;
+#ifdef _USE_COMPACT_POINT_
+template class SubmapCache<PointXYZIc>;
+#endif
+
+}  // namespace static_map
@@ -0,0 +1,68 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#ifndef BUILDER_SUBMAP_CACHE_H_
+#define BUILDER_SUBMAP_CACHE_H_
+
+// stl
+#include <memory>
+#include <vector>
+// local
+#include "builder/submap.h"
+#include "common/metrics.h"
+
+namespace static_map {
+
+/*
+ * @class SubmapCache
+ * @brief keeps the clouds of all submaps (of all trajectories) in RAM under
+ * a byte budget, the least recently used ones are saved to disk first.
+ * the resident bytes, evictions and reloads are in the metrics named
+ * submap_cache.*
+ */
+template <typename PointType>
+class SubmapCache {
+ public:
+  using SubmapPtr = std::shared_ptr<Submap<PointType>>;
+
+  explicit SubmapCache(const size_t budget_bytes);
+  ~SubmapCache() = default;
+
+  SubmapCache(const SubmapCache&) = delete;
+  SubmapCache& operator=(const SubmapCache&) = delete;
+
+  /// @brief request evictions until the resident bytes are under budget
+  /// the submaps being evicted are not counted as resident
+  void Update(const std::vector<SubmapPtr>& submaps);
+
+  inline size_t BudgetBytes() const { return budget_bytes_; }
+  /// @brief the resident bytes of the last update
+  inline size_t ResidentBytes() const { return resident_bytes_; }
+
+ private:
+  const size_t budget_bytes_;
+  size_t resident_bytes_;
+  common::Gauge* const resident_gauge_;
+};
+
+}  // namespace static_map
+
+#endif  // BUILDER_SUBMAP_CACHE_H_
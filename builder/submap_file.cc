@@ -0,0 +1,211 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "builder/submap_file.h"
+#include "common/cloud_codec.h"
+#include "common/macro_defines.h"
+#include "common/point_types.h"
+
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <vector>
+
+namespace static_map {
+
+namespace {
+
+constexpr uint32_t kSubmapFileMagic = 0x50414d53;  // "SMAP"
+constexpr uint32_t kSubmapFileVersion = 2;
+// the points start at a page boundary
+constexpr uint64_t kPointsAlignment = 4096;
+
+}  // namespace
+
+template <typename PointType>
+bool SubmapFile<PointType>::Write(const std::string& filename,
+                                  const int32_t trajectory_index,
+                                  const int32_t submap_index,
+                                  const Eigen::Matrix4f& pose,
+                                  const Eigen::VectorXf& descriptor,
+                                  const PointCloudType& cloud,
+                                  const float compression_resolution) {
+  std::ofstream file(filename,
+                     std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    PRINT_ERROR_FMT("Cannot open file: %s", filename.c_str());
+    return false;
+  }
+
+  SubmapFileHeader header;
+  std::memset(&header, 0, sizeof(header));
+  header.magic = kSubmapFileMagic;
+  header.version = kSubmapFileVersion;
+  header.point_size = sizeof(PointType);
+  header.descriptor_size = descriptor.size();
+  header.trajectory_index = trajectory_index;
+  header.submap_index = submap_index;
+  header.point_count = cloud.size();
+  const uint64_t descriptor_end =
+      sizeof(header) + header.descriptor_size * sizeof(float);
+  header.points_offset = (descriptor_end + kPointsAlignment - 1) /
+                         kPointsAlignment * kPointsAlignment;
+  Eigen::Map<Eigen::Matrix4f>(header.pose) = pose;
+  Eigen::Map<Eigen::Vector3f> bbox_min(header.bbox_min);
+  Eigen::Map<Eigen::Vector3f> bbox_max(header.bbox_max);
+  if (cloud.empty()) {
+    bbox_min.setZero();
+    bbox_max.setZero();
+  } else {
+    bbox_min.setConstant(std::numeric_limits<float>::max());
+    bbox_max.setConstant(std::numeric_limits<float>::lowest());
+    for (const auto& point : cloud.points) {
+      bbox_min = bbox_min.cwiseMin(point.getVector3fMap());
+      bbox_max = bbox_max.cwiseMax(point.getVector3fMap());
+    }
+  }
+
+  std::vector<char> encoded;
+  if (compression_resolution > 0.f) {
+    header.compressed = 1;
+    header.resolution = compression_resolution;
+    common::CloudCodec<PointType> codec(bbox_min, compression_resolution);
+    codec.Encode(cloud, &encoded);
+    header.points_bytes = encoded.size();
+  } else {
+    header.points_bytes = header.point_count * sizeof(PointType);
+  }
+
+  const std::vector<char> padding(header.points_offset - descriptor_end, 0);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(descriptor.data()),
+             header.descriptor_size * sizeof(float));
+  file.write(padding.data(), padding.size());
+  if (header.compressed) {
+    file.write(encoded.data(), encoded.size());
+  } else {
+    file.write(reinterpret_cast<const char*>(cloud.points.data()),
+               header.points_bytes);
+  }
+  return file.good();
+}
+
+template <typename PointType>
+std::unique_ptr<SubmapFile<PointType>> SubmapFile<PointType>::Open(
+    const std::string& filename) {
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 ||
+      file_stat.st_size < static_cast<off_t>(sizeof(SubmapFileHeader))) {
+    close(fd);
+    return nullptr;
+  }
+  const size_t length = file_stat.st_size;
+  void* const data = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping stays valid after closing
+  close(fd);
+  if (data == MAP_FAILED) {
+    PRINT_ERROR_FMT("Failed to map file: %s", filename.c_str());
+    return nullptr;
+  }
+
+  std::unique_ptr<SubmapFile> file(new SubmapFile(data, length));
+  const SubmapFileHeader& header = file->Header();
+  if (header.magic != kSubmapFileMagic ||
+      header.version != kSubmapFileVersion ||
+      header.point_size != sizeof(PointType) ||
+      header.points_offset % kPointsAlignment != 0 ||
+      // the descriptor is between the header and the points
+      sizeof(header) + header.descriptor_size * sizeof(float) >
+          header.points_offset ||
+      header.points_offset > length ||
+      header.points_bytes > length - header.points_offset ||
+      (!header.compressed &&
+       header.points_bytes != header.point_count * sizeof(PointType))) {
+    PRINT_ERROR_FMT("Not a valid submap file: %s", filename.c_str());
+    return nullptr;
+  }
+  file->points_ = reinterpret_cast<const PointType*>(
+      static_cast<const char*>(data) + header.points_offset);
+  return file;
+}
+
+template <typename PointType>
+SubmapFile<PointType>::SubmapFile(void* const data, const size_t length)
+    : data_(data),
+      length_(length),
+      header_(static_cast<const SubmapFileHeader*>(data)),
+      points_(nullptr) {}
+
+template <typename PointType>
+SubmapFile<PointType>::~SubmapFile() {
+  munmap(data_, length_);
+}
+
+template <typename PointType>
+Eigen::Matrix4f SubmapFile<PointType>::Pose() const {
+  return Eigen::Map<const Eigen::Matrix4f>(header_->pose);
+}
+
+template <typename PointType>
+Eigen::VectorXf SubmapFile<PointType>::Descriptor() const {
+  return Eigen::Map<const Eigen::VectorXf>(
+      reinterpret_cast<const float*>(header_ + 1), header_->descriptor_size);
+}
+
+template <typename PointType>
+void SubmapFile<PointType>::WillNeed() const {
+  madvise(data_, length_, MADV_WILLNEED);
+}
+
+template <typename PointType>
+bool SubmapFile<PointType>::CopyTo(PointCloudType* const cloud) const {
+  CHECK(cloud);
+  if (Compressed()) {
+    const common::CloudCodec<PointType> codec(
+        Eigen::Map<const Eigen::Vector3f>(header_->bbox_min),
+        header_->resolution);
+    return codec.Decode(reinterpret_cast<const char*>(points_),
+                        header_->points_bytes, cloud);
+  }
+  cloud->points.assign(points_, points_ + Size());
+  cloud->width = Size();
+  cloud->height = 1;
+  return true;
+}
+
+template class SubmapFile<pcl::PointXYZI>;
+#ifdef _USE_COMPACT_POINT_
+template class SubmapFile<PointXYZIc>;
+#endif
+
+}  // namespace static_map
@@ -0,0 +1,116 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#ifndef BUILDER_SUBMAP_FILE_H_
+#define BUILDER_SUBMAP_FILE_H_
+
+// third party
+#include <Eigen/Eigen>
+#include <pcl/point_cloud.h>
+// stl
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace static_map {
+
+/*
+ * @struct SubmapFileHeader
+ * @brief the fixed header of a submap file, it is followed by the
+ * descriptor (descriptor_size floats) and the points, which start at
+ * points_offset (a multiple of the page size) with the in-memory layout,
+ * or coded by common::CloudCodec if compressed
+ */
+struct SubmapFileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t point_size;
+  uint32_t descriptor_size;
+  int32_t trajectory_index;
+  int32_t submap_index;
+  uint32_t compressed;
+  // quantization of the compressed points relative to bbox_min
+  float resolution;
+  uint64_t point_count;
+  uint64_t points_offset;
+  uint64_t points_bytes;
+  // global pose, column major
+  float pose[16];
+  float bbox_min[3];
+  float bbox_max[3];
+};
+
+/*
+ * @class SubmapFile
+ * @brief a submap saved in the SubmapFileHeader layout and read back by
+ * mmap, so the points are used without parsing and the page cache keeps
+ * the recently used files
+ */
+template <typename PointType>
+class SubmapFile {
+ public:
+  using PointCloudType = pcl::PointCloud<PointType>;
+
+  ~SubmapFile();
+
+  SubmapFile(const SubmapFile&) = delete;
+  SubmapFile& operator=(const SubmapFile&) = delete;
+
+  /// @brief return false if the file can not be written
+  /// the points are compressed if compression_resolution > 0
+  static bool Write(const std::string& filename,
+                    const int32_t trajectory_index,
+                    const int32_t submap_index, const Eigen::Matrix4f& pose,
+                    const Eigen::VectorXf& descriptor,
+                    const PointCloudType& cloud,
+                    const float compression_resolution = 0.f);
+  /// @brief map the file, nullptr if it is not a valid submap file
+  static std::unique_ptr<SubmapFile> Open(const std::string& filename);
+
+  inline const SubmapFileHeader& Header() const { return *header_; }
+  inline size_t Size() const { return header_->point_count; }
+  inline bool Compressed() const { return header_->compressed != 0; }
+  /// @brief the points in the mapped file, valid as long as this object
+  /// nullptr if they are compressed
+  inline const PointType* Points() const {
+    return Compressed() ? nullptr : points_;
+  }
+  Eigen::Matrix4f Pose() const;
+  Eigen::VectorXf Descriptor() const;
+
+  /// @brief tell the kernel the points will be read soon
+  void WillNeed() const;
+  /// @brief one copy of the mapped points (or decoding them in parallel)
+  /// @return false if the compressed points are corrupted
+  bool CopyTo(PointCloudType* const cloud) const;
+
+ private:
+  SubmapFile(void* const data, const size_t length);
+
+  void* const data_;
+  const size_t length_;
+  const SubmapFileHeader* header_;
+  const PointType* points_;
+};
+
+}  // namespace static_map
+
+#endif  // BUILDER_SUBMAP_FILE_H_
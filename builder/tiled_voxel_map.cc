@@ -0,0 +1,342 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// stl
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <numeric>
+// local
+#include "builder/tiled_voxel_map.h"
+#include "common/macro_defines.h"
+#include "common/point_types.h"
+
+namespace static_map {
+
+namespace {
+
+// the index of (x, y) on the hilbert curve filling a n x n grid
+// n is a power of 2
+uint64_t HilbertIndex(const uint32_t n, uint32_t x, uint32_t y) {
+  uint64_t index = 0;
+  for (uint32_t s = n / 2; s > 0; s /= 2) {
+    const uint32_t rx = (x & s) > 0;
+    const uint32_t ry = (y & s) > 0;
+    index += static_cast<uint64_t>(s) * s * ((3 * rx) ^ ry);
+    // rotate the quadrant
+    if (ry == 0) {
+      if (rx == 1) {
+        x = n - 1 - x;
+        y = n - 1 - y;
+      }
+      std::swap(x, y);
+    }
+  }
+  return index;
+}
+
+// the segment from a to b in 2d against the box [min, max], slab method
+bool SegmentIntersectsBox(const Eigen::Vector2f& a, const Eigen::Vector2f& b,
+                          const Eigen::Vector2f& min,
+                          const Eigen::Vector2f& max) {
+  float t_enter = 0.f;
+  float t_exit = 1.f;
+  const Eigen::Vector2f direction = b - a;
+  for (int i = 0; i < 2; ++i) {
+    if (std::fabs(direction[i]) < 1.e-9f) {
+      if (a[i] < min[i] || a[i] > max[i]) {
+        return false;
+      }
+      continue;
+    }
+    float t_near = (min[i] - a[i]) / direction[i];
+    float t_far = (max[i] - a[i]) / direction[i];
+    if (t_near > t_far) {
+      std::swap(t_near, t_far);
+    }
+    t_enter = std::max(t_enter, t_near);
+    t_exit = std::min(t_exit, t_far);
+    if (t_enter > t_exit) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// the tiles are paged with the flat storage on host
+MrvmSettings FlatSettings(const MrvmSettings& settings) {
+  MrvmSettings flat_settings = settings;
+  if (flat_settings.block_storage) {
+    PRINT_WARNING("the tiled map does not support block storage, ignored.");
+    flat_settings.block_storage = false;
+  }
+  if (flat_settings.gpu_insertion) {
+    PRINT_WARNING("the tiled map does not support gpu insertion, ignored.");
+    flat_settings.gpu_insertion = false;
+  }
+  return flat_settings;
+}
+
+}  // namespace
+
+TileGrid::TileGrid(double tile_width, double ray_range, float resolution)
+    : resolution_(resolution),
+      ray_range_(ray_range),
+      tile_voxels_(std::max(
+          1, static_cast<int>(std::lround(tile_width / resolution)))) {}
+
+std::vector<TileGrid::TileIndex> TileGrid::TilesInRange(
+    const Eigen::Vector3f& origin) const {
+  const double tile_size = tile_voxels_ * resolution_;
+  const int min_x = std::floor((origin[0] - ray_range_) / tile_size);
+  const int max_x = std::floor((origin[0] + ray_range_) / tile_size);
+  const int min_y = std::floor((origin[1] - ray_range_) / tile_size);
+  const int max_y = std::floor((origin[1] + ray_range_) / tile_size);
+  std::vector<TileIndex> indices;
+  for (int x = min_x; x <= max_x; ++x) {
+    for (int y = min_y; y <= max_y; ++y) {
+      indices.emplace_back(x, y);
+    }
+  }
+  return indices;
+}
+
+Eigen::AlignedBox3i TileGrid::TileBounds(const TileIndex& index) const {
+  constexpr int kIntMax = std::numeric_limits<int>::max();
+  return Eigen::AlignedBox3i(
+      Eigen::Vector3i(index.first * tile_voxels_, index.second * tile_voxels_,
+                      -kIntMax),
+      Eigen::Vector3i((index.first + 1) * tile_voxels_ - 1,
+                      (index.second + 1) * tile_voxels_ - 1, kIntMax));
+}
+
+bool TileGrid::RayReachesTile(const Eigen::Vector2f& start,
+                              const Eigen::Vector2f& end,
+                              const TileIndex& index) const {
+  // the voxels on a ray may be off the segment a little
+  const float tile_size = tile_voxels_ * resolution_;
+  const float margin = 2.f * resolution_;
+  const Eigen::Vector2f min(index.first * tile_size - margin,
+                            index.second * tile_size - margin);
+  const Eigen::Vector2f max((index.first + 1) * tile_size + margin,
+                            (index.second + 1) * tile_size + margin);
+  return SegmentIntersectsBox(start, end, min, max);
+}
+
+template <typename PointT>
+TiledVoxelMap<PointT>::TiledVoxelMap(const TiledVoxelMapOptions& options,
+                                     const MrvmSettings& settings)
+    : options_(options),
+      settings_(FlatSettings(settings)),
+      grid_(options.tile_width, options.ray_range,
+            settings.high_resolution) {
+  CHECK_GT(options_.tile_width, 0.);
+  CHECK_GT(options_.ray_range, 0.);
+  CHECK_GT(options_.memory_budget_mb, 0);
+}
+
+template <typename PointT>
+TiledVoxelMap<PointT>::~TiledVoxelMap() {
+  for (auto& tile : tiles_) {
+    if (tile.second.paged) {
+      std::remove(CacheFilename(tile.first).c_str());
+    }
+  }
+}
+
+template <typename PointT>
+std::vector<int> TiledVoxelMap<PointT>::SpatiallyCoherentOrder(
+    const std::vector<Eigen::Vector3f>& positions, const double cell_width) {
+  std::vector<int> order(positions.size());
+  std::iota(order.begin(), order.end(), 0);
+  if (positions.empty()) {
+    return order;
+  }
+  std::vector<Eigen::Vector2i> cells;
+  cells.reserve(positions.size());
+  Eigen::Vector2i min_cell = Eigen::Vector2i::Constant(INT_MAX);
+  Eigen::Vector2i max_cell = Eigen::Vector2i::Constant(INT_MIN);
+  for (const auto& position : positions) {
+    const Eigen::Vector2i cell(
+        static_cast<int>(std::floor(position[0] / cell_width)),
+        static_cast<int>(std::floor(position[1] / cell_width)));
+    min_cell = min_cell.cwiseMin(cell);
+    max_cell = max_cell.cwiseMax(cell);
+    cells.push_back(cell);
+  }
+  const int extent = (max_cell - min_cell).maxCoeff() + 1;
+  uint32_t n = 1;
+  while (n < static_cast<uint32_t>(extent)) {
+    n <<= 1;
+  }
+  std::vector<uint64_t> curve_indices(positions.size());
+  for (size_t i = 0; i < cells.size(); ++i) {
+    const Eigen::Vector2i cell = cells[i] - min_cell;
+    curve_indices[i] = HilbertIndex(n, cell[0], cell[1]);
+  }
+  std::stable_sort(order.begin(), order.end(), [&](const int a, const int b) {
+    return curve_indices[a] < curve_indices[b];
+  });
+  return order;
+}
+
+template <typename PointT>
+bool TiledVoxelMap<PointT>::Plan(const std::vector<Eigen::Vector3f>& origins,
+                                 const std::string& filename) {
+  CHECK(tiles_.empty() && cloud_index_ == 0) << "planned already";
+  planned_cloud_num_ = origins.size();
+  for (size_t i = 0; i < origins.size(); ++i) {
+    for (const auto& tile_index : grid_.TilesInRange(origins[i])) {
+      tiles_[tile_index].last_cloud = i;
+    }
+  }
+  PRINT_INFO_FMT("%zu clouds planned in %zu tiles.", origins.size(),
+                 tiles_.size());
+  return writer_.Open(filename);
+}
+
+template <typename PointT>
+void TiledVoxelMap<PointT>::InsertPointCloud(const PointCloudPtr& cloud,
+                                             const Eigen::Vector3f& origin) {
+  CHECK_LT(cloud_index_, planned_cloud_num_) << "the cloud is not planned";
+  const int cloud_index = cloud_index_++;
+
+  PointCloudType cloud_in_range;
+  const size_t dropped_num = grid_.CropToRange(*cloud, origin, &cloud_in_range);
+  if (dropped_num > 0) {
+    PRINT_WARNING_FMT("%zu points out of the ray range are dropped.",
+                      dropped_num);
+  }
+
+  PointCloudPtr tile_cloud(new PointCloudType);
+  for (const auto& tile_index : grid_.TilesInRange(origin)) {
+    auto it = tiles_.find(tile_index);
+    CHECK(it != tiles_.end() && it->second.last_cloud >= cloud_index)
+        << "the cloud is not inserted in the planned order";
+    Tile& tile = it->second;
+    grid_.CropToTile(cloud_in_range, origin, tile_index, tile_cloud.get());
+    if (!tile_cloud->empty()) {
+      Activate(tile_index, &tile);
+      tile.map->InsertPointCloud(tile_cloud, origin);
+      tile.memory_bytes = tile.map->MemoryBytes();
+      tile.last_insert = cloud_index;
+    }
+    if (tile.last_cloud == cloud_index) {
+      OutputTile(tile_index, &tile);
+      tiles_.erase(it);
+    }
+  }
+  PageOutOverBudget();
+}
+
+template <typename PointT>
+size_t TiledVoxelMap<PointT>::Finish() {
+  if (cloud_index_ < static_cast<int>(planned_cloud_num_)) {
+    PRINT_WARNING_FMT("only %d / %zu planned clouds are inserted.",
+                      cloud_index_, planned_cloud_num_);
+  }
+  for (auto& tile : tiles_) {
+    OutputTile(tile.first, &tile.second);
+  }
+  tiles_.clear();
+  writer_.Close();
+  return writer_.PointNum();
+}
+
+template <typename PointT>
+std::string TiledVoxelMap<PointT>::CacheFilename(
+    const TileIndex& index) const {
+  return options_.cache_path + "tile_" + std::to_string(index.first) + "_" +
+         std::to_string(index.second) + ".voxels";
+}
+
+template <typename PointT>
+void TiledVoxelMap<PointT>::Activate(const TileIndex& index, Tile* tile) {
+  if (tile->map) {
+    return;
+  }
+  tile->map.reset(new MultiResolutionVoxelMap<PointT>);
+  tile->map->Initialise(settings_);
+  tile->map->SetBounds(grid_.TileBounds(index));
+  if (tile->paged) {
+    const std::string filename = CacheFilename(index);
+    CHECK(tile->map->LoadVoxels(filename)) << "lost the tile " << filename;
+    std::remove(filename.c_str());
+    tile->paged = false;
+  }
+}
+
+template <typename PointT>
+void TiledVoxelMap<PointT>::OutputTile(const TileIndex& index, Tile* tile) {
+  if (!tile->map && !tile->paged) {
+    // reached by no points
+    return;
+  }
+  Activate(index, tile);
+  if (!tile->map->OutputToPointCloud(settings_.prob_threshold, &writer_)) {
+    PRINT_ERROR("failed to write the tile.");
+  }
+  tile->map.reset();
+  tile->memory_bytes = 0;
+}
+
+template <typename PointT>
+void TiledVoxelMap<PointT>::PageOutOverBudget() {
+  const size_t budget =
+      static_cast<size_t>(options_.memory_budget_mb) * 1024 * 1024;
+  size_t bytes = 0;
+  for (const auto& tile : tiles_) {
+    bytes += tile.second.memory_bytes;
+  }
+  while (bytes > budget) {
+    // the least recently inserted tile in memory
+    auto least_recent = tiles_.end();
+    for (auto it = tiles_.begin(); it != tiles_.end(); ++it) {
+      if (it->second.map && (least_recent == tiles_.end() ||
+                             it->second.last_insert <
+                                 least_recent->second.last_insert)) {
+        least_recent = it;
+      }
+    }
+    if (least_recent == tiles_.end()) {
+      break;
+    }
+    Tile& tile = least_recent->second;
+    if (!tile.map->SaveVoxels(CacheFilename(least_recent->first))) {
+      PRINT_ERROR("failed to page the tile out, keep it in memory.");
+      break;
+    }
+    tile.map.reset();
+    tile.paged = true;
+    bytes -= tile.memory_bytes;
+    tile.memory_bytes = 0;
+  }
+}
+
+template class TiledVoxelMap<pcl::PointXYZI>;
+#ifdef _USE_COMPACT_POINT_
+template class TiledVoxelMap<PointXYZIc>;
+#endif
+
+}  // namespace static_map
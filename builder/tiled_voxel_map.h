@@ -0,0 +1,172 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef BUILDER_TILED_VOXEL_MAP_H_
+#define BUILDER_TILED_VOXEL_MAP_H_
+
+// stl
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+// local
+#include "builder/multi_resolution_voxel_map.h"
+#include "common/pcd_stream_writer.h"
+
+namespace static_map {
+
+struct TiledVoxelMapOptions {
+  bool enable = false;
+  // the width of the square tiles in meters
+  double tile_width = 100.;
+  // the points farther than it (in x-y) from their origins are dropped
+  double ray_range = 100.;
+  // the tiles are paged to disk when their voxels are over it
+  int memory_budget_mb = 4096;
+  // the directory of the paged tiles
+  std::string cache_path = "./";
+};
+
+/// @class TileGrid
+/// @brief the square tiles (in x-y) of the voxels, and the tiles reached by
+/// the rays of the clouds, a tile is unbounded in z
+class TileGrid {
+ public:
+  using TileIndex = std::pair<int, int>;
+
+  TileGrid(double tile_width, double ray_range, float resolution);
+
+  /// @brief the tiles reached by the rays (in the range) from the origin
+  std::vector<TileIndex> TilesInRange(const Eigen::Vector3f& origin) const;
+  /// @brief the voxels in the tile
+  Eigen::AlignedBox3i TileBounds(const TileIndex& index) const;
+  /// @brief whether the ray in x-y may pass through a voxel of the tile
+  bool RayReachesTile(const Eigen::Vector2f& start, const Eigen::Vector2f& end,
+                      const TileIndex& index) const;
+
+  /// @brief the points in the ray range from the origin (in x-y)
+  /// @return the number of the dropped points
+  template <typename PointT>
+  size_t CropToRange(const pcl::PointCloud<PointT>& cloud,
+                     const Eigen::Vector3f& origin,
+                     pcl::PointCloud<PointT>* cloud_in_range) const {
+    const float range_squared = ray_range_ * ray_range_;
+    cloud_in_range->clear();
+    cloud_in_range->points.reserve(cloud.size());
+    for (const auto& point : cloud.points) {
+      const float dx = point.x - origin[0];
+      const float dy = point.y - origin[1];
+      if (dx * dx + dy * dy <= range_squared) {
+        cloud_in_range->push_back(point);
+      }
+    }
+    return cloud.size() - cloud_in_range->size();
+  }
+  /// @brief the points whose rays from the origin reach the tile
+  template <typename PointT>
+  void CropToTile(const pcl::PointCloud<PointT>& cloud,
+                  const Eigen::Vector3f& origin, const TileIndex& index,
+                  pcl::PointCloud<PointT>* tile_cloud) const {
+    const Eigen::Vector2f start(origin[0], origin[1]);
+    tile_cloud->clear();
+    for (const auto& point : cloud.points) {
+      if (RayReachesTile(start, Eigen::Vector2f(point.x, point.y), index)) {
+        tile_cloud->push_back(point);
+      }
+    }
+  }
+
+ private:
+  const float resolution_;
+  const float ray_range_;
+  // the width of a tile in voxels
+  const int tile_voxels_;
+};
+
+/// @class TiledVoxelMap
+/// @brief a MultiResolutionVoxelMap split into square tiles (in x-y) for
+/// the maps larger than the RAM, the clouds are planned first, so that a
+/// tile is finalized and streamed to the output file as soon as no more
+/// planned cloud reaches it, the tiles alive are paged to disk when they
+/// are over the memory budget
+/// @notice the result of a tile is the same as one MultiResolutionVoxelMap
+/// with the clouds in the same order (except stop_ray_at_hit_voxel)
+template <typename PointT>
+class TiledVoxelMap {
+ public:
+  using PointCloudType = pcl::PointCloud<PointT>;
+  using PointCloudPtr = typename PointCloudType::Ptr;
+  using TileIndex = TileGrid::TileIndex;
+
+  TiledVoxelMap(const TiledVoxelMapOptions& options,
+                const MrvmSettings& settings);
+  ~TiledVoxelMap();
+
+  TiledVoxelMap(const TiledVoxelMap&) = delete;
+  TiledVoxelMap& operator=(const TiledVoxelMap&) = delete;
+
+  /// @brief the order of the positions along a hilbert curve over the
+  /// cells of cell_width, the order in a cell is kept
+  static std::vector<int> SpatiallyCoherentOrder(
+      const std::vector<Eigen::Vector3f>& positions, const double cell_width);
+
+  /// @brief the origins of all the clouds, in the order of the insertion
+  /// and the file of the output (the points are appended tile by tile)
+  bool Plan(const std::vector<Eigen::Vector3f>& origins,
+            const std::string& filename);
+  /// @brief insert the next planned cloud
+  void InsertPointCloud(const PointCloudPtr& cloud,
+                        const Eigen::Vector3f& origin);
+  /// @brief output the remaining tiles and close the file
+  /// @return the number of points in the output file
+  size_t Finish();
+
+ private:
+  struct Tile {
+    std::unique_ptr<MultiResolutionVoxelMap<PointT>> map;
+    // the last planned cloud reaching it
+    int last_cloud = -1;
+    // the last inserted cloud reaching it, for paging the least recent
+    int last_insert = -1;
+    size_t memory_bytes = 0;
+    bool paged = false;
+  };
+
+  std::string CacheFilename(const TileIndex& index) const;
+  // load/create the map of the tile
+  void Activate(const TileIndex& index, Tile* tile);
+  void OutputTile(const TileIndex& index, Tile* tile);
+  void PageOutOverBudget();
+
+  const TiledVoxelMapOptions options_;
+  const MrvmSettings settings_;
+  const TileGrid grid_;
+  std::map<TileIndex, Tile> tiles_;
+  int cloud_index_ = 0;
+  size_t planned_cloud_num_ = 0;
+  common::PcdStreamWriter<PointT> writer_;
+};
+
+}  // namespace static_map
+
+#endif  // BUILDER_TILED_VOXEL_MAP_H_
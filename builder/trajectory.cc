@@ -23,36 +23,27 @@
 #include <utility>
 // local
 #include "builder/trajectory.h"
+#include "common/point_types.h"
 
 namespace static_map {
 
 template <typename PointT>
-void Trajectory<PointT>::ToXmlNode(pugi::xml_node* map_node) {
-  pugi::xml_node t_node = map_node->append_child("Trajectory");
-  t_node.append_attribute("id") = id_;
-  t_node.append_attribute("utm_x") = utm_offset_x_;
-  t_node.append_attribute("utm_y") = utm_offset_y_;
-  for (auto& submap : submaps_) {
-    pugi::xml_node submap_node = t_node.append_child("Submap");
-    submap_node.append_attribute("id") = submap->GetId().submap_index;
-    submap_node.append_attribute("file") = submap->SavedFileName().c_str();
+void Trajectory<PointT>::ToPackage(MapPackageWriter* writer) {
+  CHECK(writer);
+  writer->BeginTrajectory(id_, utm_offset_x_, utm_offset_y_);
+  const Snapshot submaps = GetSnapshot();
+  MapPackageSubmap package_submap;
+  for (auto& submap : *submaps) {
+    package_submap.id = submap->GetId().submap_index;
+    package_submap.file = submap->SavedFileName();
     Eigen::VectorXf pose_6d = submap->GlobalPoseIn6Dof();
-    submap_node.append_attribute("tx") = pose_6d[0];
-    submap_node.append_attribute("ty") = pose_6d[1];
-    submap_node.append_attribute("tz") = pose_6d[2];
-    submap_node.append_attribute("rx") = pose_6d[3];
-    submap_node.append_attribute("ry") = pose_6d[4];
-    submap_node.append_attribute("rz") = pose_6d[5];
-
-    std::string connect_pairs;
-    for (auto& connected : submap->GetConnected()) {
-      std::string single_pair =
-          "[" + std::to_string(connected.trajectory_index) + "," +
-          std::to_string(connected.submap_index) + "]";
-      connect_pairs += single_pair;
+    for (int i = 0; i < 6; ++i) {
+      package_submap.pose_6d[i] = pose_6d[i];
     }
-    submap_node.append_attribute("connections") = connect_pairs.c_str();
+    package_submap.connections = submap->GetConnected();
+    writer->AddSubmap(package_submap);
   }
+  writer->EndTrajectory();
 }
 
 template <typename PointT>
@@ -63,11 +54,15 @@ void Trajectory<PointT>::SetUtmOffset(const double x, const double y) {
 
 template <typename PointT>
 void Trajectory<PointT>::SetSavePath(const std::string& path) {
-  for (auto& submap : submaps_) {
+  const Snapshot submaps = GetSnapshot();
+  for (auto& submap : *submaps) {
     submap->SetSavePath(path);
   }
 }
 
 template class Trajectory<pcl::PointXYZI>;
+#ifdef _USE_COMPACT_POINT_
+template class Trajectory<PointXYZIc>;
+#endif
 
 }  // namespace static_map
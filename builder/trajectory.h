@@ -23,12 +23,15 @@
 #ifndef BUILDER_TRAJECTORY_H_
 #define BUILDER_TRAJECTORY_H_
 // stl
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <string>
 #include <vector>
 // local
+#include "builder/map_package_file.h"
 #include "builder/submap.h"
-#include "common/pugixml.hpp"
+#include "common/mutex.h"
 
 namespace static_map {
 
@@ -41,99 +44,74 @@ namespace static_map {
  *   |- submaps
  *     |- frames
  *
- * @notice you can use a Trajectory just like a vector of submap
+ * @notice the submaps are read through an immutable snapshot, grab it once
+ * and iterate it without any lock, appending submaps does not change the
+ * snapshots taken before (copy on write)
  * for instance :
- *   1. for(auto& submap : trajectory) {}
+ *   1. const auto submaps = trajectory.GetSnapshot();
+ *      for (auto& submap : *submaps) {}
  *   2. traejctory.push_back(submap)
  *   ...
  */
 template <typename PointT>
 class Trajectory {
  public:
-  Trajectory() {}
+  Trajectory() : submaps_(std::make_shared<const Submaps>()) {}
   ~Trajectory() {}
 
   Trajectory(const Trajectory<PointT>&) = delete;
   Trajectory& operator=(const Trajectory<PointT>&) = delete;
 
   using Ptr = std::shared_ptr<Trajectory<PointT>>;
+  using SubmapPtr = std::shared_ptr<Submap<PointT>>;
+  using Submaps = std::vector<SubmapPtr>;
+  using Snapshot = std::shared_ptr<const Submaps>;
 
-  using ReadWriteMutex = boost::shared_mutex;
-  using ReadMutexLocker = boost::shared_lock<ReadWriteMutex>;
-  using WriteMutexLocker = boost::upgrade_to_unique_lock<ReadWriteMutex>;
+  /// @brief the submaps at this moment, it never changes
+  inline Snapshot GetSnapshot() const { return std::atomic_load(&submaps_); }
 
-  using iterator =
-      typename std::vector<std::shared_ptr<Submap<PointT>>>::iterator;
-  using const_iterator =
-      typename std::vector<std::shared_ptr<Submap<PointT>>>::const_iterator;
   // Element access
-  inline std::shared_ptr<Submap<PointT>> at(size_t n) {
-    ReadMutexLocker locker(mutex_);
-    return submaps_.at(n);
-  }
-  inline std::shared_ptr<Submap<PointT>>& operator[](size_t n) {
-    ReadMutexLocker locker(mutex_);
-    return submaps_[n];
-  }
-  inline std::shared_ptr<Submap<PointT>>& front() {
-    ReadMutexLocker locker(mutex_);
-    return submaps_.front();
-  }
-  inline std::shared_ptr<Submap<PointT>>& back() {
-    ReadMutexLocker locker(mutex_);
-    return submaps_.back();
-  }
+  inline SubmapPtr at(size_t n) const { return GetSnapshot()->at(n); }
+  inline SubmapPtr operator[](size_t n) const { return (*GetSnapshot())[n]; }
+  inline SubmapPtr front() const { return GetSnapshot()->front(); }
+  inline SubmapPtr back() const { return GetSnapshot()->back(); }
 
-  // Iterators
-  inline iterator begin() {
-    ReadMutexLocker locker(mutex_);
-    return submaps_.begin();
-  }
-  inline iterator end() {
-    ReadMutexLocker locker(mutex_);
-    return submaps_.end();
-  }
   // Capacity
-  size_t size() {
-    ReadMutexLocker locker(mutex_);
-    return submaps_.size();
-  }
-  bool empty() {
-    ReadMutexLocker locker(mutex_);
-    return submaps_.empty();
-  }
+  size_t size() const { return GetSnapshot()->size(); }
+  bool empty() const { return GetSnapshot()->empty(); }
+  /// @brief the capacity of the next copies
   inline void reserve(size_t n) {
-    ReadMutexLocker locker(mutex_);
-    submaps_.reserve(n);
+    common::MutexLocker locker(&write_mutex_);
+    reserved_size_ = n;
   }
 
   // Modifiers
-  inline void push_back(const std::shared_ptr<Submap<PointT>>& submap) {
+  inline void push_back(const SubmapPtr& submap) {
     CHECK(submap);
     CHECK(submap->GetId().trajectory_index == id_);
 
-    boost::upgrade_lock<ReadWriteMutex> locker(mutex_);
-    WriteMutexLocker write_locker(locker);
-    submaps_.push_back(submap);
-  }
-  inline void shrink_to_fit() {
-    boost::upgrade_lock<ReadWriteMutex> locker(mutex_);
-    WriteMutexLocker write_locker(locker);
-    submaps_.shrink_to_fit();
+    common::MutexLocker locker(&write_mutex_);
+    const Snapshot current = GetSnapshot();
+    std::shared_ptr<Submaps> submaps = std::make_shared<Submaps>();
+    submaps->reserve(std::max(reserved_size_, current->size() + 1));
+    submaps->insert(submaps->end(), current->begin(), current->end());
+    submaps->push_back(submap);
+    std::atomic_store(&submaps_, Snapshot(std::move(submaps)));
   }
 
   // Trajectory APIs
   inline void SetId(int id) { id_ = id; }
   inline int GetId() { return id_; }
   void SetUtmOffset(const double x, const double y);
-  void ToXmlNode(pugi::xml_node* map_node);
+  /// @brief write the trajectory into the map package descriptor
+  void ToPackage(MapPackageWriter* writer);
   void SetSavePath(const std::string& path);
 
  private:
-  // use a read&write mutex locker to ensure efficiency of submap
-  // accessment and modifying
-  ReadWriteMutex mutex_;
-  std::vector<std::shared_ptr<Submap<PointT>>> submaps_;
+  // only the writers are serialized, the readers just load the snapshot
+  common::Mutex write_mutex_;
+  Snapshot submaps_;
+  size_t reserved_size_ = 0;
 
   int id_;
   double utm_offset_x_ = 0.;
@@ -357,6 +357,99 @@ int LatLonToUTMXY(double lat, double lon, int zone, double& x, double& y) {
   return zone;
 }
 
+namespace {
+// the constants of MapLatLonToXY and ArcLengthOfMeridian, computed once
+struct SeriesConstants {
+  SeriesConstants() {
+    const double n = (sm_a - sm_b) / (sm_a + sm_b);
+    alpha = ((sm_a + sm_b) / 2.0) *
+            (1.0 + (POW(n, 2.0) / 4.0) + (POW(n, 4.0) / 64.0));
+    beta = (-3.0 * n / 2.0) + (9.0 * POW(n, 3.0) / 16.0) +
+           (-3.0 * POW(n, 5.0) / 32.0);
+    gamma = (15.0 * POW(n, 2.0) / 16.0) + (-15.0 * POW(n, 4.0) / 32.0);
+    delta = (-35.0 * POW(n, 3.0) / 48.0) + (105.0 * POW(n, 5.0) / 256.0);
+    epsilon = (315.0 * POW(n, 4.0) / 512.0);
+    ep2 = (POW(sm_a, 2.0) - POW(sm_b, 2.0)) / POW(sm_b, 2.0);
+    a2_b = POW(sm_a, 2.0) / sm_b;
+  }
+
+  double alpha, beta, gamma, delta, epsilon;
+  double ep2;
+  // N = a2_b / sqrt(1 + nu2)
+  double a2_b;
+};
+
+const SeriesConstants& Constants() {
+  static const SeriesConstants constants;
+  return constants;
+}
+}  // namespace
+
+int LatLonToUTMXY(const double* lat, const double* lon, const int size,
+                  int zone, double* x, double* y) {
+  if ((zone < 1) || (zone > 60)) {
+    if (size <= 0) return 0;
+    zone = FLOOR((lon[0] + 180.0) / 6) + 1;
+  }
+  const SeriesConstants& c = Constants();
+  const double lambda0 = UTMCentralMeridian(zone);
+  const double deg_to_rad = M_PI / 180.0;
+
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+  for (int i = 0; i < size; ++i) {
+    const double phi = lat[i] * deg_to_rad;
+    const double l = lon[i] * deg_to_rad - lambda0;
+    const double s = SIN(phi);
+    const double cp = COS(phi);
+    // the multiple angles of the meridian arc from the double angle
+    const double s2 = 2.0 * s * cp;
+    const double c2 = cp * cp - s * s;
+    const double s4 = 2.0 * s2 * c2;
+    const double c4 = c2 * c2 - s2 * s2;
+    const double s6 = s4 * c2 + c4 * s2;
+    const double s8 = 2.0 * s4 * c4;
+    const double arc =
+        c.alpha * (phi + c.beta * s2 + c.gamma * s4 + c.delta * s6 +
+                   c.epsilon * s8);
+
+    const double t = s / cp;
+    const double t2 = t * t;
+    const double t4 = t2 * t2;
+    const double t6 = t4 * t2;
+    const double nu2 = c.ep2 * cp * cp;
+    const double N = c.a2_b / SQRT(1 + nu2);
+    const double l3coef = 1.0 - t2 + nu2;
+    const double l4coef = 5.0 - t2 + 9 * nu2 + 4.0 * (nu2 * nu2);
+    const double l5coef = 5.0 - 18.0 * t2 + t4 + 14.0 * nu2 - 58.0 * t2 * nu2;
+    const double l6coef =
+        61.0 - 58.0 * t2 + t4 + 270.0 * nu2 - 330.0 * t2 * nu2;
+    const double l7coef = 61.0 - 479.0 * t2 + 179.0 * t4 - t6;
+    const double l8coef = 1385.0 - 3111.0 * t2 + 543.0 * t4 - t6;
+
+    // N cos^k(phi) l^k of the series
+    const double cl = cp * l;
+    const double cl2 = cl * cl;
+    const double ncl = N * cl;
+    const double ncl2 = N * cl2;
+    const double tm_x =
+        ncl * (1.0 + cl2 * (l3coef / 6.0 +
+                            cl2 * (l5coef / 120.0 + cl2 * l7coef / 5040.0)));
+    const double tm_y =
+        arc + t * ncl2 *
+                  (1.0 / 2.0 +
+                   cl2 * (l4coef / 24.0 +
+                          cl2 * (l6coef / 720.0 + cl2 * l8coef / 40320.0)));
+
+    /* Adjust easting and northing for UTM system. */
+    x[i] = tm_x * UTMScaleFactor + 500000.0;
+    const double northing = tm_y * UTMScaleFactor;
+    y[i] = northing < 0.0 ? northing + 10000000.0 : northing;
+  }
+  return zone;
+}
+
 // UTMXYToLatLon
 //
 // Converts x and y coordinates in the Universal Transverse Mercator
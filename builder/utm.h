@@ -166,6 +166,29 @@ void MapXYToLatLon(double x, double y, double lambda0, double& phi,
 //   The UTM zone used for calculating the values of x and y.
 int LatLonToUTMXY(double lat, double lon, int zone, double& x, double& y);
 
+// LatLonToUTMXY (batch)
+// Converts arrays of latitude/longitude pairs as the one above, all in one
+// zone, for the gps streams.  The ellipsoid and zone constants are computed
+// once, the series take one sin and one cos per point (the multiple angles
+// by recurrence) and the loop has no branch, so it can be vectorized.
+// The results match the single conversion within 1e-6 m.
+//
+// Inputs:
+//   lat - Latitudes of the points, in degrees.
+//   lon - Longitudes of the points, in degrees.
+//   size - The number of points.
+//   zone - UTM zone of all the points, if it is out of [1,60] the zone of
+//          the first point is used.
+//
+// Outputs:
+//   x - The eastings of the points, in meters, size elements.
+//   y - The northings of the points, in meters, size elements.
+//
+// Returns:
+//   The UTM zone used, 0 if size is 0 and no valid zone is given.
+int LatLonToUTMXY(const double* lat, const double* lon, int size, int zone,
+                  double* x, double* y);
+
 // UTMXYToLatLon
 //
 // Converts x and y coordinates in the Universal Transverse Mercator//   The UTM
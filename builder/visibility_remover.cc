@@ -0,0 +1,135 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// stl
+#include <algorithm>
+#include <cmath>
+#include <limits>
+// local
+#include "builder/visibility_remover.h"
+#include "common/macro_defines.h"
+#include "common/point_types.h"
+#include "common/shared_executor.h"
+
+namespace static_map {
+
+template <typename PointT>
+VisibilityRemover<PointT>::VisibilityRemover(
+    const VisibilityRemovalOptions& options)
+    : options_(options) {
+  range_image_.SetValue("top_angle", options_.top_angle);
+  range_image_.SetValue("btm_angle", options_.btm_angle);
+  range_image_.SetValue("vertical_line_num", options_.vertical_line_num);
+  range_image_.SetValue("horizontal_line_num", options_.horizontal_line_num);
+}
+
+template <typename PointT>
+void VisibilityRemover<PointT>::AddSubmap(const PointCloudType& cloud,
+                                          const Eigen::Matrix4f& pose) {
+  SubmapImage image;
+  image.inverse_pose = pose.inverse();
+  image.position = pose.block<3, 1>(0, 3);
+  image.ranges.assign(range_image_.Rows() * range_image_.Cols(), 0);
+  for (const auto& point : cloud.points) {
+    float range = 0.f;
+    const int pixel = range_image_.Project(point, &range);
+    if (pixel < 0) {
+      continue;
+    }
+    const Range quantized = static_cast<Range>(std::min(
+        std::lround(range * kRangeScale),
+        static_cast<long>(std::numeric_limits<Range>::max())));
+    Range& pixel_range = image.ranges[pixel];
+    if (quantized > 0 && (pixel_range == 0 || quantized < pixel_range)) {
+      pixel_range = quantized;
+    }
+  }
+  images_.push_back(image);
+}
+
+template <typename PointT>
+size_t VisibilityRemover<PointT>::RemoveDynamicPoints(
+    const int index, PointCloudType* cloud) const {
+  CHECK(cloud);
+  CHECK(index >= 0 && index < static_cast<int>(images_.size()));
+  const Eigen::Vector3f& position = images_[index].position;
+  const double range_squared = options_.search_range * options_.search_range;
+  std::vector<const SubmapImage*> neighbors;
+  for (int i = 0; i < static_cast<int>(images_.size()); ++i) {
+    const Eigen::Vector3f offset = images_[i].position - position;
+    if (i != index &&
+        offset.head<2>().squaredNorm() <= static_cast<float>(range_squared)) {
+      neighbors.push_back(&images_[i]);
+    }
+  }
+  if (neighbors.empty()) {
+    return 0;
+  }
+
+  const int point_num = cloud->size();
+  std::vector<uint8_t> dynamic(point_num, 0);
+  const int thread_num = static_cast<int>(common::SharedExecutor::ThreadNum());
+  common::ParallelFor(0, point_num, thread_num, [&](const int i) {
+    const PointT& point = cloud->points[i];
+    const Eigen::Vector4f global_point(point.x, point.y, point.z, 1.f);
+    int see_through_num = 0;
+    for (const SubmapImage* image : neighbors) {
+      const Eigen::Vector4f local_point = image->inverse_pose * global_point;
+      PointT projected = point;
+      projected.x = local_point[0];
+      projected.y = local_point[1];
+      projected.z = local_point[2];
+      float range = 0.f;
+      const int pixel = range_image_.Project(projected, &range);
+      if (pixel < 0 || image->ranges[pixel] == 0) {
+        continue;
+      }
+      const float seen_range = image->ranges[pixel] / kRangeScale;
+      if (seen_range - range >
+          options_.range_tolerance + options_.range_ratio * range) {
+        if (++see_through_num >= options_.min_see_through_num) {
+          dynamic[i] = 1;
+          break;
+        }
+      }
+    }
+  });
+
+  size_t kept_num = 0;
+  for (int i = 0; i < point_num; ++i) {
+    if (!dynamic[i]) {
+      cloud->points[kept_num++] = cloud->points[i];
+    }
+  }
+  const size_t removed_num = point_num - kept_num;
+  cloud->points.resize(kept_num);
+  cloud->width = kept_num;
+  cloud->height = 1;
+  return removed_num;
+}
+
+template class VisibilityRemover<pcl::PointXYZI>;
+#ifdef _USE_COMPACT_POINT_
+template class VisibilityRemover<PointXYZIc>;
+#endif
+
+}  // namespace static_map
@@ -0,0 +1,109 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef BUILDER_VISIBILITY_REMOVER_H_
+#define BUILDER_VISIBILITY_REMOVER_H_
+
+// stl
+#include <cstdint>
+#include <vector>
+// third party
+#include <Eigen/Core>
+#include <Eigen/StdVector>
+#include "pcl/point_cloud.h"
+#include "pcl/point_types.h"
+// local
+#include "pre_processors/filter_range_image.h"
+
+namespace static_map {
+
+struct VisibilityRemovalOptions {
+  // remove the dynamic points by the range images of the submaps before the
+  // output voxel map, which only aggregates the points then (no raycasting)
+  bool enable = false;
+  // the range image of a submap (in its own frame)
+  float top_angle = 30.f;
+  float btm_angle = -30.f;
+  int vertical_line_num = 64;
+  int horizontal_line_num = 900;
+  // the points are checked by the submaps in this range (in x-y)
+  double search_range = 50.;
+  // a point is seen through by a submap if the range in its pixel is longer
+  // than its own by more than (range_tolerance + range_ratio * range)
+  float range_tolerance = 0.5f;
+  float range_ratio = 0.05f;
+  // the points seen through by this number of submaps are removed
+  int min_see_through_num = 2;
+};
+
+/*
+ * @class VisibilityRemover
+ * @brief the removal of the dynamic points by the visibility (like
+ * Removert), the points of a submap are projected into the range images of
+ * the submaps around it, a point is dynamic if the other submaps see
+ * through it, i.e. they hit something farther in the same direction. it
+ * is one projection for each point and submap instead of the rays
+ */
+template <typename PointT>
+class VisibilityRemover {
+ public:
+  using PointCloudType = pcl::PointCloud<PointT>;
+  using PointCloudPtr = typename PointCloudType::Ptr;
+
+  explicit VisibilityRemover(const VisibilityRemovalOptions& options);
+
+  VisibilityRemover(const VisibilityRemover&) = delete;
+  VisibilityRemover& operator=(const VisibilityRemover&) = delete;
+
+  /// @brief the range image of the next submap from its cloud (in its own
+  /// frame), all the submaps are added before the removal
+  void AddSubmap(const PointCloudType& cloud, const Eigen::Matrix4f& pose);
+  /// @brief remove the points (in the global frame) of the submap 'index'
+  /// which are seen through by the other submaps, the order is kept
+  /// @return the number of the removed points
+  size_t RemoveDynamicPoints(int index, PointCloudType* cloud) const;
+
+  size_t SubmapNum() const { return images_.size(); }
+
+ private:
+  // the range of a pixel in centimeters, 0 for the empty pixels
+  using Range = uint16_t;
+  static constexpr float kRangeScale = 100.f;
+
+  struct SubmapImage {
+    Eigen::Matrix4f inverse_pose;
+    Eigen::Vector3f position;
+    // the closest range in each pixel
+    std::vector<Range> ranges;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+
+  const VisibilityRemovalOptions options_;
+  // only the projection is used
+  pre_processers::filter::RangeImage<PointT> range_image_;
+  std::vector<SubmapImage, Eigen::aligned_allocator<SubmapImage>> images_;
+};
+
+}  // namespace static_map
+
+#endif  // BUILDER_VISIBILITY_REMOVER_H_
@@ -0,0 +1,249 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "builder/visualization_sink.h"
+
+#include <algorithm>
+
+#include "common/make_unique.h"
+#include "common/metrics.h"
+#include "common/point_types.h"
+#include "common/time.h"
+#include "common/voxel_centroid_grid.h"
+
+namespace static_map {
+
+template <typename PointType>
+VisualizationSink<PointType>::~VisualizationSink() {
+  Stop();
+}
+
+template <typename PointType>
+void VisualizationSink<PointType>::SetShowSubmapFunction(
+    const ShowCloudFunction& func) {
+  common::MutexLocker locker(&mutex_);
+  show_submap_function_ = func;
+}
+
+template <typename PointType>
+void VisualizationSink<PointType>::SetShowPoseFunction(
+    const ShowPoseFunction& func) {
+  common::MutexLocker locker(&mutex_);
+  show_pose_function_ = func;
+}
+
+template <typename PointType>
+void VisualizationSink<PointType>::SetShowSubmapPosesFunction(
+    const ShowSubmapPosesFunction& func) {
+  common::MutexLocker locker(&mutex_);
+  show_submap_poses_function_ = func;
+}
+
+template <typename PointType>
+void VisualizationSink<PointType>::Start(
+    const VisualizationOptions& options) {
+  CHECK(!thread_);
+  options_ = options;
+  if (options_.publish_rate <= 0.) {
+    return;
+  }
+  {
+    common::MutexLocker locker(&mutex_);
+    done_ = false;
+  }
+  thread_ = common::make_unique<std::thread>(
+      std::bind(&VisualizationSink<PointType>::Publishing, this));
+}
+
+template <typename PointType>
+void VisualizationSink<PointType>::Stop() {
+  if (!thread_) {
+    return;
+  }
+  {
+    common::MutexLocker locker(&mutex_);
+    done_ = true;
+  }
+  thread_->join();
+  thread_.reset();
+}
+
+template <typename PointType>
+void VisualizationSink<PointType>::AddSubmap(const SubmapPtr& submap) {
+  if (!thread_) {
+    return;
+  }
+  common::MutexLocker locker(&mutex_);
+  pending_submaps_.push_back(submap);
+}
+
+template <typename PointType>
+void VisualizationSink<PointType>::UpdatePose(const Eigen::Matrix4f& pose) {
+  if (!thread_) {
+    return;
+  }
+  common::MutexLocker locker(&mutex_);
+  pose_ = pose;
+  got_pose_ = true;
+}
+
+template <typename PointType>
+void VisualizationSink<PointType>::Publishing() {
+  common::Histogram* const latency =
+      common::MetricsRegistry::Get()->GetHistogram("visualization.publish");
+  const common::Duration period =
+      common::FromSeconds(1. / options_.publish_rate);
+  bool done = false;
+  while (!done) {
+    ShowCloudFunction show_submap;
+    ShowPoseFunction show_pose;
+    ShowSubmapPosesFunction show_submap_poses;
+    std::vector<SubmapPtr> new_submaps;
+    bool got_pose = false;
+    Eigen::Matrix4f pose;
+    {
+      common::MutexLocker locker(&mutex_);
+      locker.AwaitWithTimeout([this]() { return done_; }, period);
+      done = done_;
+      // the callbacks are copied, so that nothing waits for them
+      show_submap = show_submap_function_;
+      show_pose = show_pose_function_;
+      show_submap_poses = show_submap_poses_function_;
+      // the rest waits for the next period, all of them at the end
+      const size_t taken_num =
+          done ? pending_submaps_.size()
+               : std::min(pending_submaps_.size(),
+                          static_cast<size_t>(std::max(
+                              options_.max_submaps_per_publish, 1)));
+      new_submaps.assign(pending_submaps_.begin(),
+                         pending_submaps_.begin() + taken_num);
+      pending_submaps_.erase(pending_submaps_.begin(),
+                             pending_submaps_.begin() + taken_num);
+      got_pose = got_pose_;
+      pose = pose_;
+      got_pose_ = false;
+    }
+    common::ScopedLatency scoped_latency(latency);
+    PublishOnce(show_submap, show_pose, show_submap_poses, &new_submaps,
+                got_pose, pose);
+  }
+}
+
+template <typename PointType>
+void VisualizationSink<PointType>::PublishOnce(
+    const ShowCloudFunction& show_submap, const ShowPoseFunction& show_pose,
+    const ShowSubmapPosesFunction& show_submap_poses,
+    std::vector<SubmapPtr>* const new_submaps, const bool got_pose,
+    const Eigen::Matrix4f& pose) {
+  if (got_pose && show_pose) {
+    show_pose(pose);
+  }
+
+  // the poses changed since the last period, before adding the new submaps
+  SubmapPoses changed_poses;
+  for (size_t i = 0; i < published_submaps_.size(); ++i) {
+    auto& published = published_submaps_[i];
+    const SubmapPtr submap = published.submap.lock();
+    if (!submap) {
+      continue;
+    }
+    const uint64_t pose_version = submap->PoseVersion();
+    if (pose_version == published.pose_version) {
+      continue;
+    }
+    published.pose_version = pose_version;
+    SubmapPose submap_pose;
+    submap_pose.index = static_cast<int>(i);
+    submap_pose.pose = submap->GlobalPose();
+    changed_poses.push_back(submap_pose);
+  }
+  if (!changed_poses.empty() && show_submap_poses) {
+    show_submap_poses(changed_poses);
+  }
+
+  if (new_submaps->empty()) {
+    return;
+  }
+  PointCloudPtr cloud(new PointCloudType);
+  SubmapPoses new_poses;
+  for (const auto& submap : *new_submaps) {
+    PublishedSubmap published;
+    published.submap = submap;
+    published.pose_version = submap->PoseVersion();
+    SubmapPose submap_pose;
+    submap_pose.index = static_cast<int>(published_submaps_.size());
+    submap_pose.pose = submap->GlobalPose();
+    new_poses.push_back(submap_pose);
+    published_submaps_.push_back(published);
+    if (show_submap) {
+      AppendSubmapCloud(submap, cloud.get());
+    }
+  }
+  new_submaps->clear();
+  if (show_submap_poses) {
+    show_submap_poses(new_poses);
+  }
+  if (show_submap && !cloud->empty()) {
+    show_submap(cloud);
+  }
+}
+
+template <typename PointType>
+void VisualizationSink<PointType>::AppendSubmapCloud(
+    const SubmapPtr& submap, PointCloudType* const cloud) const {
+  // waits for the submap being finished, only in this thread
+  const PointCloudPtr submap_cloud = submap->Cloud();
+  const Eigen::Matrix4f pose = submap->GlobalPose();
+  const Eigen::Matrix3f rotation = pose.block<3, 3>(0, 0);
+  const Eigen::Vector3f translation = pose.block<3, 1>(0, 3);
+  const auto transformed = [&](const PointType& point) {
+    PointType transformed_point = point;
+    transformed_point.getVector3fMap() =
+        rotation * point.getVector3fMap() + translation;
+    return transformed_point;
+  };
+
+  if (options_.downsample_leaf_size <= 0.f) {
+    cloud->points.reserve(cloud->size() + submap_cloud->size());
+    for (const auto& point : submap_cloud->points) {
+      cloud->points.push_back(transformed(point));
+    }
+  } else {
+    common::VoxelCentroidGrid<PointType> grid(options_.downsample_leaf_size);
+    for (const auto& point : submap_cloud->points) {
+      grid.Add(transformed(point));
+    }
+    PointCloudType centroids;
+    grid.Output(&centroids);
+    cloud->points.insert(cloud->points.end(), centroids.points.begin(),
+                         centroids.points.end());
+  }
+  cloud->width = cloud->points.size();
+  cloud->height = 1;
+}
+
+template class VisualizationSink<pcl::PointXYZI>;
+#ifdef _USE_COMPACT_POINT_
+template class VisualizationSink<PointXYZIc>;
+#endif
+
+}  // namespace static_map
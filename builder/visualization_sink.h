@@ -0,0 +1,138 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef BUILDER_VISUALIZATION_SINK_H_
+#define BUILDER_VISUALIZATION_SINK_H_
+
+// stl
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+// third party
+#include <Eigen/Core>
+#include <Eigen/StdVector>
+#include "pcl/point_cloud.h"
+// local
+#include "builder/submap.h"
+#include "common/mutex.h"
+
+namespace static_map {
+
+struct VisualizationOptions {
+  // the callbacks are called at most this often (Hz), 0 for no visualization
+  double publish_rate = 2.;
+  // the submap clouds are published as the centroids of voxels of this size,
+  // 0 for the whole clouds
+  float downsample_leaf_size = 0.4f;
+  // the new submaps published together in one cloud, the others wait for the
+  // next period
+  int max_submaps_per_publish = 5;
+};
+
+/*
+ * @class VisualizationSink
+ * @brief publishes the progress from its own thread at a limited rate, the
+ * pipeline only hands over the submaps and the pose and never waits for the
+ * callbacks. only the deltas are published: the clouds of the new submaps
+ * (in the map frame) once, and the poses of the published submaps which are
+ * changed by the optimization since the last period
+ */
+template <typename PointType>
+class VisualizationSink {
+ public:
+  using PointCloudType = pcl::PointCloud<PointType>;
+  using PointCloudPtr = typename PointCloudType::Ptr;
+  using SubmapPtr = std::shared_ptr<Submap<PointType>>;
+
+  struct SubmapPose {
+    // the order the submap was published in (of all trajectories)
+    int index;
+    Eigen::Matrix4f pose;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+  using SubmapPoses =
+      std::vector<SubmapPose, Eigen::aligned_allocator<SubmapPose>>;
+
+  using ShowCloudFunction = std::function<void(const PointCloudPtr&)>;
+  using ShowPoseFunction = std::function<void(const Eigen::Matrix4f&)>;
+  using ShowSubmapPosesFunction = std::function<void(const SubmapPoses&)>;
+
+  VisualizationSink() = default;
+  ~VisualizationSink();
+
+  VisualizationSink(const VisualizationSink&) = delete;
+  VisualizationSink& operator=(const VisualizationSink&) = delete;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  void SetShowSubmapFunction(const ShowCloudFunction& func);
+  void SetShowPoseFunction(const ShowPoseFunction& func);
+  void SetShowSubmapPosesFunction(const ShowSubmapPosesFunction& func);
+
+  /// @brief start the publishing thread, nothing is done if the rate is 0
+  void Start(const VisualizationOptions& options);
+  /// @brief publish the remaining deltas and stop the thread
+  void Stop();
+
+  /// @brief a new full submap, its cloud is published in the next period
+  void AddSubmap(const SubmapPtr& submap);
+  /// @brief the latest pose of the front end, only the last one in a period
+  /// is published
+  void UpdatePose(const Eigen::Matrix4f& pose);
+
+ private:
+  struct PublishedSubmap {
+    std::weak_ptr<Submap<PointType>> submap;
+    uint64_t pose_version;
+  };
+
+  void Publishing();
+  // one period, without the mutex
+  void PublishOnce(const ShowCloudFunction& show_submap,
+                   const ShowPoseFunction& show_pose,
+                   const ShowSubmapPosesFunction& show_submap_poses,
+                   std::vector<SubmapPtr>* const new_submaps,
+                   const bool got_pose, const Eigen::Matrix4f& pose);
+  void AppendSubmapCloud(const SubmapPtr& submap,
+                         PointCloudType* const cloud) const;
+
+  VisualizationOptions options_;
+  std::unique_ptr<std::thread> thread_;
+
+  common::Mutex mutex_;
+  bool done_ GUARDED_BY(mutex_) = false;
+  ShowCloudFunction show_submap_function_ GUARDED_BY(mutex_);
+  ShowPoseFunction show_pose_function_ GUARDED_BY(mutex_);
+  ShowSubmapPosesFunction show_submap_poses_function_ GUARDED_BY(mutex_);
+  std::vector<SubmapPtr> pending_submaps_ GUARDED_BY(mutex_);
+  bool got_pose_ GUARDED_BY(mutex_) = false;
+  Eigen::Matrix4f pose_ GUARDED_BY(mutex_) = Eigen::Matrix4f::Identity();
+
+  // only accessed by the publishing thread
+  std::vector<PublishedSubmap> published_submaps_;
+};
+
+}  // namespace static_map
+
+#endif  // BUILDER_VISUALIZATION_SINK_H_
@@ -0,0 +1,389 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#ifndef COMMON_CLOUD_CODEC_H_
+#define COMMON_CLOUD_CODEC_H_
+
+// third party
+#include <Eigen/Core>
+#include <glog/logging.h>
+#ifdef _USE_BLOSC_
+#include <blosc.h>
+#endif
+// pcl
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+// stl
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+// local
+#include "common/macro_defines.h"
+#include "common/point_types.h"
+
+namespace static_map {
+namespace common {
+
+/*
+ * @class CloudCodec
+ * @brief lossy compression of the points of a cloud. the coordinates are
+ * quantized relative to an origin, delta coded along the point order (the
+ * neighbours in a scan are close) and written as zigzag varints, the
+ * intensities are kept as they are. with blosc (USE_BLOSC), every block is
+ * compressed by lz4 further. the blocks are independent, so they are
+ * decoded in parallel
+ */
+template <typename PointType>
+class CloudCodec {
+ public:
+  enum Method : uint32_t { kVarint = 0, kVarintBlosc = 1 };
+
+  CloudCodec(const Eigen::Vector3f& origin, const float resolution)
+      : origin_(origin), resolution_(resolution) {}
+
+  /// @brief append the encoded points to output
+  void Encode(const pcl::PointCloud<PointType>& cloud,
+              std::vector<char>* const output) const;
+  /// @return false if the data is corrupted or the method is not built in
+  bool Decode(const char* const data, const size_t size,
+              pcl::PointCloud<PointType>* const cloud) const;
+
+ private:
+  // points per block
+  static constexpr size_t kBlockSize = 65536;
+  struct StreamHeader {
+    uint32_t method;
+    uint32_t block_size;
+    uint64_t point_count;
+    uint64_t block_num;
+  };
+
+  static inline float Intensity(const PointType&) { return 0.f; }
+  static inline void SetIntensity(const float, PointType* const) {}
+
+  void EncodeBlock(const PointType* const points, const size_t num,
+                   std::vector<char>* const output) const;
+  bool DecodeBlock(const char* data, const char* const end,
+                   PointType* const points, const size_t num) const;
+
+  const Eigen::Vector3f origin_;
+  const float resolution_;
+};
+
+template <typename PointType>
+constexpr size_t CloudCodec<PointType>::kBlockSize;
+
+template <>
+inline float CloudCodec<pcl::PointXYZI>::Intensity(
+    const pcl::PointXYZI& point) {
+  return point.intensity;
+}
+
+template <>
+inline void CloudCodec<pcl::PointXYZI>::SetIntensity(
+    const float intensity, pcl::PointXYZI* const point) {
+  point->intensity = intensity;
+}
+
+template <>
+inline float CloudCodec<PointXYZIc>::Intensity(const PointXYZIc& point) {
+  return point.intensity;
+}
+
+template <>
+inline void CloudCodec<PointXYZIc>::SetIntensity(const float intensity,
+                                                 PointXYZIc* const point) {
+  common::SetIntensity(intensity, point);
+}
+
+namespace codec_internal {
+
+inline void PutVarint(uint32_t value, std::vector<char>* const output) {
+  while (value >= 0x80) {
+    output->push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  output->push_back(static_cast<char>(value));
+}
+
+inline bool GetVarint(const char** const data, const char* const end,
+                      uint32_t* const value) {
+  uint32_t result = 0;
+  for (int shift = 0; shift <= 28 && *data < end; shift += 7) {
+    const uint32_t byte = static_cast<uint8_t>(*((*data)++));
+    result |= (byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      *value = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+inline uint32_t ZigZag(const int32_t value) {
+  return (static_cast<uint32_t>(value) << 1) ^
+         static_cast<uint32_t>(value >> 31);
+}
+
+inline int32_t UnZigZag(const uint32_t value) {
+  return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+}
+
+}  // namespace codec_internal
+
+template <typename PointType>
+void CloudCodec<PointType>::EncodeBlock(
+    const PointType* const points, const size_t num,
+    std::vector<char>* const output) const {
+  using namespace codec_internal;
+  const float inv_resolution = 1.f / resolution_;
+  output->reserve(output->size() + num * (6 + sizeof(float)));
+  int32_t last[3] = {0, 0, 0};
+  for (size_t i = 0; i < num; ++i) {
+    const float coordinates[3] = {points[i].x, points[i].y, points[i].z};
+    for (int j = 0; j < 3; ++j) {
+      // the invalid points are (lossily) moved to the origin
+      const int32_t quantized =
+          std::isfinite(coordinates[j])
+              ? static_cast<int32_t>(std::lround(
+                    (coordinates[j] - origin_[j]) * inv_resolution))
+              : 0;
+      PutVarint(ZigZag(quantized - last[j]), output);
+      last[j] = quantized;
+    }
+  }
+  for (size_t i = 0; i < num; ++i) {
+    const float intensity = Intensity(points[i]);
+    const char* const bytes = reinterpret_cast<const char*>(&intensity);
+    output->insert(output->end(), bytes, bytes + sizeof(float));
+  }
+}
+
+template <typename PointType>
+bool CloudCodec<PointType>::DecodeBlock(const char* data,
+                                        const char* const end,
+                                        PointType* const points,
+                                        const size_t num) const {
+  using namespace codec_internal;
+  int32_t last[3] = {0, 0, 0};
+  for (size_t i = 0; i < num; ++i) {
+    float coordinates[3];
+    for (int j = 0; j < 3; ++j) {
+      uint32_t delta = 0;
+      if (!GetVarint(&data, end, &delta)) {
+        return false;
+      }
+      last[j] += UnZigZag(delta);
+      coordinates[j] = last[j] * resolution_ + origin_[j];
+    }
+    points[i] = PointType();
+    points[i].x = coordinates[0];
+    points[i].y = coordinates[1];
+    points[i].z = coordinates[2];
+  }
+  if (static_cast<size_t>(end - data) != num * sizeof(float)) {
+    return false;
+  }
+  for (size_t i = 0; i < num; ++i) {
+    float intensity = 0.f;
+    std::memcpy(&intensity, data + i * sizeof(float), sizeof(float));
+    SetIntensity(intensity, &points[i]);
+  }
+  return true;
+}
+
+template <typename PointType>
+void CloudCodec<PointType>::Encode(const pcl::PointCloud<PointType>& cloud,
+                                   std::vector<char>* const output) const {
+  StreamHeader header;
+#ifdef _USE_BLOSC_
+  header.method = kVarintBlosc;
+#else
+  header.method = kVarint;
+#endif
+  header.block_size = kBlockSize;
+  header.point_count = cloud.size();
+  header.block_num = (cloud.size() + kBlockSize - 1) / kBlockSize;
+  const int block_num = header.block_num;
+
+  std::vector<std::vector<char>> blocks(block_num);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(LOCAL_OMP_THREADS_NUM)
+#endif
+  for (int i = 0; i < block_num; ++i) {
+    const size_t begin = i * kBlockSize;
+    const size_t num = std::min(kBlockSize, cloud.size() - begin);
+    EncodeBlock(cloud.points.data() + begin, num, &blocks[i]);
+#ifdef _USE_BLOSC_
+    // raw size + lz4 stream
+    std::vector<char> compressed(sizeof(uint64_t) + blocks[i].size() +
+                                 BLOSC_MAX_OVERHEAD);
+    const uint64_t raw_size = blocks[i].size();
+    std::memcpy(compressed.data(), &raw_size, sizeof(raw_size));
+    const int compressed_size = blosc_compress_ctx(
+        5, BLOSC_NOSHUFFLE, 1, raw_size, blocks[i].data(),
+        compressed.data() + sizeof(raw_size), raw_size + BLOSC_MAX_OVERHEAD,
+        "lz4", 0, 1);
+    CHECK_GT(compressed_size, 0);
+    compressed.resize(sizeof(raw_size) + compressed_size);
+    blocks[i].swap(compressed);
+#endif
+  }
+
+  // header, offsets of the blocks (block_num + 1), blocks
+  std::vector<uint64_t> offsets(block_num + 1, 0);
+  for (int i = 0; i < block_num; ++i) {
+    offsets[i + 1] = offsets[i] + blocks[i].size();
+  }
+  const char* const header_bytes = reinterpret_cast<const char*>(&header);
+  output->insert(output->end(), header_bytes, header_bytes + sizeof(header));
+  const char* const offset_bytes =
+      reinterpret_cast<const char*>(offsets.data());
+  output->insert(output->end(), offset_bytes,
+                 offset_bytes + offsets.size() * sizeof(uint64_t));
+  for (const auto& block : blocks) {
+    output->insert(output->end(), block.begin(), block.end());
+  }
+}
+
+template <typename PointType>
+bool CloudCodec<PointType>::Decode(
+    const char* const data, const size_t size,
+    pcl::PointCloud<PointType>* const cloud) const {
+  StreamHeader header;
+  if (size < sizeof(header)) {
+    return false;
+  }
+  std::memcpy(&header, data, sizeof(header));
+#ifndef _USE_BLOSC_
+  if (header.method == kVarintBlosc) {
+    PRINT_ERROR("The cloud is compressed by blosc, build with USE_BLOSC.");
+    return false;
+  }
+#endif
+  // everything is bounded by the size before any allocation, so that a
+  // corrupt stream fails instead of allocating or reading out of bounds
+  if (header.method > kVarintBlosc || header.block_size == 0 ||
+      header.block_size > kBlockSize ||
+      header.block_num >= (size - sizeof(header)) / sizeof(uint64_t) ||
+      header.block_num >
+          static_cast<uint64_t>(std::numeric_limits<int>::max())) {
+    return false;
+  }
+  // block_num is the number of blocks for point_count, no overflow here
+  if (header.point_count > header.block_num * header.block_size ||
+      (header.block_num > 0 &&
+       header.point_count <= (header.block_num - 1) * header.block_size)) {
+    return false;
+  }
+  const int block_num = header.block_num;
+  const size_t table_end =
+      sizeof(header) + (header.block_num + 1) * sizeof(uint64_t);
+  if (size < table_end) {
+    return false;
+  }
+  // without blosc, every point takes at least 3 bytes and the intensity
+  if (header.method == kVarint &&
+      header.point_count > (size - table_end) / (3 + sizeof(float))) {
+    return false;
+  }
+  std::vector<uint64_t> offsets(block_num + 1);
+  std::memcpy(offsets.data(), data + sizeof(header),
+              offsets.size() * sizeof(uint64_t));
+  // each block lies in the payload, checked serially before decoding
+  if (offsets.front() != 0 || offsets.back() > size - table_end) {
+    return false;
+  }
+  for (int i = 0; i < block_num; ++i) {
+    if (offsets[i] > offsets[i + 1]) {
+      return false;
+    }
+  }
+
+  cloud->points.resize(header.point_count);
+  cloud->width = header.point_count;
+  cloud->height = 1;
+  const char* const blocks = data + table_end;
+  std::atomic<bool> succeed(true);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(LOCAL_OMP_THREADS_NUM)
+#endif
+  for (int i = 0; i < block_num; ++i) {
+    const char* block = blocks + offsets[i];
+    const char* block_end = blocks + offsets[i + 1];
+    const size_t begin = i * static_cast<size_t>(header.block_size);
+    const size_t num =
+        std::min<size_t>(header.block_size, header.point_count - begin);
+#ifdef _USE_BLOSC_
+    std::vector<char> raw;
+    if (header.method == kVarintBlosc) {
+      uint64_t raw_size = 0;
+      if (block_end - block < static_cast<int64_t>(sizeof(raw_size))) {
+        succeed = false;
+        continue;
+      }
+      std::memcpy(&raw_size, block, sizeof(raw_size));
+      // at most 5 bytes for every coordinate
+      if (raw_size > num * (15 + sizeof(float))) {
+        succeed = false;
+        continue;
+      }
+      // blosc trusts the compressed size in its own header
+      size_t blosc_raw_size = 0;
+      size_t blosc_compressed_size = 0;
+      size_t blosc_block_size = 0;
+      const size_t compressed_size = block_end - block - sizeof(raw_size);
+      if (compressed_size < BLOSC_MIN_HEADER_LENGTH) {
+        succeed = false;
+        continue;
+      }
+      blosc_cbuffer_sizes(block + sizeof(raw_size), &blosc_raw_size,
+                          &blosc_compressed_size, &blosc_block_size);
+      if (blosc_compressed_size > compressed_size ||
+          blosc_raw_size != raw_size) {
+        succeed = false;
+        continue;
+      }
+      raw.resize(raw_size);
+      if (blosc_decompress_ctx(block + sizeof(raw_size), raw.data(), raw_size,
+                               1) != static_cast<int>(raw_size)) {
+        succeed = false;
+        continue;
+      }
+      block = raw.data();
+      block_end = raw.data() + raw.size();
+    }
+#endif
+    if (!DecodeBlock(block, block_end, cloud->points.data() + begin, num)) {
+      succeed = false;
+    }
+  }
+  return succeed.load();
+}
+
+}  // namespace common
+}  // namespace static_map
+
+#endif  // COMMON_CLOUD_CODEC_H_
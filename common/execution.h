@@ -0,0 +1,154 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_EXECUTION_H_
+#define COMMON_EXECUTION_H_
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _USE_TBB_
+#ifndef TBB_PREVIEW_GLOBAL_CONTROL
+// global_control is a preview feature before tbb 2019
+#define TBB_PREVIEW_GLOBAL_CONTROL 1
+#endif
+#include <tbb/global_control.h>
+#include <tbb/task_scheduler_observer.h>
+#endif
+
+#include "common/macro_defines.h"
+
+namespace static_map {
+namespace common {
+
+/// @brief parse a cpu list like "0-3,8,10-11" (the format of taskset and
+/// /sys/devices/system/node/node*/cpulist), empty for an invalid list
+inline std::vector<int> ParseCpuList(const std::string& list) {
+  std::vector<int> cpus;
+  std::stringstream stream(list);
+  std::string range;
+  while (std::getline(stream, range, ',')) {
+    if (range.find_first_not_of(" \t\n") == std::string::npos) {
+      continue;
+    }
+    int first = -1;
+    int last = -1;
+    char tail = '\0';
+    const int read = sscanf(range.c_str(), "%d-%d%c", &first, &last, &tail);
+    if (read == 1) {
+      last = first;
+    }
+    if ((read != 1 && read != 2) || first < 0 || last < first ||
+        last >= CPU_SETSIZE) {
+      PRINT_ERROR_FMT("invalid cpu list: %s", list.c_str());
+      return std::vector<int>();
+    }
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+/// @brief the cpus of the numa node, empty if there is no such node
+inline std::vector<int> NumaNodeCpus(const int node) {
+  std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) +
+                     "/cpulist");
+  std::string list;
+  if (node < 0 || !file.is_open() || !std::getline(file, list)) {
+    PRINT_ERROR_FMT("no numa node %d.", node);
+    return std::vector<int>();
+  }
+  return ParseCpuList(list);
+}
+
+/// @brief allow the thread to run on the cpus only, nothing for empty cpus
+/// @note the threads created by it (also the omp threads) inherit them
+inline bool SetThreadCpus(const pthread_t thread,
+                          const std::vector<int>& cpus) {
+  if (cpus.empty()) {
+    return true;
+  }
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (const int cpu : cpus) {
+    CPU_SET(cpu, &cpu_set);
+  }
+  if (pthread_setaffinity_np(thread, sizeof(cpu_set), &cpu_set) != 0) {
+    PRINT_WARNING("failed to set the cpus of the thread.");
+    return false;
+  }
+  return true;
+}
+
+inline bool SetCurrentThreadCpus(const std::vector<int>& cpus) {
+  return SetThreadCpus(pthread_self(), cpus);
+}
+
+/// @brief limit and pin the tbb workers of the process (batch optimization,
+/// tbb containers), 0 threads and empty cpus keep the tbb defaults
+/// @note call it once before any tbb algorithm runs
+inline void SetTbbExecution(const int thread_num,
+                            const std::vector<int>& cpus) {
+#ifdef _USE_TBB_
+  // pin each worker as it joins an arena
+  class PinningObserver : public tbb::task_scheduler_observer {
+   public:
+    explicit PinningObserver(const std::vector<int>& cpus) : cpus_(cpus) {
+      observe(true);
+    }
+    void on_scheduler_entry(bool is_worker) override {
+      if (is_worker) {
+        SetCurrentThreadCpus(cpus_);
+      }
+    }
+
+   private:
+    const std::vector<int> cpus_;
+  };
+  // alive until the process exits
+  static std::unique_ptr<tbb::global_control> thread_limit;
+  static std::unique_ptr<PinningObserver> observer;
+  if (thread_num > 0) {
+    thread_limit.reset(new tbb::global_control(
+        tbb::global_control::max_allowed_parallelism, thread_num));
+  }
+  if (!cpus.empty()) {
+    observer.reset(new PinningObserver(cpus));
+  }
+#else
+  (void)thread_num;
+  (void)cpus;
+#endif
+}
+
+}  // namespace common
+}  // namespace static_map
+
+#endif  // COMMON_EXECUTION_H_
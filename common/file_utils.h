@@ -23,7 +23,9 @@
 #ifndef COMMON_FILE_UTILS_H_
 #define COMMON_FILE_UTILS_H_
 
+#include <sys/stat.h>
 #include <unistd.h>
+#include <cerrno>
 #include <string>
 
 namespace static_map {
@@ -33,7 +35,7 @@ inline bool FileExist(const std::string& name) {
   return (access(name.c_str(), F_OK) != -1);
 }
 
-std::string FilePath(const std::string& file) {
+inline std::string FilePath(const std::string& file) {
   size_t found = file.find_last_of("/");
   std::string file_path = "";
   if (found != std::string::npos) {
@@ -43,6 +45,22 @@ std::string FilePath(const std::string& file) {
   return file_path;
 }
 
+/// @brief create the directory and its parents (like "mkdir -p")
+/// @return false if a directory can not be created
+inline bool MakeDirectories(const std::string& path) {
+  for (size_t found = path.find('/', 1); !path.empty();
+       found = path.find('/', found + 1)) {
+    const std::string directory = path.substr(0, found);
+    if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+      return false;
+    }
+    if (found == std::string::npos) {
+      break;
+    }
+  }
+  return true;
+}
+
 }  // namespace common
 }  // namespace static_map
 
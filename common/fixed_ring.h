@@ -0,0 +1,109 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_FIXED_RING_H_
+#define COMMON_FIXED_RING_H_
+
+// stl
+#include <cstddef>
+#include <vector>
+
+#include "glog/logging.h"
+
+namespace static_map {
+namespace common {
+
+/*
+ * @class FixedRing
+ * @brief fixed-capacity ring with random access, allocated once on
+ * construction, the oldest element is overwritten if it is full
+ * not thread safe
+ */
+template <typename T>
+class FixedRing {
+ public:
+  explicit FixedRing(size_t capacity) : buffer_(capacity) {
+    CHECK_GT(capacity, 0u);
+  }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  bool full() const { return size_ == buffer_.size(); }
+  size_t capacity() const { return buffer_.size(); }
+
+  /// @return false if the oldest one is overwritten
+  bool push_back(const T& item) {
+    const bool overwritten = full();
+    if (overwritten) {
+      pop_front();
+    }
+    buffer_[(head_ + size_) % buffer_.size()] = item;
+    ++size_;
+    return !overwritten;
+  }
+
+  void pop_front() {
+    CHECK(!empty());
+    head_ = (head_ + 1) % buffer_.size();
+    --size_;
+  }
+
+  void clear() {
+    head_ = 0;
+    size_ = 0;
+  }
+
+  const T& operator[](size_t i) const {
+    return buffer_[(head_ + i) % buffer_.size()];
+  }
+  T& operator[](size_t i) { return buffer_[(head_ + i) % buffer_.size()]; }
+  const T& front() const { return (*this)[0]; }
+  const T& back() const { return (*this)[size_ - 1]; }
+
+  /// @return index of the first element for which less(element) is false,
+  /// in a ring partitioned by less
+  template <typename LessThan>
+  size_t LowerBound(const LessThan& less) const {
+    size_t begin = 0;
+    size_t count = size_;
+    while (count > 0) {
+      const size_t step = count / 2;
+      if (less((*this)[begin + step])) {
+        begin += step + 1;
+        count -= step + 1;
+      } else {
+        count = step;
+      }
+    }
+    return begin;
+  }
+
+ private:
+  std::vector<T> buffer_;
+  size_t head_ = 0;
+  size_t size_ = 0;
+};
+
+}  // namespace common
+}  // namespace static_map
+
+#endif  // COMMON_FIXED_RING_H_
@@ -20,11 +20,12 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
-#include <chrono>
+#include <atomic>
 #include <cstring>
-#include <stack>
+#include <random>
+#include <string>
 
-#include "common/simple_time.h"
+#include "common/macro_defines.h"
 
 namespace static_map {
 
@@ -41,43 +42,36 @@ char* splited_file_name(const char* file) {
   return filename;
 }
 
-std::stack<SimpleTime> debug_times;
-// @todo make it thread-safe
-void start_clock() { debug_times.push(SimpleTime::get_current_time()); }
-void end_clock(const char* filename, const char* func_name, const int line) {
-  if (debug_times.empty()) {
-    PRINT_ERROR_FMT("[ %s: %s: %d ] no clock.", splited_file_name(filename),
-                    func_name, line);
-    return;
+namespace common {
+
+namespace {
+std::atomic<int> omp_thread_num(10);
+std::atomic<bool> deterministic_seeds(false);
+}  // namespace
+
+void SetOmpThreadNum(const int thread_num) {
+  if (thread_num > 0) {
+    omp_thread_num = thread_num;
   }
-  SimpleTime current_time = debug_times.top();
-  debug_times.pop();
-  PRINT_COLOR_FMT(BOLD, "[ %s: %s: %d ] Cost : %lf s",
-                  splited_file_name(filename), func_name, line,
-                  (SimpleTime::get_current_time() - current_time).toSec());
 }
 
-// using c++ std
-std::chrono::high_resolution_clock::time_point debug_start_time_std;
-void start_clock_std() {
-  debug_start_time_std = std::chrono::high_resolution_clock::now();
-}
+int OmpThreadNum() { return omp_thread_num.load(); }
 
-void end_clock_std() {
-  std::chrono::high_resolution_clock::time_point end =
-      std::chrono::high_resolution_clock::now();
-  std::chrono::duration<double, std::ratio<1, 1>> duration_s(
-      end - debug_start_time_std);
-  PRINT_DEBUG_FMT("Cost: %lf s", duration_s.count());
+void SetDeterministicSeeds(const bool deterministic) {
+  deterministic_seeds = deterministic;
 }
 
-void end_clock_min_time_std(double min_time) {
-  std::chrono::high_resolution_clock::time_point end =
-      std::chrono::high_resolution_clock::now();
-  std::chrono::duration<double, std::ratio<1, 1>> duration_s(
-      end - debug_start_time_std);
-  double spent_time = duration_s.count();
-  if (spent_time > min_time) PRINT_DEBUG_FMT("Cost: %lf s", spent_time);
+uint32_t RandomSeed(const uint64_t stamp) {
+  if (!deterministic_seeds.load()) {
+    return std::random_device()();
+  }
+  // splitmix64, the close stamps of consecutive clouds give unrelated seeds
+  uint64_t seed = stamp + 0x9e3779b97f4a7c15ull;
+  seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ull;
+  seed = (seed ^ (seed >> 27)) * 0x94d049bb133111ebull;
+  return static_cast<uint32_t>(seed ^ (seed >> 31));
 }
 
+}  // namespace common
+
 }  // namespace static_map
@@ -28,6 +28,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <cstdint>
 #include <iostream>
 #include <string>
 
@@ -61,23 +62,25 @@
 
 namespace static_map {
 /*!
- * \brief just for debug
- *
- * use this function with end_clock/end_clock_min_time
- * the when you call end_clock, you will get the time cost from the start to
- * the end
+ * @brief return the filename without path
  */
-void start_clock();
-void end_clock(const char* filename, const char* func_name, const int line);
-
-void start_clock_std();
-void end_clock_std();
-void end_clock_min_time_std(double min_time);
+char* splited_file_name(const char*);
 
+namespace common {
 /*!
- * @brief return the filename without path
+ * @brief the threads of each omp loop (filters, icp, cloud codec), set
+ * from the execution options before the loops run, 10 by default
  */
-char* splited_file_name(const char*);
+void SetOmpThreadNum(const int thread_num);
+int OmpThreadNum();
+/*!
+ * @brief the seeds of the random samplers (filters), from
+ * std::random_device by default. in the deterministic mode they are derived
+ * from the cloud stamps, so the replays of the same data keep the same points
+ */
+void SetDeterministicSeeds(const bool deterministic);
+uint32_t RandomSeed(const uint64_t stamp);
+}  // namespace common
 
 }  // namespace static_map
 
@@ -198,7 +201,7 @@ using static_map::splited_file_name;
 
 #define RAD_TO_DEG 57.29577951
 
-#define LOCAL_OMP_THREADS_NUM 10
+#define LOCAL_OMP_THREADS_NUM (::static_map::common::OmpThreadNum())
 
 #define GET_SINGLE_OPTION(XML_NODE, CHILD_NAME, CHILD_ATTR_NAME, TARGET,     \
                           DATA_TYPE, TARGET_TYPE)                            \
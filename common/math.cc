@@ -129,67 +129,31 @@ std::vector<Eigen::Vector3i> VoxelCasting(const Eigen::Vector3f& ray_start,
   return visited_voxels;
 }
 
-// refer to code in
-// "http://members.chello.at/easyfilter/bresenham.html"
+namespace {
+
+// the number of voxels on the ray for reserving, 0 if the ray is invalid
+size_t VoxelNumOnRay(const Eigen::Vector3f& ray_start,
+                     const Eigen::Vector3f& ray_end, const float step_size) {
+  Eigen::Vector3i start, end;
+  if (!PointToVoxel(ray_start, step_size, &start) ||
+      !PointToVoxel(ray_end, step_size, &end)) {
+    return 0;
+  }
+  return (end - start).cwiseAbs().maxCoeff() + 1;
+}
+
+}  // namespace
+
 std::vector<Eigen::Vector3i> VoxelCastingBresenham(
     const Eigen::Vector3f& ray_start, const Eigen::Vector3f& ray_end,
     const float& step_size) {
   std::vector<Eigen::Vector3i> visited_voxels;
-  // This id of the first/current voxel hit by the ray.
-  // Using floor (round down) is actually very important,
-  // the implicit int-casting will round up for negative numbers.
-  int x0 = std::lround(std::floor(ray_start[0] / step_size));
-  int y0 = std::lround(std::floor(ray_start[1] / step_size));
-  int z0 = std::lround(std::floor(ray_start[2] / step_size));
-  if (std::isnan(x0) || std::isnan(y0) || std::isnan(z0)) {
-    return visited_voxels;
-  }
-  // The id of the last voxel hit by the ray.
-  // @todo what happens if the end point is on a border?
-  int x1 = std::lround(std::floor(ray_end[0] / step_size));
-  int y1 = std::lround(std::floor(ray_end[1] / step_size));
-  int z1 = std::lround(std::floor(ray_end[2] / step_size));
-  if (std::isnan(x1) || std::isnan(y1) || std::isnan(z1)) {
-    return visited_voxels;
-  }
-
-  const int x1_init = x1;
-  const int y1_init = y1;
-  const int z1_init = z1;
-
-  const int dx = std::abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
-  const int dy = std::abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
-  const int dz = std::abs(z1 - z0), sz = z0 < z1 ? 1 : -1;
-  const int dm = std::max({dx, dy, dz});
-  x1 = y1 = z1 = (dm >> 1); /* error offset */
-
-  int i = dm;
-  visited_voxels.reserve(dm + 1);
-  for (;;) {
-    visited_voxels.emplace_back(x0, y0, z0);
-    if (i-- == 0) {
-      break;
-    }
-    x1 -= dx;
-    if (x1 < 0) {
-      x1 += dm;
-      x0 += sx;
-    }
-    y1 -= dy;
-    if (y1 < 0) {
-      y1 += dm;
-      y0 += sy;
-    }
-    z1 -= dz;
-    if (z1 < 0) {
-      z1 += dm;
-      z0 += sz;
-    }
-  }
-
-  CHECK_EQ(x0, x1_init);
-  CHECK_EQ(y0, y1_init);
-  CHECK_EQ(z0, z1_init);
+  visited_voxels.reserve(VoxelNumOnRay(ray_start, ray_end, step_size));
+  VisitVoxelsBresenham(ray_start, ray_end, step_size,
+                       [&](const Eigen::Vector3i& voxel) {
+                         visited_voxels.push_back(voxel);
+                         return true;
+                       });
   return visited_voxels;
 }
 
@@ -199,76 +163,12 @@ std::vector<Eigen::Vector3i> VoxelCastingDDA(const Eigen::Vector3f& ray_start,
                                              const Eigen::Vector3f& ray_end,
                                              const float& step_size) {
   std::vector<Eigen::Vector3i> visited_voxels;
-  // This id of the first/current voxel hit by the ray.
-  // Using floor (round down) is actually very important,
-  // the implicit int-casting will round up for negative numbers.
-  Eigen::Vector3i start_voxel(
-      static_cast<int>(std::lround(std::floor(ray_start[0] / step_size))),
-      static_cast<int>(std::lround(std::floor(ray_start[1] / step_size))),
-      static_cast<int>(std::lround(std::floor(ray_start[2] / step_size))));
-  if (std::isnan(start_voxel[0]) || std::isnan(start_voxel[1]) ||
-      std::isnan(start_voxel[2])) {
-    return visited_voxels;
-  }
-  // The id of the last voxel hit by the ray.
-  // @todo what happens if the end point is on a border?
-  Eigen::Vector3i end_voxel(
-      static_cast<int>(std::lround(std::floor(ray_end[0] / step_size))),
-      static_cast<int>(std::lround(std::floor(ray_end[1] / step_size))),
-      static_cast<int>(std::lround(std::floor(ray_end[2] / step_size))));
-  if (std::isnan(end_voxel[0]) || std::isnan(end_voxel[1]) ||
-      std::isnan(end_voxel[2])) {
-    return visited_voxels;
-  }
-
-  Eigen::Vector3i current_voxel = start_voxel;
-  Eigen::Vector3i delta = end_voxel - start_voxel;
-  Eigen::Vector3i error(0, 0, 0);
-  Eigen::Vector3i step(delta[0] >= 0 ? 1 : -1, delta[1] >= 0 ? 1 : -1,
-                       delta[2] >= 0 ? 1 : -1);
-
-  // take the absolute value of the coordinate changes
-  delta[0] = delta[0] < 0 ? -delta[0] : delta[0];
-  delta[1] = delta[1] < 0 ? -delta[1] : delta[1];
-  delta[2] = delta[2] < 0 ? -delta[2] : delta[2];
-
-  int max_delta = delta[0] > delta[1] ? delta[0] : delta[1];
-  max_delta = max_delta > delta[2] ? max_delta : delta[2];
-
-  visited_voxels.reserve(max_delta + 1);
-  for (int i = 0; i < max_delta; ++i) {
-    visited_voxels.push_back(current_voxel);
-
-    // Bresenham error updates
-    error[0] += delta[0];
-    error[1] += delta[1];
-    error[2] += delta[2];
-
-    // check if error in x exceeds threshold, if so
-    // update coord and error
-    if ((error[0] << 1) >= max_delta) {
-      current_voxel[0] += step[0];
-      error[0] -= max_delta;
-    }
-    // check if error in y exceeds threshold, if so
-    // update coord and error
-    if ((error[1] << 1) >= max_delta) {
-      current_voxel[1] += step[1];
-      error[1] -= max_delta;
-    }
-
-    if ((error[2] << 1) >= max_delta) {
-      current_voxel[2] += step[2];
-      error[2] -= max_delta;
-    }
-  }
-  visited_voxels.push_back(current_voxel);
-  // visited_voxels.shrink_to_fit();
-  if (current_voxel != end_voxel) {
-    std::cout << current_voxel.transpose() << " != " << end_voxel.transpose()
-              << std::endl;
-  }
-  CHECK_EQ(current_voxel, end_voxel);
+  visited_voxels.reserve(VoxelNumOnRay(ray_start, ray_end, step_size));
+  VisitVoxelsDDA(ray_start, ray_end, step_size,
+                 [&](const Eigen::Vector3i& voxel) {
+                   visited_voxels.push_back(voxel);
+                   return true;
+                 });
   return visited_voxels;
 }
 
@@ -24,13 +24,16 @@
 #define COMMON_MATH_H_
 
 // stl
+#include <algorithm>
 #include <cmath>
+#include <cstdlib>
 #include <iostream>
 #include <limits>
 #include <utility>
 #include <vector>
 // third party
 #include "Eigen/Core"
+#include "Eigen/Eigenvalues"
 #include "Eigen/SVD"
 #include "glog/logging.h"
 
@@ -223,6 +226,115 @@ std::vector<Eigen::Vector3i> VoxelCastingDDA(const Eigen::Vector3f& ray_start,
                                              const Eigen::Vector3f& ray_end,
                                              const float& step_size);
 
+// the voxel containing 'point', false if the point has nan coordinates
+// using floor (round down) is actually very important,
+// the implicit int-casting will round up for negative numbers.
+inline bool PointToVoxel(const Eigen::Vector3f& point, const float step_size,
+                         Eigen::Vector3i* voxel) {
+  if (std::isnan(point[0]) || std::isnan(point[1]) || std::isnan(point[2])) {
+    return false;
+  }
+  *voxel << static_cast<int>(std::lround(std::floor(point[0] / step_size))),
+      static_cast<int>(std::lround(std::floor(point[1] / step_size))),
+      static_cast<int>(std::lround(std::floor(point[2] / step_size)));
+  return true;
+}
+
+// a / b rounded down, also for the negative a (b > 0)
+inline int FloorDiv(const int a, const int b) {
+  const int q = a / b;
+  return (a % b != 0 && a < 0) ? q - 1 : q;
+}
+
+// allocation-free forms of VoxelCastingBresenham and VoxelCastingDDA
+// 'visitor' is called as bool(const Eigen::Vector3i&) for every voxel from
+// the start voxel to the end voxel (both included) in the same order as the
+// vector-returning versions, returning false stops the traversal
+// @return false if the traversal was stopped by the visitor
+// or the ray is invalid (nan)
+template <typename Visitor>
+bool VisitVoxelsBresenham(const Eigen::Vector3f& ray_start,
+                          const Eigen::Vector3f& ray_end,
+                          const float step_size, Visitor&& visitor) {
+  Eigen::Vector3i current, end;
+  if (!PointToVoxel(ray_start, step_size, &current) ||
+      !PointToVoxel(ray_end, step_size, &end)) {
+    return false;
+  }
+  // refer to code in
+  // "http://members.chello.at/easyfilter/bresenham.html"
+  const int dx = std::abs(end[0] - current[0]);
+  const int dy = std::abs(end[1] - current[1]);
+  const int dz = std::abs(end[2] - current[2]);
+  const int sx = current[0] < end[0] ? 1 : -1;
+  const int sy = current[1] < end[1] ? 1 : -1;
+  const int sz = current[2] < end[2] ? 1 : -1;
+  const int dm = std::max(dx, std::max(dy, dz));
+  int ex, ey, ez;
+  ex = ey = ez = (dm >> 1); /* error offset */
+
+  for (int i = dm;; --i) {
+    if (!visitor(const_cast<const Eigen::Vector3i&>(current))) {
+      return false;
+    }
+    if (i == 0) {
+      break;
+    }
+    ex -= dx;
+    if (ex < 0) {
+      ex += dm;
+      current[0] += sx;
+    }
+    ey -= dy;
+    if (ey < 0) {
+      ey += dm;
+      current[1] += sy;
+    }
+    ez -= dz;
+    if (ez < 0) {
+      ez += dm;
+      current[2] += sz;
+    }
+  }
+  CHECK_EQ(current, end);
+  return true;
+}
+
+template <typename Visitor>
+bool VisitVoxelsDDA(const Eigen::Vector3f& ray_start,
+                    const Eigen::Vector3f& ray_end, const float step_size,
+                    Visitor&& visitor) {
+  Eigen::Vector3i current, end;
+  if (!PointToVoxel(ray_start, step_size, &current) ||
+      !PointToVoxel(ray_end, step_size, &end)) {
+    return false;
+  }
+  Eigen::Vector3i delta = end - current;
+  Eigen::Vector3i error(0, 0, 0);
+  const Eigen::Vector3i step(delta[0] >= 0 ? 1 : -1, delta[1] >= 0 ? 1 : -1,
+                             delta[2] >= 0 ? 1 : -1);
+  // take the absolute value of the coordinate changes
+  delta = delta.cwiseAbs();
+  const int max_delta = delta.maxCoeff();
+
+  for (int i = 0; i < max_delta; ++i) {
+    if (!visitor(const_cast<const Eigen::Vector3i&>(current))) {
+      return false;
+    }
+    // Bresenham error updates, check if the error exceeds threshold,
+    // if so update coord and error
+    error += delta;
+    for (int j = 0; j < 3; ++j) {
+      if ((error[j] << 1) >= max_delta) {
+        current[j] += step[j];
+        error[j] -= max_delta;
+      }
+    }
+  }
+  CHECK_EQ(current, end);
+  return visitor(const_cast<const Eigen::Vector3i&>(current));
+}
+
 template <typename Scalar>
 std::pair<Eigen::Matrix<Scalar, 3, 1>, Eigen::Matrix<Scalar, 3, 1>>
 PlaneFitting(const std::vector<Eigen::Matrix<Scalar, 3, 1>>& points) {
@@ -231,29 +343,23 @@ PlaneFitting(const std::vector<Eigen::Matrix<Scalar, 3, 1>>& points) {
     return std::make_pair(Eigen::Matrix<Scalar, 3, 1>(limit, limit, limit),
                           Eigen::Matrix<Scalar, 3, 1>(limit, limit, limit));
   }
-  // copy coordinates to  matrix in Eigen format
-  size_t num_atoms = points.size();
-  Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> coord(3, num_atoms);
-  for (size_t i = 0; i < num_atoms; ++i) {
-    coord.template col(i) = points[i];
+  // pca in closed form: the normal is the eigen vector of the smallest
+  // eigen value of the 3x3 covariance, no copy of the points
+  Eigen::Matrix<Scalar, 3, 1> centroid = Eigen::Matrix<Scalar, 3, 1>::Zero();
+  for (const auto& point : points) {
+    centroid += point;
+  }
+  centroid /= static_cast<Scalar>(points.size());
+  Eigen::Matrix<Scalar, 3, 3> covariance = Eigen::Matrix<Scalar, 3, 3>::Zero();
+  for (const auto& point : points) {
+    const Eigen::Matrix<Scalar, 3, 1> offset = point - centroid;
+    covariance += offset * offset.transpose();
   }
 
-  // calculate centroid
-  Eigen::Matrix<Scalar, 3, 1> centroid(coord.template row(0).template mean(),
-                                       coord.template row(1).template mean(),
-                                       coord.template row(2).template mean());
-
-  // subtract centroid
-  coord.template row(0).array() -= centroid(0);
-  coord.template row(1).array() -= centroid(1);
-  coord.template row(2).array() -= centroid(2);
-
-  // we only need the left-singular matrix here
-  // http://math.stackexchange.com/questions/99299/best-fitting-plane-given-a-set-of-points
-  Eigen::JacobiSVD<Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>> svd =
-      coord.template jacobiSvd(Eigen::ComputeFullU | Eigen::ComputeThinV);
-  Eigen::Matrix<Scalar, 3, 1> plane_normal =
-      svd.template matrixU().template rightCols<1>();
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix<Scalar, 3, 3>> solver;
+  solver.computeDirect(covariance);
+  // the eigen values are in increasing order
+  Eigen::Matrix<Scalar, 3, 1> plane_normal = solver.eigenvectors().col(0);
   return std::make_pair(centroid, plane_normal);
 }
 
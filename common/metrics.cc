@@ -0,0 +1,288 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "common/metrics.h"
+
+// stl
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+
+namespace static_map {
+namespace common {
+
+namespace {
+// bucket i holds the latencies in [kBase^(i-1), kBase^i) us
+constexpr double kBase = 1.2;
+const double kLogBase = std::log(kBase);
+
+int BucketIndex(const double micro_seconds) {
+  if (micro_seconds < 1.) {
+    return 0;
+  }
+  const int index = static_cast<int>(std::log(micro_seconds) / kLogBase) + 1;
+  return index < Histogram::kBucketNum ? index : Histogram::kBucketNum - 1;
+}
+
+// use the geometric center of a bucket as its value
+double BucketValue(const int index) {
+  if (index == 0) {
+    return 0.5;
+  }
+  return std::pow(kBase, static_cast<double>(index) - 0.5);
+}
+
+std::atomic<bool> memory_accounting_enabled{false};
+
+// the metric names of prometheus are [a-zA-Z_:][a-zA-Z0-9_:]*
+std::string PrometheusName(const std::string& name) {
+  std::string result = "static_map_" + name;
+  for (char& c : result) {
+    if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_') {
+      c = '_';
+    }
+  }
+  return result;
+}
+}  // namespace
+
+void Histogram::Observe(const double seconds) {
+  const double micro_seconds = seconds > 0. ? seconds * 1.e6 : 0.;
+  buckets_[BucketIndex(micro_seconds)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_us_.fetch_add(static_cast<uint64_t>(micro_seconds),
+                    std::memory_order_relaxed);
+}
+
+double Histogram::Sum() const {
+  return static_cast<double>(sum_us_.load(std::memory_order_relaxed)) * 1.e-6;
+}
+
+double Histogram::Mean() const {
+  const uint64_t count = Count();
+  return count == 0 ? 0. : Sum() / static_cast<double>(count);
+}
+
+double Histogram::Percentile(const double p) const {
+  // the buckets are read one by one, their sum may slightly differ from
+  // count_ while others are writing, it is fine for monitoring
+  std::array<uint64_t, kBucketNum> buckets;
+  uint64_t total = 0;
+  for (int i = 0; i < kBucketNum; ++i) {
+    buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+    total += buckets[i];
+  }
+  if (total == 0) {
+    return 0.;
+  }
+  const double target = std::max(1., std::ceil(p * total));
+  uint64_t accumulated = 0;
+  for (int i = 0; i < kBucketNum; ++i) {
+    accumulated += buckets[i];
+    if (accumulated >= target) {
+      return BucketValue(i) * 1.e-6;
+    }
+  }
+  return BucketValue(kBucketNum - 1) * 1.e-6;
+}
+
+void Histogram::Reset() {
+  for (auto& bucket : buckets_) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+  count_.store(0, std::memory_order_relaxed);
+  sum_us_.store(0, std::memory_order_relaxed);
+}
+
+MetricsRegistry::MetricsRegistry()
+    : start_time_(std::chrono::steady_clock::now()) {}
+
+MetricsRegistry* MetricsRegistry::Get() {
+  // never destructed, metrics may be used during static destruction
+  static MetricsRegistry* const registry = new MetricsRegistry;
+  return registry;
+}
+
+Histogram* MetricsRegistry::GetHistogram(const std::string& name) {
+  MutexLocker locker(&mutex_);
+  auto& histogram = histograms_[name];
+  if (!histogram) {
+    histogram.reset(new Histogram);
+  }
+  return histogram.get();
+}
+
+Counter* MetricsRegistry::GetCounter(const std::string& name) {
+  MutexLocker locker(&mutex_);
+  auto& counter = counters_[name];
+  if (!counter) {
+    counter.reset(new Counter);
+  }
+  return counter.get();
+}
+
+Gauge* MetricsRegistry::GetGauge(const std::string& name) {
+  MutexLocker locker(&mutex_);
+  auto& gauge = gauges_[name];
+  if (!gauge) {
+    gauge.reset(new Gauge);
+  }
+  return gauge.get();
+}
+
+std::vector<std::pair<std::string, const Gauge*>> MetricsRegistry::GetGauges(
+    const std::string& prefix) {
+  MutexLocker locker(&mutex_);
+  std::vector<std::pair<std::string, const Gauge*>> gauges;
+  for (auto it = gauges_.lower_bound(prefix);
+       it != gauges_.end() && it->first.compare(0, prefix.size(), prefix) == 0;
+       ++it) {
+    gauges.emplace_back(it->first, it->second.get());
+  }
+  return gauges;
+}
+
+void EnableMemoryAccounting() { memory_accounting_enabled = true; }
+
+bool MemoryAccountingEnabled() {
+  return memory_accounting_enabled.load(std::memory_order_relaxed);
+}
+
+Gauge* MemoryGauge(const std::string& tag) {
+  return MetricsRegistry::Get()->GetGauge("memory." + tag + ".bytes");
+}
+
+void MetricsRegistry::Dump(std::ostream& stream) {
+  const double time = std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - start_time_)
+                          .count();
+  MutexLocker locker(&mutex_);
+  stream << std::fixed << std::setprecision(6) << "{\"time\": " << time;
+  stream << ", \"histograms\": {";
+  bool first = true;
+  for (const auto& histogram : histograms_) {
+    const Histogram& h = *histogram.second;
+    stream << (first ? "" : ", ") << "\"" << histogram.first << "\": {"
+           << "\"count\": " << h.Count() << ", \"mean\": " << h.Mean()
+           << ", \"p50\": " << h.Percentile(0.5)
+           << ", \"p95\": " << h.Percentile(0.95)
+           << ", \"p99\": " << h.Percentile(0.99) << "}";
+    first = false;
+  }
+  stream << "}, \"counters\": {";
+  first = true;
+  for (const auto& counter : counters_) {
+    stream << (first ? "" : ", ") << "\"" << counter.first
+           << "\": " << counter.second->Value();
+    first = false;
+  }
+  stream << "}, \"gauges\": {";
+  first = true;
+  for (const auto& gauge : gauges_) {
+    stream << (first ? "" : ", ") << "\"" << gauge.first
+           << "\": " << gauge.second->Value();
+    first = false;
+  }
+  stream << "}}" << std::endl;
+}
+
+bool MetricsRegistry::DumpToFile(const std::string& filename) {
+  std::ofstream file(filename, std::ios::out | std::ios::app);
+  if (!file.is_open()) {
+    return false;
+  }
+  Dump(file);
+  return true;
+}
+
+void MetricsRegistry::DumpPrometheus(std::ostream& stream) {
+  const double time = std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - start_time_)
+                          .count();
+  MutexLocker locker(&mutex_);
+  stream << std::fixed << std::setprecision(6);
+  stream << "# TYPE static_map_uptime_seconds gauge\n"
+         << "static_map_uptime_seconds " << time << "\n";
+  for (const auto& histogram : histograms_) {
+    const Histogram& h = *histogram.second;
+    const std::string name = PrometheusName(histogram.first) + "_seconds";
+    stream << "# TYPE " << name << " summary\n";
+    stream << name << "{quantile=\"0.5\"} " << h.Percentile(0.5) << "\n"
+           << name << "{quantile=\"0.95\"} " << h.Percentile(0.95) << "\n"
+           << name << "{quantile=\"0.99\"} " << h.Percentile(0.99) << "\n";
+    stream << name << "_sum " << h.Sum() << "\n"
+           << name << "_count " << h.Count() << "\n";
+  }
+  for (const auto& counter : counters_) {
+    const std::string name = PrometheusName(counter.first) + "_total";
+    stream << "# TYPE " << name << " counter\n"
+           << name << " " << counter.second->Value() << "\n";
+  }
+  for (const auto& gauge : gauges_) {
+    const std::string name = PrometheusName(gauge.first);
+    stream << "# TYPE " << name << " gauge\n"
+           << name << " " << gauge.second->Value() << "\n"
+           << "# TYPE " << name << "_max gauge\n"
+           << name << "_max " << gauge.second->Max() << "\n";
+  }
+}
+
+void MetricsRegistry::Reset() {
+  MutexLocker locker(&mutex_);
+  for (auto& histogram : histograms_) {
+    histogram.second->Reset();
+  }
+  for (auto& counter : counters_) {
+    counter.second->Reset();
+  }
+  for (auto& gauge : gauges_) {
+    gauge.second->ResetMax();
+  }
+}
+
+ScopedLatency::~ScopedLatency() {
+  const auto duration = std::chrono::steady_clock::now() - start_;
+  if (histogram_) {
+    histogram_->Observe(std::chrono::duration<double>(duration).count());
+  }
+  if (busy_us_) {
+    busy_us_->Add(
+        std::chrono::duration_cast<std::chrono::microseconds>(duration)
+            .count());
+  }
+}
+
+Histogram* ScopedTimer::TimerHistogram(const char* name) {
+  // the registry is locked only on the first use in each thread
+  thread_local std::unordered_map<const char*, Histogram*> histograms;
+  Histogram*& histogram = histograms[name];
+  if (histogram == nullptr) {
+    histogram =
+        MetricsRegistry::Get()->GetHistogram(std::string("timer.") + name);
+  }
+  return histogram;
+}
+
+}  // namespace common
+}  // namespace static_map
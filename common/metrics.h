@@ -0,0 +1,233 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+// stl
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// local
+#include "common/mutex.h"
+
+namespace static_map {
+namespace common {
+
+// a monotonic counter, e.g. processed clouds or busy microseconds of a thread
+class Counter {
+ public:
+  void Add(const int64_t value = 1) {
+    value_.fetch_add(value, std::memory_order_relaxed);
+  }
+  int64_t Value() const { return value_.load(std::memory_order_relaxed); }
+  void Reset() { value_.store(0, std::memory_order_relaxed); }
+
+ private:
+  std::atomic<int64_t> value_{0};
+};
+
+// a value which can go up and down, e.g. queue depth
+class Gauge {
+ public:
+  void Set(const int64_t value) {
+    value_.store(value, std::memory_order_relaxed);
+    UpdateMax(value);
+  }
+  // for the values tracked by their owners, e.g. live bytes
+  void Add(const int64_t delta) {
+    UpdateMax(value_.fetch_add(delta, std::memory_order_relaxed) + delta);
+  }
+  int64_t Value() const { return value_.load(std::memory_order_relaxed); }
+  // the high-water mark
+  int64_t Max() const { return max_.load(std::memory_order_relaxed); }
+  // restart the high-water mark from the current value
+  void ResetMax() { max_.store(Value(), std::memory_order_relaxed); }
+
+ private:
+  void UpdateMax(const int64_t value) {
+    int64_t max = max_.load(std::memory_order_relaxed);
+    while (value > max &&
+           !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+    }
+  }
+
+  std::atomic<int64_t> value_{0};
+  std::atomic<int64_t> max_{0};
+};
+
+// a lock-free latency histogram with exponential buckets
+// from 1us to about 100s, the relative error of percentiles is < 10%
+class Histogram {
+ public:
+  static constexpr int kBucketNum = 96;
+
+  // @param seconds the observed latency
+  void Observe(const double seconds);
+
+  uint64_t Count() const { return count_.load(std::memory_order_relaxed); }
+  double Sum() const;
+  double Mean() const;
+  /// @brief get the approximate percentile in seconds
+  /// @param p percentile in [0, 1]
+  double Percentile(const double p) const;
+  void Reset();
+
+ private:
+  std::array<std::atomic<uint64_t>, kBucketNum> buckets_{};
+  std::atomic<uint64_t> count_{0};
+  // sum in microseconds
+  std::atomic<uint64_t> sum_us_{0};
+};
+
+/// @class MetricsRegistry
+/// @brief process-wide registry of named metrics
+/// the returned metrics are never released, so callers can hold the
+/// pointers (e.g. as static locals) and skip the lookup in hot paths
+class MetricsRegistry {
+ public:
+  static MetricsRegistry* Get();
+
+  Histogram* GetHistogram(const std::string& name);
+  Counter* GetCounter(const std::string& name);
+  Gauge* GetGauge(const std::string& name);
+  /// @brief the gauges whose names start with the prefix, in name order
+  std::vector<std::pair<std::string, const Gauge*>> GetGauges(
+      const std::string& prefix);
+
+  /// @brief write one json line with the snapshot of all metrics
+  void Dump(std::ostream& stream);
+  /// @brief append a snapshot to the file
+  bool DumpToFile(const std::string& filename);
+  /// @brief write the snapshot in the prometheus text format, the names
+  /// are prefixed with "static_map_" and their dots become underscores,
+  /// the histograms are summaries in seconds
+  void DumpPrometheus(std::ostream& stream);
+  /// @brief restart the metrics for a new run in the same process, the
+  /// counters and the histograms from zero, the gauges keep their values
+  /// (the live ones) and restart their high-water marks from them
+  void Reset();
+
+ private:
+  MetricsRegistry();
+
+  const std::chrono::steady_clock::time_point start_time_;
+  Mutex mutex_;
+  std::map<std::string, std::unique_ptr<Histogram>> histograms_;
+  std::map<std::string, std::unique_ptr<Counter>> counters_;
+  std::map<std::string, std::unique_ptr<Gauge>> gauges_;
+};
+
+/// @brief the memory accounting is opt-in, the bytes of a tag are in the
+/// gauge "memory.<tag>.bytes"
+void EnableMemoryAccounting();
+bool MemoryAccountingEnabled();
+Gauge* MemoryGauge(const std::string& tag);
+
+/// @class TrackedBytes
+/// @brief the share of one owner in a memory gauge, it leaves the gauge
+/// with the owner, not thread safe
+class TrackedBytes {
+ public:
+  explicit TrackedBytes(Gauge* gauge) : gauge_(gauge), bytes_(0) {}
+  ~TrackedBytes() { Set(0); }
+
+  TrackedBytes(const TrackedBytes&) = delete;
+  TrackedBytes& operator=(const TrackedBytes&) = delete;
+
+  void Set(const int64_t bytes) {
+    if (bytes != bytes_) {
+      gauge_->Add(bytes - bytes_);
+      bytes_ = bytes;
+    }
+  }
+
+ private:
+  Gauge* gauge_;
+  int64_t bytes_;
+};
+
+/// @class ScopedLatency
+/// @brief observes the lifetime of itself into a histogram, and adds it
+/// to the busy counter (in microseconds) of the working thread if provided
+class ScopedLatency {
+ public:
+  explicit ScopedLatency(Histogram* histogram, Counter* busy_us = nullptr)
+      : histogram_(histogram),
+        busy_us_(busy_us),
+        start_(std::chrono::steady_clock::now()) {}
+  ~ScopedLatency();
+
+  ScopedLatency(const ScopedLatency&) = delete;
+  ScopedLatency& operator=(const ScopedLatency&) = delete;
+
+ private:
+  Histogram* histogram_;
+  Counter* busy_us_;
+  const std::chrono::steady_clock::time_point start_;
+};
+
+/// @class ScopedTimer
+/// @brief observes the lifetime of itself into the histogram "timer.<name>",
+/// the state is in the timer and the histograms are looked up once per
+/// thread, so it works in any thread, OMP region or TBB task
+/// @note use SCOPED_TIMER(name), which is compiled out without the cmake
+/// option USE_SCOPED_TIMER
+class ScopedTimer {
+ public:
+  /// @param name a string literal, it is the key of the lookup
+  explicit ScopedTimer(const char* name) : latency_(TimerHistogram(name)) {}
+
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+ private:
+  static Histogram* TimerHistogram(const char* name);
+
+  ScopedLatency latency_;
+};
+
+}  // namespace common
+}  // namespace static_map
+
+#define STATIC_MAP_CONCAT_INNER(a, b) a##b
+#define STATIC_MAP_CONCAT(a, b) STATIC_MAP_CONCAT_INNER(a, b)
+
+/*!
+ * @def SCOPED_TIMER(name)
+ * time the rest of the scope into the histogram "timer.<name>"
+ */
+#ifdef _USE_SCOPED_TIMER_
+#define SCOPED_TIMER(name)          \
+  ::static_map::common::ScopedTimer \
+      STATIC_MAP_CONCAT(scoped_timer_, __LINE__)(name)
+#else
+#define SCOPED_TIMER(name)
+#endif
@@ -0,0 +1,168 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "common/metrics_server.h"
+
+// linux
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+// stl
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <string>
+
+// local
+#include "common/macro_defines.h"
+#include "common/metrics.h"
+
+namespace static_map {
+namespace common {
+
+namespace {
+// how often the serving thread checks whether it is stopped
+constexpr int kPollTimeoutMs = 200;
+// a slow or silent client does not hold the thread longer than this
+constexpr int kReceiveTimeoutSec = 1;
+constexpr size_t kMaxRequestBytes = 8192;
+
+bool SendAll(const int connection, const std::string& data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    const ssize_t n = send(connection, data.data() + sent, data.size() - sent,
+                           MSG_NOSIGNAL);
+    if (n <= 0) {
+      return false;
+    }
+    sent += static_cast<size_t>(n);
+  }
+  return true;
+}
+}  // namespace
+
+bool MetricsServer::Start(const int port) {
+  if (thread_) {
+    return false;
+  }
+  socket_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (socket_ < 0) {
+    PRINT_ERROR_FMT("failed to create the metrics socket: %s",
+                    std::strerror(errno));
+    return false;
+  }
+  // the jobs of a service listen on the same port one after another
+  const int reuse = 1;
+  setsockopt(socket_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  sockaddr_in address;
+  std::memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(static_cast<uint16_t>(port));
+  if (bind(socket_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) !=
+          0 ||
+      listen(socket_, 8) != 0) {
+    PRINT_ERROR_FMT("failed to listen on port %d for the metrics: %s", port,
+                    std::strerror(errno));
+    close(socket_);
+    socket_ = -1;
+    return false;
+  }
+  stopped_ = false;
+  thread_.reset(new std::thread(&MetricsServer::Serve, this));
+  PRINT_INFO_FMT("serving the metrics on http://0.0.0.0:%d/metrics", port);
+  return true;
+}
+
+void MetricsServer::Stop() {
+  if (!thread_) {
+    return;
+  }
+  stopped_ = true;
+  thread_->join();
+  thread_.reset();
+  close(socket_);
+  socket_ = -1;
+}
+
+void MetricsServer::Serve() {
+  pollfd listening;
+  listening.fd = socket_;
+  listening.events = POLLIN;
+  while (!stopped_) {
+    listening.revents = 0;
+    if (poll(&listening, 1, kPollTimeoutMs) <= 0 ||
+        !(listening.revents & POLLIN)) {
+      continue;
+    }
+    const int connection = accept(socket_, nullptr, nullptr);
+    if (connection < 0) {
+      continue;
+    }
+    Respond(connection);
+    close(connection);
+  }
+}
+
+void MetricsServer::Respond(const int connection) {
+  timeval timeout;
+  timeout.tv_sec = kReceiveTimeoutSec;
+  timeout.tv_usec = 0;
+  setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  // only the request line matters, the rest of the headers are ignored
+  std::string request;
+  char buffer[1024];
+  while (request.find("\r\n") == std::string::npos &&
+         request.size() < kMaxRequestBytes) {
+    const ssize_t n = recv(connection, buffer, sizeof(buffer), 0);
+    if (n <= 0) {
+      return;
+    }
+    request.append(buffer, static_cast<size_t>(n));
+  }
+  std::istringstream request_line(request.substr(0, request.find("\r\n")));
+  std::string method, path;
+  request_line >> method >> path;
+  std::string status = "200 OK";
+  std::string body;
+  if (method != "GET") {
+    status = "405 Method Not Allowed";
+  } else if (path != "/metrics" && path != "/") {
+    status = "404 Not Found";
+  } else {
+    std::ostringstream metrics;
+    MetricsRegistry::Get()->DumpPrometheus(metrics);
+    body = metrics.str();
+  }
+  std::ostringstream response;
+  response << "HTTP/1.1 " << status << "\r\n"
+           << "Content-Type: text/plain; version=0.0.4\r\n"
+           << "Content-Length: " << body.size() << "\r\n"
+           << "Connection: close\r\n\r\n"
+           << body;
+  SendAll(connection, response.str());
+}
+
+}  // namespace common
+}  // namespace static_map
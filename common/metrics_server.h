@@ -0,0 +1,62 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+// stl
+#include <atomic>
+#include <memory>
+#include <thread>
+
+namespace static_map {
+namespace common {
+
+/// @class MetricsServer
+/// @brief a minimal http endpoint of the metrics registry, "GET /metrics"
+/// gives the snapshot in the prometheus text format, for scraping the
+/// running jobs and spotting the stalled ones
+/// one thread serves the requests one by one, it is only for monitoring
+class MetricsServer {
+ public:
+  MetricsServer() = default;
+  ~MetricsServer() { Stop(); }
+
+  MetricsServer(const MetricsServer&) = delete;
+  MetricsServer& operator=(const MetricsServer&) = delete;
+
+  /// @brief listen on the port of all interfaces
+  /// @return false if the port can not be listened on
+  bool Start(int port);
+  /// @brief stop serving and close the port, no-op if not started
+  void Stop();
+
+ private:
+  void Serve();
+  void Respond(int connection);
+
+  int socket_ = -1;
+  std::atomic<bool> stopped_{false};
+  std::unique_ptr<std::thread> thread_;
+};
+
+}  // namespace common
+}  // namespace static_map
@@ -0,0 +1,116 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_MORTON_H_
+#define COMMON_MORTON_H_
+
+#include <Eigen/Core>
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+namespace static_map {
+namespace common {
+
+// 21 bits for each axis, it covers +-2^20 voxels (about +-100 km at 0.1 m)
+// around the origin, the highest bit of the key is never used
+constexpr int kMortonBits = 21;
+constexpr int64_t kMortonOffset = int64_t(1) << (kMortonBits - 1);
+constexpr uint64_t kMortonAxisMask = (uint64_t(1) << kMortonBits) - 1u;
+
+/// @brief spread the lowest 21 bits of v to every 3rd bit
+inline uint64_t MortonSpreadBits(uint64_t v) {
+#ifdef __BMI2__
+  return _pdep_u64(v, 0x1249249249249249ull);
+#else
+  v &= kMortonAxisMask;
+  v = (v | v << 32) & 0x1f00000000ffffull;
+  v = (v | v << 16) & 0x1f0000ff0000ffull;
+  v = (v | v << 8) & 0x100f00f00f00f00full;
+  v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+  v = (v | v << 2) & 0x1249249249249249ull;
+  return v;
+#endif
+}
+
+/// @brief the inverse of MortonSpreadBits
+inline uint64_t MortonCompactBits(uint64_t v) {
+#ifdef __BMI2__
+  return _pext_u64(v, 0x1249249249249249ull);
+#else
+  v &= 0x1249249249249249ull;
+  v = (v | v >> 2) & 0x10c30c30c30c30c3ull;
+  v = (v | v >> 4) & 0x100f00f00f00f00full;
+  v = (v | v >> 8) & 0x1f0000ff0000ffull;
+  v = (v | v >> 16) & 0x1f00000000ffffull;
+  v = (v | v >> 32) & kMortonAxisMask;
+  return v;
+#endif
+}
+
+/// @brief the morton (z-order) key of the voxel index, the bits of x, y and
+/// z are interleaved, so the voxels near in space are mostly near in the
+/// order of the keys, e.g. the 8 voxels of an aligned 2x2x2 block only
+/// differ in the lowest 3 bits
+inline uint64_t MortonEncode(const Eigen::Vector3i& index) {
+  return MortonSpreadBits(static_cast<uint64_t>(index[0] + kMortonOffset)) |
+         MortonSpreadBits(static_cast<uint64_t>(index[1] + kMortonOffset))
+             << 1 |
+         MortonSpreadBits(static_cast<uint64_t>(index[2] + kMortonOffset))
+             << 2;
+}
+
+inline Eigen::Vector3i MortonDecode(const uint64_t key) {
+  return Eigen::Vector3i(
+      static_cast<int>(static_cast<int64_t>(MortonCompactBits(key)) -
+                       kMortonOffset),
+      static_cast<int>(static_cast<int64_t>(MortonCompactBits(key >> 1)) -
+                       kMortonOffset),
+      static_cast<int>(static_cast<int64_t>(MortonCompactBits(key >> 2)) -
+                       kMortonOffset));
+}
+
+/// @brief the indices of the keys in the order of the keys, the same keys
+/// keep their order, e.g. for visiting the points in the spatial order
+inline std::vector<int> MortonOrder(const std::vector<uint64_t>& keys) {
+  std::vector<std::pair<uint64_t, int>> sorted(keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    sorted[i] = std::make_pair(keys[i], static_cast<int>(i));
+  }
+  std::sort(sorted.begin(), sorted.end());
+  std::vector<int> order(keys.size());
+  for (size_t i = 0; i < sorted.size(); ++i) {
+    order[i] = sorted[i].second;
+  }
+  return order;
+}
+
+}  // namespace common
+}  // namespace static_map
+
+#endif  // COMMON_MORTON_H_
@@ -0,0 +1,287 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_NDT_MAP_FILE_H_
+#define COMMON_NDT_MAP_FILE_H_
+
+// stl
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+// system
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+// third party
+#include <Eigen/Dense>
+#include "pcl/point_cloud.h"
+// local
+#include "common/eigen_hash.h"
+
+namespace static_map {
+namespace common {
+
+/*
+ * the precomputed ndt grid of a map piece (little endian):
+ *   NdtMapHeader
+ *   NdtMapCell[cell_num] at cells_offset, sorted by the voxel index
+ * the cells are the same as pclomp::VoxelGridCovariance builds from the
+ * points of the piece (relative to its center), so a localizer maps the
+ * file instead of building the grid at startup
+ */
+constexpr char kNdtMapMagic[8] = {'S', 'M', 'N', 'D', 'T', 'M', 'P', '\0'};
+constexpr uint32_t kNdtMapVersion = 1u;
+
+struct NdtMapHeader {
+  char magic[8];
+  uint32_t version;
+  // the voxels of less points are not in the grid
+  uint32_t min_point_num;
+  float resolution;
+  // the eigen values are inflated to this ratio of the largest one
+  float min_covariance_eigenvalue_mult;
+  // the center of the piece, the cells are relative to it
+  double center[2];
+  uint64_t cell_num;
+  uint64_t cells_offset;
+};
+static_assert(sizeof(NdtMapHeader) == 56, "unexpected padding");
+
+struct NdtMapCell {
+  // floor(point / resolution)
+  int32_t index[3];
+  uint32_t point_num;
+  float mean[3];
+  // the upper triangles: xx xy xz yy yz zz
+  float covariance[6];
+  float inverse_covariance[6];
+};
+static_assert(sizeof(NdtMapCell) == 76, "unexpected padding");
+
+inline bool operator<(const NdtMapCell& a, const NdtMapCell& b) {
+  return std::lexicographical_compare(a.index, a.index + 3, b.index,
+                                      b.index + 3);
+}
+
+/// @brief the ndt cells of the points, in the order of the voxel indices
+template <typename PointT>
+std::vector<NdtMapCell> ComputeNdtCells(
+    const pcl::PointCloud<PointT>& cloud, const float resolution,
+    const int min_point_num, const float min_covariance_eigenvalue_mult) {
+  struct Accumulator {
+    int point_num = 0;
+    Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+    // from the identity as pclomp::VoxelGridCovariance, for the same
+    // distributions
+    Eigen::Matrix3d squared_sum = Eigen::Matrix3d::Identity();
+  };
+  std::unordered_map<Eigen::Vector3i, Accumulator> voxels;
+  for (const auto& point : cloud.points) {
+    const Eigen::Vector3d position(point.x, point.y, point.z);
+    const Eigen::Vector3i index(std::floor(point.x / resolution),
+                                std::floor(point.y / resolution),
+                                std::floor(point.z / resolution));
+    Accumulator& voxel = voxels[index];
+    ++voxel.point_num;
+    voxel.sum += position;
+    voxel.squared_sum += position * position.transpose();
+  }
+
+  std::vector<NdtMapCell> cells;
+  cells.reserve(voxels.size());
+  for (const auto& voxel : voxels) {
+    const Accumulator& accumulator = voxel.second;
+    const double point_num = accumulator.point_num;
+    if (accumulator.point_num < min_point_num) {
+      continue;
+    }
+    const Eigen::Vector3d mean = accumulator.sum / point_num;
+    Eigen::Matrix3d covariance =
+        (accumulator.squared_sum - 2. * (accumulator.sum * mean.transpose())) /
+            point_num +
+        mean * mean.transpose();
+    covariance *= (point_num - 1.) / point_num;
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver;
+    solver.computeDirect(covariance);
+    Eigen::Vector3d eigen_values = solver.eigenvalues();
+    if (eigen_values[0] < 0. || eigen_values[1] < 0. ||
+        eigen_values[2] <= 0.) {
+      continue;
+    }
+    // avoid the singular matrices (eq 6.11)[Magnusson 2009]
+    const double min_eigen_value =
+        min_covariance_eigenvalue_mult * eigen_values[2];
+    if (eigen_values[0] < min_eigen_value) {
+      eigen_values[0] = min_eigen_value;
+      eigen_values[1] = std::max(eigen_values[1], min_eigen_value);
+      covariance = solver.eigenvectors() * eigen_values.asDiagonal() *
+                   solver.eigenvectors().transpose();
+    }
+    const Eigen::Matrix3d inverse_covariance = covariance.inverse();
+    if (!inverse_covariance.allFinite()) {
+      continue;
+    }
+    NdtMapCell cell;
+    for (int i = 0; i < 3; ++i) {
+      cell.index[i] = voxel.first[i];
+      cell.mean[i] = mean[i];
+    }
+    cell.point_num = accumulator.point_num;
+    int k = 0;
+    for (int i = 0; i < 3; ++i) {
+      for (int j = i; j < 3; ++j, ++k) {
+        cell.covariance[k] = covariance(i, j);
+        cell.inverse_covariance[k] = inverse_covariance(i, j);
+      }
+    }
+    cells.push_back(cell);
+  }
+  std::sort(cells.begin(), cells.end());
+  return cells;
+}
+
+/// @brief write the ndt grid of the points of a piece (relative to its
+/// center), return false if the file can not be written
+template <typename PointT>
+bool SaveNdtMap(const std::string& filename, const Eigen::Vector2d& center,
+                const pcl::PointCloud<PointT>& cloud, const float resolution,
+                const int min_point_num,
+                const float min_covariance_eigenvalue_mult = 0.01f) {
+  const std::vector<NdtMapCell> cells = ComputeNdtCells(
+      cloud, resolution, min_point_num, min_covariance_eigenvalue_mult);
+  NdtMapHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kNdtMapMagic, sizeof(kNdtMapMagic));
+  header.version = kNdtMapVersion;
+  header.min_point_num = min_point_num;
+  header.resolution = resolution;
+  header.min_covariance_eigenvalue_mult = min_covariance_eigenvalue_mult;
+  header.center[0] = center[0];
+  header.center[1] = center[1];
+  header.cell_num = cells.size();
+  header.cells_offset = sizeof(header);
+  std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(cells.data()),
+             cells.size() * sizeof(NdtMapCell));
+  return file.good();
+}
+
+/// @class NdtMapReader
+/// @brief map an ndt grid file into memory, the cells are read in place
+class NdtMapReader {
+ public:
+  NdtMapReader() = default;
+  ~NdtMapReader() { Close(); }
+
+  NdtMapReader(const NdtMapReader&) = delete;
+  NdtMapReader& operator=(const NdtMapReader&) = delete;
+
+  /// @return false if the file can not be mapped or is not an ndt grid
+  bool Open(const std::string& filename) {
+    Close();
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 ||
+        static_cast<size_t>(file_stat.st_size) < sizeof(NdtMapHeader)) {
+      close(fd);
+      return false;
+    }
+    size_ = file_stat.st_size;
+    void* data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+      size_ = 0u;
+      return false;
+    }
+    data_ = static_cast<const char*>(data);
+    if (!Valid()) {
+      Close();
+      return false;
+    }
+    return true;
+  }
+
+  void Close() {
+    if (data_) {
+      munmap(const_cast<char*>(data_), size_);
+    }
+    data_ = nullptr;
+    size_ = 0u;
+  }
+
+  inline const NdtMapHeader& Header() const {
+    return *reinterpret_cast<const NdtMapHeader*>(data_);
+  }
+  inline size_t CellNum() const { return Header().cell_num; }
+  inline const NdtMapCell* Cells() const {
+    return reinterpret_cast<const NdtMapCell*>(data_ +
+                                               Header().cells_offset);
+  }
+
+  /// @brief the cell of the voxel, nullptr if it is not in the grid
+  const NdtMapCell* FindCell(const Eigen::Vector3i& index) const {
+    NdtMapCell key;
+    std::copy(index.data(), index.data() + 3, key.index);
+    const NdtMapCell* end = Cells() + CellNum();
+    const NdtMapCell* cell = std::lower_bound(Cells(), end, key);
+    if (cell == end || std::memcmp(cell->index, key.index, sizeof(key.index))) {
+      return nullptr;
+    }
+    return cell;
+  }
+  /// @brief the cell of the point relative to the center
+  const NdtMapCell* FindCell(const Eigen::Vector3f& point) const {
+    const float resolution = Header().resolution;
+    return FindCell(Eigen::Vector3i(std::floor(point[0] / resolution),
+                                    std::floor(point[1] / resolution),
+                                    std::floor(point[2] / resolution)));
+  }
+
+ private:
+  bool Valid() const {
+    const NdtMapHeader& header = Header();
+    return !std::memcmp(header.magic, kNdtMapMagic, sizeof(kNdtMapMagic)) &&
+           header.version == kNdtMapVersion && header.resolution > 0.f &&
+           header.cells_offset % alignof(NdtMapCell) == 0u &&
+           header.cells_offset + header.cell_num * sizeof(NdtMapCell) <=
+               size_;
+  }
+
+  const char* data_ = nullptr;
+  size_t size_ = 0u;
+};
+
+}  // namespace common
+}  // namespace static_map
+
+#endif  // COMMON_NDT_MAP_FILE_H_
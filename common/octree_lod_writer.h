@@ -0,0 +1,533 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_OCTREE_LOD_WRITER_H_
+#define COMMON_OCTREE_LOD_WRITER_H_
+
+// stl
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+// third party
+#include <Eigen/Core>
+#include "pcl/point_cloud.h"
+// local
+#include "common/file_utils.h"
+#include "common/mutex.h"
+#include "common/shared_executor.h"
+
+namespace static_map {
+namespace common {
+
+struct OctreeLodOptions {
+  // also export the static map as an octree of the levels of detail
+  bool enable = false;
+  // the directory of the octree, in the export path
+  std::string directory = "potree/";
+  // a node of no more points is a leaf
+  int max_node_points = 20000;
+  // the levels in a hierarchy (.hrc) file
+  int hierarchy_step_size = 5;
+  // the precision of the positions in meters
+  double scale = 0.001;
+  // the subtrees of about this number of points are built in parallel
+  int partition_points = 4000000;
+};
+
+/*
+ * the octree of the levels of detail in the layout of Potree 1.7, so that
+ * the viewers load it progressively:
+ *   cloud.js       the metadata
+ *   data/r/r.bin   the points of the root, a node is named by "r" and the
+ *                  child index (x << 2 | y << 1 | z) of each level, every
+ *                  hierarchy_step_size digits are a sub-directory
+ *   data/r/*.hrc   the child masks (uint8) and point numbers (uint32) of
+ *                  the next hierarchy_step_size levels in breadth first
+ *                  order, one file for each hierarchy_step_size levels
+ * a point is its position relative to the min of its node in the scale
+ * (3 uint32) and its intensity (uint16). a node keeps the first point (in
+ * the input order) in each cell of (spacing / 2^level), the others go to
+ * its children.
+ * the points are spilled to the disk when they are written, then split
+ * into the subtrees of the partition depth, which are built in parallel.
+ * since a cell is never larger than a subtree, the nodes get the same
+ * points as building the whole tree at once
+ */
+template <typename PointT>
+class OctreeLodWriter {
+ public:
+  explicit OctreeLodWriter(const OctreeLodOptions& options)
+      : options_(options) {}
+  ~OctreeLodWriter() {
+    if (spill_file_.is_open()) {
+      spill_file_.close();
+      std::remove(SpillFileName().c_str());
+    }
+  }
+
+  OctreeLodWriter(const OctreeLodWriter&) = delete;
+  OctreeLodWriter& operator=(const OctreeLodWriter&) = delete;
+
+  /// @brief return false if the directory can not be written
+  bool Open(const std::string& directory) {
+    directory_ = directory;
+    if (!directory_.empty() && directory_.back() != '/') {
+      directory_ += '/';
+    }
+    point_num_ = 0u;
+    min_.setConstant(std::numeric_limits<double>::max());
+    max_.setConstant(std::numeric_limits<double>::lowest());
+    if (!MakeDirectories(directory_ + "data/r")) {
+      return false;
+    }
+    spill_file_.open(SpillFileName(), std::ios::binary | std::ios::trunc);
+    return spill_file_.good();
+  }
+
+  /// @brief the points in the global frame, thread-safe
+  bool Write(const pcl::PointCloud<PointT>& cloud) {
+    std::vector<RawPoint> points;
+    points.reserve(cloud.size());
+    for (const auto& point : cloud.points) {
+      if (std::isfinite(point.x) && std::isfinite(point.y) &&
+          std::isfinite(point.z)) {
+        points.push_back(
+            {point.x, point.y, point.z, static_cast<float>(point.intensity)});
+      }
+    }
+    MutexLocker locker(&mutex_);
+    if (!spill_file_.is_open()) {
+      return false;
+    }
+    for (const auto& point : points) {
+      const Eigen::Vector3d position(point.x, point.y, point.z);
+      min_ = min_.cwiseMin(position);
+      max_ = max_.cwiseMax(position);
+    }
+    spill_file_.write(reinterpret_cast<const char*>(points.data()),
+                      points.size() * sizeof(RawPoint));
+    point_num_ += points.size();
+    return spill_file_.good();
+  }
+
+  /// @brief build the octree and write the files
+  /// @return false if a file can not be written
+  bool Close() {
+    MutexLocker locker(&mutex_);
+    if (!spill_file_.is_open()) {
+      return false;
+    }
+    spill_file_.close();
+    bool all_right = true;
+    nodes_.clear();
+    if (point_num_ == 0u) {
+      min_.setZero();
+      max_.setZero();
+    }
+    // the bbox of the octree is a cube
+    size_ = std::max((max_ - min_).maxCoeff(), 1.) * (1. + 1.e-6);
+    depth_ = 0;
+    while (depth_ < kMaxPartitionDepth &&
+           (point_num_ >> (3 * depth_)) >
+               static_cast<uint64_t>(options_.partition_points)) {
+      ++depth_;
+    }
+    std::vector<Key> partitions;
+    if (point_num_ > 0u) {
+      all_right = Partition(&partitions);
+    }
+    std::remove(SpillFileName().c_str());
+
+    // the partitions only write the nodes under them, the nodes above are
+    // merged in the order of the partitions
+    std::vector<std::vector<std::vector<RawPoint>>> upper_points(
+        partitions.size());
+    std::vector<std::map<std::string, uint32_t>> partition_nodes(
+        partitions.size());
+    std::vector<char> partition_right(partitions.size(), 1);
+    const int partition_num = partitions.size();
+    ParallelFor(0, partition_num,
+                static_cast<int>(SharedExecutor::ThreadNum()),
+                [&](const int i) {
+                  partition_right[i] =
+                      BuildPartition(partitions[i], &upper_points[i],
+                                     &partition_nodes[i]);
+                });
+    for (int i = 0; i < partition_num; ++i) {
+      all_right = all_right && partition_right[i];
+      nodes_.insert(partition_nodes[i].begin(), partition_nodes[i].end());
+    }
+    std::map<std::string, std::pair<Key, std::vector<RawPoint>>> uppers;
+    for (int i = 0; i < partition_num; ++i) {
+      for (int level = 0; level < depth_; ++level) {
+        const Key key = Parent(partitions[i], depth_ - level);
+        auto& upper = uppers[NodeName(key, level)];
+        upper.first = key;
+        upper.second.insert(upper.second.end(),
+                            upper_points[i][level].begin(),
+                            upper_points[i][level].end());
+      }
+    }
+    for (auto& upper : uppers) {
+      const int level = upper.first.size() - 1;
+      all_right = WriteNode(upper.first, upper.second.first, level,
+                            upper.second.second) &&
+                  all_right;
+      nodes_[upper.first] = upper.second.second.size();
+    }
+    return WriteHierarchy() && WriteMetadata() && all_right;
+  }
+
+  uint64_t PointNum() const { return point_num_; }
+
+ private:
+  struct RawPoint {
+    float x, y, z, intensity;
+  };
+  // the coordinates of a node in its level
+  using Key = Eigen::Matrix<int64_t, 3, 1>;
+  struct KeyHash {
+    size_t operator()(const Key& key) const {
+      return std::hash<int64_t>()((key[0] * 73856093) ^ (key[1] * 19349663) ^
+                                  (key[2] * 83492791));
+    }
+  };
+
+  // a node has (kRootCells / 2^level)^3 cells in the root
+  static constexpr int kRootCells = 128;
+  // the cells of a level are never larger than the partitions
+  static constexpr int kMaxPartitionDepth = 5;
+  static constexpr int kMaxLevel = 20;
+  // the points spilled to a partition file at once
+  static constexpr size_t kSpillBatch = 1 << 16;
+
+  std::string SpillFileName() const { return directory_ + "points.tmp"; }
+  std::string PartitionFileName(const Key& key) const {
+    return directory_ + "partition_" + std::to_string(key[0]) + "_" +
+           std::to_string(key[1]) + "_" + std::to_string(key[2]) + ".tmp";
+  }
+
+  Key KeyOf(const RawPoint& point, const int level) const {
+    const int64_t num = int64_t(1) << level;
+    const double node_size = size_ / num;
+    Key key;
+    const double xyz[3] = {point.x, point.y, point.z};
+    for (int i = 0; i < 3; ++i) {
+      key[i] = std::min<int64_t>(
+          std::max<int64_t>(std::floor((xyz[i] - min_[i]) / node_size), 0),
+          num - 1);
+    }
+    return key;
+  }
+  static Key Parent(const Key& key, const int levels_up) {
+    return Key(key[0] >> levels_up, key[1] >> levels_up,
+               key[2] >> levels_up);
+  }
+  static std::string NodeName(const Key& key, const int level) {
+    std::string name = "r";
+    for (int i = level - 1; i >= 0; --i) {
+      name += static_cast<char>('0' + (((key[0] >> i) & 1) << 2 |
+                                       ((key[1] >> i) & 1) << 1 |
+                                       ((key[2] >> i) & 1)));
+    }
+    return name;
+  }
+  // the directory of the node in the hierarchy, with '/'
+  std::string NodeDirectory(const std::string& name) const {
+    std::string directory = directory_ + "data/r/";
+    const int step = options_.hierarchy_step_size;
+    const int part_num = (name.size() - 1) / step;
+    for (int i = 0; i < part_num; ++i) {
+      directory += name.substr(1 + i * step, step) + "/";
+    }
+    return directory;
+  }
+
+  // split the spilled points into the files of the partitions
+  bool Partition(std::vector<Key>* partitions) {
+    std::ifstream file(SpillFileName(), std::ios::binary);
+    std::unordered_map<Key, std::vector<RawPoint>, KeyHash> buffers;
+    std::vector<RawPoint> batch(kSpillBatch);
+    bool all_right = true;
+    auto flush = [&](const Key& key, std::vector<RawPoint>* points) {
+      std::ofstream partition(PartitionFileName(key),
+                              std::ios::binary | std::ios::app);
+      partition.write(reinterpret_cast<const char*>(points->data()),
+                      points->size() * sizeof(RawPoint));
+      all_right = all_right && partition.good();
+      points->clear();
+    };
+    uint64_t read_num = 0u;
+    while (read_num < point_num_ && file.good()) {
+      const size_t num = std::min<uint64_t>(kSpillBatch, point_num_ - read_num);
+      file.read(reinterpret_cast<char*>(batch.data()), num * sizeof(RawPoint));
+      read_num += num;
+      for (size_t i = 0; i < num; ++i) {
+        const Key key = KeyOf(batch[i], depth_);
+        auto it = buffers.find(key);
+        if (it == buffers.end()) {
+          it = buffers.emplace(key, std::vector<RawPoint>()).first;
+          // a file left by an earlier run is truncated
+          std::ofstream(PartitionFileName(key), std::ios::trunc);
+          partitions->push_back(key);
+        }
+        it->second.push_back(batch[i]);
+        if (it->second.size() >= kSpillBatch) {
+          flush(key, &it->second);
+        }
+      }
+    }
+    for (auto& buffer : buffers) {
+      if (!buffer.second.empty()) {
+        flush(buffer.first, &buffer.second);
+      }
+    }
+    // in the order of the names, so the output does not depend on the input
+    std::sort(partitions->begin(), partitions->end(),
+              [this](const Key& a, const Key& b) {
+                return NodeName(a, depth_) < NodeName(b, depth_);
+              });
+    return all_right && read_num == point_num_;
+  }
+
+  // the first point in each cell of the node is kept in 'points', the
+  // others are moved into 'rest'
+  void Sample(const int level, std::vector<RawPoint>* points,
+              std::vector<RawPoint>* rest) const {
+    const int64_t cell_num = int64_t(kRootCells) << level;
+    const double cell_size = size_ / cell_num;
+    std::unordered_set<Key, KeyHash> cells;
+    cells.reserve(points->size());
+    size_t kept_num = 0u;
+    for (size_t i = 0; i < points->size(); ++i) {
+      const RawPoint& point = (*points)[i];
+      const Key cell(std::floor((point.x - min_[0]) / cell_size),
+                     std::floor((point.y - min_[1]) / cell_size),
+                     std::floor((point.z - min_[2]) / cell_size));
+      if (cells.insert(cell).second) {
+        (*points)[kept_num++] = point;
+      } else {
+        rest->push_back(point);
+      }
+    }
+    points->resize(kept_num);
+  }
+
+  bool BuildPartition(const Key& key,
+                      std::vector<std::vector<RawPoint>>* upper_points,
+                      std::map<std::string, uint32_t>* nodes) const {
+    std::vector<RawPoint> points;
+    {
+      std::ifstream file(PartitionFileName(key),
+                         std::ios::binary | std::ios::ate);
+      const size_t bytes = file.tellg();
+      points.resize(bytes / sizeof(RawPoint));
+      file.seekg(0);
+      file.read(reinterpret_cast<char*>(points.data()), bytes);
+      if (!file.good()) {
+        return false;
+      }
+    }
+    std::remove(PartitionFileName(key).c_str());
+    upper_points->resize(depth_);
+    for (int level = 0; level < depth_; ++level) {
+      std::vector<RawPoint> rest;
+      Sample(level, &points, &rest);
+      (*upper_points)[level].swap(points);
+      points.swap(rest);
+    }
+    return points.empty() || BuildNode(key, depth_, &points, nodes);
+  }
+
+  bool BuildNode(const Key& key, const int level, std::vector<RawPoint>* points,
+                 std::map<std::string, uint32_t>* nodes) const {
+    std::vector<RawPoint> rest;
+    if (level < kMaxLevel &&
+        points->size() > static_cast<size_t>(options_.max_node_points)) {
+      Sample(level, points, &rest);
+    }
+    const std::string name = NodeName(key, level);
+    (*nodes)[name] = points->size();
+    bool all_right = WriteNode(name, key, level, *points);
+    std::vector<RawPoint>().swap(*points);
+    if (rest.empty()) {
+      return all_right;
+    }
+    std::vector<RawPoint> children[8];
+    for (const auto& point : rest) {
+      const Key child = KeyOf(point, level + 1);
+      children[(child[0] & 1) << 2 | (child[1] & 1) << 1 | (child[2] & 1)]
+          .push_back(point);
+    }
+    std::vector<RawPoint>().swap(rest);
+    for (int i = 0; i < 8; ++i) {
+      if (!children[i].empty()) {
+        const Key child(key[0] * 2 + ((i >> 2) & 1),
+                        key[1] * 2 + ((i >> 1) & 1), key[2] * 2 + (i & 1));
+        all_right = BuildNode(child, level + 1, &children[i], nodes) &&
+                    all_right;
+      }
+    }
+    return all_right;
+  }
+
+  bool WriteNode(const std::string& name, const Key& key, const int level,
+                 const std::vector<RawPoint>& points) const {
+    const std::string directory = NodeDirectory(name);
+    if (!MakeDirectories(directory)) {
+      return false;
+    }
+    const double node_size = size_ / (int64_t(1) << level);
+    const Eigen::Vector3d node_min = min_ + key.cast<double>() * node_size;
+    const double max_value = std::numeric_limits<uint32_t>::max();
+    std::vector<char> buffer(points.size() * kPointBytes);
+    char* data = buffer.data();
+    for (const auto& point : points) {
+      const double xyz[3] = {point.x, point.y, point.z};
+      for (int i = 0; i < 3; ++i) {
+        const uint32_t value = static_cast<uint32_t>(std::min(
+            std::max((xyz[i] - node_min[i]) / options_.scale, 0.), max_value));
+        std::memcpy(data, &value, sizeof(value));
+        data += sizeof(value);
+      }
+      const uint16_t intensity = static_cast<uint16_t>(
+          std::min(std::max(std::round(point.intensity), 0.f), 65535.f));
+      std::memcpy(data, &intensity, sizeof(intensity));
+      data += sizeof(intensity);
+    }
+    std::ofstream file(directory + name + ".bin",
+                       std::ios::binary | std::ios::trunc);
+    file.write(buffer.data(), buffer.size());
+    return file.good();
+  }
+
+  bool WriteHierarchy() const {
+    const int step = options_.hierarchy_step_size;
+    auto child_mask = [this](const std::string& name) {
+      uint8_t mask = 0u;
+      for (int i = 0; i < 8; ++i) {
+        if (nodes_.count(name + static_cast<char>('0' + i))) {
+          mask |= 1u << i;
+        }
+      }
+      return mask;
+    };
+    bool all_right = true;
+    for (const auto& node : nodes_) {
+      const std::string& root = node.first;
+      if ((root.size() - 1) % step != 0) {
+        continue;
+      }
+      std::vector<char> buffer;
+      auto write_entry = [&](const std::string& name, const uint32_t num) {
+        const uint8_t mask = child_mask(name);
+        buffer.push_back(static_cast<char>(mask));
+        const char* bytes = reinterpret_cast<const char*>(&num);
+        buffer.insert(buffer.end(), bytes, bytes + sizeof(num));
+      };
+      write_entry(root, node.second);
+      std::deque<std::string> queue(1, root);
+      while (!queue.empty()) {
+        const std::string name = queue.front();
+        queue.pop_front();
+        if (name.size() - root.size() >= static_cast<size_t>(step)) {
+          continue;
+        }
+        for (int i = 0; i < 8; ++i) {
+          const std::string child = name + static_cast<char>('0' + i);
+          auto it = nodes_.find(child);
+          if (it != nodes_.end()) {
+            write_entry(child, it->second);
+            queue.push_back(child);
+          }
+        }
+      }
+      std::ofstream file(NodeDirectory(root) + root + ".hrc",
+                         std::ios::binary | std::ios::trunc);
+      file.write(buffer.data(), buffer.size());
+      all_right = all_right && file.good();
+    }
+    return all_right;
+  }
+
+  bool WriteMetadata() const {
+    FILE* file = std::fopen((directory_ + "cloud.js").c_str(), "w");
+    if (file == nullptr) {
+      return false;
+    }
+    const Eigen::Vector3d cube_max = min_ + Eigen::Vector3d::Constant(size_);
+    std::fprintf(file, "{\n  \"version\": \"1.7\",\n");
+    std::fprintf(file, "  \"octreeDir\": \"data\",\n  \"projection\": \"\",\n");
+    std::fprintf(file, "  \"points\": %llu,\n",
+                 static_cast<unsigned long long>(point_num_));
+    std::fprintf(file,
+                 "  \"boundingBox\": {\"lx\": %.6f, \"ly\": %.6f, \"lz\": "
+                 "%.6f, \"ux\": %.6f, \"uy\": %.6f, \"uz\": %.6f},\n",
+                 min_[0], min_[1], min_[2], cube_max[0], cube_max[1],
+                 cube_max[2]);
+    std::fprintf(file,
+                 "  \"tightBoundingBox\": {\"lx\": %.6f, \"ly\": %.6f, "
+                 "\"lz\": %.6f, \"ux\": %.6f, \"uy\": %.6f, \"uz\": %.6f},\n",
+                 min_[0], min_[1], min_[2], max_[0], max_[1], max_[2]);
+    std::fprintf(file,
+                 "  \"pointAttributes\": [\"POSITION_CARTESIAN\", "
+                 "\"INTENSITY\"],\n");
+    std::fprintf(file, "  \"spacing\": %.6f,\n  \"scale\": %g,\n",
+                 size_ / kRootCells, options_.scale);
+    std::fprintf(file, "  \"hierarchyStepSize\": %d\n}\n",
+                 options_.hierarchy_step_size);
+    return std::fclose(file) == 0;
+  }
+
+  // 3 uint32 for the position and uint16 for the intensity
+  static constexpr size_t kPointBytes = 14;
+
+  const OctreeLodOptions options_;
+  std::string directory_;
+  Mutex mutex_;
+  std::ofstream spill_file_;
+  uint64_t point_num_ = 0u;
+  // the tight bbox
+  Eigen::Vector3d min_;
+  Eigen::Vector3d max_;
+  // the width of the cube
+  double size_ = 1.;
+  int depth_ = 0;
+  // the point number of each node
+  std::map<std::string, uint32_t> nodes_;
+};
+
+}  // namespace common
+}  // namespace static_map
+
+#endif  // COMMON_OCTREE_LOD_WRITER_H_
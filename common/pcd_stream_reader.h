@@ -0,0 +1,377 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_PCD_STREAM_READER_H_
+#define COMMON_PCD_STREAM_READER_H_
+
+// stl
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+// third party
+#include "pcl/point_cloud.h"
+
+namespace static_map {
+namespace common {
+
+/// @class PcdStreamReader
+/// @brief read a binary or binary_compressed pcd file chunk by chunk into
+/// clouds of x y z intensity, so the whole cloud is never in memory
+/// @note the compressed data is decompressed into a temporary file first,
+/// the fields of all the points are stored one after another in it
+template <typename PointT>
+class PcdStreamReader {
+ public:
+  PcdStreamReader() = default;
+  ~PcdStreamReader() { Close(); }
+
+  PcdStreamReader(const PcdStreamReader&) = delete;
+  PcdStreamReader& operator=(const PcdStreamReader&) = delete;
+
+  /// @return false if the file can not be read or its format is not
+  /// supported
+  bool Open(const std::string& filename) {
+    Close();
+    file_ = std::fopen(filename.c_str(), "rb");
+    if (!file_ || !ReadHeader()) {
+      Close();
+      return false;
+    }
+    if (compressed_ && !Decompress()) {
+      Close();
+      return false;
+    }
+    return true;
+  }
+
+  void Close() {
+    if (file_) {
+      std::fclose(file_);
+    }
+    if (data_file_) {
+      std::fclose(data_file_);
+    }
+    file_ = nullptr;
+    data_file_ = nullptr;
+    fields_.clear();
+    point_num_ = 0u;
+    read_num_ = 0u;
+  }
+
+  inline size_t PointNum() const { return point_num_; }
+  inline size_t ReadNum() const { return read_num_; }
+
+  /// @brief read the next (at most) max_point_num points into the cloud
+  /// @return false if there is no more point or the file is broken
+  bool Read(const size_t max_point_num, pcl::PointCloud<PointT>* cloud) {
+    cloud->clear();
+    const size_t point_num = std::min(max_point_num, point_num_ - read_num_);
+    if (!file_ || point_num == 0u) {
+      return false;
+    }
+    cloud->points.resize(point_num);
+    cloud->width = point_num;
+    cloud->height = 1;
+    const bool good = compressed_ ? ReadFields(point_num, cloud)
+                                  : ReadPoints(point_num, cloud);
+    read_num_ += point_num;
+    return good;
+  }
+
+ private:
+  struct Field {
+    std::string name;
+    int size = 4;
+    char type = 'F';
+    int count = 1;
+    // in the point for binary, in the data for binary_compressed
+    size_t offset = 0u;
+  };
+
+  bool ReadHeader() {
+    std::vector<std::string> names;
+    std::vector<int> sizes;
+    std::vector<char> types;
+    std::vector<int> counts;
+    size_t width = 0u;
+    size_t height = 1u;
+    size_t points = 0u;
+    char line[4096];
+    while (std::fgets(line, sizeof(line), file_)) {
+      std::istringstream stream(line);
+      std::string key;
+      stream >> key;
+      if (key.empty() || key[0] == '#') {
+        continue;
+      }
+      if (key == "FIELDS") {
+        for (std::string name; stream >> name;) {
+          names.push_back(name);
+        }
+      } else if (key == "SIZE") {
+        for (int size; stream >> size;) {
+          sizes.push_back(size);
+        }
+      } else if (key == "TYPE") {
+        for (char type; stream >> type;) {
+          types.push_back(type);
+        }
+      } else if (key == "COUNT") {
+        for (int count; stream >> count;) {
+          counts.push_back(count);
+        }
+      } else if (key == "WIDTH") {
+        stream >> width;
+      } else if (key == "HEIGHT") {
+        stream >> height;
+      } else if (key == "POINTS") {
+        stream >> points;
+      } else if (key == "DATA") {
+        std::string data_type;
+        stream >> data_type;
+        if (data_type == "binary") {
+          compressed_ = false;
+        } else if (data_type == "binary_compressed") {
+          compressed_ = true;
+        } else {
+          return false;
+        }
+        break;
+      }
+    }
+    if (names.empty() || sizes.size() != names.size() ||
+        types.size() != names.size() ||
+        (!counts.empty() && counts.size() != names.size())) {
+      return false;
+    }
+    point_num_ = points ? points : width * height;
+    point_step_ = 0u;
+    for (size_t i = 0; i < names.size(); ++i) {
+      Field field;
+      field.name = names[i];
+      field.size = sizes[i];
+      field.type = types[i];
+      field.count = counts.empty() ? 1 : counts[i];
+      field.offset = point_step_;
+      point_step_ += field.size * field.count;
+      fields_.push_back(field);
+    }
+    x_ = FindField("x");
+    y_ = FindField("y");
+    z_ = FindField("z");
+    intensity_ = FindField("intensity");
+    return x_ >= 0 && y_ >= 0 && z_ >= 0;
+  }
+
+  int FindField(const std::string& name) const {
+    for (size_t i = 0; i < fields_.size(); ++i) {
+      if (fields_[i].name == name) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  static float ToFloat(const char* data, const Field& field) {
+    char value[8];
+    std::memcpy(value, data, field.size);
+    switch (field.type) {
+      case 'F':
+        return field.size == 8 ? *reinterpret_cast<double*>(value)
+                               : *reinterpret_cast<float*>(value);
+      case 'U':
+        return field.size == 1
+                   ? *reinterpret_cast<uint8_t*>(value)
+                   : field.size == 2 ? *reinterpret_cast<uint16_t*>(value)
+                                     : *reinterpret_cast<uint32_t*>(value);
+      default:
+        return field.size == 1
+                   ? *reinterpret_cast<int8_t*>(value)
+                   : field.size == 2 ? *reinterpret_cast<int16_t*>(value)
+                                     : *reinterpret_cast<int32_t*>(value);
+    }
+  }
+
+  bool ReadPoints(const size_t point_num, pcl::PointCloud<PointT>* cloud) {
+    buffer_.resize(point_num * point_step_);
+    if (std::fread(buffer_.data(), point_step_, point_num, file_) !=
+        point_num) {
+      return false;
+    }
+    for (size_t i = 0; i < point_num; ++i) {
+      const char* data = buffer_.data() + i * point_step_;
+      auto& point = cloud->points[i];
+      point.x = ToFloat(data + fields_[x_].offset, fields_[x_]);
+      point.y = ToFloat(data + fields_[y_].offset, fields_[y_]);
+      point.z = ToFloat(data + fields_[z_].offset, fields_[z_]);
+      point.intensity =
+          intensity_ < 0
+              ? 0.f
+              : ToFloat(data + fields_[intensity_].offset, fields_[intensity_]);
+    }
+    return true;
+  }
+
+  // x y z intensity
+  static float* Value(const int index, PointT* point) {
+    switch (index) {
+      case 0:
+        return &point->x;
+      case 1:
+        return &point->y;
+      case 2:
+        return &point->z;
+      default:
+        return &point->intensity;
+    }
+  }
+
+  bool ReadFields(const size_t point_num, pcl::PointCloud<PointT>* cloud) {
+    const int fields[4] = {x_, y_, z_, intensity_};
+    for (int f = 0; f < 4; ++f) {
+      if (fields[f] < 0) {
+        for (auto& point : cloud->points) {
+          point.intensity = 0.f;
+        }
+        continue;
+      }
+      const Field& field = fields_[fields[f]];
+      const size_t field_step = field.size * field.count;
+      buffer_.resize(point_num * field_step);
+      if (std::fseek(data_file_,
+                     field.offset * point_num_ + read_num_ * field_step,
+                     SEEK_SET) != 0 ||
+          std::fread(buffer_.data(), field_step, point_num, data_file_) !=
+              point_num) {
+        return false;
+      }
+      for (size_t i = 0; i < point_num; ++i) {
+        *Value(f, &cloud->points[i]) =
+            ToFloat(buffer_.data() + i * field_step, field);
+      }
+    }
+    return true;
+  }
+
+  // lzf (as pcl) into the temporary file through a window holding the
+  // furthest back reference
+  bool Decompress() {
+    uint32_t sizes[2];
+    if (std::fread(sizes, sizeof(uint32_t), 2, file_) != 2 ||
+        sizes[1] != point_num_ * point_step_) {
+      return false;
+    }
+    data_file_ = std::tmpfile();
+    if (!data_file_) {
+      return false;
+    }
+    constexpr size_t kMaxReference = 1u << 13;
+    constexpr size_t kWindowSize = 1u << 20;
+    std::vector<uint8_t> window(kWindowSize);
+    size_t output = 0u;
+    size_t flushed = 0u;
+    size_t remaining = sizes[0];
+    // the input is read byte by byte from a buffer
+    std::vector<uint8_t> input(1u << 16);
+    size_t input_pos = 0u;
+    size_t input_size = 0u;
+    bool good = true;
+    auto next = [&]() -> uint8_t {
+      if (input_pos == input_size) {
+        input_size = std::fread(input.data(), 1,
+                                std::min(input.size(), remaining), file_);
+        remaining -= input_size;
+        input_pos = 0u;
+        if (input_size == 0u) {
+          good = false;
+          return 0;
+        }
+      }
+      return input[input_pos++];
+    };
+    auto consumed = [&]() -> bool {
+      return remaining == 0u && input_pos == input_size;
+    };
+    auto reserve = [&](const size_t size) {
+      if (output + size > kWindowSize) {
+        const size_t kept = std::min(output, kMaxReference);
+        good = good && std::fwrite(window.data(), 1, output - kept,
+                                   data_file_) == output - kept;
+        flushed += output - kept;
+        std::memmove(window.data(), window.data() + output - kept, kept);
+        output = kept;
+      }
+    };
+    while (good && !consumed()) {
+      size_t control = next();
+      if (control < (1u << 5)) {
+        const size_t length = control + 1;
+        reserve(length);
+        for (size_t i = 0; i < length; ++i) {
+          window[output++] = next();
+        }
+      } else {
+        size_t length = control >> 5;
+        size_t distance = (control & 0x1f) << 8;
+        if (length == 7) {
+          length += next();
+        }
+        distance += next() + 1;
+        length += 2;
+        if (distance > output) {
+          return false;
+        }
+        reserve(length);
+        for (size_t i = 0; i < length; ++i, ++output) {
+          window[output] = window[output - distance];
+        }
+      }
+    }
+    good = good &&
+           std::fwrite(window.data(), 1, output, data_file_) == output &&
+           flushed + output == sizes[1];
+    return good;
+  }
+
+  std::FILE* file_ = nullptr;
+  std::FILE* data_file_ = nullptr;
+  bool compressed_ = false;
+  std::vector<Field> fields_;
+  size_t point_step_ = 0u;
+  int x_ = -1;
+  int y_ = -1;
+  int z_ = -1;
+  int intensity_ = -1;
+  size_t point_num_ = 0u;
+  size_t read_num_ = 0u;
+  std::vector<char> buffer_;
+};
+
+}  // namespace common
+}  // namespace static_map
+
+#endif  // COMMON_PCD_STREAM_READER_H_
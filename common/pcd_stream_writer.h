@@ -0,0 +1,124 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_PCD_STREAM_WRITER_H_
+#define COMMON_PCD_STREAM_WRITER_H_
+
+// stl
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+// third party
+#include "pcl/point_cloud.h"
+
+namespace static_map {
+namespace common {
+
+/// @class PcdStreamWriter
+/// @brief write a binary pcd file (x y z intensity) chunk by chunk, so the
+/// whole cloud is never in memory, the number of points in the header is
+/// filled in when it is closed
+template <typename PointT>
+class PcdStreamWriter {
+ public:
+  PcdStreamWriter() = default;
+  ~PcdStreamWriter() { Close(); }
+
+  PcdStreamWriter(const PcdStreamWriter&) = delete;
+  PcdStreamWriter& operator=(const PcdStreamWriter&) = delete;
+
+  /// @brief return false if the file can not be written
+  bool Open(const std::string& filename) {
+    Close();
+    file_.open(filename, std::ios::binary | std::ios::trunc);
+    point_num_ = 0;
+    if (!file_.good()) {
+      return false;
+    }
+    WriteHeader();
+    return file_.good();
+  }
+
+  bool Write(const pcl::PointCloud<PointT>& cloud) {
+    if (!file_.is_open()) {
+      return false;
+    }
+    buffer_.resize(cloud.points.size() * 4);
+    float* values = buffer_.data();
+    for (const auto& point : cloud.points) {
+      *values++ = point.x;
+      *values++ = point.y;
+      *values++ = point.z;
+      *values++ = point.intensity;
+    }
+    file_.write(reinterpret_cast<const char*>(buffer_.data()),
+                buffer_.size() * sizeof(float));
+    point_num_ += cloud.points.size();
+    return file_.good();
+  }
+
+  /// @brief fill in the number of points and close the file
+  bool Close() {
+    if (!file_.is_open()) {
+      return true;
+    }
+    file_.seekp(0);
+    WriteHeader();
+    const bool good = file_.good();
+    file_.close();
+    return good;
+  }
+
+  inline size_t PointNum() const { return point_num_; }
+
+ private:
+  // the numbers are padded to a fixed width, so that the header
+  // can be rewritten in place
+  void WriteHeader() {
+    char header[512];
+    const int length = std::snprintf(
+        header, sizeof(header),
+        "# .PCD v0.7 - Point Cloud Data file format\n"
+        "VERSION 0.7\n"
+        "FIELDS x y z intensity\n"
+        "SIZE 4 4 4 4\n"
+        "TYPE F F F F\n"
+        "COUNT 1 1 1 1\n"
+        "WIDTH %010zu\n"
+        "HEIGHT 1\n"
+        "VIEWPOINT 0 0 0 1 0 0 0\n"
+        "POINTS %010zu\n"
+        "DATA binary\n",
+        point_num_, point_num_);
+    file_.write(header, length);
+  }
+
+  std::ofstream file_;
+  size_t point_num_ = 0;
+  std::vector<float> buffer_;
+};
+
+}  // namespace common
+}  // namespace static_map
+
+#endif  // COMMON_PCD_STREAM_WRITER_H_
@@ -0,0 +1,194 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_PCD_WRITER_H_
+#define COMMON_PCD_WRITER_H_
+
+// stl
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+// third party
+#include <pcl/common/io.h>
+#include <pcl/io/lzf.h>
+#include <pcl/io/pcd_io.h>
+#include "pcl/point_cloud.h"
+// local
+#include "common/macro_defines.h"
+#include "common/shared_executor.h"
+
+namespace static_map {
+namespace common {
+
+namespace pcd_writer_internal {
+
+inline std::atomic<bool>& Compression() {
+  static std::atomic<bool> compression(true);
+  return compression;
+}
+
+// lzf chunks compressed in parallel, an lzf stream is the concatenation of
+// its runs which never refer back further than their start, so the chunks
+// compressed alone make up a valid stream together
+constexpr size_t kChunkBytes = 1u << 20;
+
+}  // namespace pcd_writer_internal
+
+/// @brief whether SavePcdFile() compresses, process-wide, set it before the
+/// outputs start
+inline void SetPcdCompression(const bool compression) {
+  pcd_writer_internal::Compression() = compression;
+}
+
+/// @brief save the cloud as pcl::io::savePCDFileBinaryCompressed does,
+/// with the lzf of the chunks in parallel and the writing of every round of
+/// chunks overlapped with the compression of the next round. without the
+/// compression (SetPcdCompression) it is a binary pcd, the fastest to write
+/// and read
+/// @return false if the file can not be written
+template <typename PointT>
+bool SavePcdFile(const std::string& filename,
+                 const pcl::PointCloud<PointT>& cloud) {
+  using namespace pcd_writer_internal;  // NOLINT
+  // the fields but the paddings, as pcl
+  std::vector<pcl::PCLPointField> all_fields;
+  pcl::getFields<PointT>(all_fields);
+  std::vector<pcl::PCLPointField> fields;
+  std::vector<size_t> field_sizes;
+  size_t point_size = 0;
+  for (const auto& field : all_fields) {
+    if (field.name == "_") {
+      continue;
+    }
+    fields.push_back(field);
+    field_sizes.push_back(field.count * pcl::getFieldSize(field.datatype));
+    point_size += field_sizes.back();
+  }
+  const size_t point_num = cloud.points.size();
+  const size_t data_size = point_num * point_size;
+  // pcl fails to compress the empty clouds, and its sizes are 32 bits
+  const bool compression =
+      Compression().load() && point_num > 0 && data_size <= UINT32_MAX;
+
+  FILE* const file = std::fopen(filename.c_str(), "wb");
+  if (!file) {
+    PRINT_ERROR_FMT("Cannot open file: %s", filename.c_str());
+    return false;
+  }
+  const std::string header =
+      pcl::PCDWriter::generateHeader<PointT>(cloud) +
+      (compression ? "DATA binary_compressed\n" : "DATA binary\n");
+  bool good = std::fwrite(header.data(), 1, header.size(), file) ==
+              header.size();
+
+  // binary: the points one by one, binary_compressed: each field of all
+  // points one after another
+  std::vector<char> data(data_size);
+  const int max_parallelism = SharedExecutor::ThreadNum();
+  constexpr int kBlockPoints = 65536;
+  const int block_num = (point_num + kBlockPoints - 1) / kBlockPoints;
+  ParallelFor(0, block_num, max_parallelism, [&](const int block) {
+    const size_t begin = static_cast<size_t>(block) * kBlockPoints;
+    const size_t end = std::min(point_num, begin + kBlockPoints);
+    size_t field_offset = 0;
+    for (size_t f = 0; f < fields.size(); ++f) {
+      const size_t size = field_sizes[f];
+      for (size_t i = begin; i < end; ++i) {
+        const char* const point =
+            reinterpret_cast<const char*>(&cloud.points[i]);
+        char* const output =
+            compression ? &data[field_offset * point_num + i * size]
+                        : &data[i * point_size + field_offset];
+        std::memcpy(output, point + fields[f].offset, size);
+      }
+      field_offset += size;
+    }
+  });
+
+  if (!compression) {
+    good = good && std::fwrite(data.data(), 1, data_size, file) == data_size;
+    good = std::fclose(file) == 0 && good;
+    return good;
+  }
+
+  // the sizes are filled in after the chunks
+  const long sizes_position = std::ftell(file);
+  uint32_t sizes[2] = {0u, static_cast<uint32_t>(data_size)};
+  good = good && std::fwrite(sizes, sizeof(uint32_t), 2, file) == 2;
+  const int chunk_num = (data_size + kChunkBytes - 1) / kChunkBytes;
+  const int round_size = std::max(1, max_parallelism);
+  // the outputs of two rounds, one being compressed, the other written
+  std::vector<std::vector<char>> outputs(2 * round_size);
+  std::vector<unsigned int> output_sizes(2 * round_size, 0u);
+  size_t compressed_size = 0;
+  for (int round_begin = 0; round_begin < chunk_num + round_size;
+       round_begin += round_size) {
+    const int round = round_begin / round_size;
+    const int compressing = std::min(round_size, chunk_num - round_begin);
+    const int written = round_begin - round_size;
+    const int writing = round > 0 ? std::min(round_size, chunk_num - written)
+                                  : 0;
+    // the last index writes the last round meanwhile
+    ParallelFor(0, std::max(compressing, 0) + 1, max_parallelism + 1,
+                [&](const int i) {
+                  if (i < compressing) {
+                    const int chunk = round_begin + i;
+                    const size_t begin = chunk * kChunkBytes;
+                    const size_t size =
+                        std::min(kChunkBytes, data_size - begin);
+                    const int slot = (round % 2) * round_size + i;
+                    // the worst expansion of lzf is about 1/32
+                    outputs[slot].resize(size + size / 16 + 64);
+                    output_sizes[slot] = pcl::lzfCompress(
+                        &data[begin], size, outputs[slot].data(),
+                        outputs[slot].size());
+                    return;
+                  }
+                  for (int j = 0; j < writing; ++j) {
+                    const int slot = ((round + 1) % 2) * round_size + j;
+                    good = good && output_sizes[slot] > 0u &&
+                           std::fwrite(outputs[slot].data(), 1,
+                                       output_sizes[slot],
+                                       file) == output_sizes[slot];
+                    compressed_size += output_sizes[slot];
+                  }
+                });
+  }
+  good = good && compressed_size <= UINT32_MAX;
+  sizes[0] = compressed_size;
+  good = good && std::fseek(file, sizes_position, SEEK_SET) == 0 &&
+         std::fwrite(sizes, sizeof(uint32_t), 1, file) == 1;
+  good = std::fclose(file) == 0 && good;
+  if (!good) {
+    PRINT_ERROR_FMT("Failed to write file: %s", filename.c_str());
+  }
+  return good;
+}
+
+}  // namespace common
+}  // namespace static_map
+
+#endif  // COMMON_PCD_WRITER_H_
@@ -0,0 +1,138 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#ifndef COMMON_POINT_CLOUD_POOL_H_
+#define COMMON_POINT_CLOUD_POOL_H_
+
+// stl
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+// pcl
+#include <pcl/point_cloud.h>
+
+namespace static_map {
+namespace common {
+
+/*
+ * @class PointCloudPool
+ * @brief recycling pool of pre-reserved point clouds
+ * the clouds got from Acquire() go back to the pool automatically when the
+ * last reference is released, their storage (aligned by pcl with
+ * Eigen::aligned_allocator) is kept, so that there is no heap churn for
+ * every scan. clouds may outlive the pool itself
+ */
+template <typename PointT>
+class PointCloudPool {
+ public:
+  using PointCloudType = pcl::PointCloud<PointT>;
+  using PointCloudPtr = typename PointCloudType::Ptr;
+
+  explicit PointCloudPool(size_t max_size = 32, size_t reserved_size = 0)
+      : state_(std::make_shared<State>()) {
+    Reset(max_size, reserved_size);
+  }
+
+  PointCloudPool(const PointCloudPool&) = delete;
+  PointCloudPool& operator=(const PointCloudPool&) = delete;
+
+  /// @brief max_size: max number of idle clouds kept in the pool
+  /// reserved_size: points reserved for every new cloud
+  void Reset(size_t max_size, size_t reserved_size) {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->max_size = max_size;
+    state_->reserved_size = reserved_size;
+    while (state_->free_clouds.size() > max_size) {
+      delete state_->free_clouds.back();
+      state_->free_clouds.pop_back();
+    }
+  }
+
+  /// @brief get an empty cloud, thread safe
+  PointCloudPtr Acquire() {
+    PointCloudType* cloud = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      if (!state_->free_clouds.empty()) {
+        cloud = state_->free_clouds.back();
+        state_->free_clouds.pop_back();
+      }
+    }
+    if (cloud) {
+      state_->hit_count++;
+    } else {
+      state_->miss_count++;
+      cloud = new PointCloudType;
+      cloud->points.reserve(state_->reserved_size);
+    }
+    return PointCloudPtr(cloud, Recycler{state_});
+  }
+
+  uint64_t HitCount() const { return state_->hit_count.load(); }
+  uint64_t MissCount() const { return state_->miss_count.load(); }
+  size_t IdleCount() const {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->free_clouds.size();
+  }
+
+ private:
+  struct State {
+    ~State() {
+      for (auto& cloud : free_clouds) {
+        delete cloud;
+      }
+    }
+    mutable std::mutex mutex;
+    std::vector<PointCloudType*> free_clouds;
+    size_t max_size = 0;
+    size_t reserved_size = 0;
+    std::atomic<uint64_t> hit_count{0u};
+    std::atomic<uint64_t> miss_count{0u};
+  };
+
+  struct Recycler {
+    std::shared_ptr<State> state;
+    void operator()(PointCloudType* cloud) const {
+      // clear() keeps the capacity of the points
+      cloud->clear();
+      cloud->header = pcl::PCLHeader();
+      cloud->sensor_origin_ = Eigen::Vector4f::Zero();
+      cloud->sensor_orientation_ = Eigen::Quaternionf::Identity();
+      {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (state->free_clouds.size() < state->max_size) {
+          state->free_clouds.push_back(cloud);
+          return;
+        }
+      }
+      delete cloud;
+    }
+  };
+
+  std::shared_ptr<State> state_;
+};
+
+}  // namespace common
+}  // namespace static_map
+
+#endif  // COMMON_POINT_CLOUD_POOL_H_
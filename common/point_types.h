@@ -0,0 +1,117 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_POINT_TYPES_H_
+#define COMMON_POINT_TYPES_H_
+
+// third party
+#include <Eigen/Core>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/register_point_struct.h>
+// stl
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace static_map {
+
+/// @struct PointXYZIc
+/// @brief the 16 bytes point, half of pcl::PointXYZI (32 bytes with its
+/// paddings). the intensity is rounded to an integer in [0, 65535] and takes
+/// the place of the homogeneous coordinate, so data[3] is NOT 1 and the
+/// points are transformed by their xyz only (see TransformPointCloud)
+struct EIGEN_ALIGN16 PointXYZIc {
+  union EIGEN_ALIGN16 {
+    float data[4];
+    struct {
+      float x;
+      float y;
+      float z;
+      uint16_t intensity;
+      uint16_t reserved;
+    };
+  };
+  PCL_ADD_EIGEN_MAPS_POINT4D
+
+  inline PointXYZIc() {
+    x = y = z = 0.f;
+    intensity = reserved = 0u;
+  }
+  inline PointXYZIc(const float _x, const float _y, const float _z,
+                    const uint16_t _intensity = 0u) {
+    x = _x;
+    y = _y;
+    z = _z;
+    intensity = _intensity;
+    reserved = 0u;
+  }
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+static_assert(sizeof(PointXYZIc) == 16, "PointXYZIc should be 16 bytes");
+
+/// the point of the whole mapping pipeline (frames, submaps, voxel maps,
+/// registrators), PointXYZIc with USE_COMPACT_POINT
+#ifdef _USE_COMPACT_POINT_
+using MapPointType = PointXYZIc;
+#else
+using MapPointType = pcl::PointXYZI;
+#endif
+
+namespace common {
+
+inline void SetIntensity(const float intensity, pcl::PointXYZI* const point) {
+  point->intensity = intensity;
+}
+
+inline void SetIntensity(const float intensity, PointXYZIc* const point) {
+  point->intensity = static_cast<uint16_t>(
+      std::min(std::max(std::round(intensity), 0.f), 65535.f));
+}
+
+/// @brief as pcl::transformPointCloud, but only the xyz are touched, the
+/// other fields are copied as they are (pcl sets data[3], where the
+/// intensity of PointXYZIc is), output can be the input itself
+template <typename PointT>
+void TransformPointCloud(const pcl::PointCloud<PointT>& input,
+                         pcl::PointCloud<PointT>* const output,
+                         const Eigen::Matrix4f& transform) {
+  if (&input != output) {
+    *output = input;
+  }
+  const Eigen::Matrix3f rotation = transform.block<3, 3>(0, 0);
+  const Eigen::Vector3f translation = transform.block<3, 1>(0, 3);
+  for (auto& point : output->points) {
+    point.getVector3fMap() = rotation * point.getVector3fMap() + translation;
+  }
+}
+
+}  // namespace common
+}  // namespace static_map
+
+POINT_CLOUD_REGISTER_POINT_STRUCT(
+    static_map::PointXYZIc,
+    (float, x, x)(float, y, y)(float, z, z)(std::uint16_t, intensity,
+                                             intensity))
+
+#endif  // COMMON_POINT_TYPES_H_
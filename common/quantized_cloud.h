@@ -0,0 +1,202 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#ifndef COMMON_QUANTIZED_CLOUD_H_
+#define COMMON_QUANTIZED_CLOUD_H_
+
+// third party
+#include <Eigen/Core>
+// pcl
+#include <pcl/point_cloud.h>
+// stl
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+// local
+#include "common/point_types.h"
+
+namespace static_map {
+namespace common {
+
+namespace quantized_internal {
+// points per block
+constexpr size_t kBlockSize = 4096;
+constexpr float kMaxQuantized = 65535.f;
+}  // namespace quantized_internal
+
+/*
+ * @class QuantizedCloud
+ * @brief a compact in-memory copy of a cloud: 16-bit coordinates relative
+ * to the minimum of every block of points and 8-bit intensities, 7 bytes
+ * per point. the step of a block is the resolution unless the block is
+ * larger than 65535 steps. the coordinates are kept in separate arrays, so
+ * they are decoded in vectorized loops
+ */
+template <typename PointType>
+class QuantizedCloud {
+ public:
+  QuantizedCloud() = default;
+
+  void Encode(const pcl::PointCloud<PointType>& cloud, const float resolution);
+  /// @brief the points are in the same order as encoded
+  void Decode(pcl::PointCloud<PointType>* const cloud) const;
+
+  inline size_t Size() const { return intensities_.size(); }
+  inline bool Empty() const { return intensities_.empty(); }
+  size_t Bytes() const {
+    return blocks_.capacity() * sizeof(Block) +
+           3 * coordinates_[0].capacity() * sizeof(uint16_t) +
+           intensities_.capacity() * sizeof(uint8_t);
+  }
+  void Clear() {
+    std::vector<Block>().swap(blocks_);
+    for (auto& coordinates : coordinates_) {
+      std::vector<uint16_t>().swap(coordinates);
+    }
+    std::vector<uint8_t>().swap(intensities_);
+  }
+
+ private:
+  struct Block {
+    float origin[3];
+    float step;
+    float intensity_origin;
+    float intensity_step;
+  };
+
+  std::vector<Block> blocks_;
+  std::vector<uint16_t> coordinates_[3];
+  std::vector<uint8_t> intensities_;
+};
+
+template <typename PointType>
+void QuantizedCloud<PointType>::Encode(const pcl::PointCloud<PointType>& cloud,
+                                       const float resolution) {
+  using namespace quantized_internal;
+  const size_t size = cloud.size();
+  const size_t block_num = (size + kBlockSize - 1) / kBlockSize;
+  blocks_.resize(block_num);
+  for (auto& coordinates : coordinates_) {
+    coordinates.resize(size);
+  }
+  intensities_.resize(size);
+  for (size_t b = 0; b < block_num; ++b) {
+    const size_t begin = b * kBlockSize;
+    const size_t end = std::min(begin + kBlockSize, size);
+    float min[4], max[4];
+    std::fill(min, min + 4, std::numeric_limits<float>::max());
+    std::fill(max, max + 4, std::numeric_limits<float>::lowest());
+    for (size_t i = begin; i < end; ++i) {
+      const auto& point = cloud.points[i];
+      const float values[4] = {point.x, point.y, point.z,
+                               static_cast<float>(point.intensity)};
+      for (int j = 0; j < 4; ++j) {
+        // the invalid points are (lossily) moved to the origin
+        if (std::isfinite(values[j])) {
+          min[j] = std::min(min[j], values[j]);
+          max[j] = std::max(max[j], values[j]);
+        }
+      }
+    }
+    Block& block = blocks_[b];
+    float extent = 0.f;
+    for (int j = 0; j < 3; ++j) {
+      block.origin[j] = min[j] <= max[j] ? min[j] : 0.f;
+      extent = std::max(extent, max[j] - min[j]);
+    }
+    block.step = std::max(resolution, extent / kMaxQuantized);
+    block.intensity_origin = min[3] <= max[3] ? min[3] : 0.f;
+    block.intensity_step =
+        min[3] < max[3] ? (max[3] - min[3]) / 255.f : 1.f;
+
+    const float inverse_step = 1.f / block.step;
+    const float inverse_intensity_step = 1.f / block.intensity_step;
+    for (size_t i = begin; i < end; ++i) {
+      const auto& point = cloud.points[i];
+      const float values[3] = {point.x, point.y, point.z};
+      for (int j = 0; j < 3; ++j) {
+        const float quantized =
+            std::isfinite(values[j])
+                ? std::round((values[j] - block.origin[j]) * inverse_step)
+                : 0.f;
+        coordinates_[j][i] =
+            static_cast<uint16_t>(std::min(quantized, kMaxQuantized));
+      }
+      const float intensity = static_cast<float>(point.intensity);
+      const float quantized =
+          std::isfinite(intensity)
+              ? std::round((intensity - block.intensity_origin) *
+                           inverse_intensity_step)
+              : 0.f;
+      intensities_[i] = static_cast<uint8_t>(std::min(quantized, 255.f));
+    }
+  }
+}
+
+template <typename PointType>
+void QuantizedCloud<PointType>::Decode(
+    pcl::PointCloud<PointType>* const cloud) const {
+  using quantized_internal::kBlockSize;
+  const size_t size = Size();
+  cloud->points.resize(size);
+  cloud->width = size;
+  cloud->height = 1;
+  // the values of a block, decoded axis by axis
+  std::vector<float> values(4 * kBlockSize);
+  for (size_t b = 0; b < blocks_.size(); ++b) {
+    const Block& block = blocks_[b];
+    const size_t begin = b * kBlockSize;
+    const int num = std::min(begin + kBlockSize, size) - begin;
+    for (int j = 0; j < 3; ++j) {
+      const uint16_t* const quantized = coordinates_[j].data() + begin;
+      float* const output = values.data() + j * kBlockSize;
+      const float origin = block.origin[j];
+      const float step = block.step;
+      for (int i = 0; i < num; ++i) {
+        output[i] = origin + step * quantized[i];
+      }
+    }
+    {
+      const uint8_t* const quantized = intensities_.data() + begin;
+      float* const output = values.data() + 3 * kBlockSize;
+      const float origin = block.intensity_origin;
+      const float step = block.intensity_step;
+      for (int i = 0; i < num; ++i) {
+        output[i] = origin + step * quantized[i];
+      }
+    }
+    for (int i = 0; i < num; ++i) {
+      PointType& point = cloud->points[begin + i];
+      point = PointType();
+      point.x = values[i];
+      point.y = values[kBlockSize + i];
+      point.z = values[2 * kBlockSize + i];
+      SetIntensity(values[3 * kBlockSize + i], &point);
+    }
+  }
+}
+
+}  // namespace common
+}  // namespace static_map
+
+#endif  // COMMON_QUANTIZED_CLOUD_H_
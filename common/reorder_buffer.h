@@ -0,0 +1,121 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_REORDER_BUFFER_H_
+#define COMMON_REORDER_BUFFER_H_
+
+// stl
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+// local
+#include "common/simple_time.h"
+
+namespace static_map {
+namespace common {
+
+/*
+ * @class ReorderBuffer
+ * @brief a min-heap of items keyed by their stamps, an item is released once
+ * an item newer than its stamp + latency is pushed, so the items coming
+ * out of order within the latency are released in the order of stamps.
+ * the ones older than the last released item are rejected, the items of the
+ * same stamp keep the order they were pushed in
+ * it has no lock, the caller should keep the pushing and the handling of the
+ * released items in one critical section to keep their order
+ */
+template <typename T>
+class ReorderBuffer {
+ public:
+  explicit ReorderBuffer(const double latency)
+      : latency_(SimpleTime::from_sec(latency)) {}
+
+  ReorderBuffer(const ReorderBuffer&) = delete;
+  ReorderBuffer& operator=(const ReorderBuffer&) = delete;
+
+  /// @brief push an item and append the released ones to the output
+  /// @return false if the item is too late and dropped
+  bool Push(const SimpleTime& stamp, T item, std::vector<T>* const released) {
+    if (got_released_ && stamp < last_released_) {
+      ++late_count_;
+      return false;
+    }
+    heap_.push_back(Entry{stamp, sequence_++, std::move(item)});
+    std::push_heap(heap_.begin(), heap_.end(), Later);
+    if (stamp > newest_) {
+      newest_ = stamp;
+    }
+    while (!heap_.empty() && heap_.front().stamp + latency_ <= newest_) {
+      Pop(released);
+    }
+    return true;
+  }
+
+  /// @brief release all the items
+  void Flush(std::vector<T>* const released) {
+    while (!heap_.empty()) {
+      Pop(released);
+    }
+  }
+
+  inline size_t Size() const { return heap_.size(); }
+  /// @brief the rejected items
+  inline uint64_t LateCount() const { return late_count_; }
+
+ private:
+  struct Entry {
+    SimpleTime stamp;
+    uint64_t sequence;
+    T item;
+  };
+
+  // the top of the heap is the earliest one
+  static bool Later(const Entry& a, const Entry& b) {
+    // no tolerance of SimpleTime::operator== here
+    if (a.stamp.toNSec() != b.stamp.toNSec()) {
+      return a.stamp.toNSec() > b.stamp.toNSec();
+    }
+    return a.sequence > b.sequence;
+  }
+
+  void Pop(std::vector<T>* const released) {
+    std::pop_heap(heap_.begin(), heap_.end(), Later);
+    last_released_ = heap_.back().stamp;
+    got_released_ = true;
+    released->push_back(std::move(heap_.back().item));
+    heap_.pop_back();
+  }
+
+  const SimpleTime latency_;
+  std::vector<Entry> heap_;
+  uint64_t sequence_ = 0u;
+  uint64_t late_count_ = 0u;
+  SimpleTime newest_;
+  SimpleTime last_released_;
+  bool got_released_ = false;
+};
+
+}  // namespace common
+}  // namespace static_map
+
+#endif  // COMMON_REORDER_BUFFER_H_
@@ -0,0 +1,96 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "common/shared_executor.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "common/execution.h"
+#include "common/macro_defines.h"
+
+namespace static_map {
+namespace common {
+
+namespace {
+// 0 means not set, use the hardware concurrency
+std::atomic<size_t> shared_thread_num(0);
+std::atomic<bool> shared_executor_created(false);
+// empty means no pinning
+std::mutex shared_cpus_mutex;
+std::vector<int> shared_cpus;
+// the threads not in the executor work for the front end by default
+thread_local TaskPriority current_priority = TaskPriority::kFrontEnd;
+}  // namespace
+
+ScopedTaskPriority::ScopedTaskPriority(const TaskPriority priority)
+    : last_priority_(current_priority) {
+  current_priority = priority;
+}
+
+ScopedTaskPriority::~ScopedTaskPriority() { current_priority = last_priority_; }
+
+TaskPriority ScopedTaskPriority::Current() { return current_priority; }
+
+void SharedExecutor::SetThreadNum(const size_t thread_num) {
+  if (shared_executor_created.load()) {
+    PRINT_WARNING("the shared executor is running, thread num not changed.");
+    return;
+  }
+  shared_thread_num = thread_num;
+}
+
+size_t SharedExecutor::ThreadNum() {
+  if (shared_thread_num.load() == 0) {
+    const size_t hardware_thread_num = std::thread::hardware_concurrency();
+    return hardware_thread_num > 1 ? hardware_thread_num - 1 : 1;
+  }
+  return shared_thread_num.load();
+}
+
+void SharedExecutor::SetCpus(const std::vector<int>& cpus) {
+  if (shared_executor_created.load()) {
+    PRINT_WARNING("the shared executor is running, cpus not changed.");
+    return;
+  }
+  std::lock_guard<std::mutex> lock(shared_cpus_mutex);
+  shared_cpus = cpus;
+}
+
+ThreadPool* SharedExecutor::Get() {
+  // the pool is never destroyed, it may be used by static objects
+  static ThreadPool* const pool = [] {
+    shared_executor_created = true;
+    ThreadPool* const new_pool = new ThreadPool(ThreadNum());
+    std::lock_guard<std::mutex> lock(shared_cpus_mutex);
+    for (size_t i = 0; i < new_pool->size(); ++i) {
+      SetThreadCpus(new_pool->native_handle(i), shared_cpus);
+    }
+    return new_pool;
+  }();
+  return pool;
+}
+
+}  // namespace common
+}  // namespace static_map
@@ -0,0 +1,127 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_SHARED_EXECUTOR_H_
+#define COMMON_SHARED_EXECUTOR_H_
+
+#include <future>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "common/simple_thread_pool.h"
+
+namespace static_map {
+namespace common {
+
+/// @brief the priorities of the tasks in the shared executor, the tasks
+/// with a higher priority are picked up first
+enum class TaskPriority : int {
+  kOutput = 0,
+  kLoopClosure = 1,
+  kSubmapMatch = 2,
+  kFrontEnd = 3,
+};
+
+/// @class ScopedTaskPriority
+/// @brief set the priority of the tasks submitted by the current thread
+/// (e.g. the chunks of ParallelFor) in its scope. the threads without
+/// a scoped priority submit as front end, the tasks of the executor
+/// inherit the priority they were submitted with
+class ScopedTaskPriority {
+ public:
+  explicit ScopedTaskPriority(const TaskPriority priority);
+  ~ScopedTaskPriority();
+
+  /// @brief the priority of the current thread
+  static TaskPriority Current();
+
+  ScopedTaskPriority(const ScopedTaskPriority&) = delete;
+  ScopedTaskPriority& operator=(const ScopedTaskPriority&) = delete;
+
+ private:
+  const TaskPriority last_priority_;
+};
+
+/// @class SharedExecutor
+/// @brief the process-wide thread pool for the tasks and the data-parallel
+/// parts of modules (e.g. filters, submap matching), so they do not create
+/// own threads and oversubscribe the cpus together with the other libraries
+/// @note do not put long-running (daemon) tasks in it, they occupy
+/// workers forever. a task may only wait for the tasks submitted before it
+/// from outside the executor with the same or a higher priority
+class SharedExecutor {
+ public:
+  /// @brief set the thread number, only works before the first Get()
+  static void SetThreadNum(const size_t thread_num);
+  static size_t ThreadNum();
+  /// @brief run the workers on the cpus only, only works before the
+  /// first Get(), empty for no pinning
+  static void SetCpus(const std::vector<int>& cpus);
+  static ThreadPool* Get();
+
+  /// @brief submit a task with the priority, the task runs with it as its
+  /// scoped priority
+  template <typename Func>
+  static auto Submit(const TaskPriority priority, Func&& func)
+      -> std::future<typename std::result_of<Func()>::type> {
+    using Task = PrioritizedTask<typename std::decay<Func>::type>;
+    return Get()->enqueue_with_priority(
+        static_cast<int>(priority), Task{priority, std::forward<Func>(func)});
+  }
+
+ private:
+  template <typename Func>
+  struct PrioritizedTask {
+    TaskPriority priority;
+    Func func;
+
+    auto operator()() -> decltype(std::declval<Func&>()()) {
+      ScopedTaskPriority scoped_priority(priority);
+      return func();
+    }
+  };
+};
+
+/// @brief run func(i) for i in [begin, end) in at most max_parallelism
+/// chunks on the shared executor with the priority of the calling thread
+/// @note the calling thread also runs the chunks which are not picked up
+/// by the executor yet, so it is safe to call it from a task of the
+/// shared executor
+template <typename Func>
+void ParallelFor(const int begin, const int end, const int max_parallelism,
+                 const Func& func) {
+  if (end - begin <= 1 || max_parallelism <= 1) {
+    for (int i = begin; i < end; ++i) {
+      func(i);
+    }
+    return;
+  }
+  SharedExecutor::Get()->parallel_for(
+      begin, end, max_parallelism, func,
+      static_cast<int>(ScopedTaskPriority::Current()));
+}
+
+}  // namespace common
+}  // namespace static_map
+
+#endif  // COMMON_SHARED_EXECUTOR_H_
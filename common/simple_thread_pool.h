@@ -23,89 +23,429 @@
 #ifndef COMMON_SIMPLE_THREAD_POOL_H_
 #define COMMON_SIMPLE_THREAD_POOL_H_
 
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <functional>
 #include <future>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <new>
 #include <stdexcept>
 #include <thread>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
 namespace static_map {
 namespace common {
 
+/// @class ThreadPool
+/// @brief every worker has own queues, the tasks submitted by a worker go to
+/// its queues and the others go to a global one. an idle worker takes the
+/// task from its queues, the global ones, then steals from the others in
+/// the order of the priorities. all queues are fifo, so a task submitted
+/// from outside never starts before the earlier ones with the same priority
 class ThreadPool {
  public:
+  // the priorities are clamped into [0, kPriorityLevels)
+  static constexpr int kPriorityLevels = 4;
+
+  /// @class Task
+  /// @brief move-only void() callable, the small ones (e.g. lambdas with a
+  /// few captures, packaged_task) are stored without heap allocation
+  class Task {
+   public:
+    Task() = default;
+    template <class F, class = typename std::enable_if<!std::is_same<
+                           typename std::decay<F>::type, Task>::value>::type>
+    Task(F&& f) {  // NOLINT
+      using Func = typename std::decay<F>::type;
+      if (StoredInline<Func>::value) {
+        new (buffer_) Func(std::forward<F>(f));
+        ops_ = &InlineOps<Func>::ops;
+      } else {
+        *reinterpret_cast<Func**>(buffer_) = new Func(std::forward<F>(f));
+        ops_ = &HeapOps<Func>::ops;
+      }
+    }
+    Task(Task&& other) noexcept { MoveFrom(&other); }
+    Task& operator=(Task&& other) noexcept {
+      if (this != &other) {
+        Reset();
+        MoveFrom(&other);
+      }
+      return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() { Reset(); }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+    void operator()() { ops_->invoke(buffer_); }
+
+   private:
+    static constexpr size_t kBufferSize = 48;
+
+    struct Ops {
+      void (*invoke)(void*);
+      void (*move)(void* from, void* to);
+      void (*destroy)(void*);
+    };
+
+    template <class Func>
+    struct StoredInline
+        : std::integral_constant<
+              bool, sizeof(Func) <= kBufferSize &&
+                        alignof(Func) <= alignof(std::max_align_t) &&
+                        std::is_nothrow_move_constructible<Func>::value> {};
+
+    template <class Func>
+    struct InlineOps {
+      static void Invoke(void* data) { (*static_cast<Func*>(data))(); }
+      static void Move(void* from, void* to) {
+        new (to) Func(std::move(*static_cast<Func*>(from)));
+        static_cast<Func*>(from)->~Func();
+      }
+      static void Destroy(void* data) { static_cast<Func*>(data)->~Func(); }
+      static const Ops ops;
+    };
+
+    template <class Func>
+    struct HeapOps {
+      static void Invoke(void* data) { (**static_cast<Func**>(data))(); }
+      static void Move(void* from, void* to) {
+        *static_cast<Func**>(to) = *static_cast<Func**>(from);
+      }
+      static void Destroy(void* data) { delete *static_cast<Func**>(data); }
+      static const Ops ops;
+    };
+
+    void MoveFrom(Task* other) {
+      if (other->ops_ != nullptr) {
+        other->ops_->move(other->buffer_, buffer_);
+        ops_ = other->ops_;
+        other->ops_ = nullptr;
+      }
+    }
+    void Reset() {
+      if (ops_ != nullptr) {
+        ops_->destroy(buffer_);
+        ops_ = nullptr;
+      }
+    }
+
+    alignas(std::max_align_t) unsigned char buffer_[kBufferSize];
+    const Ops* ops_ = nullptr;
+  };
+
   explicit ThreadPool(size_t);
+  ~ThreadPool();
+
+  size_t size() const { return workers.size(); }
+  // e.g. to set the cpus of the worker
+  std::thread::native_handle_type native_handle(size_t index) {
+    return workers[index].native_handle();
+  }
+
   template <class F, class... Args>
   auto enqueue(F&& f, Args&&... args)
       -> std::future<typename std::result_of<F(Args...)>::type>;
-  ~ThreadPool();
+  // the task with a higher priority runs first,
+  // the tasks with the same priority run in fifo order
+  template <class F, class... Args>
+  auto enqueue_with_priority(int priority, F&& f, Args&&... args)
+      -> std::future<typename std::result_of<F(Args...)>::type>;
+  // fire and forget, no future (and no allocation for the small tasks)
+  void execute(int priority, Task task);
+  // func(i) for i in [0, count) as count tasks, queued under one lock,
+  // func is copied into every task
+  template <class F>
+  void execute_bulk(int priority, size_t count, const F& func);
+  // run func(i) for i in [begin, end) in at most max_parallelism chunks,
+  // the calling thread also runs the chunks which are not picked up by the
+  // workers yet and waits for the others, so it can be nested in the tasks
+  template <class F>
+  void parallel_for(int begin, int end, int max_parallelism, const F& func,
+                    int priority = 0);
 
  private:
+  struct TaskQueue {
+    std::mutex mutex;
+    std::deque<Task> tasks[kPriorityLevels];
+    // number of tasks in all priorities, checked without the lock
+    std::atomic<size_t> size{0};
+  };
+
+  // the chunks of one parallel_for, claimed one by one by the calling
+  // thread and the helpers
+  class ParallelForState {
+   public:
+    ParallelForState(const int chunk_num,
+                     const std::function<void(int)>& run_chunk)
+        : chunk_num_(chunk_num), run_chunk_(run_chunk) {}
+    ParallelForState(const ParallelForState&) = delete;
+    ParallelForState& operator=(const ParallelForState&) = delete;
+
+    // run the unclaimed chunks until all are claimed
+    void Run() {
+      int chunk;
+      while ((chunk = next_chunk_.fetch_add(1)) < chunk_num_) {
+        run_chunk_(chunk);
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (++finished_chunk_num_ == chunk_num_) {
+          condition_.notify_all();
+        }
+      }
+    }
+    // wait for the claimed chunks running in other threads
+    void Wait() {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_.wait(lock,
+                      [this] { return finished_chunk_num_ == chunk_num_; });
+    }
+
+   private:
+    const int chunk_num_;
+    const std::function<void(int)> run_chunk_;
+    std::atomic<int> next_chunk_{0};
+    int finished_chunk_num_ = 0;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+  };
+
+  // the pool and the index of the worker running in the current thread
+  struct WorkerIdentity {
+    const ThreadPool* pool = nullptr;
+    size_t index = 0;
+  };
+  static WorkerIdentity& current_worker() {
+    static thread_local WorkerIdentity identity;
+    return identity;
+  }
+
+  static int clamp_priority(int priority) {
+    return std::max(0, std::min(kPriorityLevels - 1, priority));
+  }
+  // the queue for the tasks submitted by the current thread
+  TaskQueue* submit_queue();
+  void notify(size_t count);
+  bool try_pop(TaskQueue* queue, int priority, Task* task);
+  bool pop(size_t worker_index, Task* task);
+  void work(size_t worker_index);
+
   // need to keep track of threads so we can join them
   std::vector<std::thread> workers;
-  // the task queue
-  std::queue<std::function<void()> > tasks;
+  std::vector<std::unique_ptr<TaskQueue>> worker_queues;
+  TaskQueue global_queue;
 
-  // synchronization
-  std::mutex queue_mutex;
+  // synchronization, only for sleeping and waking up the idle workers
+  std::atomic<size_t> pending_tasks;
+  std::atomic<size_t> sleeping_workers;
+  std::mutex sleep_mutex;
   std::condition_variable condition;
-  bool stop;
+  std::atomic<bool> stop;
 };
 
+template <class Func>
+const ThreadPool::Task::Ops ThreadPool::Task::InlineOps<Func>::ops = {
+    &InlineOps<Func>::Invoke, &InlineOps<Func>::Move,
+    &InlineOps<Func>::Destroy};
+
+template <class Func>
+const ThreadPool::Task::Ops ThreadPool::Task::HeapOps<Func>::ops = {
+    &HeapOps<Func>::Invoke, &HeapOps<Func>::Move, &HeapOps<Func>::Destroy};
+
 // the constructor just launches some amount of workers
-inline ThreadPool::ThreadPool(size_t threads) : stop(false) {
-  for (size_t i = 0; i < threads; ++i)
-    workers.emplace_back([this] {
-      while (true) {
-        std::function<void()> task;
-
-        {
-          std::unique_lock<std::mutex> lock(this->queue_mutex);
-          this->condition.wait(
-              lock, [this] { return this->stop || !this->tasks.empty(); });
-          if (this->stop && this->tasks.empty()) return;
-          task = std::move(this->tasks.front());
-          this->tasks.pop();
-        }
+inline ThreadPool::ThreadPool(size_t threads)
+    : pending_tasks(0), sleeping_workers(0), stop(false) {
+  for (size_t i = 0; i < threads; ++i) {
+    worker_queues.emplace_back(new TaskQueue);
+  }
+  for (size_t i = 0; i < threads; ++i) {
+    workers.emplace_back([this, i] { work(i); });
+  }
+}
 
-        task();
-      }
-    });
+inline ThreadPool::TaskQueue* ThreadPool::submit_queue() {
+  const WorkerIdentity& identity = current_worker();
+  if (identity.pool == this) {
+    return worker_queues[identity.index].get();
+  }
+  return &global_queue;
+}
+
+inline void ThreadPool::notify(size_t count) {
+  // pending_tasks is increased before, a worker going to sleep either sees
+  // it or is counted in sleeping_workers and waiting for the notification
+  if (sleeping_workers.load() == 0) {
+    return;
+  }
+  { std::lock_guard<std::mutex> lock(sleep_mutex); }
+  if (count > 1) {
+    condition.notify_all();
+  } else {
+    condition.notify_one();
+  }
+}
+
+inline void ThreadPool::execute(int priority, Task task) {
+  // don't allow enqueueing after stopping the pool
+  if (stop) {
+    throw std::runtime_error("enqueue on stopped ThreadPool");
+  }
+  TaskQueue* const queue = submit_queue();
+  {
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    queue->tasks[clamp_priority(priority)].push_back(std::move(task));
+    ++queue->size;
+  }
+  ++pending_tasks;
+  notify(1);
+}
+
+template <class F>
+void ThreadPool::execute_bulk(int priority, size_t count, const F& func) {
+  if (count == 0) {
+    return;
+  }
+  if (stop) {
+    throw std::runtime_error("enqueue on stopped ThreadPool");
+  }
+  TaskQueue* const queue = submit_queue();
+  {
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    auto& tasks = queue->tasks[clamp_priority(priority)];
+    for (size_t i = 0; i < count; ++i) {
+      tasks.emplace_back([func, i]() { func(i); });
+    }
+    queue->size += count;
+  }
+  pending_tasks += count;
+  notify(count);
 }
 
 // add new work item to the pool
 template <class F, class... Args>
 auto ThreadPool::enqueue(F&& f, Args&&... args)
     -> std::future<typename std::result_of<F(Args...)>::type> {
+  return enqueue_with_priority(0, std::forward<F>(f),
+                               std::forward<Args>(args)...);
+}
+
+template <class F, class... Args>
+auto ThreadPool::enqueue_with_priority(int priority, F&& f, Args&&... args)
+    -> std::future<typename std::result_of<F(Args...)>::type> {
   using return_type = typename std::result_of<F(Args...)>::type;
 
-  auto task = std::make_shared<std::packaged_task<return_type()> >(
+  // the packaged_task is moved into the task, not shared
+  std::packaged_task<return_type()> task(
       std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+  std::future<return_type> res = task.get_future();
+  execute(priority, Task(std::move(task)));
+  return res;
+}
 
-  std::future<return_type> res = task->get_future();
-  {
-    std::unique_lock<std::mutex> lock(queue_mutex);
+template <class F>
+void ThreadPool::parallel_for(int begin, int end, int max_parallelism,
+                              const F& func, int priority) {
+  const int size = end - begin;
+  if (size <= 0) {
+    return;
+  }
+  const int chunk_num = std::min(
+      size,
+      std::min(max_parallelism, static_cast<int>(workers.size()) + 1));
+  if (chunk_num <= 1) {
+    for (int i = begin; i < end; ++i) {
+      func(i);
+    }
+    return;
+  }
+  // in 64 bits, chunk * size overflows int for large ranges
+  const auto chunk_start = [&](const int chunk) {
+    return begin +
+           static_cast<int>(static_cast<int64_t>(chunk) * size / chunk_num);
+  };
+  const auto run_chunk = [&](const int chunk) {
+    const int chunk_begin = chunk_start(chunk);
+    const int chunk_end = chunk_start(chunk + 1);
+    for (int i = chunk_begin; i < chunk_end; ++i) {
+      func(i);
+    }
+  };
+  // the helpers may start after this returns, then they find no chunk left
+  // and never touch run_chunk
+  auto state = std::make_shared<ParallelForState>(
+      chunk_num, std::function<void(int)>(run_chunk));
+  execute_bulk(priority, chunk_num - 1, [state](size_t) { state->Run(); });
+  state->Run();
+  state->Wait();
+}
 
-    // don't allow enqueueing after stopping the pool
-    if (stop) {
-      throw std::runtime_error("enqueue on stopped ThreadPool");
+inline bool ThreadPool::try_pop(TaskQueue* queue, int priority, Task* task) {
+  if (queue->size.load() == 0) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(queue->mutex);
+  auto& tasks = queue->tasks[priority];
+  if (tasks.empty()) {
+    return false;
+  }
+  *task = std::move(tasks.front());
+  tasks.pop_front();
+  --queue->size;
+  return true;
+}
+
+inline bool ThreadPool::pop(size_t worker_index, Task* task) {
+  const size_t worker_num = worker_queues.size();
+  for (int priority = kPriorityLevels - 1; priority >= 0; --priority) {
+    if (try_pop(worker_queues[worker_index].get(), priority, task) ||
+        try_pop(&global_queue, priority, task)) {
+      return true;
+    }
+    // steal from the next workers, so the victims differ between thieves
+    for (size_t i = 1; i < worker_num; ++i) {
+      if (try_pop(worker_queues[(worker_index + i) % worker_num].get(),
+                  priority, task)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+inline void ThreadPool::work(size_t worker_index) {
+  WorkerIdentity& identity = current_worker();
+  identity.pool = this;
+  identity.index = worker_index;
+  while (true) {
+    Task task;
+    if (pop(worker_index, &task)) {
+      --pending_tasks;
+      task();
+      continue;
     }
 
-    tasks.emplace([task]() { (*task)(); });
+    std::unique_lock<std::mutex> lock(sleep_mutex);
+    if (stop && pending_tasks.load() == 0) {
+      return;
+    }
+    ++sleeping_workers;
+    condition.wait(lock,
+                   [this] { return stop || pending_tasks.load() != 0; });
+    --sleeping_workers;
   }
-  condition.notify_one();
-  return res;
 }
 
-// the destructor joins all threads
+// the destructor runs the remaining tasks and joins all threads
 inline ThreadPool::~ThreadPool() {
   {
-    std::unique_lock<std::mutex> lock(queue_mutex);
+    std::unique_lock<std::mutex> lock(sleep_mutex);
     stop = true;
   }
   condition.notify_all();
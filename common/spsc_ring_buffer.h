@@ -0,0 +1,116 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#ifndef COMMON_SPSC_RING_BUFFER_H_
+#define COMMON_SPSC_RING_BUFFER_H_
+
+// stl
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace static_map {
+namespace common {
+
+/*
+ * @class SpscRingBuffer
+ * @brief bounded lock-free queue for exactly one producer thread and
+ * exactly one consumer thread. the capacity is rounded up to a power of 2
+ * so that the indices can be wrapped with a mask
+ */
+template <typename T>
+class SpscRingBuffer {
+ public:
+  explicit SpscRingBuffer(size_t capacity = 2) { Reset(capacity); }
+
+  SpscRingBuffer(const SpscRingBuffer&) = delete;
+  SpscRingBuffer& operator=(const SpscRingBuffer&) = delete;
+
+  /// @brief re-allocate the buffer
+  /// @notice not thread safe, call it before the threads start
+  void Reset(size_t capacity) {
+    size_t real_capacity = 2;
+    while (real_capacity < capacity) {
+      real_capacity <<= 1;
+    }
+    buffer_.clear();
+    buffer_.resize(real_capacity);
+    mask_ = real_capacity - 1;
+    head_.store(0, std::memory_order_relaxed);
+    tail_.store(0, std::memory_order_relaxed);
+  }
+
+  /// @brief producer side, return false if the buffer is full
+  template <typename U>
+  bool TryPush(U&& item) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) > mask_) {
+      return false;
+    }
+    buffer_[tail & mask_] = std::forward<U>(item);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// @brief consumer side, return false if the buffer is empty
+  bool TryPop(T* const item) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    T& slot = buffer_[head & mask_];
+    *item = std::move(slot);
+    // release the resource (e.g. shared_ptr) held by the slot
+    slot = T();
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// @brief consumer side, drop all remaining items
+  void Clear() {
+    T item;
+    while (TryPop(&item)) {
+    }
+  }
+
+  /// @brief approximate size if called while the other side is working
+  size_t Size() const {
+    return tail_.load(std::memory_order_acquire) -
+           head_.load(std::memory_order_acquire);
+  }
+  bool Empty() const { return Size() == 0; }
+  bool Full() const { return Size() > mask_; }
+  size_t Capacity() const { return mask_ + 1; }
+
+ private:
+  std::vector<T> buffer_;
+  size_t mask_ = 1;
+  // head_ is only written by the consumer and tail_ by the producer
+  // keep them in different cache lines to avoid false sharing
+  alignas(64) std::atomic<size_t> head_;
+  alignas(64) std::atomic<size_t> tail_;
+};
+
+}  // namespace common
+}  // namespace static_map
+
+#endif  // COMMON_SPSC_RING_BUFFER_H_
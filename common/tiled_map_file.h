@@ -0,0 +1,360 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_TILED_MAP_FILE_H_
+#define COMMON_TILED_MAP_FILE_H_
+
+// stl
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+// system
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+// third party
+#include <Eigen/Core>
+#include "pcl/point_cloud.h"
+// local
+#include "common/eigen_hash.h"
+
+namespace static_map {
+namespace common {
+
+/*
+ * the tiled map file (little endian):
+ *   TiledMapHeader
+ *   the points of tile 0, 1, ... as x y z intensity floats relative to the
+ *   tile center, each tile is ordered from the coarsest level of detail to
+ *   the finest, so a level is a prefix of the points of its tile
+ *   TiledMapTile[tile_num] at index_offset
+ * it is written tile by tile and read through mmap, a client only touches
+ * the pages of the tiles and levels it uses
+ */
+constexpr char kTiledMapMagic[8] = {'S', 'M', 'T', 'I', 'L', 'E', 'S', '\0'};
+constexpr uint32_t kTiledMapVersion = 1u;
+constexpr int kTiledMapMaxLodNum = 4;
+
+struct TiledMapHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t lod_num;
+  uint64_t tile_num;
+  uint64_t index_offset;
+  // the voxel size of each level, level 0 has all the points (0.)
+  float lod_resolutions[kTiledMapMaxLodNum];
+};
+static_assert(sizeof(TiledMapHeader) == 48, "unexpected padding");
+
+struct TiledMapTile {
+  double center[2];
+  // the bbox of the points relative to the center
+  float bb_min[3];
+  float bb_max[3];
+  // the index of the piece in the package
+  int32_t x;
+  int32_t y;
+  uint64_t offset;
+  // the points in each level of detail, the coarser levels have less
+  uint64_t point_num[kTiledMapMaxLodNum];
+};
+static_assert(sizeof(TiledMapTile) == 88, "unexpected padding");
+
+/// @brief reorder the cloud from the coarsest level to the finest, one
+/// point per voxel is moved into each coarser level
+/// @param resolutions the voxel sizes of the levels 1 to lod_num - 1,
+/// ascending
+/// @param point_num output, the points in each level
+template <typename PointT>
+void SortByLevelOfDetail(const std::vector<float>& resolutions,
+                         pcl::PointCloud<PointT>* cloud,
+                         std::vector<uint64_t>* point_num) {
+  const int lod_num = resolutions.size() + 1;
+  point_num->assign(lod_num, cloud->size());
+  // the points [0, sorted) are all in the coarser levels
+  size_t sorted = 0u;
+  for (int level = lod_num - 1; level > 0; --level) {
+    const float resolution = resolutions[level - 1];
+    std::unordered_set<Eigen::Vector3i> voxels;
+    auto voxel_of = [resolution](const PointT& point) -> Eigen::Vector3i {
+      return Eigen::Vector3i(std::floor(point.x / resolution),
+                             std::floor(point.y / resolution),
+                             std::floor(point.z / resolution));
+    };
+    for (size_t i = 0; i < sorted; ++i) {
+      voxels.insert(voxel_of(cloud->points[i]));
+    }
+    for (size_t i = sorted; i < cloud->size(); ++i) {
+      if (voxels.insert(voxel_of(cloud->points[i])).second) {
+        std::swap(cloud->points[i], cloud->points[sorted++]);
+      }
+    }
+    (*point_num)[level] = sorted;
+  }
+}
+
+/// @class TiledMapWriter
+/// @brief write the tiles into a tiled map file one by one, the index is
+/// written when it is closed
+template <typename PointT>
+class TiledMapWriter {
+ public:
+  TiledMapWriter() = default;
+  ~TiledMapWriter() { Close(); }
+
+  TiledMapWriter(const TiledMapWriter&) = delete;
+  TiledMapWriter& operator=(const TiledMapWriter&) = delete;
+
+  /// @param resolutions the voxel sizes of the coarser levels, ascending
+  /// @return false if the file can not be written
+  bool Open(const std::string& filename,
+            const std::vector<float>& resolutions) {
+    Close();
+    if (resolutions.size() + 1 > kTiledMapMaxLodNum) {
+      return false;
+    }
+    resolutions_ = resolutions;
+    tiles_.clear();
+    file_.open(filename, std::ios::binary | std::ios::trunc);
+    if (!file_.good()) {
+      return false;
+    }
+    WriteHeader(0u);
+    return file_.good();
+  }
+
+  /// @brief write a tile, the points are relative to the center
+  bool AddTile(const int x, const int y, const Eigen::Vector2d& center,
+               const pcl::PointCloud<PointT>& cloud) {
+    if (!file_.is_open()) {
+      return false;
+    }
+    pcl::PointCloud<PointT> sorted_cloud = cloud;
+    std::vector<uint64_t> point_num;
+    SortByLevelOfDetail(resolutions_, &sorted_cloud, &point_num);
+
+    TiledMapTile tile;
+    std::memset(&tile, 0, sizeof(tile));
+    tile.center[0] = center[0];
+    tile.center[1] = center[1];
+    tile.x = x;
+    tile.y = y;
+    tile.offset = file_.tellp();
+    std::copy(point_num.begin(), point_num.end(), tile.point_num);
+    if (!sorted_cloud.empty()) {
+      std::fill(tile.bb_min, tile.bb_min + 3, 1.e30f);
+      std::fill(tile.bb_max, tile.bb_max + 3, -1.e30f);
+    }
+    buffer_.resize(sorted_cloud.size() * 4);
+    float* values = buffer_.data();
+    for (const auto& point : sorted_cloud.points) {
+      const float xyz[3] = {point.x, point.y, point.z};
+      for (int i = 0; i < 3; ++i) {
+        tile.bb_min[i] = std::min(tile.bb_min[i], xyz[i]);
+        tile.bb_max[i] = std::max(tile.bb_max[i], xyz[i]);
+        *values++ = xyz[i];
+      }
+      *values++ = point.intensity;
+    }
+    file_.write(reinterpret_cast<const char*>(buffer_.data()),
+                buffer_.size() * sizeof(float));
+    tiles_.push_back(tile);
+    return file_.good();
+  }
+
+  /// @brief write the index and close the file
+  bool Close() {
+    if (!file_.is_open()) {
+      return true;
+    }
+    const uint64_t index_offset = file_.tellp();
+    file_.write(reinterpret_cast<const char*>(tiles_.data()),
+                tiles_.size() * sizeof(TiledMapTile));
+    file_.seekp(0);
+    WriteHeader(index_offset);
+    const bool good = file_.good();
+    file_.close();
+    return good;
+  }
+
+  inline size_t TileNum() const { return tiles_.size(); }
+
+ private:
+  void WriteHeader(const uint64_t index_offset) {
+    TiledMapHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, kTiledMapMagic, sizeof(kTiledMapMagic));
+    header.version = kTiledMapVersion;
+    header.lod_num = resolutions_.size() + 1;
+    header.tile_num = tiles_.size();
+    header.index_offset = index_offset;
+    std::copy(resolutions_.begin(), resolutions_.end(),
+              header.lod_resolutions + 1);
+    file_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  }
+
+  std::ofstream file_;
+  std::vector<float> resolutions_;
+  std::vector<TiledMapTile> tiles_;
+  std::vector<float> buffer_;
+};
+
+/// @class TiledMapReader
+/// @brief map a tiled map file into memory, the points of a tile are read
+/// in place
+class TiledMapReader {
+ public:
+  TiledMapReader() = default;
+  ~TiledMapReader() { Close(); }
+
+  TiledMapReader(const TiledMapReader&) = delete;
+  TiledMapReader& operator=(const TiledMapReader&) = delete;
+
+  /// @return false if the file can not be mapped or is not a tiled map
+  bool Open(const std::string& filename) {
+    Close();
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 ||
+        static_cast<size_t>(file_stat.st_size) < sizeof(TiledMapHeader)) {
+      close(fd);
+      return false;
+    }
+    size_ = file_stat.st_size;
+    void* data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+      size_ = 0u;
+      return false;
+    }
+    data_ = static_cast<const char*>(data);
+    if (!Valid()) {
+      Close();
+      return false;
+    }
+    return true;
+  }
+
+  void Close() {
+    if (data_) {
+      munmap(const_cast<char*>(data_), size_);
+    }
+    data_ = nullptr;
+    size_ = 0u;
+  }
+
+  inline const TiledMapHeader& Header() const {
+    return *reinterpret_cast<const TiledMapHeader*>(data_);
+  }
+  inline int TileNum() const { return Header().tile_num; }
+  inline int LodNum() const { return Header().lod_num; }
+  inline const TiledMapTile& Tile(const int index) const {
+    return reinterpret_cast<const TiledMapTile*>(
+        data_ + Header().index_offset)[index];
+  }
+
+  /// @brief the tiles whose points overlap the 2d box
+  std::vector<int> TilesInBox(const Eigen::Vector2d& box_min,
+                              const Eigen::Vector2d& box_max) const {
+    std::vector<int> tiles;
+    for (int i = 0; i < TileNum(); ++i) {
+      const TiledMapTile& tile = Tile(i);
+      if (tile.point_num[0] == 0u ||
+          tile.center[0] + tile.bb_max[0] < box_min[0] ||
+          tile.center[0] + tile.bb_min[0] > box_max[0] ||
+          tile.center[1] + tile.bb_max[1] < box_min[1] ||
+          tile.center[1] + tile.bb_min[1] > box_max[1]) {
+        continue;
+      }
+      tiles.push_back(i);
+    }
+    return tiles;
+  }
+
+  /// @brief the points (x y z intensity) of the tile in the level of detail
+  /// relative to the tile center, in place, the level is clamped
+  const float* TilePoints(const int index, const int level,
+                          size_t* point_num) const {
+    const TiledMapTile& tile = Tile(index);
+    *point_num = tile.point_num[std::min(std::max(level, 0), LodNum() - 1)];
+    return reinterpret_cast<const float*>(data_ + tile.offset);
+  }
+
+  /// @brief copy the points in the level of detail into the cloud
+  /// @param global add the tile center to the points
+  template <typename PointT>
+  void LoadTile(const int index, const int level, const bool global,
+                pcl::PointCloud<PointT>* cloud) const {
+    size_t point_num = 0u;
+    const float* values = TilePoints(index, level, &point_num);
+    const TiledMapTile& tile = Tile(index);
+    const float offset_x = global ? tile.center[0] : 0.;
+    const float offset_y = global ? tile.center[1] : 0.;
+    cloud->points.resize(point_num);
+    for (auto& point : cloud->points) {
+      point.x = values[0] + offset_x;
+      point.y = values[1] + offset_y;
+      point.z = values[2];
+      point.intensity = values[3];
+      values += 4;
+    }
+    cloud->width = point_num;
+    cloud->height = 1;
+  }
+
+ private:
+  bool Valid() const {
+    const TiledMapHeader& header = Header();
+    if (std::memcmp(header.magic, kTiledMapMagic, sizeof(kTiledMapMagic)) ||
+        header.version != kTiledMapVersion || header.lod_num < 1 ||
+        header.lod_num > kTiledMapMaxLodNum ||
+        header.index_offset + header.tile_num * sizeof(TiledMapTile) >
+            size_) {
+      return false;
+    }
+    for (int i = 0; i < TileNum(); ++i) {
+      const TiledMapTile& tile = Tile(i);
+      if (tile.offset + tile.point_num[0] * 4 * sizeof(float) >
+          header.index_offset) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  const char* data_ = nullptr;
+  size_t size_ = 0u;
+};
+
+}  // namespace common
+}  // namespace static_map
+
+#endif  // COMMON_TILED_MAP_FILE_H_
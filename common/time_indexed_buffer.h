@@ -0,0 +1,139 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_TIME_INDEXED_BUFFER_H_
+#define COMMON_TIME_INDEXED_BUFFER_H_
+
+// stl
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+// local
+#include "common/mutex.h"
+#include "common/simple_time.h"
+
+namespace static_map {
+namespace common {
+
+/*
+ * @class TimeIndexedBuffer
+ * @brief bounded history of messages (T with header.stamp) sorted by time,
+ * the values are stored in the chunks of a deque instead of one allocation
+ * per message, and the oldest ones are dropped once it is full
+ * the lookups start from the position of the last one, so the mostly
+ * monotonic queries are O(1) amortized, it has its own lock
+ */
+template <typename T>
+class TimeIndexedBuffer {
+ public:
+  explicit TimeIndexedBuffer(size_t max_size = 10000) : max_size_(max_size) {}
+
+  TimeIndexedBuffer(const TimeIndexedBuffer&) = delete;
+  TimeIndexedBuffer& operator=(const TimeIndexedBuffer&) = delete;
+
+  /// @brief append a message, return false if it is older than the newest
+  bool Push(const T& msg) {
+    MutexLocker locker(&mutex_);
+    if (!msgs_.empty() && msg.header.stamp < msgs_.back().header.stamp) {
+      return false;
+    }
+    msgs_.push_back(msg);
+    if (msgs_.size() > max_size_) {
+      msgs_.pop_front();
+      if (cursor_ > 0) {
+        --cursor_;
+      }
+    }
+    return true;
+  }
+
+  bool Empty() {
+    MutexLocker locker(&mutex_);
+    return msgs_.empty();
+  }
+
+  size_t Size() {
+    MutexLocker locker(&mutex_);
+    return msgs_.size();
+  }
+
+  /// @brief get the 2 messages around the time, both are the only message
+  /// if there is only one, whatever the time is
+  /// @return false if empty, or the time is out of the range of messages
+  bool Bracket(const SimpleTime& time, T* const former, T* const latter) {
+    MutexLocker locker(&mutex_);
+    if (msgs_.empty()) {
+      return false;
+    }
+    if (msgs_.size() == 1) {
+      *former = msgs_.front();
+      *latter = msgs_.front();
+      return true;
+    }
+    if (time < msgs_.front().header.stamp || time > msgs_.back().header.stamp) {
+      return false;
+    }
+    // former = msgs_[cursor_], latter = msgs_[cursor_ + 1]
+    cursor_ = std::min(cursor_, msgs_.size() - 2);
+    int steps = 0;
+    while (cursor_ + 2 < msgs_.size() &&
+           !(time < msgs_[cursor_ + 1].header.stamp) &&
+           steps++ < kMaxLinearSteps) {
+      ++cursor_;
+    }
+    while (cursor_ > 0 && time < msgs_[cursor_].header.stamp &&
+           steps++ < kMaxLinearSteps) {
+      --cursor_;
+    }
+    if (time < msgs_[cursor_].header.stamp ||
+        (cursor_ + 2 < msgs_.size() &&
+         !(time < msgs_[cursor_ + 1].header.stamp))) {
+      // far from the last query, binary search for the first later one
+      const auto latter_it = std::upper_bound(
+          msgs_.begin() + 1, msgs_.end() - 1, time,
+          [](const SimpleTime& t, const T& msg) {
+            return t < msg.header.stamp;
+          });
+      cursor_ = (latter_it - msgs_.begin()) - 1;
+    }
+    *former = msgs_[cursor_];
+    *latter = msgs_[cursor_ + 1];
+    return true;
+  }
+
+ private:
+  static constexpr int kMaxLinearSteps = 16;
+
+  Mutex mutex_;
+  const size_t max_size_;
+  std::deque<T> msgs_ GUARDED_BY(mutex_);
+  // index of the former message of the last query
+  size_t cursor_ GUARDED_BY(mutex_) = 0;
+};
+
+template <typename T>
+constexpr int TimeIndexedBuffer<T>::kMaxLinearSteps;
+
+}  // namespace common
+}  // namespace static_map
+
+#endif  // COMMON_TIME_INDEXED_BUFFER_H_
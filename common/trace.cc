@@ -0,0 +1,153 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "common/trace.h"
+
+// stl
+#include <fstream>
+
+// local
+#include "common/macro_defines.h"
+
+namespace static_map {
+namespace common {
+
+namespace {
+void WriteArg(const char* key, const int32_t value, bool* first,
+              std::ostream* stream) {
+  if (value < 0) {
+    return;
+  }
+  *stream << (*first ? "" : ", ") << "\"" << key << "\": " << value;
+  *first = false;
+}
+}  // namespace
+
+constexpr size_t Tracer::kBufferSize;
+
+Tracer::Tracer()
+    : enabled_(false), start_time_(std::chrono::steady_clock::now()) {}
+
+Tracer* Tracer::Get() {
+  // never destructed, the buffers are used until the threads end
+  static Tracer* const tracer = new Tracer;
+  return tracer;
+}
+
+void Tracer::Start(const std::string& filename) {
+  MutexLocker locker(&mutex_);
+  filename_ = filename;
+  enabled_ = true;
+}
+
+bool Tracer::Stop() {
+  if (!enabled_.exchange(false)) {
+    return false;
+  }
+  MutexLocker locker(&mutex_);
+  std::ofstream file(filename_, std::ios::out | std::ios::trunc);
+  if (!file.is_open()) {
+    PRINT_ERROR_FMT("failed to write the trace into %s", filename_.c_str());
+    return false;
+  }
+  file << "{\"traceEvents\": [";
+  bool first_event = true;
+  size_t dropped = 0;
+  for (const auto& buffer : buffers_) {
+    if (!buffer->name.empty()) {
+      file << (first_event ? "" : ",") << "\n{\"name\": \"thread_name\", "
+           << "\"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->id
+           << ", \"args\": {\"name\": \"" << buffer->name << "\"}}";
+      first_event = false;
+    }
+    // the events after the size may be being written
+    const size_t size = buffer->size.load(std::memory_order_acquire);
+    for (size_t i = 0; i < size; ++i) {
+      const Event& event = buffer->events[i];
+      file << (first_event ? "" : ",") << "\n{\"name\": \"" << event.name
+           << "\", \"ph\": \"X\", \"ts\": " << event.start_us
+           << ", \"dur\": " << event.duration_us
+           << ", \"pid\": 1, \"tid\": " << buffer->id << ", \"args\": {";
+      bool first_arg = true;
+      WriteArg("trajectory", event.args.trajectory, &first_arg, &file);
+      WriteArg("submap", event.args.submap, &first_arg, &file);
+      WriteArg("frame", event.args.frame, &first_arg, &file);
+      WriteArg("queue_depth", event.args.queue_depth, &first_arg, &file);
+      file << "}}";
+      first_event = false;
+    }
+    dropped += buffer->dropped.load(std::memory_order_relaxed);
+  }
+  file << "\n], \"displayTimeUnit\": \"ms\"}" << std::endl;
+  if (dropped > 0) {
+    PRINT_WARNING_FMT("%lu trace events dropped, the buffers were full.",
+                      dropped);
+  }
+  PRINT_INFO_FMT("trace written into %s", filename_.c_str());
+  return file.good();
+}
+
+void Tracer::SetThreadName(const std::string& name) {
+  // no buffer for the threads which never record
+  if (!Enabled()) {
+    return;
+  }
+  ThreadBuffer* const buffer = LocalBuffer();
+  MutexLocker locker(&mutex_);
+  buffer->name = name;
+}
+
+void Tracer::Record(const char* name,
+                    const std::chrono::steady_clock::time_point& start,
+                    const std::chrono::steady_clock::time_point& end,
+                    const TraceArgs& args) {
+  ThreadBuffer* const buffer = LocalBuffer();
+  const size_t index = buffer->size.load(std::memory_order_relaxed);
+  if (index >= kBufferSize) {
+    buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  Event& event = buffer->events[index];
+  event.name = name;
+  event.start_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                       start - start_time_)
+                       .count();
+  event.duration_us =
+      std::chrono::duration_cast<std::chrono::microseconds>(end - start)
+          .count();
+  event.args = args;
+  buffer->size.store(index + 1, std::memory_order_release);
+}
+
+Tracer::ThreadBuffer* Tracer::LocalBuffer() {
+  thread_local ThreadBuffer* buffer = nullptr;
+  if (buffer == nullptr) {
+    MutexLocker locker(&mutex_);
+    buffers_.emplace_back(
+        new ThreadBuffer(static_cast<int>(buffers_.size()) + 1));
+    buffer = buffers_.back().get();
+  }
+  return buffer;
+}
+
+}  // namespace common
+}  // namespace static_map
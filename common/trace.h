@@ -0,0 +1,137 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+// stl
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// local
+#include "common/mutex.h"
+
+namespace static_map {
+namespace common {
+
+/// @brief the optional arguments of a trace event, -1 for the unused ones
+struct TraceArgs {
+  int32_t trajectory = -1;
+  int32_t submap = -1;
+  int32_t frame = -1;
+  // the depth of the queue the stage consumes
+  int32_t queue_depth = -1;
+};
+
+/// @class Tracer
+/// @brief the timeline of the pipeline stages as a chrome trace (json),
+/// viewable in Perfetto or chrome://tracing
+/// the events are recorded in a fixed buffer of each thread without any
+/// lock, the full buffers drop the new events, they are all written by Stop()
+class Tracer {
+ public:
+  static Tracer* Get();
+
+  /// @brief start recording, the file is written by Stop()
+  void Start(const std::string& filename);
+  /// @brief stop recording and write the events recorded so far
+  /// @return false if it is not started or the file can not be written
+  bool Stop();
+  inline bool Enabled() const {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  /// @brief the name of the calling thread in the timeline, only works
+  /// after Start()
+  void SetThreadName(const std::string& name);
+  /// @param name a string literal, it is kept as the pointer
+  void Record(const char* name,
+              const std::chrono::steady_clock::time_point& start,
+              const std::chrono::steady_clock::time_point& end,
+              const TraceArgs& args);
+
+ private:
+  Tracer();
+
+  struct Event {
+    const char* name;
+    int64_t start_us;
+    int64_t duration_us;
+    TraceArgs args;
+  };
+  // written by its thread only, read by Stop() up to the published size
+  struct ThreadBuffer {
+    explicit ThreadBuffer(const int id) : id(id), events(kBufferSize) {}
+
+    const int id;
+    // set with the lock of the tracer
+    std::string name;
+    std::vector<Event> events;
+    std::atomic<size_t> size{0};
+    std::atomic<size_t> dropped{0};
+  };
+  static constexpr size_t kBufferSize = 1 << 16;
+
+  // registered on the first event of the thread, kept until the end
+  ThreadBuffer* LocalBuffer();
+
+  std::atomic<bool> enabled_;
+  const std::chrono::steady_clock::time_point start_time_;
+  Mutex mutex_;
+  std::string filename_ GUARDED_BY(mutex_);
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers_ GUARDED_BY(mutex_);
+};
+
+/// @class ScopedTrace
+/// @brief records its lifetime as an event of the tracer if it is started
+class ScopedTrace {
+ public:
+  explicit ScopedTrace(const char* name, const TraceArgs& args = TraceArgs())
+      : name_(Tracer::Get()->Enabled() ? name : nullptr), args_(args) {
+    if (name_) {
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+  ~ScopedTrace() {
+    if (name_) {
+      Tracer::Get()->Record(name_, start_, std::chrono::steady_clock::now(),
+                            args_);
+    }
+  }
+
+  ScopedTrace(const ScopedTrace&) = delete;
+  ScopedTrace& operator=(const ScopedTrace&) = delete;
+
+  /// @brief the arguments known only in the scope, e.g. the new ids
+  inline TraceArgs* MutableArgs() { return &args_; }
+
+ private:
+  const char* const name_;
+  TraceArgs args_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace common
+}  // namespace static_map
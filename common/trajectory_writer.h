@@ -0,0 +1,270 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_TRAJECTORY_WRITER_H_
+#define COMMON_TRAJECTORY_WRITER_H_
+
+// stl
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace static_map {
+namespace common {
+
+/// @brief format the value like "%f" (std::to_string) into out, which
+/// needs at least 32 chars
+/// @return the number of the chars
+inline int FormatFixed6(const double value, char* out) {
+  // the huge (and the non-finite) values go to printf, the ones over 1e20
+  // in the exponent format which fits in 32 chars
+  if (std::isfinite(value) && std::abs(value) >= 1.e20) {
+    return std::snprintf(out, 32, "%e", value);
+  }
+  if (!std::isfinite(value) || std::abs(value) >= 1.e15) {
+    return std::snprintf(out, 32, "%f", value);
+  }
+  char* cursor = out;
+  if (std::signbit(value)) {
+    *cursor++ = '-';
+  }
+  // the integer part and the rest are exact, only the rest is rounded
+  // (half to even as printf)
+  const double absolute = std::abs(value);
+  const double integer_part = std::floor(absolute);
+  uint64_t integer = integer_part;
+  uint32_t fraction = std::nearbyint((absolute - integer_part) * 1.e6);
+  if (fraction == 1000000u) {
+    ++integer;
+    fraction = 0u;
+  }
+  char digits[20];
+  int digit_num = 0;
+  do {
+    digits[digit_num++] = '0' + integer % 10u;
+    integer /= 10u;
+  } while (integer);
+  while (digit_num) {
+    *cursor++ = digits[--digit_num];
+  }
+  *cursor++ = '.';
+  for (int i = 5; i >= 0; --i) {
+    cursor[i] = '0' + fraction % 10u;
+    fraction /= 10u;
+  }
+  cursor += 6;
+  return cursor - out;
+}
+
+/// @class BufferedFileWriter
+/// @brief append bytes to a file through a fixed buffer, the memory does
+/// not grow with the length of the file
+class BufferedFileWriter {
+ public:
+  static constexpr size_t kBufferSize = 1u << 16;
+
+  BufferedFileWriter() : buffer_(kBufferSize) {}
+  ~BufferedFileWriter() { Close(); }
+
+  BufferedFileWriter(const BufferedFileWriter&) = delete;
+  BufferedFileWriter& operator=(const BufferedFileWriter&) = delete;
+
+  /// @return false if the file can not be written
+  bool Open(const std::string& filename) {
+    Close();
+    file_ = std::fopen(filename.c_str(), "wb");
+    good_ = file_ != nullptr;
+    return good_;
+  }
+
+  inline bool IsOpen() const { return file_ != nullptr; }
+
+  /// @brief the buffer to write at most size bytes into, commit them
+  /// with Commit()
+  inline char* Reserve(const size_t size) {
+    if (used_ + size > kBufferSize) {
+      Flush();
+    }
+    return buffer_.data() + used_;
+  }
+  inline void Commit(const size_t size) { used_ += size; }
+
+  void Write(const void* data, const size_t size) {
+    if (size > kBufferSize) {
+      Flush();
+      good_ = good_ && std::fwrite(data, 1, size, file_) == size;
+      return;
+    }
+    std::memcpy(Reserve(size), data, size);
+    Commit(size);
+  }
+
+  /// @return false if any write failed
+  bool Close() {
+    if (!file_) {
+      return true;
+    }
+    Flush();
+    good_ = std::fclose(file_) == 0 && good_;
+    file_ = nullptr;
+    return good_;
+  }
+
+ private:
+  void Flush() {
+    if (used_ && file_) {
+      good_ = good_ && std::fwrite(buffer_.data(), 1, used_, file_) == used_;
+      used_ = 0u;
+    }
+  }
+
+  std::FILE* file_ = nullptr;
+  bool good_ = false;
+  size_t used_ = 0u;
+  std::vector<char> buffer_;
+};
+
+/// @class TextTrajectoryWriter
+/// @brief write the poses as the lines "index, x, y, z, roll, pitch, yaw"
+class TextTrajectoryWriter {
+ public:
+  bool Open(const std::string& filename) { return writer_.Open(filename); }
+  inline bool IsOpen() const { return writer_.IsOpen(); }
+
+  void Write(const int index, const double pose[6]) {
+    // 7 numbers with the separators
+    char* line = writer_.Reserve(7 * 34 + 4);
+    char* cursor = line + std::sprintf(line, "%d", index);
+    for (int i = 0; i < 6; ++i) {
+      *cursor++ = ',';
+      *cursor++ = ' ';
+      cursor += FormatFixed6(pose[i], cursor);
+    }
+    *cursor++ = ' ';
+    *cursor++ = '\n';
+    writer_.Commit(cursor - line);
+  }
+
+  bool Close() { return writer_.Close(); }
+
+ private:
+  BufferedFileWriter writer_;
+};
+
+/*
+ * the binary trajectory file (little endian): the magic, the version and
+ * the size of a record as uint32, then the records
+ */
+constexpr char kBinaryTrajectoryMagic[8] = {'S', 'M', 'T', 'R',
+                                            'A', 'J', '\0', '\0'};
+constexpr uint32_t kBinaryTrajectoryVersion = 1u;
+
+struct TrajectoryRecord {
+  uint64_t index;
+  // the full timestamp of the frame
+  uint32_t secs;
+  uint32_t nsecs;
+  // x, y, z, roll, pitch, yaw
+  double pose[6];
+};
+static_assert(sizeof(TrajectoryRecord) == 64, "unexpected padding");
+
+/// @class BinaryTrajectoryWriter
+/// @brief write the poses with their timestamps without losing precision
+class BinaryTrajectoryWriter {
+ public:
+  bool Open(const std::string& filename) {
+    if (!writer_.Open(filename)) {
+      return false;
+    }
+    const uint32_t header[2] = {kBinaryTrajectoryVersion,
+                                sizeof(TrajectoryRecord)};
+    writer_.Write(kBinaryTrajectoryMagic, sizeof(kBinaryTrajectoryMagic));
+    writer_.Write(header, sizeof(header));
+    return true;
+  }
+  inline bool IsOpen() const { return writer_.IsOpen(); }
+
+  void Write(const TrajectoryRecord& record) {
+    writer_.Write(&record, sizeof(record));
+  }
+
+  bool Close() { return writer_.Close(); }
+
+ private:
+  BufferedFileWriter writer_;
+};
+
+/// @class BinaryTrajectoryReader
+/// @brief read the records written by BinaryTrajectoryWriter
+class BinaryTrajectoryReader {
+ public:
+  BinaryTrajectoryReader() = default;
+  ~BinaryTrajectoryReader() { Close(); }
+
+  BinaryTrajectoryReader(const BinaryTrajectoryReader&) = delete;
+  BinaryTrajectoryReader& operator=(const BinaryTrajectoryReader&) = delete;
+
+  /// @return false if the file can not be read or is of another version
+  bool Open(const std::string& filename) {
+    Close();
+    file_ = std::fopen(filename.c_str(), "rb");
+    if (file_ == nullptr) {
+      return false;
+    }
+    char magic[sizeof(kBinaryTrajectoryMagic)];
+    uint32_t header[2];
+    if (std::fread(magic, sizeof(magic), 1, file_) != 1 ||
+        std::fread(header, sizeof(header), 1, file_) != 1 ||
+        std::memcmp(magic, kBinaryTrajectoryMagic, sizeof(magic)) != 0 ||
+        header[0] != kBinaryTrajectoryVersion ||
+        header[1] != sizeof(TrajectoryRecord)) {
+      Close();
+      return false;
+    }
+    return true;
+  }
+  inline bool IsOpen() const { return file_ != nullptr; }
+
+  /// @return false at the end of the file
+  bool Read(TrajectoryRecord* const record) {
+    return file_ && std::fread(record, sizeof(*record), 1, file_) == 1;
+  }
+
+  void Close() {
+    if (file_) {
+      std::fclose(file_);
+      file_ = nullptr;
+    }
+  }
+
+ private:
+  std::FILE* file_ = nullptr;
+};
+
+}  // namespace common
+}  // namespace static_map
+
+#endif  // COMMON_TRAJECTORY_WRITER_H_
@@ -0,0 +1,107 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_VOXEL_CENTROID_GRID_H_
+#define COMMON_VOXEL_CENTROID_GRID_H_
+
+// stl
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+// third party
+#include <Eigen/Core>
+#include "pcl/point_cloud.h"
+// local
+#include "common/morton.h"
+
+namespace static_map {
+namespace common {
+
+/// @class VoxelCentroidGrid
+/// @brief the centroids (x y z intensity) of the points in the voxels, the
+/// voxels are aligned to the origin, so the grids of several parts of a
+/// cloud share their voxels
+template <typename PointT>
+class VoxelCentroidGrid {
+ public:
+  explicit VoxelCentroidGrid(const float leaf_size)
+      : inverse_leaf_size_(1.f / leaf_size) {}
+
+  inline Eigen::Vector3i VoxelIndex(const PointT& point) const {
+    return Eigen::Vector3i(std::floor(point.x * inverse_leaf_size_),
+                           std::floor(point.y * inverse_leaf_size_),
+                           std::floor(point.z * inverse_leaf_size_));
+  }
+
+  inline void Add(const PointT& point) { Add(VoxelIndex(point), point); }
+  void Add(const Eigen::Vector3i& index, const PointT& point) {
+    auto inserted =
+        voxel_indices_.emplace(MortonEncode(index), centroids_.size());
+    if (inserted.second) {
+      centroids_.push_back(Centroid());
+    }
+    Centroid& centroid = centroids_[inserted.first->second];
+    centroid.sum[0] += point.x;
+    centroid.sum[1] += point.y;
+    centroid.sum[2] += point.z;
+    centroid.sum[3] += point.intensity;
+    ++centroid.point_num;
+  }
+
+  inline size_t Size() const { return centroids_.size(); }
+
+  /// @brief the centroids in the order their voxels are created
+  void Output(pcl::PointCloud<PointT>* cloud) const {
+    cloud->points.resize(centroids_.size());
+    for (size_t i = 0; i < centroids_.size(); ++i) {
+      const Centroid& centroid = centroids_[i];
+      auto& point = cloud->points[i];
+      point.x = centroid.sum[0] / centroid.point_num;
+      point.y = centroid.sum[1] / centroid.point_num;
+      point.z = centroid.sum[2] / centroid.point_num;
+      point.intensity = centroid.sum[3] / centroid.point_num;
+    }
+    cloud->width = cloud->points.size();
+    cloud->height = 1;
+  }
+
+  void Clear() {
+    voxel_indices_.clear();
+    centroids_.clear();
+  }
+
+ private:
+  struct Centroid {
+    double sum[4] = {0., 0., 0., 0.};
+    int point_num = 0;
+  };
+
+  float inverse_leaf_size_;
+  // by the morton keys, cheaper to hash than the indices
+  std::unordered_map<uint64_t, size_t> voxel_indices_;
+  std::vector<Centroid> centroids_;
+};
+
+}  // namespace common
+}  // namespace static_map
+
+#endif  // COMMON_VOXEL_CENTROID_GRID_H_
@@ -0,0 +1,182 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef COMMON_VOXEL_HASH_MAP_H_
+#define COMMON_VOXEL_HASH_MAP_H_
+
+#include <Eigen/Core>
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "common/morton.h"
+
+namespace static_map {
+namespace common {
+
+/// @brief pack the voxel index into 63 bits, the morton key (see
+/// common/morton.h)
+inline uint64_t PackVoxelKey(const Eigen::Vector3i& index) {
+  return MortonEncode(index);
+}
+
+/// @brief the finalizer of splitmix64, the neighbouring voxels are spread
+/// over the whole table
+inline uint64_t HashVoxelKey(uint64_t key) {
+  key ^= key >> 30;
+  key *= 0xbf58476d1ce4e5b9ull;
+  key ^= key >> 27;
+  key *= 0x94d049bb133111ebull;
+  key ^= key >> 31;
+  return key;
+}
+
+/// @class VoxelHashMap
+/// @brief an open-addressing (linear probing) hash map from the voxel index
+/// to T, a lookup or an insertion probes once. the probing only reads the
+/// packed keys (8 of them a cache line), the indices of the values are in
+/// a parallel array. the values are in a deque, so they never move (T may
+/// be non-movable, e.g. holding atomics) and the iteration is in the order
+/// of insertion. it is not thread-safe
+template <typename T>
+class VoxelHashMap {
+ public:
+  using Key = Eigen::Vector3i;
+  using value_type = std::pair<const Key, T>;
+  using iterator = typename std::deque<value_type>::iterator;
+  using const_iterator = typename std::deque<value_type>::const_iterator;
+
+  explicit VoxelHashMap(const size_t initial_capacity = 1024) {
+    Rehash(initial_capacity);
+  }
+
+  VoxelHashMap(const VoxelHashMap&) = delete;
+  VoxelHashMap& operator=(const VoxelHashMap&) = delete;
+
+  /// @brief the value of the voxel, a default one is inserted if not found
+  T& operator[](const Key& index) {
+    const uint64_t key = PackVoxelKey(index);
+    size_t slot = Probe(key);
+    if (keys_[slot] == kEmpty) {
+      if ((values_.size() + 1) * kMaxLoadDenominator >
+          keys_.size() * kMaxLoadNumerator) {
+        Rehash(keys_.size() * 2);
+        slot = Probe(key);
+      }
+      keys_[slot] = key;
+      indices_[slot] = static_cast<uint32_t>(values_.size());
+      values_.emplace_back(std::piecewise_construct,
+                           std::forward_as_tuple(index),
+                           std::forward_as_tuple());
+    }
+    return values_[indices_[slot]].second;
+  }
+
+  iterator find(const Key& index) {
+    const size_t slot = Probe(PackVoxelKey(index));
+    return keys_[slot] == kEmpty ? values_.end()
+                                 : values_.begin() + indices_[slot];
+  }
+  const_iterator find(const Key& index) const {
+    const size_t slot = Probe(PackVoxelKey(index));
+    return keys_[slot] == kEmpty ? values_.end()
+                                 : values_.begin() + indices_[slot];
+  }
+
+  iterator begin() { return values_.begin(); }
+  iterator end() { return values_.end(); }
+  const_iterator begin() const { return values_.begin(); }
+  const_iterator end() const { return values_.end(); }
+
+  size_t size() const { return values_.size(); }
+  bool empty() const { return values_.empty(); }
+
+  /// @brief make room for size voxels without rehashing
+  void reserve(const size_t size) {
+    const size_t needed = size * kMaxLoadDenominator / kMaxLoadNumerator + 1;
+    if (needed > keys_.size()) {
+      Rehash(needed);
+    }
+  }
+
+  void clear() {
+    values_.clear();
+    std::fill(keys_.begin(), keys_.end(), kEmpty);
+  }
+
+ private:
+  // the packed keys never use the highest bit
+  static constexpr uint64_t kEmpty = ~0ull;
+  // rehash when more than half of the slots are used, the misses (most of
+  // the lookups on a ray) probe about 2.5 slots then
+  static constexpr size_t kMaxLoadNumerator = 1;
+  static constexpr size_t kMaxLoadDenominator = 2;
+
+  // the slot holding the key, or the empty slot where it would be inserted
+  size_t Probe(const uint64_t key) const {
+    size_t slot = HashVoxelKey(key) & mask_;
+    while (keys_[slot] != key && keys_[slot] != kEmpty) {
+      slot = (slot + 1) & mask_;
+    }
+    return slot;
+  }
+
+  void Rehash(const size_t min_capacity) {
+    size_t capacity = 16;
+    while (capacity < min_capacity) {
+      capacity <<= 1;
+    }
+    std::vector<uint64_t> keys(capacity, kEmpty);
+    std::vector<uint32_t> indices(capacity, 0u);
+    keys_.swap(keys);
+    indices_.swap(indices);
+    mask_ = capacity - 1;
+    for (size_t i = 0; i < keys.size(); ++i) {
+      if (keys[i] != kEmpty) {
+        const size_t slot = Probe(keys[i]);
+        keys_[slot] = keys[i];
+        indices_[slot] = indices[i];
+      }
+    }
+  }
+
+  std::vector<uint64_t> keys_;
+  std::vector<uint32_t> indices_;
+  size_t mask_ = 0;
+  std::deque<value_type> values_;
+};
+
+template <typename T>
+constexpr uint64_t VoxelHashMap<T>::kEmpty;
+template <typename T>
+constexpr size_t VoxelHashMap<T>::kMaxLoadNumerator;
+template <typename T>
+constexpr size_t VoxelHashMap<T>::kMaxLoadDenominator;
+
+}  // namespace common
+}  // namespace static_map
+
+#endif  // COMMON_VOXEL_HASH_MAP_H_
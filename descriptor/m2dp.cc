@@ -21,6 +21,7 @@
 // SOFTWARE.
 
 #include "descriptor/m2dp.h"
+#include "common/point_types.h"
 
 namespace static_map {
 namespace descriptor {
@@ -28,6 +29,7 @@ namespace descriptor {
 template <typename PointType>
 void M2dp<PointType>::preProcess(
     const M2dp<PointType>::PointCloudSourcePtr& source) {
+  inner_cloud_->clear();
   // remove the shift and rotation
   pcl::PCA<PointType> pca;
   pca.setInputCloud(source);
@@ -48,57 +50,62 @@ void M2dp<PointType>::preProcess(
 }
 
 template <typename PointType>
-Eigen::VectorXi M2dp<PointType>::singleViewProcess(double theta, double phi) {
-  // normal
-  Eigen::Vector3f m;
-  m << std::cos(theta) * std::cos(phi), std::cos(theta) * std::sin(phi),
-      std::sin(theta);
-
-  // refer to the matlab code in git (according to the paper)
-  Eigen::Vector3f projected_x_axis =
-      Eigen::Vector3f(1., 0., 0.) -
-      (Eigen::Vector3f(1., 0., 0.).transpose() * m).norm() * m;
-  Eigen::Vector3f projected_y_axis = m.cross(projected_x_axis);
-
-  const double m_2_pi = M_PI * 2.;
-  auto calulate_polar = [&m_2_pi](const Eigen::Vector2f& p) {
-    PolarCoordinate coord;
-    coord.length = p.norm();
-    coord.angle = std::atan2(p[1], p[0]);
-    if (coord.angle < 0.) coord.angle += m_2_pi;
-
-    return coord;
-  };
-
-  Eigen::VectorXi row;
-  row.resize(l_ * t_, 1);
-  for (int i = 0; i < l_ * t_; ++i) row[i] = 0;
-  const double angle_step = m_2_pi / t_;
-  for (auto& point : inner_cloud_->points) {
-    Eigen::Vector3f p(point.x, point.y, point.z);
-    Eigen::Vector2f projected_point((p.transpose() * projected_x_axis).norm(),
-                                    (p.transpose() * projected_y_axis).norm());
-
-    PolarCoordinate coord = calulate_polar(projected_point);
-    int32_t l_index = std::floor(std::sqrt(coord.length / r_));
-    // avoid over border
-    if (l_index > l_ - 1) {
-      l_index = l_ - 1;
-    }
-    int32_t t_index = std::floor(coord.angle / angle_step);
-    if (t_index > t_ - 1) {
-      t_index = t_ - 1;
+void M2dp<PointType>::multiViewProcess() {
+  const int point_num = inner_cloud_->size();
+  points_.resize(3, point_num);
+  for (int i = 0; i < point_num; ++i) {
+    const PointType& point = inner_cloud_->points[i];
+    points_.col(i) << point.x, point.y, point.z;
+  }
+  projected_points_.resize(2, point_num);
+  histogram_.resize(l_ * t_);
+
+  const double theta_step = M_PI / p_;
+  const double phi_step = M_PI_2 / q_;
+  const double angle_step = M_PI * 2. / t_;
+  for (int p = 0; p < p_; ++p) {
+    for (int q = 0; q < q_; ++q) {
+      const double theta = p * theta_step;
+      const double phi = q * phi_step;
+      // normal
+      Eigen::Vector3f m;
+      m << std::cos(theta) * std::cos(phi), std::cos(theta) * std::sin(phi),
+          std::sin(theta);
+
+      // refer to the matlab code in git (according to the paper)
+      const Eigen::Vector3f projected_x_axis =
+          Eigen::Vector3f(1., 0., 0.) - std::fabs(m[0]) * m;
+      const Eigen::Vector3f projected_y_axis = m.cross(projected_x_axis);
+      Eigen::Matrix<float, 2, 3> axes;
+      axes.row(0) = projected_x_axis.transpose();
+      axes.row(1) = projected_y_axis.transpose();
+      projected_points_.noalias() = axes * points_;
+
+      histogram_.setZero();
+      for (int i = 0; i < point_num; ++i) {
+        // the absolute values of the projections as the former version,
+        // so the angle is in [0, pi / 2]
+        const float x = std::fabs(projected_points_(0, i));
+        const float y = std::fabs(projected_points_(1, i));
+        const double length = std::sqrt(x * x + y * y);
+        const double angle = std::atan2(y, x);
+        // avoid over border
+        const int32_t l_index =
+            std::min(static_cast<int32_t>(std::floor(std::sqrt(length / r_))),
+                     l_ - 1);
+        const int32_t t_index = std::min(
+            static_cast<int32_t>(std::floor(angle / angle_step)), t_ - 1);
+        histogram_[l_index * t_ + t_index]++;
+      }
+      A_.row(p * q_ + q) = histogram_.transpose().cast<float>();
     }
-    int32_t index = l_index * t_ + t_index;
-    //         std::cout << index << "  " << l_index << "  " << t_index << "  "
-    //         << coord.angle << std::endl;
-    row[index]++;
   }
-
-  return row;
 }
 
 template class M2dp<pcl::PointXYZI>;
+#ifdef _USE_COMPACT_POINT_
+template class M2dp<PointXYZIc>;
+#endif
 
 }  // namespace descriptor
 }  // namespace static_map
@@ -31,7 +31,9 @@
 #include <pcl/io/pcd_io.h>
 #include <pcl/point_types.h>
 #include <Eigen/Dense>
-#include <Eigen/SVD>
+// stl
+#include <algorithm>
+#include <cmath>
 
 namespace static_map {
 namespace descriptor {
@@ -58,10 +60,6 @@ class M2dp {
         max_distance_(max_distance) {}
   ~M2dp() = default;
 
-  struct PolarCoordinate {
-    double angle, length;
-  };
-
   bool setInputCloud(const PointCloudSourcePtr& source) {
     if (source->empty()) {
       PCL_ERROR("source is empty.\n");
@@ -72,19 +70,29 @@ class M2dp {
     preProcess(source);
 
     // step2 calculate A
-    const double theta_step = M_PI / p_;
-    const double phi_step = M_PI_2 / q_;
-    for (int p = 0; p < p_; ++p)
-      for (int q = 0; q < q_; ++q) {
-        Eigen::VectorXi row = singleViewProcess(p * theta_step, q * phi_step);
-        A_.block(p * q_ + q, 0, 1, l_ * t_) = row.transpose().cast<float>();
-      }
-
-    // SVD and get the final Descriptor
-    Eigen::JacobiSVD<Eigen::MatrixXf> svd(
-        A_, Eigen::ComputeThinU | Eigen::ComputeThinV);
-    Eigen::MatrixXf V = svd.matrixV(), U = svd.matrixU();
-    Eigen::VectorXf v1 = V.col(0), u1 = U.col(0);  // paper algorithm1.15
+    if (inner_cloud_->empty()) {
+      PCL_ERROR("no points in max distance.\n");
+      return false;
+    }
+    multiViewProcess();
+
+    // only the first singular vectors are needed (paper algorithm1.15),
+    // u1 is the eigen vector of the largest eigen value of A * A^T, which
+    // is (p * q) x (p * q), then v1 = A^T * u1 / sigma1
+    const Eigen::MatrixXf gram = A_ * A_.transpose();
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXf> solver(gram);
+    const int last = gram.rows() - 1;
+    const float sigma = std::sqrt(std::max(solver.eigenvalues()[last], 0.f));
+    if (solver.info() != Eigen::Success || sigma < 1.e-6f) {
+      PCL_ERROR("failed to decompose A.\n");
+      return false;
+    }
+    Eigen::VectorXf u1 = solver.eigenvectors().col(last);
+    // A has no negative elements, so do the singular vectors
+    if (u1.sum() < 0.f) {
+      u1 = -u1;
+    }
+    const Eigen::VectorXf v1 = A_.transpose() * u1 / sigma;
 
     descriptor_.resize(u1.rows() + v1.rows(), 1);
     descriptor_ << u1, v1;
@@ -96,8 +104,9 @@ class M2dp {
  private:
   // part III.B in paper
   void preProcess(const PointCloudSourcePtr& source);
-  // part III.C in paper
-  Eigen::VectorXi singleViewProcess(double theta, double phi);
+  // part III.C in paper, the rows of A for all views, the points are
+  // projected by one matrix product per view into the reused buffers
+  void multiViewProcess();
 
   inline double getLength(const PointType& a) {
     return std::sqrt(a.x * a.x + a.y * a.y + a.z * a.z);
@@ -115,6 +124,10 @@ class M2dp {
 
   Eigen::MatrixXf A_;
   Descriptor descriptor_;
+  // buffers of multiViewProcess()
+  Eigen::Matrix3Xf points_;
+  Eigen::Matrix2Xf projected_points_;
+  Eigen::VectorXi histogram_;
 };
 
 // return the match score ( 0, 1 )
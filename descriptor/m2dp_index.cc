@@ -0,0 +1,130 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "descriptor/m2dp_index.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace static_map {
+namespace descriptor {
+
+namespace {
+
+// the same as the check in matchTwoM2dpDescriptors()
+constexpr int kMinDescriptorSize = 10;
+constexpr int kInitialCapacity = 64;
+
+}  // namespace
+
+bool M2dpIndex::Normalize(const Eigen::VectorXf& descriptor,
+                          Eigen::VectorXf* const normalized) {
+  if (descriptor.size() < kMinDescriptorSize) {
+    return false;
+  }
+  *normalized = descriptor.array() - descriptor.mean();
+  const float norm = normalized->norm();
+  if (!(norm > 0.f) || !std::isfinite(norm)) {
+    return false;
+  }
+  *normalized /= norm;
+  return true;
+}
+
+int M2dpIndex::Add(const Eigen::VectorXf& descriptor) {
+  Eigen::VectorXf normalized;
+  const bool valid = Normalize(descriptor, &normalized);
+  if (valid && descriptors_.rows() == 0) {
+    // the size is set by the first valid one, the former ones never match
+    descriptors_ = Eigen::MatrixXf::Zero(
+        normalized.size(),
+        std::max<Eigen::Index>(kInitialCapacity, descriptors_.cols()));
+  }
+  if (size_ == descriptors_.cols()) {
+    descriptors_.conservativeResize(
+        Eigen::NoChange, std::max<Eigen::Index>(kInitialCapacity, size_ * 2));
+  }
+  if (valid && normalized.size() == descriptors_.rows()) {
+    descriptors_.col(size_) = normalized;
+  } else {
+    descriptors_.col(size_).setZero();
+  }
+  return size_++;
+}
+
+bool M2dpIndex::NormalizeQuery(const Eigen::VectorXf& query,
+                               Eigen::VectorXf* const normalized) const {
+  return Normalize(query, normalized) &&
+         normalized->size() == descriptors_.rows();
+}
+
+void M2dpIndex::Scores(const Eigen::VectorXf& query,
+                       const std::vector<int>& indices,
+                       std::vector<double>* const scores) const {
+  scores->assign(indices.size(), 0.);
+  Eigen::VectorXf normalized;
+  if (!NormalizeQuery(query, &normalized)) {
+    return;
+  }
+  const int indices_size = indices.size();
+  for (int i = 0; i < indices_size; ++i) {
+    if (indices[i] >= 0 && indices[i] < size_) {
+      (*scores)[i] = std::fabs(descriptors_.col(indices[i]).dot(normalized));
+    }
+  }
+}
+
+void M2dpIndex::BestMatches(
+    const Eigen::VectorXf& query, const int start_index, const int end_index,
+    const int max_num, const double min_score,
+    std::vector<std::pair<int, double>>* const matches) const {
+  matches->clear();
+  const int start = std::max(start_index, 0);
+  const int end = std::min(end_index, size_);
+  Eigen::VectorXf normalized;
+  if (start >= end || max_num <= 0 || !NormalizeQuery(query, &normalized)) {
+    return;
+  }
+  // one product for all the frames in range
+  const Eigen::VectorXf scores =
+      descriptors_.middleCols(start, end - start).transpose() * normalized;
+  for (int i = 0; i < end - start; ++i) {
+    const double score = std::fabs(scores[i]);
+    if (score > min_score) {
+      matches->emplace_back(start + i, score);
+    }
+  }
+  const auto better = [](const std::pair<int, double>& a,
+                         const std::pair<int, double>& b) {
+    return a.second > b.second || (a.second == b.second && a.first < b.first);
+  };
+  if (static_cast<int>(matches->size()) > max_num) {
+    std::partial_sort(matches->begin(), matches->begin() + max_num,
+                      matches->end(), better);
+    matches->resize(max_num);
+  } else {
+    std::sort(matches->begin(), matches->end(), better);
+  }
+}
+
+}  // namespace descriptor
+}  // namespace static_map
@@ -0,0 +1,84 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef DESCRIPTOR_M2DP_INDEX_H_
+#define DESCRIPTOR_M2DP_INDEX_H_
+
+// third party
+#include <Eigen/Dense>
+// stl
+#include <utility>
+#include <vector>
+
+namespace static_map {
+namespace descriptor {
+
+/*
+ * @class M2dpIndex
+ * @brief the m2dp descriptors of all frames, centered and scaled to unit
+ * length in the columns of one matrix, then the score of
+ * matchTwoM2dpDescriptors() is the absolute dot product of two columns and
+ * a query is scored against many frames by one matrix product
+ */
+class M2dpIndex {
+ public:
+  M2dpIndex() : size_(0) {}
+  ~M2dpIndex() {}
+
+  M2dpIndex(const M2dpIndex&) = delete;
+  M2dpIndex& operator=(const M2dpIndex&) = delete;
+
+  /// @brief add the descriptor of the next frame
+  /// an invalid one (e.g. empty) never matches
+  /// @return its index
+  int Add(const Eigen::VectorXf& descriptor);
+  inline int Size() const { return size_; }
+
+  /// @brief the scores of the query against the frames at the indices
+  void Scores(const Eigen::VectorXf& query, const std::vector<int>& indices,
+              std::vector<double>* const scores) const;
+  /// @brief at most max_num best frames in [start_index, end_index) scored
+  /// above min_score, in the descending order of the scores
+  void BestMatches(const Eigen::VectorXf& query, const int start_index,
+                   const int end_index, const int max_num,
+                   const double min_score,
+                   std::vector<std::pair<int, double>>* const matches) const;
+
+  /// @brief center and scale to unit length
+  /// @return false if it can not be matched
+  static bool Normalize(const Eigen::VectorXf& descriptor,
+                        Eigen::VectorXf* const normalized);
+
+ private:
+  // false if the query does not fit the descriptors
+  bool NormalizeQuery(const Eigen::VectorXf& query,
+                      Eigen::VectorXf* const normalized) const;
+
+  // the first size_ columns are used, the capacity is doubled when full
+  Eigen::MatrixXf descriptors_;
+  int size_;
+};
+
+}  // namespace descriptor
+}  // namespace static_map
+
+#endif  // DESCRIPTOR_M2DP_INDEX_H_
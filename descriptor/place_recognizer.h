@@ -0,0 +1,74 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef DESCRIPTOR_PLACE_RECOGNIZER_H_
+#define DESCRIPTOR_PLACE_RECOGNIZER_H_
+
+// third party
+#include <pcl/point_cloud.h>
+// stl
+#include <vector>
+
+namespace static_map {
+namespace descriptor {
+
+/*
+ * @class PlaceRecognizer
+ * @brief the interface of the appearance based place recognition, the
+ * loop candidates are proposed by the clouds of the frames only, so they
+ * are found even if the poses drifted too much
+ */
+template <typename PointT>
+class PlaceRecognizer {
+ public:
+  using PointCloudConstPtr = typename pcl::PointCloud<PointT>::ConstPtr;
+
+  struct Candidate {
+    int index;
+    // from 0 for the same place, the smaller the more similar
+    double distance;
+    // the rotation around z from the query frame to the candidate,
+    // 0 if the descriptor does not estimate it
+    float yaw;
+  };
+
+  PlaceRecognizer() = default;
+  virtual ~PlaceRecognizer() {}
+
+  PlaceRecognizer(const PlaceRecognizer&) = delete;
+  PlaceRecognizer& operator=(const PlaceRecognizer&) = delete;
+
+  /// @brief describe the cloud of the next frame, the frames are indexed
+  /// in the order of adding
+  virtual void Add(const PointCloudConstPtr& cloud) = 0;
+  virtual int Size() const = 0;
+  /// @brief at most max_num candidates in [start_index, end_index) for the
+  /// frame at query_index, in the ascending order of the distances
+  virtual void Query(const int query_index, const int start_index,
+                     const int end_index, const int max_num,
+                     std::vector<Candidate>* const candidates) = 0;
+};
+
+}  // namespace descriptor
+}  // namespace static_map
+
+#endif  // DESCRIPTOR_PLACE_RECOGNIZER_H_
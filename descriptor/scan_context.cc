@@ -0,0 +1,234 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "descriptor/scan_context.h"
+#include "common/point_types.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace static_map {
+namespace descriptor {
+
+namespace {
+
+using ScoredIndex = std::pair<float, int>;
+
+}  // namespace
+
+template <typename PointT>
+ScanContext<PointT>::ScanContext(const ScanContextSettings& settings)
+    : settings_(settings), tree_size_(0) {
+  CHECK_GT(settings_.ring_num, 0);
+  CHECK_GT(settings_.sector_num, 0);
+  CHECK_GT(settings_.max_radius, 0.f);
+  CHECK_GT(settings_.ring_key_candidate_num, 0);
+  CHECK_GT(settings_.tree_rebuild_period, 0);
+}
+
+template <typename PointT>
+Eigen::MatrixXf ScanContext<PointT>::Describe(
+    const pcl::PointCloud<PointT>& cloud) const {
+  // the empty bins and the points lower than -lidar_height are 0
+  Eigen::MatrixXf descriptor =
+      Eigen::MatrixXf::Zero(settings_.ring_num, settings_.sector_num);
+  const float ring_step = settings_.max_radius / settings_.ring_num;
+  const float sector_step = M_PI * 2. / settings_.sector_num;
+  for (const auto& point : cloud.points) {
+    const float radius = std::sqrt(point.x * point.x + point.y * point.y);
+    if (!(radius < settings_.max_radius) || radius <= 0.f) {
+      continue;
+    }
+    const int ring = std::min(static_cast<int>(radius / ring_step),
+                              settings_.ring_num - 1);
+    const int sector = std::min(
+        static_cast<int>((std::atan2(point.y, point.x) + M_PI) / sector_step),
+        settings_.sector_num - 1);
+    float& bin = descriptor(ring, sector);
+    bin = std::max(bin, point.z + settings_.lidar_height);
+  }
+  return descriptor;
+}
+
+template <typename PointT>
+typename ScanContext<PointT>::Normalized ScanContext<PointT>::Normalize(
+    const Eigen::MatrixXf& descriptor) {
+  Normalized normalized;
+  normalized.columns = descriptor;
+  normalized.valid = Eigen::VectorXf::Zero(descriptor.cols());
+  for (int i = 0; i < descriptor.cols(); ++i) {
+    const float norm = descriptor.col(i).norm();
+    if (norm > 0.f) {
+      normalized.columns.col(i) /= norm;
+      normalized.valid[i] = 1.f;
+    }
+  }
+  return normalized;
+}
+
+template <typename PointT>
+double ScanContext<PointT>::ShiftDistance(const Normalized& a,
+                                          const Normalized& b,
+                                          float* const yaw) {
+  CHECK(yaw);
+  *yaw = 0.f;
+  const int sector_num = a.columns.cols();
+  if (a.columns.rows() != b.columns.rows() ||
+      b.columns.cols() != sector_num) {
+    return 1.;
+  }
+  // the cosines between all the columns, then the sector j of a against
+  // the sector j + shift of b is on a wrapped diagonal
+  const Eigen::MatrixXf cosines = a.columns.transpose() * b.columns;
+  const Eigen::MatrixXf valid_pairs = a.valid * b.valid.transpose();
+  double best_similarity = 0.;
+  for (int shift = 0; shift < sector_num; ++shift) {
+    double similarity = 0.;
+    double valid_num = 0.;
+    for (int j = 0; j < sector_num; ++j) {
+      const int k = (j + shift) % sector_num;
+      similarity += cosines(j, k);
+      valid_num += valid_pairs(j, k);
+    }
+    if (valid_num > 0.) {
+      similarity /= valid_num;
+    }
+    if (similarity > best_similarity) {
+      best_similarity = similarity;
+      const int signed_shift =
+          shift > sector_num / 2 ? shift - sector_num : shift;
+      *yaw = signed_shift * M_PI * 2. / sector_num;
+    }
+  }
+  return 1. - best_similarity;
+}
+
+template <typename PointT>
+double ScanContext<PointT>::Distance(const Eigen::MatrixXf& a,
+                                     const Eigen::MatrixXf& b,
+                                     float* const yaw) {
+  return ShiftDistance(Normalize(a), Normalize(b), yaw);
+}
+
+template <typename PointT>
+void ScanContext<PointT>::Add(const PointCloudConstPtr& cloud) {
+  CHECK(cloud);
+  const Eigen::MatrixXf descriptor = Describe(*cloud);
+  descriptors_.push_back(Normalize(descriptor));
+  // the mean of the rings is invariant to the rotation around z
+  const Eigen::VectorXf ring_key = descriptor.rowwise().mean();
+  ring_keys_.insert(ring_keys_.end(), ring_key.data(),
+                    ring_key.data() + ring_key.size());
+}
+
+template <typename PointT>
+void ScanContext<PointT>::RebuildTree(const int size) {
+  tree_keys_.assign(ring_keys_.begin(),
+                    ring_keys_.begin() + size * settings_.ring_num);
+  flann::Matrix<float> dataset(tree_keys_.data(), size, settings_.ring_num);
+  tree_.reset(new flann::Index<flann::L2<float>>(
+      dataset, flann::KDTreeSingleIndexParams(10)));
+  tree_->buildIndex();
+  tree_size_ = size;
+}
+
+template <typename PointT>
+void ScanContext<PointT>::Query(const int query_index, const int start_index,
+                                const int end_index, const int max_num,
+                                std::vector<Candidate>* const candidates) {
+  CHECK(candidates);
+  CHECK_GE(query_index, 0);
+  CHECK_LT(query_index, Size());
+  candidates->clear();
+  const int start = std::max(start_index, 0);
+  const int end = std::min(end_index, Size());
+  if (start >= end || max_num <= 0) {
+    return;
+  }
+  if (end - tree_size_ >= settings_.tree_rebuild_period) {
+    RebuildTree(end);
+  }
+
+  const int ring_num = settings_.ring_num;
+  float* const query_key = &ring_keys_[query_index * ring_num];
+  std::vector<ScoredIndex> nearest;
+  if (tree_size_ > 0 && start < tree_size_) {
+    // the frames out of the window are in the tree too, so they are
+    // searched in addition and dropped
+    const int outside_num = tree_size_ - (std::min(end, tree_size_) - start);
+    const int knn = std::min(tree_size_,
+                             settings_.ring_key_candidate_num + outside_num);
+    std::vector<int> indices(knn);
+    std::vector<float> distances(knn);
+    flann::Matrix<float> query(query_key, 1, ring_num);
+    flann::Matrix<int> indices_matrix(indices.data(), 1, knn);
+    flann::Matrix<float> distances_matrix(distances.data(), 1, knn);
+    const int found = tree_->knnSearch(query, indices_matrix,
+                                       distances_matrix, knn,
+                                       flann::SearchParams());
+    for (int i = 0; i < std::min(found, knn); ++i) {
+      if (indices[i] >= start && indices[i] < end) {
+        nearest.emplace_back(distances[i], indices[i]);
+      }
+    }
+  }
+  // the newer frames than the tree
+  for (int i = std::max(start, tree_size_); i < end; ++i) {
+    const Eigen::Map<const Eigen::VectorXf> key(&ring_keys_[i * ring_num],
+                                                ring_num);
+    const Eigen::Map<const Eigen::VectorXf> query(query_key, ring_num);
+    nearest.emplace_back((key - query).squaredNorm(), i);
+  }
+  const int nearest_num = std::min<int>(nearest.size(),
+                                        settings_.ring_key_candidate_num);
+  std::partial_sort(nearest.begin(), nearest.begin() + nearest_num,
+                    nearest.end());
+
+  for (int i = 0; i < nearest_num; ++i) {
+    Candidate candidate;
+    candidate.index = nearest[i].second;
+    candidate.distance =
+        ShiftDistance(descriptors_[query_index],
+                      descriptors_[candidate.index], &candidate.yaw);
+    if (candidate.distance <= settings_.max_distance) {
+      candidates->push_back(candidate);
+    }
+  }
+  std::sort(candidates->begin(), candidates->end(),
+            [](const Candidate& a, const Candidate& b) {
+              return a.distance < b.distance;
+            });
+  if (candidates->size() > static_cast<size_t>(max_num)) {
+    candidates->resize(max_num);
+  }
+}
+
+template class ScanContext<pcl::PointXYZI>;
+#ifdef _USE_COMPACT_POINT_
+template class ScanContext<PointXYZIc>;
+#endif
+
+}  // namespace descriptor
+}  // namespace static_map
@@ -0,0 +1,109 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef DESCRIPTOR_SCAN_CONTEXT_H_
+#define DESCRIPTOR_SCAN_CONTEXT_H_
+
+// third party
+#include <flann/flann.hpp>
+#include <pcl/point_types.h>
+#include <Eigen/Dense>
+// stl
+#include <memory>
+#include <vector>
+// local
+#include "descriptor/place_recognizer.h"
+
+namespace static_map {
+namespace descriptor {
+
+struct ScanContextSettings {
+  int ring_num = 20;
+  int sector_num = 60;
+  float max_radius = 80.;
+  // added to the heights, so that the points lower than the origin count
+  float lidar_height = 2.;
+  // the nearest frames by the ring keys are compared by the descriptors
+  int ring_key_candidate_num = 10;
+  // the kd tree of the ring keys is rebuilt for every this many frames,
+  // the newer frames are compared one by one
+  int tree_rebuild_period = 50;
+  // candidates farther than it are dropped, in [0, 1]
+  float max_distance = 0.2;
+};
+
+/*
+ * @class ScanContext
+ * @brief "Scan Context: Egocentric Spatial Descriptor for Place Recognition
+ * within 3D Point Cloud Map", the max heights in the bins of rings and
+ * sectors around the origin. The candidates are retrieved by the rotation
+ * invariant ring keys in a kd tree, then the descriptors are aligned by
+ * shifting the sectors, which estimates the yaw as well
+ */
+template <typename PointT>
+class ScanContext : public PlaceRecognizer<PointT> {
+ public:
+  using typename PlaceRecognizer<PointT>::PointCloudConstPtr;
+  using typename PlaceRecognizer<PointT>::Candidate;
+
+  explicit ScanContext(const ScanContextSettings& settings);
+  ~ScanContext() override {}
+
+  void Add(const PointCloudConstPtr& cloud) override;
+  inline int Size() const override { return descriptors_.size(); }
+  void Query(const int query_index, const int start_index,
+             const int end_index, const int max_num,
+             std::vector<Candidate>* const candidates) override;
+
+  /// @brief rows for the rings and columns for the sectors
+  Eigen::MatrixXf Describe(const pcl::PointCloud<PointT>& cloud) const;
+  /// @brief the distance in [0, 1] of the best shift of the sectors
+  /// @param yaw the rotation around z from a to b by the shift
+  static double Distance(const Eigen::MatrixXf& a, const Eigen::MatrixXf& b,
+                         float* const yaw);
+
+ private:
+  // the columns scaled to unit length, and 1 for the non empty ones
+  struct Normalized {
+    Eigen::MatrixXf columns;
+    Eigen::VectorXf valid;
+  };
+  static Normalized Normalize(const Eigen::MatrixXf& descriptor);
+  static double ShiftDistance(const Normalized& a, const Normalized& b,
+                              float* const yaw);
+  void RebuildTree(const int size);
+
+  ScanContextSettings settings_;
+  std::vector<Normalized> descriptors_;
+  // ring_num floats for each frame
+  std::vector<float> ring_keys_;
+
+  // built from the first tree_size_ frames, and its own copy of the keys
+  std::vector<float> tree_keys_;
+  std::unique_ptr<flann::Index<flann::L2<float>>> tree_;
+  int tree_size_;
+};
+
+}  // namespace descriptor
+}  // namespace static_map
+
+#endif  // DESCRIPTOR_SCAN_CONTEXT_H_
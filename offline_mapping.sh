@@ -0,0 +1,38 @@
+## map directly from a recorded bag without ros master and realtime playback
+## the bag is replayed as fast as the mapping pipeline can go
+BAG_FILE=~/data/test.bag
+## usally, you can just leave this config file just like this, it will work fine
+CONFIG_PATH=./config/lidar_imu_default.xml
+## if you have a urdf file that contains robot model, set it here
+## otherwise, the static transforms are read from /tf_static in the bag
+URDF_FILE=./urdf/test.urdf
+## the follow 2 items must be set!!!
+## the topic name of your pointcloud msg (ros)
+POINT_CLOUD_TOPIC=velodyne_points
+## the frame id of your pointcloud msg (ros)
+POINT_CLOUD_FRAME_ID=velodyne
+
+## the following items are optional, just the same as mapping.sh
+IMU_TOPIC=imu/raw_data
+IMU_FRAME_ID=imu_link
+
+ODOM_TOPIC=/navsat/odom
+ODOM_FRAME_ID=novatel_odom
+
+GPS_TOPIC=/navsat/fix
+GPS_FRAME_ID=novatel_imu
+
+./build/offline_mapping_node \
+  -bag ${BAG_FILE} \
+  -cfg ${CONFIG_PATH} \
+  -urdf ${URDF_FILE} \
+  -pc ${POINT_CLOUD_TOPIC} \
+  -pc_frame_id ${POINT_CLOUD_FRAME_ID} \
+  -imu ${IMU_TOPIC} \
+  -imu_frame_id ${IMU_FRAME_ID}
+  # -odom ${ODOM_TOPIC} \
+  # -odom_frame_id ${ODOM_FRAME_ID} \
+  # -gps ${GPS_TOPIC} \
+  # -gps_frame_id ${GPS_FRAME_ID} \
+
+exit 0 
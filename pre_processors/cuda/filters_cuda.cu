@@ -0,0 +1,278 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "filters_cuda.h"
+
+#include <thrust/copy.h>
+#include <thrust/device_ptr.h>
+#include <thrust/execution_policy.h>
+#include <thrust/functional.h>
+#include <thrust/iterator/zip_iterator.h>
+#include <thrust/sort.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+#include <utility>
+
+namespace static_map {
+namespace pre_processers {
+namespace cuda {
+
+namespace {
+
+constexpr int kBlockSize = 256;
+constexpr int kStreamNum = 2;
+// the points are uploaded in chunks, so the copies overlap with the kernels
+constexpr int kChunkSize = 1 << 15;
+
+inline int BlockNum(const int num) {
+  return (num + kBlockSize - 1) / kBlockSize;
+}
+
+inline bool CheckCudaError(const cudaError_t error, const char* what) {
+  if (error != cudaSuccess) {
+    fprintf(stderr, "%s: %s\n", what, cudaGetErrorString(error));
+    return false;
+  }
+  return true;
+}
+
+// the same as the one in filter_range_voxel_sampler.h
+__host__ __device__ inline uint64_t VoxelKey(const float x, const float y,
+                                             const float z) {
+  const int64_t kMask = (1ll << 21) - 1;
+  return static_cast<uint64_t>(
+      ((static_cast<int64_t>(floorf(x)) & kMask) << 42) |
+      ((static_cast<int64_t>(floorf(y)) & kMask) << 21) |
+      (static_cast<int64_t>(floorf(z)) & kMask));
+}
+
+// the finalizer of murmur3
+__host__ __device__ inline uint32_t HashIndex(const int index,
+                                              const uint32_t seed) {
+  uint32_t h = static_cast<uint32_t>(index) * 0x9e3779b9u ^ seed;
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+__global__ void SequenceKernel(int* indices, const int begin, const int num) {
+  const int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i < num) {
+    indices[begin + i] = begin + i;
+  }
+}
+
+__global__ void RangeKernel(const float4* points, const int num,
+                            const float min_range, const float max_range,
+                            uint8_t* flags) {
+  const int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= num) {
+    return;
+  }
+  const float4 p = points[i];
+  const float range = sqrtf(p.x * p.x + p.y * p.y + p.z * p.z);
+  flags[i] = range >= min_range && range <= max_range;
+}
+
+__global__ void VoxelKeyKernel(const float4* points, const int num,
+                               const float inverse_voxel_size, uint64_t* keys,
+                               int* order) {
+  const int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= num) {
+    return;
+  }
+  const float4 p = points[i];
+  keys[i] = VoxelKey(p.x * inverse_voxel_size, p.y * inverse_voxel_size,
+                     p.z * inverse_voxel_size);
+  order[i] = i;
+}
+
+// the keys are stably sorted, so the first one of a key is the first point
+// of the voxel in the cloud
+__global__ void FirstInVoxelKernel(const uint64_t* sorted_keys,
+                                   const int* order, const int num,
+                                   uint8_t* flags) {
+  const int k = blockIdx.x * blockDim.x + threadIdx.x;
+  if (k >= num) {
+    return;
+  }
+  flags[order[k]] = k == 0 || sorted_keys[k] != sorted_keys[k - 1];
+}
+
+__global__ void RandomSampleKernel(const int* indices, const int num,
+                                   const uint32_t threshold,
+                                   const uint32_t seed, uint8_t* flags) {
+  const int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i < num) {
+    flags[i] = HashIndex(indices[i], seed) <= threshold;
+  }
+}
+
+template <typename T>
+void Reallocate(T** buffer, const int num) {
+  cudaFree(*buffer);
+  cudaMalloc(buffer, num * sizeof(T));
+}
+
+}  // namespace
+
+DeviceCloud::DeviceCloud() {
+  for (auto& stream : streams_) {
+    cudaStreamCreate(&stream);
+  }
+}
+
+DeviceCloud::~DeviceCloud() {
+  for (auto& stream : streams_) {
+    cudaStreamDestroy(stream);
+  }
+  cudaFree(points_);
+  cudaFree(points_buffer_);
+  cudaFree(indices_);
+  cudaFree(indices_buffer_);
+  cudaFree(flags_);
+  cudaFree(keys_);
+  cudaFree(order_);
+  cudaFreeHost(host_points_);
+  cudaFreeHost(host_indices_);
+}
+
+float* DeviceCloud::HostPoints(const int num) {
+  if (num > host_capacity_) {
+    cudaFreeHost(host_points_);
+    cudaFreeHost(host_indices_);
+    cudaMallocHost(&host_points_, 4 * num * sizeof(float));
+    cudaMallocHost(&host_indices_, num * sizeof(int));
+    host_capacity_ = num;
+  }
+  return host_points_;
+}
+
+bool DeviceCloud::Upload(const int num) {
+  if (num > host_capacity_) {
+    fprintf(stderr, "the host points are not filled.\n");
+    return false;
+  }
+  if (num > capacity_) {
+    Reallocate(&points_, 4 * num);
+    Reallocate(&points_buffer_, 4 * num);
+    Reallocate(&indices_, num);
+    Reallocate(&indices_buffer_, num);
+    Reallocate(&flags_, num);
+    Reallocate(&keys_, num);
+    Reallocate(&order_, num);
+    capacity_ = num;
+  }
+  size_ = num;
+  for (int begin = 0, chunk = 0; begin < num; begin += kChunkSize, ++chunk) {
+    const int chunk_num = std::min(kChunkSize, num - begin);
+    cudaStream_t stream = streams_[chunk % kStreamNum];
+    cudaMemcpyAsync(points_ + 4 * begin, host_points_ + 4 * begin,
+                    4 * chunk_num * sizeof(float), cudaMemcpyHostToDevice,
+                    stream);
+    SequenceKernel<<<BlockNum(chunk_num), kBlockSize, 0, stream>>>(
+        indices_, begin, chunk_num);
+  }
+  for (auto& stream : streams_) {
+    cudaStreamSynchronize(stream);
+  }
+  return CheckCudaError(cudaGetLastError(), "upload points");
+}
+
+const int* DeviceCloud::DownloadIndices() {
+  if (size_ == 0) {
+    return host_indices_;
+  }
+  cudaMemcpyAsync(host_indices_, indices_, size_ * sizeof(int),
+                  cudaMemcpyDeviceToHost, streams_[0]);
+  if (!CheckCudaError(cudaStreamSynchronize(streams_[0]),
+                      "download indices")) {
+    return nullptr;
+  }
+  return host_indices_;
+}
+
+bool DeviceCloud::Range(const float min_range, const float max_range) {
+  if (size_ == 0) {
+    return true;
+  }
+  RangeKernel<<<BlockNum(size_), kBlockSize, 0, streams_[0]>>>(
+      reinterpret_cast<const float4*>(points_), size_, min_range, max_range,
+      flags_);
+  return Compact();
+}
+
+bool DeviceCloud::VoxelGrid(const float voxel_size) {
+  if (size_ == 0 || voxel_size <= 0.f) {
+    return true;
+  }
+  VoxelKeyKernel<<<BlockNum(size_), kBlockSize, 0, streams_[0]>>>(
+      reinterpret_cast<const float4*>(points_), size_, 1.f / voxel_size,
+      keys_, order_);
+  thrust::stable_sort_by_key(thrust::cuda::par.on(streams_[0]),
+                             thrust::device_pointer_cast(keys_),
+                             thrust::device_pointer_cast(keys_ + size_),
+                             thrust::device_pointer_cast(order_));
+  FirstInVoxelKernel<<<BlockNum(size_), kBlockSize, 0, streams_[0]>>>(
+      keys_, order_, size_, flags_);
+  return Compact();
+}
+
+bool DeviceCloud::RandomSample(const float sampling_rate,
+                               const uint32_t seed) {
+  if (size_ == 0 || sampling_rate >= 0.999f) {
+    return true;
+  }
+  // the same threshold as RangeVoxelSampler
+  const uint32_t threshold = static_cast<uint32_t>(
+      std::max(sampling_rate, 0.f) *
+      static_cast<double>(std::numeric_limits<uint32_t>::max()));
+  RandomSampleKernel<<<BlockNum(size_), kBlockSize, 0, streams_[0]>>>(
+      indices_, size_, threshold, seed, flags_);
+  return Compact();
+}
+
+bool DeviceCloud::Compact() {
+  const auto input = thrust::make_zip_iterator(thrust::make_tuple(
+      thrust::device_pointer_cast(reinterpret_cast<float4*>(points_)),
+      thrust::device_pointer_cast(indices_)));
+  const auto output = thrust::make_zip_iterator(thrust::make_tuple(
+      thrust::device_pointer_cast(reinterpret_cast<float4*>(points_buffer_)),
+      thrust::device_pointer_cast(indices_buffer_)));
+  const auto output_end = thrust::copy_if(
+      thrust::cuda::par.on(streams_[0]), input, input + size_,
+      thrust::device_pointer_cast(flags_), output,
+      thrust::identity<uint8_t>());
+  size_ = output_end - output;
+  std::swap(points_, points_buffer_);
+  std::swap(indices_, indices_buffer_);
+  return CheckCudaError(cudaGetLastError(), "compact points");
+}
+
+}  // namespace cuda
+}  // namespace pre_processers
+}  // namespace static_map
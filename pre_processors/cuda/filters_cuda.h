@@ -0,0 +1,98 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef PRE_PROCESSORS_CUDA_FILTERS_CUDA_H_
+#define PRE_PROCESSORS_CUDA_FILTERS_CUDA_H_
+
+#include <cstdint>
+
+// the same as cudaStream_t, without the cuda headers for the host code
+struct CUstream_st;
+
+namespace static_map {
+namespace pre_processers {
+namespace cuda {
+
+/*
+ * @class DeviceCloud
+ * @brief the points of a cloud and their indices in the uploaded input,
+ * resident in device memory through the gpu filters. the filters only
+ * compact the points on device, so the points are uploaded once for all
+ * the filters and only the indices of the inliers are downloaded at last.
+ * the host buffers are pinned and the copies are asynchronous
+ */
+class DeviceCloud {
+ public:
+  DeviceCloud();
+  ~DeviceCloud();
+
+  DeviceCloud(const DeviceCloud&) = delete;
+  DeviceCloud& operator=(const DeviceCloud&) = delete;
+
+  /// @brief the pinned buffer of x,y,z,w (AoS, num for each), filled by
+  /// the caller before Upload()
+  float* HostPoints(int num);
+  /// @brief upload the host points in chunks on two streams, the copy of a
+  /// chunk overlaps with the initialization of the last one
+  bool Upload(int num);
+  /// @brief the indices in the uploaded input of the current points, in
+  /// increasing order, valid until the next call of the cloud
+  const int* DownloadIndices();
+  inline int Size() const { return size_; }
+  /// @brief the stamp of the uploaded cloud, e.g. for the sampling seeds
+  inline void SetStamp(const uint64_t stamp) { stamp_ = stamp; }
+  inline uint64_t Stamp() const { return stamp_; }
+
+  // the filters, the kept points are the same as the host ones
+  bool Range(float min_range, float max_range);
+  /// @brief the first point in a voxel is kept (see RangeVoxelSampler)
+  bool VoxelGrid(float voxel_size);
+  /// @brief the points are kept by a hash of their index and the seed
+  bool RandomSample(float sampling_rate, uint32_t seed);
+
+ private:
+  // keep the points with flags_ set, in the same order
+  bool Compact();
+
+  uint64_t stamp_ = 0;
+  int size_ = 0;
+  int capacity_ = 0;
+  int host_capacity_ = 0;
+  // device buffers, the compacted points are written into the other ones
+  float* points_ = nullptr;
+  float* points_buffer_ = nullptr;
+  int* indices_ = nullptr;
+  int* indices_buffer_ = nullptr;
+  uint8_t* flags_ = nullptr;
+  uint64_t* keys_ = nullptr;
+  int* order_ = nullptr;
+  // pinned host buffers
+  float* host_points_ = nullptr;
+  int* host_indices_ = nullptr;
+  CUstream_st* streams_[2] = {nullptr, nullptr};
+};
+
+}  // namespace cuda
+}  // namespace pre_processers
+}  // namespace static_map
+
+#endif  // PRE_PROCESSORS_CUDA_FILTERS_CUDA_H_
@@ -22,17 +22,24 @@
 
 #pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
 #include <map>
 #include <memory>
+#include <numeric>
 #include <string>
 #include <vector>
 
+#include "common/metrics.h"
 // filters
+#include "pre_processors/filter_gpu.h"
 #include "pre_processors/filter_ground_removal.h"
 #include "pre_processors/filter_ground_removal2.h"
 #include "pre_processors/filter_random_sample.h"
 #include "pre_processors/filter_range.h"
 #include "pre_processors/filter_range_image.h"
+#include "pre_processors/filter_range_voxel_sampler.h"
 #include "pre_processors/filter_statistic_removal.h"
 #include "pre_processors/filter_voxel_grid.h"
 
@@ -83,10 +90,58 @@ class Factory : public Interface<PointT> {
       auto filter = it->second->CreateNewInstance();
       filter->InitFromXmlNode(filter_node);
       filters_.push_back(filter);
+#ifdef _FILTER_USE_CUDA_
+      gpu_filters_.push_back(
+          std::dynamic_pointer_cast<GpuInterface<PointT>>(filter));
+#endif
       filter->DisplayAllParams();
+      FilterStatistics statistics;
+      statistics.name = filter_name;
+      BindStatistics(filters_.size() - 1, &statistics);
+      filter_statistics_.push_back(statistics);
     }
   }
 
+  /// @brief the metrics of the filters are <prefix>.<index>_<name>.*, e.g.
+  /// "filter.0_Range.latency" by default. give the factories different ones
+  /// (e.g. with the frame id of the sensor), or they share the metrics
+  void SetMetricsPrefix(const std::string& prefix) {
+    metrics_prefix_ = prefix;
+    for (size_t f = 0; f < filter_statistics_.size(); ++f) {
+      BindStatistics(f, &filter_statistics_[f]);
+    }
+  }
+
+  /// @brief print the time cost and the point counts of every filter
+  void DisplayFilterStatistics() const {
+    for (size_t f = 0; f < filter_statistics_.size(); ++f) {
+      const auto& statistics = filter_statistics_[f];
+      const uint64_t calls = statistics.latency->Count();
+      if (calls == 0) {
+        continue;
+      }
+      const double input_points = statistics.input_points->Value();
+      const double output_points = statistics.output_points->Value();
+      XML_INFO << std::to_string(f) + "_" + statistics.name << " -> "
+               << "calls: " << calls << ", mean: " << std::fixed
+               << std::setprecision(3) << statistics.latency->Mean() * 1.e3
+               << " ms, p99: " << statistics.latency->Percentile(0.99) * 1.e3
+               << " ms, points in/out: " << std::setprecision(0)
+               << input_points / calls << "/" << output_points / calls
+               << ", buffer reallocations: "
+               << statistics.reallocations->Value() << std::endl;
+    }
+  }
+
+  /// @brief names of all filters which can be used in xml
+  std::vector<std::string> SupportedFilters() const {
+    std::vector<std::string> names;
+    for (const auto& filter : supported_filters_) {
+      names.push_back(filter.first);
+    }
+    return names;
+  }
+
   void Filter(const PointCloudPtr& cloud) override {
     if (!cloud || !Interface<PointT>::inner_cloud_) {
       LOG(WARNING) << "nullptr cloud, do nothing!" << std::endl;
@@ -100,23 +155,136 @@ class Factory : public Interface<PointT> {
     }
 
     // use all filters in order
-    PointCloudPtr middle_poindcloud1(new PointCloudType);
-    PointCloudPtr middle_poindcloud2(new PointCloudType);
-    *middle_poindcloud1 = *(this->inner_cloud_);
-    for (auto filter : filters_) {
-      filter->SetInputCloud(middle_poindcloud1);
-      filter->Filter(middle_poindcloud2);
-      // @todo copy but not directly =
-      *middle_poindcloud1 = *middle_poindcloud2;
+    // the input is never copied, every filter writes into one of the two
+    // reusable buffers and reads the output of last filter, the buffers are
+    // swapped but not copied. only the final output is moved into cloud
+    if (!input_buffer_) {
+      input_buffer_.reset(new PointCloudType);
+      output_buffer_.reset(new PointCloudType);
     }
-    *cloud = *middle_poindcloud2;
+    // inliers of the whole chain, indices of the original input
+    const int input_size = this->inner_cloud_->size();
+    this->ChainBegin(input_size);
+
+    PointCloudPtr filter_input = this->inner_cloud_;
+    for (size_t f = 0; f < filters_.size();) {
+      output_buffer_->clear();
+      const size_t capacity = output_buffer_->points.capacity();
+      // the filters [f, end) are used in this step, their inliers are
+      // indices of the input of f
+      size_t end = f + 1;
+      const std::vector<int>* filter_inliers = nullptr;
+      const std::vector<float>* filter_normals = nullptr;
+#ifdef _FILTER_USE_CUDA_
+      if (gpu_filters_[f]) {
+        end = FilterOnDevice(f, filter_input);
+        filter_inliers = &device_inliers_;
+      }
+#endif
+      if (!filter_inliers) {
+        auto& filter = filters_[f];
+        auto& statistics = filter_statistics_[f];
+        const size_t filter_input_size = filter_input->size();
+        {
+          common::ScopedLatency latency(statistics.latency);
+          filter->SetInputCloud(filter_input);
+          filter->Filter(output_buffer_);
+        }
+        statistics.input_points->Add(filter_input_size);
+        statistics.output_points->Add(output_buffer_->size());
+        filter_inliers = &filter->Inliers();
+        filter_normals = &filter->Normals();
+      }
+      if (output_buffer_->points.capacity() != capacity) {
+        filter_statistics_[end - 1].reallocations->Add();
+      }
+      this->ChainStage(*filter_inliers, filter_normals,
+                       output_buffer_->size());
+      input_buffer_.swap(output_buffer_);
+      filter_input = input_buffer_;
+      f = end;
+    }
+
+    // move the result out, the buffer keeps the capacity of cloud
+    cloud->points.swap(input_buffer_->points);
+    cloud->width = cloud->points.size();
+    cloud->height = 1;
+    cloud->is_dense = input_buffer_->is_dense;
+    this->ChainEnd(input_size);
   }
 
  protected:
   void RegisterSupportedFilters();
 
  private:
+#ifdef _FILTER_USE_CUDA_
+  // the run of gpu filters from first shares the device cloud, the input
+  // is uploaded and the inliers are downloaded only once for all of them
+  // (the copies are not counted in the latencies of the filters)
+  // @return the end of the run
+  size_t FilterOnDevice(const size_t first, const PointCloudPtr& input) {
+    using GpuFilter = GpuInterface<PointT>;
+    if (!device_cloud_) {
+      device_cloud_.reset(new cuda::DeviceCloud);
+    }
+    bool all_right = GpuFilter::Upload(*input, device_cloud_.get());
+    size_t end = first;
+    for (; end < filters_.size() && gpu_filters_[end]; ++end) {
+      auto& statistics = filter_statistics_[end];
+      const int filter_input_size = device_cloud_->Size();
+      {
+        common::ScopedLatency latency(statistics.latency);
+        all_right = all_right &&
+                    gpu_filters_[end]->FilterOnDevice(device_cloud_.get());
+      }
+      statistics.input_points->Add(filter_input_size);
+      statistics.output_points->Add(device_cloud_->Size());
+    }
+    output_buffer_->header = input->header;
+    if (!all_right || !GpuFilter::Download(*input, device_cloud_.get(),
+                                           output_buffer_, &device_inliers_)) {
+      LOG(ERROR) << "gpu filters failed, the cloud is not filtered."
+                 << std::endl;
+      *output_buffer_ = *input;
+      device_inliers_.resize(input->size());
+      std::iota(device_inliers_.begin(), device_inliers_.end(), 0);
+    }
+    return end;
+  }
+
+#endif
   std::vector<std::shared_ptr<Interface<PointT>>> filters_;
+#ifdef _FILTER_USE_CUDA_
+  // nullptr for the filters on host, in the same order of filters_
+  std::vector<std::shared_ptr<GpuInterface<PointT>>> gpu_filters_;
+  std::unique_ptr<cuda::DeviceCloud> device_cloud_;
+  std::vector<int> device_inliers_;
+#endif
+  // metrics of each filter, in the same order of filters_
+  struct FilterStatistics {
+    std::string name;
+    common::Histogram* latency;
+    common::Counter* input_points;
+    common::Counter* output_points;
+    // times the output buffer grew, the allocations inside the filters
+    // are not counted
+    common::Counter* reallocations;
+  };
+  void BindStatistics(const size_t index, FilterStatistics* statistics) const {
+    const std::string prefix = metrics_prefix_ + "." + std::to_string(index) +
+                               "_" + statistics->name;
+    auto* const metrics = common::MetricsRegistry::Get();
+    statistics->latency = metrics->GetHistogram(prefix + ".latency");
+    statistics->input_points = metrics->GetCounter(prefix + ".input_points");
+    statistics->output_points = metrics->GetCounter(prefix + ".output_points");
+    statistics->reallocations = metrics->GetCounter(prefix + ".reallocations");
+  }
+
+  std::string metrics_prefix_ = "filter";
+  std::vector<FilterStatistics> filter_statistics_;
+  // reusable buffers between filters
+  PointCloudPtr input_buffer_;
+  PointCloudPtr output_buffer_;
   std::map<std::string, std::shared_ptr<Interface<PointT>>> supported_filters_;
 };
 
@@ -131,10 +299,19 @@ void Factory<PointT>::RegisterSupportedFilters() {
   supported_filters_.emplace("GroundRemoval2",
                              std::make_shared<GroundRemoval2<PointT>>());
   supported_filters_.emplace("Range", std::make_shared<Range<PointT>>());
+  supported_filters_.emplace("RangeVoxelSampler",
+                             std::make_shared<RangeVoxelSampler<PointT>>());
   supported_filters_.emplace("StatisticRemoval",
                              std::make_shared<StatisticRemoval<PointT>>());
   supported_filters_.emplace("VoxelGrid",
                              std::make_shared<VoxelGrid<PointT>>());
+#ifdef _FILTER_USE_CUDA_
+  supported_filters_.emplace("RangeGpu", std::make_shared<RangeGpu<PointT>>());
+  supported_filters_.emplace("VoxelGridGpu",
+                             std::make_shared<VoxelGridGpu<PointT>>());
+  supported_filters_.emplace("RandomSamplerGpu",
+                             std::make_shared<RandomSamplerGpu<PointT>>());
+#endif
 }
 
 }  // namespace filter
@@ -0,0 +1,218 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "common/macro_defines.h"
+#include "pre_processors/filter_interface.h"
+
+#ifdef _FILTER_USE_CUDA_
+#include "pre_processors/cuda/filters_cuda.h"
+#endif
+
+namespace static_map {
+namespace pre_processers {
+namespace filter {
+
+#ifdef _FILTER_USE_CUDA_
+
+/*
+ * @class GpuInterface
+ * @brief the filters running on device. the consecutive ones in Factory
+ * share one device cloud, so the points are uploaded once for all of them
+ * and only the indices of the inliers are downloaded
+ */
+template <typename PointT>
+class GpuInterface : public Interface<PointT> {
+ public:
+  USE_POINTCLOUD;
+
+  GpuInterface() : Interface<PointT>() {}
+  ~GpuInterface() {}
+  GpuInterface(const GpuInterface &) = delete;
+  GpuInterface &operator=(const GpuInterface &) = delete;
+
+  /// @brief filter the points of the device cloud in place
+  virtual bool FilterOnDevice(cuda::DeviceCloud *device) = 0;
+
+  void Filter(const PointCloudPtr &cloud) override {
+    if (!cloud || !Interface<PointT>::inner_cloud_) {
+      LOG(WARNING) << "nullptr cloud, do nothing!" << std::endl;
+      return;
+    }
+
+    this->FilterPrepare(cloud);
+    if (!device_) {
+      device_.reset(new cuda::DeviceCloud);
+    }
+    const auto &input = *this->inner_cloud_;
+    if (!Upload(input, device_.get()) || !FilterOnDevice(device_.get()) ||
+        !Download(input, device_.get(), cloud, &this->inliers_)) {
+      LOG(ERROR) << "gpu filter failed, the cloud is not filtered."
+                 << std::endl;
+      *cloud = input;
+      this->inliers_.resize(input.size());
+      for (size_t i = 0; i < input.size(); ++i) {
+        this->inliers_[i] = i;
+      }
+      return;
+    }
+    // the inliers are in increasing order
+    const int size = input.size();
+    this->outliers_.reserve(size - this->inliers_.size());
+    size_t inlier_index = 0;
+    for (int i = 0; i < size; ++i) {
+      if (inlier_index < this->inliers_.size() &&
+          this->inliers_[inlier_index] == i) {
+        ++inlier_index;
+      } else {
+        this->outliers_.push_back(i);
+      }
+    }
+  }
+
+  /// @brief copy the points into the pinned buffer and upload them
+  static bool Upload(const PointCloudType &input, cuda::DeviceCloud *device) {
+    const int size = input.size();
+    float *const points = device->HostPoints(size);
+    for (int i = 0; i < size; ++i) {
+      points[4 * i] = input.points[i].x;
+      points[4 * i + 1] = input.points[i].y;
+      points[4 * i + 2] = input.points[i].z;
+      points[4 * i + 3] = 0.f;
+    }
+    device->SetStamp(input.header.stamp);
+    return device->Upload(size);
+  }
+
+  /// @brief the points kept on device are copied from the input on host,
+  /// so all the fields of the points are kept
+  static bool Download(const PointCloudType &input, cuda::DeviceCloud *device,
+                       const PointCloudPtr &cloud, std::vector<int> *inliers) {
+    const int *const indices = device->DownloadIndices();
+    if (!indices) {
+      return false;
+    }
+    inliers->assign(indices, indices + device->Size());
+    cloud->points.reserve(inliers->size());
+    for (const int i : *inliers) {
+      cloud->push_back(input.points[i]);
+    }
+    return true;
+  }
+
+ private:
+  std::unique_ptr<cuda::DeviceCloud> device_;
+};
+
+/// @class RangeGpu
+/// @brief the same as Range, on device
+template <typename PointT>
+class RangeGpu : public GpuInterface<PointT> {
+ public:
+  RangeGpu() : GpuInterface<PointT>(), min_range_(0.), max_range_(100.) {
+    // float params
+    INIT_INNER_PARAM(Interface<PointT>::kFloatParam, 0, "min_range",
+                     min_range_);
+    INIT_INNER_PARAM(Interface<PointT>::kFloatParam, 1, "max_range",
+                     max_range_);
+  }
+
+  std::shared_ptr<Interface<PointT>> CreateNewInstance() override {
+    return std::make_shared<RangeGpu<PointT>>();
+  }
+
+  bool FilterOnDevice(cuda::DeviceCloud *device) override {
+    return device->Range(min_range_, max_range_);
+  }
+
+  void DisplayAllParams() override {
+    PARAM_INFO(min_range_);
+    PARAM_INFO(max_range_);
+  }
+
+ private:
+  float min_range_;
+  float max_range_;
+};
+
+/// @class VoxelGridGpu
+/// @brief the first point in a voxel is kept, the same as the voxel grid
+/// of RangeVoxelSampler
+template <typename PointT>
+class VoxelGridGpu : public GpuInterface<PointT> {
+ public:
+  VoxelGridGpu() : GpuInterface<PointT>(), voxel_size_(0.1) {
+    INIT_INNER_PARAM(Interface<PointT>::kFloatParam, 0, "voxel_size",
+                     voxel_size_);
+  }
+
+  std::shared_ptr<Interface<PointT>> CreateNewInstance() override {
+    return std::make_shared<VoxelGridGpu<PointT>>();
+  }
+
+  bool FilterOnDevice(cuda::DeviceCloud *device) override {
+    return device->VoxelGrid(voxel_size_);
+  }
+
+  void DisplayAllParams() override { PARAM_INFO(voxel_size_); }
+
+ private:
+  float voxel_size_;
+};
+
+/// @class RandomSamplerGpu
+/// @brief every point is kept in the sampling rate, by a hash of its index
+/// with a new seed for every cloud (see common::RandomSeed)
+template <typename PointT>
+class RandomSamplerGpu : public GpuInterface<PointT> {
+ public:
+  RandomSamplerGpu()
+      : GpuInterface<PointT>(), sampling_rate_(1.) {
+    INIT_INNER_PARAM(Interface<PointT>::kFloatParam, 0, "sampling_rate",
+                     sampling_rate_);
+  }
+
+  std::shared_ptr<Interface<PointT>> CreateNewInstance() override {
+    return std::make_shared<RandomSamplerGpu<PointT>>();
+  }
+
+  bool FilterOnDevice(cuda::DeviceCloud *device) override {
+    // a hardware seed, or by the stamp in the deterministic mode
+    return device->RandomSample(sampling_rate_,
+                                common::RandomSeed(device->Stamp()));
+  }
+
+  void DisplayAllParams() override { PARAM_INFO(sampling_rate_); }
+
+ private:
+  float sampling_rate_;
+};
+
+#endif  // _FILTER_USE_CUDA_
+
+}  // namespace filter
+}  // namespace pre_processers
+}  // namespace static_map
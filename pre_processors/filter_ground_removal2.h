@@ -29,7 +29,7 @@
 #include <utility>
 #include <vector>
 
-#include "common/simple_thread_pool.h"
+#include "common/shared_executor.h"
 #include "pre_processors/filter_interface.h"
 
 // implementation of paper
@@ -83,10 +83,22 @@ class GroundRemoval2 : public Interface<PointT> {
   // search other segments to find matched line
   float search_angle_;  // degree
 
+  // max parallelism on the shared executor
   int32_t thread_num_;
 
+  struct InnerPoint {
+    int s_index;
+    int b_index;
+    Point point;  // d, z
+    int cloud_index;
+  };
+
+  // storages reused between scans
   // point to a 2d array
   std::vector<Grid> grids_;
+  std::vector<Segment> segments_;
+  std::vector<InnerPoint> inner_points_;
+  std::vector<uint8_t> is_outlier_;
 
  public:
   GroundRemoval2()
@@ -152,32 +164,24 @@ class GroundRemoval2 : public Interface<PointT> {
     }
     // step1 initialise
     this->inner_cloud_ = cloud;
-    // init the grids
-    grids_.clear();
-    Grid default_grid_value;
-    default_grid_value.min_z_point[0] = 1.e6;
-    default_grid_value.min_z_point[1] = 1.e6;
-    grids_.resize(bin_num_ * segment_num_, default_grid_value);
+    // init the grids, only allocated once, then reset in place
+    grids_.resize(bin_num_ * segment_num_);
+    for (auto& grid : grids_) {
+      grid.min_z_point[0] = 1.e6;
+      grid.min_z_point[1] = 1.e6;
+      grid.points.clear();
+    }
 
     const float double_pi = M_PI * 2;
     const float delta_alpha = double_pi / segment_num_;
     const float delta_bin = (r_max_ - r_min_) / bin_num_;
 
     const int size = this->inner_cloud_->size();
-    struct InnerPoint {
-      int s_index;
-      int b_index;
-      Point point;  // d, z
-      int cloud_index;
-    };
-    std::vector<InnerPoint> inner_points;
+    auto& inner_points = inner_points_;
     inner_points.resize(size);
 
-// step2 insert the cloud into grids
-#if defined _OPENMP
-#pragma omp parallel for num_threads(LOCAL_OMP_THREADS_NUM)
-#endif
-    for (int i = 0; i < size; ++i) {
+    // step2 insert the cloud into grids
+    common::ParallelFor(0, size, thread_num_, [&](const int i) {
       auto& point = this->inner_cloud_->points[i];
       float range = std::sqrt(point.x * point.x + point.y * point.y);
       if (range < r_min_ && range > r_max_) {
@@ -208,7 +212,7 @@ class GroundRemoval2 : public Interface<PointT> {
         inner_points[i].point[0] = range;
         inner_points[i].point[1] = point.z;
       }
-    }
+    });
 
     for (auto& inner_point : inner_points) {
       if (inner_point.s_index < 0) {
@@ -235,14 +239,14 @@ class GroundRemoval2 : public Interface<PointT> {
     }
     // step1 prepare
     this->FilterPrepare(cloud);
-    std::vector<Segment> segments;
-    segments.resize(segment_num_);
-    FitSegments(&segments);
+    segments_.resize(segment_num_);
+    FitSegments(&segments_);
 
     // step2 cluster ( ground )
     auto cloud_size = this->inner_cloud_->size();
-    std::vector<uint8_t> is_outlier(cloud_size, 0);
-    ClusterGround(segments, &is_outlier);
+    auto& is_outlier = is_outlier_;
+    is_outlier.assign(cloud_size, 0);
+    ClusterGround(segments_, &is_outlier);
 
     // step3 manage inliers and outliers
     for (int i = 0; i < cloud_size; ++i) {
@@ -276,10 +280,11 @@ class GroundRemoval2 : public Interface<PointT> {
   }
 
  protected:
-  Segment FitLines(const int32_t& seg_index) {
+  void FitLines(const int32_t& seg_index, Segment* const segment_ptr) {
     CHECK(seg_index >= 0 && seg_index < segment_num_);
 
-    Segment segment;
+    Segment& segment = *segment_ptr;
+    segment.clear();
     int start_index = 0;
     for (start_index = 0; start_index < bin_num_; ++start_index) {
       if (!grids_[GridIndex(seg_index, start_index)].points.empty()) {
@@ -287,7 +292,7 @@ class GroundRemoval2 : public Interface<PointT> {
       }
     }
     if (start_index >= bin_num_ - 1) {
-      return std::move(segment);
+      return;
     }
 
     std::vector<Point> current_line_points;
@@ -351,27 +356,12 @@ class GroundRemoval2 : public Interface<PointT> {
       auto new_line = FitLocalLine(current_line_points);
       segment.push_back(LocalLineToLine(new_line, current_line_points));
     }
-
-    return std::move(segment);
   }
 
   void FitSegments(std::vector<Segment>* const segments) {
-    auto calculate_in_one_thread = [&](const int& index) {
-      (*segments)[index] = FitLines(index);
-    };
-#if defined _OPENMP
-// openmp version
-#pragma omp parallel for num_threads(LOCAL_OMP_THREADS_NUM)
-    for (int i = 0; i < segment_num_; ++i) {
-      calculate_in_one_thread(i);
-    }
-#else
-    // thread pool version
-    common::ThreadPool pool(thread_num_);
-    for (int i = 0; i < segment_num_; ++i) {
-      pool.enqueue(calculate_in_one_thread, i);
-    }
-#endif
+    common::ParallelFor(0, segment_num_, thread_num_, [&](const int index) {
+      FitLines(index, &(*segments)[index]);
+    });
   }
 
   void ClusterGround(const std::vector<Segment>& segments,
@@ -385,9 +375,8 @@ class GroundRemoval2 : public Interface<PointT> {
       segment_index_candidate.push_back(-i);
     }
 
-    // using thread pool to accelerate
-    auto pool = std::make_shared<common::ThreadPool>(thread_num_);
-    auto calculate_in_one_thread = [&](const int& s /* seg_index */) {
+    // using the shared executor to accelerate
+    auto calculate_in_one_thread = [&](const int s /* seg_index */) {
       for (int b = 0; b < bin_num_; ++b) {
         auto grid_index = GridIndex(s, b);
         auto& grid = grids_[grid_index];
@@ -427,12 +416,7 @@ class GroundRemoval2 : public Interface<PointT> {
       }    // loop for bins
     };
 
-    for (int i = 0; i < segment_num_; ++i) {
-      pool->enqueue(calculate_in_one_thread, i);
-    }
-    // reset the shared pointer to destroy the thread pool
-    // the destrcutor will wait for all threads then return
-    pool.reset();
+    common::ParallelFor(0, segment_num_, thread_num_, calculate_in_one_thread);
   }
 
   float VerticalDistanceToSegment(const Point& point, const Segment& seg) {
@@ -22,8 +22,11 @@
 
 #pragma once
 
+#include <algorithm>
 #include <memory>
+#include <numeric>
 #include <string>
+#include <vector>
 
 #include "pre_processors/processor_interface.h"
 
@@ -87,7 +90,80 @@ class Interface : public ProcesserInterface<PointT> {
     cloud->header = input->header;
     this->inliers_.clear();
     this->outliers_.clear();
+    this->normals_.clear();
   }
+
+ protected:
+  // the bookkeeping of a chain of filters (Factory, Pipeline): the inliers
+  // are indices of the chain input and follow the points through every
+  // stage, the normals follow the points or come from the last stage which
+  // provides them
+  void ChainBegin(const int input_size) {
+    chain_indices_valid_ = true;
+    this->inliers_.resize(input_size);
+    std::iota(this->inliers_.begin(), this->inliers_.end(), 0);
+  }
+
+  /// @param stage_inliers indices of the stage input, in output order
+  /// @param stage_normals normals of the stage output, can be nullptr
+  /// @param output_size the point count of the stage output
+  void ChainStage(const std::vector<int>& stage_inliers,
+                  const std::vector<float>* stage_normals,
+                  const size_t output_size) {
+    if (stage_normals && stage_normals->size() == 3 * output_size) {
+      this->normals_.assign(stage_normals->begin(), stage_normals->end());
+    } else if (!this->normals_.empty() &&
+               stage_inliers.size() == output_size) {
+      chain_normals_buffer_.resize(3 * output_size);
+      for (size_t i = 0; i < output_size; ++i) {
+        for (int j = 0; j < 3; ++j) {
+          chain_normals_buffer_[3 * i + j] =
+              this->normals_[3 * stage_inliers[i] + j];
+        }
+      }
+      this->normals_.swap(chain_normals_buffer_);
+    } else {
+      this->normals_.clear();
+    }
+    if (chain_indices_valid_ && stage_inliers.size() == output_size) {
+      chain_indices_buffer_.resize(output_size);
+      for (size_t i = 0; i < output_size; ++i) {
+        chain_indices_buffer_[i] = this->inliers_[stage_inliers[i]];
+      }
+      this->inliers_.swap(chain_indices_buffer_);
+    } else {
+      // e.g. the output points are not a subset of the input
+      chain_indices_valid_ = false;
+    }
+  }
+
+  /// @brief fills the outliers, or clears the inliers if any stage
+  /// did not provide them
+  void ChainEnd(const int input_size) {
+    if (!chain_indices_valid_) {
+      this->inliers_.clear();
+      return;
+    }
+    // the inliers keep the order of the output points, e.g. to map
+    // per-point attributes, only a sorted copy is used for the outliers
+    chain_indices_buffer_.assign(this->inliers_.begin(), this->inliers_.end());
+    std::sort(chain_indices_buffer_.begin(), chain_indices_buffer_.end());
+    this->outliers_.reserve(input_size - chain_indices_buffer_.size());
+    size_t inlier_index = 0;
+    for (int i = 0; i < input_size; ++i) {
+      if (inlier_index < chain_indices_buffer_.size() &&
+          chain_indices_buffer_[inlier_index] == i) {
+        ++inlier_index;
+      } else {
+        this->outliers_.push_back(i);
+      }
+    }
+  }
+
+ private:
+  bool chain_indices_valid_ = true;
+  std::vector<int> chain_indices_buffer_;
+  std::vector<float> chain_normals_buffer_;
 };
 
 }  // namespace filter
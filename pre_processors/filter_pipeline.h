@@ -0,0 +1,251 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "pre_processors/filter_interface.h"
+
+namespace static_map {
+namespace pre_processers {
+namespace filter {
+
+namespace pipeline_internal {
+
+// a filter is point-wise if it provides
+//   void PointWiseBegin(const PointCloudType& input);
+//   bool IsInlier(const PointT& point);
+// then the consecutive point-wise filters are fused into one loop
+template <typename FilterT>
+struct IsPointWise {
+ private:
+  using PointCloudType = typename FilterT::PointCloudType;
+  using PointT = typename PointCloudType::PointType;
+
+  template <typename U>
+  static auto Test(int) -> decltype(
+      std::declval<U&>().PointWiseBegin(std::declval<const PointCloudType&>()),
+      std::declval<U&>().IsInlier(std::declval<const PointT&>()),
+      std::true_type());
+  template <typename U>
+  static std::false_type Test(...);
+
+ public:
+  static constexpr bool value = decltype(Test<FilterT>(0))::value;
+};
+
+// the end index of the run of point-wise filters starting from I
+template <typename Stages, size_t I,
+          bool = (I < std::tuple_size<Stages>::value)>
+struct PointWiseEnd : std::integral_constant<size_t, I> {};
+
+template <typename Stages, size_t I>
+struct PointWiseEnd<Stages, I, true>
+    : std::conditional<
+          IsPointWise<typename std::tuple_element<I, Stages>::type>::value,
+          PointWiseEnd<Stages, I + 1>,
+          std::integral_constant<size_t, I>>::type {};
+
+// the fused predicates of filters [I, J)
+template <typename Stages, size_t I, size_t J>
+struct PointWiseChain {
+  template <typename PointCloudType>
+  static void Begin(Stages& stages, const PointCloudType& input) {
+    std::get<I>(stages).PointWiseBegin(input);
+    PointWiseChain<Stages, I + 1, J>::Begin(stages, input);
+  }
+
+  template <typename PointT>
+  static inline bool IsInlier(Stages& stages, const PointT& point) {
+    return std::get<I>(stages).IsInlier(point) &&
+           PointWiseChain<Stages, I + 1, J>::IsInlier(stages, point);
+  }
+};
+
+template <typename Stages, size_t J>
+struct PointWiseChain<Stages, J, J> {
+  template <typename PointCloudType>
+  static void Begin(Stages&, const PointCloudType&) {}
+
+  template <typename PointT>
+  static inline bool IsInlier(Stages&, const PointT&) {
+    return true;
+  }
+};
+
+}  // namespace pipeline_internal
+
+/// @class Pipeline
+/// @brief a filter chain fixed at compile time, e.g.
+///   Pipeline<pcl::PointXYZI, Range, RangeVoxelSampler, GroundRemoval2>
+/// all filters are called without virtual dispatch and the loops of the
+/// consecutive point-wise filters are fused. the params are read from the
+/// <filter> nodes in the same order as the template arguments.
+/// the inliers, outliers and normals are chained the same way as the
+/// Factory. the Factory stays the default for the configurable chains.
+template <typename PointT, template <typename> class... Filters>
+class Pipeline : public Interface<PointT> {
+ public:
+  USE_POINTCLOUD;
+  using Stages = std::tuple<Filters<PointT>...>;
+  static constexpr size_t kStageNum = sizeof...(Filters);
+
+  Pipeline()
+      : Interface<PointT>(),
+        input_buffer_(new PointCloudType),
+        output_buffer_(new PointCloudType) {}
+  ~Pipeline() = default;
+
+  Pipeline(const Pipeline&) = delete;
+  Pipeline& operator=(const Pipeline&) = delete;
+
+  std::shared_ptr<Interface<PointT>> CreateNewInstance() override {
+    return std::make_shared<Pipeline<PointT, Filters...>>();
+  }
+
+  void InitFromXmlNode(const pugi::xml_node& filters_node) {
+    std::vector<pugi::xml_node> filter_nodes;
+    for (auto filter_node = filters_node.child("filter"); filter_node;
+         filter_node = filter_node.next_sibling("filter")) {
+      filter_nodes.push_back(filter_node);
+    }
+    CHECK_EQ(filter_nodes.size(), kStageNum)
+        << "the filters in xml do not match the pipeline";
+    InitStages<0>(filter_nodes, IsLast<0>());
+  }
+
+  void Filter(const PointCloudPtr& cloud) override {
+    if (!cloud || !Interface<PointT>::inner_cloud_) {
+      LOG(WARNING) << "nullptr cloud, do nothing!" << std::endl;
+      return;
+    }
+
+    this->FilterPrepare(cloud);
+    if (kStageNum == 0) {
+      *cloud = *this->inner_cloud_;
+      return;
+    }
+    const int input_size = this->inner_cloud_->size();
+    this->ChainBegin(input_size);
+    RunFrom<0>(this->inner_cloud_, IsLast<0>());
+    // move the result out, the buffers are reused by next scan
+    cloud->points.swap(result_->points);
+    cloud->width = cloud->points.size();
+    cloud->height = 1;
+    cloud->is_dense = result_->is_dense;
+    result_.reset();
+    this->ChainEnd(input_size);
+  }
+
+  void DisplayAllParams() override { DisplayStages<0>(IsLast<0>()); }
+
+  Stages& GetStages() { return stages_; }
+
+ private:
+  template <size_t I>
+  using IsLast = std::integral_constant<bool, I == kStageNum>;
+  template <size_t I>
+  using IsPointWise = std::integral_constant<
+      bool, pipeline_internal::IsPointWise<
+                typename std::tuple_element<I, Stages>::type>::value>;
+
+  template <size_t I>
+  void InitStages(const std::vector<pugi::xml_node>&, std::true_type) {}
+  template <size_t I>
+  void InitStages(const std::vector<pugi::xml_node>& nodes, std::false_type) {
+    XML_INFO << "Init pipeline filter: " << nodes[I].attribute("name").value()
+             << std::endl;
+    std::get<I>(stages_).InitFromXmlNode(nodes[I]);
+    InitStages<I + 1>(nodes, IsLast<I + 1>());
+  }
+
+  template <size_t I>
+  void DisplayStages(std::true_type) {}
+  template <size_t I>
+  void DisplayStages(std::false_type) {
+    std::get<I>(stages_).DisplayAllParams();
+    DisplayStages<I + 1>(IsLast<I + 1>());
+  }
+
+  template <size_t I>
+  void RunFrom(const PointCloudPtr& input, std::true_type) {
+    result_ = input;
+  }
+  template <size_t I>
+  void RunFrom(const PointCloudPtr& input, std::false_type) {
+    output_buffer_->clear();
+    output_buffer_->header = input->header;
+    RunStage<I>(input, IsPointWise<I>());
+  }
+
+  // a normal filter
+  template <size_t I>
+  void RunStage(const PointCloudPtr& input, std::false_type) {
+    auto& filter = std::get<I>(stages_);
+    filter.SetInputCloud(input);
+    filter.Filter(output_buffer_);
+    this->ChainStage(filter.Inliers(), &filter.Normals(),
+                     output_buffer_->size());
+    input_buffer_.swap(output_buffer_);
+    RunFrom<I + 1>(input_buffer_, IsLast<I + 1>());
+  }
+
+  // point-wise filters [I, J) in one loop
+  template <size_t I>
+  void RunStage(const PointCloudPtr& input, std::true_type) {
+    constexpr size_t J = pipeline_internal::PointWiseEnd<Stages, I>::value;
+    using Chain = pipeline_internal::PointWiseChain<Stages, I, J>;
+    Chain::Begin(stages_, *input);
+    const int input_size = input->size();
+    output_buffer_->points.reserve(input_size);
+    stage_inliers_.clear();
+    stage_inliers_.reserve(input_size);
+    for (int i = 0; i < input_size; ++i) {
+      const auto& point = input->points[i];
+      if (Chain::IsInlier(stages_, point)) {
+        output_buffer_->push_back(point);
+        stage_inliers_.push_back(i);
+      }
+    }
+    this->ChainStage(stage_inliers_, nullptr, output_buffer_->size());
+    input_buffer_.swap(output_buffer_);
+    RunFrom<J>(input_buffer_, IsLast<J>());
+  }
+
+  Stages stages_;
+  // reusable buffers between the stages
+  PointCloudPtr input_buffer_;
+  PointCloudPtr output_buffer_;
+  // the output of last stage, only valid in Filter()
+  PointCloudPtr result_;
+  // inliers of a run of point-wise filters, indices of the run input
+  std::vector<int> stage_inliers_;
+};
+
+}  // namespace filter
+}  // namespace pre_processers
+}  // namespace static_map
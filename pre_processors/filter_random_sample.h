@@ -26,6 +26,7 @@
 #include <memory>
 #include <random>
 
+#include "common/macro_defines.h"
 #include "pre_processors/filter_interface.h"
 
 namespace static_map {
@@ -67,8 +68,8 @@ class RandomSampler : public Interface<PointT> {
     // can not be optimized to multi-thread version
     this->FilterPrepare(cloud);
     const int int_sample_rate = sampling_rate_ * 1000;
-    std::random_device rand_dev;   // obtain a random number from hardware
-    std::mt19937 eng(rand_dev());  // seed the generator
+    // a hardware seed, or by the stamp in the deterministic mode
+    std::mt19937 eng(common::RandomSeed(this->inner_cloud_->header.stamp));
     std::uniform_int_distribution<> distr(0, 1000);  // define the range
 
     auto& input = this->inner_cloud_;
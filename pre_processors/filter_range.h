@@ -63,14 +63,7 @@ class Range : public Interface<PointT> {
 #pragma omp parallel for num_threads(LOCAL_OMP_THREADS_NUM)
 #endif
     for (int i = 0; i < size; ++i) {
-      auto &point = this->inner_cloud_->points[i];
-      float range =
-          std::sqrt(point.x * point.x + point.y * point.y + point.z * point.z);
-      if (range >= min_range_ && range <= max_range_) {
-        is_inlier[i] = true;
-      } else {
-        is_inlier[i] = false;
-      }
+      is_inlier[i] = IsInlier(this->inner_cloud_->points[i]);
     }
 
     // first, reserve
@@ -93,6 +86,14 @@ class Range : public Interface<PointT> {
     cloud->points.shrink_to_fit();
   }
 
+  /// @brief point-wise interface, used by Pipeline to fuse the loops
+  void PointWiseBegin(const PointCloudType &) {}
+  inline bool IsInlier(const PointT &point) const {
+    const float range =
+        std::sqrt(point.x * point.x + point.y * point.y + point.z * point.z);
+    return range >= min_range_ && range <= max_range_;
+  }
+
   void DisplayAllParams() override {
     PARAM_INFO(min_range_);
     PARAM_INFO(max_range_);
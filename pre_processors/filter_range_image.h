@@ -27,12 +27,9 @@
 #include <algorithm>
 #include <map>
 #include <memory>
-#include <queue>
-#include <unordered_map>
 #include <utility>
 #include <vector>
 
-#include "common/eigen_hash.h"
 #include "pre_processors/filter_interface.h"
 
 namespace static_map {
@@ -44,17 +41,7 @@ class RangeImage : public Interface<PointT> {
  public:
   USE_POINTCLOUD;
 
-  struct Pixel {
-    float range = 0.;
-    int32_t index = -1;  // index in raw point cloud
-    uint32_t label = 0;  // label from depth cluster
-
-    Pixel() {}
-    Pixel(const float &r, const int32_t &i, uint32_t l = 0)
-        : range(r), index(i), label(l) {}
-  };
   using Index = Eigen::Vector2i;
-  using MapRangeImage = std::unordered_map<Index, Pixel, std::hash<Index>>;
   using MatrixRangeImage = Eigen::MatrixXf;
   using LabelT = uint32_t;
 
@@ -69,7 +56,8 @@ class RangeImage : public Interface<PointT> {
         offset_y_(0.f),
         offset_z_(0.f),
         vertical_line_num_(40),
-        horizontal_line_num_(1800) {
+        horizontal_line_num_(1800),
+        output_normals_(0) {
     neighbors_.push_back(Index(0, 1));
     neighbors_.push_back(Index(0, -1));
     neighbors_.push_back(Index(0, 2));
@@ -90,6 +78,8 @@ class RangeImage : public Interface<PointT> {
                      vertical_line_num_);
     INIT_INNER_PARAM(Interface<PointT>::kInt32Param, 1, "horizontal_line_num",
                      horizontal_line_num_);
+    INIT_INNER_PARAM(Interface<PointT>::kInt32Param, 2, "output_normals",
+                     output_normals_);
   }
   ~RangeImage() {}
   RangeImage(const RangeImage &) = delete;
@@ -110,9 +100,19 @@ class RangeImage : public Interface<PointT> {
     }
 
     this->inner_cloud_ = cloud;
-    map_image_.clear();
-    matrix_image_.resize(vertical_line_num_, horizontal_line_num_);
+    // the images are only reallocated if the size changed
+    const int pixel_num = vertical_line_num_ * horizontal_line_num_;
+    if (matrix_image_.rows() != vertical_line_num_ ||
+        matrix_image_.cols() != horizontal_line_num_) {
+      matrix_image_.resize(vertical_line_num_, horizontal_line_num_);
+      index_image_.resize(pixel_num);
+      label_image_.resize(pixel_num);
+      parents_.resize(pixel_num);
+    }
     matrix_image_.setZero();
+    std::fill(index_image_.begin(), index_image_.end(), -1);
+    std::fill(label_image_.begin(), label_image_.end(), 0u);
+    clusters_.clear();
   }
 
   void Filter(const PointCloudPtr &cloud) override {
@@ -122,77 +122,191 @@ class RangeImage : public Interface<PointT> {
     }
 
     this->FilterPrepare(cloud);
-    const float image_horizontal_res =
-        M_PI * 2 / static_cast<float>(horizontal_line_num_);
-    const float image_vertical_res = (top_angle_ - btm_angle_) /
-                                     static_cast<float>(vertical_line_num_) /
-                                     180.f * M_PI;
 
-    int row_index = 0;
-    int col_index = 0;
-    float vertical_rad = 0.;
-    float horizontal_rad = 0.;
-    float range = 0.;
+    // 1. project all points in parallel, -1 for invalid pixels
     const auto &input_cloud = this->inner_cloud_;
-    for (int i = 0; i < input_cloud->size(); ++i) {
-      auto point = input_cloud->points[i];
-      point.x += offset_x_;
-      point.y += offset_y_;
-      point.z += offset_z_;
-      float distance_in_xy = std::sqrt(point.x * point.x + point.y * point.y);
-      if (distance_in_xy < 0.01f) {
+    const int size = input_cloud->size();
+    pixel_of_points_.resize(size);
+    range_of_points_.resize(size);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(LOCAL_OMP_THREADS_NUM)
+#endif
+    for (int i = 0; i < size; ++i) {
+      pixel_of_points_[i] = Project(input_cloud->points[i],
+                                    &range_of_points_[i]);
+    }
+
+    // 2. fill the image in order, the first point in a pixel wins
+    this->inliers_.reserve(size);
+    this->outliers_.reserve(size);
+    for (int i = 0; i < size; ++i) {
+      const int pixel = pixel_of_points_[i];
+      if (pixel < 0 || index_image_[pixel] >= 0) {
         this->outliers_.push_back(i);
         continue;
       }
-      vertical_rad = std::atan2(point.z, distance_in_xy);
-      row_index =
-          (vertical_rad - btm_angle_ / 180.f * M_PI) / image_vertical_res;
-      if (row_index < 0 || row_index >= vertical_line_num_) {
-        this->outliers_.push_back(i);
+      index_image_[pixel] = i;
+      matrix_image_(pixel / horizontal_line_num_,
+                    pixel % horizontal_line_num_) = range_of_points_[i];
+      this->inliers_.push_back(i);
+    }
+    cloud->points.reserve(this->inliers_.size());
+    for (auto &i : this->inliers_) {
+      cloud->push_back(input_cloud->points[i]);
+    }
+    if (output_normals_ > 0) {
+      EstimateNormals();
+    }
+  }
+
+  // the normal of each inlier is the cross product of its tangents in the
+  // image, along the row and along the column. the neighbours (circular in
+  // the row) are only used if they are on the same surface, the normal is
+  // (0, 0, 0) if a tangent can not be found. it costs O(1) per point
+  // instead of the k nearest search of the registrators
+  void EstimateNormals() {
+    const int row_num = vertical_line_num_;
+    const int col_num = horizontal_line_num_;
+    const float image_horizontal_res =
+        M_PI * 2 / static_cast<float>(horizontal_line_num_);
+    const float image_vertical_res = (top_angle_ - btm_angle_) /
+                                     static_cast<float>(vertical_line_num_) /
+                                     180. * M_PI;
+    const Eigen::Vector3f offset(offset_x_, offset_y_, offset_z_);
+    const int size = this->inliers_.size();
+    this->normals_.assign(3 * size, 0.f);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(LOCAL_OMP_THREADS_NUM)
+#endif
+    for (int k = 0; k < size; ++k) {
+      const int pixel = pixel_of_points_[this->inliers_[k]];
+      const int row = pixel / col_num;
+      const int col = pixel % col_num;
+      const int next_col = row * col_num + (col + 1) % col_num;
+      const int last_col = row * col_num + (col + col_num - 1) % col_num;
+      const int next_row = row + 1 < row_num ? pixel + col_num : -1;
+      const int last_row = row > 0 ? pixel - col_num : -1;
+      Eigen::Vector3f horizontal;
+      Eigen::Vector3f vertical;
+      if (!Tangent(pixel, next_col, last_col, image_horizontal_res,
+                   &horizontal) ||
+          !Tangent(pixel, next_row, last_row, image_vertical_res,
+                   &vertical)) {
         continue;
       }
-      horizontal_rad = std::atan2(point.y, point.x);
-      if (horizontal_rad < 0.f) {
-        horizontal_rad += M_PI * 2;
-      }
-      col_index = std::lround(horizontal_rad / image_horizontal_res);
-      if (col_index >= horizontal_line_num_) col_index -= horizontal_line_num_;
-      if (col_index < 0 || col_index >= horizontal_line_num_) {
-        this->outliers_.push_back(i);
+      Eigen::Vector3f normal = horizontal.cross(vertical);
+      const float norm = normal.norm();
+      if (norm < 1.e-6) {
         continue;
       }
-
-      if (matrix_image_(row_index, col_index) < 1.e-6) {
-        range = std::sqrt(point.x * point.x + point.y * point.y +
-                          point.z * point.z);
-        matrix_image_(row_index, col_index) = range;
-        map_image_[Index(row_index, col_index)] = Pixel(range, i);
-        this->inliers_.push_back(i);
-      } else {
-        this->outliers_.push_back(i);
+      normal /= norm;
+      // towards the sensor
+      const Eigen::Vector3f ray =
+          PointOfPixel(pixel).getVector3fMap() + offset;
+      if (normal.dot(ray) > 0.f) {
+        normal = -normal;
+      }
+      for (int j = 0; j < 3; ++j) {
+        this->normals_[3 * k + j] = normal[j];
       }
-    }
-    for (auto &i : this->inliers_) {
-      cloud->push_back(input_cloud->points[i]);
     }
   }
 
+  // connected component labeling with union-find, two passes:
+  // 1. in-row connections, rows in parallel
+  // 2. connections between rows
+  // the result is the same as flood fill from each unlabeled pixel
   void DepthCluster(const LabeledPointCloudPtr &cloud = nullptr) {
     CHECK(this->inner_cloud_ != nullptr);
-    LabelT label = 1;
-    for (int row = 0; row < vertical_line_num_; ++row) {
-      for (int col = 0; col < horizontal_line_num_; ++col) {
-        if (matrix_image_(row, col) < 1.e-6) {
+    const int row_num = vertical_line_num_;
+    const int col_num = horizontal_line_num_;
+    CHECK_EQ(matrix_image_.rows(), row_num);
+    CHECK_EQ(matrix_image_.cols(), col_num);
+    const float image_horizontal_res =
+        M_PI * 2 / static_cast<float>(horizontal_line_num_);
+    const float image_vertical_res = (top_angle_ - btm_angle_) /
+                                     static_cast<float>(vertical_line_num_) /
+                                     180. * M_PI;
+    for (int i = 0; i < row_num * col_num; ++i) {
+      parents_[i] = i;
+    }
+
+    // only the positive steps are needed for undirected connections
+    std::vector<int> in_row_steps;
+    std::vector<int> cross_row_steps;
+    for (const auto &step : neighbors_) {
+      if (step[0] == 0 && step[1] > 0) {
+        in_row_steps.push_back(step[1]);
+      } else if (step[0] > 0 && step[1] == 0) {
+        cross_row_steps.push_back(step[0]);
+      }
+    }
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(LOCAL_OMP_THREADS_NUM)
+#endif
+    for (int row = 0; row < row_num; ++row) {
+      for (int col = 0; col < col_num; ++col) {
+        const float range = matrix_image_(row, col);
+        if (range < 1.e-6) {
           continue;
         }
-        if (map_image_.at(Index(row, col)).label > 0) {
+        for (const int step : in_row_steps) {
+          // the columns are circular
+          const int neighbor_col = (col + step) % col_num;
+          const float neighbor_range = matrix_image_(row, neighbor_col);
+          if (neighbor_range > 1.e-6 &&
+              IsSameSegment(range, neighbor_range, image_horizontal_res)) {
+            // unions only touch the pixels in this row
+            Union(row * col_num + col, row * col_num + neighbor_col);
+          }
+        }
+      }
+    }
+
+    for (int row = 0; row < row_num; ++row) {
+      for (int col = 0; col < col_num; ++col) {
+        const float range = matrix_image_(row, col);
+        if (range < 1.e-6) {
           continue;
         }
-        LabelOneComponent(label, Index(row, col));
-        label++;
-        max_label_ = label;
+        for (const int step : cross_row_steps) {
+          const int neighbor_row = row + step;
+          if (neighbor_row >= row_num) {
+            continue;
+          }
+          const float neighbor_range = matrix_image_(neighbor_row, col);
+          if (neighbor_range > 1.e-6 &&
+              IsSameSegment(range, neighbor_range, image_vertical_res)) {
+            Union(row * col_num + col, neighbor_row * col_num + col);
+          }
+        }
+      }
+    }
+
+    // labels in the order of the first pixel of each component
+    LabelT label = 1;
+    for (int pixel = 0; pixel < row_num * col_num; ++pixel) {
+      if (index_image_[pixel] < 0) {
+        continue;
+      }
+      const int root = Find(pixel);
+      if (label_image_[root] == 0) {
+        label_image_[root] = label++;
       }
+      label_image_[pixel] = label_image_[root];
+      clusters_[label_image_[pixel]].push_back(index_image_[pixel]);
     }
+    max_label_ = label;
+    // small clusters are ignored
+    for (auto it = clusters_.begin(); it != clusters_.end();) {
+      if (it->second.size() < 20) {
+        it = clusters_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+
     if (cloud) {
       for (auto &cluster : clusters_) {
         auto &indices = cluster.second;
@@ -209,6 +323,49 @@ class RangeImage : public Interface<PointT> {
     }
   }
 
+  /// @brief the pixel (row * cols + col) of the point with the offsets and
+  /// its range, -1 if it is out of the image
+  /// @notice it only reads the parameters, so it is thread-safe
+  int Project(PointT point, float *range) const {
+    const float image_horizontal_res =
+        M_PI * 2 / static_cast<float>(horizontal_line_num_);
+    const float image_vertical_res = (top_angle_ - btm_angle_) /
+                                     static_cast<float>(vertical_line_num_) /
+                                     180.f * M_PI;
+    point.x += offset_x_;
+    point.y += offset_y_;
+    point.z += offset_z_;
+    const float distance_in_xy =
+        std::sqrt(point.x * point.x + point.y * point.y);
+    if (distance_in_xy < 0.01f) {
+      return -1;
+    }
+    const float vertical_rad = std::atan2(point.z, distance_in_xy);
+    const int row_index =
+        (vertical_rad - btm_angle_ / 180.f * M_PI) / image_vertical_res;
+    if (row_index < 0 || row_index >= vertical_line_num_) {
+      return -1;
+    }
+    float horizontal_rad = std::atan2(point.y, point.x);
+    if (horizontal_rad < 0.f) {
+      horizontal_rad += M_PI * 2;
+    }
+    int col_index = std::lround(horizontal_rad / image_horizontal_res);
+    if (col_index >= horizontal_line_num_) col_index -= horizontal_line_num_;
+    if (col_index < 0 || col_index >= horizontal_line_num_) {
+      return -1;
+    }
+    *range = std::sqrt(distance_in_xy * distance_in_xy + point.z * point.z);
+    return row_index * horizontal_line_num_ + col_index;
+  }
+
+  // the images of last Filter(), row major as (row * cols + col)
+  int32_t Rows() const { return vertical_line_num_; }
+  int32_t Cols() const { return horizontal_line_num_; }
+  /// @brief index in raw point cloud of each pixel, -1 if empty
+  const std::vector<int32_t> &IndexImage() const { return index_image_; }
+  const MatrixRangeImage &Image() const { return matrix_image_; }
+
   void DisplayAllParams() override {
     PARAM_INFO(top_angle_);
     PARAM_INFO(btm_angle_);
@@ -217,6 +374,7 @@ class RangeImage : public Interface<PointT> {
     PARAM_INFO(offset_z_);
     PARAM_INFO(vertical_line_num_);
     PARAM_INFO(horizontal_line_num_);
+    PARAM_INFO(output_normals_);
   }
 
   void ToPng(const float &max_range, const char *filename,
@@ -290,69 +448,61 @@ class RangeImage : public Interface<PointT> {
   }
 
  protected:
-  void LabelOneComponent(LabelT label, Index index) {
-    std::queue<Index> labeling_queue;
-    std::vector<int> indices;
-    labeling_queue.push(index);
-
-    int row_num = matrix_image_.rows();
-    int col_num = matrix_image_.cols();
-    CHECK_EQ(row_num, vertical_line_num_);
-    CHECK_EQ(col_num, horizontal_line_num_);
-
-    const float image_horizontal_res =
-        M_PI * 2 / static_cast<float>(horizontal_line_num_);
-    const float image_vertical_res = (top_angle_ - btm_angle_) /
-                                     static_cast<float>(vertical_line_num_) /
-                                     180. * M_PI;
-
-    while (!labeling_queue.empty()) {
-      const Index current = labeling_queue.front();
-      labeling_queue.pop();
-      if (matrix_image_(current[0], current[1]) < 1.e-6 ||
-          map_image_.at(current).label > 0) {
-        continue;
-      }
+  // the angle between the laser beam and the line of the two points
+  inline float SegmentAngle(const float range1, const float range2,
+                            const float alpha) const {
+    const float d1 = std::max(range1, range2);
+    const float d2 = std::min(range1, range2);
+    return std::atan2(d2 * std::sin(alpha), (d1 - d2 * std::cos(alpha)));
+  }
 
-      map_image_.at(current).label = label;
-      CHECK_GE(map_image_.at(current).index, 0);
-      indices.push_back(map_image_.at(current).index);
-      for (const auto &step : neighbors_) {
-        Index neighbor = current + step;
-        if (neighbor[0] < 0 || neighbor[0] >= row_num) {
-          continue;
-        }
-        if (neighbor[1] < 0) {
-          neighbor[1] += col_num;
-        } else if (neighbor[1] >= col_num) {
-          neighbor[1] -= col_num;
-        }
+  inline bool IsSameSegment(const float range1, const float range2,
+                            const float alpha) const {
+    return SegmentAngle(range1, range2, alpha) > segmentation_rad_threshold_;
+  }
 
-        if (matrix_image_(neighbor[0], neighbor[1]) < 1.e-6 ||
-            map_image_.at(neighbor).label > 0) {
-          continue;
-        }
+  inline const PointT &PointOfPixel(const int pixel) const {
+    return this->inner_cloud_->points[index_image_[pixel]];
+  }
 
-        float d1 = std::max(matrix_image_(current[0], current[1]),
-                            matrix_image_(neighbor[0], neighbor[1]));
-        float d2 = std::min(matrix_image_(current[0], current[1]),
-                            matrix_image_(neighbor[0], neighbor[1]));
+  // the tangent at pixel from the neighbour pixels forward and backward
+  // (-1 if out of the image), one side is enough
+  bool Tangent(const int pixel, const int forward, const int backward,
+               const float alpha, Eigen::Vector3f *const tangent) const {
+    const float range = range_of_points_[index_image_[pixel]];
+    const auto is_valid = [&](const int neighbor) {
+      return neighbor >= 0 && index_image_[neighbor] >= 0 &&
+             SegmentAngle(range, range_of_points_[index_image_[neighbor]],
+                          alpha) > normal_rad_threshold_;
+    };
+    const bool forward_valid = is_valid(forward);
+    const bool backward_valid = is_valid(backward);
+    if (!forward_valid && !backward_valid) {
+      return false;
+    }
+    *tangent =
+        PointOfPixel(forward_valid ? forward : pixel).getVector3fMap() -
+        PointOfPixel(backward_valid ? backward : pixel).getVector3fMap();
+    return true;
+  }
 
-        float alpha = 0.;
-        if (step[0] == 0) {
-          alpha = image_horizontal_res;
-        } else {
-          alpha = image_vertical_res;
-        }
-        float beta =
-            std::atan2(d2 * std::sin(alpha), (d1 - d2 * std::cos(alpha)));
-        if (beta > segmentation_rad_threshold_) {
-          labeling_queue.push(neighbor);
-        }
-      }
+  int Find(int pixel) {
+    while (parents_[pixel] != pixel) {
+      // path halving
+      parents_[pixel] = parents_[parents_[pixel]];
+      pixel = parents_[pixel];
     }
-    if (indices.size() >= 20) {
-      clusters_[label] = std::move(indices);
+    return pixel;
+  }
+
+  // the smaller index is always the root
+  void Union(const int pixel1, const int pixel2) {
+    const int root1 = Find(pixel1);
+    const int root2 = Find(pixel2);
+    if (root1 < root2) {
+      parents_[root2] = root1;
+    } else if (root2 < root1) {
+      parents_[root1] = root2;
     }
   }
 
@@ -367,14 +517,26 @@ class RangeImage : public Interface<PointT> {
   float offset_z_;
   int32_t vertical_line_num_;
   int32_t horizontal_line_num_;
+  // > 0 to estimate the normals of the output points, see Normals()
+  int32_t output_normals_;
 
-  // inner storages
-  MapRangeImage map_image_;
+  // inner storages, reused between scans
   MatrixRangeImage matrix_image_;
+  // index in raw point cloud of each pixel, -1 if empty
+  std::vector<int32_t> index_image_;
+  // label from depth cluster, 0 if not labeled
+  std::vector<LabelT> label_image_;
+  // union-find parents of each pixel
+  std::vector<int> parents_;
+  std::vector<int> pixel_of_points_;
+  std::vector<float> range_of_points_;
 
   std::vector<Index> neighbors_;
   const float segmentation_rad_threshold_ = 10 / 180. * M_PI;
-  LabelT max_label_;
+  // lower than the one of segmentation to keep the grazing ground, only
+  // the depth jumps are not the same surface
+  const float normal_rad_threshold_ = 2 / 180. * M_PI;
+  LabelT max_label_ = 0;
 
   std::map<LabelT, std::vector<int> /*index*/> clusters_;
 };
@@ -0,0 +1,169 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <random>
+#include <unordered_set>
+
+#include "common/macro_defines.h"
+#include "pre_processors/filter_interface.h"
+
+namespace static_map {
+namespace pre_processers {
+namespace filter {
+
+/// @class RangeVoxelSampler
+/// @brief Range + VoxelGrid + RandomSampler in a single pass
+/// it uses the same param names as the separated filters, the first point
+/// in a voxel is kept (voxel_size <= 0 disables the voxel grid)
+template <typename PointT>
+class RangeVoxelSampler : public Interface<PointT> {
+ public:
+  USE_POINTCLOUD;
+
+  RangeVoxelSampler()
+      : Interface<PointT>(),
+        min_range_(0.),
+        max_range_(100.),
+        voxel_size_(0.),
+        sampling_rate_(1.) {
+    // float params
+    INIT_INNER_PARAM(Interface<PointT>::kFloatParam, 0, "min_range",
+                     min_range_);
+    INIT_INNER_PARAM(Interface<PointT>::kFloatParam, 1, "max_range",
+                     max_range_);
+    INIT_INNER_PARAM(Interface<PointT>::kFloatParam, 2, "voxel_size",
+                     voxel_size_);
+    INIT_INNER_PARAM(Interface<PointT>::kFloatParam, 3, "sampling_rate",
+                     sampling_rate_);
+  }
+  ~RangeVoxelSampler() = default;
+  RangeVoxelSampler(const RangeVoxelSampler&) = delete;
+  RangeVoxelSampler& operator=(const RangeVoxelSampler&) = delete;
+
+  std::shared_ptr<Interface<PointT>> CreateNewInstance() override {
+    return std::make_shared<RangeVoxelSampler<PointT>>();
+  }
+
+  void Filter(const PointCloudPtr& cloud) override {
+    if (!cloud || !Interface<PointT>::inner_cloud_) {
+      LOG(WARNING) << "nullptr cloud, do nothing!" << std::endl;
+      return;
+    }
+
+    this->FilterPrepare(cloud);
+    const auto& input = this->inner_cloud_;
+    const int size = input->size();
+    PointWiseBegin(*input);
+    this->inliers_.reserve(size);
+    this->outliers_.reserve(size);
+    cloud->points.reserve(size);
+    for (int i = 0; i < size; ++i) {
+      const auto& point = input->points[i];
+      if (IsInlier(point)) {
+        this->inliers_.push_back(i);
+        cloud->push_back(point);
+      } else {
+        this->outliers_.push_back(i);
+      }
+    }
+  }
+
+  /// @brief point-wise interface, used by Pipeline to fuse the loops
+  /// PointWiseBegin should be called before every scan
+  void PointWiseBegin(const PointCloudType& input) {
+    min_range_squared_ = min_range_ * min_range_;
+    max_range_squared_ = max_range_ * max_range_;
+    inverse_voxel_size_ = voxel_size_ > 0. ? 1. / voxel_size_ : 0.;
+    // compare with the raw 32-bit output of mt19937, no distribution needed
+    sampling_threshold_ = static_cast<uint64_t>(
+        std::max(sampling_rate_, 0.f) *
+        static_cast<double>(std::numeric_limits<uint32_t>::max()));
+    // a new seed per scan, by the stamp in the deterministic mode
+    if (sampling_rate_ < 0.999) {
+      engine_.seed(common::RandomSeed(input.header.stamp));
+    }
+    // the hash table keeps its buckets between scans
+    occupied_voxels_.clear();
+    if (voxel_size_ > 0.) {
+      occupied_voxels_.reserve(input.size());
+    }
+  }
+
+  inline bool IsInlier(const PointT& point) {
+    const float range_squared =
+        point.x * point.x + point.y * point.y + point.z * point.z;
+    if (range_squared < min_range_squared_ ||
+        range_squared > max_range_squared_) {
+      return false;
+    }
+    if (voxel_size_ > 0. &&
+        !occupied_voxels_
+             .insert(VoxelKey(point.x * inverse_voxel_size_,
+                              point.y * inverse_voxel_size_,
+                              point.z * inverse_voxel_size_))
+             .second) {
+      return false;
+    }
+    return sampling_rate_ >= 0.999 || engine_() <= sampling_threshold_;
+  }
+
+  void DisplayAllParams() override {
+    PARAM_INFO(min_range_);
+    PARAM_INFO(max_range_);
+    PARAM_INFO(voxel_size_);
+    PARAM_INFO(sampling_rate_);
+  }
+
+ private:
+  // 21 bits for each axis
+  static int64_t VoxelKey(const float x, const float y, const float z) {
+    constexpr int64_t kMask = (1ll << 21) - 1;
+    return ((static_cast<int64_t>(std::floor(x)) & kMask) << 42) |
+           ((static_cast<int64_t>(std::floor(y)) & kMask) << 21) |
+           (static_cast<int64_t>(std::floor(z)) & kMask);
+  }
+
+  float min_range_;
+  float max_range_;
+  float voxel_size_;
+  float sampling_rate_;
+
+  // updated in PointWiseBegin
+  float min_range_squared_ = 0.;
+  float max_range_squared_ = 0.;
+  float inverse_voxel_size_ = 0.;
+  uint64_t sampling_threshold_ = 0u;
+
+  std::mt19937 engine_;
+  std::unordered_set<int64_t> occupied_voxels_;
+};
+
+}  // namespace filter
+}  // namespace pre_processers
+}  // namespace static_map
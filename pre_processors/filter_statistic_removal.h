@@ -22,10 +22,14 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cmath>
 #include <memory>
+#include <vector>
 
 #include "pcl/filters/statistical_outlier_removal.h"
 #include "pre_processors/filter_interface.h"
+#include "pre_processors/filter_range_image.h"
 
 namespace static_map {
 namespace pre_processers {
@@ -36,12 +40,43 @@ class StatisticRemoval : public Interface<PointT> {
  public:
   USE_POINTCLOUD;
 
-  StatisticRemoval() : Interface<PointT>(), point_num_meank_(30), std_mul_(1.) {
+  StatisticRemoval()
+      : Interface<PointT>(),
+        point_num_meank_(30),
+        std_mul_(1.),
+        organized_(0),
+        window_half_width_(3),
+        window_half_height_(1),
+        top_angle_(30.),
+        btm_angle_(-15.),
+        offset_x_(0.f),
+        offset_y_(0.f),
+        offset_z_(0.f),
+        vertical_line_num_(40),
+        horizontal_line_num_(1800) {
     // float params
     INIT_INNER_PARAM(Interface<PointT>::kFloatParam, 0, "std_mul", std_mul_);
+    // same as RangeImage, only used in organized mode
+    INIT_INNER_PARAM(Interface<PointT>::kFloatParam, 1, "top_angle",
+                     top_angle_);
+    INIT_INNER_PARAM(Interface<PointT>::kFloatParam, 2, "btm_angle",
+                     btm_angle_);
+    INIT_INNER_PARAM(Interface<PointT>::kFloatParam, 3, "offset_x", offset_x_);
+    INIT_INNER_PARAM(Interface<PointT>::kFloatParam, 4, "offset_y", offset_y_);
+    INIT_INNER_PARAM(Interface<PointT>::kFloatParam, 5, "offset_z", offset_z_);
     // int32_t params
     INIT_INNER_PARAM(Interface<PointT>::kInt32Param, 0, "point_num_meank",
                      point_num_meank_);
+    INIT_INNER_PARAM(Interface<PointT>::kInt32Param, 1, "organized",
+                     organized_);
+    INIT_INNER_PARAM(Interface<PointT>::kInt32Param, 2, "window_half_width",
+                     window_half_width_);
+    INIT_INNER_PARAM(Interface<PointT>::kInt32Param, 3, "window_half_height",
+                     window_half_height_);
+    INIT_INNER_PARAM(Interface<PointT>::kInt32Param, 4, "vertical_line_num",
+                     vertical_line_num_);
+    INIT_INNER_PARAM(Interface<PointT>::kInt32Param, 5, "horizontal_line_num",
+                     horizontal_line_num_);
   }
   ~StatisticRemoval() {}
   StatisticRemoval(const StatisticRemoval &) = delete;
@@ -58,6 +93,10 @@ class StatisticRemoval : public Interface<PointT> {
     }
 
     this->FilterPrepare(cloud);
+    if (organized_) {
+      OrganizedFilter(cloud);
+      return;
+    }
     pcl::StatisticalOutlierRemoval<PointT> sor;
     sor.setInputCloud(this->inner_cloud_);
     sor.setMeanK(point_num_meank_);
@@ -70,11 +109,179 @@ class StatisticRemoval : public Interface<PointT> {
   void DisplayAllParams() override {
     PARAM_INFO(point_num_meank_);
     PARAM_INFO(std_mul_);
+    PARAM_INFO(organized_);
+    if (organized_) {
+      PARAM_INFO(window_half_width_);
+      PARAM_INFO(window_half_height_);
+      PARAM_INFO(top_angle_);
+      PARAM_INFO(btm_angle_);
+      PARAM_INFO(offset_x_);
+      PARAM_INFO(offset_y_);
+      PARAM_INFO(offset_z_);
+      PARAM_INFO(vertical_line_num_);
+      PARAM_INFO(horizontal_line_num_);
+    }
+  }
+
+ protected:
+  // the neighbors are the points in a (2w+1)x(2h+1) window of the range
+  // image instead of knn from a kd-tree, then the same statistics as pcl.
+  // the points not in the image (e.g. sharing a pixel) are kept
+  void OrganizedFilter(const PointCloudPtr &cloud) {
+    range_image_.SetValue("top_angle", top_angle_);
+    range_image_.SetValue("btm_angle", btm_angle_);
+    range_image_.SetValue("offset_x", offset_x_);
+    range_image_.SetValue("offset_y", offset_y_);
+    range_image_.SetValue("offset_z", offset_z_);
+    range_image_.SetValue("vertical_line_num", vertical_line_num_);
+    range_image_.SetValue("horizontal_line_num", horizontal_line_num_);
+    range_image_.SetInputCloud(this->inner_cloud_);
+    if (!range_image_buffer_) {
+      range_image_buffer_.reset(new PointCloudType);
+    }
+    range_image_.Filter(range_image_buffer_);
+
+    const int rows = range_image_.Rows();
+    const int cols = range_image_.Cols();
+    const int pixel_num = rows * cols;
+    const auto &index_image = range_image_.IndexImage();
+    const auto &points = this->inner_cloud_->points;
+    // SoA of the pixels, row major
+    xs_.assign(pixel_num, 0.f);
+    ys_.assign(pixel_num, 0.f);
+    zs_.assign(pixel_num, 0.f);
+    valid_.assign(pixel_num, 0.f);
+    for (int i = 0; i < pixel_num; ++i) {
+      if (index_image[i] >= 0) {
+        const auto &point = points[index_image[i]];
+        xs_[i] = point.x;
+        ys_[i] = point.y;
+        zs_[i] = point.z;
+        valid_[i] = 1.f;
+      }
+    }
+
+    // sliding window, the inner loops go along the columns with fixed
+    // offsets, so they are contiguous and vectorized by the compiler
+    distance_sums_.assign(pixel_num, 0.f);
+    neighbor_counts_.assign(pixel_num, 0.f);
+    const int half_width = std::max(window_half_width_, 0);
+    const int half_height = std::max(window_half_height_, 0);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(LOCAL_OMP_THREADS_NUM)
+#endif
+    for (int row = 0; row < rows; ++row) {
+      float *const sums = &distance_sums_[row * cols];
+      float *const counts = &neighbor_counts_[row * cols];
+      const float *const x = &xs_[row * cols];
+      const float *const y = &ys_[row * cols];
+      const float *const z = &zs_[row * cols];
+      const float *const valid = &valid_[row * cols];
+      for (int dr = -half_height; dr <= half_height; ++dr) {
+        const int neighbor_row = row + dr;
+        if (neighbor_row < 0 || neighbor_row >= rows) {
+          continue;
+        }
+        for (int dc = -half_width; dc <= half_width; ++dc) {
+          if (dr == 0 && dc == 0) {
+            continue;
+          }
+          // the columns are circular, split into 2 contiguous parts
+          const int shift = (dc % cols + cols) % cols;
+          const int offset = neighbor_row * cols;
+          AccumulateDistances(x, y, z, valid, &xs_[offset + shift],
+                              &ys_[offset + shift], &zs_[offset + shift],
+                              &valid_[offset + shift], cols - shift, sums,
+                              counts);
+          AccumulateDistances(x + cols - shift, y + cols - shift,
+                              z + cols - shift, valid + cols - shift,
+                              &xs_[offset], &ys_[offset], &zs_[offset],
+                              &valid_[offset], shift, sums + cols - shift,
+                              counts + cols - shift);
+        }
+      }
+    }
+
+    // mean distances and their statistics
+    double sum = 0.;
+    double sq_sum = 0.;
+    int valid_num = 0;
+    for (int i = 0; i < pixel_num; ++i) {
+      if (valid_[i] > 0.f && neighbor_counts_[i] > 0.f) {
+        distance_sums_[i] /= neighbor_counts_[i];
+        sum += distance_sums_[i];
+        sq_sum += distance_sums_[i] * distance_sums_[i];
+        ++valid_num;
+      }
+    }
+    if (valid_num <= 1) {
+      *cloud = *this->inner_cloud_;
+      return;
+    }
+    const double mean = sum / valid_num;
+    const double variance =
+        (sq_sum - sum * sum / valid_num) / static_cast<double>(valid_num - 1);
+    const double distance_threshold =
+        mean + std_mul_ * std::sqrt(std::max(variance, 0.));
+
+    // isolated pixels or large mean distance
+    is_outlier_.assign(points.size(), 0);
+    for (int i = 0; i < pixel_num; ++i) {
+      if (valid_[i] > 0.f && (neighbor_counts_[i] <= 0.f ||
+                              distance_sums_[i] > distance_threshold)) {
+        is_outlier_[index_image[i]] = 1;
+      }
+    }
+    this->inliers_.reserve(points.size());
+    cloud->points.reserve(points.size());
+    for (size_t i = 0; i < points.size(); ++i) {
+      if (is_outlier_[i]) {
+        this->outliers_.push_back(i);
+      } else {
+        this->inliers_.push_back(i);
+        cloud->push_back(points[i]);
+      }
+    }
+  }
+
+  static inline void AccumulateDistances(
+      const float *x, const float *y, const float *z, const float *valid,
+      const float *nx, const float *ny, const float *nz, const float *nvalid,
+      const int size, float *sums, float *counts) {
+    for (int i = 0; i < size; ++i) {
+      const float dx = x[i] - nx[i];
+      const float dy = y[i] - ny[i];
+      const float dz = z[i] - nz[i];
+      const float weight = valid[i] * nvalid[i];
+      sums[i] += weight * std::sqrt(dx * dx + dy * dy + dz * dz);
+      counts[i] += weight;
+    }
   }
 
  private:
   int32_t point_num_meank_;
   float std_mul_;
+
+  // organized mode
+  int32_t organized_;
+  int32_t window_half_width_;
+  int32_t window_half_height_;
+  // params of the range image
+  float top_angle_;
+  float btm_angle_;
+  float offset_x_;
+  float offset_y_;
+  float offset_z_;
+  int32_t vertical_line_num_;
+  int32_t horizontal_line_num_;
+
+  // storages reused between scans
+  RangeImage<PointT> range_image_;
+  PointCloudPtr range_image_buffer_;
+  std::vector<float> xs_, ys_, zs_, valid_;
+  std::vector<float> distance_sums_;
+  std::vector<float> neighbor_counts_;
+  std::vector<uint8_t> is_outlier_;
 };
 
 }  // namespace filter
@@ -50,6 +50,7 @@ class ProcesserInterface : public XmlInterface {
   virtual void SetInputCloud(const PointCloudPtr& cloud) {
     inliers_.clear();
     outliers_.clear();
+    normals_.clear();
     if (cloud == nullptr || cloud->empty()) {
       LOG(WARNING) << "cloud empty, do nothing!" << std::endl;
       inner_cloud_ = nullptr;
@@ -60,6 +61,9 @@ class ProcesserInterface : public XmlInterface {
 
   virtual const std::vector<int>& Inliers() const { return inliers_; }
   virtual const std::vector<int>& Outliers() const { return outliers_; }
+  /// @brief the unit normals of the output points in a flat buffer, x y z
+  /// of each point in the order of the output, empty if not estimated
+  virtual const std::vector<float>& Normals() const { return normals_; }
 
  protected:
   /// @brief it is just a pointer, no memory allocated
@@ -68,6 +72,8 @@ class ProcesserInterface : public XmlInterface {
   std::vector<int> inliers_;
   /// @brief should be sorted from small to large
   std::vector<int> outliers_;
+  /// @brief 3 floats per output point, or empty
+  std::vector<float> normals_;
 };
 
 }  // namespace pre_processers
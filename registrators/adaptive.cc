@@ -0,0 +1,109 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "registrators/adaptive.h"
+#include "common/point_types.h"
+
+namespace static_map {
+namespace registrator {
+
+template <typename PointType>
+Adaptive<PointType>::Adaptive(
+    const std::shared_ptr<Interface<PointType>>& cheap_matcher,
+    const std::shared_ptr<Interface<PointType>>& fallback_matcher,
+    const std::string& metrics_prefix)
+    : Interface<PointType>(),
+      cheap_matcher_(cheap_matcher),
+      fallback_matcher_(fallback_matcher) {
+  CHECK(cheap_matcher_ && fallback_matcher_);
+  auto* const metrics = common::MetricsRegistry::Get();
+  cheap_counter_ = metrics->GetCounter(metrics_prefix + ".cheap");
+  escalated_counter_ = metrics->GetCounter(metrics_prefix + ".escalated");
+}
+
+template <typename PointType>
+void Adaptive<PointType>::setInputSource(const PointCloudSourcePtr& cloud) {
+  Interface<PointType>::setInputSource(cloud);
+  cheap_matcher_->setInputSource(cloud);
+}
+
+template <typename PointType>
+void Adaptive<PointType>::setInputTarget(const PointCloudTargetPtr& cloud) {
+  Interface<PointType>::setInputTarget(cloud);
+  // the fallback one gets the target only when it is needed
+  cheap_matcher_->setTargetCacheSize(this->target_cache_size_);
+  cheap_matcher_->setPinnedTarget(this->pinned_target_cloud_);
+  cheap_matcher_->setInputTarget(cloud);
+}
+
+template <typename PointType>
+void Adaptive<PointType>::updateInputTarget(
+    const PointCloudTargetPtr& cloud, const PointCloudTargetPtr& added_points,
+    const PointCloudTargetPtr& removed_points) {
+  Interface<PointType>::setInputTarget(cloud);
+  // the fallback one prepares the whole target when it is needed
+  cheap_matcher_->setTargetCacheSize(this->target_cache_size_);
+  cheap_matcher_->setPinnedTarget(this->pinned_target_cloud_);
+  cheap_matcher_->updateInputTarget(cloud, added_points, removed_points);
+}
+
+template <typename PointType>
+bool Adaptive<PointType>::align(const Eigen::Matrix4f& guess,
+                                Eigen::Matrix4f& result) {
+  cheap_matcher_->setMaximumIterations(cheap_max_iterations_);
+  const bool cheap_succeed = cheap_matcher_->align(guess, result);
+  const int cheap_iterations = cheap_matcher_->getFinalNumIteration();
+  // the registrators stop before the cap once converged
+  const bool converged =
+      cheap_iterations >= 0 && cheap_iterations < cheap_max_iterations_;
+  escalated_ = !cheap_succeed || !converged ||
+               cheap_matcher_->getFitnessScore() < accepted_min_score_;
+
+  Interface<PointType>* used_matcher = cheap_matcher_.get();
+  bool succeed = cheap_succeed;
+  if (escalated_) {
+    escalated_counter_->Add();
+    fallback_matcher_->setTargetCacheSize(this->target_cache_size_);
+    fallback_matcher_->setPinnedTarget(this->pinned_target_cloud_);
+    fallback_matcher_->setInputTarget(this->target_cloud_);
+    fallback_matcher_->setInputSource(this->source_cloud_);
+    // from the guess, the cheap one may have diverged
+    succeed = fallback_matcher_->align(guess, result);
+    used_matcher = fallback_matcher_.get();
+  } else {
+    cheap_counter_->Add();
+  }
+
+  this->final_score_ = used_matcher->getFitnessScore();
+  this->point_pairs_ = used_matcher->getInlierPointPairs();
+  this->final_iterations_ = used_matcher->getFinalNumIteration();
+  return succeed;
+}
+
+template class Adaptive<pcl::PointXYZI>;
+template class Adaptive<pcl::PointXYZ>;
+#ifdef _USE_COMPACT_POINT_
+template class Adaptive<PointXYZIc>;
+#endif
+
+}  // namespace registrator
+}  // namespace static_map
@@ -0,0 +1,84 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef REGISTRATORS_ADAPTIVE_H_
+#define REGISTRATORS_ADAPTIVE_H_
+
+#include <glog/logging.h>
+#include <memory>
+#include <string>
+
+#include "common/metrics.h"
+#include "registrators/registrator_interface.h"
+
+namespace static_map {
+namespace registrator {
+
+/*
+ * @class Adaptive
+ * @brief try a cheap registrator with few iterations first, and escalate to
+ * the expensive one only if the cheap one does not converge or its score is
+ * too low. the taken paths are counted in metrics
+ */
+template <typename PointType>
+class Adaptive : public Interface<PointType> {
+ public:
+  USE_REGISTRATOR_CLOUDS;
+
+  /// @param metrics_prefix e.g. "front_end.adaptive", the counters are
+  /// <prefix>.cheap and <prefix>.escalated
+  Adaptive(const std::shared_ptr<Interface<PointType>>& cheap_matcher,
+           const std::shared_ptr<Interface<PointType>>& fallback_matcher,
+           const std::string& metrics_prefix);
+
+  /// @brief the cheap result is accepted with the score over it
+  void setAcceptedMinScore(const double score) { accepted_min_score_ = score; }
+  /// @brief the cheap one not converged in it is escalated
+  void setCheapMaxIterations(const int iterations) {
+    cheap_max_iterations_ = iterations;
+  }
+
+  void setInputSource(const PointCloudSourcePtr& cloud) override;
+  void setInputTarget(const PointCloudTargetPtr& cloud) override;
+  void updateInputTarget(const PointCloudTargetPtr& cloud,
+                         const PointCloudTargetPtr& added_points,
+                         const PointCloudTargetPtr& removed_points) override;
+  bool align(const Eigen::Matrix4f& guess, Eigen::Matrix4f& result) override;
+
+  /// @brief if the last align took the fallback one
+  bool escalated() const { return escalated_; }
+
+ private:
+  std::shared_ptr<Interface<PointType>> cheap_matcher_;
+  std::shared_ptr<Interface<PointType>> fallback_matcher_;
+  double accepted_min_score_ = 0.9;
+  int cheap_max_iterations_ = 5;
+  bool escalated_ = false;
+
+  common::Counter* cheap_counter_;
+  common::Counter* escalated_counter_;
+};
+
+}  // namespace registrator
+}  // namespace static_map
+
+#endif  // REGISTRATORS_ADAPTIVE_H_
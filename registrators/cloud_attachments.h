@@ -0,0 +1,371 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#ifndef REGISTRATORS_CLOUD_ATTACHMENTS_H_
+#define REGISTRATORS_CLOUD_ATTACHMENTS_H_
+
+// third party
+#include <Eigen/Dense>
+// pcl
+#include <pcl/filters/approximate_voxel_grid.h>
+#include <pcl/point_cloud.h>
+#include <pcl/search/kdtree.h>
+// stl
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+// local
+#include "common/macro_defines.h"
+#include "common/mutex.h"
+#include "registrators/prepared_target_cache.h"
+#include "registrators/soa_cloud.h"
+
+namespace static_map {
+namespace registrator {
+
+/*
+ * @class CloudAttachments
+ * @brief the structures computed from a cloud (kd-tree, gicp covariances,
+ * normals, down sampled copies). they are computed once on demand and
+ * shared by all the registrations using the same cloud, get them by
+ * Get(cloud). the registry only keeps weak references, the attachments live
+ * as long as a registrator holds them, e.g. in a Cache within its target
+ * cache size. a cloud changed in place with the same size and stamp (e.g.
+ * its points swapped with the motion compensated ones) must be passed to
+ * Invalidate()
+ */
+template <typename PointType>
+class CloudAttachments {
+ public:
+  using PointCloud = pcl::PointCloud<PointType>;
+  using PointCloudPtr = typename PointCloud::Ptr;
+  using KdTree = pcl::search::KdTree<PointType>;
+  using KdTreePtr = typename KdTree::Ptr;
+  using Covariances =
+      std::vector<Eigen::Matrix3d, Eigen::aligned_allocator<Eigen::Matrix3d>>;
+  using CovariancesPtr = boost::shared_ptr<Covariances>;
+  // the unit normals in a flat buffer, x y z of each point
+  using Normals = std::vector<float>;
+  using NormalsPtr = std::shared_ptr<const Normals>;
+  using Cache = PreparedTargetCache<PointCloudPtr, CloudAttachments>;
+
+  /// @brief thread safe, the attachments are re-created if the cloud has
+  /// been changed (size or stamp) since they were created
+  static std::shared_ptr<CloudAttachments> Get(const PointCloudPtr& cloud) {
+    Registry& registry = GetRegistry();
+    common::MutexLocker locker(&registry.mutex);
+    auto& entry = registry.entries[cloud.get()];
+    std::shared_ptr<CloudAttachments> attachments = entry.attachments.lock();
+    // the address may be re-used by a new cloud after the old one is gone
+    if (attachments && entry.cloud.lock() == cloud &&
+        attachments->size_ == cloud->size() &&
+        attachments->stamp_ == cloud->header.stamp) {
+      return attachments;
+    }
+    attachments.reset(new CloudAttachments(cloud));
+    entry.cloud = cloud;
+    entry.attachments = attachments;
+    if (registry.entries.size() > 2 * registry.pruned_size) {
+      Prune(&registry);
+    }
+    return attachments;
+  }
+
+  /// @brief Get(cloud) and keep it in the cache of a registrator, the least
+  /// recently used ones over capacity are released
+  static std::shared_ptr<CloudAttachments> Get(const PointCloudPtr& cloud,
+                                               const size_t capacity,
+                                               const PointCloudPtr& pinned,
+                                               Cache* const cache) {
+    auto attachments = Get(cloud);
+    if (cache->Find(cloud) != attachments) {
+      cache->Erase(cloud);
+      cache->Insert(cloud, attachments, capacity, pinned);
+    }
+    return attachments;
+  }
+
+  /// @brief thread safe, drops the structures computed from the points of
+  /// the cloud, call it after changing the points in place. the normals
+  /// given by SetNormals() are kept, they are close enough for the slightly
+  /// moved points
+  static void Invalidate(const PointCloudPtr& cloud) {
+    std::shared_ptr<CloudAttachments> attachments;
+    {
+      Registry& registry = GetRegistry();
+      common::MutexLocker locker(&registry.mutex);
+      auto it = registry.entries.find(cloud.get());
+      if (it == registry.entries.end() || it->second.cloud.lock() != cloud) {
+        return;
+      }
+      attachments = it->second.attachments.lock();
+    }
+    if (attachments) {
+      common::MutexLocker locker(&attachments->mutex_);
+      attachments->kdtree_.reset();
+      attachments->covariances_.reset();
+      attachments->normals_.reset();
+      attachments->downsampled_.clear();
+    }
+  }
+
+  const PointCloudPtr& Cloud() const { return cloud_; }
+
+  KdTreePtr GetKdTree() {
+    common::MutexLocker locker(&mutex_);
+    return GetKdTreeLocked();
+  }
+
+  /// @brief the normals estimated before, e.g. by the RangeImage filter,
+  /// they are used by GetNormals() and GetCovariances() instead of the k
+  /// nearest search, only the (0, 0, 0) ones are fitted in the neighbours
+  void SetNormals(const NormalsPtr& normals) {
+    common::MutexLocker locker(&mutex_);
+    if (!normals || normals->size() != 3 * cloud_->size()) {
+      return;
+    }
+    given_normals_ = normals;
+    normals_.reset();
+    covariances_.reset();
+  }
+
+  /// @brief nullptr if no normals are set
+  NormalsPtr GivenNormals() {
+    common::MutexLocker locker(&mutex_);
+    return given_normals_;
+  }
+
+  /// @brief covariances computed in the same way as pcl gicp
+  CovariancesPtr GetCovariances(const int k_correspondences = 20,
+                                const double epsilon = 0.001) {
+    common::MutexLocker locker(&mutex_);
+    if (covariances_ && covariance_k_ == k_correspondences) {
+      return covariances_;
+    }
+    CovariancesPtr covariances(new Covariances(cloud_->size()));
+    const int points_num = cloud_->size();
+    const bool knn_valid = points_num >= k_correspondences;
+    if (!knn_valid && !given_normals_) {
+      return covariances;
+    }
+    const KdTreePtr kdtree =
+        knn_valid && HasMissingNormals() ? GetKdTreeLocked() : nullptr;
+#ifdef _OPENMP
+#pragma omp parallel num_threads(LOCAL_OMP_THREADS_NUM)
+#endif
+    {
+      std::vector<int> indices(k_correspondences);
+      std::vector<float> distances(k_correspondences);
+#ifdef _OPENMP
+#pragma omp for
+#endif
+      for (int i = 0; i < points_num; ++i) {
+        Eigen::Vector3d normal;
+        if (GivenNormal(i, &normal)) {
+          // the same as the flattened one below, u.col(0) is the normal
+          (*covariances)[i] = Eigen::Matrix3d::Identity() -
+                              (1. - epsilon) * normal * normal.transpose();
+          continue;
+        }
+        if (!kdtree) {
+          continue;
+        }
+        // flatten to a plane, eigen values are (epsilon, 1, 1) in the
+        // increasing order of the closed-form 3x3 solver
+        Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver;
+        solver.computeDirect(NeighboursCovariance(*kdtree, i, k_correspondences,
+                                                  &indices, &distances));
+        const Eigen::Matrix3d& u = solver.eigenvectors();
+        (*covariances)[i] = u * Eigen::Vector3d(epsilon, 1., 1.).asDiagonal() *
+                            u.transpose();
+      }
+    }
+    covariances_ = covariances;
+    covariance_k_ = k_correspondences;
+    return covariances_;
+  }
+
+  /// @brief the normals fitted in the k nearest neighbours of the points,
+  /// same as libicp, or the given ones if set by SetNormals()
+  NormalsPtr GetNormals(const int k_neighbours = 10) {
+    common::MutexLocker locker(&mutex_);
+    if (normals_ && normal_k_ == k_neighbours) {
+      return normals_;
+    }
+    const int points_num = cloud_->size();
+    const int k = std::min(k_neighbours, points_num);
+    if (given_normals_ && (k <= 0 || !HasMissingNormals())) {
+      return given_normals_;
+    }
+    std::shared_ptr<Normals> normals(new Normals(3 * cloud_->size(), 0.f));
+    if (k > 0) {
+      const KdTreePtr kdtree = GetKdTreeLocked();
+#ifdef _OPENMP
+#pragma omp parallel num_threads(LOCAL_OMP_THREADS_NUM)
+#endif
+      {
+        std::vector<int> indices(k);
+        std::vector<float> distances(k);
+#ifdef _OPENMP
+#pragma omp for
+#endif
+        for (int i = 0; i < points_num; ++i) {
+          Eigen::Vector3d normal;
+          if (!GivenNormal(i, &normal)) {
+            // the eigen vector of the smallest eigen value
+            Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver;
+            solver.computeDirect(
+                NeighboursCovariance(*kdtree, i, k, &indices, &distances));
+            normal = solver.eigenvectors().col(0);
+          }
+          for (int j = 0; j < 3; ++j) {
+            (*normals)[3 * i + j] = normal[j];
+          }
+        }
+      }
+    }
+    normals_ = normals;
+    normal_k_ = k_neighbours;
+    return normals_;
+  }
+
+  /// @brief the down sampled cloud has its own attachments
+  std::shared_ptr<CloudAttachments> GetDownsampled(const float resolution) {
+    common::MutexLocker locker(&mutex_);
+    auto& downsampled = downsampled_[resolution];
+    if (!downsampled) {
+      PointCloudPtr cloud(new PointCloud);
+      pcl::ApproximateVoxelGrid<PointType> filter;
+      filter.setLeafSize(resolution, resolution, resolution);
+      filter.setInputCloud(cloud_);
+      filter.filter(*cloud);
+      downsampled.reset(new CloudAttachments(cloud));
+    }
+    return downsampled;
+  }
+
+ private:
+  struct Entry {
+    typename WeakPtrOf<PointCloudPtr>::type cloud;
+    std::weak_ptr<CloudAttachments> attachments;
+  };
+  struct Registry {
+    common::Mutex mutex;
+    std::unordered_map<const PointCloud*, Entry> entries;
+    size_t pruned_size = 64;
+  };
+
+  static Registry& GetRegistry() {
+    static Registry registry;
+    return registry;
+  }
+
+  static void Prune(Registry* const registry) {
+    for (auto it = registry->entries.begin();
+         it != registry->entries.end();) {
+      if (it->second.attachments.expired() || it->second.cloud.expired()) {
+        it = registry->entries.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    registry->pruned_size = std::max<size_t>(64, registry->entries.size());
+  }
+
+  explicit CloudAttachments(const PointCloudPtr& cloud)
+      : cloud_(cloud), size_(cloud->size()), stamp_(cloud->header.stamp) {}
+
+  // false if no normal is given for point i
+  bool GivenNormal(const int i, Eigen::Vector3d* const normal) const {
+    if (!given_normals_) {
+      return false;
+    }
+    const float* const given = given_normals_->data() + 3 * i;
+    if (given[0] == 0.f && given[1] == 0.f && given[2] == 0.f) {
+      return false;
+    }
+    *normal = Eigen::Vector3d(given[0], given[1], given[2]);
+    return true;
+  }
+
+  bool HasMissingNormals() const {
+    if (!given_normals_) {
+      return true;
+    }
+    const int points_num = cloud_->size();
+    Eigen::Vector3d normal;
+    for (int i = 0; i < points_num; ++i) {
+      if (!GivenNormal(i, &normal)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // the covariance of the k nearest neighbours of point i, the buffers are
+  // reused between points
+  Eigen::Matrix3d NeighboursCovariance(
+      const KdTree& kdtree, const int i, const int k,
+      std::vector<int>* const indices,
+      std::vector<float>* const distances) const {
+    kdtree.nearestKSearch(cloud_->points[i], k, *indices, *distances);
+    Eigen::Vector3d mean = Eigen::Vector3d::Zero();
+    Eigen::Matrix3d cov = Eigen::Matrix3d::Zero();
+    for (const int index : *indices) {
+      const Eigen::Vector3d p =
+          cloud_->points[index].getVector3fMap().template cast<double>();
+      mean += p;
+      cov += p * p.transpose();
+    }
+    mean /= indices->size();
+    return cov / indices->size() - mean * mean.transpose();
+  }
+
+  KdTreePtr GetKdTreeLocked() {
+    if (!kdtree_) {
+      kdtree_.reset(new KdTree);
+      kdtree_->setInputCloud(cloud_);
+    }
+    return kdtree_;
+  }
+
+  const PointCloudPtr cloud_;
+  // to find out if the cloud is changed
+  const size_t size_;
+  const uint64_t stamp_;
+
+  common::Mutex mutex_;
+  KdTreePtr kdtree_;
+  CovariancesPtr covariances_;
+  int covariance_k_ = 0;
+  NormalsPtr normals_;
+  int normal_k_ = 0;
+  // set by SetNormals(), (0, 0, 0) for the points without one
+  NormalsPtr given_normals_;
+  std::map<float, std::shared_ptr<CloudAttachments>> downsampled_;
+};
+
+}  // namespace registrator
+}  // namespace static_map
+
+#endif  // REGISTRATORS_CLOUD_ATTACHMENTS_H_
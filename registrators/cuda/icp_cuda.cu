@@ -7,6 +7,10 @@
 #include <cugar/sampling/random.h>
 #include <thrust/gather.h>
 
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
 #include "common/simple_thread_pool.h"
 
 #define DEBUG_CUDA 0
@@ -140,6 +144,274 @@ bool knn_cugar(const float *ref, int ref_points_num, const float *query,
   return true;
 }
 
+namespace {
+
+constexpr int kBlockSize = 256;
+// 21 for hessian, 6 for gradient, residual and matched number
+constexpr int kSystemSize = 29;
+constexpr int64_t kEmptyKey = -1;
+
+static_assert(sizeof(PointToPlaneSystem) == kSystemSize * sizeof(float),
+              "PointToPlaneSystem should be packed floats");
+
+struct Transform3x4 {
+  float m[12];
+};
+
+// the same as the one in icp_fast.cc
+__host__ __device__ inline int64_t VoxelKey(const int64_t x, const int64_t y,
+                                            const int64_t z) {
+  const int64_t kMask = (1 << 21) - 1;
+  return ((x & kMask) << 42) | ((y & kMask) << 21) | (z & kMask);
+}
+
+__host__ __device__ inline int HashSlot(const int64_t key, const int mask) {
+  const uint64_t h = static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ull;
+  return static_cast<int>(h >> 32) & mask;
+}
+
+__device__ inline int FindPlaneIndex(const int64_t* keys, const int* indices,
+                                     const int table_size, const int64_t key) {
+  const int mask = table_size - 1;
+  // the load factor is less than 0.5, so there is always an empty slot
+  for (int slot = HashSlot(key, mask);; slot = (slot + 1) & mask) {
+    const int64_t k = keys[slot];
+    if (k == key) {
+      return indices[slot];
+    }
+    if (k == kEmptyKey) {
+      return -1;
+    }
+  }
+}
+
+__global__ void PointToPlaneKernel(const float* points, const int num,
+                                   const int64_t* keys, const int* indices,
+                                   const int table_size, const float* planes,
+                                   const int plane_num, const float resolution,
+                                   const Transform3x4 t,
+                                   const float max_residual_sq,
+                                   float* system) {
+  __shared__ float shared[kSystemSize][kBlockSize];
+  float values[kSystemSize];
+  for (int k = 0; k < kSystemSize; ++k) {
+    values[k] = 0.f;
+  }
+
+  const int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i < num) {
+    const float sx = points[i];
+    const float sy = points[num + i];
+    const float sz = points[2 * num + i];
+    const float px = t.m[0] * sx + t.m[1] * sy + t.m[2] * sz + t.m[3];
+    const float py = t.m[4] * sx + t.m[5] * sy + t.m[6] * sz + t.m[7];
+    const float pz = t.m[8] * sx + t.m[9] * sy + t.m[10] * sz + t.m[11];
+    const float inv_resolution = 1.f / resolution;
+    const float max_distance_sq = 2.25f * resolution * resolution;
+    const int64_t vx = floorf(px * inv_resolution);
+    const int64_t vy = floorf(py * inv_resolution);
+    const int64_t vz = floorf(pz * inv_resolution);
+
+    // the closest plane in the voxel and its 26 neighbours
+    const float* cx = planes;
+    const float* cy = planes + plane_num;
+    const float* cz = planes + 2 * plane_num;
+    const float* nx = planes + 3 * plane_num;
+    const float* ny = planes + 4 * plane_num;
+    const float* nz = planes + 5 * plane_num;
+    int plane_index = -1;
+    float residual = 0.f;
+    float min_residual_sq = max_residual_sq;
+    for (int dx = -1; dx <= 1; ++dx) {
+      for (int dy = -1; dy <= 1; ++dy) {
+        for (int dz = -1; dz <= 1; ++dz) {
+          const int j = FindPlaneIndex(keys, indices, table_size,
+                                       VoxelKey(vx + dx, vy + dy, vz + dz));
+          if (j < 0) {
+            continue;
+          }
+          const float ex = px - cx[j];
+          const float ey = py - cy[j];
+          const float ez = pz - cz[j];
+          if (ex * ex + ey * ey + ez * ez > max_distance_sq) {
+            continue;
+          }
+          const float r = nx[j] * ex + ny[j] * ey + nz[j] * ez;
+          if (r * r < min_residual_sq) {
+            min_residual_sq = r * r;
+            plane_index = j;
+            residual = r;
+          }
+        }
+      }
+    }
+
+    if (plane_index >= 0) {
+      const int j = plane_index;
+      // left perturbation: d(r)/d(w) = p x n, d(r)/d(v) = n
+      const float jacobian[6] = {py * nz[j] - pz * ny[j],
+                                 pz * nx[j] - px * nz[j],
+                                 px * ny[j] - py * nx[j],
+                                 nx[j],
+                                 ny[j],
+                                 nz[j]};
+      int k = 0;
+      for (int row = 0; row < 6; ++row) {
+        for (int col = row; col < 6; ++col) {
+          values[k++] = jacobian[row] * jacobian[col];
+        }
+      }
+      for (int row = 0; row < 6; ++row) {
+        values[k++] = jacobian[row] * residual;
+      }
+      values[k++] = fabsf(residual);
+      values[k] = 1.f;
+    }
+  }
+
+  // reduce in block, then add to the global system
+  for (int k = 0; k < kSystemSize; ++k) {
+    shared[k][threadIdx.x] = values[k];
+  }
+  __syncthreads();
+  for (int stride = kBlockSize / 2; stride > 0; stride >>= 1) {
+    if (threadIdx.x < stride) {
+      for (int k = 0; k < kSystemSize; ++k) {
+        shared[k][threadIdx.x] += shared[k][threadIdx.x + stride];
+      }
+    }
+    __syncthreads();
+  }
+  if (threadIdx.x < kSystemSize) {
+    atomicAdd(&system[threadIdx.x], shared[threadIdx.x][0]);
+  }
+}
+
+inline bool CheckCudaError(const cudaError_t error, const char* what) {
+  if (error != cudaSuccess) {
+    fprintf(stderr, "%s: %s\n", what, cudaGetErrorString(error));
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+DeviceVoxelPlanes::DeviceVoxelPlanes(const int64_t* keys, const int* indices,
+                                     const int voxel_num, const float* planes,
+                                     const int plane_num,
+                                     const float resolution)
+    : resolution_(resolution), plane_num_(plane_num), table_size_(16) {
+  // keep the load factor under 0.5
+  while (table_size_ < 2 * voxel_num) {
+    table_size_ <<= 1;
+  }
+  std::vector<int64_t> table_keys(table_size_, kEmptyKey);
+  std::vector<int> table_indices(table_size_, -1);
+  const int mask = table_size_ - 1;
+  for (int i = 0; i < voxel_num; ++i) {
+    int slot = HashSlot(keys[i], mask);
+    while (table_keys[slot] != kEmptyKey) {
+      slot = (slot + 1) & mask;
+    }
+    table_keys[slot] = keys[i];
+    table_indices[slot] = indices[i];
+  }
+
+  // stops at the first failure, the buffers not allocated stay nullptr
+  valid_ =
+      CheckCudaError(cudaMalloc(&table_keys_, table_size_ * sizeof(int64_t)),
+                     "malloc voxel keys") &&
+      CheckCudaError(cudaMalloc(&table_indices_, table_size_ * sizeof(int)),
+                     "malloc voxel indices") &&
+      CheckCudaError(cudaMalloc(&planes_, 6 * plane_num_ * sizeof(float)),
+                     "malloc voxel planes") &&
+      CheckCudaError(
+          cudaMemcpy(table_keys_, table_keys.data(),
+                     table_size_ * sizeof(int64_t), cudaMemcpyHostToDevice),
+          "upload voxel keys") &&
+      CheckCudaError(
+          cudaMemcpy(table_indices_, table_indices.data(),
+                     table_size_ * sizeof(int), cudaMemcpyHostToDevice),
+          "upload voxel indices") &&
+      CheckCudaError(cudaMemcpy(planes_, planes, 6 * plane_num_ * sizeof(float),
+                                cudaMemcpyHostToDevice),
+                     "upload voxel planes");
+}
+
+DeviceVoxelPlanes::~DeviceVoxelPlanes() {
+  cudaFree(table_keys_);
+  cudaFree(table_indices_);
+  cudaFree(planes_);
+}
+
+DevicePoints::~DevicePoints() {
+  cudaFree(points_);
+  cudaFree(system_buffer_);
+}
+
+bool DevicePoints::Upload(const float* points, const int num) {
+  // empty until the points are on device
+  size_ = 0;
+  if (num > capacity_) {
+    cudaFree(points_);
+    points_ = nullptr;
+    capacity_ = 0;
+    if (!CheckCudaError(cudaMalloc(&points_, 3 * num * sizeof(float)),
+                        "malloc points")) {
+      points_ = nullptr;
+      return false;
+    }
+    capacity_ = num;
+  }
+  if (!system_buffer_ &&
+      !CheckCudaError(cudaMalloc(&system_buffer_, kSystemSize * sizeof(float)),
+                      "malloc system buffer")) {
+    system_buffer_ = nullptr;
+    return false;
+  }
+  if (num > 0 &&
+      !CheckCudaError(cudaMemcpy(points_, points, 3 * num * sizeof(float),
+                                 cudaMemcpyHostToDevice),
+                      "upload points")) {
+    return false;
+  }
+  size_ = num;
+  return true;
+}
+
+bool BuildPointToPlaneSystem(const DeviceVoxelPlanes& target,
+                             const DevicePoints& source,
+                             const float* transform,
+                             const float max_correspondence_distance,
+                             PointToPlaneSystem* system) {
+  if (source.Size() <= 0 || !target.Valid() || target.PlaneNum() <= 0 ||
+      !system) {
+    return false;
+  }
+  Transform3x4 t;
+  memcpy(t.m, transform, sizeof(t.m));
+  if (!CheckCudaError(
+          cudaMemset(source.SystemBuffer(), 0, kSystemSize * sizeof(float)),
+          "clear system")) {
+    return false;
+  }
+  const int block_num = (source.Size() + kBlockSize - 1) / kBlockSize;
+  PointToPlaneKernel<<<block_num, kBlockSize>>>(
+      source.Points(), source.Size(), target.TableKeys(),
+      target.TableIndices(), target.TableSize(), target.Planes(),
+      target.PlaneNum(), target.Resolution(), t,
+      max_correspondence_distance * max_correspondence_distance,
+      source.SystemBuffer());
+  if (!CheckCudaError(cudaGetLastError(), "point to plane kernel")) {
+    return false;
+  }
+  return CheckCudaError(
+      cudaMemcpy(system, source.SystemBuffer(), sizeof(PointToPlaneSystem),
+                 cudaMemcpyDeviceToHost),
+      "download system");
+}
+
 }  // namespace cuda
 }  // namespace registrator
-}  // namespace static_map
\ No newline at end of file
+}  // namespace static_map
@@ -22,6 +22,8 @@
 
 #pragma once
 
+#include <cstdint>
+
 namespace static_map {
 namespace registrator {
 
@@ -36,6 +38,92 @@ void init_cuda_device();
 bool knn_cugar(const float* ref, int ref_points_num, const float* query,
                int query_points_num, float* knn_dist2, int* knn_index);
 
+/*
+ * @class DeviceVoxelPlanes
+ * @brief the planes fitted in the voxels of a target (see IcpFast),
+ * resident in device memory together with a hash table of voxel keys
+ */
+class DeviceVoxelPlanes {
+ public:
+  /// @param keys,indices voxel key and the plane index in it
+  /// @param planes cx,cy,cz,nx,ny,nz (SoA, plane_num for each)
+  DeviceVoxelPlanes(const int64_t* keys, const int* indices, int voxel_num,
+                    const float* planes, int plane_num, float resolution);
+  ~DeviceVoxelPlanes();
+
+  DeviceVoxelPlanes(const DeviceVoxelPlanes&) = delete;
+  DeviceVoxelPlanes& operator=(const DeviceVoxelPlanes&) = delete;
+
+  /// @brief false if the device memory failed to be allocated or filled
+  inline bool Valid() const { return valid_; }
+  inline float Resolution() const { return resolution_; }
+  inline int PlaneNum() const { return plane_num_; }
+  inline int TableSize() const { return table_size_; }
+  // device pointers
+  inline const int64_t* TableKeys() const { return table_keys_; }
+  inline const int* TableIndices() const { return table_indices_; }
+  inline const float* Planes() const { return planes_; }
+
+ private:
+  bool valid_ = false;
+  float resolution_;
+  int plane_num_;
+  // open addressing, the size is power of 2
+  int table_size_;
+  int64_t* table_keys_ = nullptr;
+  int* table_indices_ = nullptr;
+  float* planes_ = nullptr;
+};
+
+/*
+ * @class DevicePoints
+ * @brief source points and the reduction buffer in device memory,
+ * the buffers are re-used for every source
+ */
+class DevicePoints {
+ public:
+  DevicePoints() = default;
+  ~DevicePoints();
+
+  DevicePoints(const DevicePoints&) = delete;
+  DevicePoints& operator=(const DevicePoints&) = delete;
+
+  /// @param points x,y,z (SoA, num for each)
+  /// @return false on cuda errors, then it is empty
+  bool Upload(const float* points, int num);
+  inline int Size() const { return size_; }
+  // device pointers
+  inline const float* Points() const { return points_; }
+  inline float* SystemBuffer() const { return system_buffer_; }
+
+ private:
+  int size_ = 0;
+  int capacity_ = 0;
+  float* points_ = nullptr;
+  float* system_buffer_ = nullptr;
+};
+
+/*
+ * @struct PointToPlaneSystem
+ * @brief the gauss-newton system reduced on device
+ */
+struct PointToPlaneSystem {
+  // upper triangle of J^T J (row-major), J^T r
+  float hessian[21];
+  float gradient[6];
+  float abs_residual_sum;
+  float matched_num;
+};
+
+/// @brief transform the source points, find the planes and reduce the
+/// system, all on device
+/// @param transform row-major 3x4 matrix
+bool BuildPointToPlaneSystem(const DeviceVoxelPlanes& target,
+                             const DevicePoints& source,
+                             const float* transform,
+                             float max_correspondence_distance,
+                             PointToPlaneSystem* system);
+
 }  // namespace cuda
 }  // namespace registrator
 }  // namespace static_map
@@ -20,145 +20,383 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
-#include <cstdlib>
-#include <ctime>
-#include <iostream>
+#include <algorithm>
+#include <cmath>
 
 #include "common/macro_defines.h"
-#include "common/math.h"
-#include "nabo/nabo.h"
+#include "common/mutex.h"
+#include "common/point_types.h"
 #include "registrators/icp_fast.h"
 
+#include <Eigen/Eigenvalues>
+#include <Eigen/Geometry>
+
 namespace static_map {
 namespace registrator {
 
+namespace {
+
+constexpr int kMinMatchedPoints = 10;
+// the smallest eigen value should be clearly less than the middle one
+constexpr float kPlanarityRatio = 0.1;
+
+inline int64_t VoxelKey(const int64_t x, const int64_t y, const int64_t z) {
+  // 21 bits for each axis
+  constexpr int64_t kMask = (1 << 21) - 1;
+  return ((x & kMask) << 42) | ((y & kMask) << 21) | (z & kMask);
+}
+
+// the planes of the target clouds, only weak references are kept as the
+// registry of SoaCloud, the planes live in the caches of the matchers
+template <typename CloudPtr>
+struct VoxelPlanesRegistry {
+  struct Entry {
+    typename WeakPtrOf<CloudPtr>::type cloud;
+    std::weak_ptr<VoxelPlanes> planes;
+    size_t size = 0u;
+    uint64_t stamp = 0u;
+  };
+  common::Mutex mutex;
+  std::unordered_map<const void*, Entry> entries;
+  size_t pruned_size = 64;
+
+  static VoxelPlanesRegistry& Get() {
+    static VoxelPlanesRegistry registry;
+    return registry;
+  }
+
+  // the planes of the cloud with the settings, nullptr if not built
+  std::shared_ptr<VoxelPlanes> Find(const CloudPtr& cloud,
+                                    const float resolution,
+                                    const int min_points_in_voxel) {
+    common::MutexLocker locker(&mutex);
+    const auto it = entries.find(cloud.get());
+    if (it == entries.end()) {
+      return nullptr;
+    }
+    const Entry& entry = it->second;
+    std::shared_ptr<VoxelPlanes> planes = entry.planes.lock();
+    // the address may be re-used by a new cloud after the old one is gone
+    if (planes && entry.cloud.lock() == cloud &&
+        entry.size == cloud->size() && entry.stamp == cloud->header.stamp &&
+        planes->resolution == resolution &&
+        planes->min_points_in_voxel == min_points_in_voxel) {
+      return planes;
+    }
+    return nullptr;
+  }
+
+  void Insert(const CloudPtr& cloud,
+              const std::shared_ptr<VoxelPlanes>& planes) {
+    common::MutexLocker locker(&mutex);
+    Entry& entry = entries[cloud.get()];
+    entry.cloud = cloud;
+    entry.planes = planes;
+    entry.size = cloud->size();
+    entry.stamp = cloud->header.stamp;
+    if (entries.size() > 2 * pruned_size) {
+      for (auto it = entries.begin(); it != entries.end();) {
+        if (it->second.planes.expired() || it->second.cloud.expired()) {
+          it = entries.erase(it);
+        } else {
+          ++it;
+        }
+      }
+      pruned_size = std::max<size_t>(64, entries.size());
+    }
+  }
+};
+
+}  // namespace
+
 template <typename PointT>
 void IcpFast<PointT>::setInputSource(const PointCloudSourcePtr& cloud) {
-  source_inner_cloud_.reset(new InnerPointCloud);
-  size_t size = cloud->size();
-  source_inner_cloud_->points.reserve(size);
-  for (size_t i = 0; i < size; ++i) {
-    source_inner_cloud_->points.emplace_back();
-    source_inner_cloud_->points[i].FromPoint(cloud->points[i]);
-  }
+  Interface<PointT>::setInputSource(cloud);
+  source_soa_ = SoaCloud<PointT>::Get(cloud);
+}
+
+template <typename PointT>
+std::unique_ptr<Interface<PointT>> IcpFast<PointT>::cloneWithSource() const {
+  std::unique_ptr<IcpFast<PointT>> matcher(new IcpFast<PointT>);
+  matcher->resolution_ = resolution_;
+  matcher->max_iterations_ = max_iterations_;
+  matcher->epsilon_ = epsilon_;
+  matcher->max_correspondence_distance_ = max_correspondence_distance_;
+  matcher->min_points_in_voxel_ = min_points_in_voxel_;
+  matcher->source_cloud_ = this->source_cloud_;
+  matcher->source_soa_ = source_soa_;
+  return matcher;
 }
 
 template <typename PointT>
 void IcpFast<PointT>::setInputTarget(const PointCloudTargetPtr& cloud) {
-  target_inner_cloud_.reset(new InnerPointCloud);
-  int points_num = cloud->size();
-  const float sample_ratio = 0.1;
-
-#ifndef _ICP_USE_CUDA_
-
-  const int knn = kNNForNormal;
-  // step1. get all points's nerghbors (with sampling)
-  Eigen::MatrixXf M(kPointDim, points_num);
-  Eigen::MatrixXf query(kPointDim, points_num);
-  int query_num = 0;
-  for (int i = 0; i < points_num; ++i) {
-    M.col(i) << cloud->points[i].x, cloud->points[i].y, cloud->points[i].z;
-    if (static_cast<float>(std::rand()) / static_cast<float>(RAND_MAX) <
-        sample_ratio) {
-      query.col(query_num) = M.col(i);
-      query_num++;
-    }
+  Interface<PointT>::setInputTarget(cloud);
+  if (!this->target_cloud_) {
+    target_planes_.reset();
+    return;
+  }
+  target_planes_ = target_cache_.Find(this->target_cloud_);
+  if (target_planes_ && target_planes_->resolution == resolution_ &&
+      target_planes_->min_points_in_voxel == min_points_in_voxel_) {
+    return;
+  }
+  target_planes_ = SharedVoxelPlanes(this->target_cloud_);
+  target_cache_.Insert(this->target_cloud_, target_planes_,
+                       this->target_cache_size_, this->pinned_target_cloud_);
+}
+
+template <typename PointT>
+std::shared_ptr<VoxelPlanes> IcpFast<PointT>::SharedVoxelPlanes(
+    const PointCloudTargetPtr& cloud) const {
+  auto& registry = VoxelPlanesRegistry<PointCloudTargetPtr>::Get();
+  std::shared_ptr<VoxelPlanes> planes =
+      registry.Find(cloud, resolution_, min_points_in_voxel_);
+  if (planes) {
+    return planes;
+  }
+  // built out of the lock, the matchers of other targets are not blocked
+  planes = BuildVoxelPlanes(*SoaCloud<PointT>::Get(cloud));
+  registry.Insert(cloud, planes);
+  return planes;
+}
+
+template <typename PointT>
+std::shared_ptr<VoxelPlanes> IcpFast<PointT>::BuildVoxelPlanes(
+    const SoaCloud<PointT>& cloud) const {
+  // step1. accumulate the first and second moments of every voxel
+  struct Moments {
+    int count = 0;
+    Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+    Eigen::Matrix3d sum_sq = Eigen::Matrix3d::Zero();
+  };
+  const float inv_resolution = 1. / resolution_;
+  std::unordered_map<int64_t, Moments> voxels;
+  voxels.reserve(cloud.Size() / 4 + 1);
+  const float* const x = cloud.X();
+  const float* const y = cloud.Y();
+  const float* const z = cloud.Z();
+  for (size_t i = 0; i < cloud.Size(); ++i) {
+    const Eigen::Vector3d p(x[i], y[i], z[i]);
+    auto& moments = voxels[VoxelKey(std::floor(x[i] * inv_resolution),
+                                    std::floor(y[i] * inv_resolution),
+                                    std::floor(z[i] * inv_resolution))];
+    moments.count++;
+    moments.sum += p;
+    moments.sum_sq += p * p.transpose();
   }
-  query.resize(kPointDim, query_num);
-  Eigen::MatrixXi indices(knn, query_num);
-  Eigen::MatrixXf dists2(knn, query_num);
-
-  start_clock();
-  // using cpu
-  // use kdtree in libnabo to search every point's neighbors
-  Nabo::NNSearchF* knn_searcher = Nabo::NNSearchF::createKDTreeLinearHeap(M);
-  // we do not want to sort the distance
-
-  knn_searcher->knn(query, indices, dists2, knn, 0.,
-                    Nabo::NNSearchF::ALLOW_SELF_MATCH);
-  end_clock(__FILE__, __FUNCTION__, __LINE__);
-
-  delete knn_searcher;
-
-#else  // using GPU (cuda)
-  // step1. get all points's nerghbors (with sampling)
-  // average 0.5ms (1ms at most) for all malloc and copy ****
-  float* ref =
-      reinterpret_cast<float*>(malloc(points_num * kPointDim * sizeof(float)));
-  float* query =
-      reinterpret_cast<float*>(malloc(points_num * kPointDim * sizeof(float)));
-  int query_num = 0;
-  const size_t point_mem_size = kPointDim * sizeof(float);
-  for (int i = 0; i < points_num; ++i) {
-    ref[i * 3] = cloud->points[i].x;
-    ref[i * 3 + 1] = cloud->points[i].y;
-    ref[i * 3 + 2] = cloud->points[i].z;
-    if (static_cast<float>(query_num) / (i + 1) < sample_ratio) {
-      memcpy(&query[query_num * kPointDim], &ref[i * kPointDim],
-             point_mem_size);
-      query_num++;
+
+  // step2. fit planes in the voxels with enough points
+  std::vector<std::pair<int64_t, const Moments*>> candidates;
+  candidates.reserve(voxels.size());
+  for (const auto& voxel : voxels) {
+    if (voxel.second.count >= min_points_in_voxel_) {
+      candidates.emplace_back(voxel.first, &voxel.second);
     }
   }
-  float* result_dists = reinterpret_cast<float*>(
-      malloc(query_num * kNNForNormal * sizeof(float)));
-  int* result_indices =
-      reinterpret_cast<int*>(malloc(query_num * kNNForNormal * sizeof(int)));
-  // ****
-  start_clock();
-  cuda::knn_cugar(ref, points_num, query, query_num, result_dists,
-                  result_indices);
-  end_clock(__FILE__, __FUNCTION__, __LINE__);
-
-  // step2. calculate normals
-  start_clock();
-  target_inner_cloud_->points.resize(query_num);
-#if defined _OPENMP
+  const int candidate_num = candidates.size();
+  std::vector<Eigen::Vector3f> centroids(candidate_num);
+  std::vector<Eigen::Vector3f> normals(candidate_num);
+  std::vector<char> is_plane(candidate_num, 0);
+#ifdef _OPENMP
 #pragma omp parallel for num_threads(LOCAL_OMP_THREADS_NUM)
 #endif
-  for (int i = 0; i < query_num; ++i) {
-    auto& inner_point = target_inner_cloud_->points[i];
-    inner_point.FromFloatArray(&query[kPointDim * i]);
-
-    if (result_dists[i * kNNForNormal] < 1.) {
-      std::vector<Eigen::Vector3f> point_for_calculating_normal(kNNForNormal);
-      for (int j = 0; j < kNNForNormal; ++j) {
-        const int index = result_indices[i * kNNForNormal + j];
-        point_for_calculating_normal[j] << ref[kPointDim * index],
-            ref[kPointDim * index + 1], ref[kPointDim * index + 2];
-      }
-      auto norm = common::PlaneFitting(point_for_calculating_normal);
-      inner_point.normal = norm.second;
-      inner_point.has_normal = true;
+  for (int i = 0; i < candidate_num; ++i) {
+    const Moments& moments = *candidates[i].second;
+    const Eigen::Vector3d centroid = moments.sum / moments.count;
+    const Eigen::Matrix3d covariance =
+        moments.sum_sq / moments.count - centroid * centroid.transpose();
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver;
+    solver.computeDirect(covariance);
+    // eigen values are in increasing order
+    const Eigen::Vector3d& values = solver.eigenvalues();
+    if (values[0] < kPlanarityRatio * values[1]) {
+      centroids[i] = centroid.cast<float>();
+      normals[i] = solver.eigenvectors().col(0).normalized().cast<float>();
+      is_plane[i] = 1;
     }
   }
-  end_clock(__FILE__, __FUNCTION__, __LINE__);
 
-  free(ref);
-  free(query);
-  free(result_dists);
-  free(result_indices);
-#endif
+  // step3. save the planes as SoA
+  std::shared_ptr<VoxelPlanes> planes = std::make_shared<VoxelPlanes>();
+  planes->resolution = resolution_;
+  planes->min_points_in_voxel = min_points_in_voxel_;
+  planes->voxel_to_plane.reserve(candidate_num);
+  for (int i = 0; i < candidate_num; ++i) {
+    if (!is_plane[i]) {
+      continue;
+    }
+    planes->voxel_to_plane[candidates[i].first] = planes->Size();
+    planes->cx.push_back(centroids[i][0]);
+    planes->cy.push_back(centroids[i][1]);
+    planes->cz.push_back(centroids[i][2]);
+    planes->nx.push_back(normals[i][0]);
+    planes->ny.push_back(normals[i][1]);
+    planes->nz.push_back(normals[i][2]);
+  }
+  return planes;
+}
+
+template <typename PointT>
+int IcpFast<PointT>::FindPlane(const Eigen::Vector3f& p,
+                               float* const residual) const {
+  const VoxelPlanes& planes = *target_planes_;
+  const float inv_resolution = 1. / planes.resolution;
+  // the centroid of a neighbour voxel should be close enough
+  const float max_distance_sq = 2.25 * planes.resolution * planes.resolution;
+  const int64_t vx = std::floor(p[0] * inv_resolution);
+  const int64_t vy = std::floor(p[1] * inv_resolution);
+  const int64_t vz = std::floor(p[2] * inv_resolution);
+
+  // the closest plane in the voxel and its 26 neighbours
+  int plane_index = -1;
+  float min_residual_sq =
+      max_correspondence_distance_ * max_correspondence_distance_;
+  for (int dx = -1; dx <= 1; ++dx) {
+    for (int dy = -1; dy <= 1; ++dy) {
+      for (int dz = -1; dz <= 1; ++dz) {
+        const auto it =
+            planes.voxel_to_plane.find(VoxelKey(vx + dx, vy + dy, vz + dz));
+        if (it == planes.voxel_to_plane.end()) {
+          continue;
+        }
+        const int j = it->second;
+        const float ex = p[0] - planes.cx[j];
+        const float ey = p[1] - planes.cy[j];
+        const float ez = p[2] - planes.cz[j];
+        if (ex * ex + ey * ey + ez * ez > max_distance_sq) {
+          continue;
+        }
+        const float r =
+            planes.nx[j] * ex + planes.ny[j] * ey + planes.nz[j] * ez;
+        if (r * r < min_residual_sq) {
+          min_residual_sq = r * r;
+          plane_index = j;
+          *residual = r;
+        }
+      }
+    }
+  }
+  return plane_index;
+}
 
-  target_cloud_with_mormal_.resize(query_num, 6);
-  int row_index = 0;
-  for (auto& p : target_inner_cloud_->points) {
-    if (!p.has_normal) {
+template <typename PointT>
+void IcpFast<PointT>::SetInlierPointPairs(const Eigen::Matrix4f& transform) {
+  const VoxelPlanes& planes = *target_planes_;
+  const SoaCloud<PointT>& source = *source_soa_;
+  const int source_num = source.Size();
+  auto& pairs = this->point_pairs_;
+  pairs.read_points.resize(source_num, 3);
+  pairs.ref_points.resize(source_num, 3);
+  pairs.pairs_num = 0;
+  for (int i = 0; i < source_num; ++i) {
+    const Eigen::Vector3f p =
+        transform.block<3, 3>(0, 0) * source.Point(i) +
+        transform.block<3, 1>(0, 3);
+    float residual = 0.;
+    const int j = FindPlane(p, &residual);
+    if (j < 0) {
       continue;
     }
-    target_cloud_with_mormal_.row(row_index) << p.point, p.normal;
-    row_index++;
+    // the reference point is the projection on the plane
+    const Eigen::Vector3f n(planes.nx[j], planes.ny[j], planes.nz[j]);
+    pairs.read_points.row(pairs.pairs_num) = p.transpose();
+    pairs.ref_points.row(pairs.pairs_num) = (p - residual * n).transpose();
+    pairs.pairs_num++;
   }
-  target_cloud_with_mormal_.resize(row_index, 6);
+  pairs.read_points.conservativeResize(pairs.pairs_num, 3);
+  pairs.ref_points.conservativeResize(pairs.pairs_num, 3);
 }
 
 template <typename PointT>
 bool IcpFast<PointT>::align(const Eigen::Matrix4f& guess,
                             Eigen::Matrix4f& result) {
-  // @todo add filter for source cloud
+  if (!this->source_cloud_ || !target_planes_ || !source_soa_ ||
+      source_soa_->Empty()) {
+    return false;
+  }
+  const VoxelPlanes& planes = *target_planes_;
+  const SoaCloud<PointT>& source = *source_soa_;
+  const int source_num = source.Size();
+  jacobians_.resize(source_num, 6);
+  residuals_.resize(source_num);
 
+  Eigen::Matrix4f transform = guess;
+  int matched_num = 0;
+  this->final_iterations_ = 0;
+  for (int iteration = 0; iteration < max_iterations_; ++iteration) {
+    this->final_iterations_ = iteration + 1;
+    const Eigen::Matrix3f rotation = transform.block<3, 3>(0, 0);
+    const Eigen::Vector3f translation = transform.block<3, 1>(0, 3);
+    matched_num = 0;
+    // step1. correspondences and rows of J, the unmatched rows are zeros
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(LOCAL_OMP_THREADS_NUM) \
+    reduction(+ : matched_num)
+#endif
+    for (int i = 0; i < source_num; ++i) {
+      const Eigen::Vector3f p = rotation * source.Point(i) + translation;
+      float residual = 0.;
+      const int j = FindPlane(p, &residual);
+      if (j < 0) {
+        jacobians_.row(i).setZero();
+        residuals_[i] = 0.;
+        continue;
+      }
+      const Eigen::Vector3f n(planes.nx[j], planes.ny[j], planes.nz[j]);
+      // left perturbation: d(r)/d(w) = p x n, d(r)/d(v) = n
+      jacobians_.row(i) << p.cross(n).transpose(), n.transpose();
+      residuals_[i] = residual;
+      matched_num++;
+    }
+    if (matched_num < kMinMatchedPoints) {
+      PRINT_WARNING_FMT("Too few matched points: %d", matched_num);
+      return false;
+    }
+
+    // step2. normal equation, the products are vectorized by eigen
+    const Eigen::Matrix<float, 6, 6> hessian =
+        jacobians_.transpose() * jacobians_;
+    const Eigen::Matrix<float, 6, 1> gradient =
+        jacobians_.transpose() * residuals_;
+    if (!UpdateTransform(hessian, gradient, &transform)) {
+      break;
+    }
+  }
+
+  // same as the other registrators, the higher the better
+  this->final_score_ = std::exp(-residuals_.cwiseAbs().sum() / matched_num);
+  SetInlierPointPairs(transform);
+  result = transform;
   return true;
 }
 
+template <typename PointT>
+bool IcpFast<PointT>::UpdateTransform(
+    const Eigen::Matrix<float, 6, 6>& hessian,
+    const Eigen::Matrix<float, 6, 1>& gradient,
+    Eigen::Matrix4f* const transform) const {
+  const Eigen::Matrix<float, 6, 1> delta = hessian.ldlt().solve(-gradient);
+  if (!delta.allFinite()) {
+    return false;
+  }
+  Eigen::Matrix4f increment = Eigen::Matrix4f::Identity();
+  const Eigen::Vector3f omega = delta.head<3>();
+  const float angle = omega.norm();
+  if (angle > 1.e-12) {
+    increment.block<3, 3>(0, 0) =
+        Eigen::AngleAxisf(angle, omega / angle).toRotationMatrix();
+  }
+  increment.block<3, 1>(0, 3) = delta.tail<3>();
+  *transform = increment * (*transform);
+  // false if converged
+  return delta.norm() >= epsilon_;
+}
+
 template class IcpFast<pcl::PointXYZI>;
+template class IcpFast<pcl::PointXYZ>;
+#ifdef _USE_COMPACT_POINT_
+template class IcpFast<PointXYZIc>;
+#endif
+
 }  // namespace registrator
 }  // namespace static_map
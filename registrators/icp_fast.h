@@ -19,66 +19,41 @@
 // LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
-
 #pragma once
 
 #include <memory>
+#include <unordered_map>
 #include <vector>
 
-#include "registrators/cuda/icp_cuda.h"
+#include "registrators/prepared_target_cache.h"
 #include "registrators/registrator_interface.h"
+#include "registrators/soa_cloud.h"
 
 namespace static_map {
 namespace registrator {
 
-constexpr int kDim = 3;
-
-struct InnerPoint {
-  Eigen::Vector3f point = Eigen::Vector3f::Zero();
-  Eigen::Vector3f normal = Eigen::Vector3f::Zero();
-  double intensity;
-  bool has_normal = false;
-
-  inline void FromFloatArray(const float* const array) {
-    point << array[0], array[1], array[2];
-  }
-
-  inline void ToFloatArray(float* const array) {
-    array[0] = point[0];
-    array[1] = point[1];
-    array[2] = point[2];
-  }
-
-  inline void FromPoint(const pcl::PointXYZI& p) {
-    point[0] = p.x;
-    point[1] = p.y;
-    point[2] = p.z;
-    intensity = p.intensity;
-  }
-  inline void FromPoint(const pcl::PointXYZ& p) {
-    point[0] = p.x;
-    point[1] = p.y;
-    point[2] = p.z;
-    intensity = 0.;
-  }
-};
-
-struct InnerPointCloud {
-  std::vector<InnerPoint> points;
-
-  void ToFloatArray(float* const array) {
-    CHECK(array);
-    float* start = array;
-    for (auto& p : points) {
-      p.ToFloatArray(start);
-      start += kDim;
-    }
-  }
-
-  using Ptr = std::unique_ptr<InnerPointCloud>;
-  using ConstPtr = std::unique_ptr<const InnerPointCloud>;
+/*
+ * @struct VoxelPlanes
+ * @brief planes fitted in the voxels of a target cloud, stored as SoA
+ * so that the correspondences can be gathered without a kd-tree
+ */
+struct VoxelPlanes {
+  float resolution = 1.;
+  int min_points_in_voxel = 0;
+  // centroid and normal of every plane
+  std::vector<float> cx, cy, cz;
+  std::vector<float> nx, ny, nz;
+  // voxel key -> index of the plane
+  std::unordered_map<int64_t, int> voxel_to_plane;
+
+  inline size_t Size() const { return cx.size(); }
 };
 
+/*
+ * @class IcpFast
+ * @brief point-to-plane icp using a voxel hash as the approximate
+ * nearest neighbour structure for the target cloud
+ */
 template <typename PointType>
 class IcpFast : public Interface<PointType> {
  public:
@@ -89,12 +64,51 @@ class IcpFast : public Interface<PointType> {
   void setInputSource(const PointCloudSourcePtr& cloud) override;
   void setInputTarget(const PointCloudTargetPtr& cloud) override;
   bool align(const Eigen::Matrix4f& guess, Eigen::Matrix4f& result) override;
+  std::unique_ptr<Interface<PointType>> cloneWithSource() const override;
 
- private:
-  typename InnerPointCloud::Ptr source_inner_cloud_;
-  typename InnerPointCloud::Ptr target_inner_cloud_;
+  void setResolution(const float resolution) { resolution_ = resolution; }
+  void setMaximumIterations(const int iterations) override {
+    max_iterations_ = iterations > 0 ? iterations : 30;
+  }
+  void setTransformationEpsilon(const float epsilon) { epsilon_ = epsilon; }
+  void setMaxCorrespondenceDistance(const float distance) {
+    max_correspondence_distance_ = distance;
+  }
 
-  Eigen::Matrix<float, Eigen::Dynamic, 6> target_cloud_with_mormal_;
+ protected:
+  /// @brief the planes of the cloud are shared by all the matchers (and
+  /// their clones) with the same settings, they are built once from the
+  /// shared SoA of the cloud, which is already there if the cloud has been
+  /// a source (e.g. the last scan in the scan to scan matching)
+  std::shared_ptr<VoxelPlanes> SharedVoxelPlanes(
+      const PointCloudTargetPtr& cloud) const;
+  std::shared_ptr<VoxelPlanes> BuildVoxelPlanes(
+      const SoaCloud<PointType>& cloud) const;
+  // @return index of the plane, -1 if there is no plane close enough
+  int FindPlane(const Eigen::Vector3f& point, float* const residual) const;
+  void SetInlierPointPairs(const Eigen::Matrix4f& transform);
+  // one gauss-newton step, return false if converged or failed
+  bool UpdateTransform(const Eigen::Matrix<float, 6, 6>& hessian,
+                       const Eigen::Matrix<float, 6, 1>& gradient,
+                       Eigen::Matrix4f* const transform) const;
+
+ protected:
+  float resolution_ = 1.;
+  int max_iterations_ = 30;
+  float epsilon_ = 1.e-4;
+  // point-to-plane distance over it is not a correspondence
+  float max_correspondence_distance_ = 0.5;
+  // the points less than it in voxel will not be used for fitting
+  int min_points_in_voxel_ = 5;
+
+  // source cloud in SoA, shared with the frame and the other registrators
+  std::shared_ptr<const SoaCloud<PointType>> source_soa_;
+  std::shared_ptr<VoxelPlanes> target_planes_;
+  PreparedTargetCache<PointCloudTargetPtr, VoxelPlanes> target_cache_;
+
+  // buffers of every iteration, J is N x 6 and r is N x 1
+  Eigen::Matrix<float, Eigen::Dynamic, 6> jacobians_;
+  Eigen::VectorXf residuals_;
 };
 
 }  // namespace registrator
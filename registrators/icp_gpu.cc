@@ -0,0 +1,146 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "registrators/icp_gpu.h"
+#include "common/point_types.h"
+
+#ifdef _ICP_USE_CUDA_
+
+namespace static_map {
+namespace registrator {
+
+namespace {
+constexpr int kMinMatchedPoints = 10;
+}  // namespace
+
+template <typename PointT>
+void IcpGpu<PointT>::setInputSource(const PointCloudSourcePtr& cloud) {
+  IcpFast<PointT>::setInputSource(cloud);
+  // the shared SoA buffer has the layout of the device points already
+  const auto& source = this->source_soa_;
+  if (!device_source_.Upload(source ? source->Data() : nullptr,
+                             source ? source->Size() : 0)) {
+    PRINT_WARNING("Failed to upload the source, aligning it on cpu.");
+  }
+}
+
+template <typename PointT>
+void IcpGpu<PointT>::setInputTarget(const PointCloudTargetPtr& cloud) {
+  IcpFast<PointT>::setInputTarget(cloud);
+  if (!this->target_planes_) {
+    device_planes_.reset();
+    return;
+  }
+  const VoxelPlanes& planes = *this->target_planes_;
+  device_planes_ = device_target_cache_.Find(this->target_cloud_);
+  if (device_planes_ && device_planes_->Resolution() == planes.resolution) {
+    return;
+  }
+
+  const int voxel_num = planes.voxel_to_plane.size();
+  const int plane_num = planes.Size();
+  std::vector<int64_t> keys;
+  std::vector<int> indices;
+  keys.reserve(voxel_num);
+  indices.reserve(voxel_num);
+  for (const auto& voxel : planes.voxel_to_plane) {
+    keys.push_back(voxel.first);
+    indices.push_back(voxel.second);
+  }
+  std::vector<float> soa;
+  soa.reserve(6 * plane_num);
+  for (const auto* v : {&planes.cx, &planes.cy, &planes.cz, &planes.nx,
+                        &planes.ny, &planes.nz}) {
+    soa.insert(soa.end(), v->begin(), v->end());
+  }
+  device_planes_ = std::make_shared<cuda::DeviceVoxelPlanes>(
+      keys.data(), indices.data(), voxel_num, soa.data(), plane_num,
+      planes.resolution);
+  if (!device_planes_->Valid()) {
+    PRINT_WARNING("Failed to upload the target, aligning to it on cpu.");
+    device_planes_.reset();
+    return;
+  }
+  device_target_cache_.Insert(this->target_cloud_, device_planes_,
+                              this->target_cache_size_,
+                              this->pinned_target_cloud_);
+}
+
+template <typename PointT>
+bool IcpGpu<PointT>::align(const Eigen::Matrix4f& guess,
+                           Eigen::Matrix4f& result) {
+  // the same icp on cpu if the device failed on the target or the source
+  if (!device_planes_ || !device_source_.Size()) {
+    return IcpFast<PointT>::align(guess, result);
+  }
+
+  Eigen::Matrix4f transform = guess;
+  cuda::PointToPlaneSystem system;
+  this->final_iterations_ = 0;
+  for (int iteration = 0; iteration < this->max_iterations_; ++iteration) {
+    this->final_iterations_ = iteration + 1;
+    Eigen::Matrix<float, 3, 4, Eigen::RowMajor> transform_3x4 =
+        transform.topRows<3>();
+    if (!cuda::BuildPointToPlaneSystem(
+            *device_planes_, device_source_, transform_3x4.data(),
+            this->max_correspondence_distance_, &system)) {
+      PRINT_WARNING("Failed to align on device, aligning on cpu.");
+      return IcpFast<PointT>::align(guess, result);
+    }
+    if (system.matched_num < kMinMatchedPoints) {
+      PRINT_WARNING_FMT("Too few matched points: %d",
+                        static_cast<int>(system.matched_num));
+      return false;
+    }
+
+    Eigen::Matrix<float, 6, 6> hessian;
+    int k = 0;
+    for (int row = 0; row < 6; ++row) {
+      for (int col = row; col < 6; ++col) {
+        hessian(row, col) = hessian(col, row) = system.hessian[k++];
+      }
+    }
+    const Eigen::Map<const Eigen::Matrix<float, 6, 1>> gradient(
+        system.gradient);
+    if (!this->UpdateTransform(hessian, gradient, &transform)) {
+      break;
+    }
+  }
+
+  // same as the other registrators, the higher the better
+  this->final_score_ =
+      std::exp(-system.abs_residual_sum / system.matched_num);
+  this->SetInlierPointPairs(transform);
+  result = transform;
+  return true;
+}
+
+template class IcpGpu<pcl::PointXYZI>;
+template class IcpGpu<pcl::PointXYZ>;
+#ifdef _USE_COMPACT_POINT_
+template class IcpGpu<PointXYZIc>;
+#endif
+
+}  // namespace registrator
+}  // namespace static_map
+
+#endif  // _ICP_USE_CUDA_
@@ -0,0 +1,66 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "registrators/icp_fast.h"
+#include "registrators/cuda/icp_cuda.h"
+
+namespace static_map {
+namespace registrator {
+
+#ifdef _ICP_USE_CUDA_
+
+/*
+ * @class IcpGpu
+ * @brief the same point-to-plane icp as IcpFast, but the correspondences
+ * and the gauss-newton system are computed on device. the voxel planes of
+ * the targets stay in device memory
+ */
+template <typename PointType>
+class IcpGpu : public IcpFast<PointType> {
+ public:
+  USE_REGISTRATOR_CLOUDS;
+
+  IcpGpu() : IcpFast<PointType>() { this->type_ = kGpuIcp; }
+
+  void setInputSource(const PointCloudSourcePtr& cloud) override;
+  void setInputTarget(const PointCloudTargetPtr& cloud) override;
+  bool align(const Eigen::Matrix4f& guess, Eigen::Matrix4f& result) override;
+  // the device is shared, so batches run serially on it
+  std::unique_ptr<Interface<PointType>> cloneWithSource() const override {
+    return nullptr;
+  }
+
+ private:
+  std::shared_ptr<cuda::DeviceVoxelPlanes> device_planes_;
+  PreparedTargetCache<PointCloudTargetPtr, cuda::DeviceVoxelPlanes>
+      device_target_cache_;
+  cuda::DevicePoints device_source_;
+};
+
+#endif  // _ICP_USE_CUDA_
+
+}  // namespace registrator
+}  // namespace static_map
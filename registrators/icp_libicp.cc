@@ -20,58 +20,230 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
+
 #include "registrators/icp_libicp.h"
 #include "common/macro_defines.h"
+#include "common/point_types.h"
+
+#include <cmath>
+
+#include <Eigen/Geometry>
+#include <Eigen/SVD>
 
 namespace static_map {
 namespace registrator {
 
+namespace {
+
+// same as libicp
+constexpr int kMinPointNum = 5;
+constexpr int kNormalNeighbours = 10;
+constexpr double kInitialInlierDistance = 0.1;
+constexpr double kMinInlierDistance = 0.05;
+
+}  // namespace
+
 template <typename PointType>
-bool IcpUsingLibicp<PointType>::align(const Eigen::Matrix4f& guess,
-                                      Eigen::Matrix4f& result) {
-  if (!target_cloud_ || !source_cloud_) {
-    PRINT_ERROR("Empty cloud.");
-    return false;
+void IcpUsingLibicp<PointType>::setInputTarget(
+    const PointCloudTargetPtr& cloud) {
+  Interface<PointType>::setInputTarget(cloud);
+  if (!this->target_cloud_) {
+    target_.reset();
+    return;
   }
-
-  Matrix R = Matrix::eye(3);
-  for (int i = 0; i < 3; ++i) {
-    for (int j = 0; j < 3; ++j) {
-      R.val[i][j] = guess(i, j);
-    }
+  // the kd-tree (and normals for point to plane) is built only once, and
+  // shared with the other registrators using the cloud, e.g. the source of
+  // the last matching
+  target_ = target_cache_.Find(this->target_cloud_);
+  if (target_ && (icp_type_ == kPointToPoint || target_->normals)) {
+    return;
   }
+  target_ = std::make_shared<Target>();
+  target_->attachments = CloudAttachments<PointType>::Get(this->target_cloud_);
+  target_->kdtree = target_->attachments->GetKdTree();
+  if (icp_type_ == kPointToPlane) {
+    target_->normals = target_->attachments->GetNormals(kNormalNeighbours);
+  }
+  target_cache_.Insert(this->target_cloud_, target_, this->target_cache_size_,
+                       this->pinned_target_cloud_);
+}
 
-  Matrix t(3, 1);
-  t.val[0][0] = guess(0, 3);
-  t.val[1][0] = guess(1, 3);
-  t.val[2][0] = guess(2, 3);
-
-  double icp_score = icp_->fit(source_cloud_, source_size_, R, t, 0.1);
-  for (int i = 0; i < 3; ++i)
-    for (int j = 0; j < 3; ++j) result(i, j) = R.val[i][j];
+template <typename PointType>
+std::unique_ptr<Interface<PointType>>
+IcpUsingLibicp<PointType>::cloneWithSource() const {
+  std::unique_ptr<IcpUsingLibicp<PointType>> matcher(
+      new IcpUsingLibicp<PointType>(icp_type_));
+  matcher->max_iterations_ = max_iterations_;
+  matcher->min_delta_ = min_delta_;
+  matcher->source_cloud_ = this->source_cloud_;
+  matcher->source_soa_ = source_soa_;
+  return matcher;
+}
 
-  for (int i = 0; i < 3; ++i) {
-    result(i, 3) = t.val[i][0];
-    result(3, i) = 0.;
+template <typename PointType>
+typename IcpUsingLibicp<PointType>::NormalEquations
+IcpUsingLibicp<PointType>::Accumulate(const Eigen::Matrix3d& rotation,
+                                      const Eigen::Vector3d& translation,
+                                      const double inlier_distance) const {
+  const SoaCloud<PointType>& source = *source_soa_;
+  const PointCloudTarget& target = *this->target_cloud_;
+  const auto& kdtree = *target_->kdtree;
+  const float* const normals =
+      target_->normals ? target_->normals->data() : nullptr;
+  const int source_num = source.Size();
+  NormalEquations equations;
+#ifdef _OPENMP
+#pragma omp parallel num_threads(LOCAL_OMP_THREADS_NUM)
+#endif
+  {
+    // the buffers of each thread, nothing is allocated per point
+    NormalEquations local;
+    std::vector<int> indices(1);
+    std::vector<float> distances(1);
+    PointType query;
+#ifdef _OPENMP
+#pragma omp for nowait
+#endif
+    for (int i = 0; i < source_num; ++i) {
+      const Eigen::Vector3d s =
+          rotation * source.Point(i).template cast<double>() + translation;
+      query.x = s[0];
+      query.y = s[1];
+      query.z = s[2];
+      if (kdtree.nearestKSearch(query, 1, indices, distances) < 1) {
+        continue;
+      }
+      const int j = indices[0];
+      const Eigen::Vector3d d =
+          target.points[j].getVector3fMap().template cast<double>();
+      if (icp_type_ == kPointToPoint) {
+        // the squared distance as libicp
+        if (distances[0] >= inlier_distance) {
+          continue;
+        }
+        local.source_sum += s;
+        local.target_sum += d;
+        local.cross_sum += s * d.transpose();
+        local.residual_sum += distances[0];
+      } else {
+        const Eigen::Vector3d n(normals[3 * j], normals[3 * j + 1],
+                                normals[3 * j + 2]);
+        const double r = n.dot(d - s);
+        if (std::fabs(r) >= inlier_distance) {
+          continue;
+        }
+        Eigen::Matrix<double, 6, 1> jacobian;
+        jacobian << s.cross(n), n;
+        local.hessian.noalias() += jacobian * jacobian.transpose();
+        local.gradient += jacobian * r;
+        local.residual_sum += std::fabs(r);
+      }
+      ++local.inlier_num;
+    }
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+    equations.Add(local);
   }
-  result(3, 3) = 1.;
+  return equations;
+}
 
-  this->final_score_ = std::exp(-icp_score);
-  return true;
+template <typename PointType>
+double IcpUsingLibicp<PointType>::Step(const NormalEquations& equations,
+                                       Eigen::Matrix3d* rotation,
+                                       Eigen::Vector3d* translation) const {
+  if (equations.inlier_num < kMinPointNum) {
+    return 0.;
+  }
+  Eigen::Matrix3d delta_rotation;
+  Eigen::Vector3d delta_translation;
+  if (icp_type_ == kPointToPoint) {
+    const double num = equations.inlier_num;
+    const Eigen::Vector3d source_mean = equations.source_sum / num;
+    const Eigen::Vector3d target_mean = equations.target_sum / num;
+    const Eigen::Matrix3d cross =
+        equations.cross_sum - num * source_mean * target_mean.transpose();
+    Eigen::JacobiSVD<Eigen::Matrix3d> svd(
+        cross, Eigen::ComputeFullU | Eigen::ComputeFullV);
+    Eigen::Matrix3d reflection = Eigen::Matrix3d::Identity();
+    reflection(2, 2) =
+        (svd.matrixV() * svd.matrixU().transpose()).determinant();
+    delta_rotation =
+        svd.matrixV() * reflection * svd.matrixU().transpose();
+    delta_translation = target_mean - delta_rotation * source_mean;
+  } else {
+    const Eigen::Matrix<double, 6, 1> x =
+        equations.hessian.ldlt().solve(equations.gradient);
+    if (!x.allFinite()) {
+      return 0.;
+    }
+    // the linearized rotation, orthonormalized
+    Eigen::Matrix3d linearized = Eigen::Matrix3d::Identity();
+    linearized(0, 1) = -x[2];
+    linearized(1, 0) = x[2];
+    linearized(0, 2) = x[1];
+    linearized(2, 0) = -x[1];
+    linearized(1, 2) = -x[0];
+    linearized(2, 1) = x[0];
+    Eigen::JacobiSVD<Eigen::Matrix3d> svd(
+        linearized, Eigen::ComputeFullU | Eigen::ComputeFullV);
+    Eigen::Matrix3d reflection = Eigen::Matrix3d::Identity();
+    reflection(2, 2) =
+        (svd.matrixU() * svd.matrixV().transpose()).determinant();
+    delta_rotation =
+        svd.matrixU() * reflection * svd.matrixV().transpose();
+    delta_translation = x.tail<3>();
+  }
+  *rotation = delta_rotation * (*rotation);
+  *translation = delta_rotation * (*translation) + delta_translation;
+  return std::max(
+      (delta_rotation - Eigen::Matrix3d::Identity()).norm(),
+      delta_translation.norm());
 }
 
 template <typename PointType>
-IcpUsingLibicp<PointType>::~IcpUsingLibicp() {
-  if (target_cloud_) {
-    free(target_cloud_);
+bool IcpUsingLibicp<PointType>::align(const Eigen::Matrix4f& guess,
+                                      Eigen::Matrix4f& result) {
+  if (!target_ || !source_soa_ ||
+      source_soa_->Size() < static_cast<size_t>(kMinPointNum) ||
+      this->target_cloud_->size() < static_cast<size_t>(kMinPointNum)) {
+    PRINT_ERROR("Empty cloud.");
+    return false;
   }
-  if (source_cloud_) {
-    free(source_cloud_);
+
+  Eigen::Matrix3d rotation = guess.block<3, 3>(0, 0).cast<double>();
+  Eigen::Vector3d translation = guess.block<3, 1>(0, 3).cast<double>();
+  double inlier_distance = kInitialInlierDistance;
+  double delta = 1000.;
+  this->final_iterations_ = 0;
+  for (int iteration = 0; iteration < max_iterations_ && delta > min_delta_;
+       ++iteration) {
+    this->final_iterations_ = iteration + 1;
+    inlier_distance = std::max(inlier_distance * 0.9, kMinInlierDistance);
+    delta = Step(Accumulate(rotation, translation, inlier_distance),
+                 &rotation, &translation);
   }
+
+  // the mean residual of the inliers at the final pose
+  const NormalEquations equations =
+      Accumulate(rotation, translation, inlier_distance);
+  const double icp_score =
+      equations.inlier_num > 0
+          ? equations.residual_sum / equations.inlier_num
+          : 0.;
+  result.setIdentity();
+  result.block<3, 3>(0, 0) = rotation.cast<float>();
+  result.block<3, 1>(0, 3) = translation.cast<float>();
+
+  this->final_score_ = std::exp(-icp_score);
+  return true;
 }
 
 template class IcpUsingLibicp<pcl::PointXYZI>;
 template class IcpUsingLibicp<pcl::PointXYZ>;
+#ifdef _USE_COMPACT_POINT_
+template class IcpUsingLibicp<PointXYZIc>;
+#endif
 
 }  // namespace registrator
 }  // namespace static_map
@@ -20,18 +20,30 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
+
 #pragma once
 
+#include <algorithm>
 #include <memory>
+#include <vector>
 
-#include "libicp/icpPointToPlane.h"
-#include "libicp/icpPointToPoint.h"
-
+#include "registrators/cloud_attachments.h"
+#include "registrators/prepared_target_cache.h"
 #include "registrators/registrator_interface.h"
+#include "registrators/soa_cloud.h"
 
 namespace static_map {
 namespace registrator {
 
+/*
+ * @class IcpUsingLibicp
+ * @brief the icp of libicp (andreas geiger): the inlier distance shrinks
+ * in every iteration until kMinInlierDistance, the correspondences are the
+ * nearest neighbours in the target. it runs on the shared SoA of the source
+ * and the shared kd-tree and normals of the target (see CloudAttachments),
+ * an iteration is a single parallel pass over the source accumulating the
+ * fixed size normal equations
+ */
 template <typename PointType>
 class IcpUsingLibicp : public Interface<PointType> {
  public:
@@ -45,54 +57,68 @@ class IcpUsingLibicp : public Interface<PointType> {
     this->type_ = kLibicp;
   }
 
-  ~IcpUsingLibicp();
-
-  inline void setInputSource(const PointCloudSourcePtr& cloud) override {
-    if (source_cloud_) {
-      free(source_cloud_);
-    }
-    source_size_ = cloud->size();
-    source_cloud_ =
-        reinterpret_cast<double*>(calloc(3 * source_size_, sizeof(double)));
-    for (size_t i = 0; i < source_size_; ++i) {
-      source_cloud_[i * 3 + 0] = (*cloud)[i].x;
-      source_cloud_[i * 3 + 1] = (*cloud)[i].y;
-      source_cloud_[i * 3 + 2] = (*cloud)[i].z;
-    }
+  void setInputSource(const PointCloudSourcePtr& cloud) override {
+    Interface<PointType>::setInputSource(cloud);
+    source_soa_ = SoaCloud<PointType>::Get(this->source_cloud_);
   }
 
-  inline void setInputTarget(const PointCloudTargetPtr& cloud) override {
-    if (target_cloud_) {
-      free(target_cloud_);
-    }
-    target_cloud_ =
-        reinterpret_cast<double*>(calloc(3 * cloud->size(), sizeof(double)));
-    for (int i = 0; i < cloud->size(); ++i) {
-      target_cloud_[i * 3 + 0] = (*cloud)[i].x;
-      target_cloud_[i * 3 + 1] = (*cloud)[i].y;
-      target_cloud_[i * 3 + 2] = (*cloud)[i].z;
-    }
-
-    if (icp_ != nullptr) {
-      icp_.reset();
-    }
+  void setInputTarget(const PointCloudTargetPtr& cloud) override;
 
-    if (icp_type_ == kPointToPoint) {
-      icp_ = std::make_shared<IcpPointToPoint>(target_cloud_, cloud->size(), 3);
-    } else {
-      icp_ = std::make_shared<IcpPointToPlane>(target_cloud_, cloud->size(), 3);
-    }
+  void setMaximumIterations(const int iterations) override {
+    max_iterations_ = iterations > 0 ? iterations : 200;
   }
 
   bool align(const Eigen::Matrix4f& guess, Eigen::Matrix4f& result) override;
+  std::unique_ptr<Interface<PointType>> cloneWithSource() const override;
 
  private:
+  // the kd-tree and normals (for point to plane) of a target
+  struct Target {
+    std::shared_ptr<CloudAttachments<PointType>> attachments;
+    typename CloudAttachments<PointType>::KdTreePtr kdtree;
+    typename CloudAttachments<PointType>::NormalsPtr normals;
+  };
+
+  // the sums over the inliers of an iteration, reduced from the threads
+  struct NormalEquations {
+    // point to plane: J^T * J and J^T * r
+    Eigen::Matrix<double, 6, 6> hessian = Eigen::Matrix<double, 6, 6>::Zero();
+    Eigen::Matrix<double, 6, 1> gradient = Eigen::Matrix<double, 6, 1>::Zero();
+    // point to point: the sums of the points and their cross products
+    Eigen::Vector3d source_sum = Eigen::Vector3d::Zero();
+    Eigen::Vector3d target_sum = Eigen::Vector3d::Zero();
+    Eigen::Matrix3d cross_sum = Eigen::Matrix3d::Zero();
+    double residual_sum = 0.;
+    int inlier_num = 0;
+
+    void Add(const NormalEquations& other) {
+      hessian += other.hessian;
+      gradient += other.gradient;
+      source_sum += other.source_sum;
+      target_sum += other.target_sum;
+      cross_sum += other.cross_sum;
+      residual_sum += other.residual_sum;
+      inlier_num += other.inlier_num;
+    }
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+
+  NormalEquations Accumulate(const Eigen::Matrix3d& rotation,
+                             const Eigen::Vector3d& translation,
+                             const double inlier_distance) const;
+  // update the pose by the equations, return the change of the pose, 0 if
+  // failed
+  double Step(const NormalEquations& equations, Eigen::Matrix3d* rotation,
+              Eigen::Vector3d* translation) const;
+
   IcpType icp_type_;
+  int max_iterations_ = 200;
+  double min_delta_ = 1.e-4;
 
-  double* target_cloud_ = NULL;
-  double* source_cloud_ = NULL;
-  size_t source_size_ = 0;
-  std::shared_ptr<Icp> icp_ = nullptr;
+  std::shared_ptr<const SoaCloud<PointType>> source_soa_;
+  std::shared_ptr<Target> target_;
+  PreparedTargetCache<PointCloudTargetPtr, Target> target_cache_;
 };
 
 }  // namespace registrator
@@ -21,31 +21,147 @@
 // SOFTWARE.
 
 #include "registrators/icp_pointmatcher.h"
+#include "common/point_types.h"
 
 namespace static_map {
 namespace registrator {
 
+template <typename PointType>
+void IcpUsingPointMatcher<PointType>::setInputTarget(
+    const PointCloudTargetPtr& cloud) {
+  if (!cloud || cloud->empty()) {
+    PRINT_ERROR("Empty cloud.");
+    return;
+  }
+  this->target_cloud_ = cloud;
+  current_target_ = target_cache_.Find(cloud);
+  if (current_target_) {
+    return;
+  }
+
+  current_target_ = std::make_shared<PreparedTarget>();
+  // e.g. the source of last matching becomes the target
+  current_target_->reference_cloud = ConvertCloud(cloud);
+  CHECK(current_target_->reference_cloud->getNbPoints() ==
+        cloud->points.size());
+
+  // filters and kd-tree for reference are applied only once here
+  current_target_->icp = std::make_shared<PM::ICPSequence>();
+  if (yaml_file_.empty()) {
+    loadDefaultConfig(current_target_->icp.get());
+  } else {
+    loadConfig(yaml_file_, current_target_->icp.get());
+  }
+  current_target_->icp->setMap(*current_target_->reference_cloud);
+  current_target_->checkers_num =
+      current_target_->icp->transformationCheckers.size();
+
+  PointMatcherSupport::Parametrizable::Parameters params;
+  params["knn"] = "1";
+  params["epsilon"] = "3.16";
+  current_target_->score_matcher =
+      PM::get().MatcherRegistrar.create("KDTreeMatcher", params);
+  current_target_->score_matcher->init(*current_target_->reference_cloud);
+
+  target_cache_.Insert(cloud, current_target_, this->target_cache_size_,
+                       this->pinned_target_cloud_);
+}
+
+template <typename PointType>
+std::shared_ptr<PM::DataPoints> IcpUsingPointMatcher<PointType>::ConvertCloud(
+    const PointCloudSourcePtr& cloud) {
+  struct Converted {
+    typename WeakPtrOf<PointCloudSourcePtr>::type cloud;
+    // to find out if the cloud is changed
+    size_t size;
+    uint64_t stamp;
+    std::weak_ptr<PM::DataPoints> points;
+  };
+  static common::Mutex mutex;
+  static std::unordered_map<const PointCloudSource*, Converted> registry;
+  static size_t pruned_size = 64;
+
+  {
+    common::MutexLocker locker(&mutex);
+    const auto it = registry.find(cloud.get());
+    if (it != registry.end()) {
+      const Converted& converted = it->second;
+      auto points = converted.points.lock();
+      // the address may be re-used by a new cloud after the old one is gone
+      if (points && converted.cloud.lock() == cloud &&
+          converted.size == cloud->size() &&
+          converted.stamp == cloud->header.stamp) {
+        return points;
+      }
+    }
+  }
+  // the points are never modified by icp, so they can be shared
+  auto points = std::make_shared<PM::DataPoints>(
+      sensors::pclPointCloudToLibPointMatcherPoints<PointType>(cloud));
+  common::MutexLocker locker(&mutex);
+  Converted& converted = registry[cloud.get()];
+  converted.cloud = cloud;
+  converted.size = cloud->size();
+  converted.stamp = cloud->header.stamp;
+  converted.points = points;
+  if (registry.size() > 2 * pruned_size) {
+    for (auto it = registry.begin(); it != registry.end();) {
+      if (it->second.points.expired() || it->second.cloud.expired()) {
+        it = registry.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    pruned_size = std::max<size_t>(64, registry.size());
+  }
+  return points;
+}
+
 template <typename PointType>
 bool IcpUsingPointMatcher<PointType>::align(const Eigen::Matrix4f& guess,
                                             Eigen::Matrix4f& result) {
+  if (!current_target_ || reading_cloud_->getNbPoints() == 0) {
+    PRINT_ERROR("Empty cloud.");
+    return false;
+  }
+  PM::ICPSequence& icp = *current_target_->icp;
+  const PM::DataPoints& reference_cloud = *current_target_->reference_cloud;
+  // drop the counter of the last align
+  icp.transformationCheckers.resize(current_target_->checkers_num);
+  if (max_iterations_ > 0) {
+    PointMatcherSupport::Parametrizable::Parameters params;
+    params["maxIterationCount"] = std::to_string(max_iterations_);
+    icp.transformationCheckers.push_back(
+        PM::get().TransformationCheckerRegistrar.create(
+            "CounterTransformationChecker", params));
+  }
   // **** compute the transform ****
-  result = pm_icp_.compute(*reading_cloud_, *reference_cloud_, guess);
+  result = icp.compute(*reading_cloud_, guess);
+  this->final_iterations_ = -1;
+  for (const auto& checker : icp.transformationCheckers) {
+    // only the counter checker has this condition variable
+    const auto& names = checker->getConditionVariableNames();
+    for (size_t i = 0; i < names.size(); ++i) {
+      if (names[i] == "Iteration") {
+        this->final_iterations_ = checker->getConditionVariables()(i);
+      }
+    }
+  }
 
   // **** compute the final score ****
   PM::DataPoints data_out(*reading_cloud_);
-  pm_icp_.transformations.apply(data_out, result);
-  pm_icp_.matcher->init(*reference_cloud_);
+  icp.transformations.apply(data_out, result);
 
   // extract closest points
-  PM::Matches matches = pm_icp_.matcher->findClosests(data_out);
+  PM::Matches matches = current_target_->score_matcher->findClosests(data_out);
 
   // weight paired points
   const PM::OutlierWeights outlier_weights =
-      pm_icp_.outlierFilters.compute(data_out, *reference_cloud_, matches);
+      icp.outlierFilters.compute(data_out, reference_cloud, matches);
 
   // generate tuples of matched points and remove pairs with zero weight
   const PM::ErrorMinimizer::ErrorElements matched_points(
-      data_out, *reference_cloud_, outlier_weights, matches);
+      data_out, reference_cloud, outlier_weights, matches);
 
   // extract relevant information for convenience
   const int dim = matched_points.reading.getEuclideanDim();
@@ -77,9 +193,10 @@ bool IcpUsingPointMatcher<PointType>::align(const Eigen::Matrix4f& guess,
 
 template <typename PointType>
 void IcpUsingPointMatcher<PointType>::loadConfig(
-    const std::string& yaml_filename) {
+    const std::string& yaml_filename, PM::ICPChainBase* const icp) {
+  CHECK(icp);
   if (yaml_filename.empty()) {
-    loadDefaultConfig();
+    loadDefaultConfig(icp);
     return;
   }
 
@@ -89,11 +206,13 @@ void IcpUsingPointMatcher<PointType>::loadConfig(
     PRINT_ERROR_FMT("Cannot open config file: %s", yaml_filename.c_str());
     exit(1);
   }
-  pm_icp_.loadFromYaml(ifs);
+  icp->loadFromYaml(ifs);
 }
 
 template <typename PointType>
-void IcpUsingPointMatcher<PointType>::loadDefaultConfig() {
+void IcpUsingPointMatcher<PointType>::loadDefaultConfig(
+    PM::ICPChainBase* const icp) {
+  CHECK(icp);
   // config
   PointMatcherSupport::Parametrizable::Parameters params;
   std::string name;
@@ -159,25 +278,28 @@ void IcpUsingPointMatcher<PointType>::loadDefaultConfig() {
       PM::get().InspectorRegistrar.create("NullInspector");
 
   // data filters
-  pm_icp_.readingDataPointsFilters.push_back(rand_read);
-  pm_icp_.referenceDataPointsFilters.push_back(normal_ref);
+  icp->readingDataPointsFilters.push_back(rand_read);
+  icp->referenceDataPointsFilters.push_back(normal_ref);
   // matcher
-  pm_icp_.matcher = kdtree;
+  icp->matcher = kdtree;
   // outlier filter
-  pm_icp_.outlierFilters.push_back(trim);
+  icp->outlierFilters.push_back(trim);
   // error minimizer
-  pm_icp_.errorMinimizer = pointToPlane;
+  icp->errorMinimizer = pointToPlane;
   // checker
-  pm_icp_.transformationCheckers.push_back(maxIter);
-  pm_icp_.transformationCheckers.push_back(diff);
+  icp->transformationCheckers.push_back(maxIter);
+  icp->transformationCheckers.push_back(diff);
 
-  pm_icp_.inspector = nullInspect;
+  icp->inspector = nullInspect;
   // result transform
-  pm_icp_.transformations.push_back(rigidTrans);
+  icp->transformations.push_back(rigidTrans);
 }
 
 template class IcpUsingPointMatcher<pcl::PointXYZI>;
 template class IcpUsingPointMatcher<pcl::PointXYZ>;
+#ifdef _USE_COMPACT_POINT_
+template class IcpUsingPointMatcher<PointXYZIc>;
+#endif
 
 }  // namespace registrator
 }  // namespace static_map
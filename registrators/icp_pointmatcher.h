@@ -26,8 +26,12 @@
 #include <fstream>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include "builder/msg_conversion.h"
+#include "common/mutex.h"
+#include "registrators/prepared_target_cache.h"
 #include "registrators/registrator_interface.h"
+#include "registrators/soa_cloud.h"
 
 namespace static_map {
 namespace registrator {
@@ -40,14 +44,18 @@ class IcpUsingPointMatcher : public Interface<PointType> {
 
   explicit IcpUsingPointMatcher(const std::string& ymal_file = "")
       : Interface<PointType>(),
-        reference_cloud_(new PM::DataPoints),
+        yaml_file_(ymal_file),
         reading_cloud_(new PM::DataPoints) {
     Interface<PointType>::type_ = kIcpPM;
-    loadConfig(ymal_file);
+    if (!yaml_file_.empty() && !std::ifstream(yaml_file_.c_str()).good()) {
+      PRINT_ERROR_FMT("Cannot open config file: %s", yaml_file_.c_str());
+      exit(1);
+    }
   }
   ~IcpUsingPointMatcher() {
-    reference_cloud_.reset();
     reading_cloud_.reset();
+    current_target_.reset();
+    target_cache_.Clear();
   }
 
   inline void setInputSource(const PointCloudSourcePtr& cloud) override {
@@ -55,34 +63,60 @@ class IcpUsingPointMatcher : public Interface<PointType> {
       PRINT_ERROR("Empty cloud.");
       return;
     }
-    *reading_cloud_ =
-        sensors::pclPointCloudToLibPointMatcherPoints<PointType>(cloud);
+    reading_cloud_ = ConvertCloud(cloud);
+    this->source_cloud_ = cloud;
 
     CHECK(reading_cloud_->getNbPoints() == cloud->points.size());
   }
 
-  inline void setInputTarget(const PointCloudTargetPtr& cloud) override {
-    if (!cloud || cloud->empty()) {
-      PRINT_ERROR("Empty cloud.");
-      return;
-    }
-    *reference_cloud_ =
-        sensors::pclPointCloudToLibPointMatcherPoints<PointType>(cloud);
+  void setInputTarget(const PointCloudTargetPtr& cloud) override;
 
-    CHECK(reference_cloud_->getNbPoints() == cloud->points.size());
+  std::unique_ptr<Interface<PointType>> cloneWithSource() const override {
+    std::unique_ptr<IcpUsingPointMatcher> matcher(
+        new IcpUsingPointMatcher(yaml_file_));
+    matcher->max_iterations_ = max_iterations_;
+    // the reading cloud is never modified by icp
+    matcher->reading_cloud_ = reading_cloud_;
+    matcher->source_cloud_ = this->source_cloud_;
+    return matcher;
   }
 
   bool align(const Eigen::Matrix4f& guess, Eigen::Matrix4f& result) override;
 
+  /// @brief an extra counter checker is added to the configured ones
+  void setMaximumIterations(const int iterations) override {
+    max_iterations_ = iterations;
+  }
+
  protected:
-  void loadDefaultConfig();
-  void loadConfig(const std::string& yaml_filename);
+  /// @brief the converted clouds are shared by all the matchers, e.g. the
+  /// source submap of a match is the target of the next one. only weak
+  /// references are kept, a converted cloud lives as long as a matcher (its
+  /// source or target cache) holds it
+  static std::shared_ptr<PM::DataPoints> ConvertCloud(
+      const PointCloudSourcePtr& cloud);
+
+  void loadDefaultConfig(PM::ICPChainBase* const icp);
+  void loadConfig(const std::string& yaml_filename,
+                  PM::ICPChainBase* const icp);
 
  private:
-  std::shared_ptr<PM::DataPoints> reference_cloud_;
+  // everything prepared for a target cloud
+  struct PreparedTarget {
+    std::shared_ptr<PM::DataPoints> reference_cloud;
+    // holds the filtered reference and its kd-tree
+    std::shared_ptr<PM::ICPSequence> icp;
+    // the number of the configured transformation checkers
+    size_t checkers_num = 0;
+    // kd-tree of the unfiltered reference for scoring
+    std::shared_ptr<PM::Matcher> score_matcher;
+  };
+
+  std::string yaml_file_;
+  int max_iterations_ = 0;
   std::shared_ptr<PM::DataPoints> reading_cloud_;
-
-  PM::ICP pm_icp_;
+  std::shared_ptr<PreparedTarget> current_target_;
+  PreparedTargetCache<PointCloudTargetPtr, PreparedTarget> target_cache_;
 };
 
 }  // namespace registrator
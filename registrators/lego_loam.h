@@ -79,9 +79,8 @@ class LegoLoam : public Interface<PointT> {
       if (cloud == source_data_.raw_cloud) {
         return;
       } else if (cloud == target_data_.raw_cloud) {
-        source_data_.raw_cloud = target_data_.raw_cloud;
-        *source_data_.ground_removed_cloud = *target_data_.ground_removed_cloud;
-        *source_data_.segmented_cloud = *target_data_.segmented_cloud;
+        // shared, not copied
+        source_data_ = target_data_;
         return;
       }
     }
@@ -94,9 +93,7 @@ class LegoLoam : public Interface<PointT> {
       if (cloud == target_data_.raw_cloud) {
         return;
       } else if (cloud == source_data_.raw_cloud) {
-        target_data_.raw_cloud = source_data_.raw_cloud;
-        *target_data_.ground_removed_cloud = *source_data_.ground_removed_cloud;
-        *target_data_.segmented_cloud = *source_data_.segmented_cloud;
+        target_data_ = source_data_;
         return;
       }
     }
@@ -128,9 +125,17 @@ class LegoLoam : public Interface<PointT> {
       PRINT_ERROR("Empty cloud.");
       return;
     }
-    // clear the former data
+    // the buffers are re-used unless they are shared with the other data
+    if (data.ground_removed_cloud.use_count() > 1) {
+      data.ground_removed_cloud.reset(new PointCloudType);
+    }
+    if (data.segmented_cloud.use_count() > 1) {
+      data.segmented_cloud.reset(new pcl::PointCloud<LabeledPointType>);
+    }
     data.ground_removed_cloud->clear();
     data.segmented_cloud->clear();
+    data.ground_removed_cloud->reserve(cloud->size());
+    data.segmented_cloud->reserve(cloud->size());
 
     ground_removal_filter_.SetInputCloud(cloud);
     ground_removal_filter_.Filter(data.ground_removed_cloud);
@@ -142,7 +147,7 @@ class LegoLoam : public Interface<PointT> {
       ground_point.y = cloud->points[i].y;
       ground_point.z = cloud->points[i].z;
       ground_point.label = kGroundLabel;
-      source_data_.segmented_cloud->push_back(ground_point);
+      data.segmented_cloud->push_back(ground_point);
     }
   }
 
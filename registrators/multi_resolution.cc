@@ -0,0 +1,133 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "registrators/multi_resolution.h"
+#include "common/point_types.h"
+
+#include <utility>
+
+namespace static_map {
+namespace registrator {
+
+template <typename PointType>
+MultiResolution<PointType>::MultiResolution(
+    const std::shared_ptr<Interface<PointType>>& matcher,
+    const std::vector<Level>& levels)
+    : Interface<PointType>(), matcher_(matcher), levels_(levels) {
+  CHECK(matcher_);
+  CHECK(!levels_.empty());
+}
+
+template <typename PointType>
+std::vector<typename MultiResolution<PointType>::Level>
+MultiResolution<PointType>::MakeLevels(const int levels_num,
+                                       const float base_resolution,
+                                       const int coarse_max_iterations) {
+  CHECK_GT(levels_num, 0);
+  std::vector<Level> levels(levels_num);
+  float resolution = base_resolution;
+  for (int i = levels_num - 2; i >= 0; --i) {
+    levels[i].resolution = resolution;
+    levels[i].max_iterations = coarse_max_iterations;
+    resolution *= 2.f;
+  }
+  levels.back().resolution = 0.f;
+  levels.back().max_iterations = 0;
+  return levels;
+}
+
+template <typename PointType>
+typename MultiResolution<PointType>::PointCloudSourcePtr
+MultiResolution<PointType>::LevelCloud(
+    const std::shared_ptr<CloudAttachments<PointType>>& attachments,
+    const float resolution) const {
+  if (resolution <= 0.f) {
+    return attachments->Cloud();
+  }
+  return attachments->GetDownsampled(resolution)->Cloud();
+}
+
+template <typename PointType>
+bool MultiResolution<PointType>::align(const Eigen::Matrix4f& guess,
+                                       Eigen::Matrix4f& result) {
+  if (!this->source_cloud_ || !this->target_cloud_) {
+    PRINT_ERROR("Empty cloud.");
+    return false;
+  }
+  // every level has its own prepared targets
+  matcher_->setTargetCacheSize(this->target_cache_size_ * levels_.size());
+  using Attachments = CloudAttachments<PointType>;
+  source_attachments_ = Attachments::Get(this->source_cloud_);
+  const auto target =
+      Attachments::Get(this->target_cloud_, this->target_cache_size_,
+                       this->pinned_target_cloud_, &target_attachments_);
+
+  Eigen::Matrix4f level_guess = guess;
+  bool succeed = false;
+  this->final_iterations_ = 0;
+  for (const Level& level : levels_) {
+    matcher_->setMaximumIterations(level.max_iterations);
+    matcher_->setInputSource(LevelCloud(source_attachments_, level.resolution));
+    matcher_->setInputTarget(LevelCloud(target, level.resolution));
+    Eigen::Matrix4f level_result;
+    succeed = matcher_->align(level_guess, level_result);
+    // the sum of all levels
+    const int iterations = matcher_->getFinalNumIteration();
+    if (iterations < 0 || this->final_iterations_ < 0) {
+      this->final_iterations_ = -1;
+    } else {
+      this->final_iterations_ += iterations;
+    }
+    // a failed coarse level does not spoil the guess of the next one
+    if (succeed) {
+      level_guess = level_result;
+    }
+  }
+  result = level_guess;
+  this->final_score_ = matcher_->getFitnessScore();
+  return succeed;
+}
+
+template <typename PointType>
+std::unique_ptr<Interface<PointType>>
+MultiResolution<PointType>::cloneWithSource() const {
+  // the source of every level is set in align, so only the settings of the
+  // matcher are needed
+  std::shared_ptr<Interface<PointType>> matcher = matcher_->cloneWithSource();
+  if (!matcher) {
+    return nullptr;
+  }
+  std::unique_ptr<MultiResolution<PointType>> clone(
+      new MultiResolution<PointType>(matcher, levels_));
+  clone->source_cloud_ = this->source_cloud_;
+  clone->target_cache_size_ = this->target_cache_size_;
+  return clone;
+}
+
+template class MultiResolution<pcl::PointXYZI>;
+template class MultiResolution<pcl::PointXYZ>;
+#ifdef _USE_COMPACT_POINT_
+template class MultiResolution<PointXYZIc>;
+#endif
+
+}  // namespace registrator
+}  // namespace static_map
@@ -0,0 +1,90 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef REGISTRATORS_MULTI_RESOLUTION_H_
+#define REGISTRATORS_MULTI_RESOLUTION_H_
+
+#include <glog/logging.h>
+#include <memory>
+#include <vector>
+
+#include "registrators/cloud_attachments.h"
+#include "registrators/registrator_interface.h"
+
+namespace static_map {
+namespace registrator {
+
+/*
+ * @class MultiResolution
+ * @brief coarse to fine registration with any registrator. the clouds are
+ * down sampled into a pyramid and the result of a level is the guess of
+ * the next one. the pyramids are cached in the attachments of the clouds,
+ * so a recent target (within the target cache size) matched again does not
+ * down sample again
+ */
+template <typename PointType>
+class MultiResolution : public Interface<PointType> {
+ public:
+  USE_REGISTRATOR_CLOUDS;
+
+  struct Level {
+    // voxel size of the down sampling, <= 0 for the original cloud
+    float resolution;
+    // <= 0 for the default of the registrator
+    int max_iterations;
+  };
+
+  /// @param levels from coarse to fine
+  MultiResolution(const std::shared_ptr<Interface<PointType>>& matcher,
+                  const std::vector<Level>& levels);
+
+  /// @brief levels_num - 1 coarse levels of coarse_max_iterations with
+  /// resolution doubled from base_resolution, then the original cloud
+  static std::vector<Level> MakeLevels(const int levels_num,
+                                       const float base_resolution,
+                                       const int coarse_max_iterations);
+
+  bool align(const Eigen::Matrix4f& guess, Eigen::Matrix4f& result) override;
+  std::unique_ptr<Interface<PointType>> cloneWithSource() const override;
+
+  double getFitnessScore() override { return matcher_->getFitnessScore(); }
+  InlierPointPairs getInlierPointPairs() override {
+    return matcher_->getInlierPointPairs();
+  }
+
+ private:
+  PointCloudSourcePtr LevelCloud(
+      const std::shared_ptr<CloudAttachments<PointType>>& attachments,
+      const float resolution) const;
+
+  std::shared_ptr<Interface<PointType>> matcher_;
+  std::vector<Level> levels_;
+  // hold the pyramids of the last source and the recent targets, the
+  // registry of the attachments only keeps weak references
+  std::shared_ptr<CloudAttachments<PointType>> source_attachments_;
+  typename CloudAttachments<PointType>::Cache target_attachments_;
+};
+
+}  // namespace registrator
+}  // namespace static_map
+
+#endif  // REGISTRATORS_MULTI_RESOLUTION_H_
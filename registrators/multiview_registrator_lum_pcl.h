@@ -23,10 +23,15 @@
 #ifndef REGISTRATORS_MULTIVIEW_REGISTRATOR_LUM_PCL_H_
 #define REGISTRATORS_MULTIVIEW_REGISTRATOR_LUM_PCL_H_
 
+#include <utility>
 #include <vector>
 
 #include "pcl/registration/correspondence_estimation.h"
 #include "pcl/registration/lum.h"
+#include "pcl/search/kdtree.h"
+
+#include "common/point_types.h"
+#include "common/shared_executor.h"
 #include "registrators/multiview_registrator_interface.h"
 
 namespace static_map {
@@ -36,6 +41,7 @@ template <typename PointT>
 class MultiviewRegistratorLumPcl : public MultiviewInterface<PointT> {
  public:
   using PointCloudPtr = typename MultiviewInterface<PointT>::PointCloudPtr;
+  using KdTree = pcl::search::KdTree<PointT>;
 
   MultiviewRegistratorLumPcl() : MultiviewInterface<PointT>() {
     lum_.setMaxIterations(5);
@@ -52,23 +58,51 @@ class MultiviewRegistratorLumPcl : public MultiviewInterface<PointT> {
       return;
     }
 
-    std::vector<PointCloudPtr> transformed_clouds;
+    const int frame_num = frames.size();
+    std::vector<PointCloudPtr> transformed_clouds(frame_num);
+    common::ParallelFor(0, frame_num, frame_num, [&](const int i) {
+      transformed_clouds[i].reset(new pcl::PointCloud<PointT>);
+      common::TransformPointCloud(*frames[i].cloud,
+                                  transformed_clouds[i].get(), frames[i].pose);
+    });
+    // the clouds are added only once, the poses are updated by lum
+    for (int i = 0; i < frame_num; ++i) {
+      lum_.addPointCloud(transformed_clouds[i]);
+    }
+
+    std::vector<std::pair<int, int>> frame_pairs;
+    for (int i = 0; i < frame_num; ++i) {
+      for (int j = 0; j < i; ++j) {
+        frame_pairs.emplace_back(j, i);
+      }
+    }
+    const int pair_num = frame_pairs.size();
+    std::vector<typename KdTree::Ptr> kdtrees(frame_num);
+    std::vector<pcl::CorrespondencesPtr> correspondences(pair_num);
     for (int iter_index = 0; iter_index < max_iteration_num_; ++iter_index) {
-      for (size_t i = 0; i < frames.size(); ++i) {
-        PointCloudPtr transformed_cloud(new pcl::PointCloud<PointT>);
-        pcl::transformPointCloud(*frames[i].cloud, *transformed_cloud,
-                                 frames[i].pose);
-        lum_.addPointCloud(transformed_cloud);
-        transformed_clouds.push_back(transformed_cloud);
-
-        for (size_t j = 0; j < i; ++j) {
-          pcl::registration::CorrespondenceEstimation<PointT, PointT> ce;
-          ce.setInputTarget(transformed_clouds[i]);
-          ce.setInputSource(transformed_clouds[j]);
-          pcl::CorrespondencesPtr corr(new pcl::Correspondences);
-          ce.determineCorrespondences(*corr, 0.25);
-
-          if (corr->size() > 2) lum_.setCorrespondences(j, i, corr);
+      // one kd-tree per frame for all the pairs
+      common::ParallelFor(0, frame_num, frame_num, [&](const int i) {
+        if (iter_index > 0) {
+          transformed_clouds[i] = lum_.getTransformedCloud(i);
+        }
+        kdtrees[i].reset(new KdTree);
+        kdtrees[i]->setInputCloud(transformed_clouds[i]);
+      });
+      common::ParallelFor(0, pair_num, pair_num, [&](const int k) {
+        const int source = frame_pairs[k].first;
+        const int target = frame_pairs[k].second;
+        pcl::registration::CorrespondenceEstimation<PointT, PointT> ce;
+        ce.setInputTarget(transformed_clouds[target]);
+        ce.setSearchMethodTarget(kdtrees[target], true);
+        ce.setInputSource(transformed_clouds[source]);
+        correspondences[k].reset(new pcl::Correspondences);
+        ce.determineCorrespondences(*correspondences[k], 0.25);
+      });
+      // the graph of lum is not thread safe
+      for (int k = 0; k < pair_num; ++k) {
+        if (correspondences[k]->size() > 2) {
+          lum_.setCorrespondences(frame_pairs[k].first, frame_pairs[k].second,
+                                  correspondences[k]);
         }
       }
       lum_.compute();
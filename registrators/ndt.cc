@@ -21,6 +21,12 @@
 // SOFTWARE.
 
 #include "registrators/ndt.h"
+
+#include <cmath>
+
+#include "common/point_types.h"
+#include "common/shared_executor.h"
+#include "glog/logging.h"
 #include "pclomp/voxel_grid_covariance_omp_impl.hpp"
 
 namespace static_map {
@@ -29,34 +35,176 @@ namespace registrator {
 template <typename PointType>
 Ndt<PointType>::Ndt() : Interface<PointType>() {
   this->type_ = kNdt;
-  inner_matcher_.setResolution(1.);
-  inner_matcher_.setNumThreads(6);
-  inner_matcher_.setNeighborhoodSearchMethod(pclomp::KDTREE);
 }
 
 template <typename PointType>
 Ndt<PointType>::~Ndt() {}
 
+template <typename PointType>
+void Ndt<PointType>::setInputTarget(const PointCloudTargetPtr& cloud) {
+  Interface<PointType>::setInputTarget(cloud);
+  if (!this->target_cloud_) {
+    inner_matcher_.reset();
+    return;
+  }
+  inner_matcher_ = target_cache_.Find(this->target_cloud_);
+  if (inner_matcher_) {
+    return;
+  }
+
+  // the voxel grid is built here only once
+  inner_matcher_ = BuildMatcher();
+  inner_matcher_->setInputTarget(this->target_cloud_);
+  target_cache_.Insert(this->target_cloud_, inner_matcher_,
+                       this->target_cache_size_, this->pinned_target_cloud_);
+}
+
+template <typename PointType>
+void Ndt<PointType>::setInputTarget(const PointCloudTargetPtr& cloud,
+                                    const int target_id) {
+  if (!shared_target_cache_ || target_id < 0 || !cloud) {
+    setInputTarget(cloud);
+    return;
+  }
+  Interface<PointType>::setInputTarget(cloud);
+  if (!shared_target_matcher_) {
+    shared_target_matcher_ = BuildMatcher();
+  }
+  typename NdtTargetCache<PointType>::Target target;
+  if (!shared_target_cache_->Find(target_id, cloud, &target)) {
+    // built by this matcher, read only once in the cache
+    shared_target_matcher_->setInputTarget(cloud);
+    target.cells = shared_target_matcher_->getSharedTargetCells();
+    target.tree.reset(new pcl::search::KdTree<PointType>);
+    target.tree->setInputCloud(cloud);
+    shared_target_cache_->Insert(target_id, cloud, target);
+  }
+  shared_target_matcher_->setInputTarget(cloud, target.cells, target.tree);
+  inner_matcher_ = shared_target_matcher_;
+}
+
+template <typename PointType>
+void Ndt<PointType>::updateInputTarget(
+    const PointCloudTargetPtr& cloud, const PointCloudTargetPtr& added_points,
+    const PointCloudTargetPtr& removed_points) {
+  // the shared grid of another target is never updated in place
+  if (!inner_matcher_ || inner_matcher_ == shared_target_matcher_ || !cloud ||
+      cloud->empty()) {
+    setInputTarget(cloud);
+    return;
+  }
+  // the matcher is not for the old target any more
+  target_cache_.Erase(this->target_cloud_);
+  Interface<PointType>::setInputTarget(cloud);
+  inner_matcher_->updateInputTarget(this->target_cloud_, added_points,
+                                    removed_points);
+  target_cache_.Insert(this->target_cloud_, inner_matcher_,
+                       this->target_cache_size_, this->pinned_target_cloud_);
+}
+
+template <typename PointType>
+std::shared_ptr<typename Ndt<PointType>::NdtRegistrator>
+Ndt<PointType>::BuildMatcher() const {
+  std::shared_ptr<NdtRegistrator> matcher(new NdtRegistrator);
+  matcher->setResolution(1.);
+  matcher->setNumThreads(common::SharedExecutor::ThreadNum());
+  matcher->setNeighborhoodSearchMethod(pclomp::KDTREE);
+  return matcher;
+}
+
 template <typename PointType>
 bool Ndt<PointType>::align(const Eigen::Matrix4f& guess,
                            Eigen::Matrix4f& result) {
-  if (!this->source_cloud_ || !this->target_cloud_) {
+  if (!this->source_cloud_ || !inner_matcher_) {
     return false;
   }
-  inner_matcher_.setInputSource(this->source_cloud_);
-  inner_matcher_.setInputTarget(this->target_cloud_);
+  inner_matcher_->setInputSource(this->source_cloud_);
+  // 35 is the default of pcl
+  const int max_iterations = max_iterations_ > 0 ? max_iterations_ : 35;
+  inner_matcher_->setMaximumIterations(max_iterations);
 
   PointCloudTargetPtr aligned_cloud(new PointCloudTarget);
-  inner_matcher_.align(*aligned_cloud, guess);
+  inner_matcher_->align(*aligned_cloud, guess);
+  this->final_iterations_ = inner_matcher_->getFinalNumIteration();
 
-  this->final_score_ = inner_matcher_.getFitnessScore();
-  result = inner_matcher_.getFinalTransformation();
+  // same as the other registrators, the higher the better
+  this->final_score_ = std::exp(-inner_matcher_->getFitnessScore());
+  result = inner_matcher_->getFinalTransformation();
 
   return true;
 }
 
+template <typename PointType>
+bool NdtTargetCache<PointType>::Find(const int id, const PointCloudPtr& cloud,
+                                     Target* const target) {
+  CHECK(target);
+  common::MutexLocker locker(&mutex_);
+  for (auto it = items_.begin(); it != items_.end(); ++it) {
+    if (it->id == id && it->cloud == cloud) {
+      // move to the front (most recently used)
+      items_.splice(items_.begin(), items_, it);
+      *target = items_.front().target;
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename PointType>
+void NdtTargetCache<PointType>::Insert(const int id,
+                                       const PointCloudPtr& cloud,
+                                       const Target& target) {
+  const size_t memory = TargetMemory(target, cloud->size());
+  common::MutexLocker locker(&mutex_);
+  // the cloud of the id is changed
+  for (auto it = items_.begin(); it != items_.end(); ++it) {
+    if (it->id == id) {
+      memory_used_ -= it->memory;
+      items_.erase(it);
+      break;
+    }
+  }
+  items_.push_front(Item{id, cloud, target, memory});
+  memory_used_ += memory;
+  // keep the newest one even if it is over the budget
+  while (memory_used_ > memory_budget_ && items_.size() > 1) {
+    memory_used_ -= items_.back().memory;
+    items_.pop_back();
+  }
+}
+
+template <typename PointType>
+void NdtTargetCache<PointType>::Clear() {
+  common::MutexLocker locker(&mutex_);
+  items_.clear();
+  memory_used_ = 0;
+}
+
+template <typename PointType>
+size_t NdtTargetCache<PointType>::MemoryUsed() {
+  common::MutexLocker locker(&mutex_);
+  return memory_used_;
+}
+
+template <typename PointType>
+size_t NdtTargetCache<PointType>::TargetMemory(const Target& target,
+                                               const size_t target_size) {
+  using Leaf = typename pclomp::VoxelGridCovariance<PointType>::Leaf;
+  // leaves in std::map, with about 4 pointers for every node
+  const size_t leaf_memory = sizeof(Leaf) + 4 * sizeof(void*);
+  // the target and its kd-tree
+  return target.cells->getLeaves().size() * leaf_memory +
+         2 * target_size * sizeof(PointType);
+}
+
 template class Ndt<pcl::PointXYZI>;
 template class Ndt<pcl::PointXYZ>;
+template class NdtTargetCache<pcl::PointXYZI>;
+template class NdtTargetCache<pcl::PointXYZ>;
+#ifdef _USE_COMPACT_POINT_
+template class Ndt<PointXYZIc>;
+template class NdtTargetCache<PointXYZIc>;
+#endif
 
 }  // namespace registrator
 }  // namespace static_map
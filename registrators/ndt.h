@@ -22,6 +22,11 @@
 
 #pragma once
 
+#include <list>
+#include <memory>
+
+#include "common/mutex.h"
+#include "registrators/prepared_target_cache.h"
 #include "registrators/registrator_interface.h"
 
 #include "pclomp/ndt_omp_impl.hpp"
@@ -29,6 +34,53 @@
 namespace static_map {
 namespace registrator {
 
+/*
+ * @class NdtTargetCache
+ * @brief the voxel grids and kd-trees built for the targets, keyed by the
+ * id of the target (e.g. index of submap) so that they can be shared by the
+ * matchers created for every pair. they are read only once built, every
+ * matcher aligns with its own pclomp instance on them. the least recently
+ * used ones are dropped once over the memory budget
+ */
+template <typename PointType>
+class NdtTargetCache {
+ public:
+  using NdtRegistrator =
+      pclomp::NormalDistributionsTransform<PointType, PointType>;
+  using PointCloudPtr = typename pcl::PointCloud<PointType>::Ptr;
+
+  struct Target {
+    typename NdtRegistrator::SharedTargetGrid cells;
+    typename NdtRegistrator::KdTreePtr tree;
+  };
+
+  explicit NdtTargetCache(const size_t memory_budget)
+      : memory_budget_(memory_budget) {}
+
+  /// @brief return false if it is not in cache or built for another cloud
+  bool Find(const int id, const PointCloudPtr& cloud, Target* const target);
+  void Insert(const int id, const PointCloudPtr& cloud, const Target& target);
+  void Clear();
+
+  size_t MemoryUsed();
+
+  /// @brief approximate memory of the voxel grid and the kd-tree
+  static size_t TargetMemory(const Target& target, const size_t target_size);
+
+ private:
+  struct Item {
+    int id;
+    PointCloudPtr cloud;
+    Target target;
+    size_t memory;
+  };
+
+  const size_t memory_budget_;
+  common::Mutex mutex_;
+  std::list<Item> items_ GUARDED_BY(mutex_);
+  size_t memory_used_ GUARDED_BY(mutex_) = 0;
+};
+
 template <typename PointType>
 class Ndt : public Interface<PointType> {
  public:
@@ -40,10 +92,37 @@ class Ndt : public Interface<PointType> {
   Ndt();
   ~Ndt();
 
+  void setInputTarget(const PointCloudTargetPtr& cloud) override;
+  /// @brief use the shared cache if target_id >= 0, only the voxel grid and
+  /// the kd-tree are shared, so the registrators can align concurrently
+  void setInputTarget(const PointCloudTargetPtr& cloud, const int target_id);
+  /// @brief only the voxels touched by the changed points are updated
+  void updateInputTarget(const PointCloudTargetPtr& cloud,
+                         const PointCloudTargetPtr& added_points,
+                         const PointCloudTargetPtr& removed_points) override;
+
+  void setSharedTargetCache(
+      const std::shared_ptr<NdtTargetCache<PointType>>& cache) {
+    shared_target_cache_ = cache;
+  }
+
   bool align(const Eigen::Matrix4f& guess, Eigen::Matrix4f& result) override;
 
+  void setMaximumIterations(const int iterations) override {
+    max_iterations_ = iterations;
+  }
+
+ private:
+  std::shared_ptr<NdtRegistrator> BuildMatcher() const;
+
  private:
-  NdtRegistrator inner_matcher_;
+  // every target has its own matcher with the voxel grid built
+  std::shared_ptr<NdtRegistrator> inner_matcher_;
+  PreparedTargetCache<PointCloudTargetPtr, NdtRegistrator> target_cache_;
+  std::shared_ptr<NdtTargetCache<PointType>> shared_target_cache_;
+  // aligns on the shared targets, not shared with other registrators
+  std::shared_ptr<NdtRegistrator> shared_target_matcher_;
+  int max_iterations_ = 0;
 };
 
 }  // namespace registrator
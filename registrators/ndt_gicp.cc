@@ -21,6 +21,7 @@
 // SOFTWARE.
 
 #include "registrators/ndt_gicp.h"
+#include "common/point_types.h"
 
 namespace static_map {
 namespace registrator {
@@ -39,38 +40,50 @@ NdtWithGicp<PointType>::NdtWithGicp(bool using_voxel_filter,
 
   gicp_.setRotationEpsilon(1e-3);
   gicp_.setMaximumIterations(35);
+}
+
+template <typename PointType>
+void NdtWithGicp<PointType>::setMaximumIterations(const int iterations) {
+  const int max_iterations = iterations > 0 ? iterations : 35;
+  ndt_.setMaximumIterations(max_iterations);
+  gicp_.setMaximumIterations(max_iterations);
+}
 
-  approximate_voxel_filter_.setLeafSize(voxel_resolution_, voxel_resolution_,
-                                        voxel_resolution_);
+template <typename PointType>
+std::unique_ptr<Interface<PointType>> NdtWithGicp<PointType>::cloneWithSource()
+    const {
+  // the down sampled source and its kd-tree and covariances are shared
+  // through the attachments
+  std::unique_ptr<NdtWithGicp<PointType>> matcher(
+      new NdtWithGicp<PointType>(using_voxel_filter_, voxel_resolution_));
+  matcher->enableNdt(use_ndt_);
+  matcher->setMaximumIterations(gicp_.getMaximumIterations());
+  matcher->source_cloud_ = this->source_cloud_;
+  return matcher;
 }
 
 template <typename PointType>
 bool NdtWithGicp<PointType>::align(const Eigen::Matrix4f& guess,
                                    Eigen::Matrix4f& result) {
+  // the down sampled clouds, kd-trees and covariances are shared with the
+  // other registrations using the same clouds
+  using Attachments = CloudAttachments<PointType>;
+  source_attachments_ = Attachments::Get(this->source_cloud_);
+  auto source = source_attachments_;
+  auto target =
+      Attachments::Get(this->target_cloud_, this->target_cache_size_,
+                       this->pinned_target_cloud_, &target_attachments_);
   if (using_voxel_filter_) {
-    if (!down_sampled_source_cloud_) {
-      down_sampled_source_cloud_ = boost::make_shared<PointCloudSource>();
-    }
-    if (!down_sampled_target_cloud_) {
-      down_sampled_target_cloud_ = boost::make_shared<PointCloudTarget>();
-    }
-
-    approximate_voxel_filter_.setInputCloud(this->source_cloud_);
-    approximate_voxel_filter_.filter(*down_sampled_source_cloud_);
-
-    approximate_voxel_filter_.setInputCloud(this->target_cloud_);
-    approximate_voxel_filter_.filter(*down_sampled_target_cloud_);
-  } else {
-    down_sampled_source_cloud_ = this->source_cloud_;
-    down_sampled_target_cloud_ = this->target_cloud_;
+    source = source->GetDownsampled(voxel_resolution_);
+    target = target->GetDownsampled(voxel_resolution_);
   }
 
   PointCloudSourcePtr output_cloud(new PointCloudSource);
   Eigen::Matrix4f ndt_guess = guess;
   double ndt_score = 0.9;
   if (use_ndt_) {
-    ndt_.setInputSource(down_sampled_source_cloud_);
-    ndt_.setInputTarget(down_sampled_target_cloud_);
+    ndt_.setInputSource(source->Cloud());
+    ndt_.setInputTarget(target->Cloud());
     ndt_.align(*output_cloud, guess);
     ndt_score = ndt_.getFitnessScore();
 
@@ -82,8 +95,14 @@ bool NdtWithGicp<PointType>::align(const Eigen::Matrix4f& guess,
   if (ndt_score <= 1.) {
     icp_score = ndt_score;
 
-    gicp_.setInputSource(down_sampled_source_cloud_);
-    gicp_.setInputTarget(down_sampled_target_cloud_);
+    const int k = gicp_.getCorrespondenceRandomness();
+    // the covariances should be set after the clouds
+    gicp_.setInputSource(source->Cloud());
+    gicp_.setSearchMethodSource(source->GetKdTree(), true);
+    gicp_.setSourceCovariances(source->GetCovariances(k));
+    gicp_.setInputTarget(target->Cloud());
+    gicp_.setSearchMethodTarget(target->GetKdTree(), true);
+    gicp_.setTargetCovariances(target->GetCovariances(k));
     gicp_.align(*output_cloud, ndt_guess);
 
     icp_score = gicp_.getFitnessScore();
@@ -103,6 +122,9 @@ bool NdtWithGicp<PointType>::align(const Eigen::Matrix4f& guess,
 
 template class NdtWithGicp<pcl::PointXYZI>;
 template class NdtWithGicp<pcl::PointXYZ>;
+#ifdef _USE_COMPACT_POINT_
+template class NdtWithGicp<PointXYZIc>;
+#endif
 
 }  // namespace registrator
 }  // namespace static_map
@@ -32,6 +32,7 @@
 #include "pcl/search/impl/search.hpp"
 
 #include "common/macro_defines.h"
+#include "registrators/cloud_attachments.h"
 #include "registrators/registrator_interface.h"
 
 namespace static_map {
@@ -50,20 +51,22 @@ class NdtWithGicp : public Interface<PointType> {
   typedef boost::shared_ptr<const NdtWithGicp<PointType> > ConstPtr;
 
   bool align(const Eigen::Matrix4f& guess, Eigen::Matrix4f& result) override;
+  std::unique_ptr<Interface<PointType>> cloneWithSource() const override;
 
   inline void enableNdt(bool use_ndt) { use_ndt_ = use_ndt; }
+  void setMaximumIterations(const int iterations) override;
 
  private:
   pcl::NormalDistributionsTransform<PointType, PointType> ndt_;
   pcl::GeneralizedIterativeClosestPoint<PointType, PointType> gicp_;
 
-  PointCloudSourcePtr down_sampled_source_cloud_ = nullptr;
-  PointCloudTargetPtr down_sampled_target_cloud_ = nullptr;
-
-  pcl::ApproximateVoxelGrid<PointType> approximate_voxel_filter_;
   double voxel_resolution_;
   bool using_voxel_filter_;
   bool use_ndt_ = true;
+  // hold the attachments (with the down sampled clouds) of the last source
+  // and the recent targets, the registry only keeps weak references
+  std::shared_ptr<CloudAttachments<PointType>> source_attachments_;
+  typename CloudAttachments<PointType>::Cache target_attachments_;
 };
 }  // namespace registrator
 }  // namespace static_map
@@ -97,6 +97,9 @@ namespace pclomp
 
 		typedef boost::shared_ptr< NormalDistributionsTransform<PointSource, PointTarget> > Ptr;
 		typedef boost::shared_ptr< const NormalDistributionsTransform<PointSource, PointTarget> > ConstPtr;
+		/** \brief The voxel grid of a target, shared by the instances aligning to the same target. */
+		typedef boost::shared_ptr< pclomp::VoxelGridCovariance<PointTarget> > SharedTargetGrid;
+		typedef typename pcl::Registration<PointSource, PointTarget>::KdTreePtr KdTreePtr;
 
 
 		/** \brief Constructor.
@@ -121,6 +124,57 @@ namespace pclomp
 			init();
 		}
 
+		/** \brief Provide the input target with the voxel grid and the kd-tree already built for it by
+		  * another instance, both are only read while aligning, so the instances can align concurrently.
+		  * \param[in] cloud the input point cloud target
+		  * \param[in] cells the voxel grid of the cloud, with the resolution of this instance
+		  * \param[in] tree the kd-tree of the cloud, for the fitness score
+		  */
+		inline void
+			setInputTarget(const PointCloudTargetConstPtr &cloud, const SharedTargetGrid &cells, const KdTreePtr &tree)
+		{
+			pcl::Registration<PointSource, PointTarget>::setInputTarget(cloud);
+			target_cells_ = cells;
+			pcl::Registration<PointSource, PointTarget>::setSearchMethodTarget(tree, true);
+		}
+
+		/** \brief Update the target with the changed points, only the touched voxels are re-computed.
+		  * \param[in] cloud the whole target cloud after the update
+		  * \param[in] added_points the points inserted into the target, may be null
+		  * \param[in] removed_points the points removed from the target, may be null
+		  * \return false if the voxel structure is rebuilt from scratch
+		  */
+		inline bool
+			updateInputTarget(const PointCloudTargetConstPtr &cloud, const PointCloudTargetConstPtr &added_points,
+												const PointCloudTargetConstPtr &removed_points)
+		{
+			pcl::Registration<PointSource, PointTarget>::setInputTarget(cloud);
+			// the kd-tree is rebuilt for the whole cloud when aligning
+			pcl::Registration<PointSource, PointTarget>::setSearchMethodTarget(KdTreePtr(new pcl::search::KdTree<PointTarget>), false);
+			// a shared grid is not touched, the new one is built from scratch;
+			// added first, a point inserted then removed again is in both
+			if (target_cells_.unique() &&
+					(!added_points || target_cells_->addPoints(*added_points)) &&
+					(!removed_points || target_cells_->removePoints(*removed_points)))
+				return true;
+			init();
+			return false;
+		}
+
+		/** \brief Get the covariance voxel structure of the target. */
+		inline const TargetGrid&
+			getTargetCells() const
+		{
+			return *target_cells_;
+		}
+
+		/** \brief Get the covariance voxel structure of the target, to share it with other instances. */
+		inline const SharedTargetGrid&
+			getSharedTargetCells() const
+		{
+			return target_cells_;
+		}
+
 		/** \brief Set/change the voxel grid resolution.
 		  * \param[in] resolution side length of voxels
 		  */
@@ -271,10 +325,13 @@ namespace pclomp
 		void inline
 			init()
 		{
-			target_cells_.setLeafSize(resolution_, resolution_, resolution_);
-			target_cells_.setInputCloud(target_);
+			// a new grid, the former one may be shared by other instances
+			target_cells_.reset(new TargetGrid);
+			target_cells_->setLeafSize(resolution_, resolution_, resolution_);
+			target_cells_->setNumThreads(num_threads_);
+			target_cells_->setInputCloud(target_);
 			// Initiate voxel structure.
-			target_cells_.filter(true);
+			target_cells_->filter(true);
 		}
 
 		/** \brief Compute derivatives of probability function w.r.t. the transformation vector.
@@ -442,7 +499,7 @@ namespace pclomp
 		}
 
 		/** \brief The voxel grid generated from target cloud containing point means and covariances. */
-		TargetGrid target_cells_;
+		SharedTargetGrid target_cells_;
 
 		//double fitness_epsilon_;
 
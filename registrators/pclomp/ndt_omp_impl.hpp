@@ -45,7 +45,7 @@
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 template<typename PointSource, typename PointTarget>
 pclomp::NormalDistributionsTransform<PointSource, PointTarget>::NormalDistributionsTransform () 
-  : target_cells_ ()
+  : target_cells_ (new TargetGrid)
   , resolution_ (1.0f)
   , step_size_ (0.1)
   , outlier_ratio_ (0.55)
@@ -232,17 +232,17 @@ pclomp::NormalDistributionsTransform<PointSource, PointTarget>::computeDerivativ
 		// Find nieghbors (Radius search has been experimentally faster than direct neighbor checking.
 		switch (search_method) {
 		case KDTREE:
-			target_cells_.radiusSearch(x_trans_pt, resolution_, neighborhood, distances);
+			target_cells_->radiusSearch(x_trans_pt, resolution_, neighborhood, distances);
 			break;
 		case DIRECT26:
-			target_cells_.getNeighborhoodAtPoint(x_trans_pt, neighborhood);
+			target_cells_->getNeighborhoodAtPoint(x_trans_pt, neighborhood);
 			break;
 		default:
 		case DIRECT7:
-			target_cells_.getNeighborhoodAtPoint7(x_trans_pt, neighborhood);
+			target_cells_->getNeighborhoodAtPoint7(x_trans_pt, neighborhood);
 			break;
 		case DIRECT1:
-			target_cells_.getNeighborhoodAtPoint1(x_trans_pt, neighborhood);
+			target_cells_->getNeighborhoodAtPoint1(x_trans_pt, neighborhood);
 			break;
 		}
 
@@ -567,7 +567,7 @@ pclomp::NormalDistributionsTransform<PointSource, PointTarget>::computeHessian (
     // Find nieghbors (Radius search has been experimentally faster than direct neighbor checking.
     std::vector<TargetGridLeafConstPtr> neighborhood;
     std::vector<float> distances;
-    target_cells_.radiusSearch (x_trans_pt, resolution_, neighborhood, distances);
+    target_cells_->radiusSearch (x_trans_pt, resolution_, neighborhood, distances);
 
     for (typename std::vector<TargetGridLeafConstPtr>::iterator neighborhood_it = neighborhood.begin (); neighborhood_it != neighborhood.end (); neighborhood_it++)
     {
@@ -928,7 +928,7 @@ double pclomp::NormalDistributionsTransform<PointSource, PointTarget>::calculate
 		// Find nieghbors (Radius search has been experimentally faster than direct neighbor checking.
 		std::vector<TargetGridLeafConstPtr> neighborhood;
 		std::vector<float> distances;
-		target_cells_.radiusSearch(x_trans_pt, resolution_, neighborhood, distances);
+		target_cells_->radiusSearch(x_trans_pt, resolution_, neighborhood, distances);
 
 		for (typename std::vector<TargetGridLeafConstPtr>::iterator neighborhood_it = neighborhood.begin(); neighborhood_it != neighborhood.end(); neighborhood_it++)
 		{
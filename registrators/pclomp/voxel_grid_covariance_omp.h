@@ -40,8 +40,10 @@
 
 #include <pcl/filters/boost.h>
 #include <pcl/filters/voxel_grid.h>
-#include <map>
+#include <algorithm>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 #include <pcl/point_types.h>
 #include <pcl/kdtree/kdtree_flann.h>
 
@@ -101,7 +103,10 @@ namespace pclomp
           cov_ (Eigen::Matrix3d::Identity ()),
           icov_ (Eigen::Matrix3d::Zero ()),
           evecs_ (Eigen::Matrix3d::Identity ()),
-          evals_ (Eigen::Vector3d::Zero ())
+          evals_ (Eigen::Vector3d::Zero ()),
+          nr_accumulated_ (0),
+          pt_sum_ (Eigen::Vector3d::Zero ()),
+          pt_sq_sum_ (Eigen::Matrix3d::Zero ())
         {
         }
 
@@ -184,6 +189,11 @@ namespace pclomp
         /** \brief Eigen values of voxel covariance matrix */
         Eigen::Vector3d evals_;
 
+        /** \brief Raw sums kept for incremental updates, see \ref addPoints and \ref removePoints */
+        int nr_accumulated_;
+        Eigen::Vector3d pt_sum_;
+        Eigen::Matrix3d pt_sq_sum_;
+
       };
 
       /** \brief Pointer to VoxelGridCovariance leaf structure */
@@ -192,7 +202,80 @@ namespace pclomp
       /** \brief Const pointer to VoxelGridCovariance leaf structure */
       typedef const Leaf* LeafConstPtr;
 
-    typedef std::map<size_t, Leaf> Map;
+      /** \brief Leaves sorted by their indices in one array, looked up with binary search.
+        * \note Cheaper to build and iterate than a std::map, the leaf pointers are invalidated
+        * by inserting new leaves (only in \ref filter and \ref addPoints), removed points keep their leaves.
+        */
+      class LeafArray
+      {
+        public:
+          typedef std::pair<size_t, Leaf> value_type;
+          typedef typename std::vector<value_type>::iterator iterator;
+          typedef typename std::vector<value_type>::const_iterator const_iterator;
+
+          iterator begin () { return leaves_.begin (); }
+          iterator end () { return leaves_.end (); }
+          const_iterator begin () const { return leaves_.begin (); }
+          const_iterator end () const { return leaves_.end (); }
+          size_t size () const { return leaves_.size (); }
+          bool empty () const { return leaves_.empty (); }
+          void clear () { leaves_.clear (); }
+
+          value_type& at (size_t position) { return leaves_[position]; }
+          const value_type& at (size_t position) const { return leaves_[position]; }
+
+          iterator
+          find (size_t index)
+          {
+            const auto it = lowerBound (leaves_.begin (), leaves_.end (), index);
+            return (it != leaves_.end () && it->first == index) ? it : leaves_.end ();
+          }
+
+          const_iterator
+          find (size_t index) const
+          {
+            const auto it = lowerBound (leaves_.begin (), leaves_.end (), index);
+            return (it != leaves_.end () && it->first == index) ? it : leaves_.end ();
+          }
+
+          /** \brief Take the leaves, they should be sorted by the indices without duplicates. */
+          void
+          assign (std::vector<value_type> &&sorted_leaves)
+          {
+            leaves_ = std::move (sorted_leaves);
+          }
+
+          /** \brief Insert empty leaves with the sorted and unique indices which are missing, in one merge. */
+          void
+          insert (const std::vector<size_t> &sorted_indices)
+          {
+            std::vector<value_type> merged;
+            merged.reserve (leaves_.size () + sorted_indices.size ());
+            auto it = leaves_.begin ();
+            for (const size_t index : sorted_indices)
+            {
+              for (; it != leaves_.end () && it->first < index; ++it)
+                merged.push_back (std::move (*it));
+              if (it == leaves_.end () || it->first != index)
+                merged.emplace_back (index, Leaf ());
+            }
+            for (; it != leaves_.end (); ++it)
+              merged.push_back (std::move (*it));
+            leaves_ = std::move (merged);
+          }
+
+        private:
+          template <typename Iterator> static Iterator
+          lowerBound (Iterator first, Iterator last, size_t index)
+          {
+            return std::lower_bound (first, last, index,
+                                     [] (const value_type &leaf, size_t value) { return leaf.first < value; });
+          }
+
+          std::vector<value_type> leaves_;
+      };
+
+    typedef LeafArray Map;
 
     public:
 
@@ -201,6 +284,7 @@ namespace pclomp
        */
       VoxelGridCovariance () :
         searchable_ (true),
+        num_threads_ (1),
         min_points_per_voxel_ (6),
         min_covar_eigvalue_mult_ (0.01),
         leaves_ (),
@@ -233,6 +317,16 @@ namespace pclomp
         }
       }
 
+      /** \brief Set the threads of binning the points and computing the leaf distributions.
+        * \param[in] num_threads the number of threads, the results do not depend on it
+        *  except for the rounding of the sums
+        */
+      inline void
+      setNumThreads (int num_threads)
+      {
+        num_threads_ = std::max (1, num_threads);
+      }
+
       /** \brief Get the minimum number of points required for a cell to be used.
         * \return the minimum number of points for required for a voxel to be used
         */
@@ -296,6 +390,21 @@ namespace pclomp
         }
       }
 
+      /** \brief Insert points into the initialized voxel structure, only the touched leaves are re-computed.
+       * \note The leaf indices depend on the bounding box, so it fails if any point is out of it.
+       * \param[in] cloud the points to insert
+       * \return false if the structure should be rebuilt with \ref filter
+       */
+      bool
+      addPoints (const PointCloud &cloud);
+
+      /** \brief Remove points inserted before from the voxel structure, only the touched leaves are re-computed.
+       * \param[in] cloud the points to remove, each one should have been inserted by \ref filter or \ref addPoints
+       * \return false if the structure should be rebuilt with \ref filter
+       */
+      bool
+      removePoints (const PointCloud &cloud);
+
       /** \brief Get the voxel containing point p.
        * \param[in] index the index of the leaf structure node
        * \return const pointer to leaf structure
@@ -383,7 +492,7 @@ namespace pclomp
        * \return a map contataining all leaves
        */
       inline const Map&
-      getLeaves ()
+      getLeaves () const
       {
         return leaves_;
       }
@@ -434,7 +543,7 @@ namespace pclomp
         k_leaves.reserve (k);
         for (std::vector<int>::iterator iter = k_indices.begin (); iter != k_indices.end (); iter++)
         {
-          k_leaves.push_back (&leaves_[voxel_centroids_leaf_indices_[*iter]]);
+          k_leaves.push_back (&leaves_.at (voxel_centroids_leaf_indices_[*iter]).second);
         }
         return k;
       }
@@ -488,12 +597,7 @@ namespace pclomp
         k_leaves.reserve (k);
         for (std::vector<int>::iterator iter = k_indices.begin (); iter != k_indices.end (); iter++)
         {
-		  auto leaf = leaves_.find(voxel_centroids_leaf_indices_[*iter]);
-		  if (leaf == leaves_.end()) {
-			  std::cerr << "error : could not find the leaf corresponding to the voxel" << std::endl;
-			  std::cin.ignore(1);
-		  }
-          k_leaves.push_back (&(leaf->second));
+          k_leaves.push_back (&leaves_.at (voxel_centroids_leaf_indices_[*iter]).second);
         }
         return k;
       }
@@ -525,9 +629,24 @@ namespace pclomp
        */
       void applyFilter (PointCloud &output);
 
+      /** \brief Compute mean, covariance and its inverse of a leaf from the raw sums.
+       * \param[in,out] leaf the leaf, nr_points is set to -1 if the covariance is singular
+       */
+      void computeLeafDistribution (Leaf &leaf) const;
+
+      /** \brief Accumulate the points into the raw sums of their leaves, then re-collect the centroids.
+       * \param[in] cloud the points
+       * \param[in] weight 1 to insert the points, -1 to remove them
+       * \return false if the structure should be rebuilt with \ref filter
+       */
+      bool accumulatePoints (const PointCloud &cloud, const int weight);
+
       /** \brief Flag to determine if voxel structure is searchable. */
       bool searchable_;
 
+      /** \brief Threads of \ref applyFilter. */
+      int num_threads_;
+
       /** \brief Minimum points contained with in a voxel to allow it to be useable. */
       int min_points_per_voxel_;
 
@@ -540,7 +659,7 @@ namespace pclomp
       /** \brief Point cloud containing centroids of voxels containing atleast minimum number of points. */
       PointCloudPtr voxel_centroids_;
 
-      /** \brief Indices of leaf structurs associated with each point in \ref voxel_centroids_ (used for searching). */
+      /** \brief Positions in \ref leaves_ of the leaf associated with each point in \ref voxel_centroids_ (used for searching). */
       std::vector<int> voxel_centroids_leaf_indices_;
 
       /** \brief KdTree generated using \ref voxel_centroids_ (used for searching). */
@@ -43,6 +43,10 @@
 #include "voxel_grid_covariance_omp.h"
 #include <Eigen/Dense>
 #include <Eigen/Cholesky>
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include <vector>
 
 //////////////////////////////////////////////////////////////////////////////////////////
 template<typename PointT> void
@@ -120,6 +124,7 @@ pclomp::VoxelGridCovariance<PointT>::applyFilter (PointCloud &output)
   }
 
   // If we don't want to process the entire cloud, but rather filter points far away from the viewpoint first...
+  int distance_offset = -1;
   if (!filter_field_name_.empty ())
   {
     // Get the distance field index
@@ -127,143 +132,177 @@ pclomp::VoxelGridCovariance<PointT>::applyFilter (PointCloud &output)
     int distance_idx = pcl::getFieldIndex (*input_, filter_field_name_, fields);
     if (distance_idx == -1)
       PCL_WARN ("[pcl::%s::applyFilter] Invalid filter field name. Index is %d.\n", getClassName ().c_str (), distance_idx);
+    else
+      distance_offset = fields[distance_idx].offset;
+  }
 
-    // First pass: go over all points and insert them into the right leaf
-    for (size_t cp = 0; cp < input_->points.size (); ++cp)
-    {
-      if (!input_->is_dense)
-        // Check if the point is invalid
-        if (!pcl_isfinite (input_->points[cp].x) ||
-            !pcl_isfinite (input_->points[cp].y) ||
-            !pcl_isfinite (input_->points[cp].z))
-          continue;
+  // The leaf index of a point, -1 if the point is invalid or filtered out
+  auto point_leaf_index = [&] (size_t cp) -> int
+  {
+    const PointT& point = input_->points[cp];
+    if (!input_->is_dense)
+      // Check if the point is invalid
+      if (!pcl_isfinite (point.x) || !pcl_isfinite (point.y) || !pcl_isfinite (point.z))
+        return -1;
 
+    if (distance_offset >= 0)
+    {
       // Get the distance value
-      const uint8_t* pt_data = reinterpret_cast<const uint8_t*> (&input_->points[cp]);
+      const uint8_t* pt_data = reinterpret_cast<const uint8_t*> (&point);
       float distance_value = 0;
-      memcpy (&distance_value, pt_data + fields[distance_idx].offset, sizeof (float));
+      memcpy (&distance_value, pt_data + distance_offset, sizeof (float));
 
       if (filter_limit_negative_)
       {
         // Use a threshold for cutting out points which inside the interval
         if ((distance_value < filter_limit_max_) && (distance_value > filter_limit_min_))
-          continue;
+          return -1;
       }
       else
       {
         // Use a threshold for cutting out points which are too close/far away
         if ((distance_value > filter_limit_max_) || (distance_value < filter_limit_min_))
-          continue;
+          return -1;
       }
+    }
 
-      int ijk0 = static_cast<int> (floor (input_->points[cp].x * inverse_leaf_size_[0]) - static_cast<float> (min_b_[0]));
-      int ijk1 = static_cast<int> (floor (input_->points[cp].y * inverse_leaf_size_[1]) - static_cast<float> (min_b_[1]));
-      int ijk2 = static_cast<int> (floor (input_->points[cp].z * inverse_leaf_size_[2]) - static_cast<float> (min_b_[2]));
+    int ijk0 = static_cast<int> (floor (point.x * inverse_leaf_size_[0]) - static_cast<float> (min_b_[0]));
+    int ijk1 = static_cast<int> (floor (point.y * inverse_leaf_size_[1]) - static_cast<float> (min_b_[1]));
+    int ijk2 = static_cast<int> (floor (point.z * inverse_leaf_size_[2]) - static_cast<float> (min_b_[2]));
 
-      // Compute the centroid leaf index
-      int idx = ijk0 * divb_mul_[0] + ijk1 * divb_mul_[1] + ijk2 * divb_mul_[2];
+    // Compute the centroid leaf index
+    return ijk0 * divb_mul_[0] + ijk1 * divb_mul_[1] + ijk2 * divb_mul_[2];
+  };
 
-      Leaf& leaf = leaves_[idx];
-      if (leaf.nr_points == 0)
-      {
-        leaf.centroid.resize (centroid_size);
-        leaf.centroid.setZero ();
-      }
+  // Accumulate a point into a leaf, the covariance holds the raw x*xT sum (from zero) until the second pass
+  auto accumulate = [&] (Leaf& leaf, size_t cp)
+  {
+    const PointT& point = input_->points[cp];
+    if (leaf.nr_points == 0)
+    {
+      leaf.centroid.resize (centroid_size);
+      leaf.centroid.setZero ();
+      leaf.cov_.setZero ();
+    }
 
-      Eigen::Vector3d pt3d (input_->points[cp].x, input_->points[cp].y, input_->points[cp].z);
-      // Accumulate point sum for centroid calculation
-      leaf.mean_ += pt3d;
-      // Accumulate x*xT for single pass covariance calculation
-      leaf.cov_ += pt3d * pt3d.transpose ();
+    Eigen::Vector3d pt3d (point.x, point.y, point.z);
+    // Accumulate point sum for centroid calculation
+    leaf.mean_ += pt3d;
+    // Accumulate x*xT for single pass covariance calculation
+    leaf.cov_ += pt3d * pt3d.transpose ();
 
-      // Do we need to process all the fields?
-      if (!downsample_all_data_)
-      {
-        Eigen::Vector4f pt (input_->points[cp].x, input_->points[cp].y, input_->points[cp].z, 0);
-        leaf.centroid.template head<4> () += pt;
-      }
-      else
+    // Do we need to process all the fields?
+    if (!downsample_all_data_)
+    {
+      Eigen::Vector4f pt (point.x, point.y, point.z, 0);
+      leaf.centroid.template head<4> () += pt;
+    }
+    else
+    {
+      // Copy all the fields
+      Eigen::VectorXf centroid = Eigen::VectorXf::Zero (centroid_size);
+      // ---[ RGB special case
+      if (rgba_index >= 0)
       {
-        // Copy all the fields
-        Eigen::VectorXf centroid = Eigen::VectorXf::Zero (centroid_size);
-        // ---[ RGB special case
-        if (rgba_index >= 0)
-        {
-          // fill r/g/b data
-          int rgb;
-          memcpy (&rgb, reinterpret_cast<const char*> (&input_->points[cp]) + rgba_index, sizeof (int));
-          centroid[centroid_size - 3] = static_cast<float> ((rgb >> 16) & 0x0000ff);
-          centroid[centroid_size - 2] = static_cast<float> ((rgb >> 8) & 0x0000ff);
-          centroid[centroid_size - 1] = static_cast<float> ((rgb) & 0x0000ff);
-        }
-        pcl::for_each_type<FieldList> (pcl::NdCopyPointEigenFunctor<PointT> (input_->points[cp], centroid));
-        leaf.centroid += centroid;
+        // Fill r/g/b data, assuming that the order is BGRA
+        int rgb;
+        memcpy (&rgb, reinterpret_cast<const char*> (&point) + rgba_index, sizeof (int));
+        centroid[centroid_size - 3] = static_cast<float> ((rgb >> 16) & 0x0000ff);
+        centroid[centroid_size - 2] = static_cast<float> ((rgb >> 8) & 0x0000ff);
+        centroid[centroid_size - 1] = static_cast<float> ((rgb) & 0x0000ff);
       }
-      ++leaf.nr_points;
+      pcl::for_each_type<FieldList> (pcl::NdCopyPointEigenFunctor<PointT> (point, centroid));
+      leaf.centroid += centroid;
+    }
+    ++leaf.nr_points;
+  };
+
+  // First pass: each thread sorts the points of its chunk by the leaf indices and sums them into sorted partial
+  // leaves, which are merged in the thread order, so the sums do not depend on the scheduling
+  typedef typename Map::value_type IndexedLeaf;
+  const int thread_num = std::max (1, std::min (num_threads_, static_cast<int> (input_->points.size () / 4096) + 1));
+  const size_t chunk_size = (input_->points.size () + thread_num - 1) / thread_num;
+  std::vector<std::vector<IndexedLeaf>> partial_leaves (thread_num);
+#pragma omp parallel for num_threads(thread_num) schedule(static, 1)
+  for (int thread = 0; thread < thread_num; ++thread)
+  {
+    const size_t begin = std::min (input_->points.size (), thread * chunk_size);
+    const size_t end = std::min (input_->points.size (), begin + chunk_size);
+    std::vector<std::pair<int, int>> point_indices;
+    point_indices.reserve (end - begin);
+    for (size_t cp = begin; cp < end; ++cp)
+    {
+      const int idx = point_leaf_index (cp);
+      if (idx >= 0)
+        point_indices.emplace_back (idx, static_cast<int> (cp));
+    }
+    // The pairs are unique, the points of a leaf stay in the input order
+    std::sort (point_indices.begin (), point_indices.end ());
+
+    std::vector<IndexedLeaf>& leaves = partial_leaves[thread];
+    for (const auto& point_index : point_indices)
+    {
+      if (leaves.empty () || leaves.back ().first != static_cast<size_t> (point_index.first))
+        leaves.emplace_back (point_index.first, Leaf ());
+      accumulate (leaves.back ().second, point_index.second);
     }
   }
-  // No distance filtering, process all data
+
+  if (thread_num == 1)
+    leaves_.assign (std::move (partial_leaves[0]));
   else
   {
-    // First pass: go over all points and insert them into the right leaf
-    for (size_t cp = 0; cp < input_->points.size (); ++cp)
+    std::vector<IndexedLeaf> all_leaves;
+    size_t leaf_num = 0;
+    for (const auto& leaves : partial_leaves)
+      leaf_num += leaves.size ();
+    all_leaves.reserve (leaf_num);
+    for (auto& leaves : partial_leaves)
     {
-      if (!input_->is_dense)
-        // Check if the point is invalid
-        if (!pcl_isfinite (input_->points[cp].x) ||
-            !pcl_isfinite (input_->points[cp].y) ||
-            !pcl_isfinite (input_->points[cp].z))
-          continue;
-
-      int ijk0 = static_cast<int> (floor (input_->points[cp].x * inverse_leaf_size_[0]) - static_cast<float> (min_b_[0]));
-      int ijk1 = static_cast<int> (floor (input_->points[cp].y * inverse_leaf_size_[1]) - static_cast<float> (min_b_[1]));
-      int ijk2 = static_cast<int> (floor (input_->points[cp].z * inverse_leaf_size_[2]) - static_cast<float> (min_b_[2]));
-
-      // Compute the centroid leaf index
-      int idx = ijk0 * divb_mul_[0] + ijk1 * divb_mul_[1] + ijk2 * divb_mul_[2];
-
-      //int idx = (((input_->points[cp].getArray4fmap () * inverse_leaf_size_).template cast<int> ()).matrix () - min_b_).dot (divb_mul_);
-      Leaf& leaf = leaves_[idx];
-      if (leaf.nr_points == 0)
-      {
-        leaf.centroid.resize (centroid_size);
-        leaf.centroid.setZero ();
-      }
-
-      Eigen::Vector3d pt3d (input_->points[cp].x, input_->points[cp].y, input_->points[cp].z);
-      // Accumulate point sum for centroid calculation
-      leaf.mean_ += pt3d;
-      // Accumulate x*xT for single pass covariance calculation
-      leaf.cov_ += pt3d * pt3d.transpose ();
+      std::move (leaves.begin (), leaves.end (), std::back_inserter (all_leaves));
+      std::vector<IndexedLeaf> ().swap (leaves);
+    }
+    std::stable_sort (all_leaves.begin (), all_leaves.end (),
+                      [] (const IndexedLeaf& a, const IndexedLeaf& b) { return a.first < b.first; });
 
-      // Do we need to process all the fields?
-      if (!downsample_all_data_)
-      {
-        Eigen::Vector4f pt (input_->points[cp].x, input_->points[cp].y, input_->points[cp].z, 0);
-        leaf.centroid.template head<4> () += pt;
-      }
-      else
+    std::vector<IndexedLeaf> merged;
+    merged.reserve (all_leaves.size ());
+    for (auto& indexed_leaf : all_leaves)
+    {
+      if (merged.empty () || merged.back ().first != indexed_leaf.first)
       {
-        // Copy all the fields
-        Eigen::VectorXf centroid = Eigen::VectorXf::Zero (centroid_size);
-        // ---[ RGB special case
-        if (rgba_index >= 0)
-        {
-          // Fill r/g/b data, assuming that the order is BGRA
-          int rgb;
-          memcpy (&rgb, reinterpret_cast<const char*> (&input_->points[cp]) + rgba_index, sizeof (int));
-          centroid[centroid_size - 3] = static_cast<float> ((rgb >> 16) & 0x0000ff);
-          centroid[centroid_size - 2] = static_cast<float> ((rgb >> 8) & 0x0000ff);
-          centroid[centroid_size - 1] = static_cast<float> ((rgb) & 0x0000ff);
-        }
-        pcl::for_each_type<FieldList> (pcl::NdCopyPointEigenFunctor<PointT> (input_->points[cp], centroid));
-        leaf.centroid += centroid;
+        merged.push_back (std::move (indexed_leaf));
+        continue;
       }
-      ++leaf.nr_points;
+      Leaf& leaf = merged.back ().second;
+      leaf.mean_ += indexed_leaf.second.mean_;
+      leaf.cov_ += indexed_leaf.second.cov_;
+      leaf.centroid += indexed_leaf.second.centroid;
+      leaf.nr_points += indexed_leaf.second.nr_points;
     }
+    leaves_.assign (std::move (merged));
+  }
+
+  // Second pass: go over all leaves and compute centroids and covariance matrices, in parallel
+  const int leaf_num = static_cast<int> (leaves_.size ());
+#pragma omp parallel for num_threads(num_threads_) schedule(guided, 64)
+  for (int i = 0; i < leaf_num; ++i)
+  {
+    Leaf& leaf = leaves_.at (i).second;
+
+    // Normalize the centroid
+    leaf.centroid /= static_cast<float> (leaf.nr_points);
+    // Keep the raw sums for incremental insertion, the identity is the initial covariance of the leaf in the
+    // original single pass, kept for the same distributions
+    leaf.nr_accumulated_ = leaf.nr_points;
+    leaf.pt_sum_ = leaf.mean_;
+    leaf.pt_sq_sum_ = leaf.cov_ + Eigen::Matrix3d::Identity ();
+
+    // Normalize mean, and compute the covariance for the voxel with sufficient points
+    computeLeafDistribution (leaf);
   }
 
-  // Second pass: go over all leaves and compute centroids and covariance matrices
+  // Collect the centroids in the leaf order
   output.points.reserve (leaves_.size ());
   if (searchable_)
     voxel_centroids_leaf_indices_.reserve (leaves_.size ());
@@ -271,33 +310,17 @@ pclomp::VoxelGridCovariance<PointT>::applyFilter (PointCloud &output)
   if (save_leaf_layout_)
     leaf_layout_.resize (div_b_[0] * div_b_[1] * div_b_[2], -1);
 
-  // Eigen values and vectors calculated to prevent near singluar matrices
-  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigensolver;
-  Eigen::Matrix3d eigen_val;
-  Eigen::Vector3d pt_sum;
-
-  // Eigen values less than a threshold of max eigen value are inflated to a set fraction of the max eigen value.
-  double min_covar_eigvalue;
-
-  for (auto it = leaves_.begin (); it != leaves_.end (); ++it)
+  for (int i = 0; i < leaf_num; ++i)
   {
-
-    // Normalize the centroid
-    Leaf& leaf = it->second;
-
-    // Normalize the centroid
-    leaf.centroid /= static_cast<float> (leaf.nr_points);
-    // Point sum used for single pass covariance calculation
-    pt_sum = leaf.mean_;
-    // Normalize mean
-    leaf.mean_ /= leaf.nr_points;
+    const IndexedLeaf& indexed_leaf = leaves_.at (i);
+    const Leaf& leaf = indexed_leaf.second;
 
     // If the voxel contains sufficient points, its covariance is calculated and is added to the voxel centroids and output clouds.
     // Points with less than the minimum points will have a can not be accuratly approximated using a normal distribution.
-    if (leaf.nr_points >= min_points_per_voxel_)
+    if (leaf.nr_accumulated_ >= min_points_per_voxel_)
     {
       if (save_leaf_layout_)
-        leaf_layout_[it->first] = cp++;
+        leaf_layout_[indexed_leaf.first] = cp++;
 
       output.push_back (PointT ());
 
@@ -321,52 +344,188 @@ pclomp::VoxelGridCovariance<PointT>::applyFilter (PointCloud &output)
         }
       }
 
-      // Stores the voxel indice for fast access searching
+      // Stores the leaf position for fast access searching
       if (searchable_)
-        voxel_centroids_leaf_indices_.push_back (static_cast<int> (it->first));
+        voxel_centroids_leaf_indices_.push_back (i);
+    }
+  }
 
-      // Single pass covariance calculation
-      leaf.cov_ = (leaf.cov_ - 2 * (pt_sum * leaf.mean_.transpose ())) / leaf.nr_points + leaf.mean_ * leaf.mean_.transpose ();
-      leaf.cov_ *= (leaf.nr_points - 1.0) / leaf.nr_points;
+  output.width = static_cast<uint32_t> (output.points.size ());
+}
 
-      //Normalize Eigen Val such that max no more than 100x min.
-      eigensolver.compute (leaf.cov_);
-      eigen_val = eigensolver.eigenvalues ().asDiagonal ();
-      leaf.evecs_ = eigensolver.eigenvectors ();
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> void
+pclomp::VoxelGridCovariance<PointT>::computeLeafDistribution (Leaf &leaf) const
+{
+  leaf.nr_points = leaf.nr_accumulated_;
+  leaf.mean_ = leaf.pt_sum_ / leaf.nr_points;
+  if (leaf.nr_points < min_points_per_voxel_)
+    return;
 
-      if (eigen_val (0, 0) < 0 || eigen_val (1, 1) < 0 || eigen_val (2, 2) <= 0)
-      {
-        leaf.nr_points = -1;
-        continue;
-      }
+  // Single pass covariance calculation
+  leaf.cov_ = (leaf.pt_sq_sum_ - 2 * (leaf.pt_sum_ * leaf.mean_.transpose ())) / leaf.nr_points + leaf.mean_ * leaf.mean_.transpose ();
+  leaf.cov_ *= (leaf.nr_points - 1.0) / leaf.nr_points;
 
-      // Avoids matrices near singularities (eq 6.11)[Magnusson 2009]
+  //Normalize Eigen Val such that max no more than 100x min.
+  // The closed-form solver of the 3x3 symmetric matrices, much faster than the iterative one
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigensolver;
+  eigensolver.computeDirect (leaf.cov_);
+  Eigen::Matrix3d eigen_val = eigensolver.eigenvalues ().asDiagonal ();
+  leaf.evecs_ = eigensolver.eigenvectors ();
 
-      min_covar_eigvalue = min_covar_eigvalue_mult_ * eigen_val (2, 2);
-      if (eigen_val (0, 0) < min_covar_eigvalue)
-      {
-        eigen_val (0, 0) = min_covar_eigvalue;
+  if (eigen_val (0, 0) < 0 || eigen_val (1, 1) < 0 || eigen_val (2, 2) <= 0)
+  {
+    leaf.nr_points = -1;
+    return;
+  }
 
-        if (eigen_val (1, 1) < min_covar_eigvalue)
-        {
-          eigen_val (1, 1) = min_covar_eigvalue;
-        }
+  // Avoids matrices near singularities (eq 6.11)[Magnusson 2009]
+  // Eigen values less than a threshold of max eigen value are inflated to a set fraction of the max eigen value.
+  const double min_covar_eigvalue = min_covar_eigvalue_mult_ * eigen_val (2, 2);
+  if (eigen_val (0, 0) < min_covar_eigvalue)
+  {
+    eigen_val (0, 0) = min_covar_eigvalue;
 
-        leaf.cov_ = leaf.evecs_ * eigen_val * leaf.evecs_.inverse ();
-      }
-      leaf.evals_ = eigen_val.diagonal ();
+    if (eigen_val (1, 1) < min_covar_eigvalue)
+    {
+      eigen_val (1, 1) = min_covar_eigvalue;
+    }
 
-      leaf.icov_ = leaf.cov_.inverse ();
-      if (leaf.icov_.maxCoeff () == std::numeric_limits<float>::infinity ( )
-          || leaf.icov_.minCoeff () == -std::numeric_limits<float>::infinity ( ) )
-      {
-        leaf.nr_points = -1;
-      }
+    // The eigen vectors are orthonormal
+    leaf.cov_ = leaf.evecs_ * eigen_val * leaf.evecs_.transpose ();
+  }
+  leaf.evals_ = eigen_val.diagonal ();
+
+  leaf.icov_ = leaf.cov_.inverse ();
+  if (leaf.icov_.maxCoeff () == std::numeric_limits<float>::infinity ( )
+      || leaf.icov_.minCoeff () == -std::numeric_limits<float>::infinity ( ) )
+  {
+    leaf.nr_points = -1;
+  }
+}
 
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> bool
+pclomp::VoxelGridCovariance<PointT>::addPoints (const PointCloud &cloud)
+{
+  return accumulatePoints (cloud, 1);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> bool
+pclomp::VoxelGridCovariance<PointT>::removePoints (const PointCloud &cloud)
+{
+  return accumulatePoints (cloud, -1);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> bool
+pclomp::VoxelGridCovariance<PointT>::accumulatePoints (const PointCloud &cloud, const int weight)
+{
+  // The filtered and all-data cases are not supported, rebuild them
+  if (!voxel_centroids_ || downsample_all_data_ || !filter_field_name_.empty ())
+    return false;
+
+  // First pass: the leaf indices, all points should be inside the bounding box
+  std::vector<int> point_leaf_indices (cloud.points.size (), -1);
+  for (size_t cp = 0; cp < cloud.points.size (); ++cp)
+  {
+    const PointT& point = cloud.points[cp];
+    if (!pcl_isfinite (point.x) || !pcl_isfinite (point.y) || !pcl_isfinite (point.z))
+      continue;
+
+    const Eigen::Vector4i ijk (static_cast<int> (floor (point.x * inverse_leaf_size_[0])),
+                               static_cast<int> (floor (point.y * inverse_leaf_size_[1])),
+                               static_cast<int> (floor (point.z * inverse_leaf_size_[2])), 0);
+    if ((ijk.array () < min_b_.array ()).any () || (ijk.array () > max_b_.array ()).any ())
+      return false;
+    point_leaf_indices[cp] = (ijk - min_b_).dot (divb_mul_);
+  }
+
+  // Second pass: insert the new leaves in one merge, accumulate the raw sums, then update the touched leaves
+  std::vector<size_t> new_leaves;
+  for (size_t cp = 0; cp < cloud.points.size (); ++cp)
+  {
+    const int idx = point_leaf_indices[cp];
+    if (idx >= 0 && leaves_.find (idx) == leaves_.end ())
+      new_leaves.push_back (idx);
+  }
+  // The removed points should be in the leaves
+  if (weight < 0 && !new_leaves.empty ())
+    return false;
+  std::sort (new_leaves.begin (), new_leaves.end ());
+  new_leaves.erase (std::unique (new_leaves.begin (), new_leaves.end ()), new_leaves.end ());
+  if (!new_leaves.empty ())
+    leaves_.insert (new_leaves);
+
+  std::vector<size_t> touched;
+  touched.reserve (cloud.points.size ());
+  for (size_t cp = 0; cp < cloud.points.size (); ++cp)
+  {
+    const int idx = point_leaf_indices[cp];
+    if (idx < 0)
+      continue;
+
+    const auto leaf_iter = leaves_.find (idx);
+    Leaf& leaf = leaf_iter->second;
+    if (leaf.nr_accumulated_ == 0)
+    {
+      leaf.centroid.resize (4);
+      leaf.centroid.setZero ();
     }
+    const Eigen::Vector3d pt3d (cloud.points[cp].x, cloud.points[cp].y, cloud.points[cp].z);
+    leaf.pt_sum_ += weight * pt3d;
+    leaf.pt_sq_sum_ += weight * (pt3d * pt3d.transpose ());
+    leaf.nr_accumulated_ += weight;
+    // An emptied leaf restarts from zero sums, not the rounding errors
+    if (leaf.nr_accumulated_ <= 0)
+    {
+      leaf.nr_accumulated_ = 0;
+      leaf.pt_sum_.setZero ();
+      leaf.pt_sq_sum_.setZero ();
+    }
+    touched.push_back (static_cast<size_t> (leaf_iter - leaves_.begin ()));
+  }
+  std::sort (touched.begin (), touched.end ());
+  touched.erase (std::unique (touched.begin (), touched.end ()), touched.end ());
+  const int touched_num = static_cast<int> (touched.size ());
+#pragma omp parallel for num_threads(num_threads_) schedule(guided, 64)
+  for (int i = 0; i < touched_num; ++i)
+  {
+    Leaf& leaf = leaves_.at (touched[i]).second;
+    computeLeafDistribution (leaf);
+    leaf.centroid.template head<3> () = leaf.mean_.template cast<float> ();
   }
 
-  output.width = static_cast<uint32_t> (output.points.size ());
+  // Third pass: re-collect the centroids, which is much cheaper than the leaves
+  voxel_centroids_->points.clear ();
+  voxel_centroids_leaf_indices_.clear ();
+  if (save_leaf_layout_)
+    std::fill (leaf_layout_.begin (), leaf_layout_.end (), -1);
+  int cp = 0;
+  const int leaf_num = static_cast<int> (leaves_.size ());
+  for (int i = 0; i < leaf_num; ++i)
+  {
+    const Leaf& leaf = leaves_.at (i).second;
+    if (leaf.nr_accumulated_ < min_points_per_voxel_)
+      continue;
+    if (save_leaf_layout_)
+      leaf_layout_[leaves_.at (i).first] = cp++;
+
+    PointT point;
+    point.x = leaf.centroid[0];
+    point.y = leaf.centroid[1];
+    point.z = leaf.centroid[2];
+    voxel_centroids_->push_back (point);
+    if (searchable_)
+      voxel_centroids_leaf_indices_.push_back (i);
+  }
+  voxel_centroids_->width = static_cast<uint32_t> (voxel_centroids_->points.size ());
+  voxel_centroids_->height = 1;
+
+  if (searchable_ && voxel_centroids_->size() > 0)
+    kdtree_.setInputCloud (voxel_centroids_);
+  return true;
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,90 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#ifndef REGISTRATORS_PREPARED_TARGET_CACHE_H_
+#define REGISTRATORS_PREPARED_TARGET_CACHE_H_
+
+// stl
+#include <iterator>
+#include <list>
+#include <memory>
+#include <utility>
+
+namespace static_map {
+namespace registrator {
+
+/*
+ * @class PreparedTargetCache
+ * @brief LRU cache for the structures (kd-tree, voxel grid, ...) prepared
+ * for target clouds, keyed by the cloud pointer. the cache keeps a
+ * reference of the cloud so that its address can not be re-used
+ */
+template <typename CloudPtr, typename Prepared>
+class PreparedTargetCache {
+ public:
+  using PreparedPtr = std::shared_ptr<Prepared>;
+
+  /// @brief return nullptr if it is not in cache
+  PreparedPtr Find(const CloudPtr& cloud) {
+    for (auto it = items_.begin(); it != items_.end(); ++it) {
+      if (it->first == cloud) {
+        // move to the front (most recently used)
+        items_.splice(items_.begin(), items_, it);
+        return items_.front().second;
+      }
+    }
+    return nullptr;
+  }
+
+  /// @brief drop the least recently used ones if over capacity
+  /// the pinned one is kept as long as there is another one to drop
+  void Insert(const CloudPtr& cloud, const PreparedPtr& prepared,
+              const size_t capacity, const CloudPtr& pinned = nullptr) {
+    items_.emplace_front(cloud, prepared);
+    while (items_.size() > capacity && !items_.empty()) {
+      auto it = std::prev(items_.end());
+      if (pinned && it->first == pinned && items_.size() > 1) {
+        it = std::prev(it);
+      }
+      items_.erase(it);
+    }
+  }
+
+  void Erase(const CloudPtr& cloud) {
+    for (auto it = items_.begin(); it != items_.end(); ++it) {
+      if (it->first == cloud) {
+        items_.erase(it);
+        return;
+      }
+    }
+  }
+
+  void Clear() { items_.clear(); }
+  size_t Size() const { return items_.size(); }
+
+ private:
+  std::list<std::pair<CloudPtr, PreparedPtr>> items_;
+};
+
+}  // namespace registrator
+}  // namespace static_map
+
+#endif  // REGISTRATORS_PREPARED_TARGET_CACHE_H_
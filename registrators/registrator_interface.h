@@ -25,7 +25,15 @@
 
 #include <pcl/io/pcd_io.h>
 #include <pcl/point_types.h>
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <vector>
+
 #include "common/macro_defines.h"
+#include "common/shared_executor.h"
 
 namespace static_map {
 namespace registrator {
@@ -38,6 +46,7 @@ enum Type {
   kLegoLoam,
   kNdt,
   kFastIcp,
+  kGpuIcp,
   kTypeCount
 };
 
@@ -57,8 +66,27 @@ class Interface {
   typedef typename PointCloudTarget::Ptr PointCloudTargetPtr;
   typedef typename PointCloudTarget::ConstPtr PointCloudTargetConstPtr;
 
+  struct BatchTarget {
+    PointCloudTargetPtr cloud;
+    Eigen::Matrix4f guess = Eigen::Matrix4f::Identity();
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+  struct BatchResult {
+    // index in the targets
+    int index = -1;
+    // false if failed or skipped after early exit
+    bool succeed = false;
+    double score = 0.;
+    Eigen::Matrix4f transform = Eigen::Matrix4f::Identity();
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+  using BatchTargets =
+      std::vector<BatchTarget, Eigen::aligned_allocator<BatchTarget>>;
+  using BatchResults =
+      std::vector<BatchResult, Eigen::aligned_allocator<BatchResult>>;
+
   Interface() = default;
-  ~Interface() = default;
+  virtual ~Interface() = default;
 
   virtual void setInputSource(const PointCloudSourcePtr& cloud) {
     if (!cloud) {
@@ -83,21 +111,112 @@ class Interface {
     }
     target_cloud_ = cloud;
   }
+  /// @brief the current target changed into cloud by adding and removing
+  /// some points (either may be null), registrators able to update their
+  /// prepared target in place override it, the others prepare cloud from
+  /// scratch as a new target
+  virtual void updateInputTarget(const PointCloudTargetPtr& cloud,
+                                 const PointCloudTargetPtr& added_points,
+                                 const PointCloudTargetPtr& removed_points) {
+    setInputTarget(cloud);
+  }
+
+  /// @brief how many prepared targets (kd-tree, voxel grid ...) are kept
+  /// setting one of them (or the current source) as target again reuses the
+  /// prepared structures instead of building them from scratch
+  /// registrators without heavy target preparing just ignore it
+  void setTargetCacheSize(const size_t size) { target_cache_size_ = size; }
+  /// @brief keep the prepared structures of the cloud in cache even if it is
+  /// not recently used, e.g. the key frame which will be matched again later
+  void setPinnedTarget(const PointCloudTargetPtr& cloud) {
+    pinned_target_cloud_ = cloud;
+  }
+
+  /// @brief cap of the iterations of one align, <= 0 for the default of
+  /// the registrator. registrators without iterations just ignore it
+  virtual void setMaximumIterations(const int iterations) {}
 
   virtual double getFitnessScore() { return final_score_; }
+  /// @brief iterations of the last align, -1 if it is unknown
+  int getFinalNumIteration() const { return final_iterations_; }
   virtual InlierPointPairs getInlierPointPairs() { return point_pairs_; }
 
   // need to be implemented by child class
   virtual bool align(const Eigen::Matrix4f& guess, Eigen::Matrix4f& result) = 0;
 
+  /// @brief a new registrator with the same settings and the prepared
+  /// source shared (read only), it should be thread safe
+  /// @return nullptr if not supported, then alignBatch runs serially
+  virtual std::unique_ptr<Interface> cloneWithSource() const {
+    return nullptr;
+  }
+
+  /// @brief align the source to all targets, the source is prepared only
+  /// once and the targets run in parallel on the shared executor
+  /// @param accepted_min_score once a target reaches it, the ones not
+  /// started yet are skipped
+  /// @return results ranked by score (the higher the better)
+  BatchResults alignBatch(
+      const PointCloudSourcePtr& source, const BatchTargets& targets,
+      const double accepted_min_score = std::numeric_limits<double>::max()) {
+    setInputSource(source);
+    const int target_num = targets.size();
+    BatchResults results(target_num);
+    std::atomic<bool> accepted(false);
+    const auto align_one = [&](Interface* const matcher, const int i) {
+      BatchResult& result = results[i];
+      result.index = i;
+      if (accepted.load()) {
+        return;
+      }
+      matcher->setInputTarget(targets[i].cloud);
+      result.succeed = matcher->align(targets[i].guess, result.transform);
+      result.score = matcher->getFitnessScore();
+      if (result.succeed && result.score >= accepted_min_score) {
+        accepted = true;
+      }
+    };
+
+    std::unique_ptr<Interface> first_matcher;
+    if (target_num > 1) {
+      first_matcher = cloneWithSource();
+    }
+    if (first_matcher) {
+      common::ParallelFor(0, target_num, target_num, [&](const int i) {
+        if (i == 0) {
+          align_one(first_matcher.get(), i);
+        } else {
+          auto matcher = cloneWithSource();
+          align_one(matcher.get(), i);
+        }
+      });
+    } else {
+      for (int i = 0; i < target_num; ++i) {
+        align_one(this, i);
+      }
+    }
+
+    std::stable_sort(results.begin(), results.end(),
+                     [](const BatchResult& a, const BatchResult& b) {
+                       if (a.succeed != b.succeed) {
+                         return a.succeed;
+                       }
+                       return a.score > b.score;
+                     });
+    return results;
+  }
+
  protected:
   double final_score_;
+  int final_iterations_ = -1;
 
   PointCloudSourcePtr source_cloud_ = nullptr;
   PointCloudTargetPtr target_cloud_ = nullptr;
 
   Type type_ = kNoType;
   InlierPointPairs point_pairs_;
+  size_t target_cache_size_ = 2;
+  PointCloudTargetPtr pinned_target_cloud_ = nullptr;
 };
 
 }  // namespace registrator
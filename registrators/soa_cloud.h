@@ -0,0 +1,154 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#ifndef REGISTRATORS_SOA_CLOUD_H_
+#define REGISTRATORS_SOA_CLOUD_H_
+
+// third party
+#include <Eigen/Core>
+#include <boost/weak_ptr.hpp>
+// pcl
+#include <pcl/point_cloud.h>
+// stl
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+// local
+#include "common/mutex.h"
+
+namespace static_map {
+namespace registrator {
+
+// pcl uses boost::shared_ptr before 1.11 and std::shared_ptr after it
+template <typename Ptr>
+struct WeakPtrOf;
+template <typename T>
+struct WeakPtrOf<boost::shared_ptr<T>> {
+  using type = boost::weak_ptr<T>;
+};
+template <typename T>
+struct WeakPtrOf<std::shared_ptr<T>> {
+  using type = std::weak_ptr<T>;
+};
+
+/*
+ * @class SoaCloud
+ * @brief the coordinates of a cloud in structure of arrays, all x first,
+ * then all y and all z in one aligned buffer (a row major 3 x N matrix).
+ * it is built once per cloud and shared by all the registrators using the
+ * cloud, get it by Get(cloud)
+ */
+template <typename PointType>
+class SoaCloud {
+ public:
+  using PointCloud = pcl::PointCloud<PointType>;
+  using PointCloudPtr = typename PointCloud::Ptr;
+  using Buffer = std::vector<float, Eigen::aligned_allocator<float>>;
+  using Points = Eigen::Map<const Eigen::Matrix<float, 3, Eigen::Dynamic,
+                                               Eigen::RowMajor>>;
+
+  /// @brief thread safe, the registry only keeps weak references, the
+  /// SoaCloud lives as long as someone (a frame, a registrator) holds it
+  static std::shared_ptr<const SoaCloud> Get(const PointCloudPtr& cloud) {
+    if (!cloud) {
+      return nullptr;
+    }
+    Registry& registry = GetRegistry();
+    common::MutexLocker locker(&registry.mutex);
+    auto& entry = registry.entries[cloud.get()];
+    std::shared_ptr<const SoaCloud> soa = entry.soa.lock();
+    // the address may be re-used by a new cloud after the old one is gone
+    if (soa && entry.cloud.lock() == cloud && soa->size_ == cloud->size() &&
+        soa->stamp_ == cloud->header.stamp) {
+      return soa;
+    }
+    soa.reset(new SoaCloud(*cloud));
+    entry.cloud = cloud;
+    entry.soa = soa;
+    if (registry.entries.size() > 2 * registry.pruned_size) {
+      Prune(&registry);
+    }
+    return soa;
+  }
+
+  inline size_t Size() const { return size_; }
+  inline bool Empty() const { return size_ == 0; }
+  inline const float* X() const { return buffer_.data(); }
+  inline const float* Y() const { return buffer_.data() + size_; }
+  inline const float* Z() const { return buffer_.data() + 2 * size_; }
+  /// @brief x, y, z of all points, 3 * Size() in total
+  inline const float* Data() const { return buffer_.data(); }
+  inline Points AsMatrix() const { return Points(buffer_.data(), 3, size_); }
+  inline Eigen::Vector3f Point(const size_t i) const {
+    return Eigen::Vector3f(X()[i], Y()[i], Z()[i]);
+  }
+
+ private:
+  struct Entry {
+    typename WeakPtrOf<PointCloudPtr>::type cloud;
+    std::weak_ptr<const SoaCloud> soa;
+  };
+  struct Registry {
+    common::Mutex mutex;
+    std::unordered_map<const PointCloud*, Entry> entries;
+    size_t pruned_size = 64;
+  };
+
+  static Registry& GetRegistry() {
+    static Registry registry;
+    return registry;
+  }
+
+  static void Prune(Registry* const registry) {
+    for (auto it = registry->entries.begin();
+         it != registry->entries.end();) {
+      if (it->second.soa.expired() || it->second.cloud.expired()) {
+        it = registry->entries.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    registry->pruned_size = std::max<size_t>(64, registry->entries.size());
+  }
+
+  explicit SoaCloud(const PointCloud& cloud)
+      : size_(cloud.size()), stamp_(cloud.header.stamp) {
+    buffer_.resize(3 * size_);
+    float* const x = buffer_.data();
+    float* const y = x + size_;
+    float* const z = y + size_;
+    for (size_t i = 0; i < size_; ++i) {
+      x[i] = cloud.points[i].x;
+      y[i] = cloud.points[i].y;
+      z[i] = cloud.points[i].z;
+    }
+  }
+
+  const size_t size_;
+  const uint64_t stamp_;
+  Buffer buffer_;
+};
+
+}  // namespace registrator
+}  // namespace static_map
+
+#endif  // REGISTRATORS_SOA_CLOUD_H_
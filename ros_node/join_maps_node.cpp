@@ -21,8 +21,27 @@
 // SOFTWARE.
 
 #include <pcl/console/parse.h>
+#include <sstream>
+#include <string>
+#include <vector>
 #include "builder/multi_trajectory_map_builder.h"
 
+namespace {
+
+std::vector<std::string> SplitByComma(const std::string& list) {
+  std::vector<std::string> items;
+  std::istringstream stream(list);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    if (!item.empty()) {
+      items.push_back(item);
+    }
+  }
+  return items;
+}
+
+}  // namespace
+
 int main(int argc, char** argv) {
   std::string base_map_file = "";
   pcl::console::parse_argument(argc, argv, "-b", base_map_file);
@@ -31,14 +50,30 @@ int main(int argc, char** argv) {
     return -1;
   }
 
-  std::string incremental_map_file = "";
-  pcl::console::parse_argument(argc, argv, "-i", incremental_map_file);
-  if (incremental_map_file.empty()) {
+  // one or more incremental maps separated by commas, joined in order
+  std::string incremental_map_list = "";
+  pcl::console::parse_argument(argc, argv, "-i", incremental_map_list);
+  const std::vector<std::string> incremental_map_files =
+      SplitByComma(incremental_map_list);
+  if (incremental_map_files.empty()) {
     PRINT_ERROR(
         "you should use \"-i filename\" to specify the incremental map xml. ");
     return -1;
   }
 
+  // optional, the paths (path.traj) of the base and the incremental maps,
+  // for the segments of one bag (tools/scripts/segment_mapping.sh), each
+  // map is then placed by the overlap with the one before it, otherwise
+  // only by the utm offsets
+  std::string path_list = "";
+  pcl::console::parse_argument(argc, argv, "-traj", path_list);
+  const std::vector<std::string> path_files = SplitByComma(path_list);
+  if (!path_files.empty() &&
+      path_files.size() != incremental_map_files.size() + 1) {
+    PRINT_ERROR("you should give one path for every map with \"-traj\". ");
+    return -1;
+  }
+
   std::string new_map_file = "";
   pcl::console::parse_argument(argc, argv, "-n", new_map_file);
   if (new_map_file.empty()) {
@@ -46,17 +81,57 @@ int main(int argc, char** argv) {
     return -1;
   }
 
+  // optional, the static map of the base map, the one of the joined map
+  // is then updated from it incrementally
+  std::string base_static_map_file = "";
+  pcl::console::parse_argument(argc, argv, "-s", base_static_map_file);
+
+  // optional, the static map is saved in pieces under the directory, the
+  // pieces saved there before and not touched by the new map are kept
+  std::string static_map_pieces_path = "";
+  pcl::console::parse_argument(argc, argv, "-p", static_map_pieces_path);
+
   static_map::MultiTrajectoryMapBuilderOptions options;
   options.loop_dettect_settings.use_gps = false;
   options.loop_dettect_settings.max_close_loop_distance = 10.;
   options.loop_dettect_settings.nearest_history_pos_num = 3;
+  // optional, a batch optimization of the joined graph at last
+  options.final_optimization_options.enable_batch =
+      pcl::console::find_switch(argc, argv, "-batch");
+  pcl::console::parse_argument(argc, argv, "-threads",
+                               options.final_optimization_options.threads);
+  // optional, the hierarchical optimization in clusters of this size (m),
+  // for the large base maps, only the changed clusters are solved again
+  pcl::console::parse_argument(
+      argc, argv, "-cluster", options.final_optimization_options.cluster_size);
 
   static_map::MultiTrajectoryMapBuilder builder(options);
 
   builder.LoadBaseMap(base_map_file);
-  builder.LoadIncrementalMap(incremental_map_file);
+  if (!base_static_map_file.empty()) {
+    builder.GenerateStaticMap(base_static_map_file);
+  }
+  Eigen::Matrix4d base_from_incremental = Eigen::Matrix4d::Identity();
+  for (size_t i = 0; i < incremental_map_files.size(); ++i) {
+    if (!path_files.empty()) {
+      Eigen::Matrix4d previous_from_incremental;
+      if (!static_map::AlignOverlappingPaths(path_files[i], path_files[i + 1],
+                                             &previous_from_incremental)) {
+        return -1;
+      }
+      base_from_incremental = base_from_incremental * previous_from_incremental;
+    }
+    builder.LoadIncrementalMap(incremental_map_files[i], base_from_incremental);
+  }
   builder.SaveWholeMap(new_map_file);
   // builder.GenerateWholeMapPcd("2map.pcd");
-  builder.GenerateStaticMap("2map_static.pcd");
+  if (!static_map_pieces_path.empty()) {
+    if (static_map_pieces_path.back() != '/') {
+      static_map_pieces_path += '/';
+    }
+    builder.GenerateStaticMapPieces(static_map_pieces_path);
+  } else {
+    builder.GenerateStaticMap("2map_static.pcd");
+  }
   return 0;
 }
@@ -0,0 +1,440 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// third party
+#include <pcl/console/parse.h>
+#include <pcl/conversions.h>
+#include <pcl/point_types.h>
+#include <pcl_conversions/pcl_conversions.h>
+#include <ros/ros.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <tf2_msgs/TFMessage.h>
+// stl
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+// linux
+#include <sys/resource.h>
+// boost
+#include <boost/algorithm/string.hpp>
+// local
+#include "builder/map_builder.h"
+#include "builder/msg_conversion.h"
+#include "common/metrics.h"
+#include "common/simple_time.h"
+#include "ros_node/tf_bridge.h"
+
+using static_map::MapBuilder;
+using static_map::sensors::ImuMsg;
+using static_map::sensors::NavSatFixMsg;
+using static_map::sensors::OdomMsg;
+
+// read all static transforms recorded in the bag
+void ReadStaticTransformsFromBag(const rosbag::Bag& bag,
+                                 tf2_ros::Buffer* const tf_buffer) {
+  rosbag::View tf_view(bag, rosbag::TopicQuery(std::vector<std::string>{
+                                "/tf_static", "tf_static"}));
+  for (const rosbag::MessageInstance& msg : tf_view) {
+    tf2_msgs::TFMessage::ConstPtr tf_msg =
+        msg.instantiate<tf2_msgs::TFMessage>();
+    if (!tf_msg) {
+      continue;
+    }
+    for (const auto& transform : tf_msg->transforms) {
+      tf_buffer->setTransform(transform, "bag", true /* is_static */);
+    }
+  }
+}
+
+// the peak resident memory of the process in MB
+double PeakRssInMb() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0.;
+  }
+  // in KB on linux
+  return usage.ru_maxrss / 1024.;
+}
+
+// print the benchmark summary, also saved as "key value" lines if the
+// filename is not empty
+void ReportSummary(const MapBuilder::RunStatistics& statistics,
+                   const size_t scan_num, const double cost_time,
+                   const std::string& filename) {
+  const double safe_time = std::max(cost_time, 1.e-6);
+  PRINT_INFO("Benchmark summary:");
+  PRINT_INFO_FMT("  scans: %lu (%lf / s)", scan_num, scan_num / safe_time);
+  PRINT_INFO_FMT("  submaps: %d (%lf / s)", statistics.submap_num,
+                 statistics.submap_num / safe_time);
+  PRINT_INFO_FMT("  loop closures: %d", statistics.loop_closure_num);
+  PRINT_INFO_FMT("  peak rss: %lf MB", PeakRssInMb());
+  PRINT_INFO_FMT("  final optimization: %lf s",
+                 statistics.final_optimization_time);
+  PRINT_INFO_FMT("  map generation: %lf s", statistics.map_generation_time);
+  if (filename.empty()) {
+    return;
+  }
+  std::ofstream file(filename);
+  file << "total_time " << cost_time << "\n"
+       << "scans " << scan_num << "\n"
+       << "scans_per_second " << scan_num / safe_time << "\n"
+       << "submaps " << statistics.submap_num << "\n"
+       << "submaps_per_second " << statistics.submap_num / safe_time << "\n"
+       << "loop_closures " << statistics.loop_closure_num << "\n"
+       << "peak_rss_mb " << PeakRssInMb() << "\n"
+       << "final_optimization_time " << statistics.final_optimization_time
+       << "\n"
+       << "map_generation_time " << statistics.map_generation_time << "\n";
+  if (!file) {
+    PRINT_ERROR_FMT("Failed to write the summary into %s", filename.c_str());
+  }
+}
+
+// the replay settings shared by all the bags of a run
+struct ReplaySettings {
+  std::vector<std::string> point_cloud_topics;
+  std::vector<std::string> cloud_frame_ids;
+  std::string imu_topic;
+  std::string imu_frame_id;
+  std::string odom_topic;
+  std::string odom_frame_id;
+  std::string gps_topic;
+  std::string gps_frame_id;
+  std::string config_file;
+  std::string urdf_file;
+  std::string tracking_frame;
+  // the time window of the bag to map, in seconds from its beginning, for
+  // mapping the segments of a long bag in parallel (see
+  // tools/scripts/segment_mapping.sh), the whole bag by default
+  double start = 0.;
+  double duration = -1.;
+};
+
+// map one bag with a new map builder, the outputs are under output_prefix
+// if it is not empty, otherwise where the config puts them
+// @return false if the bag can not be mapped
+bool RunMapping(const ReplaySettings& settings, const std::string& bag_file,
+                const std::string& output_prefix,
+                const std::string& summary_file) {
+  const auto& point_cloud_topics = settings.point_cloud_topics;
+  const auto& cloud_frame_ids = settings.cloud_frame_ids;
+  const std::string& cloud_frame_id = cloud_frame_ids.front();
+  const std::string& imu_topic = settings.imu_topic;
+  const std::string& odom_topic = settings.odom_topic;
+  const std::string& gps_topic = settings.gps_topic;
+  const std::string& tracking_frame = settings.tracking_frame;
+  const bool use_imu = !imu_topic.empty();
+  const bool use_odom = !odom_topic.empty() && !settings.odom_frame_id.empty();
+  const bool use_gps = !gps_topic.empty() && !settings.gps_frame_id.empty();
+
+  rosbag::Bag bag;
+  try {
+    bag.open(bag_file, rosbag::bagmode::Read);
+  } catch (const rosbag::BagException& e) {
+    PRINT_ERROR_FMT("Failed to open bag %s : %s", bag_file.c_str(), e.what());
+    return false;
+  }
+  PRINT_INFO_FMT("Replay bag: %s", bag_file.c_str());
+
+  // static transforms from urdf file or from the bag itself
+  tf2_ros::Buffer tf_buffer;
+  if (settings.urdf_file.empty()) {
+    ReadStaticTransformsFromBag(bag, &tf_buffer);
+  } else {
+    static_map_ros::ReadStaticTransformsFromUrdf(settings.urdf_file,
+                                                 &tf_buffer);
+  }
+
+  MapBuilder::Ptr map_builder = std::make_shared<MapBuilder>();
+  map_builder->SetOutputPrefix(output_prefix);
+  // a checkpoint is only resumed by the same bag and segment
+  std::string job_name = bag_file;
+  if (settings.start > 0. || settings.duration > 0.) {
+    job_name += " " + std::to_string(settings.start) + " " +
+                std::to_string(settings.duration);
+  }
+  map_builder->SetJobName(job_name);
+  static_map_ros::StaticTransformCache static_transforms(&tf_buffer);
+  for (size_t i = 0; i < cloud_frame_ids.size(); ++i) {
+    static_transforms.Register(tracking_frame, cloud_frame_ids[i],
+                               [&, i](const Eigen::Matrix4f& t) {
+                                 map_builder->SetTrackingToLidar(
+                                     t, static_cast<int>(i));
+                               });
+  }
+  if (use_imu) {
+    static_transforms.Register(
+        tracking_frame, settings.imu_frame_id,
+        [&](const Eigen::Matrix4f& t) { map_builder->SetTrackingToImu(t); });
+  }
+  if (use_odom) {
+    static_transforms.Register(settings.odom_frame_id, cloud_frame_id,
+                               [&](const Eigen::Matrix4f& t) {
+                                 map_builder->SetTransformOdomToLidar(t);
+                               });
+  }
+  if (use_gps) {
+    static_transforms.Register(
+        tracking_frame, settings.gps_frame_id,
+        [&](const Eigen::Matrix4f& t) { map_builder->SetTrackingToGps(t); });
+  }
+  static_transforms.Resolve();
+
+  if (!settings.config_file.empty()) {
+    const auto options = map_builder->Initialise(settings.config_file.c_str());
+    if (options.front_end_options.imu_options.enabled && !use_imu) {
+      PRINT_ERROR("You should set a imu topic if you enable using imu.");
+      map_builder->FinishAllComputations();
+      return false;
+    }
+  } else {
+    map_builder->Initialise(NULL);
+  }
+  map_builder->EnableUsingOdom(use_odom);
+  map_builder->EnableUsingGps(use_gps);
+
+  std::vector<std::string> topics = point_cloud_topics;
+  if (use_imu) {
+    topics.push_back(imu_topic);
+  }
+  if (use_odom) {
+    topics.push_back(odom_topic);
+  }
+  if (use_gps) {
+    topics.push_back(gps_topic);
+  }
+
+  // rosbag::View iterates all messages in timestamp order
+  // always block while the inner queues are full, so the replay runs just as
+  // fast as the mapping pipeline
+  // resumed from a checkpoint, the messages before it are skipped
+  // only the time window of the segment if it is given
+  ros::Time replay_start_time = ros::TIME_MIN;
+  ros::Time replay_end_time = ros::TIME_MAX;
+  if (settings.start > 0. || settings.duration > 0.) {
+    const ros::Time bag_begin_time =
+        rosbag::View(bag, rosbag::TopicQuery(topics)).getBeginTime();
+    replay_start_time = bag_begin_time + ros::Duration(settings.start);
+    if (settings.duration > 0.) {
+      replay_end_time = replay_start_time + ros::Duration(settings.duration);
+    }
+    PRINT_INFO_FMT("Replay the segment from %lf s to %lf s.",
+                   replay_start_time.toSec(), replay_end_time.toSec());
+  }
+  const static_map::SimpleTime resume_time = map_builder->ResumeTime();
+  if (resume_time.secs != 0 || resume_time.nsecs != 0) {
+    replay_start_time = std::max(
+        replay_start_time, ros::Time(resume_time.secs, resume_time.nsecs));
+    PRINT_INFO_FMT("Resume the replay from %lf s.", replay_start_time.toSec());
+  }
+  rosbag::View view(bag, rosbag::TopicQuery(topics), replay_start_time,
+                    replay_end_time);
+  const size_t message_count = view.size();
+  const double bag_duration = (view.getEndTime() - view.getBeginTime()).toSec();
+  size_t message_index = 0;
+  size_t scan_num = 0;
+  const auto start_time = static_map::SimpleTime::get_current_time();
+  for (const rosbag::MessageInstance& msg : view) {
+    message_index++;
+    if (message_index % 10000 == 0) {
+      PRINT_INFO_FMT("Replayed %lu / %lu messages (bag time %lf s)",
+                     message_index, message_count,
+                     (msg.getTime() - view.getBeginTime()).toSec());
+    }
+
+    const std::string& topic = msg.getTopic();
+    const auto lidar =
+        std::find(point_cloud_topics.begin(), point_cloud_topics.end(), topic);
+    if (lidar != point_cloud_topics.end()) {
+      sensor_msgs::PointCloud2::ConstPtr cloud_msg =
+          msg.instantiate<sensor_msgs::PointCloud2>();
+      if (!cloud_msg) {
+        continue;
+      }
+      const int lidar_index =
+          static_cast<int>(lidar - point_cloud_topics.begin());
+      MapBuilder::PointTimesPtr point_times;
+      MapBuilder::PointCloudPtr incoming_cloud = map_builder->AcquirePointCloud(
+          *cloud_msg, &point_times, lidar_index);
+      if (incoming_cloud &&
+          map_builder->InsertPointcloudMsgBlocking(incoming_cloud, point_times,
+                                                   lidar_index)) {
+        scan_num++;
+      }
+    } else if (use_imu && topic == imu_topic) {
+      sensor_msgs::Imu::ConstPtr imu_msg = msg.instantiate<sensor_msgs::Imu>();
+      if (!imu_msg) {
+        continue;
+      }
+      ImuMsg::Ptr incomming_imu(new ImuMsg);
+      *incomming_imu = static_map::sensors::ToLocalImu(*imu_msg);
+      map_builder->InsertImuMsg(incomming_imu);
+    } else if (use_odom && topic == odom_topic) {
+      nav_msgs::Odometry::ConstPtr odom_msg =
+          msg.instantiate<nav_msgs::Odometry>();
+      if (!odom_msg) {
+        continue;
+      }
+      OdomMsg::Ptr local_odom(new OdomMsg);
+      *local_odom = static_map::sensors::ToLocalOdom(*odom_msg);
+      map_builder->InsertOdomMsg(local_odom);
+    } else if (use_gps && topic == gps_topic) {
+      sensor_msgs::NavSatFix::ConstPtr gps_msg =
+          msg.instantiate<sensor_msgs::NavSatFix>();
+      if (!gps_msg) {
+        continue;
+      }
+      NavSatFixMsg::Ptr local_gps(new NavSatFixMsg);
+      *local_gps = static_map::sensors::ToLocalNavSatMsg(*gps_msg);
+      map_builder->InsertGpsMsg(local_gps);
+    }
+  }
+  bag.close();
+
+  map_builder->FinishAllComputations();
+  const double cost_time =
+      (static_map::SimpleTime::get_current_time() - start_time).toSec();
+  PRINT_INFO_FMT("Offline mapping done in %lf s (bag duration %lf s).",
+                 cost_time, bag_duration);
+  ReportSummary(map_builder->GetRunStatistics(), scan_num, cost_time,
+                summary_file);
+  return true;
+}
+
+// the mapping service: one process maps the bags of a queue of jobs in
+// order, the process-wide inits, the thread pools and the parsed ros
+// settings are kept warm between them, each job gets a new map builder
+// the jobs file has one job per line, "bag_file [output_dir]", with the
+// outputs of the config under output_dir if given, "#" for comments
+// with "-" the jobs are read from stdin (e.g. a fifo) until it is closed
+// @return false if any job failed
+bool RunJobs(const ReplaySettings& settings, const std::string& jobs_file,
+             const std::string& summary_file) {
+  std::ifstream file;
+  if (jobs_file != "-") {
+    file.open(jobs_file);
+    if (!file.is_open()) {
+      PRINT_ERROR_FMT("Failed to open the jobs %s", jobs_file.c_str());
+      return false;
+    }
+  }
+  std::istream& jobs = jobs_file == "-" ? std::cin : file;
+  int job_num = 0;
+  int failed_num = 0;
+  std::string line;
+  while (std::getline(jobs, line)) {
+    boost::trim(line);
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::vector<std::string> fields;
+    boost::split(fields, line, boost::is_any_of(" \t"),
+                 boost::token_compress_on);
+    std::string output_prefix = fields.size() > 1u ? fields[1] : "";
+    if (!output_prefix.empty() && output_prefix.back() != '/') {
+      output_prefix += '/';
+    }
+    job_num++;
+    PRINT_INFO_FMT("Job %d: %s", job_num, line.c_str());
+    // the metrics of each job from zero
+    static_map::common::MetricsRegistry::Get()->Reset();
+    if (!RunMapping(settings, fields[0], output_prefix,
+                    summary_file.empty() ? "" : output_prefix + summary_file)) {
+      PRINT_ERROR_FMT("Job %d failed: %s", job_num, fields[0].c_str());
+      failed_num++;
+    }
+  }
+  PRINT_INFO_FMT("Finished %d jobs, %d failed.", job_num, failed_num);
+  return failed_num == 0;
+}
+
+int main(int argc, char** argv) {
+  // no ros master is needed, only for ros::Time
+  ros::Time::init();
+
+  // parse auguements
+  // a queue of jobs instead of one bag, see RunJobs()
+  std::string jobs_file = "";
+  pcl::console::parse_argument(argc, argv, "-jobs", jobs_file);
+  std::string bag_file = "";
+  pcl::console::parse_argument(argc, argv, "-bag", bag_file);
+  if (bag_file.empty() && jobs_file.empty()) {
+    PRINT_ERROR("you should use \"-bag filename\" to specify the bag file.");
+    return -1;
+  }
+  ReplaySettings settings;
+  // point cloud
+  std::string point_cloud_topic = "";
+  pcl::console::parse_argument(argc, argv, "-pc", point_cloud_topic);
+  if (point_cloud_topic.empty()) {
+    PRINT_ERROR("point cloud topic is empty!");
+    return -1;
+  }
+  std::string cloud_frame_id = "base_link";
+  pcl::console::parse_argument(argc, argv, "-pc_frame_id", cloud_frame_id);
+  // several lidars: "-pc topic_0,topic_1 -pc_frame_id frame_0,frame_1"
+  boost::split(settings.point_cloud_topics, point_cloud_topic,
+               boost::is_any_of(","));
+  boost::split(settings.cloud_frame_ids, cloud_frame_id, boost::is_any_of(","));
+  if (settings.point_cloud_topics.size() != settings.cloud_frame_ids.size()) {
+    PRINT_ERROR("Each point cloud topic should have its frame id!");
+    return -1;
+  }
+  // imu
+  settings.imu_frame_id = "/novatel_imu";
+  pcl::console::parse_argument(argc, argv, "-imu", settings.imu_topic);
+  pcl::console::parse_argument(argc, argv, "-imu_frame_id",
+                               settings.imu_frame_id);
+  // odom
+  pcl::console::parse_argument(argc, argv, "-odom", settings.odom_topic);
+  pcl::console::parse_argument(argc, argv, "-odom_frame_id",
+                               settings.odom_frame_id);
+  // gps
+  pcl::console::parse_argument(argc, argv, "-gps", settings.gps_topic);
+  pcl::console::parse_argument(argc, argv, "-gps_frame_id",
+                               settings.gps_frame_id);
+  // config file
+  pcl::console::parse_argument(argc, argv, "-cfg", settings.config_file);
+  // urdf file
+  pcl::console::parse_argument(argc, argv, "-urdf", settings.urdf_file);
+  // tracking frame
+  settings.tracking_frame = "base_link";
+  pcl::console::parse_argument(argc, argv, "-track", settings.tracking_frame);
+  // segment
+  pcl::console::parse_argument(argc, argv, "-start", settings.start);
+  pcl::console::parse_argument(argc, argv, "-duration", settings.duration);
+  // benchmark summary file
+  std::string summary_file = "";
+  pcl::console::parse_argument(argc, argv, "-summary", summary_file);
+  // the outputs of the config under this directory, as the jobs do
+  std::string output_dir = "";
+  pcl::console::parse_argument(argc, argv, "-output", output_dir);
+
+  if (!jobs_file.empty()) {
+    return RunJobs(settings, jobs_file, summary_file) ? 0 : -1;
+  }
+  return RunMapping(settings, bag_file, output_dir, summary_file) ? 0 : -1;
+}
@@ -26,13 +26,20 @@
 #include <pcl/io/pcd_io.h>
 #include <pcl/point_types.h>
 #include <pcl_conversions/pcl_conversions.h>
+#include <ros/callback_queue.h>
 #include <ros/ros.h>
 #include <sensor_msgs/PointCloud.h>
 #include <sensor_msgs/PointCloud2.h>
 #include <std_msgs/String.h>
 #include <visualization_msgs/Marker.h>
+#include <visualization_msgs/MarkerArray.h>
 // stl
 #include <sstream>
+#include <string>
+#include <vector>
+// boost
+#include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
 // local
 #include "builder/map_builder.h"
 #include "builder/msg_conversion.h"
@@ -46,15 +53,14 @@ using static_map::sensors::ImuMsg;
 using static_map::sensors::NavSatFixMsg;
 using static_map::sensors::OdomMsg;
 
-void pointcloud_callback(const sensor_msgs::PointCloud2::ConstPtr& msg) {
-  pcl::PCLPointCloud2 pcl_pc2;
-  pcl_conversions::toPCL(*msg, pcl_pc2);
-  MapBuilder::PointCloudPtr incoming_cloud(new MapBuilder::PointCloudType);
-  pcl::fromPCLPointCloud2(pcl_pc2, *incoming_cloud);
-
-  std::vector<int> inliers;  // no use, just for the function
-  pcl::removeNaNFromPointCloud(*incoming_cloud, *incoming_cloud, inliers);
-  map_builder->InsertPointcloudMsg(incoming_cloud);
+void pointcloud_callback(const sensor_msgs::PointCloud2::ConstPtr& msg,
+                         const int lidar_index) {
+  MapBuilder::PointTimesPtr point_times;
+  MapBuilder::PointCloudPtr incoming_cloud =
+      map_builder->AcquirePointCloud(*msg, &point_times, lidar_index);
+  if (incoming_cloud) {
+    map_builder->InsertPointcloudMsg(incoming_cloud, point_times, lidar_index);
+  }
 }
 
 void imu_callback(const sensor_msgs::Imu& imu_msg) {
@@ -78,6 +84,29 @@ void gps_callback(const sensor_msgs::NavSatFix& gps_msg) {
 int main(int argc, char** argv) {
   ros::init(argc, argv, "static_mapping_node");
   ros::NodeHandle n;
+  // the lidars, the imu with the odom, and the gps have their own queues and
+  // spinners, so that a slow cloud conversion never delays the imu and odom
+  // msgs the pose extrapolator is waiting for
+  ros::CallbackQueue lidar_queue;
+  ros::CallbackQueue imu_odom_queue;
+  ros::CallbackQueue gps_queue;
+  ros::NodeHandle lidar_n;
+  ros::NodeHandle imu_odom_n;
+  ros::NodeHandle gps_n;
+  lidar_n.setCallbackQueue(&lidar_queue);
+  imu_odom_n.setCallbackQueue(&imu_odom_queue);
+  gps_n.setCallbackQueue(&gps_queue);
+  // the sizes of the subscriber queues
+  int point_cloud_queue_size = 10;
+  int imu_queue_size = 100;
+  int odom_queue_size = 100;
+  int gps_queue_size = 100;
+  pcl::console::parse_argument(argc, argv, "-pc_queue_size",
+                               point_cloud_queue_size);
+  pcl::console::parse_argument(argc, argv, "-imu_queue_size", imu_queue_size);
+  pcl::console::parse_argument(argc, argv, "-odom_queue_size",
+                               odom_queue_size);
+  pcl::console::parse_argument(argc, argv, "-gps_queue_size", gps_queue_size);
 
   // parse auguements
   // point cloud
@@ -90,10 +119,24 @@ int main(int argc, char** argv) {
     PRINT_INFO_FMT("Get point cloud from ROS topic: %s",
                    point_cloud_topic.c_str());
   }
-  ros::Subscriber sub_pointcloud =
-      n.subscribe(point_cloud_topic, 10, pointcloud_callback);
   std::string cloud_frame_id = "base_link";
   pcl::console::parse_argument(argc, argv, "-pc_frame_id", cloud_frame_id);
+  // several lidars: "-pc topic_0,topic_1 -pc_frame_id frame_0,frame_1"
+  std::vector<std::string> point_cloud_topics;
+  std::vector<std::string> cloud_frame_ids;
+  boost::split(point_cloud_topics, point_cloud_topic, boost::is_any_of(","));
+  boost::split(cloud_frame_ids, cloud_frame_id, boost::is_any_of(","));
+  if (point_cloud_topics.size() != cloud_frame_ids.size()) {
+    PRINT_ERROR("Each point cloud topic should have its frame id!");
+    return -1;
+  }
+  cloud_frame_id = cloud_frame_ids.front();
+  std::vector<ros::Subscriber> sub_pointclouds;
+  for (size_t i = 0; i < point_cloud_topics.size(); ++i) {
+    sub_pointclouds.push_back(lidar_n.subscribe<sensor_msgs::PointCloud2>(
+        point_cloud_topics[i], point_cloud_queue_size,
+        boost::bind(pointcloud_callback, _1, static_cast<int>(i))));
+  }
 
   // imu
   std::string imu_topic = "";
@@ -105,7 +148,7 @@ int main(int argc, char** argv) {
     PRINT_WARNING("No imu topic, expect no imu messages.");
   } else {
     PRINT_INFO_FMT("Get imu data from ROS topic: %s", imu_topic.c_str());
-    sub_imu = n.subscribe(imu_topic, 100, imu_callback);
+    sub_imu = imu_odom_n.subscribe(imu_topic, imu_queue_size, imu_callback);
     pcl::console::parse_argument(argc, argv, "-imu_frame_id", imu_frame_id);
     use_imu = true;
   }
@@ -118,7 +161,8 @@ int main(int argc, char** argv) {
   pcl::console::parse_argument(argc, argv, "-odom_frame_id", odom_frame_id);
   ros::Subscriber sub_odom;
   if (!odom_topic.empty() && !odom_frame_id.empty()) {
-    sub_odom = n.subscribe(odom_topic, 100, odom_callback);
+    sub_odom =
+        imu_odom_n.subscribe(odom_topic, odom_queue_size, odom_callback);
     use_odom = true;
     PRINT_INFO_FMT("Get odom data from ROS topic: %s", odom_topic.c_str());
   } else {
@@ -133,7 +177,7 @@ int main(int argc, char** argv) {
   pcl::console::parse_argument(argc, argv, "-gps_frame_id", gps_frame_id);
   ros::Subscriber gps_subscriber;
   if (!gps_topic.empty() && !gps_frame_id.empty()) {
-    gps_subscriber = n.subscribe(gps_topic, 100, gps_callback);
+    gps_subscriber = gps_n.subscribe(gps_topic, gps_queue_size, gps_callback);
     use_gps = true;
     PRINT_INFO_FMT("Get gps data from ROS topic: %s", gps_topic.c_str());
   } else {
@@ -159,6 +203,10 @@ int main(int argc, char** argv) {
       n.advertise<sensor_msgs::PointCloud2>("/submap", 1);
   ros::Publisher pose_marker_pub =
       n.advertise<visualization_msgs::Marker>("/submap_pose", 1);
+  // only the new and the optimized submaps in each message, a marker per
+  // submap with its index as the id, so rviz keeps the others
+  ros::Publisher submap_poses_pub =
+      n.advertise<visualization_msgs::MarkerArray>("/submap_poses", 10);
 
   auto show_function =
       [&](const static_map::MapBuilder::PointCloudPtr& cloud) -> void {
@@ -217,54 +265,85 @@ int main(int argc, char** argv) {
     pose_marker_pub.publish(marker);
   };
 
+  auto show_submap_poses_function =
+      [&](const static_map::MapBuilder::SubmapPoses& poses) -> void {
+    visualization_msgs::MarkerArray markers;
+    markers.markers.reserve(poses.size());
+    for (const auto& submap_pose : poses) {
+      visualization_msgs::Marker marker;
+      marker.header.frame_id = "/map";
+      marker.header.stamp = ros::Time::now();
+      marker.ns = "submaps";
+      marker.id = submap_pose.index;
+      marker.type = visualization_msgs::Marker::ARROW;
+      marker.action = visualization_msgs::Marker::ADD;
+      const Eigen::Matrix4f& pose = submap_pose.pose;
+      marker.pose.position.x = pose(0, 3);
+      marker.pose.position.y = pose(1, 3);
+      marker.pose.position.z = pose(2, 3);
+      Eigen::Quaternionf q(Eigen::Matrix3f(pose.block(0, 0, 3, 3)));
+      marker.pose.orientation.x = q.x();
+      marker.pose.orientation.y = q.y();
+      marker.pose.orientation.z = q.z();
+      marker.pose.orientation.w = q.w();
+      marker.scale.x = 1.0;
+      marker.scale.y = 0.3;
+      marker.scale.z = 0.3;
+      marker.color.r = 1.0f;
+      marker.color.g = 0.5f;
+      marker.color.b = 0.0f;
+      marker.color.a = 1.0;
+      marker.lifetime = ros::Duration();
+      markers.markers.push_back(marker);
+    }
+    submap_poses_pub.publish(markers);
+  };
+
   map_builder = std::make_shared<MapBuilder>();
 
-  // @todo(edward) merge these 2 situation into 1
+  // static transforms from urdf file or from tf, resolved only once
+  tf2_ros::Buffer tf_buffer;
+  static_map_ros::StaticTransformCache static_transforms(&tf_buffer);
+  for (size_t i = 0; i < cloud_frame_ids.size(); ++i) {
+    static_transforms.Register(tracking_frame, cloud_frame_ids[i],
+                               [i](const Eigen::Matrix4f& t) {
+                                 map_builder->SetTrackingToLidar(
+                                     t, static_cast<int>(i));
+                               });
+  }
+  if (use_imu) {
+    static_transforms.Register(
+        tracking_frame, imu_frame_id,
+        [](const Eigen::Matrix4f& t) { map_builder->SetTrackingToImu(t); });
+  }
+  if (use_odom) {
+    static_transforms.Register(odom_frame_id, cloud_frame_id,
+                               [](const Eigen::Matrix4f& t) {
+                                 map_builder->SetTransformOdomToLidar(t);
+                               });
+  }
+  if (use_gps) {
+    static_transforms.Register(
+        tracking_frame, gps_frame_id,
+        [](const Eigen::Matrix4f& t) { map_builder->SetTrackingToGps(t); });
+  }
+  ros::Subscriber tf_static_subscriber;
   if (urdf_file.empty()) {
-    tf::TransformListener listener;
-    map_builder->SetTrackingToLidar(
-        static_map_ros::LoopUpTransfrom(tracking_frame, cloud_frame_id,
-                                        listener)
-            .cast<float>());
-    if (use_imu) {
-      map_builder->SetTrackingToImu(static_map_ros::LoopUpTransfrom(
-                                        tracking_frame, imu_frame_id, listener)
-                                        .cast<float>());
-    }
-    if (use_odom) {
-      map_builder->SetTransformOdomToLidar(
-          static_map_ros::LoopUpTransfrom(odom_frame_id, cloud_frame_id,
-                                          listener)
-              .cast<float>());
-    }
-    if (use_gps) {
-      map_builder->SetTrackingToGps(static_map_ros::LoopUpTransfrom(
-                                        tracking_frame, gps_frame_id, listener)
-                                        .cast<float>());
+    {
+      // listens only until all resolved
+      tf2_ros::TransformListener listener(tf_buffer);
+      static_transforms.Resolve();
     }
+    // the later changes, handled in the main thread by ros::spinOnce(), the
+    // sensor callbacks run in their own spinners, MapBuilder guards the
+    // transforms against that
+    tf_static_subscriber =
+        n.subscribe("/tf_static", 10,
+                    &static_map_ros::StaticTransformCache::OnTfStatic,
+                    &static_transforms);
   } else {
-    tf2_ros::Buffer tf_buffer;
     static_map_ros::ReadStaticTransformsFromUrdf(urdf_file, &tf_buffer);
-    map_builder->SetTrackingToLidar(
-        static_map_ros::LoopUpTransfrom(tracking_frame, cloud_frame_id,
-                                        tf_buffer)
-            .cast<float>());
-    if (use_imu) {
-      map_builder->SetTrackingToImu(static_map_ros::LoopUpTransfrom(
-                                        tracking_frame, imu_frame_id, tf_buffer)
-                                        .cast<float>());
-    }
-    if (use_odom) {
-      map_builder->SetTransformOdomToLidar(
-          static_map_ros::LoopUpTransfrom(odom_frame_id, cloud_frame_id,
-                                          tf_buffer)
-              .cast<float>());
-    }
-    if (use_gps) {
-      map_builder->SetTrackingToGps(static_map_ros::LoopUpTransfrom(
-                                        tracking_frame, gps_frame_id, tf_buffer)
-                                        .cast<float>());
-    }
+    static_transforms.Resolve();
   }
 
   if (!config_file.empty()) {
@@ -282,11 +361,23 @@ int main(int argc, char** argv) {
   map_builder->SetShowMapFunction(show_function);
   map_builder->SetShowPoseFunction(show_pose_function);
   map_builder->SetShowSubmapFunction(show_submap_function);
+  map_builder->SetShowSubmapPosesFunction(show_submap_poses_function);
+  // a thread per lidar, the callbacks of one subscriber are still in order
+  ros::AsyncSpinner lidar_spinner(point_cloud_topics.size(), &lidar_queue);
+  // one thread, the imu and the odom are inserted in the order they come
+  ros::AsyncSpinner imu_odom_spinner(1, &imu_odom_queue);
+  ros::AsyncSpinner gps_spinner(1, &gps_queue);
+  lidar_spinner.start();
+  imu_odom_spinner.start();
+  gps_spinner.start();
   ros::Rate loop_rate(1000);
   while (ros::ok()) {
     ros::spinOnce();
     loop_rate.sleep();
   }
+  lidar_spinner.stop();
+  imu_odom_spinner.stop();
+  gps_spinner.stop();
 
   map_builder->FinishAllComputations();
   while (ros::ok()) {
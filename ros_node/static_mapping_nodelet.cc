@@ -0,0 +1,250 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// third party
+#include <nodelet/nodelet.h>
+#include <pcl_conversions/pcl_conversions.h>
+#include <pluginlib/class_list_macros.h>
+#include <ros/ros.h>
+#include <sensor_msgs/PointCloud2.h>
+// stl
+#include <memory>
+#include <string>
+#include <vector>
+// boost
+#include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
+// local
+#include "builder/map_builder.h"
+#include "builder/msg_conversion.h"
+#include "ros_node/tf_bridge.h"
+
+namespace static_map_ros {
+
+using static_map::MapBuilder;
+using static_map::sensors::ImuMsg;
+using static_map::sensors::NavSatFixMsg;
+using static_map::sensors::OdomMsg;
+
+/**
+ * @class StaticMappingNodelet
+ * @brief the nodelet version of static_mapping_node, loaded into the same
+ * manager as the lidar driver nodelet it gets the clouds by shared pointers
+ * without any serialization
+ * the arguments of the node are the private params here:
+ * point_cloud_topic, point_cloud_frame_id, imu_topic, imu_frame_id,
+ * odom_topic, odom_frame_id, gps_topic, gps_frame_id, config_file,
+ * urdf_file and tracking_frame
+ * several lidars are given by comma separated topics and frame ids
+ */
+class StaticMappingNodelet : public nodelet::Nodelet {
+ public:
+  StaticMappingNodelet() = default;
+  ~StaticMappingNodelet() {
+    if (map_builder_) {
+      map_builder_->FinishAllComputations();
+    }
+  }
+
+ private:
+  void onInit() override {
+    ros::NodeHandle& n = getMTNodeHandle();
+    ros::NodeHandle& private_n = getMTPrivateNodeHandle();
+
+    std::string point_cloud_topic = "";
+    std::string cloud_frame_id = "base_link";
+    std::string imu_topic = "";
+    std::string imu_frame_id = "/novatel_imu";
+    std::string odom_topic = "";
+    std::string odom_frame_id = "";
+    std::string gps_topic = "";
+    std::string gps_frame_id = "";
+    std::string config_file = "";
+    std::string urdf_file = "";
+    std::string tracking_frame = "base_link";
+    private_n.param("point_cloud_topic", point_cloud_topic, point_cloud_topic);
+    private_n.param("point_cloud_frame_id", cloud_frame_id, cloud_frame_id);
+    private_n.param("imu_topic", imu_topic, imu_topic);
+    private_n.param("imu_frame_id", imu_frame_id, imu_frame_id);
+    private_n.param("odom_topic", odom_topic, odom_topic);
+    private_n.param("odom_frame_id", odom_frame_id, odom_frame_id);
+    private_n.param("gps_topic", gps_topic, gps_topic);
+    private_n.param("gps_frame_id", gps_frame_id, gps_frame_id);
+    private_n.param("config_file", config_file, config_file);
+    private_n.param("urdf_file", urdf_file, urdf_file);
+    private_n.param("tracking_frame", tracking_frame, tracking_frame);
+    if (point_cloud_topic.empty()) {
+      PRINT_ERROR("point cloud topic is empty!");
+      return;
+    }
+    std::vector<std::string> point_cloud_topics;
+    std::vector<std::string> cloud_frame_ids;
+    boost::split(point_cloud_topics, point_cloud_topic, boost::is_any_of(","));
+    boost::split(cloud_frame_ids, cloud_frame_id, boost::is_any_of(","));
+    if (point_cloud_topics.size() != cloud_frame_ids.size()) {
+      PRINT_ERROR("Each point cloud topic should have its frame id!");
+      return;
+    }
+    cloud_frame_id = cloud_frame_ids.front();
+    const bool use_imu = !imu_topic.empty();
+    const bool use_odom = !odom_topic.empty() && !odom_frame_id.empty();
+    const bool use_gps = !gps_topic.empty() && !gps_frame_id.empty();
+
+    map_builder_ = std::make_shared<MapBuilder>();
+    // static transforms from urdf file or from tf, resolved only once
+    // the callbacks of the nodelet are multi-threaded, so the later changes
+    // in /tf_static are not applied
+    tf2_ros::Buffer tf_buffer;
+    StaticTransformCache static_transforms(&tf_buffer);
+    MapBuilder* const builder = map_builder_.get();
+    for (size_t i = 0; i < cloud_frame_ids.size(); ++i) {
+      static_transforms.Register(tracking_frame, cloud_frame_ids[i],
+                                 [builder, i](const Eigen::Matrix4f& t) {
+                                   builder->SetTrackingToLidar(
+                                       t, static_cast<int>(i));
+                                 });
+    }
+    if (use_imu) {
+      static_transforms.Register(tracking_frame, imu_frame_id,
+                                 [builder](const Eigen::Matrix4f& t) {
+                                   builder->SetTrackingToImu(t);
+                                 });
+    }
+    if (use_odom) {
+      static_transforms.Register(odom_frame_id, cloud_frame_id,
+                                 [builder](const Eigen::Matrix4f& t) {
+                                   builder->SetTransformOdomToLidar(t);
+                                 });
+    }
+    if (use_gps) {
+      static_transforms.Register(tracking_frame, gps_frame_id,
+                                 [builder](const Eigen::Matrix4f& t) {
+                                   builder->SetTrackingToGps(t);
+                                 });
+    }
+    if (urdf_file.empty()) {
+      tf2_ros::TransformListener listener(tf_buffer);
+      static_transforms.Resolve();
+    } else {
+      ReadStaticTransformsFromUrdf(urdf_file, &tf_buffer);
+      static_transforms.Resolve();
+    }
+
+    if (!config_file.empty()) {
+      const auto options = map_builder_->Initialise(config_file.c_str());
+      if (options.front_end_options.imu_options.enabled && !use_imu) {
+        PRINT_ERROR("You should set a imu topic if you enable using imu.");
+        map_builder_->FinishAllComputations();
+        map_builder_.reset();
+        return;
+      }
+    } else {
+      map_builder_->Initialise(NULL);
+    }
+    map_builder_->EnableUsingOdom(use_odom);
+    map_builder_->EnableUsingGps(use_gps);
+
+    map_publisher_ = n.advertise<sensor_msgs::PointCloud2>("/optimized_map", 1);
+    submap_publisher_ = n.advertise<sensor_msgs::PointCloud2>("/submap", 1);
+    map_builder_->SetShowMapFunction(
+        [this](const MapBuilder::PointCloudPtr& cloud) {
+          Publish(cloud, &map_publisher_);
+        });
+    map_builder_->SetShowSubmapFunction(
+        [this](const MapBuilder::PointCloudPtr& cloud) {
+          Publish(cloud, &submap_publisher_);
+        });
+
+    // subscribed by ConstPtr, the msgs from the nodelets in the same manager
+    // are passed by shared pointers
+    for (size_t i = 0; i < point_cloud_topics.size(); ++i) {
+      PRINT_INFO_FMT("Get point cloud from ROS topic: %s",
+                     point_cloud_topics[i].c_str());
+      sub_pointclouds_.push_back(n.subscribe<sensor_msgs::PointCloud2>(
+          point_cloud_topics[i], 10,
+          boost::bind(&StaticMappingNodelet::PointCloudCallback, this, _1,
+                      static_cast<int>(i))));
+    }
+    if (use_imu) {
+      sub_imu_ =
+          n.subscribe(imu_topic, 100, &StaticMappingNodelet::ImuCallback, this);
+    }
+    if (use_odom) {
+      sub_odom_ = n.subscribe(odom_topic, 100,
+                              &StaticMappingNodelet::OdomCallback, this);
+    }
+    if (use_gps) {
+      sub_gps_ =
+          n.subscribe(gps_topic, 100, &StaticMappingNodelet::GpsCallback, this);
+    }
+  }
+
+  void PointCloudCallback(const sensor_msgs::PointCloud2::ConstPtr& msg,
+                          const int lidar_index) {
+    MapBuilder::PointTimesPtr point_times;
+    MapBuilder::PointCloudPtr incoming_cloud =
+        map_builder_->AcquirePointCloud(*msg, &point_times, lidar_index);
+    if (incoming_cloud) {
+      map_builder_->InsertPointcloudMsg(incoming_cloud, point_times,
+                                        lidar_index);
+    }
+  }
+
+  void ImuCallback(const sensor_msgs::Imu::ConstPtr& msg) {
+    ImuMsg::Ptr incomming_imu(new ImuMsg);
+    *incomming_imu = static_map::sensors::ToLocalImu(*msg);
+    map_builder_->InsertImuMsg(incomming_imu);
+  }
+
+  void OdomCallback(const nav_msgs::Odometry::ConstPtr& msg) {
+    OdomMsg::Ptr local_odom(new OdomMsg);
+    *local_odom = static_map::sensors::ToLocalOdom(*msg);
+    map_builder_->InsertOdomMsg(local_odom);
+  }
+
+  void GpsCallback(const sensor_msgs::NavSatFix::ConstPtr& msg) {
+    NavSatFixMsg::Ptr local_gps(new NavSatFixMsg);
+    *local_gps = static_map::sensors::ToLocalNavSatMsg(*msg);
+    map_builder_->InsertGpsMsg(local_gps);
+  }
+
+  void Publish(const MapBuilder::PointCloudPtr& cloud,
+               ros::Publisher* const publisher) {
+    sensor_msgs::PointCloud2::Ptr cloud_msg(new sensor_msgs::PointCloud2);
+    pcl::toROSMsg(*cloud, *cloud_msg);
+    cloud_msg->header.frame_id = "/map";
+    cloud_msg->header.stamp = ros::Time::now();
+    publisher->publish(cloud_msg);
+  }
+
+  MapBuilder::Ptr map_builder_;
+  std::vector<ros::Subscriber> sub_pointclouds_;
+  ros::Subscriber sub_imu_;
+  ros::Subscriber sub_odom_;
+  ros::Subscriber sub_gps_;
+  ros::Publisher map_publisher_;
+  ros::Publisher submap_publisher_;
+};
+
+}  // namespace static_map_ros
+
+PLUGINLIB_EXPORT_CLASS(static_map_ros::StaticMappingNodelet, nodelet::Nodelet)
@@ -72,4 +72,65 @@ Eigen::Matrix4d LoopUpTransfrom(const std::string& target_frame,
   return GeometryTransformToEigen(transform);
 }
 
+StaticTransformCache::StaticTransformCache(tf2_ros::Buffer* const tf_buffer)
+    : tf_buffer_(tf_buffer) {
+  CHECK(tf_buffer_);
+}
+
+void StaticTransformCache::Register(const std::string& target_frame,
+                                   const std::string& source_frame,
+                                   const Setter& setter) {
+  Entry entry;
+  entry.target_frame = target_frame;
+  entry.source_frame = source_frame;
+  entry.setter = setter;
+  entries_.push_back(entry);
+}
+
+void StaticTransformCache::Resolve() {
+  for (auto& entry : entries_) {
+    std::string tf_error_msg;
+    int wait_count = 30;
+    while (!tf_buffer_->canTransform(entry.target_frame, entry.source_frame,
+                                     ros::Time(0), &tf_error_msg)) {
+      // only a listener (with its own thread) fills the buffer meanwhile
+      CHECK(tf_buffer_->isUsingDedicatedThread()) << tf_error_msg;
+      PRINT_INFO_FMT("Wating for tf from %s to %s", entry.target_frame.c_str(),
+                     entry.source_frame.c_str());
+      wait_count--;
+      CHECK_GT(wait_count, 0);
+      ros::Duration(2.).sleep();
+    }
+    entry.transform = GeometryTransformToEigen(tf_buffer_->lookupTransform(
+        entry.target_frame, entry.source_frame, ros::Time(0)));
+    entry.resolved = true;
+    entry.setter(entry.transform.cast<float>());
+  }
+}
+
+void StaticTransformCache::OnTfStatic(
+    const tf2_msgs::TFMessage::ConstPtr& msg) {
+  for (const auto& transform : msg->transforms) {
+    tf_buffer_->setTransform(transform, "tf_static", true /* is_static */);
+  }
+  // only a few registered, no need to find the affected ones
+  for (auto& entry : entries_) {
+    if (!tf_buffer_->canTransform(entry.target_frame, entry.source_frame,
+                                  ros::Time(0))) {
+      continue;
+    }
+    const Eigen::Matrix4d transform =
+        GeometryTransformToEigen(tf_buffer_->lookupTransform(
+            entry.target_frame, entry.source_frame, ros::Time(0)));
+    if (entry.resolved && transform.isApprox(entry.transform, 1.e-9)) {
+      continue;
+    }
+    PRINT_INFO_FMT("Static tf from %s to %s updated.",
+                   entry.target_frame.c_str(), entry.source_frame.c_str());
+    entry.transform = transform;
+    entry.resolved = true;
+    entry.setter(entry.transform.cast<float>());
+  }
+}
+
 }  // namespace static_map_ros
@@ -25,8 +25,11 @@
 
 #include <tf/transform_listener.h>
 #include <tf2_msgs/TFMessage.h>
+#include <tf2_ros/transform_listener.h>
 #include <tf_conversions/tf_eigen.h>
+#include <functional>
 #include <string>
+#include <vector>
 #include "Eigen/Eigen"
 #include "ros_node/urdf_reader.h"
 
@@ -38,6 +41,42 @@ Eigen::Matrix4d LoopUpTransfrom(const std::string& target_frame,
 Eigen::Matrix4d LoopUpTransfrom(const std::string& target_frame,
                                 const std::string& source_frame,
                                 const tf2_ros::Buffer& tf_buffer);
+
+/*
+ * @class StaticTransformCache
+ * @brief resolves the static transforms (tracking -> sensors) only once
+ * instead of walking the tf tree for every use, the setters get the
+ * precomputed matrices and they are called again only if a transform
+ * changed in /tf_static
+ * not thread safe, use it in the thread of the ros callbacks
+ */
+class StaticTransformCache {
+ public:
+  using Setter = std::function<void(const Eigen::Matrix4f&)>;
+
+  /// @param tf_buffer filled from urdf, the bag or a listener, not owned
+  explicit StaticTransformCache(tf2_ros::Buffer* tf_buffer);
+
+  void Register(const std::string& target_frame,
+                const std::string& source_frame, const Setter& setter);
+  /// @brief waits for all registered transforms and hands them to the setters
+  void Resolve();
+  /// @brief callback of /tf_static, re-resolves the registered transforms
+  void OnTfStatic(const tf2_msgs::TFMessage::ConstPtr& msg);
+
+ private:
+  struct Entry {
+    std::string target_frame;
+    std::string source_frame;
+    Setter setter;
+    bool resolved = false;
+    Eigen::Matrix4d transform = Eigen::Matrix4d::Identity();
+  };
+
+  tf2_ros::Buffer* const tf_buffer_;
+  std::vector<Entry> entries_;
+};
+
 }  // namespace static_map_ros
 
 #endif  // ROS_NODE_TF_BRIDGE_H_
@@ -0,0 +1,299 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <dirent.h>
+#include <pcl/console/parse.h>
+#include <pcl/io/pcd_io.h>
+#include <pcl/point_types.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "common/macro_defines.h"
+#include "common/pugixml.hpp"
+#include "pre_processors/filter_factory.h"
+#include "pre_processors/filter_pipeline.h"
+
+// count all heap allocations of this process
+namespace {
+std::atomic<uint64_t> allocation_count(0);
+}
+
+void* operator new(std::size_t size) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  void* ptr = std::malloc(size == 0 ? 1 : size);
+  if (!ptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+void* operator new[](std::size_t size) { return operator new(size); }
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+
+using PointType = pcl::PointXYZI;
+using PointCloudType = pcl::PointCloud<PointType>;
+using PointCloudPtr = PointCloudType::Ptr;
+using Factory = static_map::pre_processers::filter::Factory<PointType>;
+using FilterInterface =
+    static_map::pre_processers::filter::Interface<PointType>;
+// the same chain as kPipelineFilters, fixed at compile time
+using Pipeline = static_map::pre_processers::filter::Pipeline<
+    PointType, static_map::pre_processers::filter::Range,
+    static_map::pre_processers::filter::RangeVoxelSampler,
+    static_map::pre_processers::filter::GroundRemoval2>;
+const std::vector<std::string> kPipelineFilters = {
+    "Range", "RangeVoxelSampler", "GroundRemoval2"};
+
+struct BenchResult {
+  uint64_t input_points = 0;
+  uint64_t output_points = 0;
+  uint64_t allocations = 0;
+  double seconds = 0.;
+  int runs = 0;
+};
+
+std::vector<std::string> ListPcdFiles(const std::string& dir) {
+  std::vector<std::string> files;
+  DIR* dp = opendir(dir.c_str());
+  if (!dp) {
+    return files;
+  }
+  struct dirent* entry;
+  while ((entry = readdir(dp)) != nullptr) {
+    const std::string name = entry->d_name;
+    if (name.size() > 4 && name.substr(name.size() - 4) == ".pcd") {
+      files.push_back(dir + "/" + name);
+    }
+  }
+  closedir(dp);
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+// the first "filters" node in the xml, e.g. of a mapping config
+pugi::xml_node FindFiltersNode(const pugi::xml_node& node) {
+  if (std::string(node.name()) == "filters") {
+    return node;
+  }
+  for (auto child = node.first_child(); child; child = child.next_sibling()) {
+    auto found = FindFiltersNode(child);
+    if (!found.empty()) {
+      return found;
+    }
+  }
+  return pugi::xml_node();
+}
+
+BenchResult RunBench(FilterInterface* const filter,
+                     const std::vector<PointCloudPtr>& scans,
+                     const int repeat) {
+  BenchResult result;
+  PointCloudPtr input(new PointCloudType);
+  PointCloudPtr output(new PointCloudType);
+  // warm up, the reusable buffers are allocated here
+  for (const auto& scan : scans) {
+    *input = *scan;
+    filter->SetInputCloud(input);
+    filter->Filter(output);
+  }
+  for (int r = 0; r < repeat; ++r) {
+    for (const auto& scan : scans) {
+      // restore the input, some filters may touch it
+      *input = *scan;
+      const uint64_t allocation_start = allocation_count.load();
+      const auto start = std::chrono::steady_clock::now();
+      filter->SetInputCloud(input);
+      filter->Filter(output);
+      const auto end = std::chrono::steady_clock::now();
+      result.allocations += allocation_count.load() - allocation_start;
+      result.seconds += std::chrono::duration<double>(end - start).count();
+      result.input_points += scan->size();
+      result.output_points += output->size();
+      result.runs++;
+    }
+  }
+  return result;
+}
+
+// true if two filters give the same points, inliers and outliers on a scan
+bool SameResult(FilterInterface* const filter_a,
+                FilterInterface* const filter_b, const PointCloudPtr& scan) {
+  PointCloudPtr input(new PointCloudType);
+  PointCloudPtr output_a(new PointCloudType);
+  PointCloudPtr output_b(new PointCloudType);
+  *input = *scan;
+  filter_a->SetInputCloud(input);
+  filter_a->Filter(output_a);
+  *input = *scan;
+  filter_b->SetInputCloud(input);
+  filter_b->Filter(output_b);
+  if (output_a->size() != output_b->size() ||
+      filter_a->Inliers() != filter_b->Inliers() ||
+      filter_a->Outliers() != filter_b->Outliers()) {
+    return false;
+  }
+  for (size_t i = 0; i < output_a->size(); ++i) {
+    const auto& point_a = output_a->points[i];
+    const auto& point_b = output_b->points[i];
+    if (point_a.x != point_b.x || point_a.y != point_b.y ||
+        point_a.z != point_b.z || point_a.intensity != point_b.intensity) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void PrintHeader() {
+  std::cout << std::left << std::setw(28) << "filter" << std::right
+            << std::setw(12) << "in pts" << std::setw(12) << "out pts"
+            << std::setw(12) << "ms/scan" << std::setw(12) << "ns/pt"
+            << std::setw(12) << "Mpts/s" << std::setw(14) << "allocs/scan"
+            << std::endl;
+}
+
+void PrintResult(const std::string& name, const BenchResult& result) {
+  if (result.runs == 0 || result.input_points == 0) {
+    std::cout << std::left << std::setw(28) << name << " no result"
+              << std::endl;
+    return;
+  }
+  const double runs = result.runs;
+  std::cout << std::left << std::setw(28) << name << std::right << std::fixed
+            << std::setprecision(1) << std::setw(12)
+            << result.input_points / runs << std::setw(12)
+            << result.output_points / runs << std::setprecision(3)
+            << std::setw(12) << result.seconds / runs * 1.e3 << std::setw(12)
+            << result.seconds / result.input_points * 1.e9 << std::setw(12)
+            << result.input_points / result.seconds * 1.e-6
+            << std::setprecision(1) << std::setw(14)
+            << result.allocations / runs << std::endl;
+}
+
+int main(int argc, char** argv) {
+  std::string pcd_dir = "";
+  std::string xml_filename = "";
+  int repeat = 10;
+  pcl::console::parse_argument(argc, argv, "-dir", pcd_dir);
+  pcl::console::parse_argument(argc, argv, "-xml", xml_filename);
+  pcl::console::parse_argument(argc, argv, "-n", repeat);
+  if (pcd_dir.empty()) {
+    std::cout << "Should use it this way: \n\n"
+              << "    filter_bench -dir [pcd dir] -xml [config] -n [repeat]\n"
+              << "\n  every filter is run with its default params, the "
+                 "fixed chain is run by\n  Factory and by Pipeline, and the "
+                 "filter chain in the xml (e.g. a mapping\n  config) is run "
+                 "as a whole if provided.\n"
+              << std::endl;
+    return -1;
+  }
+
+  std::vector<PointCloudPtr> scans;
+  for (const auto& file : ListPcdFiles(pcd_dir)) {
+    PointCloudPtr scan(new PointCloudType);
+    if (pcl::io::loadPCDFile<PointType>(file, *scan) == -1 || scan->empty()) {
+      std::cout << "Can not load " << file << std::endl;
+      continue;
+    }
+    scans.push_back(scan);
+  }
+  if (scans.empty()) {
+    std::cout << "No pcd file in " << pcd_dir << std::endl;
+    return -1;
+  }
+  std::cout << "Loaded " << scans.size() << " scans, repeat " << repeat
+            << " times.\n"
+            << std::endl;
+
+  // every single filter with default params
+  std::vector<std::pair<std::string, BenchResult>> results;
+  for (const auto& name : Factory().SupportedFilters()) {
+    pugi::xml_document doc;
+    auto filter_node = doc.append_child("filters").append_child("filter");
+    filter_node.append_attribute("name") = name.c_str();
+    // every factory has its own metrics
+    Factory factory;
+    factory.SetMetricsPrefix("filter_bench." + name);
+    factory.InitFromXmlNode(doc.child("filters"));
+    results.emplace_back(name, RunBench(&factory, scans, repeat));
+  }
+
+  // the fixed chain by Factory and by Pipeline, both with default params
+  {
+    pugi::xml_document doc;
+    auto filters_node = doc.append_child("filters");
+    for (const auto& name : kPipelineFilters) {
+      filters_node.append_child("filter").append_attribute("name") =
+          name.c_str();
+    }
+    Factory factory;
+    factory.SetMetricsPrefix("filter_bench.range_chain");
+    factory.InitFromXmlNode(filters_node);
+    Pipeline pipeline;
+    pipeline.InitFromXmlNode(filters_node);
+    if (!SameResult(&factory, &pipeline, scans.front())) {
+      std::cout << "The pipeline does not match the factory!" << std::endl;
+      return -1;
+    }
+    results.emplace_back("factory: range chain",
+                         RunBench(&factory, scans, repeat));
+    results.emplace_back("pipeline: range chain",
+                         RunBench(&pipeline, scans, repeat));
+  }
+
+  // the whole chain from xml
+  if (!xml_filename.empty()) {
+    pugi::xml_document doc;
+    if (!doc.load_file(xml_filename.c_str())) {
+      std::cout << "Can not load " << xml_filename << " as a xml."
+                << std::endl;
+      return -1;
+    }
+    auto filters_node = FindFiltersNode(doc);
+    if (filters_node.empty()) {
+      std::cout << "No filters in " << xml_filename << std::endl;
+      return -1;
+    }
+    Factory factory;
+    factory.SetMetricsPrefix("filter_bench.xml_chain");
+    factory.InitFromXmlNode(filters_node);
+    results.emplace_back("chain: " + xml_filename.substr(
+                                         xml_filename.find_last_of('/') + 1),
+                         RunBench(&factory, scans, repeat));
+  }
+
+  std::cout << std::endl;
+  PrintHeader();
+  for (const auto& result : results) {
+    PrintResult(result.first, result.second);
+  }
+  return 0;
+}
@@ -32,6 +32,16 @@
 #include <pcl/kdtree/kdtree_flann.h>
 #include <pcl/search/impl/search.hpp>
 
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "common/pcd_stream_writer.h"
+#include "common/shared_executor.h"
+
+// the hd map points are searched in chunks in parallel
+constexpr int kChunkPointNum = 1 << 14;
+
 int main(int argc, char** argv) {
   ros::init(argc, argv, "fuse_hdmap_node");
   ros::NodeHandle n;
@@ -90,29 +100,68 @@ int main(int argc, char** argv) {
   x -= 367016.9124389186;
   y -= 3451183.2851449004;
 
+  // the hd map content farther than the corridor (horizontally) from the
+  // path is dropped, 0 for no limit
+  double corridor = 0.;
+  pcl::console::parse_argument(argc, argv, "-corridor", corridor);
+  const float max_squared_distance =
+      corridor > 0. ? corridor * corridor : std::numeric_limits<float>::max();
+
+  // search the path on the ground plane, the height comes from the path
+  pcl::PointCloud<pcl::PointXYZI>::Ptr flat_path_cloud(
+      new pcl::PointCloud<pcl::PointXYZI>(*path_cloud));
+  for (auto& path_point : flat_path_cloud->points) {
+    path_point.z = 0.;
+  }
   std::unique_ptr<pcl::KdTreeFLANN<pcl::PointXYZI>> path_kdtree(
       new pcl::KdTreeFLANN<pcl::PointXYZI>);
-  path_kdtree->setInputCloud(path_cloud);
+  path_kdtree->setInputCloud(flat_path_cloud);
   const float z_offset = 0.5;
-  for (auto& hd_map_point : hdmap_cloud->points) {
-    hd_map_point.x -= x;
-    hd_map_point.y -= y;
-    // hd_map_point.z = 10.;
-    std::vector<int> index;
-    std::vector<float> distance;
-    path_kdtree->nearestKSearch(hd_map_point, 1, index, distance);
-    hd_map_point.z = path_cloud->points[index[0]].z + z_offset;
-    hd_map_point.intensity = 240.;
+  const int hd_point_num = hdmap_cloud->size();
+  std::vector<char> inside_corridor(hd_point_num, 0);
+  auto fuse_chunk = [&](const int chunk) {
+    std::vector<int> index(1);
+    std::vector<float> distance(1);
+    const int end = std::min(hd_point_num, (chunk + 1) * kChunkPointNum);
+    for (int i = chunk * kChunkPointNum; i < end; ++i) {
+      auto& hd_map_point = hdmap_cloud->points[i];
+      hd_map_point.x -= x;
+      hd_map_point.y -= y;
+      hd_map_point.z = 0.;
+      if (path_kdtree->nearestKSearch(hd_map_point, 1, index, distance) < 1 ||
+          distance[0] > max_squared_distance) {
+        continue;
+      }
+      hd_map_point.z = path_cloud->points[index[0]].z + z_offset;
+      hd_map_point.intensity = 240.;
+      inside_corridor[i] = 1;
+    }
+  };
+  const int chunk_num = (hd_point_num + kChunkPointNum - 1) / kChunkPointNum;
+  static_map::common::ParallelFor(
+      0, chunk_num, static_map::common::SharedExecutor::ThreadNum(),
+      fuse_chunk);
+  int kept_num = 0;
+  for (int i = 0; i < hd_point_num; ++i) {
+    if (inside_corridor[i]) {
+      hdmap_cloud->points[kept_num++] = hdmap_cloud->points[i];
+    }
   }
+  hdmap_cloud->points.resize(kept_num);
+  std::cout << "Fused " << kept_num << " / " << hd_point_num
+            << " points of the HDMap." << std::endl;
 
   for (auto& path_point : path_cloud->points) {
     path_point.z += z_offset;
     path_point.intensity = 20.;
   }
-  if (map_cloud) {
-    *map_cloud += *hdmap_cloud;
-    *map_cloud += *path_cloud;
+  // write the clouds one after another without joining them
+  static_map::common::PcdStreamWriter<pcl::PointXYZI> writer;
+  if (!writer.Open("fused_hdmap_map.pcd") || !writer.Write(*map_cloud) ||
+      !writer.Write(*hdmap_cloud) || !writer.Write(*path_cloud) ||
+      !writer.Close()) {
+    std::cout << "can not write the fused map." << std::endl;
+    return -1;
   }
-  pcl::io::savePCDFileBinaryCompressed("fused_hdmap_map.pcd", *map_cloud);
   return 0;
 }
@@ -20,65 +20,241 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
-#include <pcl/common/transforms.h>
 #include <pcl/console/parse.h>
-#include <pcl/filters/random_sample.h>
 #include <pcl/io/pcd_io.h>
 #include <pcl/point_types.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
 #include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
 
+#include "common/pcd_stream_writer.h"
 #include "common/pugixml.hpp"
+#include "common/shared_executor.h"
+#include "common/tiled_map_file.h"
+#include "common/voxel_centroid_grid.h"
+
+using static_map::common::PcdStreamWriter;
+using static_map::common::TiledMapReader;
+using PointCloud = pcl::PointCloud<pcl::PointXYZI>;
+
+struct Piece {
+  // the pcd file of a piece in the package, or the tile in the tiled map
+  std::string pcd_file;
+  int tile = -1;
+  Eigen::Vector2d center = Eigen::Vector2d::Zero();
+};
+
+struct JoinOptions {
+  int level = 0;
+  // no downsampling if not positive
+  float leaf_size = 0.f;
+  bool crop = false;
+  Eigen::Vector2d box_min;
+  Eigen::Vector2d box_max;
+};
+
+// load the piece in the global frame, then crop and downsample it
+bool LoadPiece(const Piece& piece, const TiledMapReader& reader,
+               const JoinOptions& options, PointCloud* cloud) {
+  if (piece.tile >= 0) {
+    reader.LoadTile(piece.tile, options.level, true, cloud);
+  } else {
+    if (pcl::io::loadPCDFile<pcl::PointXYZI>(piece.pcd_file, *cloud) == -1) {
+      return false;
+    }
+    for (auto& point : cloud->points) {
+      point.x += piece.center[0];
+      point.y += piece.center[1];
+    }
+  }
+  if (options.crop) {
+    auto outside = [&options](const pcl::PointXYZI& point) -> bool {
+      return point.x < options.box_min[0] || point.x > options.box_max[0] ||
+             point.y < options.box_min[1] || point.y > options.box_max[1];
+    };
+    cloud->points.erase(
+        std::remove_if(cloud->points.begin(), cloud->points.end(), outside),
+        cloud->points.end());
+    cloud->width = cloud->points.size();
+    cloud->height = 1;
+  }
+  if (options.leaf_size > 0.f) {
+    // the voxels are aligned to the origin, so a voxel is only split by the
+    // border of the pieces
+    static_map::common::VoxelCentroidGrid<pcl::PointXYZI> grid(
+        options.leaf_size);
+    for (const auto& point : cloud->points) {
+      grid.Add(point);
+    }
+    grid.Output(cloud);
+  }
+  return true;
+}
+
+// the pieces are centered on a grid of the half piece width, and each of
+// them covers (center +- half width)
+double PieceHalfWidth(const std::vector<Piece>& pieces) {
+  double half_width = std::numeric_limits<double>::max();
+  for (size_t i = 1; i < pieces.size(); ++i) {
+    for (int axis = 0; axis < 2; ++axis) {
+      const double distance =
+          std::abs(pieces[i].center[axis] - pieces[0].center[axis]);
+      if (distance > 1.e-3) {
+        half_width = std::min(half_width, distance);
+      }
+    }
+  }
+  return half_width;
+}
 
 int main(int argc, char** argv) {
   std::string pkg_filename = "";
+  std::string tiled_filename = "";
+  std::string output_filename = "whole_static_map.pcd";
+  int thread_num = 0;
+  JoinOptions options;
   pcl::console::parse_argument(argc, argv, "-pkg", pkg_filename);
-  if (pkg_filename.empty()) {
-    std::cout << "Should use it this way: \n\n    join_pieces -pkg [filename]\n"
+  pcl::console::parse_argument(argc, argv, "-tmap", tiled_filename);
+  pcl::console::parse_argument(argc, argv, "-lod", options.level);
+  pcl::console::parse_argument(argc, argv, "-leaf", options.leaf_size);
+  pcl::console::parse_argument(argc, argv, "-o", output_filename);
+  pcl::console::parse_argument(argc, argv, "-threads", thread_num);
+  double box[4];
+  if (pcl::console::parse_4x_arguments(argc, argv, "-box", box[0], box[1],
+                                       box[2], box[3]) >= 0) {
+    options.crop = true;
+    options.box_min << box[0], box[1];
+    options.box_max << box[2], box[3];
+  }
+  if (pkg_filename.empty() && tiled_filename.empty()) {
+    std::cout << "Should use it this way: \n\n"
+              << "    join_pieces -pkg [filename]\n"
+              << "    join_pieces -tmap [tiled filename] -lod [level]\n\n"
+              << "  -o [output pcd, default whole_static_map.pcd]\n"
+              << "  -leaf [voxel size to downsample]\n"
+              << "  -box [min_x,min_y,max_x,max_y to crop]\n"
+              << "  -threads [0 for (cpu cores - 1)]\n"
               << std::endl;
     return -1;
   }
-
-  size_t found = pkg_filename.find_last_of("/");
-  std::string pkg_file_path = "";
-  if (found != std::string::npos) {
-    pkg_file_path = pkg_filename.substr(0, found);
-    pkg_file_path += "/";
+  if (thread_num > 0) {
+    static_map::common::SharedExecutor::SetThreadNum(thread_num);
   }
 
-  pugi::xml_document doc;
-  if (!doc.load_file(pkg_filename.c_str())) {
-    std::cout << "Can not load " << pkg_filename << " as a xml." << std::endl;
-    return -1;
+  std::vector<Piece> pieces;
+  TiledMapReader reader;
+  if (!tiled_filename.empty()) {
+    if (!reader.Open(tiled_filename)) {
+      std::cout << "Can not load " << tiled_filename << " as a tiled map."
+                << std::endl;
+      return -1;
+    }
+    std::vector<int> tiles;
+    if (options.crop) {
+      tiles = reader.TilesInBox(options.box_min, options.box_max);
+    } else {
+      for (int i = 0; i < reader.TileNum(); ++i) {
+        tiles.push_back(i);
+      }
+    }
+    for (const int tile : tiles) {
+      Piece piece;
+      piece.tile = tile;
+      piece.center << reader.Tile(tile).center[0], reader.Tile(tile).center[1];
+      pieces.push_back(piece);
+    }
+  } else {
+    size_t found = pkg_filename.find_last_of("/");
+    std::string pkg_file_path = "";
+    if (found != std::string::npos) {
+      pkg_file_path = pkg_filename.substr(0, found);
+      pkg_file_path += "/";
+    }
+
+    pugi::xml_document doc;
+    if (!doc.load_file(pkg_filename.c_str())) {
+      std::cout << "Can not load " << pkg_filename << " as a xml."
+                << std::endl;
+      return -1;
+    }
+    auto package_node = doc.child("MapPackage");
+    if (package_node.empty()) {
+      std::cout << "Format error." << std::endl;
+      return -1;
+    }
+    for (auto piece_node = package_node.child("Piece"); piece_node;
+         piece_node = piece_node.next_sibling("Piece")) {
+      Piece piece;
+      piece.pcd_file = pkg_file_path + piece_node.attribute("file").as_string();
+      piece.center << piece_node.attribute("x").as_double(),
+          piece_node.attribute("y").as_double();
+      pieces.push_back(piece);
+    }
+    if (options.crop) {
+      // skip the pieces not overlapping the box without loading them
+      const double half_width = PieceHalfWidth(pieces);
+      pieces.erase(
+          std::remove_if(pieces.begin(), pieces.end(),
+                         [&](const Piece& piece) -> bool {
+                           return (piece.center.array() + half_width <
+                                   options.box_min.array())
+                                      .any() ||
+                                  (piece.center.array() - half_width >
+                                   options.box_max.array())
+                                      .any();
+                         }),
+          pieces.end());
+    }
   }
-  auto package_node = doc.child("MapPackage");
-  if (package_node.empty()) {
-    std::cout << "Format error." << std::endl;
+
+  PcdStreamWriter<pcl::PointXYZI> writer;
+  if (!writer.Open(output_filename)) {
+    std::cout << "Can not write " << output_filename << std::endl;
     return -1;
   }
-
-  pcl::PointCloud<pcl::PointXYZI> whole_cloud;
-  for (auto piece_node = package_node.child("Piece"); piece_node;
-       piece_node = piece_node.next_sibling("Piece")) {
-    std::string pcd_file =
-        pkg_file_path + piece_node.attribute("file").as_string();
-    std::cout << "Read in piece from pcd file: " << pcd_file << std::endl;
-
-    pcl::PointCloud<pcl::PointXYZI> piece_cloud;
-    if (pcl::io::loadPCDFile<pcl::PointXYZI>(pcd_file, piece_cloud) == -1) {
-      std::cout << "Error loading pointcloud from this file." << std::endl;
-    } else {
-      Eigen::Matrix4d transform = Eigen::Matrix4d::Identity();
-      transform(0, 3) = piece_node.attribute("x").as_double();
-      transform(1, 3) = piece_node.attribute("y").as_double();
-      pcl::PointCloud<pcl::PointXYZI> transformed_cloud;
-      pcl::transformPointCloud(piece_cloud, transformed_cloud, transform);
-      whole_cloud += transformed_cloud;
+  // the pieces are loaded in parallel in waves and written in order, only
+  // the clouds of a wave are in memory
+  const int wave_size =
+      std::max<int>(1, static_map::common::SharedExecutor::ThreadNum());
+  const int piece_num = pieces.size();
+  std::vector<PointCloud> clouds(wave_size);
+  std::vector<char> loaded(wave_size);
+  for (int begin = 0; begin < piece_num; begin += wave_size) {
+    const int end = std::min(begin + wave_size, piece_num);
+    auto load_piece = [&](const int i) {
+      PointCloud* cloud = &clouds[i - begin];
+      cloud->clear();
+      loaded[i - begin] = LoadPiece(pieces[i], reader, options, cloud);
+    };
+    static_map::common::ParallelFor(begin, end, end - begin, load_piece);
+    for (int i = begin; i < end; ++i) {
+      const PointCloud& cloud = clouds[i - begin];
+      if (!loaded[i - begin]) {
+        std::cout << "Error loading pointcloud from " << pieces[i].pcd_file
+                  << std::endl;
+        continue;
+      }
+      std::cout << "Joined piece " << i << " / " << piece_num - 1 << " ("
+                << cloud.size() << " points)" << std::endl;
+      if (!writer.Write(cloud)) {
+        std::cout << "Failed to write " << output_filename << std::endl;
+        return -1;
+      }
     }
   }
-
-  if (!whole_cloud.empty()) {
-    pcl::io::savePCDFileBinaryCompressed("whole_static_map.pcd", whole_cloud);
+  const size_t point_num = writer.PointNum();
+  if (!writer.Close()) {
+    std::cout << "Failed to write " << output_filename << std::endl;
+    return -1;
   }
-
+  if (point_num == 0u) {
+    std::remove(output_filename.c_str());
+  }
+  std::cout << "Saved " << point_num << " points into " << output_filename
+            << std::endl;
   return 0;
 }
@@ -0,0 +1,210 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <dirent.h>
+#include <pcl/common/pca.h>
+#include <pcl/console/parse.h>
+#include <pcl/io/pcd_io.h>
+#include <pcl/point_types.h>
+#include <Eigen/SVD>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "descriptor/m2dp.h"
+
+using PointType = pcl::PointXYZI;
+using PointCloudType = pcl::PointCloud<PointType>;
+using PointCloudPtr = PointCloudType::Ptr;
+using M2dp = static_map::descriptor::M2dp<PointType>;
+
+// the default params of M2dp
+constexpr double kR = 0.1;
+constexpr double kMaxDistance = 100.;
+constexpr int kT = 16;
+constexpr int kP = 4;
+constexpr int kQ = 16;
+
+// the former M2dp, one fresh histogram per view and the full thin SVD,
+// as the reference of the time and the descriptor
+M2dp::Descriptor ReferenceDescriptor(const PointCloudPtr& source) {
+  pcl::PCA<PointType> pca;
+  pca.setInputCloud(source);
+  PointCloudType projected_cloud, inner_cloud;
+  pca.project(*source, projected_cloud);
+  for (const auto& point : projected_cloud.points) {
+    const double d = std::sqrt(point.x * point.x + point.y * point.y +
+                               point.z * point.z);
+    if (d <= kMaxDistance) inner_cloud.push_back(point);
+  }
+
+  const int l = std::ceil(std::sqrt(kMaxDistance / kR));
+  const double angle_step = M_PI * 2. / kT;
+  Eigen::MatrixXf A(kP * kQ, l * kT);
+  for (int p = 0; p < kP; ++p) {
+    for (int q = 0; q < kQ; ++q) {
+      const double theta = p * M_PI / kP;
+      const double phi = q * M_PI_2 / kQ;
+      Eigen::Vector3f m;
+      m << std::cos(theta) * std::cos(phi), std::cos(theta) * std::sin(phi),
+          std::sin(theta);
+      Eigen::Vector3f projected_x_axis =
+          Eigen::Vector3f(1., 0., 0.) -
+          (Eigen::Vector3f(1., 0., 0.).transpose() * m).norm() * m;
+      Eigen::Vector3f projected_y_axis = m.cross(projected_x_axis);
+
+      Eigen::VectorXi row = Eigen::VectorXi::Zero(l * kT);
+      for (const auto& point : inner_cloud.points) {
+        Eigen::Vector3f x(point.x, point.y, point.z);
+        Eigen::Vector2f projected((x.transpose() * projected_x_axis).norm(),
+                                  (x.transpose() * projected_y_axis).norm());
+        double angle = std::atan2(projected[1], projected[0]);
+        if (angle < 0.) angle += M_PI * 2.;
+        const int l_index =
+            std::min<int>(std::floor(std::sqrt(projected.norm() / kR)), l - 1);
+        const int t_index =
+            std::min<int>(std::floor(angle / angle_step), kT - 1);
+        row[l_index * kT + t_index]++;
+      }
+      A.block(p * kQ + q, 0, 1, l * kT) = row.transpose().cast<float>();
+    }
+  }
+
+  Eigen::JacobiSVD<Eigen::MatrixXf> svd(
+      A, Eigen::ComputeThinU | Eigen::ComputeThinV);
+  const Eigen::VectorXf v1 = svd.matrixV().col(0), u1 = svd.matrixU().col(0);
+  M2dp::Descriptor descriptor(u1.rows() + v1.rows());
+  descriptor << u1, v1;
+  return descriptor;
+}
+
+std::vector<std::string> ListPcdFiles(const std::string& dir) {
+  std::vector<std::string> files;
+  DIR* dp = opendir(dir.c_str());
+  if (!dp) {
+    return files;
+  }
+  struct dirent* entry;
+  while ((entry = readdir(dp)) != nullptr) {
+    const std::string name = entry->d_name;
+    if (name.size() > 4 && name.substr(name.size() - 4) == ".pcd") {
+      files.push_back(dir + "/" + name);
+    }
+  }
+  closedir(dp);
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+double Milliseconds(const std::chrono::steady_clock::time_point& start,
+                    const std::chrono::steady_clock::time_point& end) {
+  return std::chrono::duration<double>(end - start).count() * 1.e3;
+}
+
+int main(int argc, char** argv) {
+  std::string pcd_dir = "";
+  int repeat = 10;
+  pcl::console::parse_argument(argc, argv, "-dir", pcd_dir);
+  pcl::console::parse_argument(argc, argv, "-n", repeat);
+  if (pcd_dir.empty() || repeat <= 0) {
+    std::cout << "Should use it this way: \n\n"
+              << "    m2dp_bench -dir [pcd dir] -n [repeat]\n"
+              << "\n  the descriptors of every scan are computed by the "
+                 "former M2dp (full SVD)\n  and the current one, the score "
+                 "between them should be close to 1.\n"
+              << std::endl;
+    return -1;
+  }
+
+  std::vector<PointCloudPtr> scans;
+  for (const auto& file : ListPcdFiles(pcd_dir)) {
+    PointCloudPtr scan(new PointCloudType);
+    if (pcl::io::loadPCDFile<PointType>(file, *scan) == -1 || scan->empty()) {
+      std::cout << "Can not load " << file << std::endl;
+      continue;
+    }
+    scans.push_back(scan);
+  }
+  if (scans.empty()) {
+    std::cout << "No pcd file in " << pcd_dir << std::endl;
+    return -1;
+  }
+  std::cout << "Loaded " << scans.size() << " scans, repeat " << repeat
+            << " times.\n"
+            << std::endl;
+
+  double reference_ms = 0.;
+  double current_ms = 0.;
+  double min_score = 1.;
+  double score_sum = 0.;
+  int failed_num = 0;
+  for (const auto& scan : scans) {
+    M2dp::Descriptor reference, current;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repeat; ++i) {
+      reference = ReferenceDescriptor(scan);
+    }
+    auto end = std::chrono::steady_clock::now();
+    reference_ms += Milliseconds(start, end);
+
+    start = std::chrono::steady_clock::now();
+    bool succeed = true;
+    for (int i = 0; i < repeat; ++i) {
+      M2dp m2dp(kR, kMaxDistance, kT, kP, kQ);
+      succeed = m2dp.setInputCloud(scan);
+      current = m2dp.getFinalDescriptor();
+    }
+    end = std::chrono::steady_clock::now();
+    current_ms += Milliseconds(start, end);
+    if (!succeed) {
+      failed_num++;
+      continue;
+    }
+
+    const double score =
+        static_map::descriptor::matchTwoM2dpDescriptors<PointType>(reference,
+                                                                   current);
+    min_score = std::min(min_score, score);
+    score_sum += score;
+  }
+
+  const double runs = static_cast<double>(scans.size()) * repeat;
+  const int scored_num = scans.size() - failed_num;
+  std::cout << std::left << std::setw(12) << "m2dp" << std::right
+            << std::setw(12) << "ms/scan" << std::endl;
+  std::cout << std::left << std::setw(12) << "reference" << std::right
+            << std::fixed << std::setprecision(3) << std::setw(12)
+            << reference_ms / runs << std::endl;
+  std::cout << std::left << std::setw(12) << "current" << std::right
+            << std::setw(12) << current_ms / runs << std::endl;
+  std::cout << "\nspeed up: " << std::setprecision(2)
+            << reference_ms / std::max(current_ms, 1.e-9) << "x, score to "
+            << "the reference: min " << std::setprecision(6) << min_score
+            << ", mean " << (scored_num ? score_sum / scored_num : 0.)
+            << ", failed " << failed_num << std::endl;
+  return 0;
+}
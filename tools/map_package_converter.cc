@@ -0,0 +1,112 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <pcl/console/parse.h>
+#include <pcl/io/pcd_io.h>
+#include <pcl/point_types.h>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "common/pugixml.hpp"
+#include "common/tiled_map_file.h"
+
+// convert a map package (map_package.xml and its pcd pieces) into a
+// tiled map file
+int main(int argc, char** argv) {
+  std::string pkg_filename = "";
+  std::string output_filename = "map_package.tmap";
+  int lod_num = 3;
+  double lod_resolution = 0.5;
+  pcl::console::parse_argument(argc, argv, "-pkg", pkg_filename);
+  pcl::console::parse_argument(argc, argv, "-o", output_filename);
+  pcl::console::parse_argument(argc, argv, "-lod_num", lod_num);
+  pcl::console::parse_argument(argc, argv, "-lod_resolution", lod_resolution);
+  if (pkg_filename.empty() || lod_num < 1 ||
+      lod_num > static_map::common::kTiledMapMaxLodNum ||
+      lod_resolution <= 0.) {
+    std::cout << "Should use it this way: \n\n    map_package_converter -pkg "
+                 "[filename] -o [tiled filename] -lod_num [1~4] "
+                 "-lod_resolution [voxel size]\n"
+              << std::endl;
+    return -1;
+  }
+
+  size_t found = pkg_filename.find_last_of("/");
+  std::string pkg_file_path = "";
+  if (found != std::string::npos) {
+    pkg_file_path = pkg_filename.substr(0, found);
+    pkg_file_path += "/";
+  }
+
+  pugi::xml_document doc;
+  if (!doc.load_file(pkg_filename.c_str())) {
+    std::cout << "Can not load " << pkg_filename << " as a xml." << std::endl;
+    return -1;
+  }
+  auto package_node = doc.child("MapPackage");
+  if (package_node.empty()) {
+    std::cout << "Format error." << std::endl;
+    return -1;
+  }
+
+  std::vector<float> resolutions;
+  for (int i = 1; i < lod_num; ++i) {
+    resolutions.push_back(lod_resolution * (1 << (i - 1)));
+  }
+  static_map::common::TiledMapWriter<pcl::PointXYZI> writer;
+  if (!writer.Open(output_filename, resolutions)) {
+    std::cout << "Can not write " << output_filename << std::endl;
+    return -1;
+  }
+  for (auto piece_node = package_node.child("Piece"); piece_node;
+       piece_node = piece_node.next_sibling("Piece")) {
+    const std::string file = piece_node.attribute("file").as_string();
+    std::cout << "Read in piece from pcd file: " << pkg_file_path + file
+              << std::endl;
+    pcl::PointCloud<pcl::PointXYZI> piece_cloud;
+    if (pcl::io::loadPCDFile<pcl::PointXYZI>(pkg_file_path + file,
+                                             piece_cloud) == -1) {
+      std::cout << "Error loading pointcloud from this file." << std::endl;
+      continue;
+    }
+    // the pieces are saved as [prefix]x_y.pcd
+    int x = -1;
+    int y = -1;
+    const size_t index_begin = file.find_last_of("_", file.rfind("_") - 1);
+    if (index_begin != std::string::npos) {
+      std::sscanf(file.c_str() + index_begin + 1, "%d_%d", &x, &y);
+    }
+    const Eigen::Vector2d center(piece_node.attribute("x").as_double(),
+                                 piece_node.attribute("y").as_double());
+    writer.AddTile(x, y, center, piece_cloud);
+  }
+  const size_t tile_num = writer.TileNum();
+  if (!writer.Close()) {
+    std::cout << "Failed to write " << output_filename << std::endl;
+    return -1;
+  }
+  std::cout << "Saved " << tile_num << " tiles into " << output_filename
+            << std::endl;
+  return 0;
+}
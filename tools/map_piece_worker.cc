@@ -0,0 +1,118 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <pcl/console/parse.h>
+#include <pcl/io/pcd_io.h>
+#include <pcl/point_types.h>
+
+#include <iostream>
+#include <string>
+
+#include "builder/map_piece.h"
+#include "common/file_utils.h"
+#include "common/pcd_writer.h"
+#include "common/point_types.h"
+
+// the same points as the map builder wrote the submaps with
+using PointType = static_map::MapPointType;
+using PointCloudType = pcl::PointCloud<PointType>;
+using PointCloudPtr = PointCloudType::Ptr;
+
+// build one piece of the manifest into output_path, return false if any
+// of its submaps can not be loaded
+bool BuildPiece(const static_map::MapWorkManifest& manifest,
+                const std::string& manifest_path,
+                const std::string& output_path, const int piece_index) {
+  const auto& piece = manifest.pieces[piece_index];
+  bool loaded = true;
+  auto acquire = [&](const int k, Eigen::Vector3f* origin) {
+    const int index = piece.submaps[k];
+    PointCloudPtr cloud(new PointCloudType);
+    PointCloudPtr transformed_cloud(new PointCloudType);
+    const std::string file = manifest_path + manifest.submap_files[index];
+    if (pcl::io::loadPCDFile<PointType>(file, *cloud) == -1) {
+      std::cout << "Can not load " << file << std::endl;
+      loaded = false;
+    }
+    const Eigen::Matrix4f& pose = manifest.submap_poses[index];
+    static_map::common::TransformPointCloud(*cloud, transformed_cloud.get(),
+                                            pose);
+    *origin = pose.block<3, 1>(0, 3);
+    return transformed_cloud;
+  };
+  auto release = [](const int) {};
+  PointCloudType piece_cloud;
+  static_map::BuildMapPiece<PointType>(
+      piece.center, piece.bb_min, piece.bb_max, piece.submaps.size(),
+      manifest.settings, acquire, release, &piece_cloud);
+  if (!loaded) {
+    return false;
+  }
+  static_map::common::SavePcdFile(output_path + piece.filename, piece_cloud);
+  std::cout << "piece [" << piece.x << "][" << piece.y << "] with "
+            << piece.submaps.size() << " submaps : " << piece_cloud.size()
+            << " points." << std::endl;
+  return true;
+}
+
+int main(int argc, char** argv) {
+  std::string manifest_file = "";
+  std::string output_path = "";
+  int piece_index = -1;
+  pcl::console::parse_argument(argc, argv, "-m", manifest_file);
+  pcl::console::parse_argument(argc, argv, "-o", output_path);
+  pcl::console::parse_argument(argc, argv, "-piece", piece_index);
+  if (manifest_file.empty()) {
+    std::cout << "Should use it this way: \n\n"
+              << "    map_piece_worker -m [manifest] -piece [index] "
+                 "-o [output path]\n"
+              << "\n  the piece of the index (in the manifest order) is "
+                 "built, or all of them if\n  the index is -1, into the "
+                 "output path (the path of the manifest by default).\n"
+              << std::endl;
+    return -1;
+  }
+  static_map::MapWorkManifest manifest;
+  if (!static_map::LoadMapWorkManifest(manifest_file, &manifest)) {
+    return -1;
+  }
+  const int piece_num = manifest.pieces.size();
+  if (piece_index < -1 || piece_index >= piece_num) {
+    std::cout << "The piece index should be in [-1, " << piece_num << ")."
+              << std::endl;
+    return -1;
+  }
+  const std::string manifest_path = static_map::common::FilePath(manifest_file);
+  if (output_path.empty()) {
+    output_path = manifest_path;
+  } else if (output_path.back() != '/') {
+    output_path += '/';
+  }
+
+  bool succeed = true;
+  for (int i = 0; i < piece_num; ++i) {
+    if (piece_index == -1 || piece_index == i) {
+      succeed = BuildPiece(manifest, manifest_path, output_path, i) && succeed;
+    }
+  }
+  return succeed ? 0 : -1;
+}
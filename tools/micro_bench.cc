@@ -0,0 +1,605 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// google benchmarks of the kernels, for tracking the per-kernel regressions
+// between releases, e.g.
+//   micro_bench --benchmark_filter=Casting --benchmark_format=json
+// the inputs are synthetic and seeded, so the runs are comparable
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <random>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _USE_TBB_
+#include <tbb/concurrent_unordered_map.h>
+#endif
+
+#include "Eigen/Geometry"
+#include "builder/motion_compensation.h"
+#include "builder/multi_resolution_voxel_map.h"
+#include "common/eigen_hash.h"
+#include "common/macro_defines.h"
+#include "common/math.h"
+#include "common/voxel_hash_map.h"
+
+namespace {
+
+using static_map::MrvmSettings;
+using static_map::MultiResolutionVoxelMap;
+using KeyInt3 = Eigen::Vector3i;
+using PointType = pcl::PointXYZI;
+
+constexpr float kResolution = 0.1f;
+constexpr int kPointNum = 20000;
+constexpr float kRange = 50.f;
+
+// the end points of a scan-like frame: the rings of a spinning lidar hit a
+// ground plane or a wall at a random range, from a lidar at 'origin'
+std::vector<Eigen::Vector3f> MakeScan(const Eigen::Vector3f& origin,
+                                      const int point_num, const float range,
+                                      const uint32_t seed) {
+  std::mt19937 random(seed);
+  std::uniform_real_distribution<float> uniform(0.f, 1.f);
+  std::vector<Eigen::Vector3f> ends;
+  ends.reserve(point_num);
+  for (int i = 0; i < point_num; ++i) {
+    const float yaw = uniform(random) * 2.f * M_PI;
+    const float pitch = (uniform(random) - 0.75f) * 0.5f;
+    float distance = 1.f + uniform(random) * (range - 1.f);
+    if (pitch < 0.f) {
+      distance = std::min(distance, origin[2] / std::sin(-pitch));
+    }
+    const Eigen::Vector3f direction(std::cos(pitch) * std::cos(yaw),
+                                    std::cos(pitch) * std::sin(yaw),
+                                    std::sin(pitch));
+    ends.push_back(origin + direction * distance);
+  }
+  return ends;
+}
+
+const Eigen::Vector3f& ScanOrigin() {
+  static const Eigen::Vector3f origin(0.f, 0.f, 1.8f);
+  return origin;
+}
+
+const std::vector<Eigen::Vector3f>& Scan() {
+  static const std::vector<Eigen::Vector3f> scan =
+      MakeScan(ScanOrigin(), kPointNum, kRange, 42u);
+  return scan;
+}
+
+// ************************ voxel containers ************************
+// the part of a voxel of MultiResolutionVoxelMap touched by the ray casting
+struct Voxel {
+  uint8_t probability = 128;
+  int need_update = 1;
+};
+
+struct VectorCompare {
+  bool operator()(const KeyInt3 a, const KeyInt3 b) const {
+    return std::forward_as_tuple(a[0], a[1], a[2]) <
+           std::forward_as_tuple(b[0], b[1], b[2]);
+  }
+};
+
+using StdMap = std::map<KeyInt3, Voxel, VectorCompare>;
+using StdUnorderedMap = std::unordered_map<KeyInt3, Voxel, std::hash<KeyInt3>>;
+using FlatMap = static_map::common::VoxelHashMap<Voxel>;
+#ifdef _USE_TBB_
+using TbbMap =
+    tbb::concurrent_unordered_map<KeyInt3, Voxel, std::hash<KeyInt3>>;
+#endif
+
+// the voxels of all rays of the scan, ray i is [offsets[i], offsets[i + 1])
+struct ScanRays {
+  std::vector<KeyInt3> voxels;
+  std::vector<size_t> offsets;
+};
+
+const ScanRays& Rays() {
+  static const ScanRays rays = []() {
+    ScanRays rays;
+    rays.offsets.push_back(0);
+    for (const auto& end : Scan()) {
+      const auto voxels = static_map::common::VoxelCastingBresenham(
+          ScanOrigin(), end, kResolution);
+      rays.voxels.insert(rays.voxels.end(), voxels.begin(), voxels.end());
+      rays.offsets.push_back(rays.voxels.size());
+    }
+    return rays;
+  }();
+  return rays;
+}
+
+// the access pattern of MultiResolutionVoxelMap::InsertPointCloud: the end
+// voxel is inserted, the voxels on the ray are updated if they exist
+template <typename Map>
+void BM_VoxelContainerInsertRays(benchmark::State& state) {
+  const ScanRays& rays = Rays();
+  const size_t ray_num = rays.offsets.size() - 1;
+  for (auto _ : state) {
+    Map map;
+    for (size_t r = 0; r < ray_num; ++r) {
+      const size_t begin = rays.offsets[r];
+      const size_t end = rays.offsets[r + 1];
+      Voxel& end_voxel = map[rays.voxels[end - 1]];
+      end_voxel.probability = std::min(255, end_voxel.probability + 1);
+      end_voxel.need_update = 0;
+      for (size_t i = begin; i + 1 < end; ++i) {
+        auto it = map.find(rays.voxels[i]);
+        if (it != map.end() && it->second.need_update == 1) {
+          it->second.probability = std::max(1, it->second.probability - 1);
+        }
+      }
+      end_voxel.need_update = 1;
+    }
+    benchmark::DoNotOptimize(map.size());
+  }
+  state.SetItemsProcessed(state.iterations() * rays.voxels.size());
+}
+BENCHMARK_TEMPLATE(BM_VoxelContainerInsertRays, StdMap)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_VoxelContainerInsertRays, StdUnorderedMap)
+    ->Unit(benchmark::kMillisecond);
+#ifdef _USE_TBB_
+BENCHMARK_TEMPLATE(BM_VoxelContainerInsertRays, TbbMap)
+    ->Unit(benchmark::kMillisecond);
+#endif
+BENCHMARK_TEMPLATE(BM_VoxelContainerInsertRays, FlatMap)
+    ->Unit(benchmark::kMillisecond);
+
+// ******************* MultiResolutionVoxelMap *******************
+enum MrvmStorage { kFlat, kCompactPoints, kBlockStorage, kDiscretized };
+
+// the storage of the voxels by the argument
+MrvmSettings MakeMrvmSettings(const int storage) {
+  MrvmSettings settings;
+  settings.high_resolution = kResolution;
+  switch (storage) {
+    case kCompactPoints:
+      settings.compact_points = true;
+      break;
+    case kBlockStorage:
+      settings.block_storage = true;
+      break;
+    case kDiscretized:
+      settings.discretized_insertion = true;
+      break;
+    case kFlat:
+    default:
+      break;
+  }
+  return settings;
+}
+
+// one scan into an empty map
+void BM_MrvmInsertPointCloud(benchmark::State& state) {
+  pcl::PointCloud<PointType>::Ptr cloud(new pcl::PointCloud<PointType>);
+  for (const auto& end : Scan()) {
+    PointType point;
+    point.x = end[0];
+    point.y = end[1];
+    point.z = end[2];
+    point.intensity = 1.f;
+    cloud->push_back(point);
+  }
+  const MrvmSettings settings = MakeMrvmSettings(state.range(0));
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::unique_ptr<MultiResolutionVoxelMap<PointType>> map(
+        new MultiResolutionVoxelMap<PointType>);
+    map->Initialise(settings);
+    state.ResumeTiming();
+    map->InsertPointCloud(cloud, ScanOrigin());
+    benchmark::ClobberMemory();
+    state.PauseTiming();
+    map.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * cloud->size());
+}
+BENCHMARK(BM_MrvmInsertPointCloud)
+    ->ArgName("storage")
+    ->Arg(kFlat)
+    ->Arg(kCompactPoints)
+    ->Arg(kBlockStorage)
+    ->Arg(kDiscretized)
+    ->Unit(benchmark::kMillisecond);
+
+// ************************ ray casting ************************
+// the rays of the scan, shortened to at most state.range(0) meters
+template <typename Casting>
+void RunCasting(benchmark::State& state, const Casting& casting) {
+  const float max_length = state.range(0);
+  std::vector<Eigen::Vector3f> ends;
+  for (const auto& end : Scan()) {
+    const Eigen::Vector3f ray = end - ScanOrigin();
+    ends.push_back(ScanOrigin() +
+                   ray * std::min(1.f, max_length / ray.norm()));
+  }
+  int64_t voxel_num = 0;
+  for (auto _ : state) {
+    for (const auto& end : ends) {
+      voxel_num += casting(ScanOrigin(), end);
+    }
+  }
+  state.SetItemsProcessed(voxel_num);
+}
+
+void BM_VoxelCastingBresenham(benchmark::State& state) {
+  RunCasting(state, [](const Eigen::Vector3f& start,
+                       const Eigen::Vector3f& end) {
+    const auto voxels =
+        static_map::common::VoxelCastingBresenham(start, end, kResolution);
+    benchmark::DoNotOptimize(voxels.data());
+    return voxels.size();
+  });
+}
+BENCHMARK(BM_VoxelCastingBresenham)
+    ->Arg(10)
+    ->Arg(50)
+    ->Unit(benchmark::kMillisecond);
+
+void BM_VoxelCastingDDA(benchmark::State& state) {
+  RunCasting(state, [](const Eigen::Vector3f& start,
+                       const Eigen::Vector3f& end) {
+    const auto voxels =
+        static_map::common::VoxelCastingDDA(start, end, kResolution);
+    benchmark::DoNotOptimize(voxels.data());
+    return voxels.size();
+  });
+}
+BENCHMARK(BM_VoxelCastingDDA)
+    ->Arg(10)
+    ->Arg(50)
+    ->Unit(benchmark::kMillisecond);
+
+void BM_VisitVoxelsBresenham(benchmark::State& state) {
+  RunCasting(state, [](const Eigen::Vector3f& start,
+                       const Eigen::Vector3f& end) {
+    int64_t voxel_num = 0;
+    static_map::common::VisitVoxelsBresenham(
+        start, end, kResolution, [&](const KeyInt3& voxel) {
+          benchmark::DoNotOptimize(voxel.data());
+          ++voxel_num;
+          return true;
+        });
+    return voxel_num;
+  });
+}
+BENCHMARK(BM_VisitVoxelsBresenham)
+    ->Arg(10)
+    ->Arg(50)
+    ->Unit(benchmark::kMillisecond);
+
+void BM_VisitVoxelsDDA(benchmark::State& state) {
+  RunCasting(state, [](const Eigen::Vector3f& start,
+                       const Eigen::Vector3f& end) {
+    int64_t voxel_num = 0;
+    static_map::common::VisitVoxelsDDA(start, end, kResolution,
+                                       [&](const KeyInt3& voxel) {
+                                         benchmark::DoNotOptimize(voxel.data());
+                                         ++voxel_num;
+                                         return true;
+                                       });
+    return voxel_num;
+  });
+}
+BENCHMARK(BM_VisitVoxelsDDA)
+    ->Arg(10)
+    ->Arg(50)
+    ->Unit(benchmark::kMillisecond);
+
+// ************************ math ************************
+// the points of a noisy plane
+template <typename Scalar>
+void BM_PlaneFitting(benchmark::State& state) {
+  std::mt19937 random(7u);
+  std::uniform_real_distribution<Scalar> uniform(-1., 1.);
+  std::vector<Eigen::Matrix<Scalar, 3, 1>> points(state.range(0));
+  for (auto& point : points) {
+    point << uniform(random), uniform(random),
+        0.01 * uniform(random) + 0.2 * point[0];
+  }
+  for (auto _ : state) {
+    auto plane = static_map::common::PlaneFitting(points);
+    benchmark::DoNotOptimize(plane);
+  }
+  state.SetItemsProcessed(state.iterations() * points.size());
+}
+BENCHMARK_TEMPLATE(BM_PlaneFitting, float)->Arg(8)->Arg(64)->Arg(512);
+BENCHMARK_TEMPLATE(BM_PlaneFitting, double)->Arg(8)->Arg(64)->Arg(512);
+
+constexpr int kTransformNum = 1024;
+
+// random rigid transforms, not exactly orthogonal as in the pipeline
+template <typename Scalar>
+std::vector<Eigen::Matrix<Scalar, 4, 4>,
+            Eigen::aligned_allocator<Eigen::Matrix<Scalar, 4, 4>>>
+MakeTransforms() {
+  std::mt19937 random(11u);
+  std::uniform_real_distribution<Scalar> uniform(-M_PI, M_PI);
+  std::vector<Eigen::Matrix<Scalar, 4, 4>,
+              Eigen::aligned_allocator<Eigen::Matrix<Scalar, 4, 4>>>
+      transforms(kTransformNum);
+  for (auto& transform : transforms) {
+    Eigen::Matrix<Scalar, 6, 1> vector;
+    for (int i = 0; i < 6; ++i) {
+      vector[i] = uniform(random);
+    }
+    transform = static_map::common::Vector6ToTransform(vector);
+    transform.template block<3, 3>(0, 0) *= Scalar(1.0001);
+  }
+  return transforms;
+}
+
+template <typename Scalar>
+void BM_RotationMatrixToEulerAngles(benchmark::State& state) {
+  const auto transforms = MakeTransforms<Scalar>();
+  for (auto _ : state) {
+    for (const auto& transform : transforms) {
+      const Eigen::Matrix<Scalar, 3, 3> rotation =
+          transform.template block<3, 3>(0, 0);
+      auto angles = static_map::common::RotationMatrixToEulerAngles(rotation);
+      benchmark::DoNotOptimize(angles);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * transforms.size());
+}
+BENCHMARK_TEMPLATE(BM_RotationMatrixToEulerAngles, float);
+BENCHMARK_TEMPLATE(BM_RotationMatrixToEulerAngles, double);
+
+template <typename Scalar>
+void BM_NormalizeRotation(benchmark::State& state) {
+  const auto transforms = MakeTransforms<Scalar>();
+  for (auto _ : state) {
+    for (const auto& transform : transforms) {
+      Eigen::Matrix<Scalar, 4, 4> normalized = transform;
+      static_map::common::NormalizeRotation(normalized);
+      benchmark::DoNotOptimize(normalized);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * transforms.size());
+}
+BENCHMARK_TEMPLATE(BM_NormalizeRotation, float);
+BENCHMARK_TEMPLATE(BM_NormalizeRotation, double);
+
+constexpr int kValueNum = 4096;
+
+// the approximations against the std ones over the same inputs
+template <typename Function>
+void RunElementwise(benchmark::State& state, const float min, const float max,
+                    const Function& function) {
+  std::mt19937 random(13u);
+  std::uniform_real_distribution<float> uniform(min, max);
+  std::vector<float> values(kValueNum);
+  for (float& value : values) {
+    value = uniform(random);
+  }
+  std::vector<float> results(kValueNum);
+  for (auto _ : state) {
+    for (int i = 0; i < kValueNum; ++i) {
+      results[i] = function(values[i]);
+    }
+    benchmark::DoNotOptimize(results.data());
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * kValueNum);
+}
+
+void BM_FastExp(benchmark::State& state) {
+  RunElementwise(state, -10.f, 10.f,
+                 [](const float x) { return static_map::common::fastexp(x); });
+}
+BENCHMARK(BM_FastExp);
+
+void BM_StdExp(benchmark::State& state) {
+  RunElementwise(state, -10.f, 10.f,
+                 [](const float x) { return std::exp(x); });
+}
+BENCHMARK(BM_StdExp);
+
+void BM_FasterLog(benchmark::State& state) {
+  RunElementwise(state, 1.e-3f, 1.e3f, [](const float x) {
+    return static_map::common::fasterlog(x);
+  });
+}
+BENCHMARK(BM_FasterLog);
+
+void BM_StdLog(benchmark::State& state) {
+  RunElementwise(state, 1.e-3f, 1.e3f,
+                 [](const float x) { return std::log(x); });
+}
+BENCHMARK(BM_StdLog);
+
+// ********************** motion compensation **********************
+using PointCloudType = pcl::PointCloud<PointType>;
+
+// a scan of 200k points, the sensor moves 1 m and turns 0.1 rad in it
+const PointCloudType& MotionScan() {
+  static const PointCloudType cloud = []() {
+    PointCloudType cloud;
+    for (const auto& end : MakeScan(ScanOrigin(), 10 * kPointNum, kRange, 7u)) {
+      PointType point;
+      point.x = end[0];
+      point.y = end[1];
+      point.z = end[2];
+      point.intensity = 1.f;
+      cloud.push_back(point);
+    }
+    return cloud;
+  }();
+  return cloud;
+}
+
+// the time factors of a spinning lidar, by the azimuths of the points
+const std::vector<float>& MotionFactors() {
+  static const std::vector<float> factors = []() {
+    std::vector<float> factors;
+    for (const auto& point : MotionScan().points) {
+      factors.push_back(std::atan2(point.y, point.x) / (2.f * M_PI) + 0.5f);
+    }
+    return factors;
+  }();
+  return factors;
+}
+
+const Eigen::Matrix4f& MotionDelta() {
+  static const Eigen::Matrix4f delta = []() {
+    Eigen::Matrix4f delta = Eigen::Matrix4f::Identity();
+    delta.block<3, 3>(0, 0) =
+        Eigen::AngleAxisf(0.1f, Eigen::Vector3f::UnitZ()).toRotationMatrix();
+    delta.block<3, 1>(0, 3) = Eigen::Vector3f(1.f, 0.1f, 0.f);
+    return delta;
+  }();
+  return delta;
+}
+
+// the same buckets as MotionCompensation, but the xyz are transposed to
+// SoA arrays per bucket, transformed and written back, it shows why the
+// AoS kernel is kept
+void MotionCompensationSoa(const PointCloudType& raw_cloud,
+                           const Eigen::Matrix4f& delta_transform,
+                           PointCloudType* const output_cloud) {
+  using static_map::kMotionCompensationBucketNum;
+  const size_t cloud_size = raw_cloud.size();
+  output_cloud->points.resize(cloud_size);
+  const size_t bucket_num = std::min(cloud_size, kMotionCompensationBucketNum);
+  const Eigen::Matrix4f delta_transform_inverse = delta_transform.inverse();
+  const int max_size = cloud_size / bucket_num + 1;
+  Eigen::ArrayXf x(max_size), y(max_size), z(max_size), row(max_size);
+  for (size_t b = 0; b < bucket_num; ++b) {
+    const size_t begin = b * cloud_size / bucket_num;
+    const size_t end = (b + 1) * cloud_size / bucket_num;
+    const size_t center = (b * cloud_size + cloud_size / 2) / bucket_num;
+    const Eigen::Matrix4f transform =
+        delta_transform_inverse *
+        static_map::InterpolateTransform(
+            Eigen::Matrix4f::Identity().eval(), delta_transform,
+            static_cast<float>(center) / static_cast<float>(cloud_size));
+    const int size = end - begin;
+    for (int i = 0; i < size; ++i) {
+      const auto& point = raw_cloud.points[begin + i];
+      x[i] = point.x;
+      y[i] = point.y;
+      z[i] = point.z;
+    }
+    for (int r = 0; r < 3; ++r) {
+      row.head(size) = transform(r, 0) * x.head(size) +
+                       transform(r, 1) * y.head(size) +
+                       transform(r, 2) * z.head(size) + transform(r, 3);
+      for (int i = 0; i < size; ++i) {
+        output_cloud->points[begin + i].data[r] = row[i];
+      }
+    }
+    for (int i = 0; i < size; ++i) {
+      output_cloud->points[begin + i].intensity =
+          raw_cloud.points[begin + i].intensity;
+    }
+  }
+}
+
+// all kernels on one thread, the costs per point are compared
+template <typename Function>
+void RunMotionCompensation(benchmark::State& state,
+                           const std::vector<float>* const factors,
+                           const Function& function) {
+  const int thread_num = static_map::common::OmpThreadNum();
+  static_map::common::SetOmpThreadNum(1);
+  const PointCloudType& cloud = MotionScan();
+  PointCloudType reference;
+  static_map::MotionCompensationPerPoint(cloud, factors, MotionDelta(),
+                                         &reference);
+  PointCloudType output;
+  function(cloud, &output);
+  // the buckets are checked against the per-point interpolation
+  float max_error = 0.f;
+  for (size_t i = 0; i < cloud.size(); ++i) {
+    max_error = std::max(max_error, (output.points[i].getVector3fMap() -
+                                     reference.points[i].getVector3fMap())
+                                        .norm());
+  }
+  if (output.size() != reference.size() || max_error > 0.01f) {
+    state.SkipWithError("differs from the per-point compensation");
+  } else {
+    for (auto _ : state) {
+      function(cloud, &output);
+      benchmark::DoNotOptimize(output.points.data());
+      benchmark::ClobberMemory();
+    }
+    state.counters["max_error_mm"] = max_error * 1.e3;
+    state.SetItemsProcessed(state.iterations() * cloud.size());
+  }
+  static_map::common::SetOmpThreadNum(thread_num);
+}
+
+// the points are ordered by time, or the time factors are given
+void BM_MotionCompensationPerPoint(benchmark::State& state) {
+  const std::vector<float>* factors =
+      state.range(0) ? &MotionFactors() : nullptr;
+  const auto function = [factors](const PointCloudType& cloud,
+                                  PointCloudType* const output) {
+    static_map::MotionCompensationPerPoint(cloud, factors, MotionDelta(),
+                                           output);
+  };
+  RunMotionCompensation(state, factors, function);
+}
+BENCHMARK(BM_MotionCompensationPerPoint)
+    ->ArgName("factors")
+    ->Arg(0)
+    ->Arg(1)
+    ->Unit(benchmark::kMillisecond);
+
+void BM_MotionCompensation(benchmark::State& state) {
+  const std::vector<float>* factors =
+      state.range(0) ? &MotionFactors() : nullptr;
+  const auto function = [factors](const PointCloudType& cloud,
+                                  PointCloudType* const output) {
+    static_map::MotionCompensation(cloud, factors, MotionDelta(), output);
+  };
+  RunMotionCompensation(state, factors, function);
+}
+BENCHMARK(BM_MotionCompensation)
+    ->ArgName("factors")
+    ->Arg(0)
+    ->Arg(1)
+    ->Unit(benchmark::kMillisecond);
+
+void BM_MotionCompensationSoa(benchmark::State& state) {
+  RunMotionCompensation(state, nullptr, [](const PointCloudType& cloud,
+                                           PointCloudType* const output) {
+    MotionCompensationSoa(cloud, MotionDelta(), output);
+  });
+}
+BENCHMARK(BM_MotionCompensationSoa)->Unit(benchmark::kMillisecond);
+
+}  // namespace
+
+BENCHMARK_MAIN();
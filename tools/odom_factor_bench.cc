@@ -0,0 +1,181 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// benchmark of the linearization of the odom calibration factor, the
+// expression factor and the former factor through traits<Pose3>::Between
+// against the current OdomCalibrationFactor with the analytic jacobians,
+// on a seeded synthetic path, e.g.
+//   odom_factor_bench -n 2000 -r 50
+
+#include <pcl/console/parse.h>
+#include <gtsam/geometry/Pose3.h>
+#include <gtsam/nonlinear/NonlinearFactorGraph.h>
+#include <gtsam/nonlinear/Values.h>
+#include <gtsam/slam/expressions.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "back_end/odom_to_pose_factor.h"
+#include "back_end/pose_graph_file.h"
+
+using gtsam::Pose3;
+using gtsam::Pose3_;
+using static_map::back_end::OdomCalibKey;
+using static_map::back_end::OdomCalibrationFactor;
+using static_map::back_end::PoseKey;
+
+// the former OdomCalibrationFactor, as the reference of the time
+class ReferenceOdomCalibrationFactor
+    : public gtsam::NoiseModelFactor2<Pose3, Pose3> {
+ public:
+  ReferenceOdomCalibrationFactor(const Pose3& measure_odom,
+                                 const gtsam::SharedNoiseModel& model,
+                                 gtsam::Key poseKey, gtsam::Key calibKey)
+      : gtsam::NoiseModelFactor2<Pose3, Pose3>(model, poseKey, calibKey),
+        measured_(measure_odom) {}
+
+  gtsam::Vector evaluateError(
+      const Pose3& pose, const Pose3& calib,
+      boost::optional<gtsam::Matrix&> H1 = boost::none,
+      boost::optional<gtsam::Matrix&> H2 = boost::none) const {
+    auto transformed =
+        gtsam::traits<Pose3>::Between(calib, pose, H2, H1) * calib;
+    return gtsam::traits<Pose3>::Local(measured_, transformed);
+  }
+
+ private:
+  Pose3 measured_;
+};
+
+Pose3 RandomPose(const double rotation, const double translation,
+                 std::mt19937* random) {
+  std::normal_distribution<double> normal(0., 1.);
+  gtsam::Vector6 xi;
+  for (int i = 0; i < 6; ++i) {
+    xi[i] = normal(*random) * (i < 3 ? rotation : translation);
+  }
+  return Pose3::Expmap(xi);
+}
+
+double Milliseconds(const std::chrono::steady_clock::time_point& start,
+                    const std::chrono::steady_clock::time_point& end) {
+  return std::chrono::duration<double>(end - start).count() * 1.e3;
+}
+
+double LinearizeMilliseconds(const gtsam::NonlinearFactorGraph& graph,
+                             const gtsam::Values& values, const int repeat) {
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < repeat; ++i) {
+    graph.linearize(values);
+  }
+  return Milliseconds(start, std::chrono::steady_clock::now());
+}
+
+// the max difference of the whitened jacobians and errors of each factor
+double MaxDifference(const gtsam::NonlinearFactorGraph& graph,
+                     const gtsam::NonlinearFactorGraph& reference,
+                     const gtsam::Values& values) {
+  double difference = 0.;
+  for (size_t i = 0; i < graph.size(); ++i) {
+    const auto a = graph.at(i)->linearize(values)->jacobian();
+    const auto b = reference.at(i)->linearize(values)->jacobian();
+    difference =
+        std::max(difference, (a.first - b.first).cwiseAbs().maxCoeff());
+    difference =
+        std::max(difference, (a.second - b.second).cwiseAbs().maxCoeff());
+  }
+  return difference;
+}
+
+int main(int argc, char** argv) {
+  int factor_num = 1000;
+  int repeat = 100;
+  pcl::console::parse_argument(argc, argv, "-n", factor_num);
+  pcl::console::parse_argument(argc, argv, "-r", repeat);
+  if (factor_num <= 0 || repeat <= 0) {
+    std::cout << "Should use it this way: \n\n"
+              << "    odom_factor_bench -n [factor num] -r [repeat]\n"
+              << std::endl;
+    return -1;
+  }
+
+  // a path of submap poses with noisy odom poses through the calibration
+  std::mt19937 random(42u);
+  const auto noise = gtsam::noiseModel::Diagonal::Sigmas(
+      (gtsam::Vector6() << 0.01, 0.01, 0.01, 0.05, 0.05, 0.05).finished());
+  const Pose3 calib = RandomPose(0.1, 0.5, &random);
+  const Pose3 calib_guess = calib * RandomPose(0.01, 0.05, &random);
+  gtsam::Values values;
+  values.insert(OdomCalibKey(), calib_guess);
+  gtsam::NonlinearFactorGraph expression_graph, reference_graph, graph;
+  Pose3 pose;
+  for (int i = 0; i < factor_num; ++i) {
+    pose = pose * RandomPose(0.05, 2., &random);
+    values.insert(PoseKey(i), pose * RandomPose(0.01, 0.05, &random));
+    const Pose3 odom =
+        calib.inverse() * pose * calib * RandomPose(0.01, 0.05, &random);
+    const auto calib_tf = Pose3_(OdomCalibKey());
+    expression_graph.addExpressionFactor(
+        noise, odom,
+        gtsam::compose(gtsam::between(calib_tf, Pose3_(PoseKey(i))),
+                       calib_tf));
+    reference_graph.emplace_shared<ReferenceOdomCalibrationFactor>(
+        odom, noise, PoseKey(i), OdomCalibKey());
+    graph.emplace_shared<OdomCalibrationFactor>(odom, noise, PoseKey(i),
+                                                OdomCalibKey());
+  }
+
+  const double expression_ms =
+      LinearizeMilliseconds(expression_graph, values, repeat);
+  const double reference_ms =
+      LinearizeMilliseconds(reference_graph, values, repeat);
+  const double current_ms = LinearizeMilliseconds(graph, values, repeat);
+
+  const double runs = static_cast<double>(factor_num) * repeat;
+  std::cout << std::left << std::setw(12) << "factor" << std::right
+            << std::setw(12) << "us/factor" << std::setw(20)
+            << "max diff to expr" << std::endl;
+  std::cout << std::left << std::setw(12) << "expression" << std::right
+            << std::fixed << std::setprecision(3) << std::setw(12)
+            << expression_ms * 1.e3 / runs << std::setw(20) << 0.
+            << std::endl;
+  std::cout << std::left << std::setw(12) << "former" << std::right
+            << std::setw(12) << reference_ms * 1.e3 / runs
+            << std::scientific << std::setw(20)
+            << MaxDifference(reference_graph, expression_graph, values)
+            << std::endl;
+  std::cout << std::left << std::setw(12) << "current" << std::right
+            << std::fixed << std::setw(12) << current_ms * 1.e3 / runs
+            << std::scientific << std::setw(20)
+            << MaxDifference(graph, expression_graph, values) << std::endl;
+  std::cout << "\nspeed up: " << std::fixed << std::setprecision(2)
+            << expression_ms / std::max(current_ms, 1.e-9)
+            << "x to the expression, "
+            << reference_ms / std::max(current_ms, 1.e-9)
+            << "x to the former factor" << std::endl;
+  return 0;
+}
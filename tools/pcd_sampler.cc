@@ -21,37 +21,144 @@
 // SOFTWARE.
 
 #include <pcl/console/parse.h>
-#include <pcl/filters/random_sample.h>
-#include <pcl/io/pcd_io.h>
 #include <pcl/point_types.h>
+#include <algorithm>
+#include <functional>
 #include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "common/eigen_hash.h"
+#include "common/pcd_stream_reader.h"
+#include "common/pcd_stream_writer.h"
+#include "common/shared_executor.h"
+#include "common/voxel_centroid_grid.h"
+
+using static_map::common::ParallelFor;
+using static_map::common::SharedExecutor;
+using static_map::common::VoxelCentroidGrid;
+using PointCloud = pcl::PointCloud<pcl::PointXYZI>;
+
+// the points are sampled in the parallel parts of a chunk
+constexpr size_t kPartPointNum = 1u << 16;
 
 int main(int argc, char** argv) {
   std::string pcd_filename = "";
   pcl::console::parse_argument(argc, argv, "-pc", pcd_filename);
   if (pcd_filename.empty()) {
-    std::cout << "point cloud topic is empty!" << std::endl;
+    std::cout << "Should use it this way: \n\n"
+              << "    pcd_sampler -pc [filename]\n\n"
+              << "  -r [ratio of the random sampling, default 0.05]\n"
+              << "  -leaf [voxel size, voxel sampling instead if positive]\n"
+              << "  -o [output pcd, default sampled.pcd]\n"
+              << "  -chunk [points read at once, default 4M]\n"
+              << "  -threads [0 for (cpu cores - 1)]\n"
+              << std::endl;
     return -1;
   }
 
   float ratio = 0.05;
+  float leaf_size = 0.;
+  std::string output_filename = "sampled.pcd";
+  int chunk_point_num = 1 << 22;
+  int thread_num = 0;
   pcl::console::parse_argument(argc, argv, "-r", ratio);
+  pcl::console::parse_argument(argc, argv, "-leaf", leaf_size);
+  pcl::console::parse_argument(argc, argv, "-o", output_filename);
+  pcl::console::parse_argument(argc, argv, "-chunk", chunk_point_num);
+  pcl::console::parse_argument(argc, argv, "-threads", thread_num);
+  if (thread_num > 0) {
+    SharedExecutor::SetThreadNum(thread_num);
+  }
+  // the chunks are made of whole parts
+  chunk_point_num =
+      std::max<int>(1, (chunk_point_num + kPartPointNum - 1) / kPartPointNum) *
+      kPartPointNum;
 
-  pcl::PointCloud<pcl::PointXYZI>::Ptr cloud(
-      new pcl::PointCloud<pcl::PointXYZI>);
-
-  if (pcl::io::loadPCDFile<pcl::PointXYZI>(pcd_filename, *cloud) == -1) {
-    PCL_ERROR("Couldn't read file test_pcd.pcd \n");
-    return (-1);
+  static_map::common::PcdStreamReader<pcl::PointXYZI> reader;
+  if (!reader.Open(pcd_filename)) {
+    std::cout << "Couldn't read " << pcd_filename
+              << " as a binary (compressed) pcd." << std::endl;
+    return -1;
+  }
+  static_map::common::PcdStreamWriter<pcl::PointXYZI> writer;
+  if (!writer.Open(output_filename)) {
+    std::cout << "Couldn't write " << output_filename << std::endl;
+    return -1;
   }
 
-  pcl::RandomSample<pcl::PointXYZI> sample(true);
-  sample.setInputCloud(cloud);
-  sample.setSample(static_cast<int>(cloud->size() * ratio));
-  // Cloud
-  pcl::PointCloud<pcl::PointXYZI> cloud_out;
-  sample.filter(cloud_out);
-  pcl::io::savePCDFileBinaryCompressed("sampled.pcd", cloud_out);
+  // the voxels are spread by their hash to the shards, every shard is
+  // updated by a single worker
+  const int shard_num = std::max<int>(1, SharedExecutor::ThreadNum());
+  std::vector<VoxelCentroidGrid<pcl::PointXYZI>> shards(
+      shard_num, VoxelCentroidGrid<pcl::PointXYZI>(leaf_size > 0. ? leaf_size
+                                                                   : 1.f));
+  std::vector<Eigen::Vector3i> voxel_indices;
+  std::vector<int> voxel_shards;
+  std::vector<PointCloud> parts;
 
-  return (0);
+  PointCloud chunk;
+  while (reader.Read(chunk_point_num, &chunk)) {
+    const size_t chunk_begin = reader.ReadNum() - chunk.size();
+    const int part_num = (chunk.size() + kPartPointNum - 1) / kPartPointNum;
+    if (leaf_size > 0.) {
+      voxel_indices.resize(chunk.size());
+      voxel_shards.resize(chunk.size());
+      ParallelFor(0, part_num, shard_num, [&](const int part) {
+        const size_t end = std::min(chunk.size(), (part + 1) * kPartPointNum);
+        for (size_t i = part * kPartPointNum; i < end; ++i) {
+          voxel_indices[i] = shards[0].VoxelIndex(chunk.points[i]);
+          voxel_shards[i] =
+              std::hash<Eigen::Vector3i>()(voxel_indices[i]) % shard_num;
+        }
+      });
+      ParallelFor(0, shard_num, shard_num, [&](const int shard) {
+        for (size_t i = 0; i < chunk.size(); ++i) {
+          if (voxel_shards[i] == shard) {
+            shards[shard].Add(voxel_indices[i], chunk.points[i]);
+          }
+        }
+      });
+    } else {
+      // the random numbers only depend on the position of the points in the
+      // file, not on the chunks and threads
+      parts.resize(part_num);
+      ParallelFor(0, part_num, shard_num, [&](const int part) {
+        const size_t begin = part * kPartPointNum;
+        const size_t end = std::min(chunk.size(), begin + kPartPointNum);
+        std::mt19937 random_engine((chunk_begin + begin) / kPartPointNum);
+        std::uniform_real_distribution<float> distribution(0.f, 1.f);
+        parts[part].clear();
+        for (size_t i = begin; i < end; ++i) {
+          if (distribution(random_engine) < ratio) {
+            parts[part].push_back(chunk.points[i]);
+          }
+        }
+      });
+      for (int part = 0; part < part_num; ++part) {
+        writer.Write(parts[part]);
+      }
+    }
+    std::cout << "Sampled " << reader.ReadNum() << " / " << reader.PointNum()
+              << " points." << std::endl;
+  }
+  if (reader.ReadNum() != reader.PointNum()) {
+    std::cout << "The pcd file is broken." << std::endl;
+  }
+  for (auto& shard : shards) {
+    if (shard.Size()) {
+      shard.Output(&chunk);
+      writer.Write(chunk);
+      shard.Clear();
+    }
+  }
+  const size_t point_num = writer.PointNum();
+  if (!writer.Close()) {
+    std::cout << "Couldn't write " << output_filename << std::endl;
+    return -1;
+  }
+  std::cout << "Saved " << point_num << " points into " << output_filename
+            << std::endl;
+  return 0;
 }
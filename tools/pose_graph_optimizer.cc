@@ -0,0 +1,101 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <pcl/console/parse.h>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+#include "back_end/batch_optimization.h"
+#include "back_end/pose_graph_file.h"
+
+using static_map::back_end::PoseGraphFactor;
+using static_map::back_end::PoseGraphFactors;
+
+int main(int argc, char** argv) {
+  std::string input_file = "";
+  std::string output_file = "";
+  double loop_sigma_scale = 1.;
+  double loop_huber = 0.;
+  const bool no_loops = pcl::console::find_switch(argc, argv, "-no_loops");
+  static_map::back_end::FinalOptimizationOptions options;
+  pcl::console::parse_argument(argc, argv, "-i", input_file);
+  pcl::console::parse_argument(argc, argv, "-o", output_file);
+  pcl::console::parse_argument(argc, argv, "-loop_sigma_scale",
+                               loop_sigma_scale);
+  pcl::console::parse_argument(argc, argv, "-loop_huber", loop_huber);
+  pcl::console::parse_argument(argc, argv, "-threads", options.threads);
+  if (input_file.empty() || output_file.empty() || loop_sigma_scale <= 0.) {
+    std::cout << "Should use it this way: \n\n"
+              << "    pose_graph_optimizer -i [pose_graph.bin] -o [output] "
+                 "-loop_sigma_scale [s]\n"
+              << "        -loop_huber [k] -no_loops -threads [n]\n"
+              << "\n  the saved graph is optimized again from its estimate "
+                 "without the registrations,\n  with the sigmas of the loop "
+                 "closure edges scaled, a huber robust noise\n  on them "
+                 "(k > 0) or without them.\n"
+              << std::endl;
+    return -1;
+  }
+
+  PoseGraphFactors factors;
+  gtsam::Values initial;
+  if (!static_map::back_end::LoadPoseGraph(input_file, &factors, &initial)) {
+    return -1;
+  }
+  gtsam::NonlinearFactorGraph graph;
+  PoseGraphFactors kept_factors;
+  int loop_num = 0;
+  for (auto factor : factors) {
+    if (factor.type == PoseGraphFactor::kLoopClosure) {
+      if (no_loops) {
+        continue;
+      }
+      std::for_each(factor.sigmas, factor.sigmas + factor.sigma_num,
+                    [=](double& sigma) { sigma *= loop_sigma_scale; });
+      if (loop_huber > 0.) {
+        factor.huber = loop_huber;
+      }
+      loop_num++;
+    }
+    static_map::back_end::AddToGraph(factor, &graph);
+    kept_factors.push_back(factor);
+  }
+  std::cout << "Loaded " << factors.size() << " factors (" << loop_num
+            << " loop closures kept), " << initial.size() << " values."
+            << std::endl;
+
+  const gtsam::Values result =
+      static_map::back_end::BatchOptimize(graph, initial, options);
+  double max_moved = 0.;
+  for (const auto& key_value : initial) {
+    const auto moved = initial.at<gtsam::Pose3>(key_value.key)
+                           .between(result.at<gtsam::Pose3>(key_value.key));
+    max_moved = std::max(max_moved, moved.translation().norm());
+  }
+  std::cout << "The largest translation change: " << max_moved << " m"
+            << std::endl;
+  return static_map::back_end::SavePoseGraph(output_file, kept_factors, result)
+             ? 0
+             : -1;
+}
@@ -0,0 +1,395 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <malloc.h>
+#include <pcl/common/transforms.h>
+#include <pcl/console/parse.h>
+#include <pcl/io/pcd_io.h>
+#include <pcl/point_types.h>
+
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "common/macro_defines.h"
+#include "common/pugixml.hpp"
+#include "registrators/icp_fast.h"
+#include "registrators/icp_gpu.h"
+#include "registrators/icp_libicp.h"
+#include "registrators/icp_pointmatcher.h"
+#include "registrators/lego_loam.h"
+#include "registrators/ndt.h"
+#include "registrators/ndt_gicp.h"
+
+using PointType = pcl::PointXYZI;
+using PointCloudType = pcl::PointCloud<PointType>;
+using PointCloudPtr = PointCloudType::Ptr;
+using Registrator = static_map::registrator::Interface<PointType>;
+
+namespace registrator = static_map::registrator;
+
+struct Settings {
+  std::string yaml_filename = "";
+  std::string xml_filename = "";
+  float voxel_resolution = 0.2;
+};
+
+struct CloudPair {
+  std::string name;
+  PointCloudPtr source;
+  PointCloudPtr target;
+  // from source to target
+  Eigen::Matrix4f ground_truth = Eigen::Matrix4f::Identity();
+  Eigen::Matrix4f guess = Eigen::Matrix4f::Identity();
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+using CloudPairs =
+    std::vector<CloudPair, Eigen::aligned_allocator<CloudPair>>;
+
+struct PairResult {
+  bool succeed = false;
+  double prepare_ms = 0.;
+  double align_ms = 0.;
+  int iterations = -1;
+  // heap still used by the registrator after aligning, e.g. prepared targets
+  double retained_heap_kb = 0.;
+  double fitness = 0.;
+  double translation_error = 0.;
+  double rotation_error_deg = 0.;
+};
+
+const char* TypeName(const registrator::Type type) {
+  switch (type) {
+    case registrator::kIcpPM:
+      return "icp_pointmatcher";
+    case registrator::kLibicp:
+      return "icp_libicp";
+    case registrator::kNdtWithGicp:
+      return "ndt_gicp";
+    case registrator::kLegoLoam:
+      return "lego_loam";
+    case registrator::kNdt:
+      return "ndt_omp";
+    case registrator::kFastIcp:
+      return "icp_fast";
+    case registrator::kGpuIcp:
+      return "icp_gpu";
+    default:
+      return "unknown";
+  }
+}
+
+std::unique_ptr<Registrator> CreateRegistrator(const registrator::Type type,
+                                               const Settings& settings) {
+  switch (type) {
+    case registrator::kIcpPM:
+      return std::unique_ptr<Registrator>(
+          new registrator::IcpUsingPointMatcher<PointType>(
+              settings.yaml_filename));
+    case registrator::kLibicp:
+      return std::unique_ptr<Registrator>(
+          new registrator::IcpUsingLibicp<PointType>());
+    case registrator::kNdtWithGicp:
+      return std::unique_ptr<Registrator>(
+          new registrator::NdtWithGicp<PointType>(true,
+                                                  settings.voxel_resolution));
+    case registrator::kLegoLoam: {
+      std::unique_ptr<registrator::LegoLoam<PointType>> lego_loam(
+          new registrator::LegoLoam<PointType>());
+      pugi::xml_document doc;
+      pugi::xml_node inner_filters;
+      if (!settings.xml_filename.empty() &&
+          doc.load_file(settings.xml_filename.c_str())) {
+        inner_filters = doc.find_node([](const pugi::xml_node& node) {
+          return std::string(node.name()) == "inner_filters";
+        });
+      }
+      lego_loam->InitialiseFiltersFromXmlNode(inner_filters);
+      return lego_loam;
+    }
+    case registrator::kNdt:
+      return std::unique_ptr<Registrator>(new registrator::Ndt<PointType>());
+    case registrator::kFastIcp:
+      return std::unique_ptr<Registrator>(
+          new registrator::IcpFast<PointType>());
+#ifdef _ICP_USE_CUDA_
+    case registrator::kGpuIcp:
+      return std::unique_ptr<Registrator>(
+          new registrator::IcpGpu<PointType>());
+#endif
+    default:
+      return nullptr;
+  }
+}
+
+double HeapInUse() {
+#if __GLIBC_PREREQ(2, 33)
+  return static_cast<double>(mallinfo2().uordblks);
+#else
+  return static_cast<double>(mallinfo().uordblks);
+#endif
+}
+
+double Milliseconds(const std::chrono::steady_clock::time_point& start,
+                    const std::chrono::steady_clock::time_point& end) {
+  return std::chrono::duration<double>(end - start).count() * 1.e3;
+}
+
+PairResult RunPair(const registrator::Type type, const Settings& settings,
+                   const CloudPair& pair) {
+  PairResult result;
+  const double heap_start = HeapInUse();
+  auto matcher = CreateRegistrator(type, settings);
+
+  const auto prepare_start = std::chrono::steady_clock::now();
+  matcher->setInputTarget(pair.target);
+  matcher->setInputSource(pair.source);
+  const auto align_start = std::chrono::steady_clock::now();
+  Eigen::Matrix4f transform = pair.guess;
+  result.succeed = matcher->align(pair.guess, transform);
+  const auto align_end = std::chrono::steady_clock::now();
+
+  result.prepare_ms = Milliseconds(prepare_start, align_start);
+  result.align_ms = Milliseconds(align_start, align_end);
+  result.iterations = matcher->getFinalNumIteration();
+  result.retained_heap_kb = (HeapInUse() - heap_start) / 1024.;
+  result.fitness = matcher->getFitnessScore();
+
+  const Eigen::Matrix4f error = pair.ground_truth.inverse() * transform;
+  result.translation_error = error.block<3, 1>(0, 3).norm();
+  const Eigen::Matrix3f rotation = error.block<3, 3>(0, 0);
+  result.rotation_error_deg =
+      std::fabs(Eigen::AngleAxisf(rotation).angle()) * 180. / M_PI;
+  return result;
+}
+
+bool ReadMatrix(std::istringstream* const stream,
+                Eigen::Matrix4f* const matrix) {
+  for (int i = 0; i < 16; ++i) {
+    if (!(*stream >> (*matrix)(i / 4, i % 4))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// every line: source.pcd target.pcd [16 of ground truth] [16 of guess]
+// the matrices are row major, the guess is identity if not given
+bool LoadPairs(const std::string& filename, CloudPairs* const pairs) {
+  std::ifstream file(filename);
+  if (!file.good()) {
+    std::cout << "Can not open " << filename << std::endl;
+    return false;
+  }
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream stream(line);
+    std::string source_file, target_file;
+    CloudPair pair;
+    if (!(stream >> source_file >> target_file) ||
+        !ReadMatrix(&stream, &pair.ground_truth)) {
+      std::cout << "Wrong line: " << line << std::endl;
+      return false;
+    }
+    ReadMatrix(&stream, &pair.guess);
+    pair.source.reset(new PointCloudType);
+    pair.target.reset(new PointCloudType);
+    if (pcl::io::loadPCDFile<PointType>(source_file, *pair.source) == -1 ||
+        pcl::io::loadPCDFile<PointType>(target_file, *pair.target) == -1) {
+      std::cout << "Can not load " << source_file << " or " << target_file
+                << std::endl;
+      return false;
+    }
+    pair.name = source_file.substr(source_file.find_last_of('/') + 1) + "->" +
+                target_file.substr(target_file.find_last_of('/') + 1);
+    pairs->push_back(pair);
+  }
+  return true;
+}
+
+// the source is the target moved by a random transform with noise,
+// the yaw is in [-max_rotation, max_rotation] and roll, pitch in a tenth
+void GeneratePairs(const PointCloudPtr& cloud, const int num,
+                   const float max_translation, const float max_rotation_deg,
+                   const float noise, CloudPairs* const pairs) {
+  std::mt19937 generator(0);
+  std::uniform_real_distribution<float> uniform(-1.f, 1.f);
+  std::normal_distribution<float> gaussian(0.f, noise > 0.f ? noise : 1.f);
+  const float max_rotation = max_rotation_deg * M_PI / 180.;
+  for (int i = 0; i < num; ++i) {
+    CloudPair pair;
+    pair.name = "generated_" + std::to_string(i);
+    pair.ground_truth.block<3, 3>(0, 0) =
+        (Eigen::AngleAxisf(uniform(generator) * max_rotation,
+                           Eigen::Vector3f::UnitZ()) *
+         Eigen::AngleAxisf(uniform(generator) * max_rotation * 0.1f,
+                           Eigen::Vector3f::UnitY()) *
+         Eigen::AngleAxisf(uniform(generator) * max_rotation * 0.1f,
+                           Eigen::Vector3f::UnitX()))
+            .toRotationMatrix();
+    pair.ground_truth.block<3, 1>(0, 3) =
+        Eigen::Vector3f(uniform(generator), uniform(generator),
+                        0.1f * uniform(generator)) *
+        max_translation;
+
+    pair.target = cloud;
+    pair.source.reset(new PointCloudType);
+    pcl::transformPointCloud(*cloud, *pair.source,
+                             Eigen::Matrix4f(pair.ground_truth.inverse()));
+    if (noise > 0.f) {
+      for (auto& point : pair.source->points) {
+        point.x += gaussian(generator);
+        point.y += gaussian(generator);
+        point.z += gaussian(generator);
+      }
+    }
+    pairs->push_back(pair);
+  }
+}
+
+int main(int argc, char** argv) {
+  std::string pairs_filename = "";
+  std::string pcd_filename = "";
+  std::string output_filename = "registration_bench.csv";
+  int num = 10;
+  float max_translation = 1.;
+  float max_rotation = 10.;
+  float noise = 0.01;
+  Settings settings;
+  pcl::console::parse_argument(argc, argv, "-pairs", pairs_filename);
+  pcl::console::parse_argument(argc, argv, "-pcd", pcd_filename);
+  pcl::console::parse_argument(argc, argv, "-o", output_filename);
+  pcl::console::parse_argument(argc, argv, "-num", num);
+  pcl::console::parse_argument(argc, argv, "-max_t", max_translation);
+  pcl::console::parse_argument(argc, argv, "-max_r", max_rotation);
+  pcl::console::parse_argument(argc, argv, "-noise", noise);
+  pcl::console::parse_argument(argc, argv, "-yaml", settings.yaml_filename);
+  pcl::console::parse_argument(argc, argv, "-xml", settings.xml_filename);
+  pcl::console::parse_argument(argc, argv, "-res", settings.voxel_resolution);
+  if (pairs_filename.empty() && pcd_filename.empty()) {
+    std::cout
+        << "Should use it this way: \n\n"
+        << "    registration_bench -pairs [pairs file] -o [csv]\n"
+        << "    registration_bench -pcd [pcd] -num [pairs] -max_t [m] "
+           "-max_r [deg] -noise [m] -o [csv]\n"
+        << "\n  every line of the pairs file is \"source.pcd target.pcd\" "
+           "with 16 values of\n  the ground truth from source to target "
+           "(row major), then 16 values of\n  the guess optionally.\n"
+        << "  -yaml: config of icp_pointmatcher, -xml: mapping config for "
+           "the inner\n  filters of lego_loam, -res: voxel resolution of "
+           "ndt_gicp.\n"
+        << std::endl;
+    return -1;
+  }
+
+  CloudPairs pairs;
+  if (!pairs_filename.empty()) {
+    if (!LoadPairs(pairs_filename, &pairs)) {
+      return -1;
+    }
+  } else {
+    PointCloudPtr cloud(new PointCloudType);
+    if (pcl::io::loadPCDFile<PointType>(pcd_filename, *cloud) == -1 ||
+        cloud->empty()) {
+      std::cout << "Can not load " << pcd_filename << std::endl;
+      return -1;
+    }
+    GeneratePairs(cloud, num, max_translation, max_rotation, noise, &pairs);
+  }
+  if (pairs.empty()) {
+    std::cout << "No pair to match." << std::endl;
+    return -1;
+  }
+
+  std::ofstream output(output_filename);
+  if (!output.good()) {
+    std::cout << "Can not write " << output_filename << std::endl;
+    return -1;
+  }
+  output << "registrator,pair,succeed,prepare_ms,align_ms,iterations,"
+            "retained_heap_kb,fitness,translation_error,rotation_error_deg\n";
+
+#ifdef _ICP_USE_CUDA_
+  registrator::cuda::init_cuda_device();
+#endif
+
+  std::cout << std::left << std::setw(20) << "registrator" << std::right
+            << std::setw(10) << "succeed" << std::setw(12) << "ms/pair"
+            << std::setw(10) << "iters" << std::setw(12) << "heap kb"
+            << std::setw(10) << "fitness" << std::setw(12) << "trans err"
+            << std::setw(12) << "rot err" << std::endl;
+  for (int t = registrator::kIcpPM; t < registrator::kTypeCount; ++t) {
+    const auto type = static_cast<registrator::Type>(t);
+    if (!CreateRegistrator(type, settings)) {
+      continue;
+    }
+    PairResult sum;
+    sum.iterations = 0;
+    int succeed_num = 0;
+    // the registrators without iteration count give -1
+    int counted_num = 0;
+    for (const auto& pair : pairs) {
+      const PairResult result = RunPair(type, settings, pair);
+      output << TypeName(type) << "," << pair.name << "," << result.succeed
+             << "," << result.prepare_ms << "," << result.align_ms << ","
+             << result.iterations << "," << result.retained_heap_kb << ","
+             << result.fitness << "," << result.translation_error << ","
+             << result.rotation_error_deg << "\n";
+      succeed_num += result.succeed;
+      sum.prepare_ms += result.prepare_ms;
+      sum.align_ms += result.align_ms;
+      if (result.iterations >= 0) {
+        sum.iterations += result.iterations;
+        counted_num++;
+      }
+      sum.retained_heap_kb += result.retained_heap_kb;
+      sum.fitness += result.fitness;
+      sum.translation_error += result.translation_error;
+      sum.rotation_error_deg += result.rotation_error_deg;
+    }
+    const double size = pairs.size();
+    const double iterations =
+        counted_num ? static_cast<double>(sum.iterations) / counted_num : -1.;
+    std::cout << std::left << std::setw(20) << TypeName(type) << std::right
+              << std::setw(10) << succeed_num << std::fixed
+              << std::setprecision(2) << std::setw(12)
+              << (sum.prepare_ms + sum.align_ms) / size << std::setw(10)
+              << iterations << std::setw(12)
+              << sum.retained_heap_kb / size << std::setprecision(3)
+              << std::setw(10) << sum.fitness / size << std::setw(12)
+              << sum.translation_error / size << std::setw(12)
+              << sum.rotation_error_deg / size << std::endl;
+  }
+  std::cout << "\nThe results of every pair are in " << output_filename
+            << std::endl;
+  return 0;
+}
@@ -1,4 +1,6 @@
 import os
+import sys
+import json
 import time
 import psutil
 
@@ -9,12 +11,67 @@ def get_pid(name):
     return check_output(["pidof", name])
 
 
-process_name = "static_mapping_node"
-pid = get_pid(process_name)
-process = psutil.Process(int(pid))
-a = 0
-while(a == 0):
-    mem = process.memory_info().rss
-    mem /= (1024*1024)  # MB
-    print(mem)  # in bytes
-    time.sleep(1)
+def monitor_memory(process_name):
+    pid = get_pid(process_name)
+    process = psutil.Process(int(pid))
+    while True:
+        mem = process.memory_info().rss
+        mem /= (1024*1024)  # MB
+        print(mem)  # in MB
+        time.sleep(1)
+
+
+def plot_metrics(metrics_file):
+    # the file is dumped by MapBuilder if metrics_options is enabled
+    import matplotlib.pyplot as plt
+    snapshots = []
+    with open(metrics_file, "r") as file:
+        for line in file.readlines():
+            line = line.strip()
+            if line:
+                snapshots.append(json.loads(line))
+    if len(snapshots) == 0:
+        print("no snapshot in " + metrics_file)
+        return
+    times = [s["time"] for s in snapshots]
+    fig, (ax_latency, ax_busy, ax_queue) = plt.subplots(3, 1, sharex=True)
+
+    # percentiles of each stage, in ms
+    for name in sorted(snapshots[-1]["histograms"].keys()):
+        for p, style in [("p50", "-"), ("p99", "--")]:
+            values = [s["histograms"].get(name, {}).get(p, 0.) * 1000.
+                      for s in snapshots]
+            ax_latency.plot(times, values, style, label=name + " " + p)
+    ax_latency.set_ylabel("latency /ms")
+    ax_latency.legend(fontsize="small")
+
+    # busy ratio of each thread, from the accumulated busy time
+    for name in sorted(snapshots[-1]["counters"].keys()):
+        if not name.endswith(".busy_us"):
+            continue
+        ratios = [0.]
+        for i in range(1, len(snapshots)):
+            dt = times[i] - times[i - 1]
+            busy = (snapshots[i]["counters"].get(name, 0) -
+                    snapshots[i - 1]["counters"].get(name, 0)) * 1.e-6
+            ratios.append(busy / dt if dt > 0. else 0.)
+        ax_busy.plot(times, ratios, label=name)
+    ax_busy.set_ylabel("busy ratio")
+    ax_busy.legend(fontsize="small")
+
+    for name in sorted(snapshots[-1]["gauges"].keys()):
+        values = [s["gauges"].get(name, 0) for s in snapshots]
+        ax_queue.plot(times, values, label=name)
+    ax_queue.set_ylabel("queue")
+    ax_queue.set_xlabel("time /s")
+    ax_queue.legend(fontsize="small")
+    plt.show()
+
+
+# usage:
+#   python monitor.py                 print the memory of static_mapping_node
+#   python monitor.py metrics.log     plot the metrics dumped by the node
+if len(sys.argv) > 1 and os.path.isfile(sys.argv[1]):
+    plot_metrics(sys.argv[1])
+else:
+    monitor_memory("static_mapping_node")
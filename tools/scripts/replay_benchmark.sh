@@ -0,0 +1,42 @@
+## end-to-end benchmark: replay a fixed bag through the offline mode, then
+## check the path against the ground truth, run it from the root of the repo
+## the summary (scans/s, submaps/s, loop closures, peak rss, final
+## optimization and map generation time, ate and rpe) is in SUMMARY_FILE
+BAG_FILE=~/data/benchmark.bag
+## "stamp x y z qx qy qz qw" lines or a path.traj of a former run
+GROUND_TRUTH=~/data/benchmark_ground_truth.txt
+CONFIG_PATH=./config/lidar_imu_default.xml
+URDF_FILE=./urdf/test.urdf
+POINT_CLOUD_TOPIC=velodyne_points
+POINT_CLOUD_FRAME_ID=velodyne
+IMU_TOPIC=imu/raw_data
+IMU_FRAME_ID=imu_link
+## "true" for the same results in every run, but not for the throughput
+DETERMINISTIC=true
+SUMMARY_FILE=./benchmark_summary.txt
+
+## the config with the binary path (for the timestamps) and the mode
+BENCHMARK_CONFIG=/tmp/benchmark_config.xml
+sed -e "s/binary_path=\"[a-z]*\"/binary_path=\"true\"/" \
+  -e "s/deterministic=\"[a-z]*\"/deterministic=\"${DETERMINISTIC}\"/" \
+  ${CONFIG_PATH} > ${BENCHMARK_CONFIG}
+EXPORT_PATH=$(sed -n "s/.*export_file_path=\"\([^\"]*\)\".*/\1/p" \
+  ${BENCHMARK_CONFIG})
+
+./build/offline_mapping_node \
+  -bag ${BAG_FILE} \
+  -cfg ${BENCHMARK_CONFIG} \
+  -urdf ${URDF_FILE} \
+  -pc ${POINT_CLOUD_TOPIC} \
+  -pc_frame_id ${POINT_CLOUD_FRAME_ID} \
+  -imu ${IMU_TOPIC} \
+  -imu_frame_id ${IMU_FRAME_ID} \
+  -summary ${SUMMARY_FILE} || exit 1
+
+./build/tools/trajectory_eval \
+  -traj ${EXPORT_PATH}path.traj \
+  -gt ${GROUND_TRUTH} \
+  -summary ${SUMMARY_FILE} || exit 1
+
+cat ${SUMMARY_FILE}
+exit 0
@@ -0,0 +1,67 @@
+## map one long bag in overlapping segments in parallel, one offline process
+## per segment, then join the segments into one map, run it from the root of
+## the repo, the map of the first segment is the base of the joined map
+BAG_FILE=~/data/long.bag
+SEGMENT_NUM=4
+## seconds, each segment overlaps the one after it by this
+OVERLAP=30
+CONFIG_PATH=./config/lidar_imu_default.xml
+URDF_FILE=./urdf/test.urdf
+POINT_CLOUD_TOPIC=velodyne_points
+POINT_CLOUD_FRAME_ID=velodyne
+IMU_TOPIC=imu/raw_data
+IMU_FRAME_ID=imu_link
+OUTPUT_PATH=./segments
+JOINED_MAP=${OUTPUT_PATH}/joined/map.xml
+
+## the config with the binary path, the overlaps are aligned by it
+SEGMENT_CONFIG=/tmp/segment_config.xml
+sed -e "s/binary_path=\"[a-z]*\"/binary_path=\"true\"/" \
+  ${CONFIG_PATH} > ${SEGMENT_CONFIG}
+EXPORT_PATH=$(sed -n "s/.*export_file_path=\"\([^\"]*\)\".*/\1/p" \
+  ${SEGMENT_CONFIG})
+PACKAGE_PATH=$(sed -n "s/.*map_package_path=\"\([^\"]*\)\".*/\1/p" \
+  ${SEGMENT_CONFIG})
+
+BAG_DURATION=$(rosbag info -y -k duration ${BAG_FILE})
+SEGMENT_DURATION=$(echo "${BAG_DURATION} / ${SEGMENT_NUM}" | bc -l)
+
+PIDS=""
+for ((i = 0; i < SEGMENT_NUM; i++)); do
+  START=$(echo "${i} * ${SEGMENT_DURATION}" | bc -l)
+  mkdir -p ${OUTPUT_PATH}/seg_${i}
+  ./build/offline_mapping_node \
+    -bag ${BAG_FILE} \
+    -cfg ${SEGMENT_CONFIG} \
+    -urdf ${URDF_FILE} \
+    -pc ${POINT_CLOUD_TOPIC} \
+    -pc_frame_id ${POINT_CLOUD_FRAME_ID} \
+    -imu ${IMU_TOPIC} \
+    -imu_frame_id ${IMU_FRAME_ID} \
+    -start ${START} \
+    -duration $(echo "${SEGMENT_DURATION} + ${OVERLAP}" | bc -l) \
+    -output ${OUTPUT_PATH}/seg_${i} \
+    > ${OUTPUT_PATH}/seg_${i}/mapping.log 2>&1 &
+  PIDS="${PIDS} $!"
+done
+for PID in ${PIDS}; do
+  wait ${PID} || exit 1
+done
+
+INCREMENTAL_MAPS=""
+PATHS=${OUTPUT_PATH}/seg_0/${EXPORT_PATH}path.traj
+for ((i = 1; i < SEGMENT_NUM; i++)); do
+  MAP=${OUTPUT_PATH}/seg_${i}/${PACKAGE_PATH}map.xml
+  INCREMENTAL_MAPS=${INCREMENTAL_MAPS},${MAP}
+  PATHS=${PATHS},${OUTPUT_PATH}/seg_${i}/${EXPORT_PATH}path.traj
+done
+
+mkdir -p $(dirname ${JOINED_MAP})
+./build/join_maps_node \
+  -b ${OUTPUT_PATH}/seg_0/${PACKAGE_PATH}map.xml \
+  -i ${INCREMENTAL_MAPS#,} \
+  -traj ${PATHS} \
+  -n ${JOINED_MAP} \
+  -batch || exit 1
+
+exit 0
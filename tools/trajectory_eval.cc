@@ -0,0 +1,275 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// accuracy of a mapping run against the ground truth, so that a speedup
+// can not degrade the trajectory silently:
+//   ATE, the absolute trajectory error after the rigid alignment of the
+//     whole path to the ground truth
+//   RPE, the relative pose error over segments of "delta" meters
+// the estimated path is the path.traj of MapBuilder (binary_path="true"),
+// the ground truth is another .traj file or the text lines of
+// "stamp x y z qx qy qz qw" (the TUM format)
+
+#include <pcl/console/parse.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Eigen/Geometry"
+#include "common/math.h"
+#include "common/trajectory_writer.h"
+
+using static_map::common::BinaryTrajectoryReader;
+using static_map::common::TrajectoryRecord;
+
+struct StampedPose {
+  double stamp;
+  Eigen::Matrix4d pose;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+using StampedPoses =
+    std::vector<StampedPose, Eigen::aligned_allocator<StampedPose>>;
+
+bool ReadBinaryTrajectory(const std::string& filename,
+                          StampedPoses* const poses) {
+  BinaryTrajectoryReader reader;
+  if (!reader.Open(filename)) {
+    return false;
+  }
+  TrajectoryRecord record;
+  while (reader.Read(&record)) {
+    StampedPose stamped;
+    stamped.stamp = record.secs + record.nsecs * 1.e-9;
+    stamped.pose = static_map::common::Vector6ToTransform(
+        Eigen::Map<const Eigen::Vector6<double>>(record.pose).eval());
+    poses->push_back(stamped);
+  }
+  return true;
+}
+
+bool ReadTumTrajectory(const std::string& filename,
+                       StampedPoses* const poses) {
+  std::ifstream file(filename);
+  if (!file.is_open()) {
+    return false;
+  }
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream stream(line);
+    StampedPose stamped;
+    double t[3], q[4];
+    if (!(stream >> stamped.stamp >> t[0] >> t[1] >> t[2] >> q[0] >> q[1] >>
+          q[2] >> q[3])) {
+      std::cout << "Invalid line: " << line << std::endl;
+      return false;
+    }
+    stamped.pose.setIdentity();
+    stamped.pose.block<3, 3>(0, 0) =
+        Eigen::Quaterniond(q[3], q[0], q[1], q[2]).normalized().matrix();
+    stamped.pose.block<3, 1>(0, 3) << t[0], t[1], t[2];
+    poses->push_back(stamped);
+  }
+  return true;
+}
+
+bool ReadTrajectory(const std::string& filename, StampedPoses* const poses) {
+  const std::string extension = ".traj";
+  const bool binary =
+      filename.size() > extension.size() &&
+      filename.compare(filename.size() - extension.size(), extension.size(),
+                       extension) == 0;
+  const bool read = binary ? ReadBinaryTrajectory(filename, poses)
+                           : ReadTumTrajectory(filename, poses);
+  std::sort(poses->begin(), poses->end(),
+            [](const StampedPose& a, const StampedPose& b) {
+              return a.stamp < b.stamp;
+            });
+  return read;
+}
+
+// the estimated poses with their nearest ground truth within max_dt
+void Associate(const StampedPoses& estimated, const StampedPoses& truth,
+               const double max_dt, StampedPoses* const matched_estimated,
+               StampedPoses* const matched_truth) {
+  for (const StampedPose& pose : estimated) {
+    const auto later = std::lower_bound(
+        truth.begin(), truth.end(), pose.stamp,
+        [](const StampedPose& a, const double stamp) {
+          return a.stamp < stamp;
+        });
+    auto nearest = later;
+    if (later == truth.end() ||
+        (later != truth.begin() &&
+         pose.stamp - (later - 1)->stamp < later->stamp - pose.stamp)) {
+      nearest = later - 1;
+    }
+    if (nearest == truth.end() ||
+        std::fabs(nearest->stamp - pose.stamp) > max_dt) {
+      continue;
+    }
+    matched_estimated->push_back(pose);
+    matched_truth->push_back(*nearest);
+  }
+}
+
+struct Errors {
+  double rmse = 0.;
+  double mean = 0.;
+  double max = 0.;
+};
+
+Errors Statistics(const std::vector<double>& errors) {
+  Errors result;
+  if (errors.empty()) {
+    return result;
+  }
+  double square_sum = 0.;
+  for (const double error : errors) {
+    square_sum += error * error;
+    result.mean += error;
+    result.max = std::max(result.max, error);
+  }
+  result.rmse = std::sqrt(square_sum / errors.size());
+  result.mean /= errors.size();
+  return result;
+}
+
+double RotationAngle(const Eigen::Matrix4d& transform) {
+  const double cos_angle = (transform.block<3, 3>(0, 0).trace() - 1.) / 2.;
+  return std::acos(std::max(-1., std::min(1., cos_angle)));
+}
+
+int main(int argc, char** argv) {
+  std::string trajectory_file = "";
+  std::string truth_file = "";
+  pcl::console::parse_argument(argc, argv, "-traj", trajectory_file);
+  pcl::console::parse_argument(argc, argv, "-gt", truth_file);
+  if (trajectory_file.empty() || truth_file.empty()) {
+    std::cout << "Usage: trajectory_eval -traj path.traj -gt ground_truth "
+                 "[-max_dt 0.02] [-delta 10.] [-summary summary.txt]"
+              << std::endl;
+    return -1;
+  }
+  // in seconds
+  double max_dt = 0.02;
+  pcl::console::parse_argument(argc, argv, "-max_dt", max_dt);
+  // the length of the segments of rpe in meters
+  double delta = 10.;
+  pcl::console::parse_argument(argc, argv, "-delta", delta);
+  // the errors are appended to it if not empty
+  std::string summary_file = "";
+  pcl::console::parse_argument(argc, argv, "-summary", summary_file);
+
+  StampedPoses estimated, truth;
+  if (!ReadTrajectory(trajectory_file, &estimated) ||
+      !ReadTrajectory(truth_file, &truth)) {
+    std::cout << "Failed to read the trajectories." << std::endl;
+    return -1;
+  }
+  StampedPoses matched_estimated, matched_truth;
+  Associate(estimated, truth, max_dt, &matched_estimated, &matched_truth);
+  const int pose_num = matched_estimated.size();
+  if (pose_num < 3) {
+    std::cout << "Only " << pose_num << " of " << estimated.size()
+              << " poses are associated with the ground truth." << std::endl;
+    return -1;
+  }
+
+  // ate, the estimated path aligned to the ground truth
+  Eigen::Matrix3Xd estimated_points(3, pose_num);
+  Eigen::Matrix3Xd truth_points(3, pose_num);
+  for (int i = 0; i < pose_num; ++i) {
+    estimated_points.col(i) = matched_estimated[i].pose.block<3, 1>(0, 3);
+    truth_points.col(i) = matched_truth[i].pose.block<3, 1>(0, 3);
+  }
+  const Eigen::Matrix4d alignment =
+      Eigen::umeyama(estimated_points, truth_points, false);
+  std::vector<double> absolute_errors(pose_num);
+  for (int i = 0; i < pose_num; ++i) {
+    const Eigen::Vector3d aligned =
+        alignment.block<3, 3>(0, 0) * estimated_points.col(i) +
+        alignment.block<3, 1>(0, 3);
+    absolute_errors[i] = (aligned - truth_points.col(i)).norm();
+  }
+  const Errors ate = Statistics(absolute_errors);
+
+  // rpe, from each pose to the first one "delta" meters after it
+  std::vector<double> distances(pose_num, 0.);
+  for (int i = 1; i < pose_num; ++i) {
+    distances[i] = distances[i - 1] +
+                   (truth_points.col(i) - truth_points.col(i - 1)).norm();
+  }
+  std::vector<double> translation_errors, rotation_errors;
+  for (int i = 0, j = 0; i < pose_num; ++i) {
+    j = std::max(j, i);
+    while (j < pose_num && distances[j] - distances[i] < delta) {
+      ++j;
+    }
+    if (j == pose_num) {
+      break;
+    }
+    const Eigen::Matrix4d truth_motion =
+        matched_truth[i].pose.inverse() * matched_truth[j].pose;
+    const Eigen::Matrix4d estimated_motion =
+        matched_estimated[i].pose.inverse() * matched_estimated[j].pose;
+    const Eigen::Matrix4d error = truth_motion.inverse() * estimated_motion;
+    translation_errors.push_back(error.block<3, 1>(0, 3).norm());
+    rotation_errors.push_back(
+        static_map::common::RadToDeg(RotationAngle(error)));
+  }
+  const Errors rpe_translation = Statistics(translation_errors);
+  const Errors rpe_rotation = Statistics(rotation_errors);
+
+  std::cout << "Associated " << pose_num << " of " << estimated.size()
+            << " poses." << std::endl;
+  std::cout << "ATE (m): rmse " << ate.rmse << ", mean " << ate.mean
+            << ", max " << ate.max << std::endl;
+  std::cout << "RPE over " << delta << " m (" << translation_errors.size()
+            << " segments): translation rmse " << rpe_translation.rmse
+            << " m (" << rpe_translation.rmse / delta * 100.
+            << " %), rotation rmse " << rpe_rotation.rmse << " deg"
+            << std::endl;
+  if (!summary_file.empty()) {
+    std::ofstream summary(summary_file, std::ios::app);
+    summary << "associated_poses " << pose_num << "\n"
+            << "ate_rmse " << ate.rmse << "\n"
+            << "ate_mean " << ate.mean << "\n"
+            << "ate_max " << ate.max << "\n"
+            << "rpe_delta " << delta << "\n"
+            << "rpe_translation_rmse " << rpe_translation.rmse << "\n"
+            << "rpe_rotation_rmse_deg " << rpe_rotation.rmse << "\n";
+    if (!summary) {
+      std::cout << "Failed to write into " << summary_file << std::endl;
+      return -1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,263 @@
+// MIT License
+
+// Copyright (c) 2019 Edward Liu
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <pcl/console/parse.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _USE_TBB_
+#include <tbb/concurrent_unordered_map.h>
+#endif
+
+#include "common/eigen_hash.h"
+#include "common/math.h"
+#include "common/voxel_hash_map.h"
+
+using KeyInt3 = Eigen::Vector3i;
+
+// the part of a voxel of MultiResolutionVoxelMap touched by the ray casting
+struct Voxel {
+  uint8_t probability = 128;
+  int need_update = 1;
+};
+
+struct VectorCompare {
+  bool operator()(const KeyInt3 a, const KeyInt3 b) const {
+    return std::forward_as_tuple(a[0], a[1], a[2]) <
+           std::forward_as_tuple(b[0], b[1], b[2]);
+  }
+};
+
+using StdMap = std::map<KeyInt3, Voxel, VectorCompare>;
+using StdUnorderedMap = std::unordered_map<KeyInt3, Voxel, std::hash<KeyInt3>>;
+using FlatMap = static_map::common::VoxelHashMap<Voxel>;
+#ifdef _USE_TBB_
+using TbbMap =
+    tbb::concurrent_unordered_map<KeyInt3, Voxel, std::hash<KeyInt3>>;
+#endif
+
+struct Settings {
+  int frames = 20;
+  int points = 20000;
+  float range = 50.f;
+  float resolution = 0.1f;
+};
+
+// the voxels of all rays of a frame, ray i is [offsets[i], offsets[i + 1])
+struct FrameRays {
+  Eigen::Vector3f origin;
+  std::vector<Eigen::Vector3f> ends;
+  std::vector<KeyInt3> voxels;
+  std::vector<size_t> offsets;
+};
+
+// a scan-like frame: the points are on the rings of a spinning lidar and
+// hit a ground plane or a wall at a random range, the lidar moves along x
+FrameRays MakeFrame(const Settings& settings, const int frame_index,
+                    std::mt19937* random) {
+  std::uniform_real_distribution<float> uniform(0.f, 1.f);
+  const Eigen::Vector3f origin(frame_index * 1.f, 0.f, 1.8f);
+  FrameRays rays;
+  rays.origin = origin;
+  rays.ends.reserve(settings.points);
+  rays.offsets.reserve(settings.points + 1);
+  rays.offsets.push_back(0);
+  for (int i = 0; i < settings.points; ++i) {
+    const float yaw = uniform(*random) * 2.f * M_PI;
+    const float pitch = (uniform(*random) - 0.75f) * 0.5f;
+    float distance = 1.f + uniform(*random) * (settings.range - 1.f);
+    if (pitch < 0.f) {
+      distance = std::min(distance, origin[2] / std::sin(-pitch));
+    }
+    const Eigen::Vector3f direction(std::cos(pitch) * std::cos(yaw),
+                                    std::cos(pitch) * std::sin(yaw),
+                                    std::sin(pitch));
+    const Eigen::Vector3f end = origin + direction * distance;
+    rays.ends.push_back(end);
+    const auto voxels = static_map::common::VoxelCastingBresenham(
+        origin, end, settings.resolution);
+    rays.voxels.insert(rays.voxels.end(), voxels.begin(), voxels.end());
+    rays.offsets.push_back(rays.voxels.size());
+  }
+  return rays;
+}
+
+// the access pattern of MultiResolutionVoxelMap::InsertPointCloud: the end
+// voxel is inserted, the voxels on the ray are updated if they exist
+template <typename Map>
+void InsertRays(const FrameRays& rays, Map* map) {
+  const size_t ray_num = rays.offsets.size() - 1;
+  for (size_t r = 0; r < ray_num; ++r) {
+    const size_t begin = rays.offsets[r];
+    const size_t end = rays.offsets[r + 1];
+    if (begin == end) {
+      continue;
+    }
+    Voxel& end_voxel = (*map)[rays.voxels[end - 1]];
+    end_voxel.probability = std::min(255, end_voxel.probability + 1);
+    end_voxel.need_update = 0;
+    for (size_t i = begin; i + 1 < end; ++i) {
+      auto it = map->find(rays.voxels[i]);
+      if (it != map->end() && it->second.need_update == 1) {
+        it->second.probability = std::max(1, it->second.probability - 1);
+      }
+    }
+    end_voxel.need_update = 1;
+  }
+}
+
+struct BenchResult {
+  double seconds = 0.;
+  size_t voxels = 0;
+  size_t lookups = 0;
+};
+
+template <typename Map>
+BenchResult Run(const std::vector<FrameRays>& frames) {
+  Map map;
+  BenchResult result;
+  const auto start = std::chrono::steady_clock::now();
+  for (const auto& rays : frames) {
+    InsertRays(rays, &map);
+    result.lookups += rays.voxels.size();
+  }
+  result.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  result.voxels = map.size();
+  return result;
+}
+
+// the ray casting alone, 'checksum' keeps the traversal from being optimized
+// out and is the same for both versions
+BenchResult CastVector(const std::vector<FrameRays>& frames,
+                       const float resolution, int64_t* checksum) {
+  BenchResult result;
+  const auto start = std::chrono::steady_clock::now();
+  for (const auto& rays : frames) {
+    for (const auto& end : rays.ends) {
+      const std::vector<KeyInt3> voxels =
+          static_map::common::VoxelCastingBresenham(rays.origin, end,
+                                                    resolution);
+      for (const auto& voxel : voxels) {
+        *checksum += voxel[0] + voxel[1] + voxel[2];
+      }
+      result.lookups += voxels.size();
+    }
+  }
+  result.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  result.voxels = result.lookups;
+  return result;
+}
+
+BenchResult CastVisitor(const std::vector<FrameRays>& frames,
+                        const float resolution, int64_t* checksum) {
+  BenchResult result;
+  const auto start = std::chrono::steady_clock::now();
+  for (const auto& rays : frames) {
+    for (const auto& end : rays.ends) {
+      static_map::common::VisitVoxelsBresenham(
+          rays.origin, end, resolution, [&](const KeyInt3& voxel) {
+            *checksum += voxel[0] + voxel[1] + voxel[2];
+            ++result.lookups;
+            return true;
+          });
+    }
+  }
+  result.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  result.voxels = result.lookups;
+  return result;
+}
+
+void Print(const std::string& name, const BenchResult& result,
+           const BenchResult& baseline) {
+  std::cout << std::left << std::setw(32) << name << std::right
+            << std::setw(12) << std::fixed << std::setprecision(3)
+            << result.seconds << " s" << std::setw(12) << std::setprecision(1)
+            << result.seconds * 1.e9 / result.lookups << " ns/lookup"
+            << std::setw(10) << std::setprecision(2)
+            << baseline.seconds / result.seconds << "x" << std::setw(12)
+            << result.voxels << " voxels" << std::endl;
+}
+
+int main(int argc, char** argv) {
+  Settings settings;
+  pcl::console::parse_argument(argc, argv, "-frames", settings.frames);
+  pcl::console::parse_argument(argc, argv, "-points", settings.points);
+  pcl::console::parse_argument(argc, argv, "-range", settings.range);
+  pcl::console::parse_argument(argc, argv, "-res", settings.resolution);
+  if (pcl::console::find_switch(argc, argv, "-h")) {
+    std::cout << "Should use it this way: \n\n"
+              << "    voxel_map_bench -frames [20] -points [20000] "
+                 "-range [50] -res [0.1]\n"
+              << "\n  the voxel maps of MultiResolutionVoxelMap are fed with "
+                 "the rays of\n  synthetic scans, the rays are cast before "
+                 "timing.\n  the ray casting is timed alone afterwards.\n"
+              << std::endl;
+    return 0;
+  }
+
+  std::mt19937 random(42);
+  std::vector<FrameRays> frames;
+  size_t lookups = 0;
+  for (int i = 0; i < settings.frames; ++i) {
+    frames.push_back(MakeFrame(settings, i, &random));
+    lookups += frames.back().voxels.size();
+  }
+  std::cout << settings.frames << " frames, " << settings.points
+            << " rays each, " << lookups << " voxel lookups in total.\n"
+            << std::endl;
+
+  const BenchResult std_map = Run<StdMap>(frames);
+  Print("std::map", std_map, std_map);
+  Print("std::unordered_map", Run<StdUnorderedMap>(frames), std_map);
+#ifdef _USE_TBB_
+  Print("tbb::concurrent_unordered_map", Run<TbbMap>(frames), std_map);
+#endif
+  Print("common::VoxelHashMap", Run<FlatMap>(frames), std_map);
+
+  std::cout << "\nray casting without insertion:" << std::endl;
+  int64_t vector_checksum = 0;
+  int64_t visitor_checksum = 0;
+  const BenchResult vector_casting =
+      CastVector(frames, settings.resolution, &vector_checksum);
+  const BenchResult visitor_casting =
+      CastVisitor(frames, settings.resolution, &visitor_checksum);
+  CHECK_EQ(vector_checksum, visitor_checksum);
+  Print("VoxelCastingBresenham", vector_casting, vector_casting);
+  Print("VisitVoxelsBresenham", visitor_casting, vector_casting);
+  return 0;
+}